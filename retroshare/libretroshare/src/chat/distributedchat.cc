@@ -27,6 +27,7 @@
 
 #include "util/rsprint.h"
 #include "util/rsmemory.h"
+#include "util/rsdir.h"
 #include "distributedchat.h"
 
 #include "pqi/p3historymgr.h"
@@ -50,10 +51,12 @@ static const rstime_t  		MAX_DELAY_BETWEEN_LOBBY_KEEP_ALIVE  =  120 ; // send ke
 static const rstime_t 		MAX_KEEP_PUBLIC_LOBBY_RECORD        =   60 ; // keep inactive lobbies records for 60 secs max.
 static const rstime_t 		MIN_DELAY_BETWEEN_PUBLIC_LOBBY_REQ  =   20 ; // don't ask for lobby list more than once every 30 secs.
 static const rstime_t 		LOBBY_LIST_AUTO_UPDATE_TIME         =  121 ; // regularly ask for available lobbies every 5 minutes, to allow auto-subscribe to work
+static const rstime_t		MAX_KEEP_SIGNATURE_RECORD           =  120 ; // keep signature check results for 2 minutes. Copies of an object arrive within seconds.
 
 static const uint32_t 		MAX_ALLOWED_LOBBIES_IN_LIST_WARNING =   50 ;
 //static const uint32_t 	MAX_MESSAGES_PER_SECONDS_NUMBER     =    5 ; // max number of messages from a given peer in a window for duration below
 static const uint32_t 		MAX_MESSAGES_PER_SECONDS_PERIOD     =   10 ; // duration window for max number of messages before messages get dropped.
+static const uint32_t 		MAX_LOBBY_ITEM_SIZE                 =32000 ; // max serial size of a lobby item. Bigger ones are dropped.
 
 #define        IS_PUBLIC_LOBBY(flags) (flags & RS_CHAT_LOBBY_FLAGS_PUBLIC    )
 #define    IS_PGP_SIGNED_LOBBY(flags) (flags & RS_CHAT_LOBBY_FLAGS_PGP_SIGNED)
@@ -61,8 +64,52 @@ static const uint32_t 		MAX_MESSAGES_PER_SECONDS_PERIOD     =   10 ; // duration
 
 #define  EXTRACT_PRIVACY_FLAGS(flags) (ChatLobbyFlags(flags.toUInt32()) * (RS_CHAT_LOBBY_FLAGS_PUBLIC | RS_CHAT_LOBBY_FLAGS_PGP_SIGNED))
 
+bool ChatLobbyMsgCache::contains(ChatLobbyMsgId id) const
+{
+	return mLastSeen.find(id) != mLastSeen.end() ;
+}
+
+bool ChatLobbyMsgCache::touch(ChatLobbyMsgId id,rstime_t now)
+{
+	std::pair<std::unordered_map<ChatLobbyMsgId,rstime_t>::iterator,bool> res = mLastSeen.insert(std::make_pair(id,now)) ;
+
+	if(res.second || res.first->second != now)
+	{
+		res.first->second = now ;
+		mSeenOrder.push_back(std::make_pair(now,id)) ;
+	}
+
+	return !res.second ;
+}
+
+void ChatLobbyMsgCache::removeOlderThan(rstime_t limit)
+{
+	while(!mSeenOrder.empty() && mSeenOrder.front().first < limit)
+	{
+		std::unordered_map<ChatLobbyMsgId,rstime_t>::iterator it = mLastSeen.find(mSeenOrder.front().second) ;
+
+		// only remove the id if it hasn't been seen again since this entry was recorded.
+
+		if(it != mLastSeen.end() && it->second == mSeenOrder.front().first)
+			mLastSeen.erase(it) ;
+
+		mSeenOrder.pop_front() ;
+	}
+}
+
+void ChatLobbyMsgCache::getRecentIds(rstime_t min_time,std::list<ChatLobbyMsgId>& ids) const
+{
+	for(std::deque<std::pair<rstime_t,ChatLobbyMsgId> >::const_reverse_iterator it(mSeenOrder.rbegin());it!=mSeenOrder.rend() && it->first >= min_time;++it)
+	{
+		std::unordered_map<ChatLobbyMsgId,rstime_t>::const_iterator it2 = mLastSeen.find(it->second) ;
+
+		if(it2 != mLastSeen.end() && it2->second == it->first)
+			ids.push_back(it->second) ;
+	}
+}
+
 DistributedChatService::DistributedChatService(uint32_t serv_type,p3ServiceControl *sc,p3HistoryMgr *hm, RsGixs *is)
-    : mServType(serv_type),mDistributedChatMtx("Distributed Chat"), mServControl(sc), mHistMgr(hm),mGixs(is)
+    : mServType(serv_type),mDistributedChatMtx("Distributed Chat"), mSignatureCacheMtx("Lobby signatures"), mServControl(sc), mHistMgr(hm),mGixs(is)
 {
     _time_shift_average = 0.0f ;
     _should_reset_lobby_counts = false ;
@@ -135,7 +182,12 @@ bool DistributedChatService::handleRecvChatLobbyMsgItem(RsChatMsgItem *ci)
         std::cerr << std::endl;
         return false ;
     }
-    
+
+	// Copies of the message forwarded by our other friends are dropped here, before checking any signature.
+
+	if(isKnownLobbyObject(cli,cli->PeerId()))
+		return false ;
+
 	if( rsReputations->overallReputationLevel(cli->signature.keyId) ==
 	        RsReputationLevel::LOCALLY_NEGATIVE )
     {
@@ -229,7 +281,10 @@ bool DistributedChatService::checkSignature(RsChatLobbyBouncingObject *obj,const
 
     uint32_t size = RsChatSerialiser(RsSerializationFlags::SIGNATURE)
             .size(dynamic_cast<RsItem*>(obj));
-    RsTemporaryMemory memory(size) ;
+    uint32_t sign_size = obj->signature.signData.bin_len ;
+
+    // the signed data is followed by the key id and the signature, which all together identify the check.
+    RsTemporaryMemory memory(size + RsGxsId::SIZE_IN_BYTES + sign_size) ;
 
 #ifdef DEBUG_CHAT_LOBBIES
     std::cerr << "Checking object signature: " << std::endl;
@@ -243,6 +298,26 @@ bool DistributedChatService::checkSignature(RsChatLobbyBouncingObject *obj,const
 	    return false ;
     }
 
+    memcpy(&memory[size],obj->signature.keyId.toByteArray(),RsGxsId::SIZE_IN_BYTES) ;
+    if(sign_size > 0)
+        memcpy(&memory[size + RsGxsId::SIZE_IN_BYTES],obj->signature.signData.bin_data,sign_size) ;
+
+    Sha1CheckSum check_hash = RsDirUtil::sha1sum(memory,size + RsGxsId::SIZE_IN_BYTES + sign_size) ;
+
+    {
+        RS_STACK_MUTEX(mSignatureCacheMtx) ;
+
+        std::map<Sha1CheckSum,std::pair<bool,rstime_t> >::const_iterator it = mSignatureCache.find(check_hash) ;
+
+        if(it != mSignatureCache.end())
+        {
+#ifdef DEBUG_CHAT_LOBBIES
+            std::cerr << "  signature already checked: " << (it->second.first?"OK":"FAILED") << std::endl;
+#endif
+            return it->second.first ;
+        }
+    }
+
     uint32_t error_status ;
     RsIdentityUsage use_info(RsServiceType::CHAT,
                              RsIdentityUsage::CHAT_LOBBY_MSG_VALIDATION,
@@ -266,6 +341,10 @@ bool DistributedChatService::checkSignature(RsChatLobbyBouncingObject *obj,const
 		    break ;
 	    case RsGixs::RS_GIXS_ERROR_SIGNATURE_MISMATCH: std::cerr << "(EE) Signature mismatch. Spoofing/MITM?." << std::endl;
 		    res =false ;
+		    {
+			    RS_STACK_MUTEX(mSignatureCacheMtx) ;
+			    mSignatureCache[check_hash] = std::make_pair(false,time(NULL)) ;
+		    }
 		    break ;
 	    default: break ;
 	    }
@@ -277,6 +356,11 @@ bool DistributedChatService::checkSignature(RsChatLobbyBouncingObject *obj,const
     std::cerr << "  signature: CHECKS" << std::endl;
 #endif
 
+    {
+        RS_STACK_MUTEX(mSignatureCacheMtx) ;
+        mSignatureCache[check_hash] = std::make_pair(true,time(NULL)) ;
+    }
+
     return true ;
 }
 
@@ -322,7 +406,7 @@ void DistributedChatService::locked_printDebugInfo() const
 		std::cerr << "   Last activity\t: " << now - it->second.last_activity << " seconds ago." << std::endl;
 		std::cerr << "   Cached messages\t: " << it->second.msg_cache.size() << std::endl;
 
-		for(std::map<ChatLobbyMsgId,rstime_t>::const_iterator it2(it->second.msg_cache.begin());it2!=it->second.msg_cache.end();++it2)
+		for(ChatLobbyMsgCache::const_iterator it2(it->second.msg_cache.begin());it2!=it->second.msg_cache.end();++it2)
 			std::cerr << "       " << std::hex << it2->first << std::dec << "  time=" << now - it2->second << " secs ago" << std::endl;
 
 		std::cerr << "   Participating friends: " << std::endl;
@@ -426,9 +510,7 @@ void DistributedChatService::checkSizeAndSendLobbyMessage(RsChatItem *msg)
     //    3 - it is unreliable since items are not guarrantied to all arrive in the end (cannot be fixed)
     //    4 - large objects can be used to corrupt end peers (cannot be fixed)
     //
-    static const uint32_t MAX_ITEM_SIZE = 32000 ;
-
-    if(RsChatSerialiser().size(msg) > MAX_ITEM_SIZE)
+    if(RsChatSerialiser().size(msg) > MAX_LOBBY_ITEM_SIZE)
     {
         std::cerr << "(EE) Chat item exceeds maximum serial size. It will be dropped." << std::endl;
         delete msg ;
@@ -694,6 +776,9 @@ void DistributedChatService::handleRecvChatLobbyEventItem(RsChatLobbyEventItem *
 #endif
 	rstime_t now = time(nullptr);
 
+	if(isKnownLobbyObject(item,item->PeerId()))
+		return ;
+
 	if( rsReputations->overallReputationLevel(item->signature.keyId) ==
 	         RsReputationLevel::LOCALLY_NEGATIVE )
 	{
@@ -856,6 +941,30 @@ void DistributedChatService::getListOfNearbyChatLobbies(std::vector<VisibleChatL
 	}
 }
 
+bool DistributedChatService::isKnownLobbyObject(RsChatLobbyBouncingObject *item,const RsPeerId& peer_id)
+{
+	rstime_t now = time(NULL) ;
+	RsStackMutex stack(mDistributedChatMtx); /********** STACK LOCKED MTX ******/
+
+	std::map<ChatLobbyId,ChatLobbyEntry>::iterator it(_chat_lobbys.find(item->lobby_id)) ;
+
+	if(it == _chat_lobbys.end() || !it->second.msg_cache.contains(item->msg_id))
+		return false ;
+
+	// Same as in bounceLobbyObject(): the friend participates to the lobby, and the last msg seen time is updated, to prevent echos.
+	// The signature of the copy is not checked, so nothing else from it is used.
+
+	if(peer_id != mServControl->getOwnId())
+		it->second.participating_friends.insert(peer_id) ;
+
+	it->second.msg_cache.touch(item->msg_id,now) ;
+
+#ifdef DEBUG_CHAT_LOBBIES
+	std::cerr << "  Msg " << std::hex << item->msg_id << std::dec << " already received. Dropping before signature check." << std::endl ;
+#endif
+	return true ;
+}
+
 // returns:
 // 	true: the object is not a duplicate and should be used
 // 	false: the object is a duplicate or there is an error, and it should be destroyed.
@@ -863,73 +972,78 @@ void DistributedChatService::getListOfNearbyChatLobbies(std::vector<VisibleChatL
 bool DistributedChatService::bounceLobbyObject(RsChatLobbyBouncingObject *item,const RsPeerId& peer_id)
 {
 	rstime_t now = time(NULL) ;
-	RsStackMutex stack(mDistributedChatMtx); /********** STACK LOCKED MTX ******/
+	std::set<RsPeerId> forward_peers ;
+
+	{
+		RsStackMutex stack(mDistributedChatMtx); /********** STACK LOCKED MTX ******/
 #ifdef DEBUG_CHAT_LOBBIES
-	locked_printDebugInfo() ; // debug
+		locked_printDebugInfo() ; // debug
 
-	std::cerr << "Handling ChatLobbyMsg " << std::hex << item->msg_id << ", lobby id " << item->lobby_id << ", from peer id " << peer_id << std::endl;
+		std::cerr << "Handling ChatLobbyMsg " << std::hex << item->msg_id << ", lobby id " << item->lobby_id << ", from peer id " << peer_id << std::endl;
 #endif
 
-	// send upward for display
+		// send upward for display
 
-	std::map<ChatLobbyId,ChatLobbyEntry>::iterator it(_chat_lobbys.find(item->lobby_id)) ;
+		std::map<ChatLobbyId,ChatLobbyEntry>::iterator it(_chat_lobbys.find(item->lobby_id)) ;
 
-	if(it == _chat_lobbys.end())
-	{
+		if(it == _chat_lobbys.end())
+		{
 #ifdef DEBUG_CHAT_LOBBIES
-		std::cerr << "Chatlobby for id " << std::hex << item->lobby_id << " has no record. Dropping the msg." << std::dec << std::endl;
+			std::cerr << "Chatlobby for id " << std::hex << item->lobby_id << " has no record. Dropping the msg." << std::dec << std::endl;
 #endif
-		return false ;
-	}
-
-	ChatLobbyEntry& lobby(it->second) ;
+			return false ;
+		}
 
-	// Adds the peer id to the list of friend participants, even if it's not original msg source
+		ChatLobbyEntry& lobby(it->second) ;
 
-	if(peer_id != mServControl->getOwnId())
-		lobby.participating_friends.insert(peer_id) ;
+		// Adds the peer id to the list of friend participants, even if it's not original msg source
 
-	lobby.gxs_ids[item->signature.keyId] = now ;
+		if(peer_id != mServControl->getOwnId())
+			lobby.participating_friends.insert(peer_id) ;
 
-	// Checks wether the msg is already recorded or not
+		lobby.gxs_ids[item->signature.keyId] = now ;
 
-	std::map<ChatLobbyMsgId,rstime_t>::iterator it2(lobby.msg_cache.find(item->msg_id)) ;
+		// Checks wether the msg is already recorded or not. Either way, the last msg seen time is updated, to prevent echos.
 
-	if(it2 != lobby.msg_cache.end()) // found!
-	{
+		if(lobby.msg_cache.touch(item->msg_id,now)) // found!
+		{
 #ifdef DEBUG_CHAT_LOBBIES
-		std::cerr << "  Msg already received at time " << it2->second << ". Dropping!" << std::endl ;
+			std::cerr << "  Msg already received. Dropping!" << std::endl ;
 #endif
-		it2->second = now ;	// update last msg seen time, to prevent echos.
-		return false ;
-	}
+			return false ;
+		}
 #ifdef DEBUG_CHAT_LOBBIES
-	std::cerr << "  Msg not received already. Adding in cache, and forwarding!" << std::endl ;
+		std::cerr << "  Msg not received already. Adding in cache, and forwarding!" << std::endl ;
 #endif
 
-	lobby.msg_cache[item->msg_id] = now ;
-	lobby.last_activity = now ;
+		lobby.last_activity = now ;
 
-	// Check that if we have a lobby bouncing object, it's not flooding the lobby
-	if(!locked_bouncingObjectCheck(item,peer_id,lobby.participating_friends.size()))
-		return false;
+		// Check that if we have a lobby bouncing object, it's not flooding the lobby
+		if(!locked_bouncingObjectCheck(item,peer_id,lobby.participating_friends.size()))
+			return false;
 
-	// Forward to allparticipating friends, except this peer.
+		// Forward to allparticipating friends, except this peer.
 
-	for(std::set<RsPeerId>::const_iterator it(lobby.participating_friends.begin());it!=lobby.participating_friends.end();++it)
-		if((*it)!=peer_id && mServControl->isPeerConnected(mServType, *it)) 
-		{
-			RsChatLobbyBouncingObject *obj2 = item->duplicate() ; // makes a copy
-			RsChatItem *item2 = dynamic_cast<RsChatItem*>(obj2) ;
+		for(std::set<RsPeerId>::const_iterator it(lobby.participating_friends.begin());it!=lobby.participating_friends.end();++it)
+			if((*it)!=peer_id && mServControl->isPeerConnected(mServType, *it))
+				forward_peers.insert(*it) ;
 
-			assert(item2 != NULL) ;
+		++lobby.connexion_challenge_count ;
+	}
 
-			item2->PeerId(*it) ;	// replaces the virtual peer id with the actual destination.
+	// The object is serialised once, and the same data is queued for all friends.
 
-            checkSizeAndSendLobbyMessage(item2) ;
-		}
+	if(!forward_peers.empty())
+	{
+		RsChatItem *citem = dynamic_cast<RsChatItem*>(item) ;
+
+		assert(citem != NULL) ;
 
-	++lobby.connexion_challenge_count ;
+		if(RsChatSerialiser().size(citem) > MAX_LOBBY_ITEM_SIZE)
+			std::cerr << "(EE) Chat item exceeds maximum serial size. It will be dropped." << std::endl;
+		else
+			sendChatItemToPeers(citem,forward_peers) ;
+	}
 
 	return true ;
 }
@@ -1004,7 +1118,7 @@ bool DistributedChatService::locked_initLobbyBouncableObject(const ChatLobbyId&
 	{ 
 		item.msg_id	= RSRandom::random_u64(); 
 	} 
-	while( lobby.msg_cache.find(item.msg_id) != lobby.msg_cache.end() ) ;
+	while( lobby.msg_cache.contains(item.msg_id) ) ;
 
 	RsIdentityDetails details ;
 	if(!rsIdentity || !rsIdentity->getIdDetails(lobby.gxs_id,details))
@@ -1127,27 +1241,31 @@ void DistributedChatService::handleConnectionChallenge(RsChatLobbyConnectChallen
 		RsStackMutex stack(mDistributedChatMtx); /********** STACK LOCKED MTX ******/
 
 		for(std::map<ChatLobbyId,ChatLobbyEntry>::iterator it(_chat_lobbys.begin());it!=_chat_lobbys.end() && !found;++it)
-			for(std::map<ChatLobbyMsgId,rstime_t>::const_iterator it2(it->second.msg_cache.begin());it2!=it->second.msg_cache.end() && !found;++it2)
-				if(it2->second + CONNECTION_CHALLENGE_MAX_MSG_AGE + 5 > now)  // any msg not older than 5 seconds plus max challenge count is fine.
-				{
-					uint64_t code = makeConnexionChallengeCode(ownId,it->first,it2->first) ;
+		{
+			std::list<ChatLobbyMsgId> recent_ids ;
+			it->second.msg_cache.getRecentIds(now - CONNECTION_CHALLENGE_MAX_MSG_AGE - 5,recent_ids) ; // any msg not older than 5 seconds plus max challenge count is fine.
+
+			for(std::list<ChatLobbyMsgId>::const_iterator it2(recent_ids.begin());it2!=recent_ids.end() && !found;++it2)
+			{
+				uint64_t code = makeConnexionChallengeCode(ownId,it->first,*it2) ;
 #ifdef DEBUG_CHAT_LOBBIES
-					std::cerr << "    Lobby_id = 0x" << std::hex << it->first << ", msg_id = 0x" << it2->first << ": code = 0x" << code << std::dec << std::endl ;
+				std::cerr << "    Lobby_id = 0x" << std::hex << it->first << ", msg_id = 0x" << *it2 << ": code = 0x" << code << std::dec << std::endl ;
 #endif
-					if(code == item->challenge_code)
-					{
+				if(code == item->challenge_code)
+				{
 #ifdef DEBUG_CHAT_LOBBIES
-						std::cerr << "    Challenge accepted for lobby " << std::hex << it->first << ", for chat msg " << it2->first << std::dec << std::endl ;
-						std::cerr << "    Sending connection request to peer " << item->PeerId() << std::endl;
+					std::cerr << "    Challenge accepted for lobby " << std::hex << it->first << ", for chat msg " << *it2 << std::dec << std::endl ;
+					std::cerr << "    Sending connection request to peer " << item->PeerId() << std::endl;
 #endif
 
-						lobby_id = it->first ;
-						found = true ;
+					lobby_id = it->first ;
+					found = true ;
 
-						// also add the peer to the list of participating friends
-						it->second.participating_friends.insert(item->PeerId()) ; 
-					}
+					// also add the peer to the list of participating friends
+					it->second.participating_friends.insert(item->PeerId()) ; 
 				}
+			}
+		}
 	}
 
 	if(found) // send invitation. As the peer already has the lobby, the invitation will most likely be accepted.
@@ -1179,15 +1297,16 @@ void DistributedChatService::sendConnectionChallenge(ChatLobbyId lobby_id)
 	rstime_t now = time(NULL) ;
 	ChatLobbyMsgId msg_id = 0 ;
 
-	for(std::map<ChatLobbyMsgId,rstime_t>::const_iterator it2(it->second.msg_cache.begin());it2!=it->second.msg_cache.end();++it2)
-		if(it2->second + CONNECTION_CHALLENGE_MAX_MSG_AGE > now)  // any msg not older than 20 seconds is fine.
-		{
-			msg_id = it2->first ;
+	std::list<ChatLobbyMsgId> recent_ids ;
+	it->second.msg_cache.getRecentIds(now - CONNECTION_CHALLENGE_MAX_MSG_AGE + 1,recent_ids) ;  // any msg not older than 20 seconds is fine.
+
+	if(!recent_ids.empty())
+	{
+		msg_id = recent_ids.front() ;
 #ifdef DEBUG_CHAT_LOBBIES
-			std::cerr << "  Using msg id 0x" << std::hex << it2->first << std::dec << std::endl; 
+		std::cerr << "  Using msg id 0x" << std::hex << msg_id << std::dec << std::endl; 
 #endif
-			break ;
-		}
+	}
 
 	if(msg_id == 0)
 	{
@@ -1913,6 +2032,18 @@ void DistributedChatService::cleanLobbyCaches()
 	std::list<ChatLobbyId> send_challenge_lobbies ;
 	std::list<ChatLobbyId> joined_lobby_ids ;
 
+	{
+		RS_STACK_MUTEX(mSignatureCacheMtx) ;
+
+		rstime_t now = time(NULL) ;
+
+		for(std::map<Sha1CheckSum,std::pair<bool,rstime_t> >::iterator it(mSignatureCache.begin());it!=mSignatureCache.end();)
+			if(it->second.second + MAX_KEEP_SIGNATURE_RECORD < now)
+				it = mSignatureCache.erase(it) ;
+			else
+				++it ;
+	}
+
 	{
 		RsStackMutex stack(mDistributedChatMtx); /********** STACK LOCKED MTX ******/
 
@@ -1922,20 +2053,7 @@ void DistributedChatService::cleanLobbyCaches()
 		{
 			// 1 - remove old messages
 			//
-			for(std::map<ChatLobbyMsgId,rstime_t>::iterator it2(it->second.msg_cache.begin());it2!=it->second.msg_cache.end();)
-				if(it2->second + MAX_KEEP_MSG_RECORD < now)
-				{
-#ifdef DEBUG_CHAT_LOBBIES
-					std::cerr << "  removing old msg 0x" << std::hex << it2->first << ", time=" << std::dec << now - it2->second << " secs ago" << std::endl;
-#endif
-
-					std::map<ChatLobbyMsgId,rstime_t>::iterator tmp(it2) ;
-					++tmp ;
-					it->second.msg_cache.erase(it2) ;
-					it2 = tmp ;
-				}
-				else
-					++it2 ;
+			it->second.msg_cache.removeOlderThan(now - MAX_KEEP_MSG_RECORD) ;
 
 			bool changed = false ;
 
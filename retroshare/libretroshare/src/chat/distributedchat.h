@@ -25,6 +25,9 @@
 #include <retroshare/rsmsgs.h>
 #include <retroshare/rsservicecontrol.h>
 
+#include <deque>
+#include <unordered_map>
+
 typedef RsPeerId ChatLobbyVirtualPeerId ;
 
 struct RsItem;
@@ -46,6 +49,34 @@ class RsChatItem ;
 class RsChatMsgItem ;
 class RsGixs ;
 
+// Ids of the lobby messages seen recently, with the last time each one was seen.
+// Lookups are hashed, and the ids are also kept in the order they were seen, so
+// that expiring old ids and finding recent ones only touches the entries concerned.
+//
+class ChatLobbyMsgCache
+{
+	public:
+		bool contains(ChatLobbyMsgId id) const ;
+
+		/// Records id as seen at time now. Returns true if it was already known.
+		bool touch(ChatLobbyMsgId id,rstime_t now) ;
+
+		void removeOlderThan(rstime_t limit) ;
+
+		/// Ids last seen at or after min_time, most recent first.
+		void getRecentIds(rstime_t min_time,std::list<ChatLobbyMsgId>& ids) const ;
+
+		size_t size() const { return mLastSeen.size() ; }
+
+		typedef std::unordered_map<ChatLobbyMsgId,rstime_t>::const_iterator const_iterator ;
+		const_iterator begin() const { return mLastSeen.begin() ; }
+		const_iterator end() const { return mLastSeen.end() ; }
+
+	private:
+		std::unordered_map<ChatLobbyMsgId,rstime_t> mLastSeen ;
+		std::deque<std::pair<rstime_t,ChatLobbyMsgId> > mSeenOrder ;	// may hold outdated entries for ids seen again since
+};
+
 class DistributedChatService
 {
 	public:
@@ -83,6 +114,7 @@ class DistributedChatService
 		bool handleRecvItem(RsChatItem *) ;
 
 		virtual void sendChatItem(RsChatItem *) =0 ;
+		virtual void sendChatItemToPeers(RsChatItem *,const std::set<RsPeerId>& peers) =0 ;
 		virtual void locked_storeIncomingMsg(RsChatMsgItem *) =0 ;
 		virtual void triggerConfigSave() =0;
 
@@ -96,6 +128,10 @@ class DistributedChatService
 
 		bool checkSignature(RsChatLobbyBouncingObject *obj,const RsPeerId& peer_id) ;
 
+		/// Cheap check, done before any signature verification: true if the object was
+		/// already received (and forwarded) through another friend.
+		bool isKnownLobbyObject(RsChatLobbyBouncingObject *obj,const RsPeerId& peer_id) ;
+
 	private:
 		/// make some statistics about time shifts, to prevent various issues. 
 		void addTimeShiftStatistics(int shift) ;
@@ -135,7 +171,7 @@ class DistributedChatService
 		class ChatLobbyEntry: public ChatLobbyInfo
 		{
 			public:
-				std::map<ChatLobbyMsgId,rstime_t> msg_cache ;
+				ChatLobbyMsgCache msg_cache ;
 				RsPeerId virtual_peer_id ;
 				int connexion_challenge_count ;
 				rstime_t last_connexion_challenge_time ;
@@ -162,6 +198,11 @@ class DistributedChatService
 		uint32_t mServType ;
 		RsMutex mDistributedChatMtx ;
 
+		// Outcome of the signature checks, indexed by the hash of the signed data and signature,
+		// so that copies of a same object that are not dropped early are not verified twice.
+		RsMutex mSignatureCacheMtx ;
+		std::map<Sha1CheckSum,std::pair<bool,rstime_t> > mSignatureCache ;
+
 		p3ServiceControl *mServControl; 
 		p3HistoryMgr *mHistMgr;
 		RsGixs *mGixs ;
@@ -264,6 +264,13 @@ void p3ChatService::sendChatItem(RsChatItem *item)
 	sendItem(item);
 }
 
+void p3ChatService::sendChatItemToPeers(RsChatItem *item,const std::set<RsPeerId>& peers)
+{
+	// Only lobby items are sent this way, to friends, so there is no distant chat tunnel to look for.
+
+	sendItemToPeers(item,peers);
+}
+
 void p3ChatService::checkSizeAndSendMessage(RsChatMsgItem *msg)
 {
 	// We check the message item, and possibly split it into multiple messages, if the message is too big.
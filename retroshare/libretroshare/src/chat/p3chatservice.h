@@ -225,6 +225,7 @@ private:
 	void handleIncomingItem(RsItem *);	// called by the former, and turtle handler for incoming encrypted items
 
 	virtual void sendChatItem(RsChatItem *) ;
+	virtual void sendChatItemToPeers(RsChatItem *,const std::set<RsPeerId>& peers) ;
 
 	void initChatMessage(RsChatMsgItem *c, ChatMessage& msg);
 
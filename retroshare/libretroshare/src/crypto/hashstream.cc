@@ -42,6 +42,27 @@ namespace librs
 		if(mdctx)
 			EVP_MD_CTX_destroy(mdctx) ;
 	}
+	HashStream::HashStream(const HashStream& h) : mdctx(NULL)
+	{
+		*this = h ;
+	}
+	HashStream& HashStream::operator=(const HashStream& h)
+	{
+		if(this == &h)
+			return *this ;
+
+		if(!mdctx)
+			mdctx = EVP_MD_CTX_create();
+
+		if(h.mdctx)
+			EVP_MD_CTX_copy_ex(mdctx,h.mdctx) ;
+		else
+		{
+			EVP_MD_CTX_destroy(mdctx) ;
+			mdctx = NULL ;
+		}
+		return *this ;
+	}
 
 	Sha1CheckSum HashStream::hash()
 	{
@@ -52,10 +73,16 @@ namespace librs
 		EVP_MD_CTX_destroy(mdctx) ;
 		mdctx=NULL ;
 
-		return Sha1CheckSum(h);
+		return Sha1CheckSum::fromBufferUnsafe(h);
 	}
     template<>
     HashStream& operator<<(HashStream& u,const std::pair<unsigned char *,uint32_t>& p)
+    {
+        EVP_DigestUpdate(u.mdctx,p.first,p.second) ;
+        return u;
+    }
+    template<>
+    HashStream& operator<<(HashStream& u,const std::pair<const unsigned char *,uint32_t>& p)
     {
         EVP_DigestUpdate(u.mdctx,p.first,p.second) ;
         return u;
@@ -43,6 +43,11 @@ namespace librs
 			HashStream(HashType t);
 			~HashStream();
 
+			/// Copies the state, so that a hash can be finished while the
+			/// original one is fed further.
+			HashStream(const HashStream& h);
+			HashStream& operator=(const HashStream& h);
+
 			Sha1CheckSum hash() ;
 
 			template<class T> friend HashStream& operator<<(HashStream& u, const T&) ;
@@ -1050,12 +1050,20 @@ bool InternalFileHierarchyStorage::save(const std::string& fname)
 
     uint32_t tmp_section_size = FL_BASE_TMP_SECTION_SIZE ;
 
+    // Each entry is handed to the container as soon as it is serialised, so that the whole
+    // file list is never held in memory, and the chunks that did not change are not written again.
+
+    FileListContainerWriter writer ;
+
     try
     {
+        if(!writer.open(fname)) throw std::runtime_error("Cannot open " + fname) ;
+
         // Write some header
 
         if(!FileListIO::writeField(buffer,buffer_size,buffer_offset,FILE_LIST_IO_TAG_LOCAL_DIRECTORY_VERSION,(uint32_t) FILE_LIST_IO_LOCAL_DIRECTORY_STORAGE_VERSION_0001)) throw std::runtime_error("Write error") ;
         if(!FileListIO::writeField(buffer,buffer_size,buffer_offset,FILE_LIST_IO_TAG_RAW_NUMBER,(uint32_t) mNodes.size())) throw std::runtime_error("Write error") ;
+        if(!writer.write(buffer,buffer_offset)) throw std::runtime_error("Write error") ;
 
         // Write all file/dir entries
 
@@ -1074,7 +1082,10 @@ bool InternalFileHierarchyStorage::save(const std::string& fname)
                 if(!FileListIO::writeField(tmp_section_data,tmp_section_size,file_section_offset,FILE_LIST_IO_TAG_FILE_SHA1_HASH,fe.file_hash             )) throw std::runtime_error("Write error") ;
                 if(!FileListIO::writeField(tmp_section_data,tmp_section_size,file_section_offset,FILE_LIST_IO_TAG_MODIF_TS      ,(uint32_t)fe.file_modtime)) throw std::runtime_error("Write error") ;
 
+                buffer_offset = 0 ;
+
                 if(!FileListIO::writeField(buffer,buffer_size,buffer_offset,FILE_LIST_IO_TAG_LOCAL_FILE_ENTRY,tmp_section_data,file_section_offset)) throw std::runtime_error("Write error") ;
+                if(!writer.write(buffer,buffer_offset)) throw std::runtime_error("Write error") ;
             }
             else if(mNodes[i] != NULL && mNodes[i]->type() == FileStorageNode::TYPE_DIR)
             {
@@ -1102,10 +1113,13 @@ bool InternalFileHierarchyStorage::save(const std::string& fname)
                 for(uint32_t j=0;j<de.subfiles.size();++j)
                     if(!FileListIO::writeField(tmp_section_data,tmp_section_size,dir_section_offset,FILE_LIST_IO_TAG_RAW_NUMBER,(uint32_t)de.subfiles[j])) throw std::runtime_error("Write error") ;
 
+                buffer_offset = 0 ;
+
                 if(!FileListIO::writeField(buffer,buffer_size,buffer_offset,FILE_LIST_IO_TAG_LOCAL_DIR_ENTRY,tmp_section_data,dir_section_offset)) throw std::runtime_error("Write error") ;
+                if(!writer.write(buffer,buffer_offset)) throw std::runtime_error("Write error") ;
             }
 
-        bool res = FileListIO::saveEncryptedDataToFile(fname,buffer,buffer_offset) ;
+        bool res = writer.close() ;
 
         free(buffer) ;
         free(tmp_section_data) ;
@@ -1128,9 +1142,7 @@ bool InternalFileHierarchyStorage::save(const std::string& fname)
 
 bool InternalFileHierarchyStorage::load(const std::string& fname)
 {
-    unsigned char *buffer = NULL ;
-    uint32_t buffer_size = 0 ;
-    uint32_t buffer_offset = 0 ;
+    FileListContainerReader reader ;
 
     mFreeNodes.clear();
     mTotalFiles = 0;
@@ -1138,17 +1150,17 @@ bool InternalFileHierarchyStorage::load(const std::string& fname)
 
     try
     {
-        if(!FileListIO::loadEncryptedDataFromFile(fname,buffer,buffer_size) )
+        if(!reader.open(fname))
             throw read_error("Cannot decrypt") ;
 
         // Read some header
 
         uint32_t version, n_nodes ;
 
-        if(!FileListIO::readField(buffer,buffer_size,buffer_offset,FILE_LIST_IO_TAG_LOCAL_DIRECTORY_VERSION,version)) throw read_error(buffer,buffer_size,buffer_offset,FILE_LIST_IO_TAG_LOCAL_DIRECTORY_VERSION) ;
+        if(!FileListIO::readField(reader,FILE_LIST_IO_TAG_LOCAL_DIRECTORY_VERSION,version)) throw read_error(reader.data(),reader.available(),0,FILE_LIST_IO_TAG_LOCAL_DIRECTORY_VERSION) ;
         if(version != (uint32_t) FILE_LIST_IO_LOCAL_DIRECTORY_STORAGE_VERSION_0001) throw std::runtime_error("Wrong version number") ;
 
-        if(!FileListIO::readField(buffer,buffer_size,buffer_offset,FILE_LIST_IO_TAG_RAW_NUMBER,n_nodes)) throw read_error(buffer,buffer_size,buffer_offset,FILE_LIST_IO_TAG_RAW_NUMBER) ;
+        if(!FileListIO::readField(reader,FILE_LIST_IO_TAG_RAW_NUMBER,n_nodes)) throw read_error(reader.data(),reader.available(),0,FILE_LIST_IO_TAG_RAW_NUMBER) ;
 
         // Write all file/dir entries
 
@@ -1159,16 +1171,16 @@ bool InternalFileHierarchyStorage::load(const std::string& fname)
         mNodes.clear();
         mNodes.resize(n_nodes,NULL) ;
 
-        for(uint32_t i=0;i<mNodes.size() && buffer_offset < buffer_size;++i)	// only the 2nd condition really is needed. The first one ensures that the loop wont go forever.
+        for(uint32_t i=0;i<mNodes.size() && !reader.eof();++i)	// only the 2nd condition really is needed. The first one ensures that the loop wont go forever.
         {
             unsigned char *node_section_data = NULL ;
             uint32_t node_section_size = 0 ;
             uint32_t node_section_offset = 0 ;
 #ifdef DEBUG_DIRECTORY_STORAGE
-            std::cerr << "reading node " << i << ", offset " << buffer_offset << " : " << RsUtil::BinToHex(&buffer[buffer_offset],std::min((int)buffer_size - (int)buffer_offset,100)) << "..." << std::endl;
+            std::cerr << "reading node " << i << " : " << RsUtil::BinToHex(reader.data(),std::min(reader.available(),100u)) << "..." << std::endl;
 #endif
 
-            if(FileListIO::readField(buffer,buffer_size,buffer_offset,FILE_LIST_IO_TAG_LOCAL_FILE_ENTRY,node_section_data,node_section_size))
+            if(FileListIO::readField(reader,FILE_LIST_IO_TAG_LOCAL_FILE_ENTRY,node_section_data,node_section_size))
             {
                 uint32_t node_index ;
                 std::string file_name ;
@@ -1200,7 +1212,7 @@ bool InternalFileHierarchyStorage::load(const std::string& fname)
                 mTotalFiles++ ;
                 mTotalSize += file_size ;
             }
-            else if(FileListIO::readField(buffer,buffer_size,buffer_offset,FILE_LIST_IO_TAG_LOCAL_DIR_ENTRY,node_section_data,node_section_size))
+            else if(FileListIO::readField(reader,FILE_LIST_IO_TAG_LOCAL_DIR_ENTRY,node_section_data,node_section_size))
             {
                 uint32_t node_index ;
                 std::string dir_name ;
@@ -1260,11 +1272,10 @@ bool InternalFileHierarchyStorage::load(const std::string& fname)
                 mDirHashes[de->dir_hash] = node_index ;
             }
             else
-                throw read_error(buffer,buffer_size,buffer_offset,FILE_LIST_IO_TAG_LOCAL_FILE_ENTRY) ;
+                throw read_error(reader.data(),reader.available(),0,FILE_LIST_IO_TAG_LOCAL_FILE_ENTRY) ;
 
             free(node_section_data) ;
         }
-        free(buffer) ;
 
         std::string err_str ;
 
@@ -1280,9 +1291,6 @@ bool InternalFileHierarchyStorage::load(const std::string& fname)
 #ifdef DEBUG_DIRECTORY_STORAGE
         std::cerr << "Error while reading: " << e.what() << std::endl;
 #endif
-
-        if(buffer != NULL)
-            free(buffer) ;
         return false;
     }
 }
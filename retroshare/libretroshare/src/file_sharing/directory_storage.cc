@@ -1078,5 +1078,142 @@ int RemoteDirectoryStorage::searchHash(const RsFileHash& hash, EntryIndex& resul
     return mFileHierarchy->searchHash(hash,result);
 }
 
+bool RemoteDirectoryStorage::checkFileHash(const EntryIndex& indx,const RsFileHash& hash) const
+{
+    RS_STACK_MUTEX(mDirStorageMtx) ;
+
+    // Do not use checkIndex() here: stale indices are expected, and it would complain about them.
+
+    if(indx >= mFileHierarchy->mNodes.size() || mFileHierarchy->mNodes[indx] == NULL || mFileHierarchy->mNodes[indx]->type() != InternalFileHierarchyStorage::FileStorageNode::TYPE_FILE)
+        return false ;
+
+    return static_cast<const InternalFileHierarchyStorage::FileEntry*>(mFileHierarchy->mNodes[indx])->file_hash == hash ;
+}
+
+void RemoteDirectoryStorage::getFileHashes(EntryIndex indx,std::vector<std::pair<RsFileHash,EntryIndex> >& hashes) const
+{
+    RS_STACK_MUTEX(mDirStorageMtx) ;
+
+    const std::vector<InternalFileHierarchyStorage::FileStorageNode*>& nodes(mFileHierarchy->mNodes) ;
+
+    if(indx == NO_INDEX)
+    {
+        for(uint32_t i=0;i<nodes.size();++i)
+            if(nodes[i] != NULL && nodes[i]->type() == InternalFileHierarchyStorage::FileStorageNode::TYPE_FILE)
+            {
+                const RsFileHash& h(static_cast<const InternalFileHierarchyStorage::FileEntry*>(nodes[i])->file_hash) ;
+
+                if(!h.isNull())
+                    hashes.push_back(std::make_pair(h,EntryIndex(i))) ;
+            }
+        return ;
+    }
+
+    const InternalFileHierarchyStorage::DirEntry *d = mFileHierarchy->getDirEntry(indx) ;
 
+    if(!d)
+        return ;
 
+    for(uint32_t i=0;i<d->subfiles.size();++i)
+    {
+        const InternalFileHierarchyStorage::FileEntry *f = mFileHierarchy->getFileEntry(d->subfiles[i]) ;
+
+        if(f != NULL && !f->file_hash.isNull())
+            hashes.push_back(std::make_pair(f->file_hash,d->subfiles[i])) ;
+    }
+}
+
+/******************************************************************************************************************/
+/*                                           Remote File Hash Index                                               */
+/******************************************************************************************************************/
+
+void RemoteFileHashIndex::indexFiles(const RemoteDirectoryStorage *rds,EntryIndex dir_index)
+{
+    std::vector<std::pair<RsFileHash,EntryIndex> > hashes ;
+    rds->getFileHashes(dir_index,hashes) ;
+
+    for(uint32_t i=0;i<hashes.size();++i)
+    {
+        std::vector<Entry>& entries(mIndex[hashes[i].first]) ;
+        uint32_t j=0;
+
+        while(j < entries.size() && entries[j].peer_id != rds->peerId())
+            ++j ;
+
+        if(j == entries.size())
+        {
+            entries.push_back(Entry()) ;
+            entries.back().peer_id = rds->peerId() ;
+        }
+
+        entries[j].index = hashes[i].second ;
+    }
+}
+
+bool RemoteFileHashIndex::checkEntry(const RsFileHash& hash,Entry& e,const ListFinder& find_list)
+{
+    const RemoteDirectoryStorage *rds = find_list(e.peer_id) ;
+
+    if(rds == NULL)
+        return false ;
+
+    // The file may have moved to another index in the same list, in which case the friend's own hash map knows where.
+
+    return rds->checkFileHash(e.index,hash) || rds->searchHash(hash,e.index) ;
+}
+
+bool RemoteFileHashIndex::findSources(const RsFileHash& hash,const ListFinder& find_list,std::list<RsPeerId>& peers)
+{
+    std::map<RsFileHash,std::vector<Entry> >::iterator it = mIndex.find(hash) ;
+
+    if(it == mIndex.end())
+        return false ;
+
+    std::vector<Entry>& entries(it->second) ;
+    bool found = false ;
+
+    for(uint32_t i=0;i<entries.size();)
+        if(checkEntry(hash,entries[i],find_list))
+        {
+            peers.push_back(entries[i].peer_id) ;
+            found = true ;
+            ++i ;
+        }
+        else
+        {
+            entries[i] = entries.back() ;	// the file is not at this friend anymore
+            entries.pop_back() ;
+        }
+
+    if(entries.empty())
+        mIndex.erase(it) ;
+
+    return found ;
+}
+
+uint32_t RemoteFileHashIndex::check(const ListFinder& find_list)
+{
+    uint32_t nb_removed = 0 ;
+
+    for(std::map<RsFileHash,std::vector<Entry> >::iterator it(mIndex.begin());it!=mIndex.end();)
+    {
+        std::vector<Entry>& entries(it->second) ;
+
+        for(uint32_t i=0;i<entries.size();)
+            if(checkEntry(it->first,entries[i],find_list))
+                ++i ;
+            else
+            {
+                entries[i] = entries.back() ;
+                entries.pop_back() ;
+                ++nb_removed ;
+            }
+
+        if(entries.empty())
+            it = mIndex.erase(it) ;
+        else
+            ++it ;
+    }
+
+    return nb_removed ;
+}
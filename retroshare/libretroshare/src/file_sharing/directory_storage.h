@@ -24,6 +24,9 @@
 #include <string>
 #include <stdint.h>
 #include <list>
+#include <vector>
+#include <map>
+#include <functional>
 
 #include "retroshare/rsids.h"
 #include "retroshare/rsfiles.h"
@@ -212,10 +215,65 @@ public:
      */
     virtual int searchHash(const RsFileHash& hash, EntryIndex& results) const ;
 
+    /*!
+     * \brief checkFileHash
+     * 				Checks that the given index is a file with the given hash. Unlike searchHash() this is constant cost,
+     * 				and silently fails on indices that do not exist anymore.
+     * \return
+     * 						true if the entry is a file with that hash
+     * 						false otherwise.
+     */
+    bool checkFileHash(const EntryIndex& indx,const RsFileHash& hash) const ;
+
+    /*!
+     * \brief getFileHashes
+     * 				Lists the hash and index of the files in directory indx, not including sub-directories.
+     * 				When indx is NO_INDEX, lists all files of the hierarchy. Files without a hash are skipped.
+     */
+    void getFileHashes(EntryIndex indx,std::vector<std::pair<RsFileHash,EntryIndex> >& hashes) const ;
+
 private:
     rstime_t mLastSweepTime ;
 };
 
+// Cross-friend index of remote files, from file hash to the friends that have it. This is used to find direct sources
+// of a file without probing every friend list. Files are added when a friend list is loaded or a directory of it is
+// updated. Removed files are not tracked: entries are checked against the friend list when used, and dropped if the
+// file is not there anymore. Files that moved within the same list are found again by hash.
+// Not thread safe: p3FileDatabase uses it under mFLSMtx.
+
+class RemoteFileHashIndex
+{
+public:
+    typedef DirectoryStorage::EntryIndex EntryIndex ;
+
+    // returns the file list of a friend, or NULL if it has none anymore
+    typedef std::function<const RemoteDirectoryStorage *(const RsPeerId&)> ListFinder ;
+
+    // Adds the files of directory dir_index of rds, or all its files when dir_index is NO_INDEX.
+    void indexFiles(const RemoteDirectoryStorage *rds,EntryIndex dir_index) ;
+
+    // Lists the friends that have the file. Returns false if there is none.
+    bool findSources(const RsFileHash& hash,const ListFinder& find_list,std::list<RsPeerId>& peers) ;
+
+    // Drops the entries of all files that are not there anymore, or of friends that have no list anymore.
+    // Returns the number of entries removed.
+    uint32_t check(const ListFinder& find_list) ;
+
+    uint32_t size() const { return mIndex.size() ; }
+
+private:
+    struct Entry
+    {
+        RsPeerId peer_id ;
+        EntryIndex index ;		// index of the file in the friend's RemoteDirectoryStorage
+    };
+
+    static bool checkEntry(const RsFileHash& hash,Entry& e,const ListFinder& find_list) ;
+
+    std::map<RsFileHash,std::vector<Entry> > mIndex ;
+};
+
 class LocalDirectoryStorage: public DirectoryStorage
 {
 public:
@@ -26,6 +26,7 @@ static const uint32_t DELAY_BETWEEN_REMOTE_DIRECTORY_SYNC_REQ   =  120 ; // 2 mi
 static const uint32_t DELAY_BETWEEN_LOCAL_DIRECTORIES_TS_UPDATE =   20 ; // 20 sec. But we only update for real if something has changed.
 static const uint32_t DELAY_BETWEEN_REMOTE_DIRECTORIES_SWEEP    =   60 ; // 60 sec.
 static const uint32_t DELAY_BETWEEN_EXTRA_FILES_CACHE_UPDATES   =    2 ; //  2 sec.
+static const uint32_t DELAY_BETWEEN_REMOTE_HASH_INDEX_CHECK     =  600 ; // 10 minutes. Drops entries of removed files from the cross-friend hash index.
 
 static const uint32_t DELAY_BEFORE_DELETE_NON_EMPTY_REMOTE_DIR  = 60*24*86400 ; // delete non empty remoe directories after 60 days of inactivity
 static const uint32_t DELAY_BEFORE_DELETE_EMPTY_REMOTE_DIR      =  5*24*86400 ; // delete empty remote directories after 5 days of inactivity
@@ -67,3 +68,7 @@ static const bool FOLLOW_SYMLINKS_DEFAULT                     = true;
 static const bool TRUST_FRIEND_NODES_FOR_BANNED_FILES_DEFAULT = true;
 
 static const uint32_t FL_BASE_TMP_SECTION_SIZE = 4096 ;
+static const uint32_t FL_CONTAINER_CHUNK_SIZE  = 65536 ;		// size of the independently encrypted chunks of hash cache and file list files
+
+static const uint32_t MAX_REMOTE_SEARCH_THREADS         = 4 ;	// max number of threads searching friend file lists in parallel
+static const uint32_t MIN_REMOTE_DIRS_PER_SEARCH_THREAD = 8 ;	// below that many friend lists per thread, starting a thread costs more than it saves
@@ -0,0 +1,804 @@
+/*******************************************************************************
+ * libretroshare/src/file_sharing: filelist_container.cc                       *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+
+#ifdef WINDOWS_SYS
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <openssl/crypto.h>
+
+#include "pqi/authssl.h"
+#include "util/rsdir.h"
+#include "util/largefile_retrocompat.hpp"
+#include "serialiser/rsbaseserial.h"
+#include "file_sharing/file_sharing_defaults.h"
+#include "file_sharing/filelist_container.h"
+
+//#define DEBUG_FILELIST_CONTAINER 1
+
+static const unsigned char CONTAINER_MAGIC[8] = { 'R','S','F','L','C','T','0','1' } ;
+static const uint32_t CONTAINER_FORMAT_VERSION = 0x00000001 ;
+static const uint32_t CONTAINER_MIN_CHUNK_SIZE = 4096 ;
+static const uint32_t CONTAINER_MAX_CHUNK_SIZE = 16*1024*1024 ;
+static const uint32_t CONTAINER_KEYS_SIZE      = 64 ;	// chunk key + header MAC key
+
+static bool syncFile(FILE *F)
+{
+	if(fflush(F) != 0)
+		return false ;
+#ifdef WINDOWS_SYS
+	return _commit(_fileno(F)) == 0 ;
+#else
+	return fsync(fileno(F)) == 0 ;
+#endif
+}
+
+static bool truncateFile(FILE *F,uint64_t size)
+{
+#ifdef WINDOWS_SYS
+	return _chsize_s(_fileno(F),size) == 0 ;
+#else
+	return ftruncate(fileno(F),size) == 0 ;
+#endif
+}
+
+//===========================================================================================================================//
+//                                                   FileListContainer                                                       //
+//===========================================================================================================================//
+
+FileListContainer::FileListContainer()
+{
+	memset(mChunkKey,0,sizeof(mChunkKey)) ;
+	memset(mMacKey,0,sizeof(mMacKey)) ;
+	memset(mHeader.file_id,0,FILE_ID_SIZE) ;
+}
+
+FileListContainer::~FileListContainer()
+{
+	OPENSSL_cleanse(mChunkKey,sizeof(mChunkKey)) ;
+	OPENSSL_cleanse(mMacKey,sizeof(mMacKey)) ;
+}
+
+uint32_t FileListContainer::slotSize() const
+{
+	return mHeader.chunk_size + CHUNK_NONCE_SIZE + CHUNK_TAG_SIZE ;
+}
+
+uint64_t FileListContainer::slotOffset(uint32_t slot) const
+{
+	return 2*(uint64_t)HEADER_SLOT_SIZE + slot*(uint64_t)slotSize() ;
+}
+
+bool FileListContainer::parseHeader(const unsigned char *buf,Header& h,uint32_t& signed_size) const
+{
+	uint32_t offset = 0 ;
+	uint32_t version = 0 ;
+	uint32_t wrapped_key_size = 0 ;
+	uint32_t n_index_slots = 0 ;
+
+	if(memcmp(buf,CONTAINER_MAGIC,sizeof(CONTAINER_MAGIC)))
+		return false ;
+
+	offset += sizeof(CONTAINER_MAGIC) ;
+
+	if(!getRawUInt32(buf,HEADER_SLOT_SIZE,&offset,&version) || version != CONTAINER_FORMAT_VERSION) return false ;
+	if(!getRawUInt64(buf,HEADER_SLOT_SIZE,&offset,&h.generation)) return false ;
+	if(!getRawUInt32(buf,HEADER_SLOT_SIZE,&offset,&h.chunk_size)) return false ;
+
+	if(h.chunk_size < CONTAINER_MIN_CHUNK_SIZE || h.chunk_size > CONTAINER_MAX_CHUNK_SIZE)
+		return false ;
+
+	if(offset + FILE_ID_SIZE > HEADER_SLOT_SIZE) return false ;
+	memcpy(h.file_id,buf+offset,FILE_ID_SIZE) ;
+	offset += FILE_ID_SIZE ;
+
+	if(!getRawUInt32(buf,HEADER_SLOT_SIZE,&offset,&wrapped_key_size)) return false ;
+	if(offset + wrapped_key_size > HEADER_SLOT_SIZE) return false ;
+	h.wrapped_key.assign(buf+offset,buf+offset+wrapped_key_size) ;
+	offset += wrapped_key_size ;
+
+	if(!getRawUInt64(buf,HEADER_SLOT_SIZE,&offset,&h.total_size)) return false ;
+	if(!getRawUInt32(buf,HEADER_SLOT_SIZE,&offset,&h.n_chunks)) return false ;
+	if(!getRawUInt32(buf,HEADER_SLOT_SIZE,&offset,&h.index_size)) return false ;
+
+	if(offset + Sha256CheckSum::SIZE_IN_BYTES > HEADER_SLOT_SIZE) return false ;
+	h.index_digest = Sha256CheckSum::fromBufferUnsafe(buf+offset) ;
+	offset += Sha256CheckSum::SIZE_IN_BYTES ;
+
+	if(!getRawUInt32(buf,HEADER_SLOT_SIZE,&offset,&n_index_slots) || n_index_slots > MAX_INDEX_SLOTS) return false ;
+
+	h.index_slots.resize(n_index_slots) ;
+
+	for(uint32_t i=0;i<n_index_slots;++i)
+		if(!getRawUInt32(buf,HEADER_SLOT_SIZE,&offset,&h.index_slots[i]))
+			return false ;
+
+	// consistency
+
+	if((uint64_t)h.n_chunks * INDEX_ENTRY_SIZE != h.index_size)
+		return false ;
+
+	if(n_index_slots != (h.index_size + h.chunk_size - 1)/h.chunk_size)
+		return false ;
+
+	if(offset + SHA256_DIGEST_LENGTH > HEADER_SLOT_SIZE)
+		return false ;
+
+	signed_size = offset ;
+	return true ;
+}
+
+bool FileListContainer::unwrapKeys(const std::vector<unsigned char>& wrapped_key)
+{
+	void *keys = NULL ;
+	int keys_size = 0 ;
+
+	if(!decryptWithOwnKey(keys,keys_size,wrapped_key.data(),wrapped_key.size()))
+		return false ;
+
+	bool res = (keys_size == (int)CONTAINER_KEYS_SIZE) ;
+
+	if(res)
+	{
+		memcpy(mChunkKey,keys,32) ;
+		memcpy(mMacKey,(unsigned char*)keys+32,32) ;
+	}
+
+	OPENSSL_cleanse(keys,keys_size) ;
+	free(keys) ;
+
+	return res ;
+}
+
+bool FileListContainer::encryptWithOwnKey(void *& out,int& out_size,const void *in,int in_size)
+{
+	return AuthSSL::instance().encrypt(out,out_size,in,in_size,AuthSSL::instance().OwnId()) ;
+}
+
+bool FileListContainer::decryptWithOwnKey(void *& out,int& out_size,const void *in,int in_size)
+{
+	return AuthSSL::instance().decrypt(out,out_size,in,in_size) ;
+}
+
+bool FileListContainer::checkHeaderMac(const unsigned char *buf,uint32_t signed_size) const
+{
+	unsigned char md[EVP_MAX_MD_SIZE] ;
+	unsigned int md_size = 0 ;
+
+	if(!HMAC(EVP_sha256(),mMacKey,sizeof(mMacKey),buf,signed_size,md,&md_size) || md_size != SHA256_DIGEST_LENGTH)
+		return false ;
+
+	return CRYPTO_memcmp(md,buf+signed_size,md_size) == 0 ;
+}
+
+bool FileListContainer::loadContainer(FILE *F)
+{
+	std::vector<unsigned char> buf(2*HEADER_SLOT_SIZE) ;
+
+	if(fseeko64(F,0,SEEK_SET) != 0 || fread(buf.data(),1,buf.size(),F) != buf.size())
+		return false ;
+
+	Header h[2] ;
+	uint32_t signed_size[2] ;
+	bool parsed[2] ;
+
+	for(int i=0;i<2;++i)
+		parsed[i] = parseHeader(&buf[i*HEADER_SLOT_SIZE],h[i],signed_size[i]) ;
+
+	if(!parsed[0] && !parsed[1])
+		return false ;	// not a container, probably an older file.
+
+	// Try the newest header first. The other one is from the previous save, and
+	// is only used if the last save was interrupted while writing the header.
+
+	int order[2] = { 0, 1 } ;
+	if(parsed[1] && (!parsed[0] || h[1].generation > h[0].generation))
+		std::swap(order[0],order[1]) ;
+
+	int best = -1 ;
+
+	for(int k=0;k<2 && best < 0;++k)
+	{
+		int i = order[k] ;
+
+		if(parsed[i] && unwrapKeys(h[i].wrapped_key) && checkHeaderMac(&buf[i*HEADER_SLOT_SIZE],signed_size[i]))
+			best = i ;
+	}
+
+	if(best < 0)
+	{
+		std::cerr << "(EE) FileListContainer: cannot authenticate container header. Wrong key or corrupted file." << std::endl;
+		return false ;
+	}
+
+	mHeader = h[best] ;
+
+	// read the chunk index
+
+	std::vector<unsigned char> index(mHeader.index_size) ;
+
+	for(uint32_t i=0;i<mHeader.index_slots.size();++i)
+	{
+		uint32_t offset = i*mHeader.chunk_size ;
+		uint32_t size = std::min(mHeader.chunk_size,mHeader.index_size - offset) ;
+
+		if(!decryptChunk(F,CHUNK_KIND_INDEX,i,mHeader.index_slots[i],size,&index[offset]))
+		{
+			std::cerr << "(EE) FileListContainer: cannot read chunk index." << std::endl;
+			return false ;
+		}
+	}
+
+	if(RsDirUtil::sha256sum(index.data(),index.size()) != mHeader.index_digest)
+	{
+		std::cerr << "(EE) FileListContainer: chunk index does not match header." << std::endl;
+		return false ;
+	}
+
+	mChunks.resize(mHeader.n_chunks) ;
+	uint32_t offset = 0 ;
+	uint64_t total_size = 0 ;
+
+	for(uint32_t i=0;i<mHeader.n_chunks;++i)
+	{
+		getRawUInt32(index.data(),index.size(),&offset,&mChunks[i].slot) ;
+		getRawUInt32(index.data(),index.size(),&offset,&mChunks[i].size) ;
+		mChunks[i].digest.deserialise(index.data(),index.size(),offset) ;
+
+		if(mChunks[i].size > mHeader.chunk_size)
+			return false ;
+
+		total_size += mChunks[i].size ;
+	}
+
+	if(total_size != mHeader.total_size)
+	{
+		std::cerr << "(EE) FileListContainer: inconsistent chunk index." << std::endl;
+		return false ;
+	}
+
+#ifdef DEBUG_FILELIST_CONTAINER
+	std::cerr << "FileListContainer: loaded generation " << mHeader.generation << ", " << mHeader.n_chunks << " chunks, " << mHeader.total_size << " bytes." << std::endl;
+#endif
+	return true ;
+}
+
+bool FileListContainer::writeHeader(FILE *F,uint32_t header_slot)
+{
+	std::vector<unsigned char> buf(HEADER_SLOT_SIZE,0) ;
+	uint32_t offset = 0 ;
+
+	memcpy(buf.data(),CONTAINER_MAGIC,sizeof(CONTAINER_MAGIC)) ;
+	offset += sizeof(CONTAINER_MAGIC) ;
+
+	bool ok = true ;
+
+	ok = ok && setRawUInt32(buf.data(),HEADER_SLOT_SIZE,&offset,CONTAINER_FORMAT_VERSION) ;
+	ok = ok && setRawUInt64(buf.data(),HEADER_SLOT_SIZE,&offset,mHeader.generation) ;
+	ok = ok && setRawUInt32(buf.data(),HEADER_SLOT_SIZE,&offset,mHeader.chunk_size) ;
+
+	memcpy(&buf[offset],mHeader.file_id,FILE_ID_SIZE) ;
+	offset += FILE_ID_SIZE ;
+
+	ok = ok && setRawUInt32(buf.data(),HEADER_SLOT_SIZE,&offset,mHeader.wrapped_key.size()) ;
+	ok = ok && offset + mHeader.wrapped_key.size() < HEADER_SLOT_SIZE ;
+
+	if(!ok)
+		return false ;
+
+	memcpy(&buf[offset],mHeader.wrapped_key.data(),mHeader.wrapped_key.size()) ;
+	offset += mHeader.wrapped_key.size() ;
+
+	ok = ok && setRawUInt64(buf.data(),HEADER_SLOT_SIZE,&offset,mHeader.total_size) ;
+	ok = ok && setRawUInt32(buf.data(),HEADER_SLOT_SIZE,&offset,mHeader.n_chunks) ;
+	ok = ok && setRawUInt32(buf.data(),HEADER_SLOT_SIZE,&offset,mHeader.index_size) ;
+	ok = ok && mHeader.index_digest.serialise(buf.data(),HEADER_SLOT_SIZE,offset) ;
+	ok = ok && setRawUInt32(buf.data(),HEADER_SLOT_SIZE,&offset,mHeader.index_slots.size()) ;
+
+	for(uint32_t i=0;i<mHeader.index_slots.size();++i)
+		ok = ok && setRawUInt32(buf.data(),HEADER_SLOT_SIZE,&offset,mHeader.index_slots[i]) ;
+
+	if(!ok || offset + SHA256_DIGEST_LENGTH > HEADER_SLOT_SIZE)
+		return false ;
+
+	unsigned int md_size = 0 ;
+
+	if(!HMAC(EVP_sha256(),mMacKey,sizeof(mMacKey),buf.data(),offset,&buf[offset],&md_size))
+		return false ;
+
+	return fseeko64(F,header_slot*(uint64_t)HEADER_SLOT_SIZE,SEEK_SET) == 0 && fwrite(buf.data(),1,buf.size(),F) == buf.size() ;
+}
+
+bool FileListContainer::writeIndex(FILE *F,const std::vector<uint32_t>& index_slots)
+{
+	std::vector<unsigned char> index(mHeader.index_size) ;
+	uint32_t offset = 0 ;
+
+	for(uint32_t i=0;i<mChunks.size();++i)
+		if(!setRawUInt32(index.data(),index.size(),&offset,mChunks[i].slot)
+		        || !setRawUInt32(index.data(),index.size(),&offset,mChunks[i].size)
+		        || !mChunks[i].digest.serialise(index.data(),index.size(),offset))
+			return false ;
+
+	mHeader.index_digest = RsDirUtil::sha256sum(index.data(),index.size()) ;
+	mHeader.index_slots = index_slots ;
+
+	for(uint32_t i=0;i<index_slots.size();++i)
+	{
+		uint32_t offset = i*mHeader.chunk_size ;
+		uint32_t size = std::min(mHeader.chunk_size,mHeader.index_size - offset) ;
+
+		if(!encryptChunk(F,CHUNK_KIND_INDEX,i,index_slots[i],&index[offset],size))
+			return false ;
+	}
+	return true ;
+}
+
+// The chunk position and kind are authenticated with the data, so that chunks cannot be swapped.
+
+static void makeChunkAad(unsigned char *aad,const unsigned char *file_id,uint32_t kind,uint32_t index,uint32_t size)
+{
+	uint32_t offset = 0 ;
+
+	memcpy(aad,file_id,FileListContainer::FILE_ID_SIZE) ;
+	offset += FileListContainer::FILE_ID_SIZE ;
+
+	setRawUInt32(aad,FileListContainer::FILE_ID_SIZE+12,&offset,kind) ;
+	setRawUInt32(aad,FileListContainer::FILE_ID_SIZE+12,&offset,index) ;
+	setRawUInt32(aad,FileListContainer::FILE_ID_SIZE+12,&offset,size) ;
+}
+
+bool FileListContainer::encryptChunk(FILE *F,uint32_t kind,uint32_t index,uint32_t slot,const unsigned char *data,uint32_t size)
+{
+	std::vector<unsigned char> out(CHUNK_NONCE_SIZE + size + CHUNK_TAG_SIZE) ;
+	unsigned char aad[FILE_ID_SIZE+12] ;
+	makeChunkAad(aad,mHeader.file_id,kind,index,size) ;
+
+	if(RAND_bytes(out.data(),CHUNK_NONCE_SIZE) != 1)
+		return false ;
+
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new() ;
+	int len = 0 ;
+	int final_len = 0 ;
+
+	bool ok = ctx != NULL
+	        && EVP_EncryptInit_ex(ctx,EVP_aes_256_gcm(),NULL,mChunkKey,out.data()) == 1
+	        && EVP_EncryptUpdate(ctx,NULL,&len,aad,sizeof(aad)) == 1
+	        && EVP_EncryptUpdate(ctx,&out[CHUNK_NONCE_SIZE],&len,data,size) == 1
+	        && EVP_EncryptFinal_ex(ctx,&out[CHUNK_NONCE_SIZE+len],&final_len) == 1
+	        && EVP_CIPHER_CTX_ctrl(ctx,EVP_CTRL_GCM_GET_TAG,CHUNK_TAG_SIZE,&out[CHUNK_NONCE_SIZE+size]) == 1 ;
+
+	EVP_CIPHER_CTX_free(ctx) ;
+
+	if(!ok)
+		return false ;
+
+	return fseeko64(F,slotOffset(slot),SEEK_SET) == 0 && fwrite(out.data(),1,out.size(),F) == out.size() ;
+}
+
+bool FileListContainer::decryptChunk(FILE *F,uint32_t kind,uint32_t index,uint32_t slot,uint32_t size,unsigned char *data)
+{
+	std::vector<unsigned char> in(CHUNK_NONCE_SIZE + size + CHUNK_TAG_SIZE) ;
+	unsigned char aad[FILE_ID_SIZE+12] ;
+	makeChunkAad(aad,mHeader.file_id,kind,index,size) ;
+
+	if(fseeko64(F,slotOffset(slot),SEEK_SET) != 0 || fread(in.data(),1,in.size(),F) != in.size())
+		return false ;
+
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new() ;
+	int len = 0 ;
+	int final_len = 0 ;
+
+	bool ok = ctx != NULL
+	        && EVP_DecryptInit_ex(ctx,EVP_aes_256_gcm(),NULL,mChunkKey,in.data()) == 1
+	        && EVP_DecryptUpdate(ctx,NULL,&len,aad,sizeof(aad)) == 1
+	        && EVP_DecryptUpdate(ctx,data,&len,&in[CHUNK_NONCE_SIZE],size) == 1
+	        && EVP_CIPHER_CTX_ctrl(ctx,EVP_CTRL_GCM_SET_TAG,CHUNK_TAG_SIZE,&in[CHUNK_NONCE_SIZE+size]) == 1
+	        && EVP_DecryptFinal_ex(ctx,data+len,&final_len) == 1 ;
+
+	EVP_CIPHER_CTX_free(ctx) ;
+	return ok ;
+}
+
+//===========================================================================================================================//
+//                                                FileListContainerWriter                                                    //
+//===========================================================================================================================//
+
+FileListContainerWriter::FileListContainerWriter()
+    : mFile(NULL), mInPlace(false), mFailed(false), mNextNewSlot(0), mWrittenChunks(0), mKeptChunks(0)
+{
+}
+
+FileListContainerWriter::~FileListContainerWriter()
+{
+	if(mFile)
+	{
+		fclose(mFile) ;
+
+		if(!mInPlace)
+			remove((mFileName+".tmp").c_str()) ;
+	}
+}
+
+bool FileListContainerWriter::open(const std::string& fname)
+{
+	mFileName = fname ;
+	mFailed = false ;
+	mWrittenChunks = 0 ;
+	mKeptChunks = 0 ;
+	mInPlace = false ;
+
+	FILE *F = RsDirUtil::rs_fopen(fname.c_str(),"r+b") ;
+
+	if(F && loadContainer(F))
+	{
+		// Update in place: the new chunks go to the slots that the current
+		// generation does not use, or at the end of the file.
+
+		mInPlace = true ;
+		mFile = F ;
+		mOldChunks.swap(mChunks) ;
+		mChunks.clear() ;
+
+		uint64_t file_size = 0 ;
+
+		if(fseeko64(F,0,SEEK_END) == 0)
+			file_size = ftello64(F) ;
+
+		uint32_t n_slots = (file_size > slotOffset(0)) ? (file_size - slotOffset(0)) / slotSize() : 0 ;
+		std::vector<bool> used(n_slots,false) ;
+
+		for(uint32_t i=0;i<mOldChunks.size();++i)
+			if(mOldChunks[i].slot < n_slots)
+				used[mOldChunks[i].slot] = true ;
+
+		for(uint32_t i=0;i<mHeader.index_slots.size();++i)
+			if(mHeader.index_slots[i] < n_slots)
+				used[mHeader.index_slots[i]] = true ;
+
+		mFreeSlots.clear() ;
+
+		for(uint32_t i=n_slots;i>0;--i)
+			if(!used[i-1])
+				mFreeSlots.push_back(i-1) ;
+
+		mNextNewSlot = n_slots ;
+		++mHeader.generation ;
+
+		// When most of the data changed last time, the previous generation left
+		// about as many free slots as used ones. The file is then written again
+		// from scratch, so that it does not stay twice as large as needed.
+
+		if(2*mFreeSlots.size() > mOldChunks.size() + mHeader.index_slots.size())
+		{
+			mInPlace = false ;
+			mFile = NULL ;
+		}
+	}
+
+	if(!mInPlace)
+	{
+		if(F)
+			fclose(F) ;
+
+		// New file, with new keys.
+
+		mInPlace = false ;
+		mOldChunks.clear() ;
+		mFreeSlots.clear() ;
+		mNextNewSlot = 0 ;
+
+		unsigned char keys[CONTAINER_KEYS_SIZE] ;
+
+		if(RAND_bytes(mChunkKey,sizeof(mChunkKey)) != 1 || RAND_bytes(mMacKey,sizeof(mMacKey)) != 1 || RAND_bytes(mHeader.file_id,FILE_ID_SIZE) != 1)
+			return false ;
+
+		memcpy(keys,mChunkKey,32) ;
+		memcpy(keys+32,mMacKey,32) ;
+
+		void *wrapped_key = NULL ;
+		int wrapped_key_size = 0 ;
+
+		bool res = encryptWithOwnKey(wrapped_key,wrapped_key_size,keys,CONTAINER_KEYS_SIZE) ;
+		OPENSSL_cleanse(keys,sizeof(keys)) ;
+
+		if(!res)
+		{
+			std::cerr << "(EE) FileListContainer: cannot encrypt container key." << std::endl;
+			return false ;
+		}
+
+		mHeader.wrapped_key.assign((unsigned char*)wrapped_key,(unsigned char*)wrapped_key + wrapped_key_size) ;
+		free(wrapped_key) ;
+
+		mHeader.generation = 1 ;
+		mHeader.chunk_size = FL_CONTAINER_CHUNK_SIZE ;
+
+		mFile = RsDirUtil::rs_fopen((fname+".tmp").c_str(),"w+b") ;
+
+		if(!mFile)
+		{
+			std::cerr << "(EE) Cannot open file for writing: " << fname+".tmp" << std::endl;
+			return false ;
+		}
+	}
+
+	mChunks.clear() ;
+	mHeader.total_size = 0 ;
+	mBuffer.clear() ;
+	mBuffer.reserve(mHeader.chunk_size) ;
+
+	return true ;
+}
+
+bool FileListContainerWriter::write(const void *data,uint32_t size)
+{
+	if(!mFile || mFailed)
+		return false ;
+
+	const unsigned char *p = (const unsigned char *)data ;
+
+	while(size > 0)
+	{
+		uint32_t n = std::min(size,(uint32_t)(mHeader.chunk_size - mBuffer.size())) ;
+
+		mBuffer.insert(mBuffer.end(),p,p+n) ;
+		p += n ;
+		size -= n ;
+
+		if(mBuffer.size() == mHeader.chunk_size && !flushChunk())
+			return false ;
+	}
+	return true ;
+}
+
+uint32_t FileListContainerWriter::allocateSlot()
+{
+	if(mFreeSlots.empty())
+		return mNextNewSlot++ ;
+
+	uint32_t slot = mFreeSlots.back() ;
+	mFreeSlots.pop_back() ;
+	return slot ;
+}
+
+bool FileListContainerWriter::flushChunk()
+{
+	if(mBuffer.empty())
+		return true ;
+
+	ChunkEntry e ;
+	e.size = mBuffer.size() ;
+	e.digest = RsDirUtil::sha256sum(mBuffer.data(),e.size) ;
+
+	uint32_t i = mChunks.size() ;
+
+	if(i < mOldChunks.size() && mOldChunks[i].size == e.size && mOldChunks[i].digest == e.digest)
+	{
+		e.slot = mOldChunks[i].slot ;	// same data at the same place: nothing to write
+		++mKeptChunks ;
+	}
+	else
+	{
+		e.slot = allocateSlot() ;
+
+		if(!encryptChunk(mFile,CHUNK_KIND_DATA,i,e.slot,mBuffer.data(),e.size))
+		{
+			std::cerr << "(EE) FileListContainer: cannot write chunk to " << mFileName << ". Out of disc space??" << std::endl;
+			mFailed = true ;
+			return false ;
+		}
+		++mWrittenChunks ;
+	}
+
+	mChunks.push_back(e) ;
+	mHeader.total_size += e.size ;
+	mBuffer.clear() ;
+
+	return true ;
+}
+
+bool FileListContainerWriter::close()
+{
+	if(!mFile)
+		return false ;
+
+	bool ok = !mFailed && flushChunk() ;
+
+	mHeader.n_chunks = mChunks.size() ;
+	mHeader.index_size = mChunks.size() * INDEX_ENTRY_SIZE ;
+
+	uint32_t n_index_slots = (mHeader.index_size + mHeader.chunk_size - 1)/mHeader.chunk_size ;
+
+	if(n_index_slots > MAX_INDEX_SLOTS)
+	{
+		std::cerr << "(EE) FileListContainer: too much data for " << mFileName << std::endl;
+		ok = false ;
+	}
+
+	std::vector<uint32_t> index_slots ;
+
+	for(uint32_t i=0;ok && i<n_index_slots;++i)
+		index_slots.push_back(allocateSlot()) ;
+
+	// Everything the new header points to must be on disc before the header
+	// is written, otherwise a crash could leave a header pointing to garbage.
+
+	ok = ok && writeIndex(mFile,index_slots) && syncFile(mFile) ;
+	ok = ok && writeHeader(mFile,mHeader.generation & 1) && syncFile(mFile) ;
+
+	if(ok)
+	{
+		// Slots after the last one in use are not needed anymore.
+
+		uint32_t max_slot = 0 ;
+		bool any_slot = false ;
+
+		for(uint32_t i=0;i<mChunks.size();++i)
+		{
+			max_slot = std::max(max_slot,mChunks[i].slot) ;
+			any_slot = true ;
+		}
+		for(uint32_t i=0;i<index_slots.size();++i)
+		{
+			max_slot = std::max(max_slot,index_slots[i]) ;
+			any_slot = true ;
+		}
+
+		truncateFile(mFile,any_slot ? slotOffset(max_slot+1) : slotOffset(0)) ;
+	}
+
+	fclose(mFile) ;
+	mFile = NULL ;
+
+	if(!mInPlace)
+	{
+		if(ok)
+			ok = RsDirUtil::renameFile(mFileName+".tmp",mFileName) ;
+		else
+			remove((mFileName+".tmp").c_str()) ;
+	}
+
+	if(!ok)
+		std::cerr << "(EE) FileListContainer: could not save " << mFileName << std::endl;
+
+#ifdef DEBUG_FILELIST_CONTAINER
+	std::cerr << "FileListContainer: saved " << mFileName << " generation " << mHeader.generation << ": " << mWrittenChunks << " chunks written, " << mKeptChunks << " kept." << std::endl;
+#endif
+	return ok ;
+}
+
+//===========================================================================================================================//
+//                                                FileListContainerReader                                                    //
+//===========================================================================================================================//
+
+FileListContainerReader::FileListContainerReader()
+    : mFile(NULL), mFailed(false), mNextChunk(0), mBufferOffset(0)
+{
+}
+
+FileListContainerReader::~FileListContainerReader()
+{
+	if(mFile)
+		fclose(mFile) ;
+}
+
+bool FileListContainerReader::open(const std::string& fname)
+{
+	mFailed = false ;
+	mNextChunk = 0 ;
+	mBuffer.clear() ;
+	mBufferOffset = 0 ;
+
+	mFile = RsDirUtil::rs_fopen(fname.c_str(),"rb") ;
+
+	if(!mFile)
+		return false ;
+
+	if(loadContainer(mFile))
+		return true ;
+
+	// Older files are a single encrypted block, read at once.
+
+	uint64_t file_size = 0 ;
+
+	if(fseeko64(mFile,0,SEEK_END) == 0)
+		file_size = ftello64(mFile) ;
+
+	std::vector<unsigned char> buffer(file_size) ;
+
+	bool ok = file_size > 0 && file_size < (uint64_t)INT32_MAX && fseeko64(mFile,0,SEEK_SET) == 0
+	        && fread(buffer.data(),1,file_size,mFile) == file_size ;
+
+	fclose(mFile) ;
+	mFile = NULL ;
+
+	void *data = NULL ;
+	int data_size = 0 ;
+
+	if(!ok || !decryptWithOwnKey(data,data_size,buffer.data(),buffer.size()))
+	{
+		std::cerr << "(EE) Cannot read encrypted file " << fname << std::endl;
+		return false ;
+	}
+
+	mBuffer.assign((unsigned char*)data,(unsigned char*)data+data_size) ;
+	free(data) ;
+
+	return true ;
+}
+
+bool FileListContainerReader::readNextChunk()
+{
+	if(!mFile || mFailed || mNextChunk >= mChunks.size())
+		return false ;
+
+	if(mBufferOffset > 0)
+	{
+		mBuffer.erase(mBuffer.begin(),mBuffer.begin()+mBufferOffset) ;
+		mBufferOffset = 0 ;
+	}
+
+	const ChunkEntry& e(mChunks[mNextChunk]) ;
+	uint32_t old_size = mBuffer.size() ;
+	mBuffer.resize(old_size + e.size) ;
+
+	if(!decryptChunk(mFile,CHUNK_KIND_DATA,mNextChunk,e.slot,e.size,&mBuffer[old_size])
+	        || RsDirUtil::sha256sum(&mBuffer[old_size],e.size) != e.digest)
+	{
+		std::cerr << "(EE) FileListContainer: chunk " << mNextChunk << " cannot be authenticated." << std::endl;
+		mBuffer.resize(old_size) ;
+		mFailed = true ;
+		return false ;
+	}
+
+	++mNextChunk ;
+	return true ;
+}
+
+bool FileListContainerReader::ensure(uint32_t n)
+{
+	while(available() < n)
+		if(!readNextChunk())
+			return false ;
+
+	return true ;
+}
+
+void FileListContainerReader::consume(uint32_t n)
+{
+	mBufferOffset += std::min(n,available()) ;
+}
+
+bool FileListContainerReader::eof()
+{
+	return available() == 0 && (!mFile || mFailed || mNextChunk >= mChunks.size()) ;
+}
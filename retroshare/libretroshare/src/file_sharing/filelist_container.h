@@ -0,0 +1,195 @@
+/*******************************************************************************
+ * libretroshare/src/file_sharing: filelist_container.h                        *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "retroshare/rsids.h"
+
+// Encrypted container used to save the hash cache and the file lists.
+//
+// The data is cut into chunks of fixed size, each encrypted and authenticated
+// on its own (AES-256-GCM), so that it can be written and read as a stream
+// without holding the whole file in memory. The chunk key is stored in the
+// file, encrypted with the node's own SSL key.
+//
+// Layout:
+//
+//   [header slot 0][header slot 1][chunk slot 0][chunk slot 1]...
+//
+// Each header slot holds a generation number, the key, the slots of the chunk
+// index and a HMAC. The valid header with the highest generation is used.
+// The chunk index gives, for each chunk of data, the slot it is stored in,
+// its size and its sha256.
+//
+// Saving over an existing container only writes the chunks that changed, in
+// slots the current generation does not use, then the index, then the other
+// header slot. Until that last write, the file still reads as the previous
+// generation, so an interrupted save never loses the previous content.
+//
+// Files written before this container (a single AuthSSL::encrypt() blob) are
+// recognised and read through the same reader.
+
+class FileListContainer
+{
+public:
+	static const uint32_t HEADER_SLOT_SIZE   = 4096 ;
+	static const uint32_t MAX_INDEX_SLOTS    = 64 ;
+	static const uint32_t CHUNK_NONCE_SIZE   = 12 ;
+	static const uint32_t CHUNK_TAG_SIZE     = 16 ;
+	static const uint32_t FILE_ID_SIZE       = 16 ;
+	static const uint32_t INDEX_ENTRY_SIZE   = 8 + Sha256CheckSum::SIZE_IN_BYTES ;
+
+protected:
+	FileListContainer() ;
+	virtual ~FileListContainer() ;
+
+	struct ChunkEntry
+	{
+		uint32_t slot ;
+		uint32_t size ;
+		Sha256CheckSum digest ;
+	};
+
+	struct Header
+	{
+		Header() : generation(0), chunk_size(0), total_size(0), n_chunks(0), index_size(0) {}
+
+		uint64_t generation ;
+		uint32_t chunk_size ;
+		unsigned char file_id[FILE_ID_SIZE] ;
+		std::vector<unsigned char> wrapped_key ;	// encrypted with AuthSSL, contains the chunk key and the header MAC key
+		uint64_t total_size ;
+		uint32_t n_chunks ;
+		uint32_t index_size ;
+		Sha256CheckSum index_digest ;
+		std::vector<uint32_t> index_slots ;
+	};
+
+	enum { CHUNK_KIND_DATA = 0x01, CHUNK_KIND_INDEX = 0x02 } ;
+
+	/// Reads the current header and the chunk index of a container. Returns
+	/// false if F is not a container or cannot be decrypted.
+	bool loadContainer(FILE *F) ;
+
+	bool writeHeader(FILE *F,uint32_t header_slot) ;
+	bool writeIndex(FILE *F,const std::vector<uint32_t>& index_slots) ;
+
+	bool encryptChunk(FILE *F,uint32_t kind,uint32_t index,uint32_t slot,const unsigned char *data,uint32_t size) ;
+	bool decryptChunk(FILE *F,uint32_t kind,uint32_t index,uint32_t slot,uint32_t size,unsigned char *data) ;
+
+	uint64_t slotOffset(uint32_t slot) const ;
+	uint32_t slotSize() const ;
+
+	/// Encryption with the node's own SSL key, through AuthSSL. The container
+	/// keys are stored this way, and so were whole files before the container.
+	virtual bool encryptWithOwnKey(void *& out,int& out_size,const void *in,int in_size) ;
+	virtual bool decryptWithOwnKey(void *& out,int& out_size,const void *in,int in_size) ;
+
+	Header mHeader ;
+	std::vector<ChunkEntry> mChunks ;
+
+	unsigned char mChunkKey[32] ;
+	unsigned char mMacKey[32] ;
+
+private:
+	bool parseHeader(const unsigned char *buf,Header& h,uint32_t& signed_size) const ;
+	bool unwrapKeys(const std::vector<unsigned char>& wrapped_key) ;
+	bool checkHeaderMac(const unsigned char *buf,uint32_t signed_size) const ;
+};
+
+class FileListContainerWriter: public FileListContainer
+{
+public:
+	FileListContainerWriter() ;
+	~FileListContainerWriter() ;
+
+	/// Prepares a new content for fname. If fname already is a container,
+	/// the unchanged chunks are kept in place, otherwise a new file is written.
+	bool open(const std::string& fname) ;
+
+	bool write(const void *data,uint32_t size) ;
+
+	/// Writes what is left and commits the new content. Nothing is changed on
+	/// disc if this is not called or fails.
+	bool close() ;
+
+	/// Chunks written / kept as they were, by the last close().
+	uint32_t writtenChunks() const { return mWrittenChunks ; }
+	uint32_t keptChunks() const { return mKeptChunks ; }
+
+private:
+	bool flushChunk() ;
+	uint32_t allocateSlot() ;
+
+	std::string mFileName ;
+	FILE *mFile ;
+	bool mInPlace ;
+	bool mFailed ;
+
+	std::vector<ChunkEntry> mOldChunks ;
+	std::vector<uint32_t> mFreeSlots ;	// sorted in decreasing order, so that the lowest one is at the back
+	uint32_t mNextNewSlot ;
+
+	std::vector<unsigned char> mBuffer ;
+	uint32_t mWrittenChunks ;
+	uint32_t mKeptChunks ;
+};
+
+class FileListContainerReader: public FileListContainer
+{
+public:
+	FileListContainerReader() ;
+	~FileListContainerReader() ;
+
+	/// Opens a container, or a file saved by FileListIO::saveEncryptedDataToFile().
+	bool open(const std::string& fname) ;
+
+	/// Makes sure that at least n bytes are available at data(). Returns false
+	/// if the data ends before, or if a chunk cannot be authenticated.
+	bool ensure(uint32_t n) ;
+
+	const unsigned char *data() const { return mBuffer.data() + mBufferOffset ; }
+	uint32_t available() const { return mBuffer.size() - mBufferOffset ; }
+
+	/// Drops the first n available bytes.
+	void consume(uint32_t n) ;
+
+	/// true when all the data has been consumed.
+	bool eof() ;
+
+	/// true if a chunk could not be read or authenticated.
+	bool failed() const { return mFailed ; }
+
+private:
+	bool readNextChunk() ;
+
+	FILE *mFile ;
+	bool mFailed ;
+	uint32_t mNextChunk ;
+
+	std::vector<unsigned char> mBuffer ;
+	uint32_t mBufferOffset ;
+};
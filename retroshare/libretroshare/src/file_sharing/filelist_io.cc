@@ -27,7 +27,7 @@
 #include "serialiser/rsbaseserial.h"
 #include "filelist_io.h"
 
-FileListIO::read_error::read_error(unsigned char *sec,uint32_t size,uint32_t offset,uint8_t expected_tag)
+FileListIO::read_error::read_error(const unsigned char *sec,uint32_t size,uint32_t offset,uint8_t expected_tag)
 {
 	std::ostringstream s ;
 	s << "At offset " << offset << "/" << size << ": expected section tag " << std::hex << (int)expected_tag << std::dec << " but got " << RsUtil::BinToHex(&sec[offset],std::min((int)size-(int)offset, 15)) << "..." << std::endl;
@@ -79,6 +79,30 @@ bool FileListIO::readField (const unsigned char *buff,uint32_t  buff_size,uint32
     return true ;
 }
 
+bool FileListIO::readField (FileListContainerReader& reader,uint8_t check_section_tag, unsigned char *& val,uint32_t& size)
+{
+    uint32_t local_size ;
+    uint32_t offset = 0 ;
+
+    reader.ensure(SECTION_HEADER_MAX_SIZE) ;	// there can be less at the end of the data
+
+    const unsigned char *buff = reader.data() ;
+
+    if(!readSectionHeader(buff,reader.available(),offset,check_section_tag,local_size))
+        return false;
+
+    if(!reader.ensure(offset + local_size))
+        return false;
+
+    if(!checkSectionSize(val,size,0,local_size))	// allocate val if needed to handle local_size bytes.
+        return false;
+
+    memcpy(val,reader.data() + offset,local_size);
+    reader.consume(offset + local_size) ;
+
+    return true ;
+}
+
 bool FileListIO::write125Size(unsigned char *data,uint32_t data_size,uint32_t& offset,uint32_t S)
 {
     if(S < 192)
@@ -26,6 +26,7 @@
 #include <string.h>
 
 #include "util/rsmemory.h"
+#include "file_sharing/filelist_container.h"
 
 // This file implements load/save of various fields used for file lists and directory content.
 // WARNING: the encoding is system-dependent, so this should *not* be used to exchange data between computers.
@@ -90,10 +91,39 @@ public:
        return deserialise(buff,buff_size,offset,val);
     }
 
+    // Same, reading from a container. The field is consumed only if it could be read.
+
+    template<typename T>
+    static bool readField(FileListContainerReader& reader,uint8_t check_section_tag,T& val)
+    {
+        uint32_t section_size ;
+        uint32_t offset = 0 ;
+
+        reader.ensure(SECTION_HEADER_MAX_SIZE) ;	// there can be less at the end of the data
+
+        const unsigned char *buff = reader.data() ;
+
+        if(!readSectionHeader(buff,reader.available(),offset,check_section_tag,section_size))
+            return false;
+
+        uint32_t section_end = offset + section_size ;
+
+        if(!reader.ensure(section_end))
+            return false;
+
+        buff = reader.data() ;
+
+        if(!deserialise(buff,section_end,offset,val))
+            return false;
+
+        reader.consume(section_end) ;
+        return true;
+    }
+
 	class read_error
 	{
 	public:
-		read_error(unsigned char *sec,uint32_t size,uint32_t offset,uint8_t expected_tag);
+		read_error(const unsigned char *sec,uint32_t size,uint32_t offset,uint8_t expected_tag);
 		read_error(const std::string& s) : err_string(s) {}
 
 		const std::string& what() const { return err_string ; }
@@ -104,11 +134,13 @@ public:
 
 	static bool writeField(      unsigned char*&buff,uint32_t& buff_size,uint32_t& offset,uint8_t       section_tag,const unsigned char *  val,uint32_t  size) ;
     static bool readField (const unsigned char *buff,uint32_t  buff_size,uint32_t& offset,uint8_t check_section_tag,      unsigned char *& val,uint32_t& size) ;
+    static bool readField (FileListContainerReader& reader,                      uint8_t check_section_tag,      unsigned char *& val,uint32_t& size) ;
 
     template<class T> static bool serialise(unsigned char *buff,uint32_t size,uint32_t& offset,const T& val) ;
     template<class T> static bool deserialise(const unsigned char *buff,uint32_t size,uint32_t& offset,T& val) ;
     template<class T> static uint32_t serial_size(const T& val) ;
 
+    // Single block encryption of a whole file, as used before FileListContainer. Still used to read older files.
     static bool saveEncryptedDataToFile(const std::string& fname,const unsigned char *data,uint32_t total_size);
     static bool loadEncryptedDataFromFile(const std::string& fname,unsigned char *& data,uint32_t& total_size);
 
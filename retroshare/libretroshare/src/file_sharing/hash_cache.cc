@@ -383,31 +383,32 @@ void HashStorage::clean()
 
 bool HashStorage::locked_load()
 {
-    unsigned char *data = NULL ;
-    uint32_t data_size=0;
+    FileListContainerReader reader ;
 
-    if(!FileListIO::loadEncryptedDataFromFile(mFilePath,data,data_size))
+    if(!reader.open(mFilePath))
     {
         std::cerr << "(EE) Cannot read hash cache." << std::endl;
         return false;
     }
-    uint32_t offset = 0 ;
     HashStorageInfo info ;
 #ifdef HASHSTORAGE_DEBUG
     uint32_t n=0;
 #endif
 
-    while(offset < data_size)
-       if(readHashStorageInfo(data,data_size,offset,info))
-       {
+    // Entries are read one at a time from the container, so the decrypted hash cache never is in memory as a whole.
+
+    while(readHashStorageInfo(reader,info))
+    {
 #ifdef HASHSTORAGE_DEBUG
-          std::cerr << info << std::endl;
-          ++n ;
+        std::cerr << info << std::endl;
+        ++n ;
 #endif
-          mFiles[info.filename] = info ;
-       }
+        mFiles[info.filename] = info ;
+    }
+
+    if(reader.failed() || !reader.eof())
+        std::cerr << "(EE) Hash cache " << mFilePath << " is corrupted. " << mFiles.size() << " entries could be read." << std::endl;
 
-    free(data) ;
 #ifdef HASHSTORAGE_DEBUG
     std::cerr << n << " entries loaded." << std::endl ;
 #endif
@@ -420,26 +421,42 @@ void HashStorage::locked_save()
     std::cerr << "Saving Hash Cache to file " << mFilePath << "..." << std::endl ;
 #endif
 
+    FileListContainerWriter writer ;
+
+    if(!writer.open(mFilePath))
+    {
+        std::cerr << "(EE) Cannot save hash cache data." << std::endl;
+        return ;
+    }
+
+    // The same buffer is used for all entries, which are streamed to the container.
+
     unsigned char *data = NULL ;
-    uint32_t offset = 0 ;
     uint32_t total_size = 0;
 
     for(std::map<std::string,HashStorageInfo>::const_iterator it(mFiles.begin());it!=mFiles.end();++it)
-        writeHashStorageInfo(data,total_size,offset,it->second) ;
+    {
+        uint32_t offset = 0 ;
 
-    if(!FileListIO::saveEncryptedDataToFile(mFilePath,data,offset))
+        if(!writeHashStorageInfo(data,total_size,offset,it->second) || !writer.write(data,offset))
+        {
+            std::cerr << "(EE) Cannot save hash cache data." << std::endl;
+            free(data) ;
+            return ;
+        }
+    }
+    free(data) ;
+
+    if(!writer.close())
     {
         std::cerr << "(EE) Cannot save hash cache data." << std::endl;
-        free(data) ;
         return ;
     }
 
-    std::cerr << mFiles.size() << " entries saved in hash cache." << std::endl;
-
-    free(data) ;
+    std::cerr << mFiles.size() << " entries saved in hash cache (" << writer.writtenChunks() << " chunks written, " << writer.keptChunks() << " unchanged)." << std::endl;
 }
 
-bool HashStorage::readHashStorageInfo(const unsigned char *data,uint32_t total_size,uint32_t& offset,HashStorageInfo& info) const
+bool HashStorage::readHashStorageInfo(FileListContainerReader& reader,HashStorageInfo& info) const
 {
     unsigned char *section_data = (unsigned char *)rs_malloc(FL_BASE_TMP_SECTION_SIZE) ;
 
@@ -452,7 +469,7 @@ bool HashStorage::readHashStorageInfo(const unsigned char *data,uint32_t total_s
     // This way, the entire section is either read or skipped. That avoids the risk of being stuck somewhere in the middle
     // of a section because of some unknown field, etc.
 
-    if(!FileListIO::readField(data,total_size,offset,FILE_LIST_IO_TAG_HASH_STORAGE_ENTRY,section_data,section_size))
+    if(!FileListIO::readField(reader,FILE_LIST_IO_TAG_HASH_STORAGE_ENTRY,section_data,section_size))
 	{
 		free(section_data);
 		return false;
@@ -28,6 +28,8 @@
 #include "retroshare/rsfiles.h"
 #include "util/rstime.h"
 
+class FileListContainerReader ;
+
 /*!
  * \brief The HashStorageClient class
  * 		Used by clients of the hash cache for receiving hash results when done. This is asynchrone of course since hashing
@@ -104,7 +106,7 @@ private:
     bool locked_load() ;
     bool try_load_import_old_hash_cache();
 
-    bool readHashStorageInfo(const unsigned char *data,uint32_t total_size,uint32_t& offset,HashStorageInfo& info) const;
+    bool readHashStorageInfo(FileListContainerReader& reader,HashStorageInfo& info) const;
     bool writeHashStorageInfo(unsigned char *& data,uint32_t&  total_size,uint32_t& offset,const HashStorageInfo& info) const;
 
     // Local configuration and storage
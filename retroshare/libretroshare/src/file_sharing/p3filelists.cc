@@ -21,6 +21,9 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
  *                                                                             *
  ******************************************************************************/
+#include <atomic>
+#include <thread>
+
 #include "rsitems/rsserviceids.h"
 
 #include "file_sharing/p3filelists.h"
@@ -78,6 +81,8 @@ p3FileDatabase::p3FileDatabase(p3ServiceControl *mpeers)
     mLastExtraFilesCacheUpdate = 0;
     mLastCleanupTime = 0 ;
     mLastDataRecvTS = 0 ;
+    mLastRemoteHashIndexCheck = 0 ;
+    mRemoteSearchesRunning = 0 ;
     mTrustFriendNodesForBannedFiles = TRUST_FRIEND_NODES_FOR_BANNED_FILES_DEFAULT;
 	mLastPrimaryBanListChangeTimeStamp = 0;
 
@@ -162,6 +167,9 @@ p3FileDatabase::~p3FileDatabase()
 
     mRemoteDirectories.clear(); // just a precaution, not to leave deleted pointers around.
 
+    for(std::list<RemoteDirectoryStorage*>::const_iterator it(mRemoteDirectoriesToDelete.begin());it!=mRemoteDirectoriesToDelete.end();++it)
+        delete *it ;
+
     delete mLocalSharedDirs ;
     delete mLocalDirWatcher ;
     delete mHashCache ;
@@ -639,6 +647,7 @@ void p3FileDatabase::cleanup()
                 friend_set.insert(*it) ;
         }
         rstime_t now = time(NULL);
+        bool remote_dirs_removed = false ;
 
         for(uint32_t i=0;i<mRemoteDirectories.size();++i)
             if(mRemoteDirectories[i] != NULL)
@@ -677,8 +686,9 @@ void p3FileDatabase::cleanup()
 
                 remove(mRemoteDirectories[i]->filename().c_str()) ;
 
-                delete mRemoteDirectories[i];
+                locked_deleteRemoteDirectory(mRemoteDirectories[i]);
                 mRemoteDirectories[i] = NULL ;
+                remote_dirs_removed = true ;
 
                 // now, in order to avoid empty seats, just move the last one here, and update indexes
 
@@ -694,6 +704,14 @@ void p3FileDatabase::cleanup()
                 mUpdateFlags |= P3FILELISTS_UPDATE_FLAG_REMOTE_DIRS_CHANGED ;
             }
 
+        // Drop the hash index entries of removed friends right away, and the ones of removed files from time to time.
+
+        if(remote_dirs_removed || mLastRemoteHashIndexCheck + DELAY_BETWEEN_REMOTE_HASH_INDEX_CHECK < now)
+        {
+            locked_checkRemoteHashIndex() ;
+            mLastRemoteHashIndexCheck = now ;
+        }
+
         // look through the remaining list of friends, which are the ones for which no remoteDirectoryStorage class has been allocated.
         //
         for(std::set<RsPeerId>::const_iterator it(friend_set.begin());it!=friend_set.end();++it)
@@ -764,6 +782,7 @@ uint32_t p3FileDatabase::locked_getFriendIndex(const RsPeerId& pid)
         {
             found = mRemoteDirectories.size();
             mRemoteDirectories.push_back(new RemoteDirectoryStorage(pid,makeRemoteFileName(pid)));
+            locked_indexRemoteFiles(mRemoteDirectories.back(),DirectoryStorage::NO_INDEX) ;
 
             mUpdateFlags |= P3FILELISTS_UPDATE_FLAG_REMOTE_DIRS_CHANGED ;
             mUpdateFlags |= P3FILELISTS_UPDATE_FLAG_REMOTE_MAP_CHANGED ;
@@ -796,6 +815,7 @@ uint32_t p3FileDatabase::locked_getFriendIndex(const RsPeerId& pid)
         {
             mRemoteDirectories.resize(it->second+1,NULL) ;
             mRemoteDirectories[it->second] = new RemoteDirectoryStorage(pid,makeRemoteFileName(pid));
+            locked_indexRemoteFiles(mRemoteDirectories[it->second],DirectoryStorage::NO_INDEX) ;
 
             mUpdateFlags |= P3FILELISTS_UPDATE_FLAG_REMOTE_DIRS_CHANGED ;
             mUpdateFlags |= P3FILELISTS_UPDATE_FLAG_REMOTE_MAP_CHANGED ;
@@ -1385,24 +1405,10 @@ int p3FileDatabase::SearchKeywords(
     {
 		std::list<void*> pointers ;
 
+        searchRemoteDirectories([&keywords](const RemoteDirectoryStorage *rds,std::list<EntryIndex>& local_results)
         {
-            RS_STACK_MUTEX(mFLSMtx) ;
-
-            for(uint32_t i=0;i<mRemoteDirectories.size();++i)
-                if(mRemoteDirectories[i] != NULL)
-                {
-                    std::list<EntryIndex> local_results;
-                    mRemoteDirectories[i]->searchTerms(keywords,local_results) ;
-
-                    for(std::list<EntryIndex>::iterator it(local_results.begin());it!=local_results.end();++it)
-                    {
-                        void *p=NULL;
-                        convertEntryIndexToPointer<sizeof(void*)>(*it,i+1,p);
-
-						pointers.push_back(p) ;
-					}
-                }
-        }
+            rds->searchTerms(keywords,local_results) ;
+        },pointers) ;
 
 		for(auto it(pointers.begin());it!=pointers.end();++it)
 		{
@@ -1443,23 +1449,11 @@ int p3FileDatabase::SearchBoolExp(RsRegularExpression::Expression *exp, std::lis
     if(flags & RS_FILE_HINTS_REMOTE)
     {
 		std::list<void*> pointers ;
-        {
-            RS_STACK_MUTEX(mFLSMtx) ;
 
-            for(uint32_t i=0;i<mRemoteDirectories.size();++i)
-                if(mRemoteDirectories[i] != NULL)
-                {
-                    std::list<EntryIndex> local_results;
-                    mRemoteDirectories[i]->searchBoolExp(exp,local_results) ;
-
-                    for(std::list<EntryIndex>::iterator it(local_results.begin());it!=local_results.end();++it)
-                    {
-                        void *p=NULL;
-                        convertEntryIndexToPointer<sizeof(void*)>(*it,i+1,p);
-						pointers.push_back(p) ;
-					}
-                }
-        }
+        searchRemoteDirectories([exp](const RemoteDirectoryStorage *rds,std::list<EntryIndex>& local_results)
+        {
+            rds->searchBoolExp(exp,local_results) ;
+        },pointers) ;
 
 		for(auto it(pointers.begin());it!=pointers.end();++it)
 		{
@@ -1506,27 +1500,117 @@ bool p3FileDatabase::search(
 
     if(hintflags & RS_FILE_HINTS_REMOTE)
     {
-        EntryIndex indx;
-		bool found = false ;
-		
-		for(uint32_t i=0;i<mRemoteDirectories.size();++i)
-			if(mRemoteDirectories[i] != NULL && mRemoteDirectories[i]->searchHash(hash,indx))
+		std::list<RsPeerId> peers ;
+
+		if(mRemoteHashIndex.findSources(hash,[this](const RsPeerId& pid) { return locked_findRemoteDirectory(pid) ; },peers))
+		{
+			for(std::list<RsPeerId>::const_iterator it(peers.begin());it!=peers.end();++it)
 			{
 				TransferInfo ti ;
-				ti.peerId = mRemoteDirectories[i]->peerId();
-				        
-				info.hash = hash ;
-				info.peers.push_back(ti) ;
+				ti.peerId = *it;
 
-				found = true ;
+				info.peers.push_back(ti) ;
 			}
-		
-		if(found)
+			info.hash = hash ;
+
 			return true;
+		}
     }
     return false;
 }
 
+void p3FileDatabase::locked_indexRemoteFiles(RemoteDirectoryStorage *rds,DirectoryStorage::EntryIndex dir_index)
+{
+    mRemoteHashIndex.indexFiles(rds,dir_index) ;
+}
+
+const RemoteDirectoryStorage *p3FileDatabase::locked_findRemoteDirectory(const RsPeerId& pid) const
+{
+    std::map<RsPeerId,uint32_t>::const_iterator it = mFriendIndexMap.find(pid) ;
+
+    if(it == mFriendIndexMap.end() || it->second >= mRemoteDirectories.size())
+        return NULL ;
+
+    return mRemoteDirectories[it->second] ;
+}
+
+void p3FileDatabase::locked_checkRemoteHashIndex()
+{
+    uint32_t nb_removed = mRemoteHashIndex.check([this](const RsPeerId& pid) { return locked_findRemoteDirectory(pid) ; }) ;
+
+#ifdef DEBUG_P3FILELISTS
+    P3FILELISTS_DEBUG() << "  checked remote hash index: " << mRemoteHashIndex.size() << " hashes, " << nb_removed << " stale entries removed." << std::endl;
+#else
+    (void)nb_removed ;
+#endif
+}
+
+void p3FileDatabase::locked_deleteRemoteDirectory(RemoteDirectoryStorage *rds)
+{
+    // a search may still be running on this list, off mutex.
+
+    if(mRemoteSearchesRunning > 0)
+        mRemoteDirectoriesToDelete.push_back(rds) ;
+    else
+        delete rds ;
+}
+
+void p3FileDatabase::searchRemoteDirectories(const std::function<void(const RemoteDirectoryStorage *,std::list<EntryIndex>&)>& search_one,std::list<void*>& pointers) const
+{
+    // Each RemoteDirectoryStorage has its own mutex, so the friend lists can be searched at the same time, and without
+    // mFLSMtx. The lists in the snapshot are not deleted before the search ends, see locked_deleteRemoteDirectory().
+
+    std::vector<const RemoteDirectoryStorage*> dirs ;
+    {
+        RS_STACK_MUTEX(mFLSMtx) ;
+
+        dirs.assign(mRemoteDirectories.begin(),mRemoteDirectories.end()) ;
+        ++mRemoteSearchesRunning ;
+    }
+
+    std::vector<std::list<EntryIndex> > results(dirs.size()) ;
+    std::atomic<uint32_t> next(0) ;
+
+    auto worker = [&]()
+    {
+        for(uint32_t i;(i = next++) < dirs.size();)
+            if(dirs[i] != NULL)
+                search_one(dirs[i],results[i]) ;
+    };
+
+    uint32_t nb_threads = std::min(std::min(MAX_REMOTE_SEARCH_THREADS,std::thread::hardware_concurrency()),uint32_t(dirs.size() / MIN_REMOTE_DIRS_PER_SEARCH_THREAD)) ;
+    std::vector<std::thread> threads ;
+
+    for(uint32_t i=1;i<nb_threads;++i)
+        threads.push_back(std::thread(worker)) ;
+
+    worker() ;
+
+    for(std::thread& t : threads)
+        t.join() ;
+
+    RS_STACK_MUTEX(mFLSMtx) ;
+
+    // Friends removed meanwhile may have had their index taken by another one. Their results are dropped.
+
+    for(uint32_t i=0;i<results.size();++i)
+        if(i < mRemoteDirectories.size() && mRemoteDirectories[i] == dirs[i])
+            for(std::list<EntryIndex>::const_iterator it(results[i].begin());it!=results[i].end();++it)
+            {
+                void *p=NULL;
+                convertEntryIndexToPointer<sizeof(void*)>(*it,i+1,p);
+                pointers.push_back(p) ;
+            }
+
+    if(--mRemoteSearchesRunning == 0)
+    {
+        for(std::list<RemoteDirectoryStorage*>::const_iterator it(mRemoteDirectoriesToDelete.begin());it!=mRemoteDirectoriesToDelete.end();++it)
+            delete *it ;
+
+        mRemoteDirectoriesToDelete.clear() ;
+    }
+}
+
 int p3FileDatabase::filterResults(
         const std::list<void*>& firesults, std::list<DirDetails>& results,
         FileSearchFlags flags, const RsPeerId& peer_id ) const
@@ -1958,7 +2042,10 @@ void p3FileDatabase::handleDirSyncResponse(RsFileListsSyncResponseItem*& sitem)
 #endif
 
         if(mRemoteDirectories[fi]->deserialiseUpdateDirEntry(entry_index,item->directory_content_data))
+        {
 			mRemoteDirectories[fi]->lastSweepTime() = now - DELAY_BETWEEN_REMOTE_DIRECTORIES_SWEEP + 10 ;  // force re-sweep in 10 secs, so as to fasten updated
+            locked_indexRemoteFiles(mRemoteDirectories[fi],entry_index) ;
+        }
         else
             P3FILELISTS_ERROR() << "(EE) Cannot deserialise dir entry. ERROR. "<< std::endl;
 
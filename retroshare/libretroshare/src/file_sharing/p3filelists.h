@@ -59,6 +59,8 @@
 //
 #pragma once
 
+#include <functional>
+
 #include "ft/ftsearch.h"
 #include "ft/ftextralist.h"
 #include "retroshare/rsfiles.h"
@@ -271,6 +273,26 @@ class p3FileDatabase: public p3Service, public p3Config, public ftSearch //, pub
 
         void locked_recursSweepRemoteDirectory(RemoteDirectoryStorage *rds, DirectoryStorage::EntryIndex e, int depth);
 
+        // Cross-friend index of remote files, from file hash to the friends that have it (see directory_storage.h).
+
+        void locked_indexRemoteFiles(RemoteDirectoryStorage *rds, DirectoryStorage::EntryIndex dir_index);
+        void locked_checkRemoteHashIndex();
+        const RemoteDirectoryStorage *locked_findRemoteDirectory(const RsPeerId& pid) const;
+
+        mutable RemoteFileHashIndex mRemoteHashIndex ;
+        rstime_t mLastRemoteHashIndexCheck ;
+
+        // Runs search_one on every remote directory, on several threads when there are many friends, and converts the
+        // results into pointers, in the order of mRemoteDirectories. Must be called without mFLSMtx: the lists are
+        // searched off mutex, so that a search does not block the other file list operations. Lists of friends that
+        // are removed meanwhile are only deleted once no search runs anymore.
+
+        void searchRemoteDirectories(const std::function<void(const RemoteDirectoryStorage *,std::list<EntryIndex>&)>& search_one, std::list<void*>& pointers) const;
+        void locked_deleteRemoteDirectory(RemoteDirectoryStorage *rds);
+
+        mutable uint32_t mRemoteSearchesRunning ;
+        mutable std::list<RemoteDirectoryStorage*> mRemoteDirectoriesToDelete ;
+
         // We use a shared file cache as well, to avoid re-hashing files with known modification TS and equal name.
 		//
         HashStorage *mHashCache ;
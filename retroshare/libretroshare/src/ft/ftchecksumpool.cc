@@ -0,0 +1,124 @@
+/*******************************************************************************
+ * libretroshare/src/ft: ftchecksumpool.cc                                     *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#include <algorithm>
+
+#include "ft/ftchecksumpool.h"
+
+ftChecksumPool::ftChecksumPool(uint32_t max_threads)
+    : mRunningTotal(0), mMaxThreads(max_threads), mStopping(false)
+{
+	// Jobs read 1MB from the disc before hashing it, so that two threads keep
+	// a single core busy.
+
+	if(mMaxThreads == 0)
+		mMaxThreads = std::min(4u,std::max(2u,std::thread::hardware_concurrency())) ;
+}
+
+ftChecksumPool::~ftChecksumPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMtx) ;
+		mJobs.clear() ;
+		mStopping = true ;
+	}
+	mCond.notify_all() ;
+
+	for(std::thread& t : mWorkers)
+		t.join() ;
+}
+
+void ftChecksumPool::addJob(const RsFileHash& hash, const std::function<void()>& fn)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMtx) ;
+
+		if(mStopping)
+			return ;
+
+		Job job ;
+		job.hash = hash ;
+		job.fn = fn ;
+		mJobs.push_back(job) ;
+
+		// Workers are only started when there is something to do, up to the limit.
+
+		if(mWorkers.size() < mMaxThreads && mWorkers.size() < mRunningTotal + mJobs.size())
+			mWorkers.push_back(std::thread(&ftChecksumPool::workerThread,this)) ;
+	}
+	mCond.notify_all() ;
+}
+
+void ftChecksumPool::cancelJobs(const RsFileHash& hash)
+{
+	std::unique_lock<std::mutex> lock(mMtx) ;
+
+	for(std::list<Job>::iterator it(mJobs.begin());it!=mJobs.end();)
+		if(it->hash == hash)
+			it = mJobs.erase(it) ;
+		else
+			++it ;
+
+	while(mRunning.find(hash) != mRunning.end())
+		mCond.wait(lock) ;
+}
+
+uint32_t ftChecksumPool::pendingJobs()
+{
+	std::lock_guard<std::mutex> lock(mMtx) ;
+
+	return mJobs.size() + mRunningTotal ;
+}
+
+void ftChecksumPool::workerThread()
+{
+	std::unique_lock<std::mutex> lock(mMtx) ;
+
+	for(;;)
+	{
+		if(mJobs.empty())
+		{
+			if(mStopping)
+				return ;
+
+			mCond.wait(lock) ;
+			continue ;
+		}
+
+		Job job ;
+		job.hash = mJobs.front().hash ;
+		job.fn.swap(mJobs.front().fn) ;
+		mJobs.pop_front() ;
+
+		++mRunning[job.hash] ;
+		++mRunningTotal ;
+
+		lock.unlock() ;
+		job.fn() ;
+		lock.lock() ;
+
+		if(--mRunning[job.hash] == 0)
+			mRunning.erase(job.hash) ;
+		--mRunningTotal ;
+
+		mCond.notify_all() ;
+	}
+}
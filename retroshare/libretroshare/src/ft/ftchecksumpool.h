@@ -0,0 +1,84 @@
+/*******************************************************************************
+ * libretroshare/src/ft: ftchecksumpool.h                                      *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#pragma once
+
+// ftChecksumPool runs the sha1 computations of file transfer on a few worker
+// threads, so that they do not stop the thread that queued them:
+//
+//  - checking downloaded chunks against the sums given by the sources, as soon
+//    as these sums arrive,
+//  - computing the sums of shared file chunks that friends ask for.
+//
+// Jobs are tagged with the hash of the file they work on. Jobs that use a
+// ftFileCreator must be cancelled with cancelJobs() before the file creator
+// is deleted.
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "retroshare/rstypes.h"
+
+class ftChecksumPool
+{
+public:
+	/// max_threads = 0 chooses from the number of cores.
+	explicit ftChecksumPool(uint32_t max_threads = 0) ;
+
+	/// Drops the pending jobs, waits for the running ones and stops the threads.
+	~ftChecksumPool() ;
+
+	/// Runs fn on a worker thread. Jobs run in the order they are added.
+	void addJob(const RsFileHash& hash, const std::function<void()>& fn) ;
+
+	/// Drops the jobs of this file that have not started yet, and waits for
+	/// the ones that are running.
+	void cancelJobs(const RsFileHash& hash) ;
+
+	/// Number of jobs waiting or running.
+	uint32_t pendingJobs() ;
+
+private:
+	struct Job
+	{
+		RsFileHash hash ;
+		std::function<void()> fn ;
+	};
+
+	void workerThread() ;
+
+	std::mutex mMtx ;
+	std::condition_variable mCond ;
+
+	std::list<Job> mJobs ;
+	std::map<RsFileHash,uint32_t> mRunning ;	// number of running jobs per file
+	uint32_t mRunningTotal ;
+
+	std::vector<std::thread> mWorkers ;
+	uint32_t mMaxThreads ;
+	bool mStopping ;
+};
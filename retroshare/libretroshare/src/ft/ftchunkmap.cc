@@ -29,6 +29,8 @@
 #endif
 #include <math.h>
 #include <stdlib.h>
+#include <limits>
+#include <algorithm>
 #include "retroshare/rspeers.h"
 #include "ftchunkmap.h"
 #include "util/rstime.h"
@@ -37,6 +39,9 @@ static const uint32_t SOURCE_CHUNK_MAP_UPDATE_PERIOD	=   60 ; //! TTL for chunkm
 static const uint32_t INACTIVE_CHUNK_TIME_LAPSE 		= 3600 ; //! TTL for an inactive chunk
 static const uint32_t FT_CHUNKMAP_MAX_CHUNK_JUMP		=   50 ; //! Maximum chunk jump in progressive DL mode
 static const uint32_t FT_CHUNKMAP_MAX_SLICE_REASK_DELAY =   10 ; //! Maximum time to re-ask a slice to another peer at end of transfer
+static const uint32_t FT_CHUNKMAP_MAX_ENDGAME_SOURCES   =    3 ; //! Maximum number of sources a slice is asked to at once because they are faster
+static const uint32_t FT_CHUNKMAP_MIN_SOURCE_RATE       = 1024 ; //! Speed assumed for sources we know nothing about, in bytes per second
+static const uint32_t FT_CHUNKMAP_MAX_FAST_SOURCE_CHUNKS =    2 ; //! Maximum number of active chunks of a source faster than the median
 
 std::ostream& operator<<(std::ostream& o,const ftChunk& c)
 {
@@ -73,6 +78,7 @@ ChunkMap::ChunkMap(uint64_t s,bool availability)
 		++n ;
 
 	_map.resize(n,FileChunksInfo::CHUNK_OUTSTANDING) ;
+	_chunk_availability.resize(n,0) ;
 	_strategy = FileChunksInfo::CHUNK_STRATEGY_PROGRESSIVE ;
 	_total_downloaded = 0 ;
 	_file_is_complete = false ;
@@ -265,25 +271,61 @@ bool ChunkMap::reAskPendingChunk( const RsPeerId& peer_id,
 			return false ;
 
 	rstime_t now = time(NULL);
+	SourceChunksInfo *sci = getSourceChunksInfo(peer_id) ;
+
+	// Endgame: among the pending slices this peer has, take the one that is expected to arrive last. It is
+	// re-asked right away if this peer should deliver it sooner than the sources it was asked to, and
+	// otherwise only after some delay, in case one of these sources is stuck.
+
+	ChunkDownloadInfo::SliceRequestInfo *best = NULL ;
+	ftChunk::OffsetInFile best_offset = 0 ;
+	float best_arrival = 0 ;
 
 	for(std::map<uint32_t,ChunkDownloadInfo>::iterator it(_slices_to_download.begin());it!=_slices_to_download.end();++it)
+	{
+		if(!sci->hasData(it->first*(uint64_t)_chunk_size,_chunk_size))
+			continue ;
+
 		for(std::map<ftChunk::OffsetInFile,ChunkDownloadInfo::SliceRequestInfo >::iterator it2(it->second._slices.begin());it2!=it->second._slices.end();++it2)
-			if(it2->second.request_time + FT_CHUNKMAP_MAX_SLICE_REASK_DELAY < now && it2->second.peers.end()==it2->second.peers.find(peer_id))
+		{
+			ChunkDownloadInfo::SliceRequestInfo& r(it2->second) ;
+
+			if(r.peers.end() != r.peers.find(peer_id))
+				continue ;
+
+			// expected arrival time, counted from now.
+
+			float arrival = std::numeric_limits<float>::max() ;
+
+			for(std::set<RsPeerId>::const_iterator pit(r.peers.begin());pit!=r.peers.end();++pit)
+				arrival = std::min(arrival,(r.request_time - now) + transferTime(*pit,r.size)) ;
+
+			bool late   = r.request_time + FT_CHUNKMAP_MAX_SLICE_REASK_DELAY < now ;
+			bool faster = r.peers.size() < FT_CHUNKMAP_MAX_ENDGAME_SOURCES && transferTime(peer_id,r.size) < arrival ;
+
+			if((late || faster) && (best == NULL || arrival > best_arrival))
 			{
-				offset = it2->first;
-				size   = it2->second.size ;
+				best = &r ;
+				best_offset = it2->first ;
+				best_arrival = arrival ;
+			}
+		}
+	}
+
+	if(best == NULL)
+		return false ;
+
+	offset = best_offset ;
+	size   = best->size ;
 
 #ifdef DEBUG_FTCHUNK
-				std::cerr << "*** ChunkMap::reAskPendingChunk: re-asking slice (" << offset << ", " << size << ") to peer " << peer_id << std::endl;
+	std::cerr << "*** ChunkMap::reAskPendingChunk: re-asking slice (" << offset << ", " << size << ") to peer " << peer_id << std::endl;
 #endif
 
-				it2->second.request_time = now ;
-				it2->second.peers.insert(peer_id) ;
-
-				return true ;
-			}
+	best->request_time = now ;
+	best->peers.insert(peer_id) ;
 
-	return false ;
+	return true ;
 }
 
 // Warning: a chunk may be empty, but still being downloaded, so asking new slices from it
@@ -303,19 +345,30 @@ bool ChunkMap::getDataChunk(const RsPeerId& peer_id,uint32_t size_hint,ftChunk&
 #ifdef DEBUG_FTCHUNK
 	std::cerr << "*** ChunkMap::getDataChunk: size_hint = " << size_hint << std::endl ;
 #endif
+	SourceChunksInfo *sci = getSourceChunksInfo(peer_id) ;
+	rstime_t now = time(NULL) ;
+
+	// The transfer module asks each source for as many bytes per second as it is able to send. The first request
+	// of each second carries the full amount.
+	//
+	if(sci->rate_TS != now)
+	{
+		sci->rate = size_hint ;
+		sci->rate_TS = now ;
+	}
+
 	// 1 - find if this peer already has an active chunk.
 	//
-	std::map<RsPeerId,Chunk>::iterator it = _active_chunks_feed.find(peer_id) ;
-	std::map<RsPeerId,Chunk>::iterator falsafe_it = _active_chunks_feed.end() ;
+	std::multimap<RsPeerId,Chunk>::iterator it = _active_chunks_feed.find(peer_id) ;
+	std::multimap<RsPeerId,Chunk>::iterator falsafe_it = _active_chunks_feed.end() ;
+	float falsafe_time = 0 ;
 
 	if(it == _active_chunks_feed.end())		
 	{
-		SourceChunksInfo *sci = getSourceChunksInfo(peer_id) ;
-
 		// 0 - Look into other pending chunks and slice from here. We only consider chunks with size smaller than 
 		//    the requested size,
 		//
-		for(std::map<RsPeerId,Chunk>::iterator pit(_active_chunks_feed.begin());pit!=_active_chunks_feed.end();++pit)
+		for(std::multimap<RsPeerId,Chunk>::iterator pit(_active_chunks_feed.begin());pit!=_active_chunks_feed.end();++pit)
 		{
 			uint32_t c = pit->second._start / _chunk_size ;
 
@@ -323,7 +376,17 @@ bool ChunkMap::getDataChunk(const RsPeerId& peer_id,uint32_t size_hint,ftChunk&
 				continue ;
 
 			ChunkDownloadInfo& cdi(_slices_to_download[c]) ;
-			falsafe_it = pit ;											// let's keep this one just in case.
+
+			// let's keep this one just in case. If no new chunk is available, we help the source that
+			// would take the longest to finish its chunk.
+			//
+			float t = transferTime(pit->first,pit->second._end - pit->second._offset) ;
+
+			if(falsafe_it == _active_chunks_feed.end() || t > falsafe_time)
+			{
+				falsafe_it = pit ;
+				falsafe_time = t ;
+			}
 
 			if(cdi._slices.rbegin() != cdi._slices.rend() && cdi._slices.rbegin()->second.size*0.7 <= (float)size_hint)
 			{
@@ -356,24 +419,34 @@ bool ChunkMap::getDataChunk(const RsPeerId& peer_id,uint32_t size_hint,ftChunk&
 				else
 					return false ;		// no more availabel chunks, no falsafe case.
 			else
-			{
-				// 2 - add the chunk in the list of active chunks, and mark it as being downloaded
-				//
-				uint32_t soc = sizeOfChunk(c) ;
-				_active_chunks_feed[peer_id] = Chunk( c*(uint64_t)_chunk_size, soc ) ;
-				_map[c] = FileChunksInfo::CHUNK_ACTIVE ;
-				_slices_to_download[c]._remains = soc ;			// init the list of slices to download
-				it = _active_chunks_feed.find(peer_id) ;
-#ifdef DEBUG_FTCHUNK
-				std::cout << "*** ChunkMap::getDataChunk: Allocating new chunk " << c << " for peer " << peer_id << std::endl ;
-#endif
-			}
+				it = activateChunk(peer_id,c) ;	// 2 - add the chunk in the list of active chunks
 		}
 	}
-#ifdef DEBUG_FTCHUNK
 	else
+	{
+		// A source faster than the median may have a second active chunk: its next chunk is picked among the rarest
+		// while it still works on the current one, and sources without a chunk can take slices of it meanwhile.
+		// Slices are taken from the chunk of this source that has the least data left to ask, so that it finishes
+		// one chunk before the other. Asking both in turn delays both, which loses data when a source leaves.
+		//
+		if(_active_chunks_feed.count(peer_id) < FT_CHUNKMAP_MAX_FAST_SOURCE_CHUNKS && isFasterThanMedian(peer_id))
+		{
+			uint32_t c = getAvailableChunk(peer_id,source_chunk_map_needed) ;
+
+			if(c < _map.size())
+				activateChunk(peer_id,c) ;
+		}
+
+		std::pair<std::multimap<RsPeerId,Chunk>::iterator,std::multimap<RsPeerId,Chunk>::iterator> range = _active_chunks_feed.equal_range(peer_id) ;
+		it = range.first ;
+
+		for(std::multimap<RsPeerId,Chunk>::iterator pit(range.first);pit!=range.second;++pit)
+			if(pit->second._end - pit->second._offset < it->second._end - it->second._offset)
+				it = pit ;
+#ifdef DEBUG_FTCHUNK
 		std::cout << "*** ChunkMap::getDataChunk: Re-using chunk " << it->second._start/_chunk_size << " for peer " << peer_id << std::endl ;
 #endif
+	}
 
 	// Get the first slice of the chunk, that is at most of length size
 	//
@@ -397,6 +470,19 @@ bool ChunkMap::getDataChunk(const RsPeerId& peer_id,uint32_t size_hint,ftChunk&
 	return true ;
 }
 
+std::multimap<RsPeerId,Chunk>::iterator ChunkMap::activateChunk(const RsPeerId& peer_id,uint32_t c)
+{
+	// mark the chunk as being downloaded, and init the list of slices to download
+	//
+	uint32_t soc = sizeOfChunk(c) ;
+	_map[c] = FileChunksInfo::CHUNK_ACTIVE ;
+	_slices_to_download[c]._remains = soc ;
+#ifdef DEBUG_FTCHUNK
+	std::cout << "*** ChunkMap::getDataChunk: Allocating new chunk " << c << " for peer " << peer_id << std::endl ;
+#endif
+	return _active_chunks_feed.insert(std::make_pair(peer_id,Chunk( c*(uint64_t)_chunk_size, soc ))) ;
+}
+
 void ChunkMap::removeInactiveChunks(std::vector<ftChunk::OffsetInFile>& to_remove)
 {
 	to_remove.clear() ;
@@ -421,10 +507,10 @@ void ChunkMap::removeInactiveChunks(std::vector<ftChunk::OffsetInFile>& to_remov
 
 			// Also remove the chunk from the chunk feed, to free the associated peer.
 			//
-			for(std::map<RsPeerId,Chunk>::iterator it3=_active_chunks_feed.begin();it3!=_active_chunks_feed.end();)
+			for(std::multimap<RsPeerId,Chunk>::iterator it3=_active_chunks_feed.begin();it3!=_active_chunks_feed.end();)
 				if(it3->second._start == _chunk_size*uint64_t(it->first))
 				{
-					std::map<RsPeerId,Chunk>::iterator tmp3 = it3 ;
+					std::multimap<RsPeerId,Chunk>::iterator tmp3 = it3 ;
 					++it3 ;
 					_active_chunks_feed.erase(tmp3) ;
 				}
@@ -489,7 +575,10 @@ void ChunkMap::setPeerAvailabilityMap(const RsPeerId& peer_id,const CompressedCh
 	// sets the map.
 	//
 	SourceChunksInfo& mi(_peers_chunks_availability[peer_id]) ;
+
+	updateChunkAvailability(mi,-1) ;
 	mi.cmap = cmap ;
+	updateChunkAvailability(mi,1) ;
 	mi.TS = time(NULL) ;
 	mi.is_full = true ;
 
@@ -548,6 +637,7 @@ SourceChunksInfo *ChunkMap::getSourceChunksInfo(const RsPeerId& peer_id)
 			pchunks.TS = 0 ;
 			pchunks.is_full = false ;
 		}
+		updateChunkAvailability(pchunks,1) ;
 
 		it = _peers_chunks_availability.find(peer_id) ;
 	}
@@ -597,34 +687,49 @@ uint32_t ChunkMap::getAvailableChunk(const RsPeerId& peer_id,bool& map_is_too_ol
 
 	if(available_chunks > 0)
 	{
-		uint32_t chosen_chunk_number ;
+		// Number of available chunks, in file order, among which we choose.
+		//
+		uint32_t window ;
 
 		switch(_strategy)
 		{
-			case FileChunksInfo::CHUNK_STRATEGY_STREAMING:   chosen_chunk_number = 0 ;
+			case FileChunksInfo::CHUNK_STRATEGY_STREAMING:   window = 1 ;
 																		    break ;
-			case FileChunksInfo::CHUNK_STRATEGY_RANDOM:      chosen_chunk_number = rand() % available_chunks ;
+			case FileChunksInfo::CHUNK_STRATEGY_RANDOM:      window = available_chunks ;
 																		    break ;
-			case FileChunksInfo::CHUNK_STRATEGY_PROGRESSIVE: chosen_chunk_number = rand() % std::min(available_chunks, available_chunks_before_max_dist+FT_CHUNKMAP_MAX_CHUNK_JUMP) ;
+			case FileChunksInfo::CHUNK_STRATEGY_PROGRESSIVE: window = std::min(available_chunks, available_chunks_before_max_dist+FT_CHUNKMAP_MAX_CHUNK_JUMP) ;
 																		    break ;
 			default:
-																			 chosen_chunk_number = 0 ;
+																			 window = 1 ;
 		}
+
+		// Rarest first: keep the chunks that the fewest sources have, so that they get downloaded while these
+		// sources are still there, and pick one of them at random so that sources do not all pick the same.
+		//
+		std::vector<uint32_t> rarest_chunks ;
+		uint32_t min_availability = std::numeric_limits<uint32_t>::max() ;
 		uint32_t j=0 ;
 
-		for(uint32_t i=0;i<_map.size();++i)
+		for(uint32_t i=0;i<_map.size() && j<window;++i)
 			if(_map[i] == FileChunksInfo::CHUNK_OUTSTANDING && (peer_chunks->is_full || peer_chunks->cmap[i]))
 			{
-				if(j == chosen_chunk_number)
+				++j ;
+
+				if(_chunk_availability[i] < min_availability)
 				{
-#ifdef DEBUG_FTCHUNK
-					std::cerr << "ChunkMap::getAvailableChunk: returning chunk " << i << " for peer " << peer_id << std::endl;
-#endif
-					return i ;
+					min_availability = _chunk_availability[i] ;
+					rarest_chunks.clear() ;
 				}
-				else
-					++j ;
+				if(_chunk_availability[i] == min_availability)
+					rarest_chunks.push_back(i) ;
 			}
+
+		uint32_t chosen_chunk = rarest_chunks[rand() % rarest_chunks.size()] ;
+
+#ifdef DEBUG_FTCHUNK
+		std::cerr << "ChunkMap::getAvailableChunk: returning chunk " << chosen_chunk << " (" << min_availability << " sources) for peer " << peer_id << std::endl;
+#endif
+		return chosen_chunk ;
 	}
 
 #ifdef DEBUG_FTCHUNK
@@ -658,9 +763,57 @@ void ChunkMap::removeFileSource(const RsPeerId& peer_id)
 	if(it == _peers_chunks_availability.end())
 		return ;
 
+	updateChunkAvailability(it->second,-1) ;
 	_peers_chunks_availability.erase(it) ;
 }
 
+void ChunkMap::updateChunkAvailability(const SourceChunksInfo& sci,int delta)
+{
+	if(sci.cmap._map.size() < CompressedChunkMap::getCompressedSize(_map.size()))	// not filled yet
+		return ;
+
+	for(uint32_t i=0;i<_map.size();++i)
+		if(sci.cmap[i])
+			_chunk_availability[i] += delta ;
+}
+
+float ChunkMap::transferTime(const RsPeerId& peer_id,uint32_t size) const
+{
+	std::map<RsPeerId,SourceChunksInfo>::const_iterator it(_peers_chunks_availability.find(peer_id)) ;
+
+	uint32_t rate = FT_CHUNKMAP_MIN_SOURCE_RATE ;
+
+	if(it != _peers_chunks_availability.end())
+		rate = std::max(rate,it->second.rate) ;
+
+	return size / (float)rate ;
+}
+
+bool ChunkMap::isFasterThanMedian(const RsPeerId& peer_id) const
+{
+	std::vector<uint32_t> rates ;
+	uint32_t peer_rate = 0 ;
+
+	for(std::map<RsPeerId,SourceChunksInfo>::const_iterator it(_peers_chunks_availability.begin());it!=_peers_chunks_availability.end();++it)
+		if(it->second.rate > 0)
+		{
+			rates.push_back(it->second.rate) ;
+
+			if(it->first == peer_id)
+				peer_rate = it->second.rate ;
+		}
+
+	if(rates.size() < 2)
+		return false ;
+
+	// lower median, so that the faster of two sources is above it.
+	//
+	std::vector<uint32_t>::iterator median = rates.begin() + (rates.size()-1)/2 ;
+	std::nth_element(rates.begin(),median,rates.end()) ;
+
+	return peer_rate > *median ;
+}
+
 void ChunkMap::getAvailabilityMap(CompressedChunkMap& compressed_map) const 
 {
 	compressed_map = CompressedChunkMap(_map) ; 
@@ -681,6 +834,14 @@ void ChunkMap::forceCheck()
 	updateTotalDownloaded() ;
 }
 
+FileChunksInfo::ChunkState ChunkMap::getChunkState(uint32_t chunk_number) const
+{
+	if(chunk_number >= _map.size())
+		return FileChunksInfo::CHUNK_OUTSTANDING ;
+
+	return _map[chunk_number] ;
+}
+
 uint32_t ChunkMap::getNumberOfChunks(uint64_t size)
 {
 	uint64_t n = size/(uint64_t)CHUNKMAP_FIXED_CHUNK_SIZE ;
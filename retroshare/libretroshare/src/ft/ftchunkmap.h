@@ -110,9 +110,13 @@ struct ChunkDownloadInfo
 class SourceChunksInfo
 {
 	public:
+		SourceChunksInfo() : TS(0), is_full(false), rate(0), rate_TS(0) {}
+
 		CompressedChunkMap cmap ;	//! map of what the peer has/doens't have
 		rstime_t TS ;						//! last update time for this info
 		bool is_full ;					//! is the map full ? In such a case, re-asking for it is unnecessary.
+		uint32_t rate ;					//! bytes per second the transfer module asks to this source, i.e. its measured speed.
+		rstime_t rate_TS ;				//! last time the rate was updated
 
 		// Returns true if the offset is starting in a mapped chunk.
 		//
@@ -151,6 +155,8 @@ class ChunkMap
 
 		/// Returns an already pending slice that was being downloaded but hasn't arrived yet. This is mostly used at the end of the file
 		/// in order to re-ask pendign slices to active peers while slow peers take a lot of time to send their remaining slices.
+		/// The slice that is expected last, given the speed of the sources it was asked to, is re-asked first. It is re-asked
+		/// at once if this peer would deliver it sooner, and otherwise after some delay.
 		///
 		bool reAskPendingChunk(const RsPeerId& peer_id,uint32_t size_hint,uint64_t& offset,uint32_t& size);
 
@@ -164,7 +170,8 @@ class ChunkMap
 
       /// Decides how chunks are selected. 
       ///    STREAMING: the 1st chunk is always returned
-      ///       RANDOM: a uniformly random chunk is selected among available chunks for the current source.
+      ///       RANDOM: a random chunk is selected among the rarest available chunks for the current source.
+      ///  PROGRESSIVE: same as RANDOM, but only among the first chunks after the downloaded part.
       ///              
 
 		void setStrategy(FileChunksInfo::ChunkStrategy s) { _strategy = s ; }
@@ -229,6 +236,9 @@ class ChunkMap
 		/// sets all chunks to checking state
 		void forceCheck() ;
 
+		/// state of the given chunk. Chunks out of the file are reported as outstanding.
+		FileChunksInfo::ChunkState getChunkState(uint32_t chunk_number) const ;
+
 		/// Goes through all structures and computes the actual file completion. The true completion
 		/// gets lost when force checking the file.
 		void updateTotalDownloaded() ;
@@ -244,13 +254,26 @@ class ChunkMap
 	private:
         bool hasChunkState(uint64_t offset, uint32_t chunk_size, FileChunksInfo::ChunkState state) const;
 
+		/// Adds (or removes, if delta<0) the chunks of this source to the availability count of each chunk.
+		void updateChunkAvailability(const SourceChunksInfo& sci,int delta) ;
+
+		/// Time in seconds this source needs to send size bytes.
+		float transferTime(const RsPeerId& peer_id,uint32_t size) const ;
+
+		/// True when the rate of this source is above the median rate of the sources.
+		bool isFasterThanMedian(const RsPeerId& peer_id) const ;
+
+		/// Marks chunk c as being downloaded from this source, and adds it to its active chunks.
+		std::multimap<RsPeerId,Chunk>::iterator activateChunk(const RsPeerId& peer_id,uint32_t c) ;
+
 		uint64_t												_file_size ;						//! total size of the file in bytes.
 		uint32_t												_chunk_size ;						//! Size of chunks. Common to all chunks.
 		FileChunksInfo::ChunkStrategy 				_strategy ;							//! how do we allocate new chunks
-		std::map<RsPeerId,Chunk>					   _active_chunks_feed ; 			//! vector of chunks being downloaded. Exactly 1 chunk per peer.
+		std::multimap<RsPeerId,Chunk>				   _active_chunks_feed ; 			//! chunks being downloaded. 1 chunk per peer, 2 for peers faster than the median.
 		std::map<ChunkNumber,ChunkDownloadInfo>	_slices_to_download ; 			//! list of (slice offset,slice size) currently being downloaded
 		std::vector<FileChunksInfo::ChunkState>	_map ;								//! vector of chunk state over the whole file
 		std::map<RsPeerId,SourceChunksInfo>		_peers_chunks_availability ;	//! what does each source peer have
+		std::vector<uint32_t>							_chunk_availability ;			//! number of sources having each chunk
 		uint64_t												_total_downloaded ;				//! completion for the file
 		bool													_file_is_complete ;           //! set to true when the file is complete.
 		bool													_assume_availability ;			//! true if all sources always have the complete file.
@@ -331,7 +331,8 @@ void ftController::tickTransfers()
 #ifdef CONTROL_DEBUG
 	//	std::cerr << "ticking transfers." << std::endl ;
 #endif
-	// Collect all non queued files.
+	// Collect all non queued files. Data requests are sent by the transfer modules as data comes in,
+	// so ticking them only restarts idle sources, gives up lost requests and checks finished files.
 	//
     for(std::map<RsFileHash,ftFileControl*>::iterator it(mDownloads.begin()); it != mDownloads.end(); ++it)
 		if(it->second->mState != ftFileControl::QUEUED && it->second->mState != ftFileControl::PAUSED)
@@ -35,6 +35,7 @@
 #include <inttypes.h>
 
 #include <retroshare/rstypes.h>
+#include "util/rsmemory.h"
 
 	/*************** SEND INTERFACE *******************/
 
@@ -51,6 +52,10 @@ class ftDataSend
 		/* Server Send */
         virtual bool    sendData(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize, void *data) = 0;
 
+		/// true if chunksize more bytes of data for peerId fit in its out queue. When false, the
+		/// data requests of that peer should wait for ftDataRecv::outgoingWritable().
+        virtual bool    canSendData(const RsPeerId& /*peerId*/, uint32_t /*chunksize*/) { return true; }
+
 		/// Send a chunkmap[request]. Because requests/chunkmaps can go both
 		//directions, but for different usages, we have this "is_client" flags,
 		//that gives the ultimate goal of the data. "is_client==true" means that
@@ -74,8 +79,11 @@ class ftDataRecv
 	public:
 		virtual ~ftDataRecv() { return; }
 
-		/* Client Recv */
-        virtual bool    recvData(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize, void *data) = 0;
+		/// The out queue of peerId has room again, after canSendData() returned false.
+        virtual void    outgoingWritable(const RsPeerId& /*peerId*/) {}
+
+		/* Client Recv. data may be a view into the received packet */
+        virtual bool    recvData(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize, const RsSharedBuffer& data) = 0;
 
 		/* Server Recv */
         virtual bool    recvDataRequest(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize) = 0;
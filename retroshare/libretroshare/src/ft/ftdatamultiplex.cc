@@ -44,6 +44,7 @@ const uint32_t DMULTIPLEX_MAX   = 1000; /* 1 sec sleep */
 const double   DMULTIPLEX_RELAX = 0.5; /* relax factor to calculate sleep time if not working in /libretroshare/src/util/rsthreads.cc */
 
 static const uint32_t MAX_CHECKING_CHUNK_WAIT_DELAY   = 120 ; //! TTL for an inactive chunk
+static const uint32_t DEFERRED_REQUESTS_RETRY_DELAY   =   1 ; //! retry of data requests that wait for the out queue without notification
 const uint32_t MAX_SIMULTANEOUS_CRC_REQUESTS = 500 ;
 
 /******
@@ -63,7 +64,7 @@ const uint32_t FT_SERVER_CHUNK_MAP_REQ	= 0x0004;		// chunk map request to be tre
 //const uint32_t FT_CRC32MAP_REQ        	= 0x0005;		// crc32 map request to be treated by server
 const uint32_t FT_CLIENT_CHUNK_CRC_REQ	= 0x0006;		// chunk sha1 crc request to be treated
 
-ftRequest::ftRequest(uint32_t type, const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunk, void *data)
+ftRequest::ftRequest(uint32_t type, const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunk, const RsSharedBuffer& data)
 	:mType(type), mPeerId(peerId), mHash(hash), mSize(size),
 	mOffset(offset), mChunk(chunk), mData(data)
 {
@@ -72,7 +73,7 @@ ftRequest::ftRequest(uint32_t type, const RsPeerId& peerId, const RsFileHash& ha
 
 ftDataMultiplex::ftDataMultiplex(const RsPeerId& ownId, ftDataSend *server, ftSearch *search)
 	:RsQueueThread(DMULTIPLEX_MIN, DMULTIPLEX_MAX, DMULTIPLEX_RELAX), dataMtx("ftDataMultiplex"),
-	mDataSend(server),  mSearch(search), mOwnId(ownId)
+	mLastDeferredRetry(0), mDataSend(server),  mSearch(search), mOwnId(ownId)
 {
 	return;
 }
@@ -129,28 +130,36 @@ bool	ftDataMultiplex::addTransferModule(ftTransferModule *mod, ftFileCreator *f)
 		
 bool	ftDataMultiplex::removeTransferModule(const RsFileHash& hash)
 {
-	RsStackMutex stack(dataMtx); /******* LOCK MUTEX ******/
-
-    std::map<RsFileHash, ftClient>::iterator it;
-	if (mClients.end() == (it = mClients.find(hash)))
 	{
-		/* error */
-		return false;
+		RsStackMutex stack(dataMtx); /******* LOCK MUTEX ******/
+
+		std::map<RsFileHash, ftClient>::iterator it;
+		if (mClients.end() == (it = mClients.find(hash)))
+		{
+			/* error */
+			return false;
+		}
+		mClients.erase(it);
+
+		// This is very important to delete the hash from servers as well, because
+		// after removing the transfer module, ftController will delete the fileCreator.
+		// If the file creator is also a server in use, then it will cause a crash
+		// at the next server request. 
+		//
+		// With the current action, the next server request will re-create the server as
+		// a ftFileProvider.
+		//
+		std::map<RsFileHash, ftFileProvider*>::iterator sit = mServers.find(hash) ;
+
+		if(sit != mServers.end())
+			mServers.erase(sit);
 	}
-	mClients.erase(it);
 
-	// This is very important to delete the hash from servers as well, because
-	// after removing the transfer module, ftController will delete the fileCreator.
-	// If the file creator is also a server in use, then it will cause a crash
-	// at the next server request. 
-	//
-	// With the current action, the next server request will re-create the server as
-	// a ftFileProvider.
-	//
-    std::map<RsFileHash, ftFileProvider*>::iterator sit = mServers.find(hash) ;
+	// Same for the chunk checks that use the file creator. This is done off-mutex,
+	// since checks take the mutex when they end. No new check can be queued now
+	// that the client is gone.
 
-	if(sit != mServers.end())
-		mServers.erase(sit);
+	mChecksumPool.cancelJobs(hash) ;
 
 	return true;
 }
@@ -263,7 +272,7 @@ bool	ftDataMultiplex::sendData(const RsPeerId& peerId, const RsFileHash& hash, u
 	/*************** RECV INTERFACE (provides ftDataRecv) ****************/
 
 	/* Client Recv */
-bool	ftDataMultiplex::recvData(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize, void *data)
+bool	ftDataMultiplex::recvData(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize, const RsSharedBuffer& data)
 {
 #ifdef MPLEX_DEBUG
 	std::cerr << "ftDataMultiplex::recvData() Client Recv";
@@ -287,7 +296,7 @@ bool	ftDataMultiplex::recvDataRequest(const RsPeerId& peerId, const RsFileHash&
 	/* Store in Queue */
 	RsStackMutex stack(dataMtx); /******* LOCK MUTEX ******/
 	mRequestQueue.push_back(
-		ftRequest(FT_DATA_REQ,peerId,hash,size,offset,chunksize,NULL));
+		ftRequest(FT_DATA_REQ,peerId,hash,size,offset,chunksize));
 
 	return true;
 }
@@ -302,9 +311,9 @@ bool	ftDataMultiplex::recvChunkMapRequest(const RsPeerId& peerId, const RsFileHa
 	RsStackMutex stack(dataMtx); /******* LOCK MUTEX ******/
 
 	if(is_client)
-		mRequestQueue.push_back(ftRequest(FT_CLIENT_CHUNK_MAP_REQ,peerId,hash,0,0,0,NULL));
+		mRequestQueue.push_back(ftRequest(FT_CLIENT_CHUNK_MAP_REQ,peerId,hash,0,0,0));
 	else
-		mRequestQueue.push_back(ftRequest(FT_SERVER_CHUNK_MAP_REQ,peerId,hash,0,0,0,NULL));
+		mRequestQueue.push_back(ftRequest(FT_SERVER_CHUNK_MAP_REQ,peerId,hash,0,0,0));
 
 	return true;
 }
@@ -318,7 +327,7 @@ bool	ftDataMultiplex::recvSingleChunkCRCRequest(const RsPeerId& peerId, const Rs
 	/* Store in Queue */
 	RsStackMutex stack(dataMtx); /******* LOCK MUTEX ******/
 
-	mRequestQueue.push_back(ftRequest(FT_CLIENT_CHUNK_CRC_REQ,peerId,hash,0,0,chunk_number,NULL));
+	mRequestQueue.push_back(ftRequest(FT_CLIENT_CHUNK_CRC_REQ,peerId,hash,0,0,chunk_number));
 
 	return true;
 }
@@ -332,6 +341,11 @@ bool 	ftDataMultiplex::workQueued()
 		return true;
 	}
 
+	if (!mDeferredRequests.empty() && time(NULL) >= mLastDeferredRetry + (rstime_t)DEFERRED_REQUESTS_RETRY_DELAY)
+	{
+		return true;
+	}
+
 	if (mSearchQueue.size() > 0)
 	{
 		return true;
@@ -340,10 +354,35 @@ bool 	ftDataMultiplex::workQueued()
 	return false;
 }
 	
+void	ftDataMultiplex::outgoingWritable(const RsPeerId& peerId)
+{
+	RsStackMutex stack(dataMtx); /******* LOCK MUTEX ******/
+
+	for(std::list<ftRequest>::iterator it(mDeferredRequests.begin());it!=mDeferredRequests.end();)
+		if(it->mPeerId == peerId)
+		{
+			mRequestQueue.push_back(*it);
+			it = mDeferredRequests.erase(it);
+		}
+		else
+			++it;
+}
+
 bool 	ftDataMultiplex::doWork()
 {
 	bool doRequests = true;
 
+	{
+		RsStackMutex stack(dataMtx); /******* LOCK MUTEX ******/
+		rstime_t now = time(NULL);
+
+		if (!mDeferredRequests.empty() && now >= mLastDeferredRetry + (rstime_t)DEFERRED_REQUESTS_RETRY_DELAY)
+		{
+			mRequestQueue.splice(mRequestQueue.end(), mDeferredRequests);
+			mLastDeferredRetry = now;
+		}
+	}
+
 	/* Handle All the current Requests */		
 	while(doRequests)
 	{
@@ -378,6 +417,15 @@ bool 	ftDataMultiplex::doWork()
 				std::cerr << "ftDataMultiplex::doWork() Handling FT_DATA_REQ";
 				std::cerr << std::endl;
 #endif
+				// Data is not read from the file while the peer cannot take it. The
+				// request waits, instead of the data waiting in the out queue.
+
+				if (!mDataSend->canSendData(req.mPeerId, req.mChunk))
+				{
+					RsStackMutex stack(dataMtx); /******* LOCK MUTEX ******/
+					mDeferredRequests.push_back(req);
+					break;
+				}
 				handleRecvDataRequest(req.mPeerId, req.mHash, req.mSize,  req.mOffset, req.mChunk);
 				break;
 
@@ -402,7 +450,10 @@ bool 	ftDataMultiplex::doWork()
 				std::cerr << "ftDataMultiplex::doWork() Handling FT_CLIENT_CHUNK_CRC_REQ";
 				std::cerr << std::endl;
 #endif
-				handleRecvChunkCrcRequest(req.mPeerId,req.mHash,req.mChunk) ;
+				// Reading and hashing the chunk is done in the checksum pool, so that
+				// data requests queued after it are not delayed.
+
+				mChecksumPool.addJob(req.mHash,[this,req]() { handleRecvChunkCrcRequest(req.mPeerId,req.mHash,req.mChunk) ; }) ;
 				break ;
 
 			default:
@@ -475,61 +526,66 @@ bool ftDataMultiplex::recvSingleChunkCRC(const RsPeerId& peerId, const RsFileHas
 	if(sha1cache._map.size() == 0)
 		sha1cache._map = Sha1Map(it->second.mCreator->fileSize(),ChunkMap::CHUNKMAP_FIXED_CHUNK_SIZE) ;
 
-	sha1cache._map.set(chunk_number,crc) ;
+	if(chunk_number >= sha1cache._map.size())
+	{
+		std::cerr << "ftDataMultiplex::recvSingleChunkCrc() ERROR: chunk " << chunk_number << " is out of file " << hash << std::endl;
+		return false ;
+	}
 
-	sha1cache._received.push_back(chunk_number) ;
+	sha1cache._map.set(chunk_number,crc) ;
 
 #ifdef MPLEX_DEBUG
 	std::cerr << "ftDataMultiplex::recvSingleChunkCrc() stored in cache. " << std::endl;
 #endif
 
+	locked_queueChunkCheck(hash,it->second.mCreator,chunk_number,crc) ;
+
 	return true ;
 }
 
-bool ftDataMultiplex::dispatchReceivedChunkCheckSum()
+void ftDataMultiplex::locked_queueChunkCheck(const RsFileHash& hash, ftFileCreator *creator, uint32_t chunk_number, const Sha1CheckSum& sum)
 {
-	RsStackMutex stack(dataMtx); /******* LOCK MUTEX ******/
+	mChecksumPool.addJob(hash,[this,hash,creator,chunk_number,sum]()
+	{
+		if(creator->verifyChunk(chunk_number,sum))
+			return ;
+
+		// The chunk will be downloaded again. Forget the sum, so that it is then
+		// checked with the sum of another source, in case this one was wrong.
 
-    uint32_t MAX_CHECKSUM_CHECK_PER_FILE = 500 ;
+		RsStackMutex stack(dataMtx); /******* LOCK MUTEX ******/
+
+		std::map<RsFileHash,Sha1CacheEntry>::iterator it(_cached_sha1maps.find(hash)) ;
+
+		if(it != _cached_sha1maps.end() && chunk_number < it->second._map.size())
+			it->second._map.reset(chunk_number) ;
+	}) ;
+}
+
+bool ftDataMultiplex::cleanChunkCheckSumCache()
+{
+	RsStackMutex stack(dataMtx); /******* LOCK MUTEX ******/
 
     for(std::map<RsFileHash,Sha1CacheEntry>::iterator it(_cached_sha1maps.begin());it!=_cached_sha1maps.end();)
 	{
         std::map<RsFileHash, ftClient>::iterator itc = mClients.find(it->first);
 
 #ifdef MPLEX_DEBUG
-		std::cerr << "ftDataMultiplex::dispatchReceivedChunkCheckSum(): treating hash " << it->first << std::endl;
+		std::cerr << "ftDataMultiplex::cleanChunkCheckSumCache(): treating hash " << it->first << std::endl;
 #endif
 
 		if(itc == mClients.end())
 		{
 #ifdef MPLEX_DEBUG
-			std::cerr << "ftDataMultiplex::dispatchReceivedChunkCheckSum() ERROR: No matching Client for hash. This is probably a late answer. Dropping the hash. Hash=" << it->first << std::endl;
+			std::cerr << "ftDataMultiplex::cleanChunkCheckSumCache(): No matching Client for hash. Dropping the hash. Hash=" << it->first << std::endl;
 #endif
 
             std::map<RsFileHash,Sha1CacheEntry>::iterator tmp(it) ;
 			++tmp ;
 			_cached_sha1maps.erase(it) ;
 			it = tmp ;
-			/* error */
 			continue ;
 		}
-		ftFileCreator *client = itc->second.mCreator ;
-
-		for(uint32_t n=0;n<MAX_CHECKSUM_CHECK_PER_FILE && !it->second._received.empty();++n)
-		{
-			int chunk_number = it->second._received.back() ;
-
-			if(!it->second._map.isSet(chunk_number))
-				std::cerr << "ftDataMultiplex::dispatchReceivedChunkCheckSum() ERROR: chunk " << chunk_number << " is supposed to be initialized but it was not received !!" << std::endl;
-			else
-			{
-#ifdef MPLEX_DEBUG
-				std::cerr << "ftDataMultiplex::dispatchReceivedChunkCheckSum(): checking chunk " << chunk_number << " with hash " << it->second._map[chunk_number].toStdString() << std::endl;
-#endif
-				client->verifyChunk(chunk_number,it->second._map[chunk_number]) ;
-			}
-			it->second._received.pop_back() ;
-		}
 		++it ;
 	}
 	return true ;
@@ -793,7 +849,7 @@ bool ftDataMultiplex::handleRecvServerChunkMapRequest(const RsPeerId& peerId, co
 	return true;
 }
 
-bool	ftDataMultiplex::handleRecvData(const RsPeerId& peerId, const RsFileHash& hash, uint64_t /*size*/, uint64_t offset, uint32_t chunksize, void *data)
+bool	ftDataMultiplex::handleRecvData(const RsPeerId& peerId, const RsFileHash& hash, uint64_t /*size*/, uint64_t offset, uint32_t chunksize, const RsSharedBuffer& data)
 {
 	ftTransferModule *transfer_module = NULL ;
 
@@ -865,7 +921,7 @@ bool	ftDataMultiplex::handleRecvDataRequest(const RsPeerId& peerId, const RsFile
 #endif
 
 	/* Add to Search Queue */
-	mSearchQueue.push_back( ftRequest(FT_DATA_REQ, peerId, hash, size, offset, chunksize, NULL));
+	mSearchQueue.push_back( ftRequest(FT_DATA_REQ, peerId, hash, size, offset, chunksize));
 
 	return true;
 }
@@ -939,12 +995,19 @@ bool ftDataMultiplex::sendSingleChunkCRCRequests(const RsFileHash& hash, const s
 {
 	RsStackMutex stack(dataMtx); /******* LOCK MUTEX ******/
 
-	// Put all requested chunks in the request queue.
+	// Put all requested chunks in the request queue, unless a source already
+	// gave us the sum of that chunk, in which case it is checked right away.
 	
 	Sha1CacheEntry& ce(_cached_sha1maps[hash]) ;
+	std::map<RsFileHash,ftClient>::const_iterator itc(mClients.find(hash)) ;
 
 	for(uint32_t i=0;i<to_ask.size();++i)
 	{
+		if(itc != mClients.end() && to_ask[i] < ce._map.size() && ce._map.isSet(to_ask[i]))
+		{
+			locked_queueChunkCheck(hash,itc->second.mCreator,to_ask[i],ce._map[to_ask[i]]) ;
+			continue ;
+		}
 		std::pair<rstime_t,ChunkCheckSumSourceList>& list(ce._to_ask[to_ask[i]]) ;
 		list.first = 0 ; // set last request time to 0
 	}
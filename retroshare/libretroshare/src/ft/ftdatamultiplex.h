@@ -42,6 +42,7 @@ class ftSearch;
 #include "util/rsthreads.h"
 
 #include "ft/ftdata.h"
+#include "ft/ftchecksumpool.h"
 #include "retroshare/rsfiles.h"
 
 
@@ -60,10 +61,10 @@ class ftRequest
 {
 	public:
 
-	ftRequest(uint32_t type, const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunk, void *data);
+	ftRequest(uint32_t type, const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunk, const RsSharedBuffer& data = RsSharedBuffer());
 
 	ftRequest()
-	:mType(0), mSize(0), mOffset(0), mChunk(0), mData(NULL) { return; }
+	:mType(0), mSize(0), mOffset(0), mChunk(0) { return; }
 
 	uint32_t mType;
 	RsPeerId mPeerId;
@@ -71,7 +72,7 @@ class ftRequest
 	uint64_t mSize;
 	uint64_t mOffset;
 	uint32_t mChunk;
-	void *mData;
+	RsSharedBuffer mData;
 };
 
 typedef std::map<RsPeerId,rstime_t> ChunkCheckSumSourceList ;
@@ -81,7 +82,6 @@ class Sha1CacheEntry
 	public:
 		Sha1Map _map ; 												// Map of available sha1 sums for every chunk.
 		rstime_t last_activity ;										// This is used for removing unused entries.
-		std::vector<uint32_t> _received ;						// received chunk ids. To bedispatched.
 		std::map<uint32_t,std::pair<rstime_t,ChunkCheckSumSourceList> > _to_ask ;		// Chunks to ask to sources.
 };
 	
@@ -131,12 +131,14 @@ class ftDataMultiplex: public ftDataRecv, public RsQueueThread
 		/* called from a separate thread */
 		bool sendSingleChunkCRCRequests(const RsFileHash& hash, const std::vector<uint32_t>& to_ask) ;
 
-		bool dispatchReceivedChunkCheckSum() ;
+		// Drops the cached sums of files that are not downloaded anymore. Received sums
+		// are checked by the checksum pool as soon as they arrive.
+		bool cleanChunkCheckSumCache() ;
 
 		/*************** RECV INTERFACE (provides ftDataRecv) ****************/
 
 		/* Client Recv */
-		virtual bool recvData(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize, void *data);
+		virtual bool recvData(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize, const RsSharedBuffer& data);
 		/* Server Recv */
 		virtual bool	recvDataRequest(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize);
 
@@ -146,6 +148,9 @@ class ftDataMultiplex: public ftDataRecv, public RsQueueThread
 		virtual bool recvChunkMap(const RsPeerId& peer_id,const RsFileHash& hash,const CompressedChunkMap& cmap,bool is_client) ;
 
 		virtual bool recvSingleChunkCRCRequest(const RsPeerId& peer_id,const RsFileHash& hash,uint32_t chunk_id) ;
+
+		/// Resumes the data requests of peerId that waited for its out queue to drain.
+		virtual void outgoingWritable(const RsPeerId& peerId) ;
 		virtual bool recvSingleChunkCRC(const RsPeerId& peer_id,const RsFileHash& hash,uint32_t chunk_id,const Sha1CheckSum& sum) ;
 		
 		// Returns the chunk map from the file uploading client. Also initiates a chunk map request if this 
@@ -162,7 +167,7 @@ class ftDataMultiplex: public ftDataRecv, public RsQueueThread
 	private:
 
 		/* Handling Job Queues */
-		bool handleRecvData(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize, void *data);
+		bool handleRecvData(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize, const RsSharedBuffer& data);
 		bool handleRecvDataRequest(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize);
 		bool handleSearchRequest(const RsPeerId& peerId, const RsFileHash& hash);
 		bool handleRecvClientChunkMapRequest(const RsPeerId& peerId, const RsFileHash& hash) ;
@@ -172,6 +177,9 @@ class ftDataMultiplex: public ftDataRecv, public RsQueueThread
 		/* We end up doing the actual server job here */
 		bool    locked_handleServerRequest(ftFileProvider *provider, const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize);
 
+		/* Checks a downloaded chunk against the sum of a source, in the checksum pool */
+		void	locked_queueChunkCheck(const RsFileHash& hash, ftFileCreator *creator, uint32_t chunk_number, const Sha1CheckSum& sum);
+
 		RsMutex dataMtx;
 
 		std::map<RsFileHash, ftClient> mClients;
@@ -180,12 +188,21 @@ class ftDataMultiplex: public ftDataRecv, public RsQueueThread
 		std::list<ftRequest> mRequestQueue;
 		std::list<ftRequest> mSearchQueue;
 
+		// Data requests of peers whose out queue is full. They go back to the request queue when
+		// the peer can take data again, or every few seconds otherwise (tunnels, lost connections...).
+		std::list<ftRequest> mDeferredRequests;
+		rstime_t mLastDeferredRetry;
+
 		std::map<RsFileHash,Sha1CacheEntry> _cached_sha1maps ;						// one cache entry per file hash. Handled dynamically.
 
 		ftDataSend *mDataSend;
 		ftSearch   *mSearch;
 		RsPeerId mOwnId;
 
+		// Declared last, so that the jobs still running when deleting the multiplexer
+		// can use the other members.
+		ftChecksumPool mChecksumPool;
+
 		friend class ftServer;
 };
 
@@ -23,6 +23,9 @@
 #include <cerrno>
 #include <cstdio>
 #include <sys/stat.h>
+#include <vector>
+#include <thread>
+#include <chrono>
 
 #include "ftfilecreator.h"
 #include "util/rstime.h"
@@ -49,7 +52,8 @@
 ***********************************************************/
 
 ftFileCreator::ftFileCreator(const std::string& path, uint64_t size, const RsFileHash& hash,bool assume_availability)
-	: ftFileProvider(path,size,hash), chunkMap(size,assume_availability)
+	: ftFileProvider(path,size,hash), chunkMap(size,assume_availability),
+	  _file_sha(librs::crypto::HashStream::SHA1)
 {
 	/* 
          * FIXME any inits to do?
@@ -69,6 +73,10 @@ ftFileCreator::ftFileCreator(const std::string& path, uint64_t size, const RsFil
 	rstime_t now = time(NULL) ;
 	_creation_time = now ;
 
+	_hashed_chunks = 0 ;
+	_file_sha_busy = false ;
+	_file_sha_reset = false ;
+
 	struct stat64 buf;
 
 	// Initialise last recv time stamp to last modification time for the partial file.
@@ -700,8 +708,63 @@ bool ftFileCreator::hashReceivedData(RsFileHash& hash)
 		return false ;
 	}
 
-	uint64_t tmpsize ;
-	return RsDirUtil::getFileHash(file_name,hash,tmpsize) ;
+	// The chunks verified while downloading are already hashed, as far as they
+	// follow each other from the beginning of the file. We start from a copy of
+	// that sha1, once no checking thread is feeding it anymore.
+
+	librs::crypto::HashStream sha(librs::crypto::HashStream::SHA1) ;
+	uint64_t offset ;
+
+	for(;;)
+	{
+		{
+			RsStackMutex stack(ftcMutex); /********** STACK LOCKED MTX ******/
+
+			if(!_file_sha_busy)
+			{
+				if(_file_sha_reset)
+				{
+					_file_sha = librs::crypto::HashStream(librs::crypto::HashStream::SHA1) ;
+					_hashed_chunks = 0 ;
+					_file_sha_reset = false ;
+				}
+				sha = _file_sha ;
+				offset = (uint64_t)_hashed_chunks * (uint64_t)ChunkMap::CHUNKMAP_FIXED_CHUNK_SIZE ;
+				break ;
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10)) ;
+	}
+
+#ifdef FILE_DEBUG
+	std::cerr << "file creator: " << offset << " bytes of " << file_name << " already hashed." << std::endl;
+#endif
+	FILE *f = RsDirUtil::rs_fopen(file_name.c_str(), "rb") ;
+
+	if(f == NULL)
+		return false ;
+
+	if(offset > 0 && 0 != fseeko64(f, offset, SEEK_SET))
+	{
+		fclose(f) ;
+		return false ;
+	}
+
+	static const uint32_t HASH_BUFFER_SIZE = 10*1024*1024 ;
+	std::vector<unsigned char> buff(HASH_BUFFER_SIZE) ;
+	size_t len ;
+
+	while((len = fread(buff.data(), 1, HASH_BUFFER_SIZE, f)) > 0)
+		sha << std::make_pair(buff.data(), (uint32_t)len) ;
+
+	bool ok = !ferror(f) ;
+	fclose(f) ;
+
+	if(!ok)
+		return false ;
+
+	hash = sha.hash() ;
+	return true ;
 }
 
 void ftFileCreator::forceCheck()
@@ -709,6 +772,7 @@ void ftFileCreator::forceCheck()
 	RsStackMutex stack(ftcMutex); /********** STACK LOCKED MTX ******/
 
 	chunkMap.forceCheck(); 
+	_file_sha_reset = true ;
 }
 
 void ftFileCreator::getSourcesList(uint32_t chunk_num,std::vector<RsPeerId>& sources)
@@ -725,41 +789,132 @@ void ftFileCreator::getChunksToCheck(std::vector<uint32_t>& chunks_to_ask)
 	chunkMap.getChunksToCheck(chunks_to_ask) ;
 }
 
-bool ftFileCreator::verifyChunk(uint32_t chunk_number,const Sha1CheckSum& sum)
+bool ftFileCreator::locked_readChunk(uint32_t chunk_number, unsigned char *data, uint32_t& len)
 {
-	RsStackMutex stack(ftcMutex); /********** STACK LOCKED MTX ******/
+	static const uint64_t chunk_size = ChunkMap::CHUNKMAP_FIXED_CHUNK_SIZE ;
 
-	if(!locked_initializeFileAttrs() )
+	if(!locked_initializeFileAttrs())
 		return false ;
 
-	static const uint32_t chunk_size = ChunkMap::CHUNKMAP_FIXED_CHUNK_SIZE ;
-	unsigned char *buff = new unsigned char[chunk_size] ;
-	uint32_t len ;
+	// Reading through the descriptor used for writing also sees what is still
+	// in its buffer, and mostly hits pages that were just written.
+
+	return fseeko64(fd, chunk_number * chunk_size, SEEK_SET) == 0 && (len = fread(data, 1, chunk_size, fd)) > 0 ;
+}
+
+bool ftFileCreator::verifyChunk(uint32_t chunk_number,const Sha1CheckSum& sum)
+{
+	std::vector<unsigned char> buff(ChunkMap::CHUNKMAP_FIXED_CHUNK_SIZE) ;
+	uint32_t len = 0 ;
 
-	if(fseeko64(fd,(uint64_t)chunk_number * (uint64_t)chunk_size,SEEK_SET)==0 && (len = fread(buff,1,chunk_size,fd)) > 0)
 	{
-		Sha1CheckSum comp = RsDirUtil::sha1sum(buff,len) ;
+		RsStackMutex stack(ftcMutex); /********** STACK LOCKED MTX ******/
 
-		if(sum == comp)
-			chunkMap.setChunkCheckingResult(chunk_number,true) ;
-		else
-		{
-			std::cerr << "Sum mismatch for chunk " << chunk_number << std::endl;
-			std::cerr << "    Computed  hash = " << comp.toStdString() << std::endl;
-			std::cerr << "    Reference hash = " << sum.toStdString() << std::endl;
+		// The chunk may have been checked already, with the sum of another source.
 
+		if(chunkMap.getChunkState(chunk_number) != FileChunksInfo::CHUNK_CHECKING)
+			return true ;
+
+		if(!locked_readChunk(chunk_number, buff.data(), len))
+		{
+			printf("Chunk verification: cannot fseek!\n") ;
 			chunkMap.setChunkCheckingResult(chunk_number,false) ;
+			return true ;
 		}
 	}
-	else
+
+	// Hashing 1MB takes a few ms, during which data keeps being written.
+
+	Sha1CheckSum comp = RsDirUtil::sha1sum(buff.data(),len) ;
+	bool ok = (sum == comp) ;
+
+	if(!ok)
 	{
-		printf("Chunk verification: cannot fseek!\n") ;
-		chunkMap.setChunkCheckingResult(chunk_number,false) ;
+		std::cerr << "Sum mismatch for chunk " << chunk_number << std::endl;
+		std::cerr << "    Computed  hash = " << comp.toStdString() << std::endl;
+		std::cerr << "    Reference hash = " << sum.toStdString() << std::endl;
 	}
 
-	delete[] buff ;
-	return true ;
+	{
+		RsStackMutex stack(ftcMutex); /********** STACK LOCKED MTX ******/
+
+		if(chunkMap.getChunkState(chunk_number) != FileChunksInfo::CHUNK_CHECKING)
+			return true ;
+
+		chunkMap.setChunkCheckingResult(chunk_number,ok) ;
+	}
+
+	if(ok)
+		hashVerifiedChunks(chunk_number, buff.data(), len) ;
+
+	return ok ;
 }
 
+void ftFileCreator::hashVerifiedChunks(uint32_t chunk_number, const unsigned char *data, uint32_t len)
+{
+	// Only one thread at a time feeds _file_sha, without the mutex. A thread
+	// that finds it busy leaves: the one that has it will see the new chunk as done.
+
+	std::vector<unsigned char> buff ;
+	bool owner = false ;
+
+	for(;;)
+	{
+		const unsigned char *chunk_data = NULL ;
+		uint32_t chunk_len = 0 ;
+
+		{
+			RsStackMutex stack(ftcMutex); /********** STACK LOCKED MTX ******/
 
+			if(!owner)
+			{
+				if(_file_sha_busy)
+					return ;
+
+				_file_sha_busy = owner = true ;
+			}
 
+			if(_file_sha_reset)
+			{
+				_file_sha = librs::crypto::HashStream(librs::crypto::HashStream::SHA1) ;
+				_hashed_chunks = 0 ;
+				_file_sha_reset = false ;
+			}
+
+			uint32_t n = _hashed_chunks ;
+
+			if(chunkMap.getChunkState(n) != FileChunksInfo::CHUNK_DONE)
+			{
+				_file_sha_busy = false ;
+				return ;
+			}
+
+			if(n == chunk_number && data != NULL)
+			{
+				chunk_data = data ;
+				chunk_len = len ;
+				data = NULL ;
+			}
+			else
+			{
+				buff.resize(ChunkMap::CHUNKMAP_FIXED_CHUNK_SIZE) ;
+
+				if(!locked_readChunk(n, buff.data(), chunk_len))
+				{
+					_file_sha_busy = false ;
+					return ;
+				}
+				chunk_data = buff.data() ;
+			}
+		}
+
+		_file_sha << std::make_pair(chunk_data, chunk_len) ;
+
+		{
+			RsStackMutex stack(ftcMutex); /********** STACK LOCKED MTX ******/
+
+			if(!_file_sha_reset)
+				++_hashed_chunks ;
+		}
+	}
+}
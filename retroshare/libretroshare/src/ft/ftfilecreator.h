@@ -31,6 +31,7 @@
  */
 #include "ftfileprovider.h"
 #include "ftchunkmap.h"
+#include "crypto/hashstream.h"
 #include <map>
 
 class ZeroInitCounter
@@ -65,6 +66,8 @@ class ftFileCreator: public ftFileProvider
 		// This function is not mutexed. This is a bit dangerous, but otherwise we might stuck the GUI for a 
 		// long time. Therefore, we must pay attention not to call this function
 		// at a time file_name nor hash can be modified, which is quite easy.
+		// The chunks verified at the beginning of the file are already hashed, so that
+		// only the end of the file that follows them is read.
 
 		bool hashReceivedData(RsFileHash& hash) ;
 
@@ -72,6 +75,11 @@ class ftFileCreator: public ftFileProvider
 		//
 		void forceCheck() ; 
 
+		// Checks a downloaded chunk against the sum given by a source, and marks it as done
+		// or to be downloaded again. The chunk is hashed off-mutex, so this is meant to be
+		// called from the checksum pool threads. Returns false only when the chunk could be
+		// read and does not match the sum.
+		//
 		bool verifyChunk(uint32_t, const Sha1CheckSum&) ;
 
 		// Looks into the chunkmap for downloaded chunks that have not yet been certified.
@@ -135,6 +143,12 @@ class ftFileCreator: public ftFileProvider
 
 		bool 	locked_printChunkMap();
 		int 	locked_notifyReceived(uint64_t offset, uint32_t chunk_size);
+		bool	locked_readChunk(uint32_t chunk_number, unsigned char *data, uint32_t& len);
+
+		// Feeds the verified chunks that follow the hashed beginning of the file into _file_sha.
+		// data, if not NULL, holds chunk chunk_number, which saves reading it again.
+		void	hashVerifiedChunks(uint32_t chunk_number, const unsigned char *data, uint32_t len);
+
 		/* 
 		 * structure to track missing chunks 
 		 */
@@ -146,6 +160,11 @@ class ftFileCreator: public ftFileProvider
 
 		rstime_t _last_recv_time_t ;	/// last time stamp when data was received. Used for queue control.
 		rstime_t _creation_time ;		/// time at which the file creator was created. Used to spot long-inactive transfers.
+
+		librs::crypto::HashStream _file_sha ;	/// sha1 of the first _hashed_chunks chunks of the file.
+		uint32_t _hashed_chunks ;
+		bool _file_sha_busy ;			/// a thread is updating _file_sha, outside of the mutex.
+		bool _file_sha_reset ;			/// _file_sha must start again, because chunks are checked again.
 };
 
 #endif // FT_FILE_CREATOR_HEADER
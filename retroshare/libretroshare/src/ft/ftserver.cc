@@ -1091,6 +1091,19 @@ bool ftServer::sendTurtleItem(const RsPeerId& peerId,const RsFileHash& hash,RsTu
 	return true ;
 }
 
+bool	ftServer::canSendData(const RsPeerId& peerId, uint32_t chunksize)
+{
+	if(mTurtleRouter->isTurtlePeer(peerId))
+		return mTurtleRouter->canSendTurtleData(peerId, chunksize) ;
+
+	return canSendItems(peerId, chunksize) ;
+}
+
+void	ftServer::outgoingWritable(const RsPeerId& peer_id)
+{
+	mFtDataplex->outgoingWritable(peer_id) ;
+}
+
 /* Client Send */
 bool	ftServer::sendDataRequest(const RsPeerId& peerId, const RsFileHash& hash, uint64_t size, uint64_t offset, uint32_t chunksize)
 {
@@ -1694,10 +1707,10 @@ void ftServer::receiveTurtleData(const RsTurtleGenericTunnelItem *i,
 #ifdef SERVER_DEBUG
 			FTSERVER_DEBUG() << "ftServer::receiveTurtleData(): received file data for " << hash << " from peer " << virtual_peer_id << std::endl;
 #endif
-			getMultiplexer()->recvData(virtual_peer_id,hash,0,item->chunk_offset,item->chunk_size,item->chunk_data) ;
+			getMultiplexer()->recvData(virtual_peer_id,hash,0,item->chunk_offset,item->chunk_size,rs_shared_buffer_adopt(item->chunk_data)) ;
 
-			const_cast<RsTurtleFileDataItem*>(item)->chunk_data = NULL ;	// this prevents deletion in the destructor of RsFileDataItem, because data will be deleted
-			// down _ft_server->getMultiplexer()->recvData()...in ftTransferModule::recvFileData
+			const_cast<RsTurtleFileDataItem*>(item)->chunk_data = NULL ;	// this prevents deletion in the destructor of RsFileDataItem, because data is now
+			// owned by the shared buffer passed down to ftTransferModule::recvFileData
 		}
 	}
 		break ;
@@ -1775,7 +1788,7 @@ int	ftServer::tick()
 
 		mFtDataplex->deleteUnusedServers() ;
 		mFtDataplex->handlePendingCrcRequests() ;
-		mFtDataplex->dispatchReceivedChunkCheckSum() ;
+		mFtDataplex->cleanChunkCheckSumCache() ;
 		cleanTimedOutSearches();
 	}
 
@@ -1894,11 +1907,9 @@ int ftServer::handleIncoming()
 #ifdef SERVER_DEBUG
 				FTSERVER_DEBUG() << "ftServer::handleIncoming: received data for hash " << f->fd.file.hash << ", offset=" << f->fd.file_offset << ", chunk size=" << f->fd.binData.bin_len << std::endl;
 #endif
-				mFtDataplex->recvData(f->PeerId(), f->fd.file.hash,  f->fd.file.filesize, f->fd.file_offset, f->fd.binData.bin_len, f->fd.binData.bin_data);
-
-				/* we've stolen the data part -> so blank before delete
-						 */
-				f->fd.binData.TlvShallowClear();
+				/* data is usually a view into the received packet, the
+				 * shared handle keeps it alive until it is written */
+				mFtDataplex->recvData(f->PeerId(), f->fd.file.hash,  f->fd.file.filesize, f->fd.file_offset, f->fd.binData.bin_len, f->fd.binData.shareBinData());
 			}
 		}
 			break ;
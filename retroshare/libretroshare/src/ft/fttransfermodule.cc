@@ -23,6 +23,8 @@
  * #define FT_DEBUG 1
  *****/
 
+#include <chrono>
+
 #include "util/rstime.h"
 
 #include "retroshare/rsturtle.h"
@@ -46,11 +48,17 @@
 
 const double   FT_TM_MAX_PEER_RATE 		       = 100 * 1024 * 1024; /* 100MB/s */
 const uint32_t FT_TM_MAX_RESETS  		       = 5;
-const uint32_t FT_TM_MINIMUM_CHUNK 		       = 1024;              /* ie 1Kb / sec */
 const uint32_t FT_TM_DEFAULT_TRANSFER_RATE     = 20*1024;           /* ie 20 Kb/sec */
 const uint32_t FT_TM_RESTART_DOWNLOAD 	       = 20;                /* 20 seconds */
 const uint32_t FT_TM_DOWNLOAD_TIMEOUT 	       = 10;                /* 10 seconds */
 
+const double   FT_TM_MIN_WINDOW                = 64 * 1024;         /* what a new source starts with */
+const double   FT_TM_MAX_WINDOW                = 32 * 1024 * 1024;
+const uint32_t FT_TM_MIN_REQUEST               = 32 * 1024;         /* smallest request sent as data comes in */
+const double   FT_TM_GOODPUT_INTERVAL          = 0.05;              /* shortest goodput sample (secs) */
+const double   FT_TM_PIPELINE_STALL            = 2.0;               /* outstanding requests are given up after this (secs) */
+const double   FT_TM_RATE_BURST                = 2.0;               /* request credit kept at most (secs at desiredRate), more than a tick */
+
 const double FT_TM_RATE_INCREASE_SLOWER  = 0.05 ;
 const double FT_TM_RATE_INCREASE_AVERAGE = 0.3 ;
 const double FT_TM_RATE_INCREASE_FASTER  = 1.0 ;
@@ -65,8 +73,10 @@ peerInfo::peerInfo(const RsPeerId& peerId_in)
     :peerId(peerId_in),state(PQIPEER_NOT_ONLINE),desiredRate(FT_TM_DEFAULT_TRANSFER_RATE),actualRate(FT_TM_DEFAULT_TRANSFER_RATE),
 		lastTS(0),
 		recvTS(0), lastTransfers(0), nResets(0),
-		rtt(0), rttActive(false), rttStart(0), rttOffset(0),
-		mRateIncrease(1)
+		rtt(0), mRateIncrease(1),
+		outstanding(0), window(FT_TM_MIN_WINDOW), srtt(0), minRtt(0),
+		goodput(0), goodputBytes(0), goodputTS(0), lastRecv(0),
+		reqCredit(0), reqCreditTS(0)
 	{
 	}
 //	peerInfo(const RsPeerId& peerId_in,uint32_t state_in,uint32_t maxRate_in):
@@ -78,6 +88,12 @@ peerInfo::peerInfo(const RsPeerId& peerId_in)
 //	{
 //		return;
 //	}
+
+static double monotonicTime()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count() ;
+}
+
 ftTransferModule::ftTransferModule(ftFileCreator *fc, ftDataMultiplex *dm, ftController *c)
 	:mFileCreator(fc), mMultiplexor(dm), mFtController(c), tfMtx("ftTransferModule"), mFlag(FT_TM_FLAG_DOWNLOADING),mPriority(SPEED_NORMAL)
 {
@@ -298,7 +314,7 @@ rstime_t ftTransferModule::lastActvTimeStamp()
 }
 
   //interface to client module
-bool ftTransferModule::recvFileData(const RsPeerId& peerId, uint64_t offset, uint32_t chunk_size, void *data)
+bool ftTransferModule::recvFileData(const RsPeerId& peerId, uint64_t offset, uint32_t chunk_size, const RsSharedBuffer& data)
 {
 	RsStackMutex stack(tfMtx); /******* STACK LOCKED ******/
 #ifdef FT_DEBUG
@@ -306,7 +322,7 @@ bool ftTransferModule::recvFileData(const RsPeerId& peerId, uint64_t offset, uin
 	std::cerr << " peerId: " << peerId;
 	std::cerr << " offset: " << offset;
 	std::cerr << " chunksize: " << chunk_size;
-	std::cerr << " data: " << data;
+	std::cerr << " data: " << (void*)data.get();
 	std::cerr << std::endl;
 #endif
 
@@ -324,13 +340,18 @@ bool ftTransferModule::recvFileData(const RsPeerId& peerId, uint64_t offset, uin
 #endif
 		return false;
 	}
-	ok = locked_recvPeerData(mit->second, offset, chunk_size, data);
+	ok = locked_recvPeerData(mit->second, offset, chunk_size, data.get());
 
-	locked_storeData(offset, chunk_size, data);
+	locked_storeData(offset, chunk_size, data.get());
+
+	// Send the next requests right away, rather than waiting for the next
+	// tick, so that the source always has some work queued.
+
+	if(mFileStatus.stat == ftFileStatus::PQIFILE_DOWNLOADING && mFlag == FT_TM_FLAG_DOWNLOADING)
+		locked_fillPipeline(mit->second, monotonicTime()) ;
 
 	_last_activity_time_stamp = time(NULL) ;
 
-	free(data) ;
 	return ok;
 }
 
@@ -674,14 +695,16 @@ void ftTransferModule::adjustSpeed()
 /*******************************************************************************
  * Actual Peer Transfer Management Code.
  *
- * request very tick, at rate
- *
+ * Each source is sent new requests as soon as data comes back from it, so
+ * that about one window of data is always in flight (see locked_fillPipeline()).
+ * The tick only handles timeouts, gives up lost requests and restarts the
+ * sources that are not sending anything.
  *
  **/
 
 
 /* NOTEs on this function...
- * 1) This is the critical function for deciding the rate at which ft takes place.
+ * 1) This decides which sources are asked for data at all. How much they are asked is up to locked_fillPipeline().
  * 2) Some of the peers might not have the file... care must be taken avoid deadlock.
  *
  * Eg. A edge case which fails badly.
@@ -733,6 +756,7 @@ bool ftTransferModule::locked_tickPeerTransfer(peerInfo &info)
 	if (ageRecv > (int) FT_TM_DOWNLOAD_TIMEOUT)
 	{
 		info.state = PQIPEER_IDLE;
+		locked_resetPipeline(info) ;
 		return false;
 	}
 #ifdef FT_DEBUG
@@ -748,114 +772,107 @@ bool ftTransferModule::locked_tickPeerTransfer(peerInfo &info)
 		info.lastTS = ts;
 	}
 
-	/****************
-	 * NOTE: If we continually increase the request rate thus: ...
-	 * uint32_t next_req = info.actualRate * 1.25;
-	 *
-	 * then we will achieve max data rate, but we will fill up 
-	 * peers out queue and/or network buffers.....
-	 *
-	 * we must therefore monitor the RTT to tell us if this is happening.
+	/* give up requests that got no answer: peer disconnected, request dropped
+	 * by the server, etc. The srtt includes the time spent queued at the source.
 	 */
+	double now = monotonicTime() ;
+	double timeout = std::max(FT_TM_PIPELINE_STALL, 4 * info.srtt) ;
+	bool expired = false ;
 
-	/* emergency shutdown if we are stuck in x 1.25 mode
-	 * probably not needed
-	 */
+	for(std::map<uint64_t,ftDataRequestInfo>::iterator it(info.pendingReqs.begin());it!=info.pendingReqs.end();)
+		if(now > it->second.sentTS + timeout)
+		{
+			info.outstanding -= it->second.left ;
+			it = info.pendingReqs.erase(it) ;
+			expired = true ;
+		}
+		else
+			++it ;
 
-// csoler: I commented this out because that tends to make some sources 
-//  get stuck into minimal 128 B/s rate, when multiple sources are competiting into  the 
-//  same limited bandwidth. I don't think this emergency shutdown is necessary anyway.
-//
-//  	if ((info.rttActive) && (ts - info.rttStart > FT_TM_SLOW_RTT))
-//	{
-//		if (info.mRateIncrease > 0)
-//		{
-//#ifdef FT_DEBUG
-//			std::cerr << "!!! - Emergency shutdown because rttActive is true, and age is " << ts - info.rttStart << std::endl ;
-//#endif
-//			info.mRateIncrease = 0;
-//			info.rttActive = false ; // I've added this to avoid being stuck when rttActive is true
-//		}
-//	}
+	if(expired && now > info.lastRecv + timeout)
+		locked_resetPipeline(info) ;
 
-	/* request at more than current rate */
-	uint32_t next_req = info.actualRate * (1.0 + info.mRateIncrease);
-#ifdef FT_DEBUG
-	std::cerr << "locked_tickPeerTransfer() actual rate (after): " << actualRate 
-				<< " info.desiredRate=" << info.desiredRate 
-				<< " info.actualRate=" << info.actualRate 
-				<< ", next_req=" << next_req ;
+	locked_fillPipeline(info, now) ;
 
-	std::cerr << std::endl;
-#endif
+	return true;
+}
 
-	if (next_req > info.desiredRate * 1.1)
-	{
-		next_req = info.desiredRate * 1.1;
-#ifdef FT_DEBUG
-		std::cerr << "locked_tickPeerTransfer() Reached MaxRate: next_req: " << next_req;
-		std::cerr << std::endl;
-#endif
-	}
+/* Keeps about one window of requests outstanding at the source. The window is
+ * the bandwidth delay product (goodput x min rtt) times a gain that depends on
+ * the download priority, so that the window keeps growing as long as the link
+ * can carry more, and stops at a small standing queue once it is saturated.
+ * Requests are never sent faster than desiredRate on average: once the credit
+ * is spent and the pipeline has drained, nothing is asked until the next tick.
+ */
+void ftTransferModule::locked_fillPipeline(peerInfo &info, double now)
+{
+	if(info.state == PQIPEER_SUSPEND)
+		return ;
 
+	double max_rate = std::min(info.desiredRate * 1.1, FT_TM_MAX_PEER_RATE) ;
 
-	if (next_req > FT_TM_MAX_PEER_RATE)
-	{
-		next_req = FT_TM_MAX_PEER_RATE;
-#ifdef FT_DEBUG
-		std::cerr << "locked_tickPeerTransfer() Reached AbsMaxRate: next_req: " << next_req;
-		std::cerr << std::endl;
-#endif
-	}
+	info.reqCredit = std::min(info.reqCredit + max_rate * (now - info.reqCreditTS), max_rate * FT_TM_RATE_BURST) ;
+	info.reqCreditTS = now ;
 
+	// Only top up the pipeline once a reasonable request can be made, so that
+	// each incoming data packet does not trigger a request of its own.
 
-	if (next_req < FT_TM_MINIMUM_CHUNK)
+	while(info.outstanding + FT_TM_MIN_REQUEST <= info.window && info.reqCredit > 0)
 	{
-		next_req = FT_TM_MINIMUM_CHUNK;
-#ifdef FT_DEBUG
-		std::cerr << "locked_tickPeerTransfer() small chunk: next_req: " << next_req;
-		std::cerr << std::endl;
-#endif
-	}
+		uint32_t next_req = info.window - info.outstanding ;
+		uint64_t req_offset = 0;
+		uint32_t req_size =0 ;
 
-#ifdef FT_DEBUG
-	std::cerr << "locked_tickPeerTransfer() desired  next_req: " << next_req;
-	std::cerr << std::endl;
-#endif
-	
-	/* do request */
-	uint64_t req_offset = 0;
-	uint32_t req_size =0 ;
-
-	// Loop over multiple calls to the file creator: for some reasons the file creator might not be able to
-	// give a plain chunk of the requested size (size hint larger than the fixed chunk size, priority given to 
-	// an old pending chunk, etc).
-	//
-	while(next_req > 0 && locked_getChunk(info.peerId,next_req,req_offset,req_size))
-		if(req_size > 0)
-		{
-			info.state = PQIPEER_DOWNLOADING;
-			locked_requestData(info.peerId,req_offset,req_size);
-
-			/* start next rtt measurement */
-			if (!info.rttActive)
-			{
-				info.rttStart = ts;
-				info.rttActive = true;
-				info.rttOffset = req_offset + req_size;
-			}
-			next_req -= std::min(req_size,next_req) ;
-		}
-		else
+		// the file creator might not be able to give a plain chunk of the requested size (size hint larger than the
+		// fixed chunk size, priority given to an old pending chunk, etc), hence the loop.
+
+		if(!locked_getChunk(info.peerId,next_req,req_offset,req_size))
+			break ;
+
+		if(req_size == 0)
 		{
 			std::cerr << "transfermodule::Waiting for available data";
 			std::cerr << std::endl;
 			break ;
 		}
 
-	return true;
+		info.state = PQIPEER_DOWNLOADING;
+		locked_requestData(info.peerId,req_offset,req_size);
+
+		// A slice may be asked again at the same offset, in which case the old request is superseded.
+
+		ftDataRequestInfo& req(info.pendingReqs[req_offset]) ;
+
+		if(req.size > 0)
+			info.outstanding -= req.left ;
+
+		req.size = req.left = req_size ;
+		req.sentTS = now ;
+		req.answered = false ;
+
+		info.outstanding += req_size ;
+		info.reqCredit -= req_size ;
+	}
+#ifdef FT_DEBUG
+	std::cerr << "locked_fillPipeline() peer " << info.peerId << " window=" << info.window << " outstanding=" << info.outstanding
+	          << " goodput=" << info.goodput << " minRtt=" << info.minRtt << " srtt=" << info.srtt << std::endl;
+#endif
 }
 
+void ftTransferModule::locked_resetPipeline(peerInfo &info)
+{
+	// Whatever was requested is considered lost. The file creator asks for
+	// the missing slices again when they get too old.
+
+	info.pendingReqs.clear() ;
+	info.outstanding = 0 ;
+	info.window = FT_TM_MIN_WINDOW ;
+	info.goodput = 0 ;
+	info.goodputBytes = 0 ;
+	info.goodputTS = 0 ;
+	info.srtt = 0 ;
+	info.minRtt = 0 ;
+}
 	
 	
   //interface to client module
@@ -864,7 +881,7 @@ bool ftTransferModule::locked_recvPeerData(peerInfo &info, uint64_t offset, uint
 #ifdef FT_DEBUG
 	std::cerr << "ftTransferModule::locked_recvPeerData()";
 	std::cerr << " peerId: " << info.peerId;
-	std::cerr << " rttOffset: " << info.rttOffset;
+	std::cerr << " outstanding: " << info.outstanding;
 	std::cerr << " lastTransfers: " << info.lastTransfers;
 	std::cerr << " offset: " << offset;
 	std::cerr << " chunksize: " << chunk_size;
@@ -877,47 +894,80 @@ bool ftTransferModule::locked_recvPeerData(peerInfo &info, uint64_t offset, uint
   info.state = PQIPEER_DOWNLOADING;
   info.lastTransfers += chunk_size;
 
-   if ((info.rttActive) && (info.rttOffset == offset + chunk_size))
-   {
- 	  /* update tip */
- 	  int32_t rtt = time(NULL) - info.rttStart;
- 
- 	  /* 
- 		* FT_TM_FAST_RTT = 1 sec. mRateIncrease =  1.00
- 		* FT_TM_SLOW_RTT =20 sec. mRateIncrease =  0
- 		* 		   11 sec. mRateIncrease = -0.25
- 		* if it is slower than this allow fast data increase.
- 		* initial guess - linear with rtt.
- 		* change if this leads to wild oscillations 
- 		*
- 		*/
- 
-// 	  info.mRateIncrease = (FT_TM_SLOW_RTT - rtt) * 
-// 		  (FT_TM_MAX_INCREASE / (FT_TM_SLOW_RTT - FT_TM_FAST_RTT));
-// 
-// 	  if (info.mRateIncrease > FT_TM_MAX_INCREASE)
-// 		  info.mRateIncrease = FT_TM_MAX_INCREASE;
-// 
-// 	  if (info.mRateIncrease < FT_TM_MIN_INCREASE)
-// 		  info.mRateIncrease = FT_TM_MIN_INCREASE;
- 
-	  switch(mPriority)
+  double now = monotonicTime() ;
+  info.lastRecv = now ;
+
+  /* account for the data in the request it answers. Data that matches no
+   * request (given up, or asked again to another peer) is simply stored.
+   */
+  std::map<uint64_t,ftDataRequestInfo>::iterator it = info.pendingReqs.upper_bound(offset) ;
+
+  if(it != info.pendingReqs.begin() && (--it)->first + it->second.size > offset)
+  {
+	  ftDataRequestInfo& req(it->second) ;
+
+	  if(!req.answered)
 	  {
-		  case SPEED_LOW  	: info.mRateIncrease = FT_TM_RATE_INCREASE_SLOWER ; break ;
-		  case SPEED_NORMAL	: info.mRateIncrease = FT_TM_RATE_INCREASE_AVERAGE; break ;
-		  case SPEED_HIGH  	: info.mRateIncrease = FT_TM_RATE_INCREASE_FASTER ; break ;
+		  /* time to first byte, including the time the request waited behind
+		   * the previous ones at the source.
+		   */
+		  double rtt = now - req.sentTS ;
+
+		  info.srtt = (info.srtt > 0)?(0.875 * info.srtt + 0.125 * rtt):rtt ;
+
+		  if(info.minRtt == 0 || rtt < info.minRtt)
+			  info.minRtt = rtt ;
+
+		  info.rtt = rtt * 1000 ;
+		  req.answered = true ;
 	  }
- 	  info.rtt = rtt;
- 	  info.rttActive = false;
+	  uint32_t n = std::min(chunk_size, req.left) ;
 
-#ifdef FT_DEBUG
-	  std::cerr << "ftTransferModule::locked_recvPeerData()";
-	  std::cerr << "Updated Rate based on RTT: " << rtt;
-	  std::cerr << " Rate increase: " << 1.0+info.mRateIncrease;
-	  std::cerr << std::endl;
-#endif
+	  req.left -= n ;
+	  info.outstanding -= n ;
+
+	  if(req.left == 0)
+		  info.pendingReqs.erase(it) ;
+  }
+
+  switch(mPriority)
+  {
+	  case SPEED_LOW  	: info.mRateIncrease = FT_TM_RATE_INCREASE_SLOWER ; break ;
+	  case SPEED_NORMAL	: info.mRateIncrease = FT_TM_RATE_INCREASE_AVERAGE; break ;
+	  case SPEED_HIGH  	: info.mRateIncrease = FT_TM_RATE_INCREASE_FASTER ; break ;
+  }
+
+  /* goodput, sampled over at least one rtt so that it is not biased by the
+   * requests being answered in bursts. The window follows it: growing while
+   * the link can carry more, and shrinking when the source slows down.
+   */
+  if(info.goodputTS == 0)
+	  info.goodputTS = now ;
+  else
+  {
+	  info.goodputBytes += chunk_size ;
+
+	  double elapsed = now - info.goodputTS ;
+
+	  if(elapsed >= std::max(info.srtt, FT_TM_GOODPUT_INTERVAL))
+	  {
+		  double sample = info.goodputBytes / elapsed ;
 
+		  info.goodput = std::max(sample, 0.75 * info.goodput + 0.25 * sample) ;
+		  info.goodputBytes = 0 ;
+		  info.goodputTS = now ;
+
+		  info.window = (1.0 + info.mRateIncrease) * info.goodput * info.minRtt + FT_TM_MIN_REQUEST ;
+		  info.window = std::max(FT_TM_MIN_WINDOW, std::min(FT_TM_MAX_WINDOW, info.window)) ;
+	  }
   }
+
+#ifdef FT_DEBUG
+  std::cerr << "ftTransferModule::locked_recvPeerData()";
+  std::cerr << " window: " << info.window << " goodput: " << info.goodput;
+  std::cerr << " srtt: " << info.srtt << " min rtt: " << info.minRtt;
+  std::cerr << std::endl;
+#endif
   return true;
 }
 
@@ -51,6 +51,17 @@ const uint32_t  PQIPEER_SUSPEND              = 0x0010;
 
 class HashThread ;
 
+class ftDataRequestInfo
+{
+public:
+	ftDataRequestInfo() : size(0), left(0), sentTS(0), answered(false) {}
+
+	uint32_t size;
+	uint32_t left;             /* bytes not received yet */
+	double   sentTS;           /* monotonic secs */
+	bool     answered;         /* some data came back: the rtt was sampled */
+};
+
 class peerInfo
 {
 public:
@@ -75,11 +86,21 @@ public:
 	uint32_t lastTransfers;    /* data recvd in last second */
 	uint32_t nResets;          /* count to disable non-existant files */
 
-	uint32_t rtt;              /* last rtt */
-	bool     rttActive;        /* have we initialised an rtt measurement */
-	rstime_t	 rttStart;     /* ts of request */
-	uint64_t rttOffset;        /* end of request */
+	uint32_t rtt;              /* last rtt (msecs) */
 	float    mRateIncrease;    /* current rate increase factor */
+
+	/* request pipeline, see ftTransferModule::locked_fillPipeline() */
+	std::map<uint64_t,ftDataRequestInfo> pendingReqs; /* by offset */
+	uint64_t outstanding;      /* bytes requested and not received yet */
+	double   window;           /* bytes that may be outstanding */
+	double   srtt;             /* smoothed time to first byte (secs) */
+	double   minRtt;           /* smallest time to first byte seen (secs) */
+	double   goodput;          /* bytes/sec received, measured over ~1 rtt */
+	uint32_t goodputBytes;     /* data recvd since goodputTS */
+	double   goodputTS;        /* start of the current goodput sample */
+	double   lastRecv;         /* last Recv (monotonic secs) */
+	double   reqCredit;        /* bytes that can still be requested under desiredRate */
+	double   reqCreditTS;      /* last update of reqCredit */
 };
 
 class ftFileStatus
@@ -129,7 +150,7 @@ public:
   void forceCheck() ;
 
   //interface to multiplex module
-  bool recvFileData(const RsPeerId& peerId, uint64_t offset, uint32_t chunk_size, void *data);
+  bool recvFileData(const RsPeerId& peerId, uint64_t offset, uint32_t chunk_size, const RsSharedBuffer& data);
   void locked_requestData(const RsPeerId& peerId, uint64_t offset, uint32_t chunk_size);
 
   //interface to file creator
@@ -155,6 +176,8 @@ public:
 private:
 
   bool locked_tickPeerTransfer(peerInfo &info);
+  void locked_fillPipeline(peerInfo &info, double now);
+  void locked_resetPipeline(peerInfo &info);
   bool locked_recvPeerData(peerInfo &info, uint64_t offset,
 			uint32_t chunk_size, void *data);
   
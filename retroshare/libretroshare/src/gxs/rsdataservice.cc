@@ -29,6 +29,7 @@
 #include <fstream>
 #include <util/rsdir.h>
 #include <algorithm>
+#include <memory>
 
 #ifdef RS_DATA_SERVICE_DEBUG_TIME
 #include <util/rstime.h>
@@ -45,8 +46,12 @@
 #define GRP_LAST_POST_UPDATE_TRIGGER std::string("LAST_POST_UPDATE")
 
 #define MSG_INDEX_GRPID std::string("INDEX_MESSAGES_GRPID")
+#define MSG_INDEX_GRPID_TS std::string("INDEX_MESSAGES_GRPID_TS")
+#define MSG_INDEX_PARENTID std::string("INDEX_MESSAGES_PARENTID")
+#define MSG_INDEX_ORIGMSGID std::string("INDEX_MESSAGES_ORIGMSGID")
 
 // generic
+#define KEY_ROWID           std::string("rowid")
 #define KEY_NXS_DATA        std::string("nxsData")
 #define KEY_NXS_DATA_LEN    std::string("nxsDataLen")
 #define KEY_NXS_IDENTITY    std::string("identity")
@@ -100,6 +105,9 @@
 #define KEY_DATABASE_RELEASE_ID_VALUE 1
 #define KEY_DATABASE_RELEASE std::string("release")
 
+// max number of messages removed in a single transaction
+static const uint32_t MSG_REMOVAL_BATCH_SIZE = 256;
+
 const std::string RsGeneralDataService::GRP_META_SERV_STRING = KEY_NXS_SERV_STRING;
 const std::string RsGeneralDataService::GRP_META_STATUS = KEY_GRP_STATUS;
 const std::string RsGeneralDataService::GRP_META_SUBSCRIBE_FLAG = KEY_GRP_SUBCR_FLAG;
@@ -118,14 +126,18 @@ static int addColumn(std::list<std::string> &list, const std::string &attribute)
 }
 
 RsDataService::RsDataService(const std::string &serviceDir, const std::string &dbName, uint16_t serviceType,
-                             RsGxsSearchModule * /* mod */, const std::string& key)
-    : RsGeneralDataService(), mDbMutex("RsDataService"), mServiceDir(serviceDir), mDbName(dbName), mDbPath(mServiceDir + "/" + dbName), mServType(serviceType), mDb(NULL)
+                             RsGxsSearchModule * /* mod */, const std::string& key, const RsDataServiceStorageOptions& storage)
+    : RsGeneralDataService(), mDbMutex("RsDataService"), mServiceDir(serviceDir), mDbName(dbName), mDbPath(mServiceDir + "/" + dbName), mServType(serviceType), mDb(NULL),
+      mNextReader(0), mCheckpointStop(false), mWriteGeneration(0)
 {
     bool isNewDatabase = !RsDirUtil::fileExists(mDbPath);
 
     mDb = new RetroDb(mDbPath, RetroDb::OPEN_READWRITE_CREATE, key);
     mUseCache = true;
 
+    // The journal mode must be changed outside of any transaction, so before the tables are created or upgraded.
+    bool wal = storage.mConcurrentReaders > 0 && mDb->isOpen() && mDb->enableWal(storage.mCacheSizeKb, storage.mMmapSize);
+
     initialise(isNewDatabase);
 
     // for retrieving msg meta
@@ -147,8 +159,10 @@ RsDataService::RsDataService(const std::string &serviceDir, const std::string &d
     mColMsgMeta_NxsDataLen    = addColumn(mMsgMetaColumns, KEY_NXS_DATA_LEN);
 
     // for retrieving actual data
+    // the data itself is read through a blob, straight into the item
     mColMsg_GrpId = addColumn(mMsgColumns, KEY_GRP_ID);
-    mColMsg_NxsData = addColumn(mMsgColumns, KEY_NXS_DATA);
+    mColMsg_RowId = addColumn(mMsgColumns, KEY_ROWID);
+    mColMsg_NxsDataLen = addColumn(mMsgColumns, KEY_NXS_DATA_LEN);
     mColMsg_MetaData = addColumn(mMsgColumns, KEY_NXS_META);
     mColMsg_MsgId = addColumn(mMsgColumns, KEY_MSG_ID);
 
@@ -186,7 +200,8 @@ RsDataService::RsDataService(const std::string &serviceDir, const std::string &d
 
     // for retrieving actual grp data
     mColGrp_GrpId = addColumn(mGrpColumns, KEY_GRP_ID);
-    mColGrp_NxsData = addColumn(mGrpColumns, KEY_NXS_DATA);
+    mColGrp_RowId = addColumn(mGrpColumns, KEY_ROWID);
+    mColGrp_NxsDataLen = addColumn(mGrpColumns, KEY_NXS_DATA_LEN);
     mColGrp_MetaData = addColumn(mGrpColumns, KEY_NXS_META);
 
     // for retrieving grp data with meta
@@ -199,6 +214,13 @@ RsDataService::RsDataService(const std::string &serviceDir, const std::string &d
 
     // Msg id columns
     mColMsgId_MsgId = addColumn(mMsgIdColumn, KEY_MSG_ID);
+
+    // Msg expiry columns
+    mColMsgExpiry_MsgId = addColumn(mMsgExpiryColumns, KEY_MSG_ID);
+    mColMsgExpiry_TimeStamp = addColumn(mMsgExpiryColumns, KEY_TIME_STAMP);
+
+    if(wal)
+        openReaders(key, storage);
 }
 
 RsDataService::~RsDataService(){
@@ -208,10 +230,133 @@ RsDataService::~RsDataService(){
     std::cerr << std::endl;
 #endif
 
+    // The main connection is closed last, which checkpoints what is left in the log.
+    closeReaders();
+
     mDb->closeDb();
     delete mDb;
 }
 
+class RsDataService::DbReadAccess
+{
+public:
+    DbReadAccess(RsDataService& ds) : mMtx(nullptr), mDb(nullptr)
+    {
+        if(ds.mReaders.empty())
+        {
+            mMtx = &ds.mDbMutex;
+            mMtx->lock();
+            mDb = ds.mDb;
+            return;
+        }
+
+        // Take the first free reader, starting from a different one at each call. If they are all
+        // busy, wait for the first one tried.
+
+        uint32_t n = ds.mReaders.size();
+        uint32_t first = ds.mNextReader++ % n;
+
+        for(uint32_t i=0; i<n && !mMtx; ++i)
+        {
+            DbReader& r(*ds.mReaders[(first + i) % n]);
+
+            if(r.mMtx.trylock())
+            {
+                mMtx = &r.mMtx;
+                mDb = r.mDb;
+            }
+        }
+
+        if(!mMtx)
+        {
+            DbReader& r(*ds.mReaders[first]);
+            mMtx = &r.mMtx;
+            mMtx->lock();
+            mDb = r.mDb;
+        }
+    }
+
+    ~DbReadAccess() { mMtx->unlock(); }
+
+    RetroDb* operator->() const { return mDb; }
+
+private:
+    RsMutex *mMtx;
+    RetroDb *mDb;
+};
+
+void RsDataService::openReaders(const std::string& key, const RsDataServiceStorageOptions& storage)
+{
+    for(uint32_t i=0; i<storage.mConcurrentReaders; ++i)
+    {
+        RetroDb *db = new RetroDb(mDbPath, RetroDb::OPEN_READWRITE, key);
+
+        if(!db->isOpen() || !db->setQueryOnly(storage.mCacheSizeKb, storage.mMmapSize))
+        {
+            RsErr() << __PRETTY_FUNCTION__ << " Cannot open reader " << i << " on " << mDbPath << ", reads will use the main connection." << std::endl;
+            delete db;
+            break;
+        }
+
+        mReaders.push_back(std::unique_ptr<DbReader>(new DbReader));
+        mReaders.back()->mDb = db;
+    }
+
+    if(mReaders.empty())
+        return;
+
+    mCheckpointThread = std::thread(&RsDataService::checkpointLoop, this, key, storage.mCheckpointInterval);
+}
+
+void RsDataService::closeReaders()
+{
+    if(mCheckpointThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mCheckpointMtx);
+            mCheckpointStop = true;
+        }
+        mCheckpointCond.notify_all();
+        mCheckpointThread.join();
+    }
+
+    for(auto& r:mReaders)
+    {
+        RsStackMutex stack(r->mMtx);
+        delete r->mDb;
+        r->mDb = nullptr;
+    }
+    mReaders.clear();
+}
+
+void RsDataService::checkpointLoop(const std::string& key, uint32_t interval)
+{
+    // The log is checkpointed from a connection of its own, so that neither the writer nor the readers wait for it.
+
+    RetroDb db(mDbPath, RetroDb::OPEN_READWRITE, key);
+
+    if(!db.isOpen())
+    {
+        RsErr() << __PRETTY_FUNCTION__ << " Cannot open " << mDbPath << ", the log will only be checkpointed at exit." << std::endl;
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mCheckpointMtx);
+
+    while(!mCheckpointCond.wait_for(lock, std::chrono::milliseconds(interval), [this]() { return mCheckpointStop; }))
+    {
+        lock.unlock();
+
+        int logPages = 0, checkpointedPages = 0;
+        db.checkpoint(&logPages, &checkpointedPages);
+
+#ifdef RS_DATA_SERVICE_DEBUG
+        std::cerr << "RsDataService::checkpointLoop() " << mDbName << ": " << checkpointedPages << "/" << logPages << " pages checkpointed" << std::endl;
+#endif
+        lock.lock();
+    }
+}
+
 static bool moveDataFromFileToDatabase(RetroDb *db, const std::string serviceDir, const std::string &tableName, const std::string &keyId, std::list<std::string> &files)
 {
     bool ok = true;
@@ -289,9 +434,132 @@ static bool moveDataFromFileToDatabase(RetroDb *db, const std::string serviceDir
     return ok;
 }
 
+// Columns of the message and group tables. The data of the items comes last: the other columns
+// then stay at the start of the row, and reading them never goes through the overflow pages of a
+// large item. It also lets SQLite insert the data as a zero blob without allocating it.
+
+typedef std::list<std::pair<std::string, std::string> > TableColumns;
+
+static const TableColumns& msgTableColumns()
+{
+    static const TableColumns columns = {
+        { KEY_MSG_ID,          "TEXT PRIMARY KEY" },
+        { KEY_GRP_ID,          "TEXT" },
+        { KEY_NXS_FLAGS,       "INT" },
+        { KEY_ORIG_MSG_ID,     "TEXT" },
+        { KEY_TIME_STAMP,      "INT" },
+        { KEY_NXS_IDENTITY,    "TEXT" },
+        { KEY_SIGN_SET,        "BLOB" },
+        { KEY_NXS_DATA_LEN,    "INT" },
+        { KEY_MSG_STATUS,      "INT" },
+        { KEY_CHILD_TS,        "INT" },
+        { KEY_NXS_META,        "BLOB" },
+        { KEY_MSG_THREAD_ID,   "TEXT" },
+        { KEY_MSG_PARENT_ID,   "TEXT" },
+        { KEY_MSG_NAME,        "TEXT" },
+        { KEY_NXS_SERV_STRING, "TEXT" },
+        { KEY_NXS_HASH,        "TEXT" },
+        { KEY_RECV_TS,         "INT" },
+        { KEY_NXS_DATA,        "BLOB" } };
+
+    return columns;
+}
+
+static const TableColumns& grpTableColumns()
+{
+    static const TableColumns columns = {
+        { KEY_GRP_ID,              "TEXT PRIMARY KEY" },
+        { KEY_TIME_STAMP,          "INT" },
+        { KEY_NXS_DATA_LEN,        "INT" },
+        { KEY_KEY_SET,             "BLOB" },
+        { KEY_NXS_META,            "BLOB" },
+        { KEY_GRP_NAME,            "TEXT" },
+        { KEY_GRP_LAST_POST,       "INT" },
+        { KEY_GRP_POP,             "INT" },
+        { KEY_MSG_COUNT,           "INT" },
+        { KEY_GRP_SUBCR_FLAG,      "INT" },
+        { KEY_GRP_STATUS,          "INT" },
+        { KEY_NXS_IDENTITY,        "TEXT" },
+        { KEY_ORIG_GRP_ID,         "TEXT" },
+        { KEY_NXS_SERV_STRING,     "TEXT" },
+        { KEY_NXS_FLAGS,           "INT" },
+        { KEY_GRP_AUTHEN_FLAGS,    "INT" },
+        { KEY_GRP_SIGN_FLAGS,      "INT" },
+        { KEY_GRP_CIRCLE_ID,       "TEXT" },
+        { KEY_GRP_CIRCLE_TYPE,     "INT" },
+        { KEY_GRP_INTERNAL_CIRCLE, "TEXT" },
+        { KEY_GRP_ORIGINATOR,      "TEXT" },
+        { KEY_NXS_HASH,            "TEXT" },
+        { KEY_RECV_TS,             "INT" },
+        { KEY_PARENT_GRP_ID,       "TEXT" },
+        { KEY_GRP_REP_CUTOFF,      "INT" },
+        { KEY_SIGN_SET,            "BLOB" },
+        { KEY_NXS_DATA,            "BLOB" } };
+
+    return columns;
+}
+
+static std::string columnNames(const TableColumns& columns)
+{
+    std::string names;
+
+    for(auto it = columns.begin(); it != columns.end(); ++it)
+        names += (names.empty() ? "" : ",") + it->first;
+
+    return names;
+}
+
+static void createTable(RetroDb *db, const std::string& tableName, const TableColumns& columns, bool& ok)
+{
+    std::string definition;
+
+    for(auto it = columns.begin(); it != columns.end(); ++it)
+        definition += (definition.empty() ? "" : ",") + it->first + " " + it->second;
+
+    ok = ok && db->execSQL("CREATE TABLE " + tableName + "(" + definition + ");");
+}
+
+// SQLite cannot move a column, so the rows are copied into a new table with the right layout.
+// The indexes and triggers of the old table are dropped with it.
+
+static void rebuildTable(RetroDb *db, const std::string& tableName, const TableColumns& columns, bool& ok)
+{
+    const std::string newTableName = tableName + "_NEW";
+    const std::string names = columnNames(columns);
+
+    createTable(db, newTableName, columns, ok);
+    ok = ok && db->execSQL("INSERT INTO " + newTableName + "(" + names + ") SELECT " + names + " FROM " + tableName + ";");
+    ok = ok && db->execSQL("DROP TABLE " + tableName + ";");
+    ok = ok && db->execSQL("ALTER TABLE " + newTableName + " RENAME TO " + tableName + ";");
+}
+
+static void createLastPostTrigger(RetroDb *db, bool& ok)
+{
+    ok = ok && db->execSQL("CREATE TRIGGER " + GRP_LAST_POST_UPDATE_TRIGGER +
+            " INSERT ON " + MSG_TABLE_NAME +
+            std::string(" BEGIN ") +
+            " UPDATE " + GRP_TABLE_NAME + " SET " + KEY_GRP_LAST_POST + "= new."
+            + KEY_RECV_TS + " WHERE " + KEY_GRP_ID + "=new." + KEY_GRP_ID + ";"
+            + std::string("END;"));
+}
+
+// Indexes used by the message clean up: expired messages are looked up by group and publish time,
+// messages with replies are skipped using the parent index, and old versions of edited messages are
+// found through a partial index that only contains the edited messages.
+
+static void createMsgExpiryIndexes(RetroDb *db,bool& ok)
+{
+    const std::string null_msg_id = RsGxsMessageId().toStdString();
+
+    ok = ok && db->execSQL("CREATE INDEX " + MSG_INDEX_GRPID_TS + " ON " + MSG_TABLE_NAME + "(" + KEY_GRP_ID + "," + KEY_TIME_STAMP + ");");
+    ok = ok && db->execSQL("CREATE INDEX " + MSG_INDEX_PARENTID + " ON " + MSG_TABLE_NAME + "(" + KEY_MSG_PARENT_ID + ");");
+    ok = ok && db->execSQL("CREATE INDEX " + MSG_INDEX_ORIGMSGID + " ON " + MSG_TABLE_NAME + "(" + KEY_GRP_ID + "," + KEY_ORIG_MSG_ID + ")"
+                           + " WHERE " + KEY_ORIG_MSG_ID + "!=" + KEY_MSG_ID + " AND " + KEY_ORIG_MSG_ID + "!='" + null_msg_id + "';");
+}
+
 void RsDataService::initialise(bool isNewDatabase)
 {
-    const int databaseRelease = 1;
+    const int databaseRelease = 3;
     int currentDatabaseRelease = 0;
     bool ok = true;
 
@@ -307,65 +575,13 @@ void RsDataService::initialise(bool isNewDatabase)
     }
 
     if (isNewDatabase) {
-        // create table for msg data
-        mDb->execSQL("CREATE TABLE " + MSG_TABLE_NAME + "(" +
-                     KEY_MSG_ID + " TEXT PRIMARY KEY," +
-                     KEY_GRP_ID +  " TEXT," +
-                     KEY_NXS_FLAGS + " INT,"  +
-                     KEY_ORIG_MSG_ID +  " TEXT," +
-                     KEY_TIME_STAMP + " INT," +
-                     KEY_NXS_IDENTITY + " TEXT," +
-                     KEY_SIGN_SET + " BLOB," +
-                     KEY_NXS_DATA + " BLOB,"+
-                     KEY_NXS_DATA_LEN + " INT," +
-                     KEY_MSG_STATUS + " INT," +
-                     KEY_CHILD_TS + " INT," +
-                     KEY_NXS_META + " BLOB," +
-                     KEY_MSG_THREAD_ID + " TEXT," +
-                     KEY_MSG_PARENT_ID + " TEXT,"+
-                     KEY_MSG_NAME + " TEXT," +
-                     KEY_NXS_SERV_STRING + " TEXT," +
-                     KEY_NXS_HASH + " TEXT," +
-                     KEY_RECV_TS + " INT);");
-
-        // create table for grp data
-        mDb->execSQL("CREATE TABLE " + GRP_TABLE_NAME + "(" +
-                     KEY_GRP_ID + " TEXT PRIMARY KEY," +
-                     KEY_TIME_STAMP + " INT," +
-                     KEY_NXS_DATA + " BLOB," +
-                     KEY_NXS_DATA_LEN + " INT," +
-                     KEY_KEY_SET + " BLOB," +
-                     KEY_NXS_META + " BLOB," +
-                     KEY_GRP_NAME + " TEXT," +
-                     KEY_GRP_LAST_POST + " INT," +
-                     KEY_GRP_POP + " INT," +
-                     KEY_MSG_COUNT + " INT," +
-                     KEY_GRP_SUBCR_FLAG + " INT," +
-                     KEY_GRP_STATUS + " INT," +
-                     KEY_NXS_IDENTITY + " TEXT," +
-                     KEY_ORIG_GRP_ID + " TEXT," +
-                     KEY_NXS_SERV_STRING + " TEXT," +
-                     KEY_NXS_FLAGS + " INT," +
-                     KEY_GRP_AUTHEN_FLAGS + " INT," +
-                     KEY_GRP_SIGN_FLAGS + " INT," +
-                     KEY_GRP_CIRCLE_ID + " TEXT," +
-                     KEY_GRP_CIRCLE_TYPE + " INT," +
-                     KEY_GRP_INTERNAL_CIRCLE + " TEXT," +
-                     KEY_GRP_ORIGINATOR + " TEXT," +
-                     KEY_NXS_HASH + " TEXT," +
-                     KEY_RECV_TS + " INT," +
-                     KEY_PARENT_GRP_ID + " TEXT," +
-                     KEY_GRP_REP_CUTOFF + " INT," +
-                     KEY_SIGN_SET + " BLOB);");
-
-        mDb->execSQL("CREATE TRIGGER " + GRP_LAST_POST_UPDATE_TRIGGER +
-                " INSERT ON " + MSG_TABLE_NAME +
-                std::string(" BEGIN ") +
-                " UPDATE " + GRP_TABLE_NAME + " SET " + KEY_GRP_LAST_POST + "= new."
-                + KEY_RECV_TS + " WHERE " + KEY_GRP_ID + "=new." + KEY_GRP_ID + ";"
-                + std::string("END;"));
-
-        mDb->execSQL("CREATE INDEX " + MSG_INDEX_GRPID + " ON " + MSG_TABLE_NAME + "(" + KEY_GRP_ID +  ");");
+        // create tables for msg and grp data
+        createTable(mDb, MSG_TABLE_NAME, msgTableColumns(), ok);
+        createTable(mDb, GRP_TABLE_NAME, grpTableColumns(), ok);
+        createLastPostTrigger(mDb, ok);
+
+        // The (grpId,timeStamp) index also serves all the queries by group id.
+        createMsgExpiryIndexes(mDb,ok);
 
         // Insert release, no need to upgrade
         ContentValue cv;
@@ -441,6 +657,39 @@ void RsDataService::initialise(bool isNewDatabase)
                 currentDatabaseRelease = newRelease;
             }
         }
+
+        // Release 2
+        newRelease = 2;
+        if (ok && currentDatabaseRelease < newRelease) {
+            ok = startReleaseUpdate(newRelease);
+
+            // Indexes for the message clean up. The index on group ids alone is a prefix of the new one.
+            createMsgExpiryIndexes(mDb,ok);
+            ok = ok && mDb->execSQL("DROP INDEX IF EXISTS " + MSG_INDEX_GRPID + ";");
+
+            ok = finishReleaseUpdate(newRelease, ok);
+            if (ok) {
+                currentDatabaseRelease = newRelease;
+            }
+        }
+
+        // Release 3
+        newRelease = 3;
+        if (ok && currentDatabaseRelease < newRelease) {
+            ok = startReleaseUpdate(newRelease);
+
+            // Move the data of the items at the end of the rows. This copies the whole database once.
+            ok = ok && mDb->execSQL("DROP TRIGGER IF EXISTS " + GRP_LAST_POST_UPDATE_TRIGGER + ";");
+            rebuildTable(mDb, MSG_TABLE_NAME, msgTableColumns(), ok);
+            rebuildTable(mDb, GRP_TABLE_NAME, grpTableColumns(), ok);
+            createMsgExpiryIndexes(mDb, ok);
+            createLastPostTrigger(mDb, ok);
+
+            ok = finishReleaseUpdate(newRelease, ok);
+            if (ok) {
+                currentDatabaseRelease = newRelease;
+            }
+        }
     }
 
     if (ok) {
@@ -484,10 +733,87 @@ bool RsDataService::finishReleaseUpdate(int release, bool result)
     return result;
 }
 
-std::shared_ptr<RsGxsGrpMetaData> RsDataService::locked_getGrpMeta(RetroCursor& c, int colOffset)
+// The data of the items is written and read through incremental blob I/O, straight from and into
+// the buffer of the item, so that a large item is never copied as a whole into a query or its result.
+
+static bool writeNxsData(RetroDb *db, const std::string& tableName, int64_t rowid, const RsTlvBinaryData& data)
+{
+    uint8_t header[TLV_HEADER_SIZE];
+    uint32_t offset = 0;
+
+    if(!SetTlvBase(header, TLV_HEADER_SIZE, &offset, data.tlvtype, data.TlvSize()))
+        return false;
+
+    std::unique_ptr<RetroBlob> blob(db->openBlob(tableName, KEY_NXS_DATA, rowid, true));
+
+    // the row holds a zero blob of the size of the serialised data
+    if(!blob || blob->size() != data.TlvSize())
+        return false;
+
+    bool ok = blob->write(header, TLV_HEADER_SIZE, 0);
+
+    if(ok && data.bin_data != NULL && data.bin_len > 0)
+        ok = blob->write(data.bin_data, data.bin_len, TLV_HEADER_SIZE);
+
+    return ok;
+}
+
+static bool readNxsData(RetroCursor& c, const std::string& tableName, int64_t rowid, RsTlvBinaryData& data)
+{
+    std::unique_ptr<RetroBlob> blob(c.openBlob(tableName, KEY_NXS_DATA, rowid));
+
+    if(!blob)
+        return false;
+
+    // same checks as RsTlvBinaryData::GetTlv()
+    uint8_t header[TLV_HEADER_SIZE];
+    uint32_t size = blob->size();
+
+    if(size < TLV_HEADER_SIZE || !blob->read(header, TLV_HEADER_SIZE, 0))
+        return false;
+
+    uint32_t tlvsize = GetTlvSize(header);
+
+    if(tlvsize < TLV_HEADER_SIZE || tlvsize > size || GetTlvType(header) != data.tlvtype)
+        return false;
+
+    data.TlvClear();
+
+    if(tlvsize == TLV_HEADER_SIZE)
+        return true;
+
+    data.bin_data = rs_malloc(tlvsize - TLV_HEADER_SIZE);
+
+    if(data.bin_data == NULL)
+        return false;
+
+    data.bin_len = tlvsize - TLV_HEADER_SIZE;
+
+    if(!blob->read(data.bin_data, data.bin_len, TLV_HEADER_SIZE))
+    {
+        data.TlvClear();
+        return false;
+    }
+
+    return true;
+}
+
+static int64_t locked_rowId(RetroDb *db, const std::string& tableName, const std::string& where)
+{
+    int64_t rowid = 0;
+    RetroCursor* c = db->sqlQuery(tableName, std::list<std::string>(1, KEY_ROWID), where, "");
+
+    if(c && c->moveToFirst())
+        rowid = c->getInt64(0);
+
+    delete c;
+    return rowid;
+}
+
+std::shared_ptr<RsGxsGrpMetaData> RsDataService::getGrpMeta(RetroCursor& c, int colOffset)
 {
 #ifdef RS_DATA_SERVICE_DEBUG
-    std::cerr << "RsDataService::locked_getGrpMeta()" << std::endl;
+    std::cerr << "RsDataService::getGrpMeta()" << std::endl;
 #endif
 
     bool ok = true;
@@ -501,19 +827,12 @@ std::shared_ptr<RsGxsGrpMetaData> RsDataService::locked_getGrpMeta(RetroCursor&
     std::string tempId;
     c.getString(mColGrpMeta_GrpId + colOffset, tempId);
 
-    std::shared_ptr<RsGxsGrpMetaData> grpMeta ;
 	RsGxsGroupId grpId(tempId) ;
 
     if(grpId.isNull())			// not in the DB!
         return nullptr;
 
-    if(mUseCache)
-        grpMeta = mGrpMetaDataCache.getOrCreateMeta(grpId);
-	else
-        grpMeta = std::make_shared<RsGxsGrpMetaData>();
-
-    if(!grpMeta->mGroupId.isNull())	// the grpMeta is already initialized because it comes from the cache
-        return grpMeta;
+    auto grpMeta = std::make_shared<RsGxsGrpMetaData>();
 
     grpMeta->mGroupId = RsGxsGroupId(tempId);
     c.getString(mColGrpMeta_NxsIdentity + colOffset, tempId);
@@ -601,7 +920,7 @@ std::shared_ptr<RsGxsGrpMetaData> RsDataService::locked_getGrpMeta(RetroCursor&
 		return NULL;
 }
 
-RsNxsGrp* RsDataService::locked_getGroup(RetroCursor &c)
+RsNxsGrp* RsDataService::getGroup(RetroCursor &c)
 {
     /*!
      * grpId, pub admin and pub publish key
@@ -627,13 +946,9 @@ RsNxsGrp* RsDataService::locked_getGroup(RetroCursor &c)
             grp->meta.GetTlv(data, data_len, &offset);
     }
 
-    /* now retrieve grp data */
-    offset = 0; data_len = 0;
-    if(ok){
-        data = (char*)c.getData(mColGrp_NxsData, data_len);
-        if(data)
-            ok &= grp->grp.GetTlv(data, data_len, &offset);
-    }
+    /* now retrieve grp data, rows without data give an empty grp as before */
+    if(ok && c.getInt32(mColGrp_NxsDataLen) > 0)
+        ok &= readNxsData(c, GRP_TABLE_NAME, c.getInt64(mColGrp_RowId), grp->grp);
 
     if(ok)
         return grp;
@@ -643,7 +958,7 @@ RsNxsGrp* RsDataService::locked_getGroup(RetroCursor &c)
     return NULL;
 }
 
-std::shared_ptr<RsGxsMsgMetaData> RsDataService::locked_getMsgMeta(RetroCursor &c, int colOffset)
+std::shared_ptr<RsGxsMsgMetaData> RsDataService::getMsgMeta(RetroCursor &c, int colOffset)
 {
     bool ok = true;
     uint32_t data_len = 0,
@@ -664,15 +979,7 @@ std::shared_ptr<RsGxsMsgMetaData> RsDataService::locked_getMsgMeta(RetroCursor &
     if(group_id.isNull() || msg_id.isNull())
         return nullptr;
 
-    std::shared_ptr<RsGxsMsgMetaData> msgMeta;
-
-    if(mUseCache)
-        msgMeta = mMsgMetaDataCache[group_id].getOrCreateMeta(msg_id);
-	else
-        msgMeta = std::make_shared<RsGxsMsgMetaData>();
-
-    if(!msgMeta->mGroupId.isNull())	// we cannot do that because the cursor needs to advance. Is there a method to skip some data in the db?
-        return msgMeta;
+    auto msgMeta = std::make_shared<RsGxsMsgMetaData>();
 
 	msgMeta->mGroupId = group_id;
 	msgMeta->mMsgId = msg_id;
@@ -715,7 +1022,7 @@ std::shared_ptr<RsGxsMsgMetaData> RsDataService::locked_getMsgMeta(RetroCursor &
 
 
 
-RsNxsMsg* RsDataService::locked_getMessage(RetroCursor &c)
+RsNxsMsg* RsDataService::getMessage(RetroCursor &c)
 {
 
     RsNxsMsg* msg = new RsNxsMsg(mServType);
@@ -739,13 +1046,9 @@ RsNxsMsg* RsDataService::locked_getMessage(RetroCursor &c)
             msg->meta.GetTlv(data, data_len, &offset);
     }
 
-    /* now retrieve msg data */
-    offset = 0; data_len = 0;
-    if(ok){
-        data = (char*)c.getData(mColMsg_NxsData, data_len);
-        if(data)
-            ok &= msg->msg.GetTlv(data, data_len, &offset);
-    }
+    /* now retrieve msg data, rows without data give an empty msg as before */
+    if(ok && c.getInt32(mColMsg_NxsDataLen) > 0)
+        ok &= readNxsData(c, MSG_TABLE_NAME, c.getInt64(mColMsg_RowId), msg->msg);
 
     if(ok)
         return msg;
@@ -761,6 +1064,7 @@ int RsDataService::storeMessage(const std::list<RsNxsMsg*>& msg)
 
     // start a transaction
     mDb->beginTransaction();
+    ++mWriteGeneration;
 
     for(std::list<RsNxsMsg*>::const_iterator mit = msg.begin(); mit != msg.end(); ++mit)
     {
@@ -786,11 +1090,9 @@ int RsDataService::storeMessage(const std::list<RsNxsMsg*>& msg)
 
         ContentValue cv;
 
+        // the data is written once the row exists, see writeNxsData()
         uint32_t dataLen = msgPtr->msg.TlvSize();
-        char msgData[dataLen];
-        uint32_t offset = 0;
-        msgPtr->msg.SetTlv(msgData, dataLen, &offset);
-        cv.put(KEY_NXS_DATA, dataLen, msgData);
+        cv.putZeroBlob(KEY_NXS_DATA, dataLen);
 
         cv.put(KEY_NXS_DATA_LEN, (int32_t)dataLen);
         cv.put(KEY_MSG_ID, msgMetaPtr->mMsgId.toStdString());
@@ -801,7 +1103,7 @@ int RsDataService::storeMessage(const std::list<RsNxsMsg*>& msg)
 
 
         char signSetData[msgMetaPtr->signSet.TlvSize()];
-        offset = 0;
+        uint32_t offset = 0;
         msgMetaPtr->signSet.SetTlv(signSetData, msgMetaPtr->signSet.TlvSize(), &offset);
         cv.put(KEY_SIGN_SET, msgMetaPtr->signSet.TlvSize(), signSetData);
         cv.put(KEY_NXS_IDENTITY, msgMetaPtr->mAuthorId.toStdString());
@@ -833,6 +1135,13 @@ int RsDataService::storeMessage(const std::list<RsNxsMsg*>& msg)
             std::cerr << "\t & MessageId: " << msgMetaPtr->mMsgId.toStdString();
             std::cerr << std::endl;
         }
+        else if (!writeNxsData(mDb, MSG_TABLE_NAME, mDb->lastInsertRowId(), msgPtr->msg))
+        {
+            std::cerr << "RsDataService::storeMessage() cannot write data of MessageId: " << msgMetaPtr->mMsgId.toStdString();
+            std::cerr << std::endl;
+
+            mDb->sqlDelete(MSG_TABLE_NAME, KEY_ROWID + "=" + std::to_string(mDb->lastInsertRowId()), "");
+        }
 
         // This is needed so that mLastPost is correctly updated in the group meta when it is re-loaded.
 
@@ -863,6 +1172,7 @@ int RsDataService::storeGroup(const std::list<RsNxsGrp*>& grp)
 
     // begin transaction
     mDb->beginTransaction();
+    ++mWriteGeneration;
 
     for(std::list<RsNxsGrp*>::const_iterator sit = grp.begin();sit != grp.end(); ++sit)
 	{
@@ -889,11 +1199,9 @@ int RsDataService::storeGroup(const std::list<RsNxsGrp*>& grp)
 		 **/
 		ContentValue cv;
 
+		// the data is written once the row exists, see writeNxsData()
 		uint32_t dataLen = grpPtr->grp.TlvSize();
-		char grpData[dataLen];
-		uint32_t offset = 0;
-		grpPtr->grp.SetTlv(grpData, dataLen, &offset);
-		cv.put(KEY_NXS_DATA, dataLen, grpData);
+		cv.putZeroBlob(KEY_NXS_DATA, dataLen);
 
 		cv.put(KEY_NXS_DATA_LEN, (int32_t) dataLen);
 		cv.put(KEY_GRP_ID, grpPtr->grpId.toStdString());
@@ -914,7 +1222,7 @@ int RsDataService::storeGroup(const std::list<RsNxsGrp*>& grp)
 		cv.put(KEY_GRP_REP_CUTOFF, (int32_t)grpMetaPtr->mReputationCutOff);
 		cv.put(KEY_NXS_IDENTITY, grpMetaPtr->mAuthorId.toStdString());
 
-		offset = 0;
+		uint32_t offset = 0;
 		char keySetData[grpMetaPtr->keys.TlvSize()];
 		grpMetaPtr->keys.SetTlv(keySetData, grpMetaPtr->keys.TlvSize(), &offset);
 		cv.put(KEY_KEY_SET, grpMetaPtr->keys.TlvSize(), keySetData);
@@ -940,6 +1248,13 @@ int RsDataService::storeGroup(const std::list<RsNxsGrp*>& grp)
 			std::cerr << "\t For GroupId: " << grpMetaPtr->mGroupId.toStdString();
 			std::cerr << std::endl;
 		}
+		else if (!writeNxsData(mDb, GRP_TABLE_NAME, mDb->lastInsertRowId(), grpPtr->grp))
+		{
+			std::cerr << "RsDataService::storeGroup() cannot write data of GroupId: " << grpMetaPtr->mGroupId.toStdString();
+			std::cerr << std::endl;
+
+			mDb->sqlDelete(GRP_TABLE_NAME, KEY_ROWID + "=" + std::to_string(mDb->lastInsertRowId()), "");
+		}
 
         delete *sit;
 	}
@@ -956,6 +1271,7 @@ int RsDataService::updateGroup(const std::list<RsNxsGrp *> &grp)
 
     // begin transaction
     mDb->beginTransaction();
+    ++mWriteGeneration;
 
     for( std::list<RsNxsGrp*>::const_iterator sit = grp.begin(); sit != grp.end(); ++sit)
     {
@@ -976,10 +1292,7 @@ int RsDataService::updateGroup(const std::list<RsNxsGrp *> &grp)
          **/
         ContentValue cv;
         uint32_t dataLen = grpPtr->grp.TlvSize();
-        char grpData[dataLen];
-        uint32_t offset = 0;
-        grpPtr->grp.SetTlv(grpData, dataLen, &offset);
-        cv.put(KEY_NXS_DATA, dataLen, grpData);
+        cv.putZeroBlob(KEY_NXS_DATA, dataLen);
 
         cv.put(KEY_NXS_DATA_LEN, (int32_t) dataLen);
         cv.put(KEY_GRP_ID, grpPtr->grpId.toStdString());
@@ -998,7 +1311,7 @@ int RsDataService::updateGroup(const std::list<RsNxsGrp *> &grp)
         cv.put(KEY_RECV_TS, (int32_t)grpMetaPtr->mRecvTS);
         cv.put(KEY_NXS_IDENTITY, grpMetaPtr->mAuthorId.toStdString());
 
-        offset = 0;
+        uint32_t offset = 0;
         char keySetData[grpMetaPtr->keys.TlvSize()];
         grpMetaPtr->keys.SetTlv(keySetData, grpMetaPtr->keys.TlvSize(), &offset);
         cv.put(KEY_KEY_SET, grpMetaPtr->keys.TlvSize(), keySetData);
@@ -1015,7 +1328,14 @@ int RsDataService::updateGroup(const std::list<RsNxsGrp *> &grp)
         cv.put(KEY_GRP_STATUS, (int32_t)grpMetaPtr->mGroupStatus);
         cv.put(KEY_GRP_LAST_POST, (int32_t)grpMetaPtr->mLastPost);
 
-        mDb->sqlUpdate(GRP_TABLE_NAME, "grpId='" + grpPtr->grpId.toStdString() + "'", cv);
+        const std::string where = "grpId='" + grpPtr->grpId.toStdString() + "'";
+
+        if(mDb->sqlUpdate(GRP_TABLE_NAME, where, cv)
+                && !writeNxsData(mDb, GRP_TABLE_NAME, locked_rowId(mDb, GRP_TABLE_NAME, where), grpPtr->grp))
+        {
+            std::cerr << "RsDataService::updateGroup() cannot write data of GroupId: " << grpPtr->grpId.toStdString();
+            std::cerr << std::endl;
+        }
 
         mGrpMetaDataCache.updateMeta(grpMetaPtr->mGroupId,*grpMetaPtr);
 
@@ -1033,6 +1353,7 @@ int RsDataService::updateGroupKeys(const RsGxsGroupId& grpId,const RsTlvSecurity
 
     // begin transaction
     mDb->beginTransaction();
+    ++mWriteGeneration;
 
     /*!
      * STORE key set
@@ -1074,14 +1395,14 @@ int RsDataService::retrieveNxsGrps(std::map<RsGxsGroupId, RsNxsGrp *> &grp, bool
 
     if(grp.empty())
     {
-        RsStackMutex stack(mDbMutex);
-        RetroCursor* c = mDb->sqlQuery(GRP_TABLE_NAME, withMeta ? mGrpColumnsWithMeta : mGrpColumns, "", "");
+        DbReadAccess db(*this);
+        RetroCursor* c = db->sqlQuery(GRP_TABLE_NAME, withMeta ? mGrpColumnsWithMeta : mGrpColumns, "", "");
 
         if(c)
         {
                 std::vector<RsNxsGrp*> grps;
 
-                locked_retrieveGroups(c, grps, withMeta ? mColGrp_WithMetaOffset : 0);
+                retrieveGroups(c, grps, withMeta ? mColGrp_WithMetaOffset : 0);
                 std::vector<RsNxsGrp*>::iterator vit = grps.begin();
 
 #ifdef RS_DATA_SERVICE_DEBUG_TIME
@@ -1099,7 +1420,7 @@ int RsDataService::retrieveNxsGrps(std::map<RsGxsGroupId, RsNxsGrp *> &grp, bool
     }
     else
     {
-        RsStackMutex stack(mDbMutex);
+        DbReadAccess db(*this);
         std::map<RsGxsGroupId, RsNxsGrp *>::iterator mit = grp.begin();
 
         std::list<RsGxsGroupId> toRemove;
@@ -1107,12 +1428,12 @@ int RsDataService::retrieveNxsGrps(std::map<RsGxsGroupId, RsNxsGrp *> &grp, bool
         for(; mit != grp.end(); ++mit)
         {
             const RsGxsGroupId& grpId = mit->first;
-            RetroCursor* c = mDb->sqlQuery(GRP_TABLE_NAME, withMeta ? mGrpColumnsWithMeta : mGrpColumns, "grpId='" + grpId.toStdString() + "'", "");
+            RetroCursor* c = db->sqlQuery(GRP_TABLE_NAME, withMeta ? mGrpColumnsWithMeta : mGrpColumns, "grpId='" + grpId.toStdString() + "'", "");
 
             if(c)
             {
                 std::vector<RsNxsGrp*> grps;
-                locked_retrieveGroups(c, grps, withMeta ? mColGrp_WithMetaOffset : 0);
+                retrieveGroups(c, grps, withMeta ? mColGrp_WithMetaOffset : 0);
 
                 if(!grps.empty())
                 {
@@ -1144,19 +1465,19 @@ int RsDataService::retrieveNxsGrps(std::map<RsGxsGroupId, RsNxsGrp *> &grp, bool
     return 1;
 }
 
-void RsDataService::locked_retrieveGroups(RetroCursor* c, std::vector<RsNxsGrp*>& grps, int metaOffset)
+void RsDataService::retrieveGroups(RetroCursor* c, std::vector<RsNxsGrp*>& grps, int metaOffset)
 {
     if(c){
         bool valid = c->moveToFirst();
 
         while(valid){
-            RsNxsGrp* g = locked_getGroup(*c);
+            RsNxsGrp* g = getGroup(*c);
 
             // only add the latest grp info
             if(g)
             {
                 if (metaOffset)
-                    g->metaData = new RsGxsGrpMetaData(*locked_getGrpMeta(*c, metaOffset));
+                    g->metaData = new RsGxsGrpMetaData(*getGrpMeta(*c, metaOffset));
                 else
                     g->metaData = nullptr;
 
@@ -1185,18 +1506,18 @@ int RsDataService::retrieveNxsMsgs(const GxsMsgReq &reqIds, GxsMsgResult &msg,
 
 		if(msgIdV.empty())
 		{
-			RS_STACK_MUTEX(mDbMutex);
+			DbReadAccess db(*this);
 
-            RetroCursor* c = mDb->sqlQuery(MSG_TABLE_NAME, withMeta ? mMsgColumnsWithMeta : mMsgColumns, KEY_GRP_ID+ "='" + grpId.toStdString() + "'", "");
+            RetroCursor* c = db->sqlQuery(MSG_TABLE_NAME, withMeta ? mMsgColumnsWithMeta : mMsgColumns, KEY_GRP_ID+ "='" + grpId.toStdString() + "'", "");
 
             if(c)
-                locked_retrieveMessages(c, msgSet, withMeta ? mColMsg_WithMetaOffset : 0);
+                retrieveMessages(c, msgSet, withMeta ? mColMsg_WithMetaOffset : 0);
 
             delete c;
 		}
 		else
 		{
-			RS_STACK_MUTEX(mDbMutex);
+			DbReadAccess db(*this);
 
             // request each grp
 			for( std::set<RsGxsMessageId>::const_iterator sit = msgIdV.begin();
@@ -1204,12 +1525,12 @@ int RsDataService::retrieveNxsMsgs(const GxsMsgReq &reqIds, GxsMsgResult &msg,
 			{
                 const RsGxsMessageId& msgId = *sit;
 
-                RetroCursor* c = mDb->sqlQuery(MSG_TABLE_NAME, withMeta ? mMsgColumnsWithMeta : mMsgColumns, KEY_GRP_ID+ "='" + grpId.toStdString()
+                RetroCursor* c = db->sqlQuery(MSG_TABLE_NAME, withMeta ? mMsgColumnsWithMeta : mMsgColumns, KEY_GRP_ID+ "='" + grpId.toStdString()
                                                + "' AND " + KEY_MSG_ID + "='" + msgId.toStdString() + "'", "");
 
                 if(c)
                 {
-                    locked_retrieveMessages(c, msgSet, withMeta ? mColMsg_WithMetaOffset : 0);
+                    retrieveMessages(c, msgSet, withMeta ? mColMsg_WithMetaOffset : 0);
                 }
 
                 delete c;
@@ -1232,15 +1553,15 @@ int RsDataService::retrieveNxsMsgs(const GxsMsgReq &reqIds, GxsMsgResult &msg,
     return 1;
 }
 
-void RsDataService::locked_retrieveMessages(RetroCursor *c, std::vector<RsNxsMsg *> &msgs, int metaOffset)
+void RsDataService::retrieveMessages(RetroCursor *c, std::vector<RsNxsMsg *> &msgs, int metaOffset)
 {
     bool valid = c->moveToFirst();
     while(valid){
-        RsNxsMsg* m = locked_getMessage(*c);
+        RsNxsMsg* m = getMessage(*c);
 
         if(m){
             if (metaOffset)
-                m->metaData = new RsGxsMsgMetaData(*locked_getMsgMeta(*c, metaOffset));
+                m->metaData = new RsGxsMsgMetaData(*getMsgMeta(*c, metaOffset));
             else
                 m->metaData = nullptr;
 
@@ -1254,81 +1575,131 @@ void RsDataService::locked_retrieveMessages(RetroCursor *c, std::vector<RsNxsMsg
 
 int RsDataService::retrieveGxsMsgMetaData(const GxsMsgReq& reqIds, GxsMsgMetaResult& msgMeta)
 {
-    RsStackMutex stack(mDbMutex);
-
 #ifdef RS_DATA_SERVICE_DEBUG_TIME
     rstime::RsScopeTimer timer("");
     int resultCount = 0;
 #endif
 
-    for(auto mit(reqIds.begin()); mit != reqIds.end(); ++mit)
+    // The metas are first looked up in the cache. The missing ones are then read from the database without
+    // holding mDbMutex, and added to the cache afterwards, unless something was written in the meantime.
+
+    GxsMsgReq toLoad;		// an empty set of ids means all the messages of the group
+    uint64_t generation;
+
     {
+        RS_STACK_MUTEX(mDbMutex);
+        generation = mWriteGeneration;
 
-        const RsGxsGroupId& grpId = mit->first;
-        const std::set<RsGxsMessageId>& msgIdV = mit->second;
+        for(auto mit(reqIds.begin()); mit != reqIds.end(); ++mit)
+        {
+            const RsGxsGroupId& grpId = mit->first;
+            const std::set<RsGxsMessageId>& msgIdV = mit->second;
+            auto& metaSet(msgMeta[grpId]);
 
-        // if vector empty then request all messages
+            // The pointer here is a trick to not initialize a new cache entry when cache is disabled, while keeping the unique variable all along.
+            t_MetaDataCache<RsGxsMessageId,RsGxsMsgMetaData> *cache(mUseCache? (&mMsgMetaDataCache[grpId]) : nullptr);
 
-        // The pointer here is a trick to not initialize a new cache entry when cache is disabled, while keeping the unique variable all along.
-        t_MetaDataCache<RsGxsMessageId,RsGxsMsgMetaData> *cache(mUseCache? (&mMsgMetaDataCache[grpId]) : nullptr);
+            // if vector empty then request all messages
 
-        if(msgIdV.empty())
-        {
-            if(mUseCache && cache->isCacheUpToDate())
-                cache->getFullMetaList(msgMeta[grpId]);
+            if(msgIdV.empty())
+            {
+                if(mUseCache && cache->isCacheUpToDate())
+                    cache->getFullMetaList(metaSet);
+                else
+                    toLoad[grpId];
+            }
             else
+                for(auto sit(msgIdV.begin()); sit!=msgIdV.end(); ++sit)
+                {
+                    auto meta = mUseCache?cache->getMeta(*sit): (std::shared_ptr<RsGxsMsgMetaData>());
+
+                    if(meta)
+                        metaSet.push_back(meta);
+                    else
+                        toLoad[grpId].insert(*sit);
+                }
+        }
+    }
+
+    std::map<RsGxsGroupId,std::vector<std::shared_ptr<RsGxsMsgMetaData> > > loaded;
+
+    if(!toLoad.empty())
+    {
+        DbReadAccess db(*this);
+
+        for(auto mit(toLoad.begin()); mit != toLoad.end(); ++mit)
+        {
+            const RsGxsGroupId& grpId = mit->first;
+            auto& metaSet(loaded[grpId]);
+
+            if(mit->second.empty())
 			{
-				RetroCursor* c = mDb->sqlQuery(MSG_TABLE_NAME, mMsgMetaColumns, KEY_GRP_ID+ "='" + grpId.toStdString() + "'", "");
+				RetroCursor* c = db->sqlQuery(MSG_TABLE_NAME, mMsgMetaColumns, KEY_GRP_ID+ "='" + grpId.toStdString() + "'", "");
 
 				if (c)
-				{
-                    locked_retrieveMsgMetaList(c, msgMeta[grpId]);
+                    retrieveMsgMetaList(c, metaSet);
 
-                    if(mUseCache)
-                            cache->setCacheUpToDate(true);
-				}
                 delete c;
 			}
-#ifdef RS_DATA_SERVICE_DEBUG_CACHE
-			std::cerr << mDbName << ": Retrieving (all) Msg metadata grpId=" << grpId << ", " << std::dec << metaSet.size() << " messages" << std::endl;
-#endif
+            else
+                for(auto sit(mit->second.begin()); sit!=mit->second.end(); ++sit)
+                {
+                    RetroCursor* c = db->sqlQuery(MSG_TABLE_NAME, mMsgMetaColumns, KEY_GRP_ID+ "='" + grpId.toStdString() + "' AND " + KEY_MSG_ID + "='" + sit->toStdString() + "'", "");
+
+                    c->moveToFirst();
+                    auto meta = getMsgMeta(*c, 0);
+
+                    if(meta)
+                        metaSet.push_back(meta);
+
+                    delete c;
+                }
         }
-        else
+    }
+
+    if(!loaded.empty())
+    {
+        RS_STACK_MUTEX(mDbMutex);
+        bool cacheable = mUseCache && generation == mWriteGeneration;
+
+        for(auto lit(loaded.begin()); lit != loaded.end(); ++lit)
         {
-            // request each msg meta
-			auto& metaSet(msgMeta[grpId]);
+            const RsGxsGroupId& grpId = lit->first;
+            auto& metaSet(msgMeta[grpId]);
 
-            for(auto sit(msgIdV.begin()); sit!=msgIdV.end(); ++sit)
-			{
-				const RsGxsMessageId& msgId = *sit;
+            if(!cacheable)
+            {
+                metaSet.insert(metaSet.end(), lit->second.begin(), lit->second.end());
+                continue;
+            }
 
-                auto meta = mUseCache?cache->getMeta(msgId): (std::shared_ptr<RsGxsMsgMetaData>());
+            auto& cache(mMsgMetaDataCache[grpId]);
 
-                if(meta)
-                    metaSet.push_back(meta);
-                else
-				{
-					RetroCursor* c = mDb->sqlQuery(MSG_TABLE_NAME, mMsgMetaColumns, KEY_GRP_ID+ "='" + grpId.toStdString() + "' AND " + KEY_MSG_ID + "='" + msgId.toStdString() + "'", "");
+            // Another thread may have loaded some of the same metas in the meantime. Keep the cached ones,
+            // as clients may already hold them.
 
-                    c->moveToFirst();
-                    auto meta = locked_getMsgMeta(*c, 0);
+            for(auto& meta:lit->second)
+            {
+                auto cached = cache.getMeta(meta->mMsgId);
 
-                    if(meta)
-                    {
-                        metaSet.push_back(meta);
+                if(cached)
+                    metaSet.push_back(cached);
+                else
+                {
+                    cache.updateMeta(meta->mMsgId,meta);
+                    metaSet.push_back(meta);
+                }
+            }
 
-                        if(mUseCache)
-                            mMsgMetaDataCache[grpId].updateMeta(msgId,meta);
-                    }
+            if(toLoad[grpId].empty())
+                cache.setCacheUpToDate(true);
+        }
+    }
 
-                    delete c;
-				}
-			}
 #ifdef RS_DATA_SERVICE_DEBUG_CACHE
-			std::cerr << mDbName << ": Retrieving Msg metadata grpId=" << grpId << ", " << std::dec << metaSet.size() << " messages" << std::endl;
+    for(auto& it:msgMeta)
+        std::cerr << mDbName << ": Retrieving Msg metadata grpId=" << it.first << ", " << std::dec << it.second.size() << " messages" << std::endl;
 #endif
-        }
-    }
 
 #ifdef RS_DATA_SERVICE_DEBUG_TIME
     if(mDbName==std::string("gxsforums_db"))
@@ -1338,7 +1709,7 @@ int RsDataService::retrieveGxsMsgMetaData(const GxsMsgReq& reqIds, GxsMsgMetaRes
     return 1;
 }
 
-void RsDataService::locked_retrieveGrpMetaList(RetroCursor *c, std::map<RsGxsGroupId,std::shared_ptr<RsGxsGrpMetaData> >& grpMeta)
+void RsDataService::retrieveGrpMetaList(RetroCursor *c, std::map<RsGxsGroupId,std::shared_ptr<RsGxsGrpMetaData> >& grpMeta)
 {
 	if(!c)
 	{
@@ -1350,7 +1721,7 @@ void RsDataService::locked_retrieveGrpMetaList(RetroCursor *c, std::map<RsGxsGro
 
 	while(valid)
 	{
-        auto m = locked_getGrpMeta(*c, 0);
+        auto m = getGrpMeta(*c, 0);
 
         if(m != nullptr)
 			grpMeta[m->mGroupId] = m;
@@ -1359,7 +1730,7 @@ void RsDataService::locked_retrieveGrpMetaList(RetroCursor *c, std::map<RsGxsGro
 	}
 }
 
-void RsDataService::locked_retrieveMsgMetaList(RetroCursor *c, std::vector<std::shared_ptr<RsGxsMsgMetaData> >& msgMeta)
+void RsDataService::retrieveMsgMetaList(RetroCursor *c, std::vector<std::shared_ptr<RsGxsMsgMetaData> >& msgMeta)
 {
 	if(!c)
 	{
@@ -1370,7 +1741,7 @@ void RsDataService::locked_retrieveMsgMetaList(RetroCursor *c, std::vector<std::
 	bool valid = c->moveToFirst();
     while(valid)
     {
-        auto m = locked_getMsgMeta(*c, 0);
+        auto m = getMsgMeta(*c, 0);
 
         if(m != nullptr)
 			msgMeta.push_back(m);
@@ -1386,92 +1757,107 @@ int RsDataService::retrieveGxsGrpMetaData(std::map<RsGxsGroupId,std::shared_ptr<
     std::cerr << std::endl;
 #endif
 
-	RS_STACK_MUTEX(mDbMutex);
-
 #ifdef RS_DATA_SERVICE_DEBUG_TIME
     rstime::RsScopeTimer timer("");
     int resultCount = 0;
     int requestedGroups = grp.size();
 #endif
 
-    if(grp.empty())
+    // Same as for the msg metas: cache first, then the missing metas are read without holding mDbMutex.
+
+    bool loadAll = grp.empty();
+    std::vector<RsGxsGroupId> toLoad;
+    uint64_t generation;
+
     {
-        if(mUseCache && mGrpMetaDataCache.isCacheUpToDate())	// grab all the stash from the cache, so as to avoid decryption costs.
+        RS_STACK_MUTEX(mDbMutex);
+        generation = mWriteGeneration;
+
+        if(loadAll)
         {
+            if(mUseCache && mGrpMetaDataCache.isCacheUpToDate())	// grab all the stash from the cache, so as to avoid decryption costs.
+            {
 #ifdef RS_DATA_SERVICE_DEBUG_CACHE
-        std::cerr << (void*)this << ": RsDataService::retrieveGxsGrpMetaData() retrieving all from cache!" << std::endl;
+                std::cerr << (void*)this << ": RsDataService::retrieveGxsGrpMetaData() retrieving all from cache!" << std::endl;
 #endif
-
-			mGrpMetaDataCache.getFullMetaList(grp) ;
+                mGrpMetaDataCache.getFullMetaList(grp) ;
+                return 1;
+            }
         }
         else
-		{
+            for(auto mit(grp.begin()); mit != grp.end(); ++mit)
+            {
+                auto meta = mUseCache?mGrpMetaDataCache.getMeta(mit->first): (std::shared_ptr<RsGxsGrpMetaData>()) ;
+
+                if(meta)
+                    mit->second = meta;
+                else
+                    toLoad.push_back(mit->first);
+            }
+    }
+
+    std::map<RsGxsGroupId,std::shared_ptr<RsGxsGrpMetaData> > loaded;
+
+    if(loadAll || !toLoad.empty())
+    {
+        DbReadAccess db(*this);
+
+        if(loadAll)
+        {
 #ifdef RS_DATA_SERVICE_DEBUG
 			std::cerr << "RsDataService::retrieveGxsGrpMetaData() retrieving all" << std::endl;
 #endif
-			// clear the cache
-
-			RetroCursor* c = mDb->sqlQuery(GRP_TABLE_NAME, mGrpMetaColumns, "", "");
+			RetroCursor* c = db->sqlQuery(GRP_TABLE_NAME, mGrpMetaColumns, "", "");
 
             if(c)
-			{
-                locked_retrieveGrpMetaList(c,grp);
+                retrieveGrpMetaList(c,loaded);
 
-                if(mUseCache)
-                        mGrpMetaDataCache.setCacheUpToDate(true);
-			}
             delete c;
-#ifdef RS_DATA_SERVICE_DEBUG_TIME
-			resultCount += grp.size();
-#endif
-
-		}
-    }
-	else
-	{
-		for(auto mit(grp.begin()); mit != grp.end(); ++mit)
-		{
-            auto meta = mUseCache?mGrpMetaDataCache.getMeta(mit->first): (std::shared_ptr<RsGxsGrpMetaData>()) ;
-
-			if(meta)
-				mit->second = meta;
-			else
-			{
+        }
+        else
+            for(auto& grpId:toLoad)
+            {
 #ifdef RS_DATA_SERVICE_DEBUG_CACHE
-				std::cerr << mDbName << ": Retrieving Grp metadata grpId=" << mit->first ;
+				std::cerr << mDbName << ": Retrieving Grp metadata grpId=" << grpId << std::endl;
 #endif
-
-				const RsGxsGroupId& grpId = mit->first;
-				RetroCursor* c = mDb->sqlQuery(GRP_TABLE_NAME, mGrpMetaColumns, "grpId='" + grpId.toStdString() + "'", "");
+				RetroCursor* c = db->sqlQuery(GRP_TABLE_NAME, mGrpMetaColumns, "grpId='" + grpId.toStdString() + "'", "");
 
 				c->moveToFirst();
 
-                auto meta = locked_getGrpMeta(*c, 0);
+                auto meta = getGrpMeta(*c, 0);
 
                 if(meta)
-                {
-                    mit->second = meta;
+                    loaded[grpId] = meta;
 
-                    if(mUseCache)
-                        mGrpMetaDataCache.updateMeta(grpId,meta);
-                }
+                delete c;
+            }
+    }
 
-#ifdef RS_DATA_SERVICE_DEBUG_TIME
-				++resultCount;
-#endif
+    if(!loaded.empty() || loadAll)
+    {
+        RS_STACK_MUTEX(mDbMutex);
+        bool cacheable = mUseCache && generation == mWriteGeneration;
 
-                delete c;
+        for(auto& it:loaded)
+        {
+            if(cacheable)
+            {
+                auto cached = mGrpMetaDataCache.getMeta(it.first);
 
-#ifdef RS_DATA_SERVICE_DEBUG_CACHE
-				else
-				std::cerr << ". not found!" << std::endl;
-#endif
-			}
-		}
+                if(cached)
+                    it.second = cached;
+                else
+                    mGrpMetaDataCache.updateMeta(it.first,it.second);
+            }
+            grp[it.first] = it.second;
+        }
 
-	}
+        if(loadAll && cacheable)
+            mGrpMetaDataCache.setCacheUpToDate(true);
+    }
 
 #ifdef RS_DATA_SERVICE_DEBUG_TIME
+    resultCount = loaded.size();
     std::cerr << "RsDataService::retrieveGxsGrpMetaData() " << mDbName << ", Requests: " << requestedGroups << ", Results: " << resultCount << ", Time: " << timer.duration() << std::endl;
 #endif
 
@@ -1492,6 +1878,7 @@ int RsDataService::resetDataStore()
 
     {
         RsStackMutex stack(mDbMutex);
+        ++mWriteGeneration;
 
         mDb->execSQL("DROP INDEX " + MSG_INDEX_GRPID);
         mDb->execSQL("DROP TABLE " + DATABASE_RELEASE_TABLE_NAME);
@@ -1519,6 +1906,8 @@ int RsDataService::updateGroupMetaData(const GrpLocMetaData& meta)
     std::cerr << (void*)this << ": erasing old entry from cache." << std::endl;
 #endif
 
+    ++mWriteGeneration;
+
     if( mDb->sqlUpdate(GRP_TABLE_NAME,  KEY_GRP_ID+ "='" + grpId.toStdString() + "'", meta.val))
     {
         // If we use the cache, update the meta data immediately.
@@ -1529,10 +1918,8 @@ int RsDataService::updateGroupMetaData(const GrpLocMetaData& meta)
 
             c->moveToFirst();
 
-            // temporarily disable the cache so that we get the value from the DB itself.
-            mUseCache=false;
-            auto meta = locked_getGrpMeta(*c, 0);
-            mUseCache=true;
+            // get the value from the DB itself, not from the cache.
+            auto meta = getGrpMeta(*c, 0);
 
             if(meta)
                 mGrpMetaDataCache.updateMeta(grpId,meta);
@@ -1555,6 +1942,8 @@ int RsDataService::updateMessageMetaData(const MsgLocMetaData& metaData)
     const RsGxsGroupId& grpId = metaData.msgId.first;
     const RsGxsMessageId& msgId = metaData.msgId.second;
 
+    ++mWriteGeneration;
+
     if(mDb->sqlUpdate(MSG_TABLE_NAME,  KEY_GRP_ID+ "='" + grpId.toStdString() + "' AND " + KEY_MSG_ID + "='" + msgId.toStdString() + "'", metaData.val) )
     {
         // If we use the cache, update the meta data immediately.
@@ -1565,10 +1954,8 @@ int RsDataService::updateMessageMetaData(const MsgLocMetaData& metaData)
 
             c->moveToFirst();
 
-            // temporarily disable the cache so that we get the value from the DB itself.
-            mUseCache=false;
-            auto meta = locked_getMsgMeta(*c, 0);
-            mUseCache=true;
+            // get the value from the DB itself, not from the cache.
+            auto meta = getMsgMeta(*c, 0);
 
             if(meta)
                 mMsgMetaDataCache[grpId].updateMeta(msgId,meta);
@@ -1583,19 +1970,27 @@ int RsDataService::updateMessageMetaData(const MsgLocMetaData& metaData)
 
 int RsDataService::removeMsgs(const GxsMsgReq& msgIds)
 {
-    RsStackMutex stack(mDbMutex);
+    // Messages are removed in bounded transactions, and the mutex is released in between, so that removing
+    // a large number of messages doesn't block the other users of the database for the whole time.
 
-    GxsMsgReq::const_iterator mit = msgIds.begin();
-
-    for(; mit != msgIds.end(); ++mit)
+    for(auto mit = msgIds.begin(); mit != msgIds.end(); ++mit)
     {
         const std::set<RsGxsMessageId>& msgIdV = mit->second;
         const RsGxsGroupId& grpId = mit->first;
 
-        // delete messages
-        GxsMsgReq msgsToDelete;
-        msgsToDelete[grpId] = msgIdV;
-        locked_removeMessageEntries(msgsToDelete);
+        auto it = msgIdV.begin();
+
+        while(it != msgIdV.end())
+        {
+            GxsMsgReq msgsToDelete;
+            std::set<RsGxsMessageId>& batch(msgsToDelete[grpId]);
+
+            for(uint32_t n=0; n < MSG_REMOVAL_BATCH_SIZE && it != msgIdV.end(); ++n,++it)
+                batch.insert(*it);
+
+            RsStackMutex stack(mDbMutex);
+            locked_removeMessageEntries(msgsToDelete);
+        }
     }
 
     return 1;
@@ -1613,14 +2008,14 @@ int RsDataService::removeGroups(const std::vector<RsGxsGroupId> &grpIds)
 
 int RsDataService::retrieveGroupIds(std::vector<RsGxsGroupId> &grpIds)
 {
-    RsStackMutex stack(mDbMutex);
+    DbReadAccess db(*this);
 
 #ifdef RS_DATA_SERVICE_DEBUG_TIME
     rstime::RsScopeTimer timer("");
     int resultCount = 0;
 #endif
 
-    RetroCursor* c = mDb->sqlQuery(GRP_TABLE_NAME, mGrpIdColumn, "", "");
+    RetroCursor* c = db->sqlQuery(GRP_TABLE_NAME, mGrpIdColumn, "", "");
 
     if(c)
     {
@@ -1657,7 +2052,8 @@ int RsDataService::retrieveMsgIds(const RsGxsGroupId& grpId, RsGxsMessageId::std
     int resultCount = 0;
 #endif
 
-    RetroCursor* c = mDb->sqlQuery(MSG_TABLE_NAME, mMsgIdColumn, KEY_GRP_ID+ "='" + grpId.toStdString() + "'", "");
+    DbReadAccess db(*this);
+    RetroCursor* c = db->sqlQuery(MSG_TABLE_NAME, mMsgIdColumn, KEY_GRP_ID+ "='" + grpId.toStdString() + "'", "");
 
     if(c)
     {
@@ -1692,10 +2088,80 @@ int RsDataService::retrieveMsgIds(const RsGxsGroupId& grpId, RsGxsMessageId::std
 
 }
 
+int RsDataService::retrieveExpiredMsgIds(const RsGxsGroupId& grpId, rstime_t newer_than, rstime_t older_than, bool include_kept, uint32_t max_count, std::vector<std::pair<RsGxsMessageId,rstime_t> >& msgs)
+{
+    DbReadAccess db(*this);
+
+    // The (grpId,timeStamp) index gives the messages in publish time order, so that the query stops
+    // after max_count rows without looking at the recent messages of the group.
+
+    std::string selection = KEY_GRP_ID + "='" + grpId.toStdString() + "' AND " + KEY_TIME_STAMP + ">=" + std::to_string(newer_than)
+            + " AND " + KEY_TIME_STAMP + "<" + std::to_string(older_than);
+
+    if(!include_kept)
+        selection += " AND (" + KEY_MSG_STATUS + " & " + std::to_string(GXS_SERV::GXS_MSG_STATUS_KEEP_FOREVER) + ")=0"
+                   + " AND NOT EXISTS (SELECT 1 FROM " + MSG_TABLE_NAME + " AS kid WHERE kid." + KEY_MSG_PARENT_ID + "=" + MSG_TABLE_NAME + "." + KEY_MSG_ID + ")";
+
+    RetroCursor* c = db->sqlQuery(MSG_TABLE_NAME, mMsgExpiryColumns, selection, KEY_TIME_STAMP + " LIMIT " + std::to_string(max_count));
+
+    if(!c)
+        return 0;
+
+    bool valid = c->moveToFirst();
+
+    while(valid)
+    {
+        std::string msgId;
+        c->getString(mColMsgExpiry_MsgId, msgId);
+
+        msgs.push_back(std::make_pair(RsGxsMessageId(msgId),(rstime_t)c->getInt32(mColMsgExpiry_TimeStamp)));
+        valid = c->moveToNext();
+    }
+    delete c;
+
+    return 1;
+}
+
+int RsDataService::retrieveOldMsgVersionIds(const RsGxsGroupId& grpId, uint32_t max_count, std::vector<RsGxsMessageId>& msgIds)
+{
+    DbReadAccess db(*this);
+
+    // The first two conditions are the ones of the partial index, which only holds edited messages.
+    // Versions that were already removed are still referenced by the newer ones, hence the last condition.
+
+    std::list<std::string> columns;
+    columns.push_back("DISTINCT " + KEY_ORIG_MSG_ID);
+
+    std::string selection = KEY_GRP_ID + "='" + grpId.toStdString() + "'"
+            + " AND " + KEY_ORIG_MSG_ID + "!=" + KEY_MSG_ID
+            + " AND " + KEY_ORIG_MSG_ID + "!='" + RsGxsMessageId().toStdString() + "'"
+            + " AND EXISTS (SELECT 1 FROM " + MSG_TABLE_NAME + " AS old WHERE old." + KEY_MSG_ID + "=" + MSG_TABLE_NAME + "." + KEY_ORIG_MSG_ID + ")";
+
+    RetroCursor* c = db->sqlQuery(MSG_TABLE_NAME, columns, selection, KEY_ORIG_MSG_ID + " LIMIT " + std::to_string(max_count));
+
+    if(!c)
+        return 0;
+
+    bool valid = c->moveToFirst();
+
+    while(valid)
+    {
+        std::string msgId;
+        c->getString(0, msgId);
+
+        msgIds.push_back(RsGxsMessageId(msgId));
+        valid = c->moveToNext();
+    }
+    delete c;
+
+    return 1;
+}
+
 bool RsDataService::locked_removeMessageEntries(const GxsMsgReq& msgIds)
 {
     // start a transaction
     bool ret = mDb->beginTransaction();
+    ++mWriteGeneration;
 
     GxsMsgReq::const_iterator mit = msgIds.begin();
 
@@ -1703,14 +2169,28 @@ bool RsDataService::locked_removeMessageEntries(const GxsMsgReq& msgIds)
     {
         const RsGxsGroupId& grpId = mit->first;
         const std::set<RsGxsMessageId>& msgsV = mit->second;
-        auto& cache(mMsgMetaDataCache[grpId]);
+
+        if(msgsV.empty())
+            continue;
+
+        // One statement per group. The message ids are the primary key, so each of them is a single lookup. The group id
+        // is not part of the condition, otherwise sqlite may prefer to scan the whole group with the group index.
+
+        std::string ids;
 
         for(auto& msgId:msgsV)
-        {
-            mDb->sqlDelete(MSG_TABLE_NAME, KEY_GRP_ID+ "='" + grpId.toStdString() + "' AND " + KEY_MSG_ID + "='" + msgId.toStdString() + "'", "");
+            ids += (ids.empty()?"'":",'") + msgId.toStdString() + "'";
 
-            cache.clear(msgId);
-        }
+        ret &= mDb->sqlDelete(MSG_TABLE_NAME, KEY_MSG_ID + " IN (" + ids + ")", "");
+
+        // Only update the meta cache of groups that have one. Using operator[] here would create empty caches
+        // for all the groups that are cleaned up.
+
+        auto cit = mMsgMetaDataCache.find(grpId);
+
+        if(cit != mMsgMetaDataCache.end())
+            for(auto& msgId:msgsV)
+                cit->second.clear(msgId);
     }
 
     ret &= mDb->commitTransaction();
@@ -1722,6 +2202,7 @@ bool RsDataService::locked_removeGroupEntries(const std::vector<RsGxsGroupId>& g
 {
     // start a transaction
     bool ret = mDb->beginTransaction();
+    ++mWriteGeneration;
 
     for(auto grpId:grpIds)
     {
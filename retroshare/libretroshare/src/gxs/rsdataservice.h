@@ -22,6 +22,12 @@
 #ifndef RSDATASERVICE_H
 #define RSDATASERVICE_H
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include "gxs/rsgds.h"
 #include "util/retrodb.h"
 
@@ -127,12 +133,43 @@ private:
     bool mCache_ContainsAllMetas ;
 };
 
+/*!
+ * How a RsDataService stores its database. By default, a single connection
+ * with a rollback journal is used, and every access is serialised.
+ *
+ * With concurrent readers, the database uses write-ahead logging: the writes
+ * go through the main connection, while the retrieve*() calls run on a small
+ * pool of query only connections, which see the last committed state without
+ * waiting for the writes. The log is checkpointed by a background thread.
+ */
+struct RsDataServiceStorageOptions
+{
+    RsDataServiceStorageOptions()
+        : mConcurrentReaders(0), mCacheSizeKb(0), mMmapSize(0), mCheckpointInterval(2000) {}
+
+    /// The usual settings for concurrent readers
+    static RsDataServiceStorageOptions concurrent()
+    {
+        RsDataServiceStorageOptions o;
+        o.mConcurrentReaders = 2;
+        o.mCacheSizeKb = 16384;
+        o.mMmapSize = 256*1024*1024;
+        return o;
+    }
+
+    uint32_t mConcurrentReaders;    /// read only connections, 0 disables WAL and concurrent reads
+    uint32_t mCacheSizeKb;          /// page cache of each connection, 0 for the sqlite default
+    uint64_t mMmapSize;             /// bytes of the file read through memory mapping
+    uint32_t mCheckpointInterval;   /// ms between two checkpoints of the log
+};
+
 class RsDataService : public RsGeneralDataService
 {
 public:
 
     RsDataService(const std::string& serviceDir, const std::string& dbName, uint16_t serviceType,
-    		RsGxsSearchModule* mod = NULL, const std::string& key = "");
+    		RsGxsSearchModule* mod = NULL, const std::string& key = "",
+    		const RsDataServiceStorageOptions& storage = RsDataServiceStorageOptions());
     virtual ~RsDataService();
 
     /*!
@@ -198,6 +235,27 @@ public:
      */
     int retrieveMsgIds(const RsGxsGroupId& grpId, RsGxsMessageId::std_set& msgId) override;
 
+    /*!
+     * Retrieves the messages of a group published before a given time, oldest first
+     * @param grpId group of the messages
+     * @param newer_than only messages published at or after this time are retrieved
+     * @param older_than only messages published strictly before this time are retrieved
+     * @param include_kept also retrieve messages flagged as kept forever and messages that have replies
+     * @param max_count max number of messages retrieved
+     * @param msgs ids and publish times of the messages retrieved
+     * @return error code
+     */
+    int retrieveExpiredMsgIds(const RsGxsGroupId& grpId, rstime_t newer_than, rstime_t older_than, bool include_kept, uint32_t max_count, std::vector<std::pair<RsGxsMessageId,rstime_t> >& msgs) override;
+
+    /*!
+     * Retrieves the messages of a group that have been replaced by a newer version
+     * @param grpId group of the messages
+     * @param max_count max number of messages retrieved
+     * @param msgIds ids of the messages retrieved
+     * @return error code
+     */
+    int retrieveOldMsgVersionIds(const RsGxsGroupId& grpId, uint32_t max_count, std::vector<RsGxsMessageId>& msgIds) override;
+
     /*!
      * @return the cache size set for this RsGeneralDataService in bytes
      */
@@ -269,14 +327,38 @@ public:
 
     void debug_printCacheSize() ;
 
+    /*!
+     * @return true if the retrieve*() calls run on their own connections
+     */
+    bool hasConcurrentReaders() const { return !mReaders.empty(); }
+
 private:
 
+    /*!
+     * Gives access to a connection for running queries: one of the readers
+     * if there are some, otherwise the main connection, under mDbMutex.
+     */
+    class DbReadAccess;
+
+    struct DbReader
+    {
+        DbReader() : mMtx("RsDataService reader"), mDb(nullptr) {}
+
+        RsMutex mMtx;
+        RetroDb* mDb;
+    };
+
+    /*
+     * The methods below extract items from a cursor. They do not use the meta
+     * data caches, so they don't need mDbMutex.
+     */
+
     /*!
      * Retrieves all the msg results from a cursor
      * @param c cursor to result set
      * @param msgs messages retrieved from cursor are stored here
      */
-    void locked_retrieveMessages(RetroCursor* c, std::vector<RsNxsMsg*>& msgs, int metaOffset);
+    void retrieveMessages(RetroCursor* c, std::vector<RsNxsMsg*>& msgs, int metaOffset);
 
     /*!
      * Retrieves all the grp results from a cursor
@@ -284,45 +366,52 @@ private:
      * @param grps groups retrieved from cursor are stored here
      * @param withMeta this initialise the metaData member of the nxsgroups retrieved
      */
-    void locked_retrieveGroups(RetroCursor* c, std::vector<RsNxsGrp*>& grps, int metaOffset);
+    void retrieveGroups(RetroCursor* c, std::vector<RsNxsGrp*>& grps, int metaOffset);
 
     /*!
      * Retrieves all the msg meta results from a cursor
      * @param c cursor to result set
      * @param msgMeta message metadata retrieved from cursor are stored here
      */
-    void locked_retrieveMsgMetaList(RetroCursor* c, std::vector<std::shared_ptr<RsGxsMsgMetaData> > &msgMeta);
+    void retrieveMsgMetaList(RetroCursor* c, std::vector<std::shared_ptr<RsGxsMsgMetaData> > &msgMeta);
 
     /*!
      * Retrieves all the grp meta results from a cursor
      * @param c cursor to result set
      * @param grpMeta group metadata retrieved from cursor are stored here
      */
-    void locked_retrieveGrpMetaList(RetroCursor *c, std::map<RsGxsGroupId, std::shared_ptr<RsGxsGrpMetaData> > &grpMeta);
+    void retrieveGrpMetaList(RetroCursor *c, std::map<RsGxsGroupId, std::shared_ptr<RsGxsGrpMetaData> > &grpMeta);
 
     /*!
      * extracts a msg meta item from a cursor at its
      * current position
      */
-    std::shared_ptr<RsGxsMsgMetaData> locked_getMsgMeta(RetroCursor& c, int colOffset);
+    std::shared_ptr<RsGxsMsgMetaData> getMsgMeta(RetroCursor& c, int colOffset);
 
     /*!
      * extracts a grp meta item from a cursor at its
      * current position
      */
-    std::shared_ptr<RsGxsGrpMetaData> locked_getGrpMeta(RetroCursor& c, int colOffset);
+    std::shared_ptr<RsGxsGrpMetaData> getGrpMeta(RetroCursor& c, int colOffset);
 
     /*!
      * extracts a msg item from a cursor at its
      * current position
      */
-    RsNxsMsg* locked_getMessage(RetroCursor& c);
+    RsNxsMsg* getMessage(RetroCursor& c);
 
     /*!
      * extracts a grp item from a cursor at its
      * current position
      */
-    RsNxsGrp* locked_getGroup(RetroCursor& c);
+    RsNxsGrp* getGroup(RetroCursor& c);
+
+    /*!
+     * Opens the readers and starts the checkpoint thread
+     */
+    void openReaders(const std::string& key, const RsDataServiceStorageOptions& storage);
+    void closeReaders();
+    void checkpointLoop(const std::string& key, uint32_t interval);
 
     /*!
      * Creates an sql database and its associated file
@@ -362,6 +451,7 @@ private:
     std::list<std::string> mMsgMetaColumns;
     std::list<std::string> mMsgColumnsWithMeta;
     std::list<std::string> mMsgIdColumn;
+    std::list<std::string> mMsgExpiryColumns;
 
     std::list<std::string> mGrpColumns;
     std::list<std::string> mGrpMetaColumns;
@@ -388,7 +478,8 @@ private:
 
     // Message columns
     int mColMsg_GrpId;
-    int mColMsg_NxsData;
+    int mColMsg_RowId;
+    int mColMsg_NxsDataLen;
     int mColMsg_MetaData;
     int mColMsg_MsgId;
 
@@ -424,7 +515,8 @@ private:
 
     // Group columns
     int mColGrp_GrpId;
-    int mColGrp_NxsData;
+    int mColGrp_RowId;
+    int mColGrp_NxsDataLen;
     int mColGrp_MetaData;
 
     // Group columns with meta
@@ -436,12 +528,29 @@ private:
     // Msg id columns
     int mColMsgId_MsgId;
 
+    // Msg expiry columns
+    int mColMsgExpiry_MsgId;
+    int mColMsgExpiry_TimeStamp;
+
     std::string mServiceDir;
     std::string mDbName;
     std::string mDbPath;
     uint16_t mServType;
 
     RetroDb* mDb;
+
+    std::vector<std::unique_ptr<DbReader> > mReaders;
+    std::atomic<uint32_t> mNextReader;
+
+    std::thread mCheckpointThread;
+    std::mutex mCheckpointMtx;
+    std::condition_variable mCheckpointCond;
+    bool mCheckpointStop;
+
+    // Incremented by every write. Metas read from a reader are only put in
+    // the caches if nothing was written since the cache was looked up,
+    // otherwise they might be older than what the cache already holds.
+    uint64_t mWriteGeneration;
     
     // used to store metadata instead of reading it from the database.
     // The boolean variable below is also used to force re-reading when 
@@ -204,6 +204,28 @@ public:
      */
     virtual int retrieveMsgIds(const RsGxsGroupId& grpId, RsGxsMessageId::std_set& msgId) = 0;
 
+    /*!
+     * Retrieves the messages of a group published before a given time, oldest first. This is
+     * what the message clean up uses, so that expired messages never need to be loaded all at once.
+     * @param grpId group of the messages
+     * @param newer_than only messages published at or after this time are retrieved
+     * @param older_than only messages published strictly before this time are retrieved
+     * @param include_kept also retrieve messages flagged as GXS_MSG_STATUS_KEEP_FOREVER and messages that have replies
+     * @param max_count max number of messages retrieved
+     * @param msgs ids and publish times of the messages retrieved
+     * @return error code
+     */
+    virtual int retrieveExpiredMsgIds(const RsGxsGroupId& grpId, rstime_t newer_than, rstime_t older_than, bool include_kept, uint32_t max_count, std::vector<std::pair<RsGxsMessageId,rstime_t> >& msgs) = 0;
+
+    /*!
+     * Retrieves the messages of a group that have been replaced by a newer version.
+     * @param grpId group of the messages
+     * @param max_count max number of messages retrieved
+     * @param msgIds ids of the messages retrieved
+     * @return error code
+     */
+    virtual int retrieveOldMsgVersionIds(const RsGxsGroupId& grpId, uint32_t max_count, std::vector<RsGxsMessageId>& msgIds) = 0;
+
     /*!
      * @return the cache size set for this RsGeneralDataService in bytes
      */
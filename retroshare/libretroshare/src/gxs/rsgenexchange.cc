@@ -65,6 +65,7 @@ static const uint32_t INDEX_AUTHEN_PUBLISH      = 0x00000020; // publish key
 static const uint32_t INDEX_AUTHEN_ADMIN        = 0x00000040; // admin key
 
 static const uint32_t MSG_CLEANUP_PERIOD     = 60*59; // 59 minutes
+static const uint32_t MSG_CLEANUP_CHUNK_SIZE = 500;   // max number of messages deleted at each tick while cleaning up
 static const uint32_t INTEGRITY_CHECK_PERIOD = 60*31; // 31 minutes
 
 #define GXS_MASK "GXS_MASK_HACK"
@@ -295,12 +296,16 @@ void RsGenExchange::tick()
     // of identities. This is why idendities do their own cleaning.
     now = time(NULL);
 
-    if( (mNetService && (mNetService->msgAutoSync() || mNetService->grpAutoSync())) && (mLastClean + MSG_CLEANUP_PERIOD < now) )
+    // A cleanup round is made of several passes, each selecting a bounded number of messages. While the round is not
+    // finished, a new pass happens at each tick, once the messages selected by the previous one have been deleted by
+    // processMessageDelete().
+
+    if( (mNetService && (mNetService->msgAutoSync() || mNetService->grpAutoSync())) && (mCleaning || mLastClean + MSG_CLEANUP_PERIOD < now) )
 	{
         GxsMsgReq msgs_to_delete;
         std::vector<RsGxsGroupId> grps_to_delete;
 
-        RsGxsCleanUp(mDataStore,this,1).clean(mNextGroupToCheck,grps_to_delete,msgs_to_delete);	// no need to lock here, because all access below (RsGenExchange, RsDataStore) are properly mutexed
+        bool done = RsGxsCleanUp(mDataStore,this,MSG_CLEANUP_CHUNK_SIZE).clean(mNextMsgTsToCheck,grps_to_delete,msgs_to_delete);	// no need to lock here, because all access below (RsGenExchange, RsDataStore) are properly mutexed
 
         uint32_t token1=0;
         deleteMsgs(token1,msgs_to_delete);
@@ -312,7 +317,10 @@ void RsGenExchange::tick()
         }
 
         RS_STACK_MUTEX(mGenMtx) ;
-        mLastClean = now;
+        mCleaning = !done;
+
+        if(done)
+            mLastClean = now;
     }
 
 	if(mChecking || (mLastCheck + INTEGRITY_CHECK_PERIOD < now))
@@ -1708,6 +1716,9 @@ void RsGenExchange::receiveNewGroups(const std::vector<RsNxsGrp *> &groups)
 
 void RsGenExchange::receiveNewMessages(const std::vector<RsNxsMsg *>& messages)
 {
+	std::map<RsPeerId,std::set<RsGxsId> > authors ;
+
+	{
 	RS_STACK_MUTEX(mGenMtx) ;
 
 	// store these for tick() to pick them up
@@ -1730,6 +1741,22 @@ void RsGenExchange::receiveNewMessages(const std::vector<RsNxsMsg *>& messages)
 			id.first = msg->grpId;
 			id.second = msg->msgId;
 
+			// Deserialise the meta data now rather than in processRecvdMessages(), so that
+			// the keys of all the authors of the transaction can be asked for at once.
+
+			if(msg->metaData == NULL)
+			{
+				RsGxsMsgMetaData* meta = new RsGxsMsgMetaData();
+
+				if(msg->meta.bin_len != 0 && meta->deserialise(msg->meta.bin_data, &(msg->meta.bin_len)))
+					msg->metaData = meta;
+				else
+					delete meta;
+			}
+
+			if(mGixs && msg->metaData && !msg->metaData->mAuthorId.isNull() && mAuthorKeysPending.insert(msg->metaData->mAuthorId).second)
+				authors[msg->PeerId()].insert(msg->metaData->mAuthorId) ;
+
 			mMsgPendingValidate.insert(std::make_pair(msg->msgId,GxsPendingItem<RsNxsMsg*, RsGxsGrpMsgIdPair>(msg, id,time(NULL))));
 		}
 		else
@@ -1740,6 +1767,26 @@ void RsGenExchange::receiveNewMessages(const std::vector<RsNxsMsg *>& messages)
 			delete msg;
 		}
 	}
+	}
+
+	// The callback may be called right away when all keys are in cache, so the mutex must not be held here.
+
+	for(auto& it: authors)
+	{
+		std::set<RsGxsId> ids(it.second) ;
+
+		mGixs->prefetchKeys(ids, std::list<RsPeerId>(1,it.first),
+		                    RsIdentityUsage(RsServiceType(mServType),RsIdentityUsage::MESSAGE_AUTHOR_SIGNATURE_VALIDATION),
+		                    [this,ids](const std::set<RsGxsId>& /*missing_ids*/)
+		{
+			// Missing keys are requested again by validateMsg(), until VALIDATE_MAX_WAITING_TIME.
+
+			RS_STACK_MUTEX(mGenMtx) ;
+
+			for(auto& id: ids)
+				mAuthorKeysPending.erase(id) ;
+		});
+	}
 }
 
 void RsGenExchange::receiveDistantSearchResults(TurtleRequestId id,const RsGxsGroupId &/*grpId*/)
@@ -1955,6 +2002,11 @@ bool     RsGenExchange::getGroupNetworkStats(const RsGxsGroupId& grpId,RsGroupNe
 	return (!mNetService) || mNetService->getGroupNetworkStats(grpId,stats) ;
 }
 
+bool     RsGenExchange::getNetworkMutexHoldStats(std::vector<uint64_t>& counts,uint64_t& max_us,uint64_t& total_us)
+{
+	return mNetService && mNetService->getMutexHoldStats(counts,max_us,total_us) ;
+}
+
 void     RsGenExchange::setSyncPeriod(const RsGxsGroupId& grpId,uint32_t age_in_secs)
 {
 	if(mNetService != NULL)
@@ -2189,6 +2241,9 @@ void RsGenExchange::processGrpMetaChanges()
 
         mNotifications.push_back(new RsGxsGroupChange(RsGxsNotify::TYPE_PROCESSED,groupId, true));
     }
+
+    if(mNetService && !grpChanged.empty())
+        mNetService->notifyGroupsChanged(std::set<RsGxsGroupId>(grpChanged.begin(),grpChanged.end()));
 }
 
 bool RsGenExchange::processGrpMask(const RsGxsGroupId& grpId, ContentValue &grpCv)
@@ -2623,6 +2678,9 @@ void RsGenExchange::processGroupDelete()
 		mNotifications.push_back(gc);
 	}
 
+	if(mNetService && !grpDeleted.empty())
+		mNetService->notifyGroupsDeleted(std::set<RsGxsGroupId>(grpDeleted.begin(),grpDeleted.end()));
+
 	mGroupDeletePublish.clear();
 }
 
@@ -3058,6 +3116,7 @@ void RsGenExchange::computeHash(const RsTlvBinaryData& data, RsFileHash& hash)
 void RsGenExchange::processRecvdMessages()
 {
     std::list<RsGxsMessageId> messages_to_reject ;
+    std::set<RsGxsGroupId> stored_groups ;
 
     {
 	    RS_STACK_MUTEX(mGenMtx) ;
@@ -3105,7 +3164,8 @@ void RsGenExchange::processRecvdMessages()
 		    }
 		    else
 		    {
-                grpMetas.insert(std::make_pair(pend_it->second.mItem->grpId, std::make_shared<RsGxsGrpMetaData>()));
+				if(mAuthorKeysPending.find(msg->metaData->mAuthorId) == mAuthorKeysPending.end())
+					grpMetas.insert(std::make_pair(pend_it->second.mItem->grpId, std::make_shared<RsGxsGrpMetaData>()));
 			    ++pend_it;
 		    }
 	    }
@@ -3145,6 +3205,14 @@ void RsGenExchange::processRecvdMessages()
 #ifdef GEN_EXCH_DEBUG
 		    std::cerr << "    deserialised info: grp id=" << msg->grpId << ", msg id=" << msg->msgId ;
 #endif
+			// the author key is being loaded. No need to try before the identity service calls back.
+
+			if(mAuthorKeysPending.find(msg->metaData->mAuthorId) != mAuthorKeysPending.end())
+			{
+				++pend_it ;
+				continue ;
+			}
+
             auto mit = grpMetas.find(msg->grpId);
 
 #ifdef GEN_EXCH_DEBUG
@@ -3248,6 +3316,7 @@ void RsGenExchange::processRecvdMessages()
                 c->mNewMsgItem = item;
 
 				mNotifications.push_back(c);
+				stored_groups.insert(item->meta.mGroupId);
 			}
 
             mDataStore->storeMessage(msgs_to_store);	// All items will be destroyed later on, since msgs_to_store is a temporary map
@@ -3269,8 +3338,13 @@ void RsGenExchange::processRecvdMessages()
     // Done off-mutex to avoid cross deadlocks in the netservice that might call the RsGenExchange as an observer..
 
     if(mNetService != NULL)
+    {
 	    for(std::list<RsGxsMessageId>::const_iterator it(messages_to_reject.begin());it!=messages_to_reject.end();++it)
 		    mNetService->rejectMessage(*it) ;
+
+	    if(!stored_groups.empty())
+		    mNetService->notifyMessagesStored(stored_groups) ;
+    }
 }
 
 bool RsGenExchange::acceptNewGroup(const RsGxsGrpMetaData* /*grpMeta*/ ) { return true; }
@@ -3400,6 +3474,8 @@ void RsGenExchange::processRecvdGroups()
 
 	if(!grps_to_store.empty())
 	{
+		std::set<RsGxsGroupId> stored_groups;
+
         for(auto Grp:grps_to_store)
 		{
 			RsGxsGroupChange* c = new RsGxsGroupChange(RsGxsNotify::TYPE_RECEIVED_NEW, Grp->grpId, false);
@@ -3407,9 +3483,13 @@ void RsGenExchange::processRecvdGroups()
             c->mNewGroupItem = dynamic_cast<RsGxsGrpItem*>(mSerialiser->deserialise(Grp->grp.bin_data,&Grp->grp.bin_len));
 
 			mNotifications.push_back(c);
+			stored_groups.insert(Grp->grpId);
 		}
 
         mDataStore->storeGroup(grps_to_store);  // deletes the data after storing it.
+
+		if(mNetService)
+			mNetService->notifyGroupsChanged(stored_groups);
 #ifdef GEN_EXCH_DEBUG
         std::cerr << "  adding the following grp ids to notification: " << std::endl;
         for(std::list<RsGxsGroupId>::const_iterator it(grpIds.begin());it!=grpIds.end();++it)
@@ -3512,8 +3592,16 @@ void RsGenExchange::performUpdateValidation()
 		}
 	}
 
+    std::set<RsGxsGroupId> updated_groups;
+
+    for(auto grp:grps)
+        updated_groups.insert(grp->grpId);
+
     mDataStore->updateGroup(grps);
 
+    if(mNetService && !updated_groups.empty())
+        mNetService->notifyGroupsChanged(updated_groups);
+
 #ifdef GEN_EXCH_DEBUG
 	std::cerr << "  adding the following grp ids to notification: " << std::endl;
 #endif
@@ -762,6 +762,7 @@ public:
     virtual uint32_t getSyncPeriod(const RsGxsGroupId& grpId) override;
     virtual void     setSyncPeriod(const RsGxsGroupId& grpId,uint32_t age_in_secs) override;
     virtual bool     getGroupNetworkStats(const RsGxsGroupId& grpId,RsGroupNetworkStats& stats);
+    virtual bool     getNetworkMutexHoldStats(std::vector<uint64_t>& counts,uint64_t& max_us,uint64_t& total_us);
 
     uint16_t serviceType() const override { return mServType ; }
     uint32_t serviceFullType() const { return RsServiceInfo::RsServiceInfoUIn16ToFullServiceId(mServType); }
@@ -983,13 +984,17 @@ private:
     typedef std::map<RsGxsMessageId,GxsPendingItem<RsNxsMsg*, RsGxsGrpMsgIdPair> > NxsMsgPendingVect;
     NxsMsgPendingVect mMsgPendingValidate;
 
+    /// Authors of received messages whose keys are being prefetched. Their
+    /// messages are not validated until the identity service calls back.
+    std::set<RsGxsId> mAuthorKeysPending;
+
     bool mCleaning;
     rstime_t mLastClean;
 
     bool mChecking, mCheckStarted;
     rstime_t mLastCheck;
     RsGxsIntegrityCheck* mIntegrityCheck;
-    RsGxsGroupId mNextGroupToCheck ;
+    std::map<RsGxsGroupId,rstime_t> mNextMsgTsToCheck ;
 
 protected:
 	enum CreateStatus { CREATE_FAIL, CREATE_SUCCESS, CREATE_FAIL_TRY_LATER };
@@ -29,6 +29,10 @@
 
 #include "serialiser/rstlvkeys.h"
 #include "retroshare/rsids.h"
+
+#include <functional>
+#include <set>
+
 /*!
  * GIXP: General Identity Exchange Service.
  *
@@ -155,6 +159,18 @@ public:
     virtual bool requestKey(const RsGxsId &id, const std::list<RsPeerId> &peers,const RsIdentityUsage& info) = 0;
     virtual bool requestPrivateKey(const RsGxsId &id) = 0;
 
+    /*!
+     * Requests a batch of keys at once, typically all the authors of an incoming transaction. Keys that are
+     * not in cache are loaded with a single database request, and the ones that are not in the database either
+     * are requested from the given peers.
+     * The callback is called once, when all keys are in cache or when the ones still missing have been given
+     * up, with the list of these missing keys. It is called off-mutex from the identity service thread, or
+     * directly from this method when no key needs to be loaded. It may be empty.
+     * @return the number of keys that are being loaded
+     */
+    virtual uint32_t prefetchKeys(const std::set<RsGxsId>& ids, const std::list<RsPeerId>& peers, const RsIdentityUsage& info,
+                                  const std::function<void(const std::set<RsGxsId>& missing_ids)>& callback) = 0;
+
     /*!
      * \brief receiveNewIdentity
      * 			Receives a new identity. This is a facility offerred to RsGxsNetService when identities are sent/received by turtle tunnels
@@ -50,7 +50,7 @@
 //    |                                                                    |
 //    |                       (Only send if rand() < sendingProb())        +---comes from mClientMsgUpdateMap
 //    |
-//    +----------- recvNxsItemQueue()
+//    +----------- recvNxsItemQueue()     (actually called from threadTick(), which incomingItemsQueued() wakes up)
 //                   |
 //                   +------ handleRecvPublishKeys(auto*)
 //                   |
@@ -148,7 +148,7 @@
 //          CLient                                                                                                   Server
 //          ======                                                                                                   ======
 //
-//    tick()                                                                                                    tick()
+//    tick()                                                                                                    threadTick()
 //      |                                                                                                         |
 //      +---- checkUpdatesFromPeers()                                                                             +-- recvNxsItemQueue()
 //                 |                                                                                                   |
@@ -245,6 +245,7 @@
 #include <math.h>
 #include <sstream>
 #include <typeinfo>
+#include <chrono>
 
 #include "rsgxsnetservice.h"
 #include "gxssecurity.h"
@@ -309,6 +310,11 @@ static const uint32_t GROUP_STATS_UPDATE_NB_PEERS             =            2; //
 static const uint32_t MAX_ALLOWED_GXS_MESSAGE_SIZE            =       199000; // 200,000 bytes including signature and headers
 static const uint32_t MIN_DELAY_BETWEEN_GROUP_SEARCH          =           40; // dont search same group more than every 40 secs.
 static const uint32_t SAFETY_DELAY_FOR_UNSUCCESSFUL_UPDATE    =            0; // avoid re-sending the same msg list to a peer who asks twice for the same update in less than this time
+static const uint32_t SERVER_SYNC_TS_UPDATE_DELAY             =           60; // check of the circles our subscribed groups are restricted to
+static const uint32_t FULL_SERVER_SYNC_TS_CHECK_DELAY         =      6*3600; // full re-computation of the server side update TS. These are otherwise maintained incrementally
+static const uint32_t RELAY_PULL_MIN_DELAY                    =            5; // min delay between two pull requests sent because new messages were stored
+static const uint32_t NET_THREAD_IDLE_DELAY_MS                =         1000; // max sleep of the net thread when no work is queued. Only matters for transaction timeouts.
+static const uint32_t NET_THREAD_VETTING_POLL_MS              =          100; // sleep of the net thread while circle/author vetting is waiting for data
 
 static const uint32_t RS_NXS_ITEM_ENCRYPTION_STATUS_UNKNOWN             = 0x00 ;
 static const uint32_t RS_NXS_ITEM_ENCRYPTION_STATUS_NO_ERROR            = 0x01 ;
@@ -376,6 +382,8 @@ RsGxsNetService::RsGxsNetService(uint16_t servType, RsGeneralDataService *gds,
                                    mNetMgr(netMgr), mNxsMutex("RsGxsNetService"),
                                    mSyncTs(0), mLastKeyPublishTs(0),
                                    mLastCleanRejectedMessages(0), mSYNC_PERIOD(SYNC_PERIOD),
+                                   mLastServerSyncTSUpdate(0), mLastFullServerSyncTSCheck(0), mLastDebugDump(0),
+                                   mWorkPending(true), mRelayPullPending(false), mLastRelayPullTs(0),
                                    mCircles(circles), mGixs(gixs),
                                    mReputations(reputations), mPgpUtils(pgpUtils), mGxsNetTunnel(mGxsNT),
                                    mSyncFlags(sync_flags),
@@ -384,7 +392,7 @@ RsGxsNetService::RsGxsNetService(uint16_t servType, RsGeneralDataService *gds,
 {
 	addSerialType(new RsNxsSerialiser(mServType));
 	mOwnId = mNetMgr->getOwnId();
-    mUpdateCounter = 0;
+	mNxsMutex.trackHoldTime(&mNxsMutexHoldStats);
 
 	mLastCacheReloadTS = 0;
 
@@ -434,9 +442,11 @@ RsGxsNetService::~RsGxsNetService()
 
 int RsGxsNetService::tick()
 {
-	// always check for new items arriving
-	// from peers
-	recvNxsItemQueue();
+	// Incoming items are handled by the net service thread, which is woken up by incomingItemsQueued().
+	// Distant data has no such hook, so it is polled from here.
+
+	if(!!(mSyncFlags & RsGxsNetServiceSyncFlags::DISTANT_SYNC) && mGxsNetTunnel != NULL && mGxsNetTunnel->hasIncomingData(mServType))
+		wakeUp();
 
     bool should_notify = false;
 
@@ -450,8 +460,10 @@ int RsGxsNetService::tick()
         should_notify = should_notify || !mNewGrpSyncParamsToNotify.empty() ;
     }
 
+    // Observer callbacks only run on the net service thread, so that they never run concurrently.
+
     if(should_notify)
-        processObserverNotifications() ;
+        wakeUp() ;
 
     rstime_t now = time(NULL);
     rstime_t elapsed = mSYNC_PERIOD + mSyncTs;
@@ -1045,6 +1057,12 @@ void RsGxsNetService::locked_resetClientTS(const RsGxsGroupId& grpId)
 void RsGxsNetService::subscribeStatusChanged(
         const RsGxsGroupId& grpId, bool subscribed )
 {
+	{
+		std::lock_guard<std::mutex> lock(mWorkMtx);
+		mGroupsToRefresh[grpId] = subscribed?GROUP_REFRESH_SUBSCRIBED:GROUP_REFRESH_UNSUBSCRIBED;
+	}
+	wakeUp();
+
 	if(!subscribed) return;
 
     // When we subscribe, we reset the time stamps, so that the entire group list
@@ -2008,37 +2026,120 @@ bool RsGxsNetService::locked_processTransac(RsNxsTransacItem *item)
         return false;
 }
 
+void RsGxsNetService::wakeUp()
+{
+	{
+		std::lock_guard<std::mutex> lock(mWorkMtx);
+		mWorkPending = true;
+	}
+	mWorkCond.notify_one();
+}
+
 void RsGxsNetService::threadTick()
 {
-    static const double timeDelta = 0.5;
+	// Each transaction step (start, receive, confirm, response) sends an item to the peer and
+	// waits for its answer, so the thread sleeps until some work is queued rather than for a
+	// fixed delay, which would be paid once per step and per hop. Vetting has no callback when
+	// the circle/identity data it waits for is loaded, so it is polled with a short delay.
 
-        //Start waiting as nothing to do in runup
-        rstime::rs_usleep((int) (timeDelta * 1000 * 1000)); // timeDelta sec
+	bool vetting_pending;
+	{
+		RS_STACK_MUTEX(mNxsMutex) ;
+		vetting_pending = !mPendingResp.empty() || !mPendingCircleVets.empty();
+	}
 
-        if(mUpdateCounter >= 120) // 60 seconds
-        {
-            updateServerSyncTS();
+	{
+		std::unique_lock<std::mutex> lock(mWorkMtx);
+
+		mWorkCond.wait_for(lock,
+		                   std::chrono::milliseconds(vetting_pending?NET_THREAD_VETTING_POLL_MS:NET_THREAD_IDLE_DELAY_MS),
+		                   [this]() { return mWorkPending || shouldStop(); });
+		mWorkPending = false;
+	}
+
+	if(shouldStop())
+		return;
+
+	recvNxsItemQueue();
+
+	rstime_t now = time(NULL);
+
+	if(now >= mLastFullServerSyncTSCheck + FULL_SERVER_SYNC_TS_CHECK_DELAY)
+	{
+		updateServerSyncTS();
 #ifdef TO_REMOVE
-            updateClientSyncTS();
+		updateClientSyncTS();
 #endif
-            mUpdateCounter = 1;
-        }
-        else
-            mUpdateCounter++;
+		mLastFullServerSyncTSCheck = now;
+		mLastServerSyncTSUpdate = now;
+	}
+	else if(now >= mLastServerSyncTSUpdate + SERVER_SYNC_TS_UPDATE_DELAY)
+	{
+		updateCircleServerTS();
+		mLastServerSyncTSUpdate = now;
+	}
+
+	processGroupServerTSUpdates();
+
+	if(now >= mLastDebugDump + 20)	// dump the full shit every 20 secs
+	{
+		debugDump() ;
+		mLastDebugDump = now;
+	}
+
+	// vetting of id and circle info. Done first so that the transactions it creates are sent right away.
+	runVetting();
+
+	processExplicitGroupRequests();
+
+	// process active transactions
+	bool progress = processTransactions();
+
+	// process completed transactions
+	progress = processCompletedTransactions() || progress;
 
-        if(mUpdateCounter % 20 == 0)	// dump the full shit every 20 secs
-            debugDump() ;
+	processRelayPull();
 
-        // process active transactions
-        processTransactions();
+	processObserverNotifications();
 
-        // process completed transactions
-        processCompletedTransactions();
+	// A transaction that moved one step may be able to move another one right away.
 
-        // vetting of id and circle info
-        runVetting();
+	if(progress)
+		wakeUp();
+}
+
+void RsGxsNetService::notifyMessagesStored(const std::set<RsGxsGroupId>& grpIds)
+{
+	if(grpIds.empty())
+		return;
+
+	{
+		RS_STACK_MUTEX(mNxsMutex) ;
+		mRelayPullPending = true;
+	}
+	wakeUp();
+}
+
+void RsGxsNetService::processRelayPull()
+{
+	// The server TS of a group is stamped when its messages are received, which is before the
+	// observer has stored them. A friend that syncs in between records the new TS and does not
+	// ask again until its next periodic sync, so once the messages are stored we ask friends to
+	// sync right away. Pull requests are rate limited, and deferred rather than dropped.
+
+	{
+		RS_STACK_MUTEX(mNxsMutex) ;
+
+		rstime_t now = time(NULL);
 
-        processExplicitGroupRequests();
+		if(!mRelayPullPending || now < mLastRelayPullTs + RELAY_PULL_MIN_DELAY)
+			return;
+
+		mRelayPullPending = false;
+		mLastRelayPullTs = now;
+	}
+
+	requestPull();
 }
 
 void RsGxsNetService::debugDump()
@@ -2049,6 +2150,13 @@ void RsGxsNetService::debugDump()
 
     GXSNETDEBUG___<< "RsGxsNetService::debugDump():" << std::endl;
 
+    {
+        std::ostream& out(GXSNETDEBUG___);
+        out << "  mNxsMutex hold times: " ;
+        mNxsMutexHoldStats.print(out) ;
+        out << std::endl;
+    }
+
     RsGxsGrpMetaTemporaryMap grpMetas;
 
     if(!group_id_to_print.isNull())
@@ -2136,10 +2244,19 @@ void RsGxsNetService::updateServerSyncTS()
     	GXSNETDEBUG___<< "updateServerSyncTS(): updating last modification time stamp of local data." << std::endl;
 #endif
 
+	// The database is read without holding mNxsMutex: with thousands of groups this takes long enough to
+	// stall the sync of every other service. Groups stored in the meantime are notified separately.
+
+	rstime_t scan_start = time(NULL);
+	mDataStore->retrieveGxsGrpMetaData(gxsMap);
+
+	bool change = false;
+#ifdef NXS_NET_DEBUG_0
+	uint32_t nb_fixed = 0;
+#endif
+
 	{
 		RS_STACK_MUTEX(mNxsMutex) ;
-		// retrieve all grps and update TS
-        mDataStore->retrieveGxsGrpMetaData(gxsMap);
 
 		// (cyril) This code was previously removed because it sounded inconsistent: the list of grps normally does not need to be updated when
 		// new posts arrive. The two (grp list and msg list) are handled independently. Still, when group meta data updates are received,
@@ -2147,19 +2264,21 @@ void RsGxsNetService::updateServerSyncTS()
 		// if needed.
 
 		// as a grp list server also note this is the latest item you have
-		// then remove from mServerMsgUpdateMap, all items that are not in the group list!
+		// then remove from mServerMsgUpdateMap, all items that are not in the group list! Entries stamped after the
+		// scan started may belong to groups stored in the meantime, so they are kept.
 
 #ifdef NXS_NET_DEBUG_0
 		GXSNETDEBUG___ << "  cleaning server map of groups with no data:" << std::endl;
 #endif
 
 		for(ServerMsgMap::iterator it(mServerMsgUpdateMap.begin());it!=mServerMsgUpdateMap.end();)
-			if(gxsMap.find(it->first) == gxsMap.end())
+			if(gxsMap.find(it->first) == gxsMap.end() && it->second.msgUpdateTS < scan_start)
 			{
 				// not found! Removing server update info for this group
 
 #ifdef NXS_NET_DEBUG_0
 				GXSNETDEBUG__G(it->first) << "    removing server update info for group " << it->first << std::endl;
+				++nb_fixed;
 #endif
 				ServerMsgMap::iterator tmp(it) ;
 				++tmp ;
@@ -2168,108 +2287,191 @@ void RsGxsNetService::updateServerSyncTS()
 			}
 			else
 				++it;
-	}
 
 #ifdef NXS_NET_DEBUG_0
-    	if(gxsMap.empty())
-            GXSNETDEBUG___<< "  database seems to be empty. The modification timestamp will be reset." << std::endl;
+		if(gxsMap.empty())
+			GXSNETDEBUG___<< "  database seems to be empty. The modification timestamp will be reset." << std::endl;
 #endif
-    	// finally, update timestamps.
-	bool change = false;
+		std::map<RsGxsGroupId,RsGxsCircleId> circle_groups;
 
-	for(auto mit = gxsMap.begin();mit != gxsMap.end(); ++mit)
-	{
-        	// Check if the group is subscribed and restricted to a circle. If the circle has changed, update the
-        	// global TS to reflect that change to clients who may be able to see/subscribe to that particular group.
+		for(auto mit = gxsMap.begin();mit != gxsMap.end(); ++mit)
+		{
+			const auto& grpMeta = mit->second;
 
-        	if( (mit->second->mSubscribeFlags & GXS_SERV::GROUP_SUBSCRIBE_SUBSCRIBED) && !mit->second->mCircleId.isNull())
-	    	{
-                	// ask to the GxsNetService of circles what the server TS is for that circle. If more recent, we update the serverTS of the
-                	// local group
+			// Subscribed groups restricted to a circle follow the changes in that circle. See updateCircleServerTS().
 
-                        rstime_t circle_group_server_ts ;
-                        rstime_t circle_msg_server_ts ;
+			if( (grpMeta->mSubscribeFlags & GXS_SERV::GROUP_SUBSCRIBE_SUBSCRIBED) && !grpMeta->mCircleId.isNull())
+				circle_groups[mit->first] = grpMeta->mCircleId;
 
-                        // This call needs to be off-mutex, because of self-restricted circles.
-                        // Normally we should update as a function of MsgServerUpdateTS and the mRecvTS of the circle, not the global grpServerTS.
-                        // But grpServerTS is easier to get since it does not require a db access. So we trade the real call for this cheap and conservative call.
+			// This is needed for group metadata updates to actually propagate: only a new grpUpdateTS will trigger the exchange of groups mPublishTs which
+			// will then be compared and pssibly trigger a MetaData transmission. mRecvTS is upated when creating, receiving for the first time, or receiving
+			// an update, all in rsgenexchange.cc, after group/update validation. It is therefore a local TS, that can be compared to grpUpdateTS (same machine).
 
-                        if(mCircles->getLocalCircleServerUpdateTS(mit->second->mCircleId,circle_group_server_ts,circle_msg_server_ts))
-                        {
+			if(mGrpServerUpdate.grpUpdateTS < grpMeta->mRecvTS)
+			{
 #ifdef NXS_NET_DEBUG_0
-                            GXSNETDEBUG__G(mit->first) << "  Group " << mit->first << " is conditionned to circle " << mit->second->mCircleId << ". local Grp TS=" << time(NULL) - mGrpServerUpdate.grpUpdateTS << " secs ago, circle grp server update TS=" << time(NULL) - circle_group_server_ts << " secs ago";
+				GXSNETDEBUG__G(grpMeta->mGroupId) << "  updated msgUpdateTS to last RecvTS = " << time(NULL) - grpMeta->mRecvTS << " secs ago for group "<< grpMeta->mGroupId << ". This is probably because an update has been received." << std::endl;
+				++nb_fixed;
 #endif
-                            // We use a max here between grp and msg TS because membership is driven by invite list (grp data) crossed with
-                            // membership requests messages (msg data).
-
-                            auto circle_membership_ts = std::max(circle_group_server_ts,circle_msg_server_ts);
+				mGrpServerUpdate.grpUpdateTS = grpMeta->mRecvTS;
+				change = true;
+			}
+		}
 
-                            if(circle_membership_ts > mGrpServerUpdate.grpUpdateTS)
-							{
 #ifdef NXS_NET_DEBUG_0
-								GXSNETDEBUG__G(mit->first) << " - Updating local Grp Server update TS to follow changes in circles." << std::endl;
+		if(circle_groups != mSubscribedCircleGroups)
+			++nb_fixed;
 #endif
+		mSubscribedCircleGroups.swap(circle_groups);
+	}
 
-								RS_STACK_MUTEX(mNxsMutex) ;
-                                mGrpServerUpdate.grpUpdateTS = circle_membership_ts ;
-							}
 #ifdef NXS_NET_DEBUG_0
-                            else
-                                GXSNETDEBUG__G(mit->first) << " - Nothing to do." << std::endl;
+	GXSNETDEBUG___<< "  full scan of " << gxsMap.size() << " groups fixed " << nb_fixed << " entries." << std::endl;
 #endif
-                        }
-                        else
-                            std::cerr << "(EE) Cannot retrieve attached circle TS" << std::endl;
-            	}
 
+	updateCircleServerTS();
+
+	// actual change in config settings, then save configuration
+	if(change)
+		IndicateConfigChanged();
+}
+
+void RsGxsNetService::updateCircleServerTS()
+{
+	std::set<RsGxsCircleId> circles;
+	{
 		RS_STACK_MUTEX(mNxsMutex) ;
 
-        const auto& grpMeta = mit->second;
-#ifdef TO_REMOVE
-		// That accounts for modification of the meta data.
+		for(auto& it:mSubscribedCircleGroups)
+			circles.insert(it.second);
+	}
+
+	if(circles.empty() || mCircles == NULL)
+		return;
+
+	rstime_t circle_membership_ts = 0;
+
+	for(auto& circle_id:circles)
+	{
+		// ask to the GxsNetService of circles what the server TS is for that circle. If more recent, we update the serverTS of the
+		// local group
+
+		rstime_t circle_group_server_ts ;
+		rstime_t circle_msg_server_ts ;
 
-		if(mGrpServerUpdateItem->grpUpdateTS < grpMeta->mPublishTs)
+		// This call needs to be off-mutex, because of self-restricted circles.
+		// Normally we should update as a function of MsgServerUpdateTS and the mRecvTS of the circle, not the global grpServerTS.
+		// But grpServerTS is easier to get since it does not require a db access. So we trade the real call for this cheap and conservative call.
+
+		if(mCircles->getLocalCircleServerUpdateTS(circle_id,circle_group_server_ts,circle_msg_server_ts))
 		{
-#ifdef NXS_NET_DEBUG_0
-			GXSNETDEBUG__G(grpId) << "  publish time stamp of group " << grpId << " has changed to " << time(NULL)-grpMeta->mPublishTs << " secs ago. updating!" << std::endl;
-#endif
-			mGrpServerUpdateItem->grpUpdateTS = grpMeta->mPublishTs;
+			// We use a max here between grp and msg TS because membership is driven by invite list (grp data) crossed with
+			// membership requests messages (msg data).
+
+			circle_membership_ts = std::max(circle_membership_ts,std::max(circle_group_server_ts,circle_msg_server_ts));
 		}
-#endif
+		else
+			std::cerr << "(EE) Cannot retrieve attached circle TS" << std::endl;
+	}
 
-        // I keep the creation, but the data is not used yet.
-#warning csoler 2016-12-12: Disabled this, but do we need it?
-		// RsGxsServerMsgUpdate& msui(mServerMsgUpdateMap[grpId]) ;
+	RS_STACK_MUTEX(mNxsMutex) ;
 
-        // (cyril) I'm removing this, because the msgUpdateTS is updated when new messages are received by calling locked_stampMsgServerUpdateTS().
-        //       mLastPost is actually updated somewhere when loading group meta data. It's not clear yet whether it is set to the latest publish time (wrong)
-        //		 or the latest receive time (right). The former would cause problems because it would need to compare times coming from different (potentially async-ed)
-        //		 machines.
-        //
-        // if(grpMeta->mLastPost > msui->msgUpdateTS )
-        // {
-        // 	change = true;
-        // 	msui->msgUpdateTS = grpMeta->mLastPost;
+	if(circle_membership_ts > mGrpServerUpdate.grpUpdateTS)
+	{
 #ifdef NXS_NET_DEBUG_0
-        // 	GXSNETDEBUG__G(grpId) << "  updated msgUpdateTS to last post = " << time(NULL) - grpMeta->mLastPost << " secs ago for group "<< grpId << std::endl;
+		GXSNETDEBUG___ << "  Updating local Grp Server update TS to follow changes in circles." << std::endl;
 #endif
-        // }
+		mGrpServerUpdate.grpUpdateTS = circle_membership_ts ;
+	}
+}
+
+void RsGxsNetService::notifyGroupsChanged(const std::set<RsGxsGroupId>& grpIds)
+{
+	{
+		std::lock_guard<std::mutex> lock(mWorkMtx);
+
+		for(auto& grpId:grpIds)
+			mGroupsToRefresh.insert(std::make_pair(grpId,GROUP_REFRESH_FROM_META));	// keeps a pending subscription change
+	}
+	wakeUp();
+}
+
+void RsGxsNetService::notifyGroupsDeleted(const std::set<RsGxsGroupId>& grpIds)
+{
+	{
+		std::lock_guard<std::mutex> lock(mWorkMtx);
+
+		for(auto& grpId:grpIds)
+			mGroupsToRefresh[grpId] = GROUP_REFRESH_DELETED;
+	}
+	wakeUp();
+}
 
-		// This is needed for group metadata updates to actually propagate: only a new grpUpdateTS will trigger the exchange of groups mPublishTs which
-		// will then be compared and pssibly trigger a MetaData transmission. mRecvTS is upated when creating, receiving for the first time, or receiving
-		// an update, all in rsgenexchange.cc, after group/update validation. It is therefore a local TS, that can be compared to grpUpdateTS (same machine).
+void RsGxsNetService::processGroupServerTSUpdates()
+{
+	std::map<RsGxsGroupId,GroupRefresh> to_refresh;
+	{
+		std::lock_guard<std::mutex> lock(mWorkMtx);
+		to_refresh.swap(mGroupsToRefresh);
+	}
+
+	if(to_refresh.empty())
+		return;
+
+	RsGxsGrpMetaTemporaryMap grpMetas;
+
+	for(auto& it:to_refresh)
+		if(it.second != GROUP_REFRESH_DELETED)
+			grpMetas[it.first] = nullptr;
+
+	if(!grpMetas.empty())
+		mDataStore->retrieveGxsGrpMetaData(grpMetas);
+
+	bool change = false;
+	{
+		RS_STACK_MUTEX(mNxsMutex) ;
 
-		if(mGrpServerUpdate.grpUpdateTS < grpMeta->mRecvTS)
+		for(auto& it:to_refresh)
 		{
+			const RsGxsGroupId& grpId(it.first);
+
+			auto mit = grpMetas.find(grpId);
+
+			if(it.second == GROUP_REFRESH_DELETED || mit == grpMetas.end() || !mit->second)
+			{
 #ifdef NXS_NET_DEBUG_0
-			GXSNETDEBUG__G(grpMeta->mGroupId) << "  updated msgUpdateTS to last RecvTS = " << time(NULL) - grpMeta->mRecvTS << " secs ago for group "<< grpMeta->mGroupId << ". This is probably because an update has been received." << std::endl;
+				GXSNETDEBUG__G(grpId) << "  removing server update info for deleted group " << grpId << std::endl;
 #endif
-			mGrpServerUpdate.grpUpdateTS = grpMeta->mRecvTS;
-			change = true;
+				if(it.second == GROUP_REFRESH_DELETED)
+					mServerMsgUpdateMap.erase(grpId);
+
+				mSubscribedCircleGroups.erase(grpId);
+				continue;
+			}
+
+			const auto& grpMeta = mit->second;
+
+			// Subscription changes are notified before the new flags reach the database, so the flags given in
+			// the notification take precedence.
+
+			bool subscribed = (it.second == GROUP_REFRESH_SUBSCRIBED)
+			        || (it.second == GROUP_REFRESH_FROM_META && (grpMeta->mSubscribeFlags & GXS_SERV::GROUP_SUBSCRIBE_SUBSCRIBED));
+
+			if(subscribed && !grpMeta->mCircleId.isNull())
+				mSubscribedCircleGroups[grpId] = grpMeta->mCircleId;
+			else
+				mSubscribedCircleGroups.erase(grpId);
+
+			// same as in updateServerSyncTS()
+
+			if(mGrpServerUpdate.grpUpdateTS < grpMeta->mRecvTS)
+			{
+				mGrpServerUpdate.grpUpdateTS = grpMeta->mRecvTS;
+				change = true;
+			}
 		}
 	}
 
-	// actual change in config settings, then save configuration
 	if(change)
 		IndicateConfigChanged();
 }
@@ -2279,9 +2481,10 @@ bool RsGxsNetService::locked_checkTransacTimedOut(NxsTransaction* tr)
    return tr->mTimeOut < ((uint32_t) time(NULL));
 }
 
-void RsGxsNetService::processTransactions()
+bool RsGxsNetService::processTransactions()
 {
     RS_STACK_MUTEX(mNxsMutex) ;
+    bool progress = false;
 
     for(TransactionsPeerMap::iterator mit = mTransactions.begin();mit != mTransactions.end(); ++mit)
     {
@@ -2354,6 +2557,7 @@ void RsGxsNetService::processTransactions()
 
                     tr->mItems.clear(); // clear so they don't get deleted in trans cleaning
                     tr->mFlag = NxsTransaction::FLAG_STATE_WAITING_CONFIRM;
+                    progress = true;
 
                 }
                 else if(flag & NxsTransaction::FLAG_STATE_WAITING_CONFIRM)
@@ -2440,6 +2644,7 @@ void RsGxsNetService::processTransactions()
                     if(tr->mItems.size() == tr->mTransaction->nItems)
                     {
                         tr->mFlag = NxsTransaction::FLAG_STATE_COMPLETED;
+                        progress = true;
 #ifdef NXS_NET_DEBUG_1
                         GXSNETDEBUG_P_(mit->first) << "    completed!" << std::endl;
 #endif
@@ -2503,6 +2708,7 @@ void RsGxsNetService::processTransactions()
                     trans->PeerId(tr->mTransaction->PeerId());
                     generic_sendItem(trans);
                     tr->mFlag = NxsTransaction::FLAG_STATE_RECEIVING;
+                    progress = true;
 
                 }
                 else{
@@ -2526,7 +2732,17 @@ void RsGxsNetService::processTransactions()
             transMap.erase(*lit);
         }
 
+        progress = progress || !toRemove.empty();
     }
+
+    return progress;
+}
+
+bool RsGxsNetService::getMutexHoldStats(std::vector<uint64_t>& counts,uint64_t& max_us,uint64_t& total_us)
+{
+	// the histogram is made of atomics, so no need to take mNxsMutex here, which would count in it.
+	mNxsMutexHoldStats.getHistogram(counts,max_us,total_us) ;
+	return true ;
 }
 
 bool RsGxsNetService::getGroupNetworkStats(const RsGxsGroupId& gid,RsGroupNetworkStats& stats)
@@ -2547,9 +2763,11 @@ bool RsGxsNetService::getGroupNetworkStats(const RsGxsGroupId& gid,RsGroupNetwor
     return true ;
 }
 
-void RsGxsNetService::processCompletedTransactions()
+bool RsGxsNetService::processCompletedTransactions()
 {
 	RS_STACK_MUTEX(mNxsMutex) ;
+	bool progress = !mComplTransactions.empty();
+
 	/*!
 	 * Depending on transaction we may have to respond to peer
 	 * responsible for transaction
@@ -2571,6 +2789,8 @@ void RsGxsNetService::processCompletedTransactions()
 		delete tr;
 		mComplTransactions.pop_front();
 	}
+
+	return progress;
 }
 
 void RsGxsNetService::locked_processCompletedIncomingTrans(NxsTransaction* tr)
@@ -4874,8 +5094,11 @@ int RsGxsNetService::requestGrp(
 	for(auto& grpId: std::as_const(grpIds)) RS_DBG("\t Group ID: ", grpId);
 #endif
 
-	RS_STACK_MUTEX(mNxsMutex);
-	mExplicitRequest[peerId].insert(grpIds.begin(), grpIds.end());
+	{
+		RS_STACK_MUTEX(mNxsMutex);
+		mExplicitRequest[peerId].insert(grpIds.begin(), grpIds.end());
+	}
+	wakeUp();
 	return 1;
 }
 
@@ -25,6 +25,8 @@
 
 #include <list>
 #include <queue>
+#include <mutex>
+#include <condition_variable>
 
 #include "rsnxs.h"
 #include "rsgds.h"
@@ -245,6 +247,15 @@ public:
     
     virtual bool getGroupServerUpdateTS(const RsGxsGroupId& gid,rstime_t& grp_server_update_TS,rstime_t& msg_server_update_TS) override ;
     virtual bool stampMsgServerUpdateTS(const RsGxsGroupId& gid) override ;
+    virtual void notifyMessagesStored(const std::set<RsGxsGroupId>& grpIds) override ;
+    virtual void notifyGroupsChanged(const std::set<RsGxsGroupId>& grpIds) override ;
+    virtual void notifyGroupsDeleted(const std::set<RsGxsGroupId>& grpIds) override ;
+
+    /*!
+     * \brief getMutexHoldStats
+     * 		Histogram of the time mNxsMutex is held, since the service was created.
+     */
+    virtual bool getMutexHoldStats(std::vector<uint64_t>& counts,uint64_t& max_us,uint64_t& total_us) override ;
     virtual bool removeGroups(const std::list<RsGxsGroupId>& groups)override ;
     virtual bool isDistantPeer(const RsPeerId& pid)override ;
 
@@ -264,6 +275,9 @@ public:
 
 	void threadTick() override; /// @see RsTickingThread
 
+	/// Wakes up the net service thread when items are queued. @see p3Service
+	void incomingItemsQueued() override { wakeUp(); }
+
 
 	/// @see RsNetworkExchangeService
 	std::error_condition checkUpdatesFromPeers(
@@ -288,15 +302,29 @@ private:
      * These process transactions which are in a wait state
      * Also moves transaction which have been completed to
      * the completed transactions list
+     * @return true if at least one transaction changed state
      */
-    void processTransactions();
+    bool processTransactions();
 
     /*!
      * Process completed transaction, which either simply
      * retires a transaction or additionally generates a response
      * to the completed transaction
+     * @return true if at least one transaction was retired
+     */
+    bool processCompletedTransactions();
+
+    /*!
+     * Makes the next threadTick() run right away instead of waiting for
+     * the idle delay. Called whenever some work is queued for the thread.
+     */
+    void wakeUp();
+
+    /*!
+     * Sends a pull request to online friends after new messages were stored,
+     * at most once every RELAY_PULL_MIN_DELAY seconds.
      */
-    void processCompletedTransactions();
+    void processRelayPull();
 
     /*!
      * Process transaction owned/started by user
@@ -500,11 +528,27 @@ private:
 
     void locked_doMsgUpdateWork(const RsNxsTransacItem* nxsTrans, const RsGxsGroupId& grpId);
 
+    /*!
+     * Full scan of the group metas, that recomputes the server update TS. Since the TS are maintained
+     * incrementally by processGroupServerTSUpdates(), it only runs at start and as a rare consistency check.
+     */
     void updateServerSyncTS();
 #ifdef TO_REMOVE
     void updateClientSyncTS();
 #endif
 
+    /*!
+     * Updates the server update TS and the list of subscribed circle-restricted groups for the groups
+     * queued by notifyGroupsChanged()/notifyGroupsDeleted()/subscribeStatusChanged().
+     */
+    void processGroupServerTSUpdates();
+
+    /*!
+     * Follows membership changes of the circles our subscribed groups are restricted to, by
+     * raising the global group server TS to the circles server TS.
+     */
+    void updateCircleServerTS();
+
     bool locked_CanReceiveUpdate(const RsNxsSyncGrpReqItem *item);
     bool locked_CanReceiveUpdate(RsNxsSyncMsgReqItem *item, bool &grp_is_known);
 	void locked_resetClientTS(const RsGxsGroupId& grpId);
@@ -627,13 +671,32 @@ private:
 
     /// for other members save transactions
     RsMutex mNxsMutex;
+    RsMutexHoldStats mNxsMutexHoldStats;
 
     uint32_t mSyncTs;
     uint32_t mLastKeyPublishTs;
     uint32_t mLastCleanRejectedMessages;
 
     const uint32_t mSYNC_PERIOD;
-    int mUpdateCounter ;
+    rstime_t mLastServerSyncTSUpdate;
+    rstime_t mLastFullServerSyncTSCheck;
+    rstime_t mLastDebugDump;
+
+    /// work queue of the net service thread, not protected by mNxsMutex
+    std::mutex mWorkMtx;
+    std::condition_variable mWorkCond;
+    bool mWorkPending;
+
+    enum GroupRefresh { GROUP_REFRESH_FROM_META, GROUP_REFRESH_SUBSCRIBED, GROUP_REFRESH_UNSUBSCRIBED, GROUP_REFRESH_DELETED };
+
+    /// groups whose server TS need to be updated, locked by mWorkMtx so that notifications never wait for mNxsMutex
+    std::map<RsGxsGroupId,GroupRefresh> mGroupsToRefresh;
+
+    /// subscribed groups restricted to a circle, locked by mNxsMutex
+    std::map<RsGxsGroupId,RsGxsCircleId> mSubscribedCircleGroups;
+
+    bool mRelayPullPending;			// locked by mNxsMutex
+    rstime_t mLastRelayPullTs;		// locked by mNxsMutex
 
     RsGcxs* mCircles;
     RsGixs *mGixs;
@@ -452,6 +452,15 @@ bool RsGxsNetTunnelService::receiveTunnelData(uint16_t service_id, unsigned char
 	return true;
 }
 
+bool RsGxsNetTunnelService::hasIncomingData(uint16_t service_id)
+{
+	RS_STACK_MUTEX(mGxsNetTunnelMtx);
+
+	auto it = mIncomingData.find(service_id);
+
+	return it != mIncomingData.end() && !it->second.empty();
+}
+
 bool RsGxsNetTunnelService::sendTunnelData(uint16_t /* service_id */,unsigned char *& data,uint32_t data_len,const RsGxsNetTunnelVirtualPeerId& virtual_peer)
 {
 	RS_STACK_MUTEX(mGxsNetTunnelMtx);
@@ -170,6 +170,12 @@ public:
 	   */
       bool receiveTunnelData(uint16_t service_id, unsigned char *& data, uint32_t& data_len, RsGxsNetTunnelVirtualPeerId& virtual_peer) ;
 
+	  /*!
+	   * \brief hasIncomingData
+	   *                 returns true if receiveTunnelData() has something to return for this service.
+	   */
+      bool hasIncomingData(uint16_t service_id) ;
+
 	  /*!
 	   * \brief isDistantPeer
 	   *                 returns wether the peer is in the list of available distant peers or not
@@ -21,6 +21,9 @@
  *                                                                             *
  *******************************************************************************/
 
+#include <algorithm>
+#include <limits>
+
 #include "util/rstime.h"
 
 #include "rsgxsutil.h"
@@ -34,6 +37,7 @@
 // happen anyway, but we still conduct these test as an extra safety measure.
 
 static const uint32_t MAX_GXS_IDS_REQUESTS_NET   =  10 ; // max number of requests from cache/net (avoids killing the system!)
+static const double   CLEANUP_TIME_BUDGET         = 0.1 ; // max time in seconds spent selecting messages to delete in one cleanup pass
 
 // #define DEBUG_GXSUTIL 1
 
@@ -46,8 +50,10 @@ RsGxsCleanUp::RsGxsCleanUp(RsGeneralDataService* const dataService, RsGenExchang
 {
 }
 
-bool RsGxsCleanUp::clean(RsGxsGroupId& next_group_to_check,std::vector<RsGxsGroupId>& grps_to_delete,GxsMsgReq& messages_to_delete)
+bool RsGxsCleanUp::clean(std::map<RsGxsGroupId,rstime_t>& next_ts_to_check,std::vector<RsGxsGroupId>& grps_to_delete,GxsMsgReq& messages_to_delete)
 {
+    double start = rstime::RsScopeTimer::currentTime();
+
     RsGxsGrpMetaTemporaryMap grpMetaMap;
     mDs->retrieveGxsGrpMetaData(grpMetaMap);
 
@@ -55,28 +61,29 @@ bool RsGxsCleanUp::clean(RsGxsGroupId& next_group_to_check,std::vector<RsGxsGrou
 
 #ifdef DEBUG_GXSUTIL
     uint16_t service_type = mGenExchangeClient->serviceType() ;
-    GXSUTIL_DEBUG() << "  Cleaning up groups in service " << std::hex << service_type << std::dec << " starting at group " << next_group_to_check << std::endl;
+    GXSUTIL_DEBUG() << "  Cleaning up groups in service " << std::hex << service_type << std::dec << std::endl;
 #endif
-    // This method stores/takes the next group to check. This allows to limit group checking to a small part of the total groups
-    // in the situation where it takes too much time. So when arriving here, we must start again from where we left last time.
+    // First look at how overdue each group is, using the publish time of its oldest expired message. This only costs
+    // one index lookup per group, and allows to clean up the most overdue groups first when a pass cannot handle
+    // all of them. Messages that are kept (see below) are not looked at again by the next passes of the round, since
+    // each group is searched from where the previous pass stopped.
 
-    if(grpMetaMap.empty())		// nothing to do.
+    struct GroupToClean
     {
-        next_group_to_check.clear();
-        return true;
-    }
-
-    auto it = next_group_to_check.isNull()?grpMetaMap.begin() : grpMetaMap.find(next_group_to_check);
-
-    if(it == grpMetaMap.end())		// group wasn't found
-        it = grpMetaMap.begin();
-
-    bool full_round = false;			// did we have the time to test all groups?
-    next_group_to_check = it->first;	// covers the case where next_group_to_check is null or not found
-
-    while(true)	// check all groups, starting from the one indicated as parameter
+        RsGxsGroupId grpId;
+        rstime_t newer_than;	// where the previous pass stopped
+        rstime_t older_than;	// messages published before that are expired
+        rstime_t overdue;
+        bool everything;		// group is not subscribed: remove all messages
+        bool old_versions;		// group has old versions of edited messages to remove
+    };
+    std::vector<GroupToClean> groups;
+
+    bool keep_old_versions = mGenExchangeClient->keepOldMsgVersions();
+
+    for(auto& it:grpMetaMap)
     {
-        const RsGxsGrpMetaData& grpMeta = *(it->second);
+        const RsGxsGrpMetaData& grpMeta = *(it.second);
 
         // first check if we keep the group or not
 
@@ -86,119 +93,126 @@ bool RsGxsCleanUp::clean(RsGxsGroupId& next_group_to_check,std::vector<RsGxsGrou
             std::cerr << "  Scheduling group " << grpMeta.mGroupId << " for removal." << std::endl;
 #endif
             grps_to_delete.push_back(grpMeta.mGroupId);
+            continue;
         }
+
+        GroupToClean g;
+        g.grpId = grpMeta.mGroupId;
+        g.newer_than = 0;
+        g.everything = (grpMeta.mSubscribeFlags & GXS_SERV::GROUP_SUBSCRIBE_NOT_SUBSCRIBED) || !(grpMeta.mSubscribeFlags & GXS_SERV::GROUP_SUBSCRIBE_SUBSCRIBED);
+        g.overdue = 0;
+        g.old_versions = false;
+
+        // If not subscribed remove messages regardless of their age, and even if they should be kept
+
+        uint32_t store_period = mGenExchangeClient->getStoragePeriod(g.grpId) ;
+
+        if(g.everything)
+            g.older_than = std::numeric_limits<int32_t>::max();
+        else if(store_period > 0)
+            g.older_than = now - store_period;
         else
-        {
-            const RsGxsGroupId& grpId = grpMeta.mGroupId;
-            GxsMsgReq req;
-            GxsMsgMetaResult result;
+            g.older_than = 0;
 
-            req[grpId] = std::set<RsGxsMessageId>();
-            mDs->retrieveGxsMsgMetaData(req, result);
+        auto nit = next_ts_to_check.find(g.grpId);
 
-            GxsMsgMetaResult::iterator mit = result.begin();
+        if(nit != next_ts_to_check.end())
+            g.newer_than = nit->second;
 
-#ifdef DEBUG_GXSUTIL
-            GXSUTIL_DEBUG() << "  Cleaning up messages for group ID " << grpId << std::endl;
-#endif
-            uint32_t store_period = mGenExchangeClient->getStoragePeriod(grpId) ;
+        bool expired = false;
 
-            for(; mit != result.end(); ++mit)
-            {
-                auto& metaV = mit->second;
+        if(g.older_than > 0)
+        {
+            std::vector<std::pair<RsGxsMessageId,rstime_t> > oldest;
+            mDs->retrieveExpiredMsgIds(g.grpId, g.newer_than, g.older_than, g.everything, 1, oldest);
 
-                // First, make a map of which message have a child message. This allows to only delete messages that dont have child messages.
-                // A more accurate way to go would be to compute the time of the oldest message and possibly delete all the branch, but in the
-                // end the message tree will be deleted slice after slice, which should still be reasonnably fast.
-                //
-                std::set<RsGxsMessageId> messages_with_kids ;
-                std::set<RsGxsMessageId> messages_old_versions ;
+            if(!oldest.empty())
+            {
+                expired = true;
+                g.overdue = g.older_than - oldest.front().second;
+            }
+        }
 
-                for( uint32_t i=0;i<metaV.size();++i)
-                    if(!metaV[i]->mParentId.isNull())
-                        messages_with_kids.insert(metaV[i]->mParentId) ;
+        // Only keep old messages if the client service asks for it.
 
-                for( uint32_t i=0;i<metaV.size();++i)
-                    if(!metaV[i]->mOrigMsgId.isNull() && metaV[i]->mOrigMsgId != metaV[i]->mMsgId)	// in some situations, mOrigMsgId is initialized, but equal to the sgId itself
-                        messages_old_versions.insert(metaV[i]->mOrigMsgId) ;
+        if(!keep_old_versions && !g.everything)
+        {
+            std::vector<RsGxsMessageId> old_versions;
+            mDs->retrieveOldMsgVersionIds(g.grpId, 1, old_versions);
 
-                for( uint32_t i=0;i<metaV.size();++i)
-                {
-                    const auto& meta = metaV[i];
+            g.old_versions = !old_versions.empty();
+        }
 
-                    bool have_kids = (messages_with_kids.find(meta->mMsgId)!=messages_with_kids.end());
+        if(expired || g.old_versions)
+            groups.push_back(g);
+    }
 
-                    // Check if expired
-                    bool remove = store_period > 0 && ((meta->mPublishTs + store_period) < now) && !have_kids;
+    std::sort(groups.begin(),groups.end(),[](const GroupToClean& g1,const GroupToClean& g2) { return g1.overdue > g2.overdue; });
 
-                    // Check client does not want the message kept regardless of age
-                    remove = remove && !(meta->mMsgStatus & GXS_SERV::GXS_MSG_STATUS_KEEP_FOREVER);
+    // Then select the expired messages of each group, oldest first, until the chunk is full or the time budget is spent.
+    // Messages that have replies are not selected. They will be in a later round, once their replies are deleted, so that
+    // the message tree is deleted slice after slice.
 
-                    // If not subscribed remove messages (can optimise this really)
-                    remove = remove ||  (grpMeta.mSubscribeFlags & GXS_SERV::GROUP_SUBSCRIBE_NOT_SUBSCRIBED);
-                    remove = remove || !(grpMeta.mSubscribeFlags & GXS_SERV::GROUP_SUBSCRIBE_SUBSCRIBED);
+    uint32_t remaining = CHUNK_SIZE;
+    bool done = true;
 
+    for(auto& g:groups)
+    {
+        if(remaining == 0 || rstime::RsScopeTimer::currentTime() > start + CLEANUP_TIME_BUDGET)
+        {
 #ifdef DEBUG_GXSUTIL
-                    GXSUTIL_DEBUG() << "    msg id " << meta->mMsgId << " in grp " << grpId << ": keep_flag=" << bool(meta->mMsgStatus & GXS_SERV::GXS_MSG_STATUS_KEEP_FOREVER)
-                                    << " subscribed: " << bool(grpMeta.mSubscribeFlags & GXS_SERV::GROUP_SUBSCRIBE_SUBSCRIBED) << " store_period: " << store_period
-                                    << " kids: " << have_kids << " now - meta->mPublishTs: " << now - meta->mPublishTs ;
+            GXSUTIL_DEBUG() << "Stopping cleanup pass. Next pass will start again with the most overdue groups." << std::endl;
 #endif
-                    // Only keep old messages if the client service asks for it.
+            done = false;
+            break;
+        }
 
-                    if(!mGenExchangeClient->keepOldMsgVersions() && messages_old_versions.find(meta->mMsgId)!=messages_old_versions.end())
-                    {
-                        std::cerr << "*********  Removing old messsage version " << meta->mMsgId << " because the service allows it." << std::endl;
-                        remove = true;
-                    }
+        if(g.older_than > 0)
+        {
+            std::vector<std::pair<RsGxsMessageId,rstime_t> > msgs;
+            mDs->retrieveExpiredMsgIds(g.grpId, g.newer_than, g.older_than, g.everything, remaining, msgs);
 
-                    if( remove )
-                    {
-                        messages_to_delete[grpId].insert(meta->mMsgId);
-#ifdef DEBUG_GXSUTIL
-                        std::cerr << "    Scheduling for removal." << std::endl;
-#endif
-                    }
+            for(auto& m:msgs)
+            {
 #ifdef DEBUG_GXSUTIL
-                    else
-                        std::cerr << std::endl;
+                GXSUTIL_DEBUG() << "    msg id " << m.first << " in grp " << g.grpId << ": now - publishTs: " << now - m.second << ". Scheduling for removal." << std::endl;
 #endif
-                }
+                messages_to_delete[g.grpId].insert(m.first);
             }
-        }
 
-        ++it;
+            // The messages selected are deleted before the next pass, so the next pass can start at the same publish time
+            // without selecting them again. This is needed because other messages may have been published at that time too.
 
-        if(it == grpMetaMap.end())
-            it = grpMetaMap.begin();
+            if(!msgs.empty())
+                next_ts_to_check[g.grpId] = msgs.back().second;
 
-        // check if we looped already
+            if(msgs.size() >= remaining)
+                done = false;
 
-        if(it->first == next_group_to_check)
-        {
-#ifdef DEBUG_GXSUTIL
-            GXSUTIL_DEBUG() << "Had the time to test all groups. Will start again at " << it->first << std::endl;
-#endif
-            full_round = true;
-            break;
+            remaining -= std::min((uint32_t)msgs.size(),remaining);
         }
 
-        // now check if we spent too much time on this already
+        if(g.old_versions && remaining > 0)
+        {
+            std::vector<RsGxsMessageId> old_versions;
+            mDs->retrieveOldMsgVersionIds(g.grpId, remaining, old_versions);
 
-        rstime_t tm = time(nullptr);
+            if(old_versions.size() >= remaining)
+                done = false;
 
-        //if(tm > now + 1) // we spent more than 1 sec on the job already
-        if(tm > now) // we spent more than 1 sec on the job already
-        {
-#ifdef DEBUG_GXSUTIL
-            GXSUTIL_DEBUG() << "Aborting cleanup because it took too much time already. Next group left to be " << it->first << std::endl;
-#endif
-            next_group_to_check = it->first;
-            full_round = false;
-            break;
+            for(auto& msgId:old_versions)
+                if(messages_to_delete[g.grpId].insert(msgId).second)
+                {
+                    std::cerr << "*********  Removing old messsage version " << msgId << " because the service allows it." << std::endl;
+                    --remaining;
+                }
         }
     }
 
-    return full_round;
+    if(done)
+        next_ts_to_check.clear();
+
+    return done;
 }
 
 RsGxsIntegrityCheck::RsGxsIntegrityCheck(
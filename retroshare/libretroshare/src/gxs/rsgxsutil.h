@@ -123,8 +123,12 @@ inline RsGxsGrpMsgIdPair getMsgIdPair(RsGxsMsgItem& msg)
 }
 
 /*!
- * Does message clean up based on individual group expirations first
- * if avialable. If not then deletion s
+ * Does message clean up based on individual group expirations. Expired messages
+ * are selected by the data service from the (group, publish time) index, in
+ * bounded chunks, starting with the groups whose oldest expired message is the
+ * most overdue. A clean up round is therefore split into several passes, and
+ * each pass starts in each group from the publish time where the previous one
+ * stopped.
  */
 class RsGxsCleanUp
 {
@@ -133,18 +137,19 @@ public:
     /*!
      *
      * @param dataService
-     * @param mGroupTS
-     * @param chunkSize
-     * @param sleepPeriod
+     * @param genex
+     * @param chunkSize max number of messages selected for deletion in one pass
      */
     RsGxsCleanUp(RsGeneralDataService* const dataService, RsGenExchange *genex, uint32_t chunkSize);
 
     /*!
-     * On construction this should be called to progress deletions
-     * Deletion will process by chunk size
+     * Selects at most chunkSize messages to delete, within a time budget.
+     * Should be called again once the selected messages are deleted, until
+     * it returns true.
+     * @param next_ts_to_check publish time to start from in each group, updated for the next pass and cleared at the end of the round
      * @return true if no more messages to delete, false otherwise
      */
-    bool clean(RsGxsGroupId& next_group_to_check,std::vector<RsGxsGroupId>& grps_to_delete,GxsMsgReq& messages_to_delete);
+    bool clean(std::map<RsGxsGroupId,rstime_t>& next_ts_to_check,std::vector<RsGxsGroupId>& grps_to_delete,GxsMsgReq& messages_to_delete);
 
 private:
 
@@ -29,6 +29,7 @@
 #include <cstdlib>
 #include <list>
 #include <map>
+#include <vector>
 
 #include "util/rstime.h"
 #include "services/p3service.h"
@@ -227,6 +228,13 @@ public:
      */
     virtual bool getGroupNetworkStats(const RsGxsGroupId& grpId,RsGroupNetworkStats& stats)=0;
 
+    /*!
+     * returns the histogram of the time the service's main mutex is held, since the service was created.
+     * Bucket i of counts covers [2^i, 2^(i+1)) microseconds (see RsMutexHoldStats).
+     * @return false when the service does not track it
+     */
+    virtual bool getMutexHoldStats(std::vector<uint64_t>& /*counts*/,uint64_t& /*max_us*/,uint64_t& /*total_us*/) { return false; }
+
     virtual void subscribeStatusChanged(const RsGxsGroupId& id,bool subscribed) =0;
 
     /*!
@@ -262,6 +270,30 @@ public:
      */
     virtual bool stampMsgServerUpdateTS(const RsGxsGroupId& gid) =0;
 
+    /*!
+     * \brief notifyMessagesStored
+     * 		Tells the network exchange service that messages received from friends have been validated and
+     * 		stored, so that they can be relayed to the other friends without waiting for their next sync.
+     * \param grpIds groups the stored messages belong to
+     */
+    virtual void notifyMessagesStored(const std::set<RsGxsGroupId>& /* grpIds */) {}
+
+    /*!
+     * \brief notifyGroupsChanged
+     * 		Tells the network exchange service that groups have been stored, updated, or had their meta data
+     * 		changed, so that the server update time stamps can be updated without scanning all groups.
+     * 		Only queues the ids, so it can be called while holding the observer's mutex.
+     * \param grpIds groups that changed
+     */
+    virtual void notifyGroupsChanged(const std::set<RsGxsGroupId>& /* grpIds */) {}
+
+    /*!
+     * \brief notifyGroupsDeleted
+     * 		Same as notifyGroupsChanged() for groups removed from the data store.
+     * \param grpIds groups that were deleted
+     */
+    virtual void notifyGroupsDeleted(const std::set<RsGxsGroupId>& /* grpIds */) {}
+
     /*!
      * \brief isDistantPeer
      * \param pid		peer that is a virtual peer provided by GxsNetTunnel
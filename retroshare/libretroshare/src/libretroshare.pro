@@ -44,6 +44,7 @@ file_lists {
 	HEADERS *= file_sharing/p3filelists.h \
 			file_sharing/hash_cache.h \
 			file_sharing/filelist_io.h \
+			file_sharing/filelist_container.h \
 			file_sharing/directory_storage.h \
 			file_sharing/directory_updater.h \
 			file_sharing/rsfilelistitems.h \
@@ -53,6 +54,7 @@ file_lists {
 	SOURCES *= file_sharing/p3filelists.cc \
 			file_sharing/hash_cache.cc \
 			file_sharing/filelist_io.cc \
+			file_sharing/filelist_container.cc \
 			file_sharing/directory_storage.cc \
 			file_sharing/directory_updater.cc \
 			file_sharing/dir_hierarchy.cc \
@@ -86,6 +88,7 @@ SOURCES +=	dht/p3bitdht.cc  \
 
 HEADERS +=	tcponudp/udppeer.h \
 		tcponudp/bio_tou.h \
+		tcponudp/tcpcongestion.h \
 		tcponudp/tcppacket.h \
 		tcponudp/tcpstream.h \
 		tcponudp/tou.h \
@@ -94,6 +97,7 @@ HEADERS +=	tcponudp/udppeer.h \
 		pqi/pqissludp.h \
 
 SOURCES +=	tcponudp/udppeer.cc \
+		tcponudp/tcpcongestion.cc \
 		tcponudp/tcppacket.cc \
 		tcponudp/tcpstream.cc \
 		tcponudp/tou.cc \
@@ -352,7 +356,8 @@ LIBS *= $${OPENPGPSDK_DIR}/lib/libops.a -lbz2
 
 ################################### HEADERS & SOURCES #############################
 
-HEADERS +=	ft/ftchunkmap.h \
+HEADERS +=	ft/ftchecksumpool.h \
+			ft/ftchunkmap.h \
 			ft/ftcontroller.h \
 			ft/ftdata.h \
 			ft/ftdatamultiplex.h \
@@ -398,10 +403,12 @@ HEADERS +=	pqi/authssl.h \
 			pqi/pqi.h \
 			pqi/pqi_base.h \
 			pqi/pqiassist.h \
+			pqi/pqibandwidth.h \
 			pqi/pqibin.h \
 			pqi/pqihandler.h \
 			pqi/pqihash.h \
 			pqi/p3historymgr.h \
+			pqi/p3historystore.h \
 			pqi/pqiindic.h \
 			pqi/pqiipset.h \
 			pqi/pqilistener.h \
@@ -414,6 +421,7 @@ HEADERS +=	pqi/authssl.h \
 			pqi/pqiservicemonitor.h \
 			pqi/pqissl.h \
 			pqi/pqissllistener.h \
+			pqi/pqisslhandshakepool.h \
 			pqi/pqisslpersongrp.h \
 			pqi/pqiproxy.h \
 			pqi/pqisslproxy.h \
@@ -493,7 +501,10 @@ HEADERS +=  \
 HEADERS +=	turtle/p3turtle.h \
 			turtle/rsturtleitem.h \
 			turtle/turtletypes.h \
-			turtle/turtleclientservice.h
+			turtle/turtleclientservice.h \
+			turtle/turtleroutingtable.h \
+			turtle/turtlerequestcache.h \
+			turtle/turtlesearchcache.h
 
 HEADERS +=	util/folderiterator.h \
     util/rsdebug.h \
@@ -520,11 +531,13 @@ HEADERS +=	util/folderiterator.h \
                         util/rsinitedptr.h \
 			util/rsprint.h \
 			util/rsstring.h \
+			util/rsstartup.h \
 			util/rsstd.h \
 			util/rsthreads.h \
 			util/rswin.h \
 			util/rsrandom.h \
 			util/rsmemcache.h \
+			util/rsmpscqueue.h \
 			util/rstickevent.h \
 			util/rsrecogn.h \
 			util/rstime.h \
@@ -538,7 +551,8 @@ HEADERS +=	util/folderiterator.h \
     util/rsurl.h \
     util/rsmacrosugar.hpp
 
-SOURCES +=	ft/ftchunkmap.cc \
+SOURCES +=	ft/ftchecksumpool.cc \
+			ft/ftchunkmap.cc \
 			ft/ftcontroller.cc \
 			ft/ftdatamultiplex.cc \
 			ft/ftextralist.cc \
@@ -575,9 +589,11 @@ SOURCES +=	pqi/authgpg.cc \
 			pqi/p3netmgr.cc \
 			pqi/p3notify.cc \
 			pqi/pqiqos.cc \
+			pqi/pqibandwidth.cc \
 			pqi/pqibin.cc \
 			pqi/pqihandler.cc \
 			pqi/p3historymgr.cc \
+			pqi/p3historystore.cc \
 			pqi/pqiipset.cc \
 			pqi/pqiloopback.cc \
 			pqi/pqimonitor.cc \
@@ -587,6 +603,7 @@ SOURCES +=	pqi/authgpg.cc \
 			pqi/pqiservice.cc \
 			pqi/pqissl.cc \
 			pqi/pqissllistener.cc \
+			pqi/pqisslhandshakepool.cc \
 			pqi/pqisslpersongrp.cc \
 			pqi/pqiproxy.cc \
 			pqi/pqisslproxy.cc \
@@ -657,7 +674,9 @@ SOURCES +=  services/autoproxy/rsautoproxymonitor.cc \
 			services/p3serviceinfo.cc \
 
 SOURCES +=	turtle/p3turtle.cc \
-                                turtle/rsturtleitem.cc
+                                turtle/rsturtleitem.cc \
+                                turtle/turtleroutingtable.cc \
+                                turtle/turtlesearchcache.cc
 
 SOURCES +=	util/folderiterator.cc \
 			util/rsdebug.cc \
@@ -674,6 +693,7 @@ SOURCES +=	util/folderiterator.cc \
 			util/dnsresolver.cc \
 			util/rsprint.cc \
 			util/rsstring.cc \
+			util/rsstartup.cc \
 			util/rsthreads.cc \
 			util/rsrandom.cc \
 			util/rstickevent.cc \
@@ -66,6 +66,10 @@ const uint32_t RS_SSL_HANDSHAKE_DIAGNOSTIC_HASH_ALGORITHM_NOT_ACCEPTED = 0x07 ;
 const uint32_t RS_SSL_HANDSHAKE_DIAGNOSTIC_WRONG_SIGNATURE_TYPE        = 0x09 ;
 const uint32_t RS_SSL_HANDSHAKE_DIAGNOSTIC_WRONG_SIGNATURE_VERSION     = 0x0a ;
 
+// Number of certificates which PGP signature check is remembered. There is one
+// certificate per friend location, so this covers very large friend lists.
+static const uint32_t AUTHSSL_MAX_AUTHENTICATED_CERTS = 1024 ;
+
 /****
  * #define AUTHSSL_DEBUG 1
  ***/
@@ -228,6 +232,7 @@ AuthSSL::~AuthSSL() = default;
 /********************************************************************************/
 
 static int verify_x509_callback(int preverify_ok, X509_STORE_CTX *ctx);
+static int new_session_callback(SSL *ssl, SSL_SESSION *session);
 
 std::string RsX509Cert::getCertName(const X509& x509)
 {
@@ -302,7 +307,9 @@ std::string RsX509Cert::getCertOrg(const X509& x509)
 
 AuthSSLimpl::AuthSSLimpl() :
     p3Config(), sslctx(nullptr), mOwnCert(nullptr), sslMtx("AuthSSL"),
-    mOwnPrivateKey(nullptr), mOwnPublicKey(nullptr), init(0) {}
+    mOwnPrivateKey(nullptr), mOwnPublicKey(nullptr), init(0),
+    mHandshakeCacheMtx("AuthSSLHandshakeCache"),
+    mAuthenticatedCerts(AUTHSSL_MAX_AUTHENTICATED_CERTS) {}
 
 AuthSSLimpl::~AuthSSLimpl()
 {
@@ -600,6 +607,15 @@ bool AuthSSLimpl::InitAuth(
 			SSL_VERIFY_FAIL_IF_NO_PEER_CERT, 
 				verify_x509_callback);
 
+	// Allow session resumption, so that reconnecting friends skip the key
+	// exchange and the PGP check of the certificate. Sessions are resumed from
+	// tickets, the client sessions are kept per peer in mResumableSessions.
+	// Resumed sessions are checked again by VerifyResumedSession().
+	static const unsigned char sessionIdContext[] = "RetroShare";
+	SSL_CTX_set_session_id_context(sslctx, sessionIdContext, sizeof(sessionIdContext) - 1);
+	SSL_CTX_set_session_cache_mode(sslctx, SSL_SESS_CACHE_BOTH | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(sslctx, new_session_callback);
+
 	mOwnCert = x509;
 
 	RsInfo mInfo;
@@ -650,6 +666,7 @@ bool	AuthSSLimpl::CloseAuth()
 	std::cerr << "AuthSSLimpl::CloseAuth()";
 	std::cerr << std::endl;
 #endif
+	clearHandshakeCache();
 	SSL_CTX_free(sslctx);
 
 	// clean up private key....
@@ -1099,6 +1116,35 @@ bool AuthSSLimpl::AuthX509WithGPG(X509 *x509,bool verbose, uint32_t& diagnostic)
 		Dbg3() << __PRETTY_FUNCTION__ << " issuer: " << issuer << " found"
 		       << std::endl;
 
+	/* Checking the PGP signature is the most expensive part of a handshake.
+	 * The result only depends on the certificate and the issuer key, so it is
+	 * remembered for the certificates that passed. */
+	Sha256CheckSum certDigest;
+	{
+		unsigned char md[EVP_MAX_MD_SIZE];
+		unsigned int mdlen = 0;
+
+		if( X509_digest(x509, EVP_sha256(), md, &mdlen) == 1 &&
+		        mdlen == Sha256CheckSum::SIZE_IN_BYTES )
+			certDigest = Sha256CheckSum::fromBufferUnsafe(md);
+	}
+
+	bool alreadyVerified = false;
+	if(!certDigest.isNull())
+	{
+		RS_STACK_MUTEX(mHandshakeCacheMtx);
+		alreadyVerified = mAuthenticatedCerts.find(certDigest, pd.fpr);
+	}
+
+	if(alreadyVerified)
+	{
+		Dbg3() << __PRETTY_FUNCTION__ << " certificate of sslId: "
+		       << RsX509Cert::getCertSslId(*x509) << " already verified"
+		       << std::endl;
+		diagnostic = RS_SSL_HANDSHAKE_DIAGNOSTIC_OK;
+		return true;
+	}
+
 	/* verify GPG signature */
 	/*** NOW The Manual signing bit (HACKED FROM asn1/a_sign.c) ***/
 
@@ -1252,6 +1298,13 @@ bool AuthSSLimpl::AuthX509WithGPG(X509 *x509,bool verbose, uint32_t& diagnostic)
 
 	OPENSSL_free(buf_in);
 
+	if(!certDigest.isNull())
+	{
+		RS_STACK_MUTEX(mHandshakeCacheMtx);
+		mAuthenticatedCerts.add(
+		            certDigest, pd.fpr, RsX509Cert::getCertSslId(*x509) );
+	}
+
 	diagnostic = RS_SSL_HANDSHAKE_DIAGNOSTIC_OK;
 
 	return true;
@@ -1287,9 +1340,6 @@ int AuthSSLimpl::VerifyX509Callback(int /*preverify_ok*/, X509_STORE_CTX* ctx)
 	constexpr int verificationFailed = 0;
 	constexpr int verificationSuccess = 1;
 
-	using Evt_t = RsAuthSslConnectionAutenticationEvent;
-	std::unique_ptr<Evt_t> ev = std::unique_ptr<Evt_t>(new Evt_t);
-
 	X509* x509Cert = X509_STORE_CTX_get_current_cert(ctx);
 	if(!x509Cert)
 	{
@@ -1302,6 +1352,17 @@ int AuthSSLimpl::VerifyX509Callback(int /*preverify_ok*/, X509_STORE_CTX* ctx)
 		return verificationFailed;
 	}
 
+	return verifyPeerCertificate(x509Cert) ? verificationSuccess : verificationFailed;
+}
+
+bool AuthSSLimpl::verifyPeerCertificate(X509* x509Cert)
+{
+	constexpr bool verificationFailed = false;
+	constexpr bool verificationSuccess = true;
+
+	using Evt_t = RsAuthSslConnectionAutenticationEvent;
+	std::unique_ptr<Evt_t> ev = std::unique_ptr<Evt_t>(new Evt_t);
+
 	RsPeerId sslId = RsX509Cert::getCertSslId(*x509Cert);
 	std::string sslCn = RsX509Cert::getCertIssuerString(*x509Cert);
 
@@ -1427,7 +1488,7 @@ int AuthSSLimpl::VerifyX509Callback(int /*preverify_ok*/, X509_STORE_CTX* ctx)
 		return verificationFailed;
 	}
 #ifdef AUTHSSL_DEBUG
-    std::cerr << "******* VerifyX509Callback cert: " << std::hex << ctx->cert <<std::dec << std::endl;
+    std::cerr << "******* VerifyX509Callback cert: " << std::hex << x509Cert <<std::dec << std::endl;
 #endif
 
     if ( !isSslOnlyFriend && pgpId != AuthPGP::getPgpOwnId() && !AuthPGP::isPGPAccepted(pgpId) )
@@ -1462,6 +1523,163 @@ int AuthSSLimpl::VerifyX509Callback(int /*preverify_ok*/, X509_STORE_CTX* ctx)
 	return verificationSuccess;
 }
 
+bool AuthSSLimpl::VerifyResumedSession(SSL* ssl)
+{
+	X509* x509Cert = SSL_get_peer_certificate(ssl);
+	if(!x509Cert)
+	{
+		RsErr() << __PRETTY_FUNCTION__ << " resumed session has no peer "
+		        << "certificate!" << std::endl;
+		return false;
+	}
+
+	RsPeerId sslId = RsX509Cert::getCertSslId(*x509Cert);
+	bool ok = verifyPeerCertificate(x509Cert);
+	X509_free(x509Cert);
+
+	if(!ok)
+	{
+		/* do not offer this session again */
+		RS_STACK_MUTEX(mHandshakeCacheMtx);
+
+		auto it = mResumableSessions.find(sslId);
+		if(it != mResumableSessions.end())
+		{
+			SSL_SESSION_free(it->second);
+			mResumableSessions.erase(it);
+		}
+	}
+
+	return ok;
+}
+
+static int new_session_callback(SSL *ssl, SSL_SESSION *session)
+{
+	/* returning 1 tells OpenSSL that we keep the reference to the session */
+	return static_cast<AuthSSLimpl&>(AuthSSL::instance()).storeResumableSession(ssl, session) ? 1 : 0;
+}
+
+bool AuthSSLimpl::storeResumableSession(SSL* ssl, SSL_SESSION* session)
+{
+	/* The server side resumes from tickets, nothing to keep there */
+	if(SSL_is_server(ssl))
+		return false;
+
+	X509* x509Cert = SSL_SESSION_get0_peer(session);
+	if(!x509Cert)
+		return false;
+
+	RsPeerId sslId = RsX509Cert::getCertSslId(*x509Cert);
+	if(sslId.isNull())
+		return false;
+
+	RS_STACK_MUTEX(mHandshakeCacheMtx);
+
+	SSL_SESSION*& stored(mResumableSessions[sslId]);
+	if(stored)
+		SSL_SESSION_free(stored);
+
+	stored = session;
+	return true;
+}
+
+bool AuthSSLimpl::setResumableSession(SSL* ssl, const RsPeerId& peerId)
+{
+	RS_STACK_MUTEX(mHandshakeCacheMtx);
+
+	auto it = mResumableSessions.find(peerId);
+	if(it == mResumableSessions.end())
+		return false;
+
+	/* Sessions are used once: a successful resumption brings a new ticket,
+	 * and TLS 1.3 recommends against reusing tickets. */
+	SSL_SESSION* session = it->second;
+	mResumableSessions.erase(it);
+
+	bool ok = SSL_SESSION_is_resumable(session) && SSL_set_session(ssl, session) == 1;
+	SSL_SESSION_free(session);
+
+	return ok;
+}
+
+void AuthSSLimpl::clearHandshakeCache()
+{
+	RS_STACK_MUTEX(mHandshakeCacheMtx);
+
+	for(auto& it: mResumableSessions)
+		SSL_SESSION_free(it.second);
+
+	mResumableSessions.clear();
+	mAuthenticatedCerts.clear();
+}
+
+void AuthSSLimpl::forgetPeer(const RsPeerId& sslId)
+{
+	RS_STACK_MUTEX(mHandshakeCacheMtx);
+
+	auto it = mResumableSessions.find(sslId);
+	if(it != mResumableSessions.end())
+	{
+		SSL_SESSION_free(it->second);
+		mResumableSessions.erase(it);
+	}
+
+	mAuthenticatedCerts.removePeer(sslId);
+}
+
+AuthenticatedCertCache::AuthenticatedCertCache(uint32_t maxSize) :
+    mMaxSize(maxSize), mUseCount(0) {}
+
+bool AuthenticatedCertCache::find(const Sha256CheckSum& digest, const RsPgpFingerprint& fpr)
+{
+	auto it = mCerts.find(digest);
+
+	if(it == mCerts.end() || it->second.fpr != fpr)
+		return false;
+
+	it->second.lastUsed = ++mUseCount;
+	return true;
+}
+
+void AuthenticatedCertCache::add( const Sha256CheckSum& digest, const RsPgpFingerprint& fpr,
+                                  const RsPeerId& sslId )
+{
+	if(mCerts.size() >= mMaxSize && mCerts.find(digest) == mCerts.end())
+	{
+		/* drop the least recently used one */
+		auto oldest = mCerts.begin();
+
+		for(auto it = mCerts.begin(); it != mCerts.end(); ++it)
+			if(it->second.lastUsed < oldest->second.lastUsed)
+				oldest = it;
+
+		mCerts.erase(oldest);
+	}
+
+	Entry& entry(mCerts[digest]);
+	entry.fpr = fpr;
+	entry.sslId = sslId;
+	entry.lastUsed = ++mUseCount;
+}
+
+uint32_t AuthenticatedCertCache::removePeer(const RsPeerId& sslId)
+{
+	uint32_t removed = 0;
+
+	for(auto it = mCerts.begin(); it != mCerts.end();)
+		if(it->second.sslId == sslId)
+		{
+			it = mCerts.erase(it);
+			++removed;
+		}
+		else
+			++it;
+
+	return removed;
+}
+
+void AuthenticatedCertCache::clear() { mCerts.clear(); }
+
 bool AuthSSLimpl::parseX509DetailsFromFile( const std::string& certFilePath, RsPeerId& certId, RsPgpId& issuer, std::string& location )
 {
 	FILE* tmpfp = RsDirUtil::rs_fopen(certFilePath.c_str(), "r");
@@ -1614,9 +1832,15 @@ bool    AuthSSLimpl::encrypt(void *&out, int &outlen, const void *in, int inlen,
 
 bool    AuthSSLimpl::decrypt(void *&out, int &outlen, const void *in, int inlen)
 {
-	RsStackMutex stack(sslMtx); /******* LOCKED ******/
-
+	// The private key is only set at init, and decrypting does not modify it,
+	// so the lock is not held while decrypting. This lets config files be
+	// decrypted in parallel at startup.
 
+	EVP_PKEY *privateKey ;
+	{
+		RsStackMutex stack(sslMtx); /******* LOCKED ******/
+		privateKey = mOwnPrivateKey ;
+	}
 
 #ifdef AUTHSSL_DEBUG
         std::cerr << "AuthSSLimpl::decrypt() called with inlen : " << inlen << std::endl;
@@ -1628,7 +1852,7 @@ bool    AuthSSLimpl::decrypt(void *&out, int &outlen, const void *in, int inlen)
         EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
         int eklen = 0, net_ekl = 0;
         unsigned char iv[EVP_MAX_IV_LENGTH];
-        int ek_mkl = EVP_PKEY_size(mOwnPrivateKey);
+        int ek_mkl = EVP_PKEY_size(privateKey);
         unsigned char *ek = (unsigned char*)malloc(ek_mkl);
         
         if(ek == NULL)
@@ -1667,7 +1891,7 @@ bool    AuthSSLimpl::decrypt(void *&out, int &outlen, const void *in, int inlen)
 
         const EVP_CIPHER* cipher = EVP_aes_128_cbc();
 
-        if(0 == EVP_OpenInit(ctx, cipher, ek, eklen, iv, mOwnPrivateKey)) {
+        if(0 == EVP_OpenInit(ctx, cipher, ek, eklen, iv, privateKey)) {
             free(ek);
             return false;
         }
@@ -1730,6 +1954,8 @@ bool AuthSSLimpl::RemoveX509(RsPeerId id)
 {
 	std::map<RsPeerId, X509*>::iterator it;
 	
+	forgetPeer(id);
+
 	RsStackMutex stack(sslMtx); /******* LOCKED ******/
 
 	if (mCerts.end() != (it = mCerts.find(id)))
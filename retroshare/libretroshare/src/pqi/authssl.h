@@ -25,6 +25,7 @@
 
 #include <openssl/evp.h>
 #include <openssl/x509.h>
+#include <openssl/ssl.h>
 
 #include <string>
 #include <map>
@@ -34,6 +35,7 @@
 #include "pqi/pqinetwork.h"
 #include "pqi/p3cfgmgr.h"
 #include "util/rsmemory.h"
+#include "util/rstime.h"
 #include "retroshare/rsevents.h"
 #include "retroshare/rsinit.h"
 
@@ -141,6 +143,36 @@ public:
 	 */
 	virtual int VerifyX509Callback(int preverify_ok, X509_STORE_CTX* ctx) = 0;
 
+	/**
+	 * @brief Authenticate the peer of a resumed TLS session
+	 * OpenSSL does not call VerifyX509Callback when a session is resumed, so
+	 * this does the same checks on the peer certificate stored in the session
+	 * and must be called once the handshake is done if SSL_session_reused().
+	 * Emits @see RsAuthSslConnectionAutenticationEvent.
+	 * @param ssl connection which handshake has completed
+	 * @return true if the peer is still accepted, false otherwise
+	 */
+	virtual bool VerifyResumedSession(SSL* ssl) = 0;
+
+	/**
+	 * @brief Offer the session of the last connection to this peer
+	 * To be called on client side, before the handshake starts.
+	 * @param ssl connection to the peer
+	 * @param peerId id of the peer the connection is for
+	 * @return true if a session was set, false if a full handshake is needed
+	 */
+	virtual bool setResumableSession(SSL* ssl, const RsPeerId& peerId) = 0;
+
+	/**
+	 * @brief Forget what is kept about a location to speed up handshakes
+	 * To be called when the location is not a friend anymore, so that its
+	 * session is not resumed and its certificate is checked again if it
+	 * becomes a friend again. Does nothing by default, for implementations
+	 * that keep nothing.
+	 * @param sslId id of the location
+	 */
+	virtual void forgetPeer(const RsPeerId& /*sslId*/) {}
+
 	/// SSL specific functions used in pqissl/pqissllistener
 	virtual SSL_CTX* getCTX() = 0;
 
@@ -162,6 +194,43 @@ protected:
 };
 
 
+/**
+ * Certificates which PGP signature was already checked, so that it is not
+ * checked again at each connection, see AuthSSLimpl::AuthX509WithGPG.
+ * When full, the least recently used certificate is dropped.
+ * Not thread safe, AuthSSLimpl protects it with its handshake cache mutex.
+ */
+class AuthenticatedCertCache
+{
+public:
+	explicit AuthenticatedCertCache(uint32_t maxSize);
+
+	/// The fingerprint is checked too, in case the issuer key has changed
+	bool find(const Sha256CheckSum& digest, const RsPgpFingerprint& fpr);
+
+	void add( const Sha256CheckSum& digest, const RsPgpFingerprint& fpr,
+	          const RsPeerId& sslId );
+
+	/// @return the number of certificates of this location that were removed
+	uint32_t removePeer(const RsPeerId& sslId);
+
+	void clear();
+	uint32_t size() const { return mCerts.size(); }
+
+private:
+	struct Entry
+	{
+		RsPgpFingerprint fpr;
+		RsPeerId sslId;
+		uint64_t lastUsed;
+	};
+
+	std::map<Sha256CheckSum, Entry> mCerts;
+	uint32_t mMaxSize;
+	uint64_t mUseCount;	/* orders the uses, time() is too coarse */
+};
+
+
 class AuthSSLimpl : public AuthSSL, public p3Config
 {
 public:
@@ -214,6 +283,18 @@ public:
 	/// @see AuthSSL
 	int VerifyX509Callback(int preverify_ok, X509_STORE_CTX *ctx) override;
 
+	/// @see AuthSSL
+	bool VerifyResumedSession(SSL* ssl) override;
+
+	/// @see AuthSSL
+	bool setResumableSession(SSL* ssl, const RsPeerId& peerId) override;
+
+	/// @see AuthSSL
+	void forgetPeer(const RsPeerId& sslId) override;
+
+	/// Keeps the new client side sessions, called by OpenSSL.
+	bool storeResumableSession(SSL* ssl, SSL_SESSION* session);
+
 	/// @see AuthSSL
 	bool parseX509DetailsFromFile(
 	        const std::string& certFilePath, RsPeerId& certId,
@@ -237,6 +318,11 @@ private:
 	bool LocalStoreCert(X509* x509);
 	bool RemoveX509(const RsPeerId id);
 
+	/// Checks shared by VerifyX509Callback and VerifyResumedSession.
+	bool verifyPeerCertificate(X509* x509Cert);
+
+	void clearHandshakeCache();
+
 	/*********** LOCKED Functions ******/
 	bool locked_FindCert(const RsPeerId& id, X509** cert);
 
@@ -265,4 +351,11 @@ private:
 	RsPgpId _last_gpgid_to_connect;
 	std::string _last_sslcn_to_connect;
 	RsPeerId _last_sslid_to_connect;
+
+	/* The handshake cache has its own mutex, as it is used from the handshake
+	 * threads while sslMtx may be held for signing. */
+	RsMutex mHandshakeCacheMtx;	/* protects all below */
+
+	AuthenticatedCertCache mAuthenticatedCerts;
+	std::map<RsPeerId, SSL_SESSION*> mResumableSessions;
 };
@@ -40,7 +40,7 @@
 
 p3ConfigMgr::p3ConfigMgr(std::string dir)
         :basedir(dir), cfgMtx("p3ConfigMgr"),
-	mConfigSaveActive(true)
+	mConfigSaveActive(true), mLoadInProgress(false)
 {
 }
 
@@ -75,6 +75,10 @@ void p3ConfigMgr::saveConfig(CheckPriority t)
 
 	RsStackMutex stack(cfgMtx);  /***** LOCK STACK MUTEX ****/
 
+	// configs may be loading on another thread, and would be saved half loaded.
+	if(mLoadInProgress)
+		return;
+
 	std::list<pqiConfig *>::iterator it;
 	for(it = mConfigs.begin(); it != mConfigs.end(); ++it)
         if ((*it)->HasConfigChanged(t))
@@ -91,32 +95,116 @@ void p3ConfigMgr::saveConfig(CheckPriority t)
 
 void p3ConfigMgr::loadConfiguration()
 {
-	loadConfig();
+	if(!mLoadScheduler)
+		loadConfig();
 
-	return;
+	mLoadScheduler->waitAll() ;
+	mLoadScheduler.reset() ;
+
+	RsStackMutex stack(cfgMtx); /***** LOCK STACK MUTEX ****/
+
+	mLoadedConfigs.clear() ;
+	mLoadInProgress = false ;
+}
+
+void p3ConfigMgr::loadConfiguration(const std::list<std::string>& first, std::list<pqiConfig *>& pending)
+{
+	if(!mLoadScheduler)
+		loadConfig();
+
+	// Waiting also loads the configs that are ready before, in particular the
+	// ones registered before those of first. Configs that are not compiled in
+	// are unknown to the scheduler.
+
+	for(const std::string& name : first)
+		mLoadScheduler->wait("load " + name) ;
+
+	pending.clear() ;
+
+	RsStackMutex stack(cfgMtx); /***** LOCK STACK MUTEX ****/
+
+	for(pqiConfig *cfg : mConfigs)
+		if(mLoadedConfigs.find(cfg) == mLoadedConfigs.end())
+			pending.push_back(cfg) ;
 }
 
 void p3ConfigMgr::loadConfig()
 {
+	// Reading, decrypting and checking the signature of the config files does
+	// not depend on the services, so all files are prepared in parallel. The
+	// items are then given to each service by the loading thread, once its file
+	// is ready and the configs its loadList() relies on are loaded: the ones it
+	// declared, or else all configs registered before it (friends list before
+	// services, etc).
+
+	{
+		RsStackMutex stack(cfgMtx); /***** LOCK STACK MUTEX ****/
+		mLoadInProgress = true ;
+	}
+
+	mLoadScheduler.reset(new RsStartupScheduler) ;
+	RsStartupScheduler& scheduler(*mLoadScheduler) ;
 	std::list<pqiConfig *>::iterator cit;
-	RsFileHash dummyHash ;
+
+	std::set<std::string> names ;
+	for (cit = mConfigs.begin(); cit != mConfigs.end(); ++cit)
+		names.insert(RsDirUtil::getTopDir((*cit)->Filename())) ;
+
+	std::string previous ;	// last config loaded in registration order
+
 	for (cit = mConfigs.begin(); cit != mConfigs.end(); ++cit)
 	{
+		pqiConfig *cfg = *cit ;
+		std::string name = RsDirUtil::getTopDir(cfg->Filename()) ;
+
+		std::list<std::string> deps(1, "read " + name) ;
+
+		// Configs that declared their dependencies still load after the
+		// undeclared configs registered before them, which they may use
+		// without saying (peers, general config...).
+
+		if(!previous.empty())
+			deps.push_back("load " + previous) ;
+
+		std::map<pqiConfig *, std::list<std::string> >::const_iterator dit = mConfigDeps.find(cfg) ;
+
+		if(dit == mConfigDeps.end())
+			previous = name ;
+		else
+			for(const std::string& dep : dit->second)
+				if(names.find(dep) != names.end())	// may not be compiled in
+					deps.push_back("load " + dep) ;
+
 #ifdef CONFIG_DEBUG
-		std::cerr << "p3ConfigMgr::loadConfig() Element: ";
-		std::cerr << *cit <<" Dummy Hash: " << dummyHash;
+		std::cerr << "p3ConfigMgr::loadConfig() Element: " << name << " after:";
+		for(const std::string& dep : deps)
+			std::cerr << " \"" << dep << "\"";
 		std::cerr << std::endl;
 #endif
+		scheduler.addTask("read " + name, [cfg]() { cfg->prepareLoad(); }) ;
+		scheduler.addWaiterTask("load " + name, [this,cfg]()
+		{
+			RsFileHash dummyHash ;
+			cfg->loadConfiguration(dummyHash);
 
-		(*cit)->loadConfiguration(dummyHash);
+			/* force config to NOT CHANGED */
+			cfg->resetChanges();
 
-		/* force config to NOT CHANGED */
-        (*cit)->resetChanges();
+			RsStackMutex stack(cfgMtx); /***** LOCK STACK MUTEX ****/
+			mLoadedConfigs.insert(cfg) ;
+		}, deps) ;
 	}
-
-	return;
 }
 
+void	p3ConfigMgr::addConfiguration(std::string file, pqiConfig *conf, const std::list<std::string>& deps)
+{
+	addConfiguration(file, conf) ;
+
+	RsStackMutex stack(cfgMtx); /***** LOCK STACK MUTEX ****/
+
+	if(std::find(mConfigs.begin(),mConfigs.end(),conf) != mConfigs.end())
+		mConfigDeps[conf] = deps ;
+}
 
 void	p3ConfigMgr::addConfiguration(std::string file, pqiConfig *conf)
 {
@@ -148,6 +236,7 @@ void	p3ConfigMgr::addConfiguration(std::string file, pqiConfig *conf)
 		if((*it)->filename == filename)
 		{
 			std::cerr << "(WW) Registering a config for file \"" << filename << "\" that is already registered. Replacing previous component." << std::endl;
+			mConfigDeps.erase(*it);
 			it = mConfigs.erase(it);
 		}
 		else
@@ -169,7 +258,7 @@ void    p3ConfigMgr::completeConfiguration()
 
 
 p3Config::p3Config()
-	:pqiConfig()
+	:pqiConfig(), mLoadPrepared(false), mPreparedLoadOk(false)
 {
 	return;
 }
@@ -180,7 +269,7 @@ bool p3Config::loadConfiguration(RsFileHash& /* loadHash */)
 	return loadConfig();
 }
 
-bool p3Config::loadConfig()
+bool p3Config::readConfigFiles(std::list<RsItem *>& load)
 {
 
 #ifdef CONFIG_DEBUG
@@ -194,7 +283,6 @@ bool p3Config::loadConfig()
 	std::string signFname = Filename() +".sgn";
 	std::string signFnameBackup = signFname + ".tmp";
 
-	std::list<RsItem *> load;
 	std::list<RsItem *>::iterator it;
 
 	// try 1st attempt
@@ -238,6 +326,37 @@ bool p3Config::loadConfig()
 
 
 
+	return pass;
+}
+
+void p3Config::prepareLoad()
+{
+	std::list<RsItem *> load;
+	bool pass = readConfigFiles(load);
+
+	RsStackMutex stack(cfgMtx); /***** LOCK STACK MUTEX ****/
+	mPreparedLoad.swap(load);
+	mPreparedLoadOk = pass;
+	mLoadPrepared = true;
+}
+
+bool p3Config::loadConfig()
+{
+	std::list<RsItem *> load;
+	bool pass;
+	bool prepared;
+
+	{
+		RsStackMutex stack(cfgMtx); /***** LOCK STACK MUTEX ****/
+		prepared = mLoadPrepared;
+		mLoadPrepared = false;
+		load.swap(mPreparedLoad);
+		pass = mPreparedLoadOk;
+	}
+
+	if(!prepared)
+		pass = readConfigFiles(load);
+
 	if(pass)
 		loadList(load);
 	else
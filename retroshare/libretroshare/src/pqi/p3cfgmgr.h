@@ -25,11 +25,13 @@
 #include <string>
 #include <map>
 #include <set>
+#include <memory>
 
 #include "pqi/pqi_base.h"
 #include "pqi/pqiindic.h"
 #include "pqi/pqinetwork.h"
 #include "util/rsthreads.h"
+#include "util/rsstartup.h"
 #include "pqi/pqibin.h"
 #include "retroshare/rsconfig.h"
 
@@ -81,6 +83,14 @@ public:
      */
     virtual bool	loadConfiguration(RsFileHash &loadHash) = 0;
 
+    /**
+     * Does the part of the loading that does not touch the object itself
+     * (reading, decrypting and checking the config file), so that it can be
+     * run in parallel for all configs, before loadConfiguration() is called.
+     * Default is to do everything in loadConfiguration().
+     */
+    virtual void	prepareLoad() {}
+
     /**
      * save configuration of object
      */
@@ -170,16 +180,37 @@ class p3ConfigMgr: public RsConfigMgr
         void	saveConfiguration();
 
         /**
-         * loads all configurations
+         * loads all configurations, or the ones not loaded yet by the call
+         * below
          */
         void	loadConfiguration();
 
+        /**
+         * Starts loading all configurations, and returns once the ones in
+         * first (file names as given to addConfiguration()) and the ones they
+         * rely on are loaded. The other files keep being read meanwhile, and
+         * are loaded by the next call to loadConfiguration(). Configs are not
+         * saved until then.
+         * @param first configs to load now
+         * @param pending the configs that are not loaded yet
+         */
+        void	loadConfiguration(const std::list<std::string>& first, std::list<pqiConfig *>& pending);
+
         /**
          * @param file The name for new configuration
          * @param conf to the configuration to use
          */
         void	addConfiguration(std::string file, pqiConfig *conf);
 
+        /**
+         * Same as above, for a config which loadList() relies on the configs
+         * in deps (file names as given to addConfiguration()), wherever they
+         * were added. It is loaded after them and after the configs added
+         * before it without deps, but not after the ones added with deps.
+         * @param deps configs which must be loaded before this one
+         */
+        void	addConfiguration(std::string file, pqiConfig *conf, const std::list<std::string>& deps);
+
 		/** saves config, and disables further saving
 		 * used for exiting the system
 		 */
@@ -195,7 +226,8 @@ class p3ConfigMgr: public RsConfigMgr
         void saveConfig(CheckPriority t);
 
 		/**
-		 *
+		 * starts reading all configs. Each one is given its items once read,
+		 * by the thread that waits for mLoadScheduler.
 		 */
 		void loadConfig();
 
@@ -205,6 +237,11 @@ class p3ConfigMgr: public RsConfigMgr
 
 	bool	mConfigSaveActive;
 	std::list<pqiConfig *> mConfigs;
+	std::map<pqiConfig *, std::list<std::string> > mConfigDeps;	// declared dependencies, when given
+
+	std::unique_ptr<RsStartupScheduler> mLoadScheduler;	// only used by the loading thread
+	std::set<pqiConfig *> mLoadedConfigs;
+	bool	mLoadInProgress;
 };
 
 
@@ -225,6 +262,10 @@ public:
 	virtual bool loadConfiguration(RsFileHash &loadHash);
 	virtual bool saveConfiguration();
 
+	/// Reads and decrypts the config file, in any thread. The items are given
+	/// to loadList() by the next call to loadConfiguration().
+	virtual void prepareLoad();
+
 protected:
 
 	/// Key Functions to be overloaded for Full Configuration
@@ -259,6 +300,11 @@ private:
 
 	bool loadAttempt( const std::string&, const std::string&,
 	                  std::list<RsItem *>& load );
+	bool readConfigFiles(std::list<RsItem *>& load);
+
+	bool mLoadPrepared;
+	bool mPreparedLoadOk;
+	std::list<RsItem *> mPreparedLoad;
 }; // end of p3Config
 
 
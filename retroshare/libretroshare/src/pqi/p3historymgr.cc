@@ -29,6 +29,8 @@
 #include "rsitems/rsmsgitems.h"
 #include "rsserver/p3face.h"
 #include "util/rsstring.h"
+#include "util/rsprint.h"
+#include "util/rsrandom.h"
 
 /****
  * #define HISTMGR_DEBUG 1
@@ -40,9 +42,9 @@
 
 RsHistory *rsHistory = NULL;
 
-p3HistoryMgr::p3HistoryMgr()
+p3HistoryMgr::p3HistoryMgr(const std::string& history_dir)
     : p3Config()
-    , nextMsgId(1)
+    , mStore(history_dir)
     , mPublicEnable(false), mLobbyEnable(true), mPrivateEnable(true), mDistantEnable(true)
     , mPublicSaveCount(0), mLobbySaveCount(0), mPrivateSaveCount(0), mDistantSaveCount(0)
     , mMaxStorageDurationSeconds(10*86400) // store for 10 days at most.
@@ -57,6 +59,20 @@ p3HistoryMgr::~p3HistoryMgr()
 
 /***** p3HistoryMgr *****/
 
+void p3HistoryMgr::checkStoreKey()
+{
+	if(mStore.hasEncryptionKey())
+		return;
+
+	uint8_t key[p3HistoryStore::ENCRYPTION_KEY_SIZE];
+	RsRandom::random_bytes(key, p3HistoryStore::ENCRYPTION_KEY_SIZE);
+	mStore.setEncryptionKey(key);
+	memset(key, 0, p3HistoryStore::ENCRYPTION_KEY_SIZE);
+
+	// without the key the stored history cannot be read back.
+	IndicateConfigChanged(RsConfigMgr::CheckPriority::SAVE_NOW);
+}
+
 void p3HistoryMgr::addMessage(const ChatMessage& cm)
 {
 	uint32_t addMsgId = 0;
@@ -130,10 +146,9 @@ void p3HistoryMgr::addMessage(const ChatMessage& cm)
 		item->message = cm.msg ;
 		//librs::util::ConvertUtf16ToUtf8(chatItem->message, item->message);
 
-		std::map<RsPeerId, std::map<uint32_t, RsHistoryMsgItem*> >::iterator mit = mMessages.find(item->chatPeerId);
-		if (mit != mMessages.end()) {
-			item->msgId = nextMsgId++;
-			mit->second.insert(std::make_pair(item->msgId, item));
+		checkStoreKey();
+
+		if (mStore.addMessage(item)) {
 			addMsgId = item->msgId;
 
 			// check the limit
@@ -145,23 +160,11 @@ void p3HistoryMgr::addMessage(const ChatMessage& cm)
 			else 
 				limit = mPrivateSaveCount;
 
-			if (limit) {
-				while (mit->second.size() > limit) {
-					delete(mit->second.begin()->second);
-					mit->second.erase(mit->second.begin());
-				}
-			}
-		} else {
-			std::map<uint32_t, RsHistoryMsgItem*> msgs;
-			item->msgId = nextMsgId++;
-			msgs.insert(std::make_pair(item->msgId, item));
-			mMessages.insert(std::make_pair(item->chatPeerId, msgs));
-			addMsgId = item->msgId;
-
-			// no need to check the limit
+			if (limit)
+				mStore.keepLastMessages(chatPeerId, limit);
 		}
 
-        IndicateConfigChanged(RsConfigMgr::CheckPriority::SAVE_OFTEN);
+		delete item;
 	}
 
 	if (addMsgId) {
@@ -176,52 +179,10 @@ void p3HistoryMgr::cleanOldMessages()
 #ifdef HISTMGR_DEBUG
 	std::cerr << "****** cleaning old messages." << std::endl;
 #endif
-	rstime_t now = time(NULL) ;
-	bool changed = false ;
-
-	for(std::map<RsPeerId, std::map<uint32_t, RsHistoryMsgItem*> >::iterator mit = mMessages.begin(); mit != mMessages.end();) 
-	{
-		if (mMaxStorageDurationSeconds > 0)
-		{
-			for(std::map<uint32_t, RsHistoryMsgItem*>::iterator lit = mit->second.begin();lit!=mit->second.end();)
-				if(lit->second->recvTime + mMaxStorageDurationSeconds < now)
-				{
-					std::map<uint32_t, RsHistoryMsgItem*>::iterator lit2 = lit ;
-					++lit2 ;
-
-#ifdef HISTMGR_DEBUG
-					std::cerr << "   removing msg id " << lit->first << ", for peer id " << mit->first << std::endl;
-#endif
-					delete lit->second ;
-
-					mit->second.erase(lit) ;
-					lit = lit2 ;
-
-					changed = true ;
-				}
-				else
-					++lit ;
-		}
-
-		if(mit->second.empty())
-		{
-			std::map<RsPeerId, std::map<uint32_t, RsHistoryMsgItem*> >::iterator mit2 = mit ;
-			++mit2 ;
-#ifdef HISTMGR_DEBUG
-			std::cerr << "   removing peer id " << mit->first << ", since it has no messages" << std::endl;
-#endif
-			mMessages.erase(mit) ;
-			mit = mit2 ;
-
-			changed = true ;
-		}
-		else
-			++mit ;
-	}
-
-	if(changed)
-        IndicateConfigChanged(RsConfigMgr::CheckPriority::SAVE_OFTEN);
+	// Only whole segments are removed from disk. See p3HistoryStore.
 
+	if (mMaxStorageDurationSeconds > 0)
+		mStore.removeOlderThan(time(NULL) - mMaxStorageDurationSeconds) ;
 }
 
 /***** p3Config *****/
@@ -241,19 +202,18 @@ bool p3HistoryMgr::saveList(bool& cleanup, std::list<RsItem*>& saveData)
 
 	mHistoryMtx.lock(); /********** STACK LOCKED MTX ******/
 
-	std::map<RsPeerId, std::map<uint32_t, RsHistoryMsgItem*> >::iterator mit;
-	std::map<uint32_t, RsHistoryMsgItem*>::iterator lit;
-	for (mit = mMessages.begin(); mit != mMessages.end(); ++mit) {
-		for (lit = mit->second.begin(); lit != mit->second.end(); ++lit) {
-			if (lit->second->saveToDisc) {
-				saveData.push_back(lit->second);
-			}
-		}
-	}
-
 	RsConfigKeyValueSet *vitem = new RsConfigKeyValueSet;
 
 	RsTlvKeyValue kv;
+
+	uint8_t key[p3HistoryStore::ENCRYPTION_KEY_SIZE];
+	if (mStore.getEncryptionKey(key)) {
+		kv.key = "STORE_KEY";
+		kv.value = RsUtil::BinToHex(key, p3HistoryStore::ENCRYPTION_KEY_SIZE);
+		vitem->tlvkvs.pairs.push_back(kv);
+		memset(key, 0, p3HistoryStore::ENCRYPTION_KEY_SIZE);
+	}
+
 	kv.key = "PUBLIC_ENABLE";
 	kv.value = mPublicEnable ? "TRUE" : "FALSE";
 	vitem->tlvkvs.pairs.push_back(kv);
@@ -315,35 +275,33 @@ bool p3HistoryMgr::loadList(std::list<RsItem*>& load)
 	RsStackMutex stack(mHistoryMtx); /********** STACK LOCKED MTX ******/
 
 	RsHistoryMsgItem *msgItem;
+	std::list<RsHistoryMsgItem*> oldMsgItems;
 	std::list<RsItem*>::iterator it;
 
 	for (it = load.begin(); it != load.end(); ++it) 
    	 {
 		if (NULL != (msgItem = dynamic_cast<RsHistoryMsgItem*>(*it))) {
+			// Older versions kept the messages in the config file. They are
+			// moved to the store once the key is known.
 
-			std::map<RsPeerId, std::map<uint32_t, RsHistoryMsgItem*> >::iterator mit = mMessages.find(msgItem->chatPeerId);
-			msgItem->msgId = nextMsgId++;
-
-#ifdef HISTMGR_DEBUG
-			std::cerr << "Loading msg history item: peer id=" << msgItem->chatPeerId << "), msg id =" << msgItem->msgId  << std::endl;
-#endif
-
-			if (mit != mMessages.end()) {
-				mit->second.insert(std::make_pair(msgItem->msgId, msgItem));
-			} else {
-				std::map<uint32_t, RsHistoryMsgItem*> msgs;
-				msgs.insert(std::make_pair(msgItem->msgId, msgItem));
-				mMessages.insert(std::make_pair(msgItem->chatPeerId, msgs));
-			}
-
-			// don't delete the item !!
-
+			oldMsgItems.push_back(msgItem);
 			continue;
 		}
 
 		RsConfigKeyValueSet *rskv ;
 		if (NULL != (rskv = dynamic_cast<RsConfigKeyValueSet*>(*it))) {
 			for (std::list<RsTlvKeyValue>::const_iterator kit = rskv->tlvkvs.pairs.begin(); kit != rskv->tlvkvs.pairs.end(); ++kit) {
+				if (kit->key == "STORE_KEY") {
+					uint8_t key[p3HistoryStore::ENCRYPTION_KEY_SIZE];
+					if (RsUtil::HexToBin(kit->value, key, p3HistoryStore::ENCRYPTION_KEY_SIZE))
+						mStore.setEncryptionKey(key);
+					else
+						std::cerr << "(EE) p3HistoryMgr: cannot read the history store key. Stored history will not be readable." << std::endl;
+
+					memset(key, 0, p3HistoryStore::ENCRYPTION_KEY_SIZE);
+					continue;
+				}
+
 				if (kit->key == "PUBLIC_ENABLE") {
 					mPublicEnable = (kit->value == "TRUE") ? true : false;
 					continue;
@@ -402,6 +360,25 @@ bool p3HistoryMgr::loadList(std::list<RsItem*>& load)
 	}
 
     load.clear() ;
+
+	if (!oldMsgItems.empty())
+	{
+		std::cerr << "p3HistoryMgr: moving " << oldMsgItems.size() << " history messages from the config file to the history store." << std::endl;
+
+		checkStoreKey();
+
+		for (std::list<RsHistoryMsgItem*>::iterator mit = oldMsgItems.begin(); mit != oldMsgItems.end(); ++mit) {
+#ifdef HISTMGR_DEBUG
+			std::cerr << "Migrating msg history item: peer id=" << (*mit)->chatPeerId << std::endl;
+#endif
+			mStore.addMessage(*mit);
+			delete (*mit);
+		}
+
+		// next save drops them from the config file
+		IndicateConfigChanged(RsConfigMgr::CheckPriority::SAVE_NOW);
+	}
+
 	return true;
 }
 
@@ -482,24 +459,15 @@ bool p3HistoryMgr::getMessages(const ChatId &chatId, std::list<HistoryMsg> &msgs
     std::cerr << "Getting history for virtual peer " << chatPeerId << std::endl;
 #endif
 
-	uint32_t foundCount = 0;
-
-	std::map<RsPeerId, std::map<uint32_t, RsHistoryMsgItem*> >::iterator mit = mMessages.find(chatPeerId);
+	std::list<RsHistoryMsgItem*> items;
+	mStore.getLastMessages(chatPeerId, loadCount, items);
 
-	if (mit != mMessages.end()) 
+	for (std::list<RsHistoryMsgItem*>::iterator lit = items.begin(); lit != items.end(); ++lit)
 	{
-		std::map<uint32_t, RsHistoryMsgItem*>::reverse_iterator lit;
-
-		for (lit = mit->second.rbegin(); lit != mit->second.rend(); ++lit)
-		{
-			HistoryMsg msg;
-			convertMsg(lit->second, msg);
-			msgs.insert(msgs.begin(), msg);
-			foundCount++;
-			if (loadCount && foundCount >= loadCount) {
-				break;
-			}
-		}
+		HistoryMsg msg;
+		convertMsg(*lit, msg);
+		msgs.push_back(msg);
+		delete (*lit);
 	}
 #ifdef HISTMGR_DEBUG
 	std::cerr << msgs.size() << " messages added." << std::endl;
@@ -512,16 +480,15 @@ bool p3HistoryMgr::getMessage(uint32_t msgId, HistoryMsg &msg)
 {
 	RsStackMutex stack(mHistoryMtx); /********** STACK LOCKED MTX ******/
 
-	std::map<RsPeerId, std::map<uint32_t, RsHistoryMsgItem*> >::iterator mit;
-	for (mit = mMessages.begin(); mit != mMessages.end(); ++mit) {
-		std::map<uint32_t, RsHistoryMsgItem*>::iterator lit = mit->second.find(msgId);
-		if (lit != mit->second.end()) {
-			convertMsg(lit->second, msg);
-			return true;
-		}
-	}
+	RsHistoryMsgItem *item = mStore.getMessage(msgId);
+
+	if (item == NULL)
+		return false;
+
+	convertMsg(item, msg);
+	delete item;
 
-	return false;
+	return true;
 }
 
 void p3HistoryMgr::clear(const ChatId &chatId)
@@ -537,19 +504,9 @@ void p3HistoryMgr::clear(const ChatId &chatId)
         std::cerr << "********** p3History::clear()called for virtual peer id " << chatPeerId << std::endl;
 #endif
 
-		std::map<RsPeerId, std::map<uint32_t, RsHistoryMsgItem*> >::iterator mit = mMessages.find(chatPeerId);
-		if (mit == mMessages.end()) {
+		if (!mStore.clearChat(chatPeerId)) {
 			return;
 		}
-
-		std::map<uint32_t, RsHistoryMsgItem*>::iterator lit;
-		for (lit = mit->second.begin(); lit != mit->second.end(); ++lit) {
-			delete(lit->second);
-		}
-		mit->second.clear();
-		mMessages.erase(mit);
-
-        IndicateConfigChanged(RsConfigMgr::CheckPriority::SAVE_OFTEN);
     }
 
 	RsServer::notify()->notifyHistoryChanged(0, NOTIFY_TYPE_MOD);
@@ -557,7 +514,6 @@ void p3HistoryMgr::clear(const ChatId &chatId)
 
 void p3HistoryMgr::removeMessages(const std::list<uint32_t> &msgIds)
 {
-	std::list<uint32_t> ids = msgIds;
 	std::list<uint32_t> removedIds;
 	std::list<uint32_t>::iterator iit;
 
@@ -567,37 +523,11 @@ void p3HistoryMgr::removeMessages(const std::list<uint32_t> &msgIds)
 	{
 		RsStackMutex stack(mHistoryMtx); /********** STACK LOCKED MTX ******/
 
-		std::map<RsPeerId, std::map<uint32_t, RsHistoryMsgItem*> >::iterator mit;
-		for (mit = mMessages.begin(); mit != mMessages.end(); ++mit)
-		{
-			iit = ids.begin();
-			while ( !ids.empty() || (iit != ids.end()) )
-			{
-				std::map<uint32_t, RsHistoryMsgItem*>::iterator lit = mit->second.find(*iit);
-				if (lit != mit->second.end())
-				{
-#ifdef HISTMGR_DEBUG
-					std::cerr << "**** Removing " << mit->first << " msg id = " << lit->first << std::endl;
-#endif
-
-					delete(lit->second);
-					mit->second.erase(lit);
-
-					removedIds.push_back(*iit);
-					iit = ids.erase(iit);
-
-					continue;
-				}
-
-				++iit;
-			}
-		}
+		mStore.removeMessages(msgIds, removedIds);
 	}
 
 	if (!removedIds.empty())
 	{
-        IndicateConfigChanged(RsConfigMgr::CheckPriority::SAVE_OFTEN);
-
 		for (iit = removedIds.begin(); iit != removedIds.end(); ++iit)
 			RsServer::notify()->notifyHistoryChanged(*iit, NOTIFY_TYPE_DEL);
 	}
@@ -28,6 +28,7 @@
 #include "rsitems/rshistoryitems.h"
 #include "retroshare/rshistory.h"
 #include "pqi/p3cfgmgr.h"
+#include "pqi/p3historystore.h"
 
 class RsChatMsgItem;
 class ChatMessage;
@@ -35,12 +36,14 @@ class ChatMessage;
 //! handles history
 /*!
  * The is a retroshare service which allows peers
- * to store the history of the chat messages
+ * to store the history of the chat messages.
+ * Messages are kept in a p3HistoryStore, outside of the config file, which
+ * only holds the settings and the key the store is encrypted with.
  */
 class p3HistoryMgr: public p3Config
 {
 public:
-	p3HistoryMgr();
+	p3HistoryMgr(const std::string& history_dir);
 	virtual ~p3HistoryMgr();
 
 	/******** p3HistoryMgr *********/
@@ -71,8 +74,10 @@ public:
 	static bool chatIdToVirtualPeerId(const ChatId& chat_id, RsPeerId& peer_id);
 
 private:
-	uint32_t nextMsgId;
-	std::map<RsPeerId, std::map<uint32_t, RsHistoryMsgItem*> > mMessages;
+	p3HistoryStore mStore;
+
+	// Creates the key of the store the first time history is written.
+	void checkStoreKey();
 
 	// Removes messages stored for more than mMaxMsgStorageDurationSeconds seconds.
 	// This avoids the stored list to grow crazy with time.
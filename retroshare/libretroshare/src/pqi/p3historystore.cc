@@ -0,0 +1,948 @@
+/*******************************************************************************
+ * libretroshare/src/pqi: p3historystore.cc                                    *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <algorithm>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "pqi/p3historystore.h"
+#include "crypto/rscrypto.h"
+#include "util/rsdir.h"
+#include "util/rsprint.h"
+#include "util/folderiterator.h"
+
+/****
+ * #define HISTSTORE_DEBUG 1
+ ***/
+
+// Segment files start with a 4 bytes magic, a 4 bytes version and the
+// encrypted day of the segment. Records are an encrypted header, holding the
+// payload size, the item size and the receive time, followed by the encrypted
+// item, padded to a multiple of HISTORY_RECORD_PADDING. All integers are in
+// network order.
+//
+// Directory and segment names are the first bytes of a HMAC of the chat id
+// (resp. of the directory name and the day), keyed with a key derived from
+// the store key.
+
+static const uint8_t  HISTORY_SEGMENT_MAGIC[4]    = { 'R', 'S', 'H', 'S' };
+static const uint32_t HISTORY_SEGMENT_VERSION     = 1;
+static const uint32_t HISTORY_ENCRYPTION_OVERHEAD = 36;		// format, IV, size and tag added by encryptAuthenticateData()
+static const uint32_t HISTORY_SEGMENT_HEADER_SIZE = 8 + 4 + HISTORY_ENCRYPTION_OVERHEAD;
+static const uint32_t HISTORY_RECORD_HEADER_SIZE  = 12 + HISTORY_ENCRYPTION_OVERHEAD;
+static const uint32_t HISTORY_RECORD_PADDING      = 128;
+static const uint32_t HISTORY_MAX_RECORD_SIZE     = 1024*1024;	// chat messages are much smaller anyway
+static const uint32_t HISTORY_NAME_SIZE           = 16;		// bytes of HMAC in file names
+
+static const std::string HISTORY_NAME_KEY_LABEL   = "RetroShare history store file names";
+
+static const std::string HISTORY_SEGMENT_EXT = ".hseg";
+static const std::string HISTORY_TMP_EXT     = ".tmp";
+
+static void putUInt32(uint8_t *p, uint32_t v)
+{
+	p[0] = (v >> 24) & 0xff;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >>  8) & 0xff;
+	p[3] =  v        & 0xff;
+}
+
+static uint32_t getUInt32(const uint8_t *p)
+{
+	return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static bool endsWith(const std::string& s, const std::string& ext)
+{
+	return s.length() >= ext.length() && s.compare(s.length() - ext.length(), ext.length(), ext) == 0;
+}
+
+static bool isName(const std::string& name)
+{
+	if(name.length() != 2*HISTORY_NAME_SIZE)
+		return false;
+
+	for(size_t i=0;i<name.length();++i)
+		if(!isxdigit(name[i]))
+			return false;
+
+	return true;
+}
+
+static std::string keyedName(const uint8_t *key, const uint8_t *data, uint32_t size)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_size = 0;
+
+	if(!HMAC(EVP_sha256(), key, p3HistoryStore::ENCRYPTION_KEY_SIZE, data, size, md, &md_size) || md_size < HISTORY_NAME_SIZE)
+		return std::string();
+
+	return RsUtil::BinToHex(md, HISTORY_NAME_SIZE);
+}
+
+p3HistoryStore::p3HistoryStore(const std::string& directory)
+    : mDirectory(directory), mInitialised(false), mHasKey(false), mNextMsgId(1), mMinRecvTime(0)
+{
+	memset(mKey, 0, ENCRYPTION_KEY_SIZE);
+	memset(mNameKey, 0, ENCRYPTION_KEY_SIZE);
+}
+
+p3HistoryStore::~p3HistoryStore()
+{
+	memset(mKey, 0, ENCRYPTION_KEY_SIZE);
+	memset(mNameKey, 0, ENCRYPTION_KEY_SIZE);
+}
+
+void p3HistoryStore::setEncryptionKey(const uint8_t key[ENCRYPTION_KEY_SIZE])
+{
+	memcpy(mKey, key, ENCRYPTION_KEY_SIZE);
+
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_size = 0;
+
+	HMAC(EVP_sha256(), mKey, ENCRYPTION_KEY_SIZE, (const unsigned char*)HISTORY_NAME_KEY_LABEL.c_str(), HISTORY_NAME_KEY_LABEL.length(), md, &md_size);
+	memcpy(mNameKey, md, ENCRYPTION_KEY_SIZE);
+	memset(md, 0, sizeof(md));
+
+	mHasKey = true;
+}
+
+bool p3HistoryStore::getEncryptionKey(uint8_t key[ENCRYPTION_KEY_SIZE]) const
+{
+	if(!mHasKey)
+		return false;
+
+	memcpy(key, mKey, ENCRYPTION_KEY_SIZE);
+	return true;
+}
+
+bool p3HistoryStore::init()
+{
+	if(mInitialised)
+		return true;
+
+	if(!RsDirUtil::checkCreateDirectory(mDirectory))
+	{
+		std::cerr << "(EE) p3HistoryStore: cannot create history directory " << mDirectory << std::endl;
+		return false;
+	}
+	mInitialised = true;
+
+	// Only the chat directories are listed here. Segments are listed and
+	// indexed on demand.
+
+	for(librs::util::FolderIterator it(mDirectory, false); it.isValid(); it.next())
+		if(it.file_type() == librs::util::FolderIterator::TYPE_DIR && isName(it.file_name()))
+			mChats[it.file_name()];
+
+#ifdef HISTSTORE_DEBUG
+	std::cerr << "p3HistoryStore: found history for " << mChats.size() << " chats in " << mDirectory << std::endl;
+#endif
+	return true;
+}
+
+bool p3HistoryStore::listChat(const std::string& chat, ChatSegments& cs)
+{
+	if(cs.listed)
+		return true;
+
+	cs.listed = true;
+
+	std::string dir = chatDirectoryPath(chat);
+
+	for(librs::util::FolderIterator it(dir, false); it.isValid(); it.next())
+	{
+		if(it.file_type() != librs::util::FolderIterator::TYPE_FILE)
+			continue;
+
+		const std::string& name = it.file_name();
+		uint32_t day;
+
+		if(endsWith(name, HISTORY_TMP_EXT))
+			RsDirUtil::removeFile(dir + "/" + name);	// left over by a rewrite that did not complete. The original segment is still there.
+		else if(!endsWith(name, HISTORY_SEGMENT_EXT))
+			continue;
+
+		// The day is only known once the segment header is decrypted. The
+		// name must then be the one of that day, so that segments cannot be
+		// moved between chats or renamed.
+
+		else if(readSegmentDay(dir + "/" + name, day) && name == segmentName(chat, day) + HISTORY_SEGMENT_EXT)
+			cs.segments[day].size = it.file_size();
+		else
+			std::cerr << "(WW) p3HistoryStore: ignoring history segment " << dir << "/" << name << ", which cannot be read with the current key." << std::endl;
+	}
+
+#ifdef HISTSTORE_DEBUG
+	std::cerr << "p3HistoryStore: found " << cs.segments.size() << " history segments for chat " << chat << std::endl;
+#endif
+	return true;
+}
+
+void p3HistoryStore::removeChat(ChatMap::iterator cit)
+{
+#ifdef HISTSTORE_DEBUG
+	std::cerr << "p3HistoryStore: removing chat " << cit->first << ", since it has no messages" << std::endl;
+#endif
+	// only removes the directory if it is empty, which it should be by now.
+	remove(chatDirectoryPath(cit->first).c_str());
+
+	mChats.erase(cit);
+}
+
+std::string p3HistoryStore::chatName(const RsPeerId& chat) const
+{
+	return keyedName(mNameKey, chat.toByteArray(), RsPeerId::SIZE_IN_BYTES);
+}
+
+std::string p3HistoryStore::segmentName(const std::string& chat, uint32_t day) const
+{
+	std::vector<uint8_t> data(chat.begin(), chat.end());
+	data.resize(chat.length() + 4);
+	putUInt32(&data[chat.length()], day);
+
+	return keyedName(mNameKey, data.data(), data.size());
+}
+
+std::string p3HistoryStore::chatDirectoryPath(const std::string& chat) const
+{
+	return mDirectory + "/" + chat;
+}
+
+std::string p3HistoryStore::segmentFilePath(const std::string& chat, uint32_t day) const
+{
+	return chatDirectoryPath(chat) + "/" + segmentName(chat, day) + HISTORY_SEGMENT_EXT;
+}
+
+std::string p3HistoryStore::chatDirectory(const RsPeerId& chat) const
+{
+	return chatDirectoryPath(chatName(chat));
+}
+
+std::string p3HistoryStore::segmentPath(const RsPeerId& chat, uint32_t day) const
+{
+	return segmentFilePath(chatName(chat), day);
+}
+
+bool p3HistoryStore::encryptBlock(const uint8_t *data, uint32_t size, std::vector<uint8_t>& out)
+{
+	unsigned char *encrypted_data = NULL;
+	uint32_t encrypted_size = 0;
+
+	if(!librs::crypto::encryptAuthenticateData(data, size, mKey, encrypted_data, encrypted_size))
+		return false;
+
+	out.assign(encrypted_data, encrypted_data + encrypted_size);
+	free(encrypted_data);
+
+	// The record and segment headers are read with a fixed size.
+	return encrypted_size == size + HISTORY_ENCRYPTION_OVERHEAD;
+}
+
+bool p3HistoryStore::decryptBlock(const uint8_t *data, uint32_t size, std::vector<uint8_t>& out)
+{
+	unsigned char *clear_data = NULL;
+	uint32_t clear_size = 0;
+
+	if(!librs::crypto::decryptAuthenticateData(data, size, mKey, clear_data, clear_size))
+		return false;
+
+	out.assign(clear_data, clear_data + clear_size);
+	memset(clear_data, 0, clear_size);
+	free(clear_data);
+
+	return true;
+}
+
+bool p3HistoryStore::readSegmentDay(const std::string& path, uint32_t& day)
+{
+	FILE *f = RsDirUtil::rs_fopen(path.c_str(), "rb");
+
+	if(!f)
+		return false;
+
+	uint8_t hdr[HISTORY_SEGMENT_HEADER_SIZE];
+	bool ok = fread(hdr, 1, HISTORY_SEGMENT_HEADER_SIZE, f) == HISTORY_SEGMENT_HEADER_SIZE
+	        && memcmp(hdr, HISTORY_SEGMENT_MAGIC, 4) == 0 && getUInt32(hdr + 4) == HISTORY_SEGMENT_VERSION;
+	fclose(f);
+
+	std::vector<uint8_t> clear;
+
+	if(!ok || !decryptBlock(hdr + 8, HISTORY_SEGMENT_HEADER_SIZE - 8, clear) || clear.size() != 4)
+		return false;
+
+	day = getUInt32(clear.data());
+	return true;
+}
+
+bool p3HistoryStore::readRecordHeader(FILE *f, RecordHeader& h)
+{
+	uint8_t hdr[HISTORY_RECORD_HEADER_SIZE];
+	std::vector<uint8_t> clear;
+
+	if(fread(hdr, 1, HISTORY_RECORD_HEADER_SIZE, f) != HISTORY_RECORD_HEADER_SIZE
+	        || !decryptBlock(hdr, HISTORY_RECORD_HEADER_SIZE, clear) || clear.size() != 12)
+		return false;
+
+	h.payloadSize = getUInt32(clear.data());
+	h.itemSize = getUInt32(clear.data() + 4);
+	h.recvTime = getUInt32(clear.data() + 8);
+
+	return h.payloadSize <= HISTORY_MAX_RECORD_SIZE && h.itemSize <= h.payloadSize;
+}
+
+void p3HistoryStore::forgetEntry(const IndexEntry& e)
+{
+	mLocations.erase(e.msgId);
+}
+
+bool p3HistoryStore::indexSegment(const std::string& chat, uint32_t day, Segment& seg)
+{
+	if(seg.indexed)
+		return true;
+
+	std::string path = segmentFilePath(chat, day);
+	FILE *f = RsDirUtil::rs_fopen(path.c_str(), "rb");
+
+	if(!f)
+	{
+		std::cerr << "(EE) p3HistoryStore: cannot open history segment " << path << std::endl;
+		return false;
+	}
+
+	uint8_t hdr[HISTORY_SEGMENT_HEADER_SIZE];
+	long file_size = 0;
+
+	if(fseek(f, 0, SEEK_END) == 0)
+		file_size = ftell(f);
+
+	if(fseek(f, 0, SEEK_SET) != 0 || fread(hdr, 1, HISTORY_SEGMENT_HEADER_SIZE, f) != HISTORY_SEGMENT_HEADER_SIZE
+	        || memcmp(hdr, HISTORY_SEGMENT_MAGIC, 4) != 0 || getUInt32(hdr + 4) != HISTORY_SEGMENT_VERSION)
+	{
+		std::cerr << "(EE) p3HistoryStore: " << path << " is not a history segment, or has an unknown version" << std::endl;
+		fclose(f);
+		return false;
+	}
+
+	seg.entries.clear();
+
+	uint32_t offset = HISTORY_SEGMENT_HEADER_SIZE;
+	bool truncated = false;
+
+	// The segment header was decrypted when the chat was listed, so the key is
+	// right: a record header that does not decrypt is a partially written one.
+
+	while(offset < file_size)
+	{
+		RecordHeader rh;
+
+		if(!readRecordHeader(f, rh) || offset + HISTORY_RECORD_HEADER_SIZE + rh.payloadSize > (uint64_t)file_size)
+		{
+			truncated = true;
+			break;
+		}
+
+		uint32_t size = rh.payloadSize;
+
+		if(rh.recvTime >= mMinRecvTime)
+		{
+			IndexEntry e;
+			e.offset = offset;
+			e.recvTime = rh.recvTime;
+			e.msgId = mNextMsgId++;
+
+			seg.entries.push_back(e);
+
+			Location& loc = mLocations[e.msgId];
+			loc.chat = chat;
+			loc.day = day;
+			loc.offset = offset;
+		}
+
+		offset += HISTORY_RECORD_HEADER_SIZE + size;
+
+		if(fseek(f, offset, SEEK_SET) != 0)
+		{
+			truncated = true;
+			break;
+		}
+	}
+	fclose(f);
+
+	seg.size = offset;
+	seg.indexed = true;
+
+#ifdef HISTSTORE_DEBUG
+	std::cerr << "p3HistoryStore: indexed " << seg.entries.size() << " records in " << path << std::endl;
+#endif
+
+	// A record was only partially written, most likely because of a crash.
+	// Rewrite the segment so that the next records are appended after the last
+	// complete one.
+
+	if(truncated)
+	{
+		std::cerr << "(WW) p3HistoryStore: history segment " << path << " is truncated. Dropping the last record." << std::endl;
+		return rewriteSegment(chat, day, seg, std::set<uint32_t>());
+	}
+
+	return true;
+}
+
+bool p3HistoryStore::rewriteSegment(const std::string& chat, uint32_t day, Segment& seg, const std::set<uint32_t>& removedIds)
+{
+	std::string path = segmentFilePath(chat, day);
+	std::string tmp_path = path + HISTORY_TMP_EXT;
+
+	FILE *in = RsDirUtil::rs_fopen(path.c_str(), "rb");
+	FILE *out = in ? RsDirUtil::rs_fopen(tmp_path.c_str(), "wb") : NULL;
+
+	if(!in || !out)
+	{
+		std::cerr << "(EE) p3HistoryStore: cannot rewrite history segment " << path << std::endl;
+		if(in)
+			fclose(in);
+		return false;
+	}
+
+	// Records are copied as they are, without being decrypted. So is the
+	// segment header, which holds the day.
+
+	uint8_t hdr[HISTORY_SEGMENT_HEADER_SIZE];
+
+	bool ok = fread(hdr, 1, HISTORY_SEGMENT_HEADER_SIZE, in) == HISTORY_SEGMENT_HEADER_SIZE
+	        && fwrite(hdr, 1, HISTORY_SEGMENT_HEADER_SIZE, out) == HISTORY_SEGMENT_HEADER_SIZE;
+	uint32_t offset = HISTORY_SEGMENT_HEADER_SIZE;
+
+	std::vector<IndexEntry> kept;
+	std::vector<uint8_t> buf;
+
+	for(uint32_t i=0;ok && i<seg.entries.size();++i)
+	{
+		const IndexEntry& e = seg.entries[i];
+
+		if(removedIds.find(e.msgId) != removedIds.end())
+			continue;
+
+		RecordHeader rh;
+
+		ok = fseek(in, e.offset, SEEK_SET) == 0 && readRecordHeader(in, rh);
+
+		if(!ok)
+			break;
+
+		uint32_t size = HISTORY_RECORD_HEADER_SIZE + rh.payloadSize;
+		buf.resize(size);
+
+		ok = fseek(in, e.offset, SEEK_SET) == 0
+		        && fread(buf.data(), 1, size, in) == size
+		        && fwrite(buf.data(), 1, size, out) == size;
+
+		IndexEntry n = e;
+		n.offset = offset;
+		kept.push_back(n);
+
+		offset += size;
+	}
+
+	fclose(in);
+	ok = (fclose(out) == 0) && ok;
+
+	if(!ok || !RsDirUtil::renameFile(tmp_path, path))
+	{
+		std::cerr << "(EE) p3HistoryStore: failed to rewrite history segment " << path << std::endl;
+		RsDirUtil::removeFile(tmp_path);
+
+		// The segment on disk is unchanged. Forget its index, it will be rebuilt when needed.
+
+		for(uint32_t i=0;i<seg.entries.size();++i)
+			forgetEntry(seg.entries[i]);
+
+		seg.entries.clear();
+		seg.indexed = false;
+		return false;
+	}
+
+	for(uint32_t i=0;i<seg.entries.size();++i)
+		if(removedIds.find(seg.entries[i].msgId) != removedIds.end())
+			forgetEntry(seg.entries[i]);
+
+	for(uint32_t i=0;i<kept.size();++i)
+		mLocations[kept[i].msgId].offset = kept[i].offset;
+
+	seg.entries.swap(kept);
+	seg.size = offset;
+
+	return true;
+}
+
+void p3HistoryStore::dropSegment(const std::string& chat, uint32_t day, Segment& seg)
+{
+	for(uint32_t i=0;i<seg.entries.size();++i)
+		forgetEntry(seg.entries[i]);
+
+	seg.entries.clear();
+
+#ifdef HISTSTORE_DEBUG
+	std::cerr << "p3HistoryStore: dropping history segment " << segmentFilePath(chat, day) << std::endl;
+#endif
+	RsDirUtil::removeFile(segmentFilePath(chat, day));
+}
+
+bool p3HistoryStore::addMessage(RsHistoryMsgItem *item)
+{
+	if(!mHasKey)
+	{
+		std::cerr << "(EE) p3HistoryStore: no encryption key. Cannot store history message." << std::endl;
+		return false;
+	}
+
+	if(!init())
+		return false;
+
+	std::string chat = chatName(item->chatPeerId);
+
+	ChatSegments& cs = mChats[chat];
+	listChat(chat, cs);
+
+	SegmentMap& segs = cs.segments;
+	uint32_t day = item->recvTime / SEGMENT_DURATION;
+
+	// Records are only appended to the last segment, even if the clock went backward.
+
+	if(!segs.empty() && segs.rbegin()->first > day)
+		day = segs.rbegin()->first;
+
+	Segment& seg = segs[day];
+
+	if(seg.size > 0 && !indexSegment(chat, day, seg))
+		return false;
+
+	// The item is padded, so that the size of the records only tells
+	// roughly how long the messages are.
+
+	RsHistorySerialiser ser;
+	uint32_t size = ser.size(item);
+	std::vector<uint8_t> clear_data(size + HISTORY_RECORD_PADDING - size % HISTORY_RECORD_PADDING, 0);
+
+	if(!ser.serialise(item, clear_data.data(), &size))
+	{
+		std::cerr << "(EE) p3HistoryStore: cannot serialise history message." << std::endl;
+		return false;
+	}
+
+	std::vector<uint8_t> encrypted_data;
+	std::vector<uint8_t> encrypted_hdr;
+	std::vector<uint8_t> encrypted_day;
+	uint8_t clear_hdr[12];
+
+	bool ok = encryptBlock(clear_data.data(), clear_data.size(), encrypted_data);
+
+	putUInt32(clear_hdr, encrypted_data.size());
+	putUInt32(clear_hdr + 4, size);
+	putUInt32(clear_hdr + 8, item->recvTime);
+
+	ok = ok && encryptBlock(clear_hdr, sizeof(clear_hdr), encrypted_hdr);
+
+	if(ok && seg.size == 0)
+	{
+		uint8_t clear_day[4];
+		putUInt32(clear_day, day);
+		ok = encryptBlock(clear_day, sizeof(clear_day), encrypted_day);
+	}
+
+	memset(clear_data.data(), 0, clear_data.size());
+
+	if(!ok)
+	{
+		std::cerr << "(EE) p3HistoryStore: cannot encrypt history message." << std::endl;
+		return false;
+	}
+
+	std::string path = segmentFilePath(chat, day);
+	FILE *f = NULL;
+
+	if(seg.size > 0 || RsDirUtil::checkCreateDirectory(chatDirectoryPath(chat)))
+		f = RsDirUtil::rs_fopen(path.c_str(), "ab");
+
+	ok = (f != NULL);
+
+	if(ok && seg.size == 0)
+	{
+		uint8_t hdr[8];
+		memcpy(hdr, HISTORY_SEGMENT_MAGIC, 4);
+		putUInt32(hdr + 4, HISTORY_SEGMENT_VERSION);
+
+		ok = fwrite(hdr, 1, 8, f) == 8
+		        && fwrite(encrypted_day.data(), 1, encrypted_day.size(), f) == encrypted_day.size();
+		seg.size = HISTORY_SEGMENT_HEADER_SIZE;
+	}
+
+	uint32_t encrypted_size = encrypted_data.size();
+
+	ok = ok && fwrite(encrypted_hdr.data(), 1, HISTORY_RECORD_HEADER_SIZE, f) == HISTORY_RECORD_HEADER_SIZE
+	        && fwrite(encrypted_data.data(), 1, encrypted_size, f) == encrypted_size;
+
+	if(f)
+		ok = (fclose(f) == 0) && ok;
+
+	if(!ok)
+	{
+		std::cerr << "(EE) p3HistoryStore: cannot write to history segment " << path << std::endl;
+
+		if(seg.size <= HISTORY_SEGMENT_HEADER_SIZE)
+		{
+			RsDirUtil::removeFile(path);
+			segs.erase(day);
+			return false;
+		}
+
+		// The segment may end with a partial record now. Re-index it next time.
+
+		for(uint32_t i=0;i<seg.entries.size();++i)
+			forgetEntry(seg.entries[i]);
+
+		seg.entries.clear();
+		seg.indexed = false;
+		return false;
+	}
+
+	IndexEntry e;
+	e.offset = seg.size;
+	e.recvTime = item->recvTime;
+	e.msgId = mNextMsgId++;
+
+	seg.entries.push_back(e);
+	seg.size += HISTORY_RECORD_HEADER_SIZE + encrypted_size;
+	seg.indexed = true;
+
+	Location& loc = mLocations[e.msgId];
+	loc.chat = chat;
+	loc.day = day;
+	loc.offset = e.offset;
+
+	item->msgId = e.msgId;
+	return true;
+}
+
+RsHistoryMsgItem *p3HistoryStore::readRecord(FILE *f, uint32_t offset)
+{
+	RecordHeader rh;
+
+	if(fseek(f, offset, SEEK_SET) != 0 || !readRecordHeader(f, rh))
+	{
+		std::cerr << "(EE) p3HistoryStore: cannot read history record header. Wrong key or corrupted segment." << std::endl;
+		return NULL;
+	}
+
+	std::vector<uint8_t> encrypted_data(rh.payloadSize);
+	std::vector<uint8_t> clear_data;
+
+	if(fread(encrypted_data.data(), 1, rh.payloadSize, f) != rh.payloadSize
+	        || !decryptBlock(encrypted_data.data(), rh.payloadSize, clear_data) || clear_data.size() < rh.itemSize)
+	{
+		std::cerr << "(EE) p3HistoryStore: cannot decrypt history record. Wrong key or corrupted segment." << std::endl;
+		return NULL;
+	}
+
+	uint32_t item_size = rh.itemSize;
+	RsItem *item = RsHistorySerialiser().deserialise(clear_data.data(), &item_size);
+	memset(clear_data.data(), 0, clear_data.size());
+
+	RsHistoryMsgItem *hitem = dynamic_cast<RsHistoryMsgItem*>(item);
+
+	if(!hitem)
+	{
+		std::cerr << "(EE) p3HistoryStore: cannot deserialise history record." << std::endl;
+		delete item;
+		return NULL;
+	}
+
+	return hitem;
+}
+
+bool p3HistoryStore::getLastMessages(const RsPeerId& chat, uint32_t count, std::list<RsHistoryMsgItem*>& items)
+{
+	if(!mHasKey || !init())
+		return false;
+
+	ChatMap::iterator cit = mChats.find(chatName(chat));
+
+	if(cit == mChats.end())
+		return true;
+
+	listChat(cit->first, cit->second);
+	SegmentMap& segs = cit->second.segments;
+
+	// Pick the last records, newest first, indexing as few segments as possible.
+
+	std::vector<std::pair<uint32_t, IndexEntry> > selected;
+
+	for(SegmentMap::reverse_iterator sit = segs.rbegin(); sit != segs.rend() && (count == 0 || selected.size() < count); ++sit)
+	{
+		if(!indexSegment(cit->first, sit->first, sit->second))
+			continue;
+
+		const std::vector<IndexEntry>& entries = sit->second.entries;
+
+		for(std::vector<IndexEntry>::const_reverse_iterator eit = entries.rbegin(); eit != entries.rend() && (count == 0 || selected.size() < count); ++eit)
+			selected.push_back(std::make_pair(sit->first, *eit));
+	}
+
+	FILE *f = NULL;
+	uint32_t open_day = 0;
+
+	for(std::vector<std::pair<uint32_t, IndexEntry> >::reverse_iterator it = selected.rbegin(); it != selected.rend(); ++it)
+	{
+		if(f == NULL || open_day != it->first)
+		{
+			if(f)
+				fclose(f);
+
+			open_day = it->first;
+			f = RsDirUtil::rs_fopen(segmentFilePath(cit->first, open_day).c_str(), "rb");
+
+			if(!f)
+			{
+				std::cerr << "(EE) p3HistoryStore: cannot open history segment " << segmentFilePath(cit->first, open_day) << std::endl;
+				continue;
+			}
+		}
+
+		RsHistoryMsgItem *item = readRecord(f, it->second.offset);
+
+		if(item)
+		{
+			item->msgId = it->second.msgId;
+			items.push_back(item);
+		}
+	}
+
+	if(f)
+		fclose(f);
+
+	return true;
+}
+
+RsHistoryMsgItem *p3HistoryStore::getMessage(uint32_t msgId)
+{
+	if(!mHasKey)
+		return NULL;
+
+	std::map<uint32_t, Location>::const_iterator it = mLocations.find(msgId);
+
+	if(it == mLocations.end())
+		return NULL;
+
+	FILE *f = RsDirUtil::rs_fopen(segmentFilePath(it->second.chat, it->second.day).c_str(), "rb");
+
+	if(!f)
+		return NULL;
+
+	RsHistoryMsgItem *item = readRecord(f, it->second.offset);
+	fclose(f);
+
+	if(item)
+		item->msgId = msgId;
+
+	return item;
+}
+
+void p3HistoryStore::removeMessages(const std::list<uint32_t>& msgIds, std::list<uint32_t>& removedIds)
+{
+	std::map<std::pair<std::string, uint32_t>, std::set<uint32_t> > to_remove;
+
+	for(std::list<uint32_t>::const_iterator it = msgIds.begin(); it != msgIds.end(); ++it)
+	{
+		std::map<uint32_t, Location>::const_iterator lit = mLocations.find(*it);
+
+		if(lit != mLocations.end())
+			to_remove[std::make_pair(lit->second.chat, lit->second.day)].insert(*it);
+	}
+
+	for(std::map<std::pair<std::string, uint32_t>, std::set<uint32_t> >::const_iterator it = to_remove.begin(); it != to_remove.end(); ++it)
+	{
+		const std::string& chat = it->first.first;
+		uint32_t day = it->first.second;
+
+		ChatMap::iterator cit = mChats.find(chat);
+
+		if(cit == mChats.end())
+			continue;
+
+		SegmentMap& segs = cit->second.segments;
+		SegmentMap::iterator sit = segs.find(day);
+
+		if(sit == segs.end() || !rewriteSegment(chat, day, sit->second, it->second))
+			continue;
+
+		removedIds.insert(removedIds.end(), it->second.begin(), it->second.end());
+
+		if(sit->second.entries.empty())
+		{
+			dropSegment(chat, day, sit->second);
+			segs.erase(sit);
+		}
+
+		if(segs.empty())
+			removeChat(cit);
+	}
+}
+
+bool p3HistoryStore::clearChat(const RsPeerId& chat)
+{
+	if(!mHasKey || !init())
+		return false;
+
+	ChatMap::iterator cit = mChats.find(chatName(chat));
+
+	if(cit == mChats.end())
+		return false;
+
+	listChat(cit->first, cit->second);
+
+	for(SegmentMap::iterator sit = cit->second.segments.begin(); sit != cit->second.segments.end(); ++sit)
+		dropSegment(cit->first, sit->first, sit->second);
+
+	removeChat(cit);
+	return true;
+}
+
+bool p3HistoryStore::removeOlderThan(rstime_t limit)
+{
+	// without the key, the days of the segments are not known.
+
+	if(!mHasKey || !init())
+		return false;
+
+	if(limit > mMinRecvTime)
+		mMinRecvTime = limit;
+
+	bool changed = false;
+
+	for(ChatMap::iterator cit = mChats.begin(); cit != mChats.end();)
+	{
+		listChat(cit->first, cit->second);
+		SegmentMap& segs = cit->second.segments;
+
+		// whole segments first. They do not need to be indexed for that.
+
+		while(!segs.empty() && (uint64_t(segs.begin()->first) + 1) * SEGMENT_DURATION <= uint64_t(limit))
+		{
+			dropSegment(cit->first, segs.begin()->first, segs.begin()->second);
+			segs.erase(segs.begin());
+			changed = true;
+		}
+
+		// Then hide the expired records of the oldest remaining segment. They
+		// are not indexed anymore, and will disappear with their segment.
+
+		if(!segs.empty() && segs.begin()->second.indexed)
+		{
+			std::vector<IndexEntry>& entries = segs.begin()->second.entries;
+			std::vector<IndexEntry> kept;
+
+			for(uint32_t i=0;i<entries.size();++i)
+				if(entries[i].recvTime < limit)
+					forgetEntry(entries[i]);
+				else
+					kept.push_back(entries[i]);
+
+			if(kept.size() != entries.size())
+			{
+				entries.swap(kept);
+				changed = true;
+			}
+		}
+
+		if(segs.empty())
+		{
+			ChatMap::iterator tmp = cit;
+			++tmp;
+			removeChat(cit);
+			cit = tmp;
+		}
+		else
+			++cit;
+	}
+
+	return changed;
+}
+
+bool p3HistoryStore::keepLastMessages(const RsPeerId& chat, uint32_t count)
+{
+	if(count == 0 || !mHasKey || !init())
+		return false;
+
+	ChatMap::iterator cit = mChats.find(chatName(chat));
+
+	if(cit == mChats.end())
+		return false;
+
+	listChat(cit->first, cit->second);
+
+	SegmentMap& segs = cit->second.segments;
+	SegmentMap::iterator sit = segs.end();
+	uint32_t total = 0;
+	bool changed = false;
+
+	// Count from the newest segment, and hide the excess records of the
+	// segment where the limit is reached.
+
+	while(sit != segs.begin() && total < count)
+	{
+		--sit;
+
+		if(!indexSegment(cit->first, sit->first, sit->second))
+			continue;
+
+		std::vector<IndexEntry>& entries = sit->second.entries;
+		total += entries.size();
+
+		if(total > count)
+		{
+			uint32_t excess = total - count;
+
+			for(uint32_t i=0;i<excess;++i)
+				forgetEntry(entries[i]);
+
+			entries.erase(entries.begin(), entries.begin() + excess);
+			total = count;
+			changed = true;
+		}
+	}
+
+	// all older segments go.
+
+	if(total >= count)
+		while(segs.begin() != sit)
+		{
+			dropSegment(cit->first, segs.begin()->first, segs.begin()->second);
+			segs.erase(segs.begin());
+			changed = true;
+		}
+
+	return changed;
+}
@@ -0,0 +1,176 @@
+/*******************************************************************************
+ * libretroshare/src/pqi: p3historystore.h                                     *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#ifndef RS_P3_HISTORY_STORE_H
+#define RS_P3_HISTORY_STORE_H
+
+#include <map>
+#include <list>
+#include <set>
+#include <vector>
+#include <string>
+#include <cstdio>
+
+#include "rsitems/rshistoryitems.h"
+#include "util/rstime.h"
+
+//! Append-only on-disk storage of the chat history.
+/*!
+ * Each chat (identified by its virtual peer id, see p3HistoryMgr) has its own
+ * directory, holding segment files that cover one day of received messages
+ * each. Records are only ever appended to the last segment of a chat.
+ *
+ * Nothing about the chats is stored in clear: directory and segment names are
+ * keyed hashes of the chat id and of the day, the day of a segment is stored
+ * encrypted in its header, and each record is made of an encrypted header
+ * (record sizes and receive time) followed by the serialised RsHistoryMsgItem,
+ * padded and encrypted. Everything is encrypted and authenticated with a
+ * 32 bytes key that the owner keeps in its (itself encrypted) config file.
+ *
+ * At start only the chat directories are listed. The segments of a chat are
+ * listed the first time the chat is used, and indexed (record headers only,
+ * not the messages) when needed, newest first, so that reading the last
+ * messages of a chat never touches the others.
+ * Retention drops whole segments, and hides the expired records of the oldest
+ * remaining one until it expires as well.
+ *
+ * The store is not thread safe: p3HistoryMgr calls it under mHistoryMtx.
+ */
+class p3HistoryStore
+{
+public:
+	p3HistoryStore(const std::string& directory);
+	~p3HistoryStore();
+
+	static const uint32_t ENCRYPTION_KEY_SIZE = 32;
+	static const uint32_t SEGMENT_DURATION = 86400;	// one segment per day and per chat
+
+	void setEncryptionKey(const uint8_t key[ENCRYPTION_KEY_SIZE]);
+	bool getEncryptionKey(uint8_t key[ENCRYPTION_KEY_SIZE]) const;
+	bool hasEncryptionKey() const { return mHasKey; }
+
+	/// Appends the item to its chat and sets item->msgId. The item is not kept.
+	bool addMessage(RsHistoryMsgItem *item);
+
+	/// Last count messages of the chat (all of them when count is 0), oldest
+	/// first. The caller owns the returned items.
+	bool getLastMessages(const RsPeerId& chat, uint32_t count, std::list<RsHistoryMsgItem*>& items);
+
+	/// Returns NULL if the message is unknown. The caller owns the item.
+	RsHistoryMsgItem *getMessage(uint32_t msgId);
+
+	/// Rewrites the segments holding the given messages without them.
+	void removeMessages(const std::list<uint32_t>& msgIds, std::list<uint32_t>& removedIds);
+	bool clearChat(const RsPeerId& chat);
+
+	/// Drops the messages received before the given time. Returns true if
+	/// anything was dropped.
+	bool removeOlderThan(rstime_t limit);
+
+	/// Only keeps the last count messages of the chat.
+	bool keepLastMessages(const RsPeerId& chat, uint32_t count);
+
+	/// Where the chat and its segments are stored. The names depend on the key.
+	std::string chatDirectory(const RsPeerId& chat) const;
+	std::string segmentPath(const RsPeerId& chat, uint32_t day) const;
+
+private:
+	struct IndexEntry
+	{
+		uint32_t offset;
+		uint32_t recvTime;
+		uint32_t msgId;
+	};
+
+	struct Segment
+	{
+		Segment() : size(0), indexed(false) {}
+
+		uint32_t size;
+		bool indexed;
+		std::vector<IndexEntry> entries;	// ordered by offset
+	};
+
+	typedef std::map<uint32_t, Segment> SegmentMap;	// day -> segment
+
+	struct RecordHeader
+	{
+		uint32_t payloadSize;	// encrypted item, as stored
+		uint32_t itemSize;		// serialised item, without the padding
+		uint32_t recvTime;
+	};
+
+	struct ChatSegments
+	{
+		ChatSegments() : listed(false) {}
+
+		bool listed;
+		SegmentMap segments;
+	};
+
+	// Chats are designated by the name of their directory, which is all
+	// that can be known of them before their messages are decrypted.
+
+	typedef std::map<std::string, ChatSegments> ChatMap;
+
+	struct Location
+	{
+		std::string chat;
+		uint32_t day;
+		uint32_t offset;
+	};
+
+	bool init();
+	bool listChat(const std::string& chat, ChatSegments& cs);
+	void removeChat(ChatMap::iterator cit);
+
+	std::string chatName(const RsPeerId& chat) const;
+	std::string segmentName(const std::string& chat, uint32_t day) const;
+	std::string chatDirectoryPath(const std::string& chat) const;
+	std::string segmentFilePath(const std::string& chat, uint32_t day) const;
+
+	bool encryptBlock(const uint8_t *data, uint32_t size, std::vector<uint8_t>& out);
+	bool decryptBlock(const uint8_t *data, uint32_t size, std::vector<uint8_t>& out);
+	bool readSegmentDay(const std::string& path, uint32_t& day);
+	bool readRecordHeader(FILE *f, RecordHeader& h);
+
+	bool indexSegment(const std::string& chat, uint32_t day, Segment& seg);
+	bool rewriteSegment(const std::string& chat, uint32_t day, Segment& seg, const std::set<uint32_t>& removedIds);
+	void dropSegment(const std::string& chat, uint32_t day, Segment& seg);
+	void forgetEntry(const IndexEntry& e);
+
+	RsHistoryMsgItem *readRecord(FILE *f, uint32_t offset);
+
+	std::string mDirectory;
+	bool mInitialised;
+
+	uint8_t mKey[ENCRYPTION_KEY_SIZE];
+	uint8_t mNameKey[ENCRYPTION_KEY_SIZE];	// derived from mKey, for the file names
+	bool mHasKey;
+
+	uint32_t mNextMsgId;
+	rstime_t mMinRecvTime;	// records received before are expired
+
+	ChatMap mChats;
+	std::map<uint32_t, Location> mLocations;
+};
+
+#endif
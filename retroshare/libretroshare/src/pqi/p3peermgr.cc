@@ -1266,6 +1266,7 @@ bool p3PeerMgrIMPL::removeFriend(const RsPgpId &id)
 	for(rit = sslid_toRemove.begin(); rit != sslid_toRemove.end(); ++rit)
 	{
 		mLinkMgr->removeFriend(*rit);
+		AuthSSL::instance().forgetPeer(*rit);
 	}
 
 	/* remove id from all groups */
@@ -1342,6 +1343,7 @@ bool p3PeerMgrIMPL::removeFriend(const RsPeerId &id, bool removePgpId)
 	for(rit = sslid_toRemove.begin(); rit != sslid_toRemove.end(); ++rit)
 	{
 		mLinkMgr->removeFriend(*rit);
+		AuthSSL::instance().forgetPeer(*rit);
 	}
 
 	/* remove id from all groups */
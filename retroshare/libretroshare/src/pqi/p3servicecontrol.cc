@@ -113,6 +113,14 @@ bool p3ServiceControl::getServiceItemNames(uint32_t serviceId,std::map<uint8_t,s
     return false ;
 }
 
+bool p3ServiceControl::getServiceQueueStats(std::map<uint32_t, RsServiceQueueStats>& stats)
+{
+    if(mServiceServer != NULL)
+        return mServiceServer->getServiceQueueStats(stats) ;
+
+    return false ;
+}
+
 /* Interface for Services */
 bool p3ServiceControl::registerService(const RsServiceInfo &info, bool defaultOn)
 {
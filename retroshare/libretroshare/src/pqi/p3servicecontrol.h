@@ -101,6 +101,9 @@ virtual bool isPeerConnected(uint32_t serviceId, const RsPeerId &peerId);
     // Gets the list of items used by that service
 virtual bool getServiceItemNames(uint32_t serviceId,std::map<uint8_t,std::string>& names) ;
 
+    // Statistics about incoming items, from the service server
+virtual bool getServiceQueueStats(std::map<uint32_t, RsServiceQueueStats>& stats) ;
+
 	/**
 	 * Registration for all Services.
 	 */
@@ -47,6 +47,8 @@ class pqiPublisher
 virtual ~pqiPublisher() { return; }
 virtual bool sendItem(RsRawItem *item) = 0;
 
+/// true if size more bytes of service_type fit in the out queue of peer_id (see pqibandwidth.h)
+virtual bool canSend(const RsPeerId& /*peer_id*/, uint32_t /*service_type*/, uint32_t /*size*/) { return true; }
 };
 
 
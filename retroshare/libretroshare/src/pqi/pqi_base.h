@@ -211,6 +211,20 @@ public:
 		virtual RsItem *GetItem() = 0;
 		virtual bool RecvItem(RsItem * /*item*/ )  { return false; }  /* alternative for for GetItem(), when we want to push */
 
+		/*!
+		 * true if the service receiving packet_id cannot keep up with its
+		 * incoming items, in which case less should be read from the network.
+		 */
+		virtual bool incomingCongested(uint32_t /*packet_id*/) { return false; }
+
+		/*!
+		 * true if size more bytes of the service service_type fit in the out
+		 * queue budgets (see pqibandwidth.h). When false, outgoingWritable() is
+		 * called for that service once they do.
+		 */
+		virtual bool canSend(uint32_t /*service_type*/, uint32_t /*size*/) { return true; }
+		virtual void outgoingWritable(uint32_t /*service_type*/) {}
+
 		/**
 		 * also there are  tick + person id  functions.
 		 */
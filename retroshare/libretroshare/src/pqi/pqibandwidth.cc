@@ -0,0 +1,183 @@
+/*******************************************************************************
+ * libretroshare/src/pqi: pqibandwidth.cc                                      *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#include <algorithm>
+#include <chrono>
+
+#include "pqi/pqibandwidth.h"
+#include "rsitems/itempriorities.h"
+
+//#define DEBUG_BANDWIDTH 1
+
+const int64_t RsTokenBucket::UNLIMITED ;
+const int64_t RsTokenBucket::MIN_BURST_SIZE ;
+const float   RsTokenBucket::BURST_DURATION = 0.25f ;
+
+const float pqiBandwidthShaper::INTERACTIVE_RESERVE = 0.25f ;
+
+const float    pqiBandwidthShaper::OUT_QUEUE_DURATION = 2.0f ;
+const uint32_t pqiBandwidthShaper::MIN_SERVICE_QUEUE_BUDGET ;
+const uint32_t pqiBandwidthShaper::MAX_SERVICE_QUEUE_BUDGET ;
+const uint32_t pqiBandwidthShaper::PEER_QUEUE_BUDGET_FACTOR ;
+
+static const int64_t MICRO = 1000000 ;
+
+RsTokenBucket::RsTokenBucket()
+    : mTokens(0), mLastRefill(monotonicTimeUs()), mRate(0)
+{
+}
+
+int64_t RsTokenBucket::monotonicTimeUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() ;
+}
+
+void RsTokenBucket::setRate(double bytes_per_sec)
+{
+	int64_t r = (bytes_per_sec > 0)?int64_t(bytes_per_sec):0 ;
+
+	// Do not let the tokens accumulated at the previous rate exceed the new
+	// burst size, otherwise lowering the rate only takes effect after a while.
+
+	if(mRate.exchange(r) != r && r > 0)
+	{
+		int64_t b = burstSize(r) * MICRO ;
+		int64_t t = mTokens.load() ;
+
+		while(t > b && !mTokens.compare_exchange_weak(t,b)) ;
+	}
+}
+
+double RsTokenBucket::rate() const
+{
+	return double(mRate.load()) ;
+}
+
+int64_t RsTokenBucket::burstSize(int64_t rate) const
+{
+	return std::max(MIN_BURST_SIZE, int64_t(rate * BURST_DURATION)) ;
+}
+
+void RsTokenBucket::refill(int64_t now)
+{
+	int64_t last = mLastRefill.load() ;
+
+	if(now <= last)
+		return ;
+
+	// Only one thread wins the right to credit the elapsed time. The others
+	// simply see the bucket as it is after that.
+
+	if(!mLastRefill.compare_exchange_strong(last,now))
+		return ;
+
+	int64_t r = mRate.load() ;
+	int64_t b = burstSize(r) * MICRO ;
+	int64_t dt = std::min(now - last, MICRO) ;	// more than 1 sec of refill is always capped by the burst size anyway
+	int64_t t = mTokens.load() ;
+	int64_t n ;
+
+	do
+		n = std::min(b, t + dt * r) ;
+	while(!mTokens.compare_exchange_weak(t,n)) ;
+}
+
+int64_t RsTokenBucket::available(float reserved_fraction)
+{
+	int64_t r = mRate.load() ;
+
+	if(r == 0)
+		return UNLIMITED ;
+
+	refill(monotonicTimeUs()) ;
+
+	int64_t reserve = int64_t(reserved_fraction * burstSize(r)) ;
+
+	return mTokens.load() / MICRO - reserve ;
+}
+
+void RsTokenBucket::consume(uint32_t bytes)
+{
+	if(mRate.load() == 0)
+		return ;
+
+	mTokens.fetch_sub(int64_t(bytes) * MICRO) ;
+}
+
+pqiBandwidthShaper::ServiceClass pqiBandwidthShaper::serviceClass(int priority)
+{
+	// File data and everything below (GXS sync, avatars, discovery replies...)
+	// is bulk. Requests, chat, tunnel management and heartbeats are interactive.
+
+	return (priority > QOS_PRIORITY_RS_FILE_DATA)?CLASS_INTERACTIVE:CLASS_BULK ;
+}
+
+RsTokenBucket& pqiBandwidthShaper::globalBucket(bool in)
+{
+	static RsTokenBucket global_in ;
+	static RsTokenBucket global_out ;
+
+	return in?global_in:global_out ;
+}
+
+void pqiBandwidthShaper::setGlobalMaxRate(bool in, float kb_per_sec)
+{
+	globalBucket(in).setRate(kb_per_sec * 1024.0) ;
+}
+
+int64_t pqiBandwidthShaper::allowedBytes(bool in, RsTokenBucket& peer_bucket, ServiceClass c)
+{
+	float reserve = (c == CLASS_BULK)?INTERACTIVE_RESERVE:0.0f ;
+
+	return std::min(peer_bucket.available(reserve), globalBucket(in).available(reserve)) ;
+}
+
+void pqiBandwidthShaper::consume(bool in, RsTokenBucket& peer_bucket, uint32_t bytes)
+{
+	peer_bucket.consume(bytes) ;
+	globalBucket(in).consume(bytes) ;
+}
+
+uint64_t pqiBandwidthShaper::serviceQueueBudget(double rate)
+{
+	if(rate <= 0)
+		return MAX_SERVICE_QUEUE_BUDGET ;
+
+	return std::min(uint64_t(MAX_SERVICE_QUEUE_BUDGET), std::max(uint64_t(MIN_SERVICE_QUEUE_BUDGET), uint64_t(rate * OUT_QUEUE_DURATION))) ;
+}
+
+bool pqiBandwidthShaper::outQueueAccepts(uint64_t service_bytes, uint64_t total_bytes, uint32_t size, double rate)
+{
+	uint64_t budget = serviceQueueBudget(rate) ;
+	uint64_t peer_budget = PEER_QUEUE_BUDGET_FACTOR * budget ;
+
+	if(2*service_bytes > budget && service_bytes + size > budget)
+		return false ;
+
+	return 2*total_bytes <= peer_budget || total_bytes + size <= peer_budget ;
+}
+
+bool pqiBandwidthShaper::outQueueDrained(uint64_t service_bytes, uint64_t total_bytes, double rate)
+{
+	uint64_t budget = serviceQueueBudget(rate) ;
+
+	return 2*service_bytes <= budget && 2*total_bytes <= PEER_QUEUE_BUDGET_FACTOR * budget ;
+}
@@ -0,0 +1,131 @@
+/*******************************************************************************
+ * libretroshare/src/pqi: pqibandwidth.h                                       *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#pragma once
+
+// Hierarchical token bucket shaping of the traffic that goes through the
+// pqistreamers. The hierarchy has three levels:
+//
+//  - one global bucket per direction, owned by pqiBandwidthShaper and driven by
+//    the total max rates given to pqihandler,
+//  - one bucket per peer and direction, owned by each pqistreamer and driven by
+//    the per-peer max rate (itself capped by the per-peer limits set through
+//    setMaxRates() and by the rates the peer announces through BwCtrl),
+//  - two service classes inside each bucket: interactive items (chat, requests,
+//    heartbeats...) may use all the tokens of a bucket, while bulk items (file
+//    and GXS data) must leave a reserve, so that interactive traffic is never
+//    queued behind a saturated transfer.
+//
+// Buckets are refilled lazily from a monotonic clock by whichever thread
+// queries them, without taking any lock.
+//
+// The out queue of each peer also has byte budgets, one per service and one for
+// the whole queue, that scale with the rate the peer is actually sent data at.
+// Nothing is refused when they are exceeded: services ask whether they can
+// send (pqiService::canSendItems()) and are told when they can again
+// (pqiService::outgoingWritable()), so that they stop producing data a slow
+// friend cannot take.
+
+#include <stdint.h>
+#include <atomic>
+
+class RsTokenBucket
+{
+public:
+	RsTokenBucket() ;
+
+	/// Sets the refill rate in bytes per second. 0 means unlimited.
+	void setRate(double bytes_per_sec) ;
+	double rate() const ;
+
+	/// Returns the number of bytes that can be consumed right now while keeping
+	/// reserved_fraction of the bucket size untouched. May be negative when
+	/// the bucket is in debt.
+	int64_t available(float reserved_fraction = 0.0f) ;
+
+	/// Takes bytes out of the bucket. Buckets are allowed to go in debt, so
+	/// that a whole packet can always be sent once some tokens are available.
+	void consume(uint32_t bytes) ;
+
+	/// Microseconds from an arbitrary origin, never going backwards.
+	static int64_t monotonicTimeUs() ;
+
+	static const int64_t UNLIMITED = (1ll << 40) ;
+
+	/// How long, in seconds, a bucket can keep accumulating unused tokens.
+	static const float BURST_DURATION ;
+	/// Minimum bucket size in bytes, so that slow links can still send packets.
+	static const int64_t MIN_BURST_SIZE = 16384 ;
+
+private:
+	void refill(int64_t now) ;
+	int64_t burstSize(int64_t rate) const ;
+
+	// Tokens are stored in micro-bytes, which makes the refill exact for any
+	// elapsed time and rate, without rounding losses.
+	std::atomic<int64_t> mTokens ;
+	std::atomic<int64_t> mLastRefill ;
+	std::atomic<int64_t> mRate ;
+};
+
+class pqiBandwidthShaper
+{
+public:
+	enum ServiceClass { CLASS_INTERACTIVE = 0, CLASS_BULK = 1 };
+
+	/// Maps a QoS item priority to the service class it is shaped with.
+	static ServiceClass serviceClass(int priority) ;
+
+	/// Sets the total rate in kB/s, as given to pqihandler. 0 means unlimited.
+	static void setGlobalMaxRate(bool in, float kb_per_sec) ;
+
+	/// Number of bytes the peer bucket can send or receive for the given
+	/// class, bounded by what is left in the global bucket.
+	static int64_t allowedBytes(bool in, RsTokenBucket& peer_bucket, ServiceClass c) ;
+
+	/// Accounts for bytes sent or received on both the peer and the global level.
+	static void consume(bool in, RsTokenBucket& peer_bucket, uint32_t bytes) ;
+
+	/// Fraction of each bucket that bulk items cannot use.
+	static const float INTERACTIVE_RESERVE ;
+
+	/// true if a service that has service_bytes in the out queue of a peer,
+	/// which holds total_bytes, can queue size more bytes. rate is the rate the
+	/// peer is sent data at, in bytes/s, 0 if the link is not limited. Queues
+	/// that are at most half full always accept, whatever the size, so that
+	/// items larger than the budget still get through.
+	static bool outQueueAccepts(uint64_t service_bytes, uint64_t total_bytes, uint32_t size, double rate) ;
+
+	/// true when a service refused by outQueueAccepts() should be told that it
+	/// can send again: both queues are back to half their budget.
+	static bool outQueueDrained(uint64_t service_bytes, uint64_t total_bytes, double rate) ;
+
+	/// Seconds of traffic the budget of a service in the out queue amounts to.
+	static const float OUT_QUEUE_DURATION ;
+	static const uint32_t MIN_SERVICE_QUEUE_BUDGET = 64*1024 ;
+	static const uint32_t MAX_SERVICE_QUEUE_BUDGET = 4*1024*1024 ;
+	/// The budget of the whole queue, relative to the budget of a service.
+	static const uint32_t PEER_QUEUE_BUDGET_FACTOR = 4 ;
+
+private:
+	static RsTokenBucket& globalBucket(bool in) ;
+	static uint64_t serviceQueueBudget(double rate) ;
+};
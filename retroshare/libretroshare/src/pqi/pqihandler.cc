@@ -23,7 +23,6 @@
 
 #include <stdlib.h>               // for NULL
 #include "util/rstime.h"                 // for time, rstime_t
-#include <algorithm>              // for sort
 #include <iostream>               // for dec
 #include <string>                 // for string, char_traits, operator+, bas...
 #include <utility>                // for pair
@@ -259,6 +258,19 @@ int	pqihandler::locked_HandleRsItem(RsItem *item, uint32_t& computed_size)
 		return 1;
 }
 
+bool pqihandler::canSend(const RsPeerId& peer_id, uint32_t service_type, uint32_t size)
+{
+	RS_STACK_MUTEX(coreMtx); /**************** LOCKED MUTEX ****************/
+
+	std::map<RsPeerId, SearchModule *>::iterator it = mods.find(peer_id);
+
+	// items to unknown peers are dropped when sent, so there is nothing to wait for.
+	if (it == mods.end())
+		return true;
+
+	return it->second->pqi->canSend(service_type, size);
+}
+
 int     pqihandler::SendRsRawItem(RsRawItem *ns)
 {
 	pqioutput(PQL_DEBUG_BASIC, pqihandlerzone, "pqihandler::SendRsRawItem()");
@@ -322,6 +334,13 @@ int     pqihandler::ExtractRates(std::map<RsPeerId, RsBwRates> &ratemap, RsBwRat
 
 
 // internal fn to send updates
+//
+// The sharing of the total bandwidth between peers is done by the global token
+// buckets of pqiBandwidthShaper, which the streamers query directly. So here we
+// only need to give each peer the total rate as max rate, and let the per-peer
+// caps (setRateCap) and the BwCtrl rates lower it where needed. This is O(n) and
+// does not depend on the rates measured at the previous tick, which avoids the
+// oscillations of the former redistribution scheme.
 int     pqihandler::UpdateRates()
 {
 	std::map<RsPeerId, SearchModule *>::iterator it;
@@ -332,159 +351,49 @@ int     pqihandler::UpdateRates()
 	float used_bw_in = 0;
 	float used_bw_out = 0;
 
+	// retrieve the bandwidth limits provided by peers via BwCtrl
+	std::map<RsPeerId, RsConfigDataRates> rateMap;
+	rsConfig->getAllBandwidthRates(rateMap);
+	std::map<RsPeerId, RsConfigDataRates>::iterator rateMap_it;
+
 	/* Lock once rates have been retrieved */
 	RS_STACK_MUTEX(coreMtx); /**************** LOCKED MUTEX ****************/
 
-	int num_sm = mods.size();
-	float used_bw_in_table[num_sm];         /* table of in bandwidth currently used by each module */
-	float used_bw_out_table[num_sm];        /* table of out bandwidth currently used by each module */
-
-	// loop through modules to get the used bandwidth
 #ifdef UPDATE_RATES_DEBUG
-		RsDbg() << "UPDATE_RATES pqihandler::UpdateRates Looping through modules" << std::endl;
+	RsDbg() << "UPDATE_RATES pqihandler::UpdateRates Looping through modules" << std::endl;
 #endif
 
-	int index = 0;
-
 	for(it = mods.begin(); it != mods.end(); ++it)
 	{
 		SearchModule *mod = (it -> second);
 
 		traffInSum += mod -> pqi -> getTraffic(true);
 		traffOutSum += mod -> pqi -> getTraffic(false);
-        
-                float crate_in = mod -> pqi -> getRate(true);
-		float crate_out = mod -> pqi -> getRate(false);
-
-		used_bw_in += crate_in;
-		used_bw_out += crate_out;
 
-		/* fill the table of used bandwidths */
-		used_bw_in_table[index] = crate_in;
-		used_bw_out_table[index] = crate_out;
+		used_bw_in += mod -> pqi -> getRate(true);
+		used_bw_out += mod -> pqi -> getRate(false);
 
-		++index;
-	}
-
-#ifdef UPDATE_RATES_DEBUG
-	RsDbg() << "UPDATE_RATES pqihandler::UpdateRates Sorting used_bw_out_table: " << num_sm << " entries" << std::endl;
-#endif
-
-	/* Sort the used bw in/out table in ascending order */
-	std::sort(used_bw_in_table, used_bw_in_table + num_sm);
-	std::sort(used_bw_out_table, used_bw_out_table + num_sm);
-
-#ifdef UPDATE_RATES_DEBUG
-	RsDbg() << "UPDATE_RATES pqihandler::UpdateRates used_bw_out " << used_bw_out << std::endl;
-#endif
-
-	/* Calculate the optimal out_max value, taking into account avail_out and the out bw requested by modules */
-
-	float out_remaining_bw = avail_out;
-	float out_max_bw = 0;
-	bool keep_going = true;
-	int mod_index = 0;
-
-	while (keep_going && (mod_index < num_sm)) {
-		float result = (num_sm - mod_index) * (used_bw_out_table[mod_index] - out_max_bw);
-		if (result > out_remaining_bw) {
-			/* There is not enough remaining out bw to satisfy all modules,
-			   distribute the remaining out bw among modules, then exit */
-			out_max_bw += out_remaining_bw / (num_sm - mod_index);
-			out_remaining_bw = 0;
-			keep_going = false;
-		} else {
-			/* Grant the requested out bandwidth to all modules,
-			   then recalculate the remaining out bandwidth */
-			out_remaining_bw -= result;
-			out_max_bw = used_bw_out_table[mod_index];
-			++mod_index;
-		}
-	}
-
-#ifdef UPDATE_RATES_DEBUG
-	RsDbg() << "UPDATE_RATES pqihandler::UpdateRates mod_index " << mod_index << " out_max_bw " << out_max_bw << " remaining out bw " << out_remaining_bw << std::endl;
-#endif
-
-	/* Allocate only 50 pct the remaining out bw, if any, to make the transition more smooth */
-	out_max_bw = out_max_bw + 0.5 * out_remaining_bw;
-
-	/* Calculate the optimal in_max value, taking into account avail_in and the in bw requested by modules */
-
-	float in_remaining_bw = avail_in;
-	float in_max_bw = 0;
-	keep_going = true;
-	mod_index = 0;
-
-	while (keep_going && mod_index < num_sm) {
-		float result = (num_sm - mod_index) * (used_bw_in_table[mod_index] - in_max_bw);
-		if (result > in_remaining_bw) {
-			/* There is not enough remaining in bw to satisfy all modules,
-			   distribute the remaining in bw among modules, then exit */
-			in_max_bw += in_remaining_bw / (num_sm - mod_index);
-			in_remaining_bw = 0;
-			keep_going = false;
-		} else {
-			/* Grant the requested in bandwidth to all modules,
-			   then recalculate the remaining in bandwidth */
-			in_remaining_bw -= result;
-			in_max_bw = used_bw_in_table[mod_index];
-			++mod_index;
-		}
-	}
-
-#ifdef UPDATE_RATES_DEBUG
-	RsDbg() << "UPDATE_RATES pqihandler::UpdateRates mod_index " << mod_index << " in_max_bw " << in_max_bw << " remaining in bw " << in_remaining_bw << std::endl;
-#endif
-
-	// allocate only 75 pct of the remaining in bw, to make the transition more smooth
-	in_max_bw = in_max_bw + 0.75 * in_remaining_bw;
-
-	// store current total in and out used bw 
-	locked_StoreCurrentRates(used_bw_in, used_bw_out);
-
-#ifdef UPDATE_RATES_DEBUG
-	RsDbg() << "UPDATE_RATES pqihandler::UpdateRates setting new out_max " << out_max_bw << " in_max " << in_max_bw << std::endl;
-#endif
-
-	// retrieve the bandwidth limits provided by peers via BwCtrl
-        std::map<RsPeerId, RsConfigDataRates> rateMap;
-        rsConfig->getAllBandwidthRates(rateMap);
-        std::map<RsPeerId, RsConfigDataRates>::iterator rateMap_it;
-
-#ifdef UPDATE_RATES_DEBUG
-	// dump RsConfigurationDataRates
-	RsDbg() << "UPDATE_RATES pqihandler::UpdateRates RsConfigDataRates dump" << std::endl;
-	for (rateMap_it = rateMap.begin(); rateMap_it != rateMap.end(); rateMap_it++)
-		RsDbg () << "UPDATE_RATES pqihandler::UpdateRates PeerId " << rateMap_it->first.toStdString() << " mAllowedOut " << rateMap_it->second.mAllowedOut << std::endl;
-#endif
-
-        // update max rates
-	for(it = mods.begin(); it != mods.end(); ++it)
-	{
-		SearchModule *mod = (it -> second);
-
-		// for our down bandwidth we use the calculated value without taking into account the max up provided by peers via BwCtrl
+		// for our down bandwidth we do not take into account the max up provided by peers via BwCtrl
 		// this is harmless as they will control their up bw on their side
-		mod -> pqi -> setMaxRate(true, in_max_bw);
+		mod -> pqi -> setMaxRate(true, avail_in);
 
 		// for our up bandwidth we take into account the max down provided by peers via BwCtrl
 		// because we don't want to clog our outqueues, the TCP buffers, and the peers inbound queues
-		mod -> pqi -> setMaxRate(false, out_max_bw);
+		float out_max_bw = avail_out;
+
 		if ((rateMap_it = rateMap.find(mod->pqi->PeerId())) != rateMap.end())
-			if (rateMap_it->second.mAllowedOut > 0)
-				if (out_max_bw > rateMap_it->second.mAllowedOut)
-        	                        mod -> pqi -> setMaxRate(false, rateMap_it->second.mAllowedOut);
-	}
+			if (rateMap_it->second.mAllowedOut > 0 && out_max_bw > rateMap_it->second.mAllowedOut)
+				out_max_bw = rateMap_it->second.mAllowedOut;
+
+		mod -> pqi -> setMaxRate(false, out_max_bw);
 
 #ifdef UPDATE_RATES_DEBUG
-	// dump maxRates
-	for(it = mods.begin(); it != mods.end(); ++it)
-	{
-		SearchModule *mod = (it -> second);
 		RsDbg() << "UPDATE_RATES pqihandler::UpdateRates PeerID " << (mod ->pqi -> PeerId()).toStdString() << " new bandwidth limits up " << mod -> pqi -> getMaxRate(false) << " down " << mod -> pqi -> getMaxRate(true) << std::endl;
-	}
 #endif
+	}
+
+	// store current total in and out used bw
+	locked_StoreCurrentRates(used_bw_in, used_bw_out);
 
 	return 1;
 }
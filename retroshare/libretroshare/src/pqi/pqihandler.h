@@ -28,6 +28,7 @@
 #include <map>                   // for map
 
 #include "pqi/pqi.h"             // for P3Interface, pqiPublisher
+#include "pqi/pqibandwidth.h"    // for pqiBandwidthShaper
 #include "retroshare/rstypes.h"  // for RsPeerId
 #include "util/rsthreads.h"      // for RsStackMutex, RsMutex
 
@@ -59,6 +60,7 @@ class pqihandler: public P3Interface, public pqiPublisher
 		{
 			return SendRsRawItem(item);
 		}
+		virtual bool canSend(const RsPeerId& peer_id, uint32_t service_type, uint32_t size);
 
 		bool	AddSearchModule(SearchModule *mod);
 		bool	RemoveSearchModule(SearchModule *mod);
@@ -137,6 +139,8 @@ inline void pqihandler::setMaxRate(bool in, float val)
 		rateMax_in = val;
 	else
 		rateMax_out = val;
+
+	pqiBandwidthShaper::setGlobalMaxRate(in, val);
 	return;
 }
 
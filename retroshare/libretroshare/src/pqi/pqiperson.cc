@@ -107,6 +107,27 @@ bool pqiperson::RecvItem(RsItem *item)
 	return pqipg->recvItem((RsRawItem *) item);
 }
 
+bool pqiperson::incomingCongested(uint32_t packet_id)
+{
+	return pqipg->incomingCongested(packet_id);
+}
+
+bool pqiperson::canSend(uint32_t service_type, uint32_t size)
+{
+	RS_STACK_MUTEX(mPersonMtx);
+
+	// items sent while not connected are deleted, so there is nothing to wait for.
+	if ((!active) || (activepqi == NULL))
+		return true;
+
+	return activepqi->canSend(service_type, size);
+}
+
+void pqiperson::outgoingWritable(uint32_t service_type)
+{
+	pqipg->outgoingWritable(PeerId(), service_type);
+}
+
 
 int pqiperson::status()
 {
@@ -132,6 +132,9 @@ public:
 
 	virtual RsItem *GetItem();
 	virtual bool RecvItem(RsItem *item);
+	virtual bool incomingCongested(uint32_t packet_id);
+	virtual bool canSend(uint32_t service_type, uint32_t size);
+	virtual void outgoingWritable(uint32_t service_type);
 	
 	virtual int status();
 	virtual int	tick();
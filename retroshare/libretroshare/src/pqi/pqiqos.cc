@@ -22,135 +22,246 @@
 #include <iostream>
 #include <list>
 #include <math.h>
+#include <chrono>
 #include <serialiser/rsserial.h>
 #include <serialiser/rsbaseserial.h>
 
 #include "pqiqos.h"
 
 const uint32_t pqiQoS::MAX_PACKET_COUNTER_VALUE = (1 << 24) ;
+const uint32_t pqiQoS::MAX_LEVELS = 32 ;		// size of the bitmap of non-empty levels
+const uint32_t pqiQoS::TOP_LEVEL_QUANTUM = 4096 ;	// bytes per round for the highest priority level
+
+static int64_t getMonotonicTimeUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() ;
+}
+
+static uint16_t getServiceId(const void *data, uint32_t size)
+{
+	uint32_t type = 0 ;
+	uint32_t offset = 0 ;
+
+	if(!getRawUInt32(data, size, &offset, &type))
+		return 0 ;
+
+	return (type >> 8) & 0xffff ;
+}
 
 pqiQoS::pqiQoS(uint32_t nb_levels,float alpha)
-	: _item_queues(nb_levels),_alpha(alpha)
+	: _levels(std::min(nb_levels,MAX_LEVELS)),_non_empty_levels(0),_current_level(-1),_alpha(alpha)
 {
-#ifdef DEBUG
-	assert(pow(alpha,nb_levels) < 1e+20) ;
-#endif
+	if(nb_levels > MAX_LEVELS)
+		std::cerr << "pqiQoS: ****Warning****: " << nb_levels << " priority levels requested. Only " << MAX_LEVELS << " are supported." << std::endl;
 
-	float c = 1.0f ;
-	float inc = alpha ;
 	_nb_items = 0 ;
-    	_id_counter = 0 ;
+	_id_counter = 0 ;
 
-for(int i=((int)nb_levels)-1;i>=0;--i,c *= alpha)
-	{
-		_item_queues[i]._threshold = c ;
-		_item_queues[i]._counter = 0 ;
-		_item_queues[i]._inc = inc ;
-	}
+	// level n+1 gets alpha times more bytes per round than level n
+
+	float q = TOP_LEVEL_QUANTUM ;
+
+	for(int i=((int)_levels.size())-1;i>=0;--i,q /= alpha)
+		_levels[i]._quantum = std::max(1u,uint32_t(q)) ;
+}
+
+pqiQoS::~pqiQoS()
+{
+	clear() ;
 }
 
 void pqiQoS::clear()
 {
-	void *item ;
+	for(uint32_t i=0;i<_levels.size();++i)
+	{
+		for(std::map<uint16_t,ItemQueue>::iterator it(_levels[i]._service_queues.begin());it!=_levels[i]._service_queues.end();++it)
+			while(!it->second._items.empty())
+				free(it->second.pop()) ;
 
-	for(uint32_t i=0;i<_item_queues.size();++i)
-		while( (item = _item_queues[i].pop()) != NULL)
-			free(item) ;
+		_levels[i]._service_queues.clear() ;
+		_levels[i]._active_services.clear() ;
+		_levels[i]._deficit = 0 ;
+	}
 
+	for(std::map<uint16_t,ServiceStatistics>::iterator it(_service_stats.begin());it!=_service_stats.end();++it)
+	{
+		it->second.queued_items = 0 ;
+		it->second.queued_bytes = 0 ;
+	}
+
+	_non_empty_levels = 0 ;
+	_current_level = -1 ;
 	_nb_items = 0 ;
 }
 
 void pqiQoS::print() const
 {
-	std::cerr << "pqiQoS: " << _item_queues.size() << " levels, alpha=" << _alpha ;
+	std::cerr << "pqiQoS: " << _levels.size() << " levels, alpha=" << _alpha ;
 	std::cerr << "  Size = " << _nb_items ;
 	std::cerr << "    Queues: " ;
-	for(uint32_t i=0;i<_item_queues.size();++i)
-		std::cerr << _item_queues[i]._items.size() << " " ;
+	for(uint32_t i=0;i<_levels.size();++i)
+	{
+		uint32_t n = 0 ;
+
+		for(std::map<uint16_t,ItemQueue>::const_iterator it(_levels[i]._service_queues.begin());it!=_levels[i]._service_queues.end();++it)
+			n += it->second.size() ;
+
+		std::cerr << n << " " ;
+	}
 	std::cerr << std::endl;
+
+	for(std::map<uint16_t,ServiceStatistics>::const_iterator it(_service_stats.begin());it!=_service_stats.end();++it)
+		std::cerr << "    service " << std::hex << it->first << std::dec << ": " << it->second.queued_items << " items / " << it->second.queued_bytes
+		          << " bytes queued, " << it->second.sent_items << " sent, avg wait " << (it->second.sent_items?(it->second.total_wait_us / it->second.sent_items):0)
+		          << " us, max wait " << it->second.max_wait_us << " us" << std::endl;
 }
 
 void pqiQoS::in_rsItem(void *ptr,int size,int priority)
 {
-	if(uint32_t(priority) >= _item_queues.size())
+	if(uint32_t(priority) >= _levels.size())
 	{
-		std::cerr << "pqiQoS::in_rsRawItem() ****Warning****: priority " << priority << " out of scope [0," << _item_queues.size()-1 << "]. Priority will be clamped to maximum value." << std::endl;
-		priority = _item_queues.size()-1 ;
+		std::cerr << "pqiQoS::in_rsRawItem() ****Warning****: priority " << priority << " out of scope [0," << _levels.size()-1 << "]. Priority will be clamped to maximum value." << std::endl;
+		priority = _levels.size()-1 ;
 	}
 
-	_item_queues[priority].push(ptr,size,_id_counter++) ;
+	uint16_t service_id = getServiceId(ptr,size) ;
+	PriorityLevel& level(_levels[priority]) ;
+	ItemQueue& queue(level._service_queues[service_id]) ;
+
+	if(queue._items.empty())
+		level._active_services.push_back(service_id) ;
+
+	queue.push(ptr,size,_id_counter++,getMonotonicTimeUs()) ;
+	_non_empty_levels |= (1u << priority) ;
 	++_nb_items ;
-    
-    	if(_id_counter >= MAX_PACKET_COUNTER_VALUE)
-            _id_counter = 0 ;
+
+	ServiceStatistics& stats(_service_stats[service_id]) ;
+	++stats.queued_items ;
+	stats.queued_bytes += size ;
+
+	if(_id_counter >= MAX_PACKET_COUNTER_VALUE)
+		_id_counter = 0 ;
 }
 
-// int pqiQoS::gatherStatistics(std::vector<uint32_t>& per_service_count,std::vector<uint32_t>& per_priority_count) const
-// {
-//     assert(per_priority_count.size() == 10) ;
-//     assert(per_service_count.size() == 65536) ;
-//
-//     for(uint32_t i=0;i<_item_queues.size();++i)
-//     {
-//         per_priority_count[i] += _item_queues[i].size() ;
-//
-//         for(std::list<void*>::const_iterator it(_item_queues[i]._items.begin());it!=_item_queues[i]._items.end();++it)
-//         {
-//                         uint32_t type = 0;
-//                         uint32_t offset = 0;
-//                         getRawUInt32((uint8_t*)(*it), 4, &offset, &type);
-//
-//             uint16_t service_id =  (type >> 8) & 0xffff ;
-//
-//             ++per_service_count[service_id] ;
-//         }
-//     }
-//     return 1 ;
-// }
+int pqiQoS::top_priority() const
+{
+	if(_non_empty_levels == 0)
+		return -1 ;
+
+	return 31 - __builtin_clz(_non_empty_levels) ;
+}
 
+// Levels are visited from the highest to the lowest non empty one, then the
+// round starts again from the top.
 
-void *pqiQoS::out_rsItem(uint32_t max_slice_size, uint32_t& size, bool& starts, bool& ends, uint32_t& packet_id) 
+int pqiQoS::nextLevel(int level) const
 {
-	// Go through the queues. Increment counters.
+	uint32_t lower = (level > 0)?(_non_empty_levels & ((1u << level) - 1)):0 ;
 
-	if(_nb_items == 0)
-		return NULL ;
+	if(lower != 0)
+		return 31 - __builtin_clz(lower) ;
 
-	float inc = 1.0f ;
-	int i = _item_queues.size()-1 ;
+	return top_priority() ;
+}
 
-	while(i > 0 && _item_queues[i]._items.empty())
-		--i, inc = _item_queues[i]._inc ;
+// When no level has enough deficit to send its next slice, give all of them the
+// number of rounds needed for the first one to be able to send. This is what DRR
+// would do by looping, without the loop.
 
-	int last = i ;
+void pqiQoS::fastForward(uint32_t max_slice_size)
+{
+	int64_t rounds = -1 ;
 
-	for(int j=i;j>=0;--j)
-		if( (!_item_queues[j]._items.empty()) && ((_item_queues[j]._counter += inc) >= _item_queues[j]._threshold ))
-		{
-			last = j ;
-			_item_queues[j]._counter -= _item_queues[j]._threshold ;
-		}
+	for(uint32_t m = _non_empty_levels;m != 0;m &= m-1)
+	{
+		const PriorityLevel& level(_levels[__builtin_ctz(m)]) ;
+		const ItemQueue& queue(level._service_queues.find(level._active_services.front())->second) ;
 
-	if(last >= 0)
+		int64_t missing = int64_t(queue.nextSliceSize(max_slice_size)) - level._deficit ;
+		int64_t r = (missing <= 0)?0:((missing + level._quantum - 1) / level._quantum) ;
+
+		if(rounds < 0 || r < rounds)
+			rounds = r ;
+	}
+
+	for(uint32_t m = _non_empty_levels;m != 0;m &= m-1)
 	{
-#ifdef DEBUG
-		assert(_nb_items > 0) ;
-#endif
-        
-        	// now chop a slice of this item
-        
-        	void *res = _item_queues[last].slice(max_slice_size,size,starts,ends,packet_id) ;
-            
-            	if(ends)
-			--_nb_items ;
-                
-		return res ;
+		PriorityLevel& level(_levels[__builtin_ctz(m)]) ;
+		level._deficit += rounds * level._quantum ;
 	}
-	else
-		return NULL ;
 }
 
+void *pqiQoS::out_rsItem(uint32_t max_slice_size, uint32_t& size, bool& starts, bool& ends, uint32_t& packet_id) 
+{
+	if(_nb_items == 0)
+		return NULL ;
+
+	int nb_levels = __builtin_popcount(_non_empty_levels) ;
+	int misses = 0 ;
 
+	if(_current_level < 0 || !(_non_empty_levels & (1u << _current_level)))
+	{
+		_current_level = nextLevel(_current_level) ;
+		_levels[_current_level]._deficit += _levels[_current_level]._quantum ;
+	}
+
+	for(;;)
+	{
+		PriorityLevel& level(_levels[_current_level]) ;
+		uint16_t service_id = level._active_services.front() ;
+		ItemQueue& queue(level._service_queues[service_id]) ;
 
-    
-    
+		if(level._deficit >= queue.nextSliceSize(max_slice_size))
+		{
+			int64_t queued_TS = queue._items.front().queued_TS ;
+			void *res = queue.slice(max_slice_size,size,starts,ends,packet_id) ;
+
+			ServiceStatistics& stats(_service_stats[service_id]) ;
+
+			if(res)
+			{
+				level._deficit -= size ;
+				stats.queued_bytes -= std::min(stats.queued_bytes,uint64_t(size)) ;
+			}
+
+			if(ends)
+			{
+				--_nb_items ;
+				--stats.queued_items ;
+
+				uint64_t wait = getMonotonicTimeUs() - queued_TS ;
+				++stats.sent_items ;
+				stats.total_wait_us += wait ;
+				stats.max_wait_us = std::max(stats.max_wait_us,wait) ;
+			}
+
+			// next service of the same level goes next. Services that have nothing
+			// left to send leave the round robin.
+
+			level._active_services.pop_front() ;
+
+			if(!queue._items.empty())
+				level._active_services.push_back(service_id) ;
+			else
+				level._service_queues.erase(service_id) ;
+
+			if(level._active_services.empty())
+			{
+				_non_empty_levels &= ~(1u << _current_level) ;
+				level._deficit = 0 ;
+			}
+			return res ;
+		}
+
+		if(++misses >= nb_levels)
+		{
+			fastForward(max_slice_size) ;
+			misses = 0 ;
+		}
+		else
+		{
+			_current_level = nextLevel(_current_level) ;
+			_levels[_current_level]._deficit += _levels[_current_level]._quantum ;
+		}
+	}
+}
@@ -24,10 +24,16 @@
 // priority level. The QoS algorithm must ensure that:
 //
 // - lower priority items get out with lower rate than high priority items
-// - items of equal priority get out of the queue in the same order than they got in
-// - items of level n+1 are output \alpha times more often than items of level n. 
+// - items of equal priority and service get out of the queue in the same order than they got in
+// - items of level n+1 get \alpha times more bandwidth than items of level n.
 //   \alpha is a constant that is not necessarily an integer, but strictly > 1.
 // - the set of possible priority levels is finite, and pre-determined.
+// - within a level, services are served in round robin, so that a burst of one
+//   service (e.g. GXS sync) does not delay the other services of the same level.
+//
+// Levels are scheduled with deficit round robin: each non-empty level receives
+// a quantum of bytes proportional to \alpha^level at each round, and a bitmap of
+// the non-empty levels makes the selection of the next level O(1).
 //
 #pragma once
 
@@ -36,7 +42,9 @@
 #include <string.h>
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <list>
+#include <map>
 
 #include <util/rsmemory.h>
 
@@ -44,6 +52,7 @@ class pqiQoS
 {
 public:
 	pqiQoS(uint32_t max_levels,float alpha) ;
+	~pqiQoS() ;
 
 	struct ItemRecord
 	{
@@ -51,16 +60,14 @@ public:
 		uint32_t current_offset ;
 		uint32_t size ;
 		uint32_t id ;
+		int64_t queued_TS ;	// in microseconds, for wait time statistics
 	};
 
+	// FIFO of the items of a single service at a given priority level.
+	//
 	class ItemQueue 
 	{
 	public:
-		ItemQueue()
-		  : _threshold(0.0)
-		  , _counter(0.0)
-		  , _inc(0.0)
-		{}
 		void *pop() 
 		{
 			if(_items.empty())
@@ -72,6 +79,17 @@ public:
 			return item ;
 		}
 
+		// Size of the next slice that will come out of slice().
+		uint32_t nextSliceSize(uint32_t max_size) const
+		{
+			const ItemRecord& rec(_items.front()) ;
+
+			if(rec.current_offset == 0 && rec.size < max_size)
+				return rec.size ;
+
+			return std::min(max_size, uint32_t((int)rec.size - (int)rec.current_offset)) ;
+		}
+
 		void *slice(uint32_t max_size,uint32_t& size,bool& starts,bool& ends,uint32_t& packet_id) 
 		{
 			if(_items.empty())
@@ -96,7 +114,8 @@ public:
 			if(rec.size <= rec.current_offset)
 			{
 				std::cerr << "(EE) severe error in slicing in QoS." << std::endl;
-				pop() ;
+				free(pop()) ;
+				ends = true ;
 				return NULL ;
 			}
 
@@ -106,7 +125,8 @@ public:
 			if(!mem)
 			{
 				std::cerr << "(EE) memory allocation error in QoS." << std::endl;
-				pop() ;
+				free(pop()) ;
+				ends = true ;
 				return NULL ;
 			}
 
@@ -123,7 +143,7 @@ public:
 			return mem ;
 		}
 
-		void push(void *item,uint32_t size,uint32_t id) 
+		void push(void *item,uint32_t size,uint32_t id,int64_t now) 
 		{
 			ItemRecord rec ;
 
@@ -131,17 +151,25 @@ public:
 			rec.current_offset = 0 ;
 			rec.size = size ;
 			rec.id = id ;
+			rec.queued_TS = now ;
 
 			_items.push_back(rec) ;
 		}
 
-        uint32_t size() const { return _items.size() ; }
+		uint32_t size() const { return _items.size() ; }
 
-		float _threshold ;
-		float _counter ;
-		float _inc ;
+		std::deque<ItemRecord> _items ;
+	};
+
+	struct ServiceStatistics
+	{
+		ServiceStatistics() : queued_items(0), queued_bytes(0), sent_items(0), total_wait_us(0), max_wait_us(0) {}
 
-		std::list<ItemRecord> _items ;
+		uint32_t queued_items ;		// current depth of the queues of this service, all levels together
+		uint64_t queued_bytes ;
+		uint64_t sent_items ;		// items completely sent since the queue was created
+		uint64_t total_wait_us ;	// accumulated time spent in the queue by the sent items
+		uint64_t max_wait_us ;
 	};
 
 	// This function pops items from the queue, y order of priority
@@ -155,25 +183,54 @@ public:
 	void print() const ;
 	uint64_t qos_queue_size() const { return _nb_items ; }
 
+	// Highest priority level that currently holds items, or -1 if the queue is empty.
+	int top_priority() const ;
+
 	// kills all waiting items.
 	void clear() ;
 
-	// get some stats about what's going on. service_packets will contain the number of
-	// packets per service, and queue_sizes will contain the size of the different priority queues.
+	// get some stats about what's going on: queue depth and wait time of the items,
+	// per service id.
+
+	void getServiceStatistics(std::map<uint16_t,ServiceStatistics>& stats) const { stats = _service_stats ; }
 
-	//int gatherStatistics(std::vector<uint32_t>& per_service_count,std::vector<uint32_t>& per_priority_count) const ;
+	// bytes currently queued for the given service id, all levels together.
+	uint64_t service_queue_bytes(uint16_t service_id) const
+	{
+		std::map<uint16_t,ServiceStatistics>::const_iterator it = _service_stats.find(service_id) ;
+		return (it == _service_stats.end())?0:it->second.queued_bytes ;
+	}
 
 	void computeTotalItemSize() const ;
 	int debug_computeTotalItemSize() const ;
 private:
-	// This vector stores the lists of items with equal priorities.
+	struct PriorityLevel
+	{
+		PriorityLevel() : _quantum(0), _deficit(0) {}
+
+		std::map<uint16_t,ItemQueue> _service_queues ;
+		std::list<uint16_t> _active_services ;	// services with pending items, in round robin order
+
+		uint32_t _quantum ;	// bytes credited at each DRR round
+		int64_t  _deficit ;
+	};
+
+	int nextLevel(int level) const ;
+	void fastForward(uint32_t max_slice_size) ;
+
+	// This vector stores the queues of items with equal priorities.
 	//
-	std::vector<ItemQueue> _item_queues ;
+	std::vector<PriorityLevel> _levels ;
+	uint32_t _non_empty_levels ;	// bit i is set when level i holds items
+	int _current_level ;		// level currently served by the DRR, -1 at the start of a round
+
+	std::map<uint16_t,ServiceStatistics> _service_stats ;
+
 	float _alpha ;
 	uint64_t _nb_items ;
 	uint32_t _id_counter ;
 
 	static const uint32_t MAX_PACKET_COUNTER_VALUE ;
+	static const uint32_t MAX_LEVELS ;
+	static const uint32_t TOP_LEVEL_QUANTUM ;
 };
-
-
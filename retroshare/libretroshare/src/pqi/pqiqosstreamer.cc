@@ -43,6 +43,12 @@ int pqiQoSstreamer::getQueueSize(bool in)
 	}
 }
 
+void pqiQoSstreamer::getServiceQueueStatistics(std::map<uint16_t,pqiQoS::ServiceStatistics>& stats)
+{
+	RsStackMutex stack(mStreamerMtx); /**** LOCKED MUTEX ****/
+	pqiQoS::getServiceStatistics(stats) ;
+}
+
 //int  pqiQoSstreamer::locked_gatherStatistics(std::vector<uint32_t>& per_service_count,std::vector<uint32_t>& per_priority_count) const // extracting data.
 //{
 //    return pqiQoS::gatherStatistics(per_service_count,per_priority_count) ;
@@ -36,12 +36,17 @@ class pqiQoSstreamer: public pqithreadstreamer, public pqiQoS
 		virtual int locked_out_queue_size() const { return _total_item_count ; }
 		virtual void locked_clear_out_queue() ;
 		virtual int locked_compute_out_pkt_size() const { return _total_item_size ; }
+		virtual uint64_t locked_out_queue_service_bytes(uint16_t service_id) const { return service_queue_bytes(service_id) ; }
+		virtual int locked_out_queue_top_priority() const { return top_priority() ; }
 		virtual  void *locked_pop_out_data(uint32_t max_slice_size,uint32_t& size,bool& starts,bool& ends,uint32_t& packet_id);
                 //virtual int  locked_gatherStatistics(std::vector<uint32_t>& per_service_count,std::vector<uint32_t>& per_priority_count) const; // extracting data.
 
 
 		virtual int getQueueSize(bool in) ;
 
+		// Depth and wait time of the out queue, per service.
+		void getServiceQueueStatistics(std::map<uint16_t,pqiQoS::ServiceStatistics>& stats) ;
+
 	private:
 		uint32_t _total_item_size ;
 		uint32_t _total_item_count ;
@@ -19,6 +19,8 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
  *                                                                             *
  *******************************************************************************/
+#include <chrono>
+
 #include "pqi/pqiservice.h"
 #include "util/rsdebug.h"
 #include "util/rsstring.h"
@@ -31,9 +33,18 @@ const int pqiservicezone = 60478;
  * #define SERVICE_DEBUG 1
  ****/
 
-void pqiService::setServiceServer(p3ServiceServerIface *server)
+void pqiService::setServiceServer(p3ServiceServerIface *server, uint32_t service_type)
 {
 	mServiceServer = server;
+	mServiceType = service_type;
+}
+
+bool pqiService::canSendItems(const RsPeerId& peer_id, uint32_t size)
+{
+	if(!mServiceServer)
+		return true;
+
+	return mServiceServer->canSend(peer_id, mServiceType, size);
 }
 
 bool pqiService::send(RsRawItem *item)
@@ -42,7 +53,7 @@ bool pqiService::send(RsRawItem *item)
 }
 
 
-p3ServiceServer::p3ServiceServer(pqiPublisher *pub, p3ServiceControl *ctrl) : mPublisher(pub), mServiceControl(ctrl), srvMtx("p3ServiceServer") 
+p3ServiceServer::p3ServiceServer(pqiPublisher *pub, p3ServiceControl *ctrl) : mPublisher(pub), mServiceControl(ctrl), srvMtx("p3ServiceServer"), mServicesHeld(false)
 {
 	RS_STACK_MUTEX(srvMtx); /********* LOCKED *********/
 
@@ -51,9 +62,43 @@ p3ServiceServer::p3ServiceServer(pqiPublisher *pub, p3ServiceControl *ctrl) : mP
 		"p3ServiceServer::p3ServiceServer()");
 #endif
 
+	for(int i=0;i<256;++i)
+		mServiceTable[i].store(NULL);
+
 	return;
 }
 
+p3ServiceServer::~p3ServiceServer()
+{
+	for(int i=0;i<256;++i)
+		delete mServiceTable[i].load();
+
+	for(std::list<ServiceEntry*>::iterator it(mAllEntries.begin());it!=mAllEntries.end();++it)
+		delete *it;
+
+	for(std::list<RsRawItem*>::iterator it(mHeldItems.begin());it!=mHeldItems.end();++it)
+		delete *it;
+}
+
+p3ServiceServer::ServiceEntry *p3ServiceServer::findEntry(uint32_t packet_id)
+{
+	// packet ids are version (8 bits) | service (16 bits) | sub type (8 bits)
+
+	uint32_t service = (packet_id >> 8) & 0xffff;
+
+	ServicePage *page = mServiceTable[service >> 8].load(std::memory_order_acquire);
+
+	if(!page)
+		return NULL;
+
+	ServiceEntry *entry = page->entries[service & 0xff].load(std::memory_order_acquire);
+
+	if(!entry || entry->service_type != (packet_id & 0xffffff00))
+		return NULL;
+
+	return entry;
+}
+
 int	p3ServiceServer::addService(pqiService *ts, bool defaultOn)
 {
 	RS_STACK_MUTEX(srvMtx); /********* LOCKED *********/
@@ -73,9 +118,22 @@ int	p3ServiceServer::addService(pqiService *ts, bool defaultOn)
 		return -1;
 	}
 
-	ts->setServiceServer(this);
+	ts->setServiceServer(this, info.mServiceType);
 	services[info.mServiceType] = ts;
 
+	uint32_t service = (info.mServiceType >> 8) & 0xffff;
+	ServicePage *page = mServiceTable[service >> 8].load();
+
+	if(!page)
+	{
+		page = new ServicePage;
+		mServiceTable[service >> 8].store(page, std::memory_order_release);
+	}
+
+	ServiceEntry *entry = new ServiceEntry(ts, info.mServiceType);
+	mAllEntries.push_back(entry);
+	page->entries[service & 0xff].store(entry, std::memory_order_release);
+
 	// This doesn't need to be in Mutex.
 	mServiceControl->registerService(info,defaultOn);
 
@@ -119,6 +177,12 @@ int p3ServiceServer::removeService(pqiService *ts)
 
 	services.erase(it);
 
+	uint32_t service = (info.mServiceType >> 8) & 0xffff;
+	ServicePage *page = mServiceTable[service >> 8].load();
+
+	if(page)
+		page->entries[service & 0xff].store(NULL, std::memory_order_release);
+
 	return 1;
 }
 
@@ -132,25 +196,90 @@ bool	p3ServiceServer::recvItem(RsRawItem *item)
 		return false;
 	}
 
-	pqiService *s = NULL;
+	ServiceEntry *entry = findEntry(item->PacketId());
 
-	// access the service map under mutex lock
+	if (!entry)
 	{
-		RS_STACK_MUTEX(srvMtx);
-		auto it = services.find(item -> PacketId() & 0xffffff00);
-		if (it == services.end())
+		delete item;
+		return false;
+	}
+
+	if(entry->held.load(std::memory_order_acquire))
+	{
+		RS_STACK_MUTEX(srvMtx); /********* LOCKED *********/
+
+		if(entry->held.load(std::memory_order_relaxed))	// not released meanwhile
 		{
-			delete item;
-			return false;
+			mHeldItems.push_back(item);
+			return true;
 		}
-		s = it->second;
 	}
 
-	// then call recv off mutex
-	bool result = s->recv(item);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	bool result = entry->service->recv(item);
+
+	uint64_t dispatch_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	// Statistics are updated without lock, several connection threads may
+	// lose an update now and then.
+
+	entry->items_received.fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t avg = entry->avg_dispatch_us.load(std::memory_order_relaxed);
+	entry->avg_dispatch_us.store(avg - avg/16 + dispatch_us/16, std::memory_order_relaxed);
+
+	if(dispatch_us > entry->max_dispatch_us.load(std::memory_order_relaxed))
+		entry->max_dispatch_us.store(dispatch_us, std::memory_order_relaxed);
+
 	return result;
 }
 
+bool p3ServiceServer::incomingCongested(uint32_t packet_id)
+{
+	ServiceEntry *entry = findEntry(packet_id);
+
+	return entry != NULL && entry->service->incomingQueueFull();
+}
+
+bool p3ServiceServer::canSend(const RsPeerId& peer_id, uint32_t service_type, uint32_t size)
+{
+	return mPublisher->canSend(peer_id, service_type, size);
+}
+
+void p3ServiceServer::outgoingWritable(const RsPeerId& peer_id, uint32_t service_type)
+{
+	ServiceEntry *entry = findEntry(service_type);
+
+	if(entry)
+		entry->service->outgoingWritable(peer_id);
+}
+
+bool p3ServiceServer::getServiceQueueStats(std::map<uint32_t, RsServiceQueueStats>& stats)
+{
+	RS_STACK_MUTEX(srvMtx); /********* LOCKED *********/
+
+	stats.clear();
+
+	for(std::map<uint32_t, pqiService *>::const_iterator it(services.begin());it!=services.end();++it)
+	{
+		ServiceEntry *entry = findEntry(it->first);
+
+		if(!entry)
+			continue;
+
+		RsServiceQueueStats& s(stats[it->first]);
+
+		s.mServiceType       = it->first;
+		s.mItemsReceived     = entry->items_received.load(std::memory_order_relaxed);
+		s.mAverageDispatchUs = entry->avg_dispatch_us.load(std::memory_order_relaxed);
+		s.mMaxDispatchUs     = entry->max_dispatch_us.load(std::memory_order_relaxed);
+
+		it->second->getIncomingQueueStats(s);
+	}
+	return true;
+}
+
 bool p3ServiceServer::sendItem(RsRawItem *item)
 {
 #ifdef  SERVICE_DEBUG
@@ -183,13 +312,18 @@ bool p3ServiceServer::sendItem(RsRawItem *item)
 
 int	p3ServiceServer::tick()
 {
-	mServiceControl->tick();
+	// Monitors are told about friends once all services can handle it.
+	if(!mServicesHeld.load())
+		mServiceControl->tick();
 
 	// make a copy of the service map
 	std::map<uint32_t,pqiService *> local_map;
 	{	
 		RS_STACK_MUTEX(srvMtx);
 		local_map=services;
+
+		for(std::list<ServiceEntry*>::const_iterator it(mHeldEntries.begin());it!=mHeldEntries.end();++it)
+			local_map.erase((*it)->service_type);
 	}
 
 	// tick all services off mutex
@@ -201,3 +335,58 @@ int	p3ServiceServer::tick()
 	return 1;
 
 }
+
+void p3ServiceServer::holdService(pqiService *ts)
+{
+	RS_STACK_MUTEX(srvMtx); /********* LOCKED *********/
+
+	for(std::map<uint32_t, pqiService *>::const_iterator it(services.begin());it!=services.end();++it)
+		if(it->second == ts)
+		{
+			ServiceEntry *entry = findEntry(it->first);
+
+			if(!entry || entry->held.load())
+				return;
+
+			entry->held.store(true, std::memory_order_release);
+			mHeldEntries.push_back(entry);
+			mServicesHeld.store(true);
+			return;
+		}
+}
+
+void p3ServiceServer::releaseServices()
+{
+	// Items keep arriving while the kept ones are given to their service, so
+	// the services are only released once there is nothing left to give them.
+	// Items are given off mutex, as services may send items when receiving.
+
+	for(;;)
+	{
+		std::list<RsRawItem*> items;
+		{
+			RS_STACK_MUTEX(srvMtx); /********* LOCKED *********/
+
+			if(mHeldItems.empty())
+			{
+				for(std::list<ServiceEntry*>::iterator it(mHeldEntries.begin());it!=mHeldEntries.end();++it)
+					(*it)->held.store(false, std::memory_order_release);
+
+				mHeldEntries.clear();
+				mServicesHeld.store(false);
+				return;
+			}
+			items.swap(mHeldItems);
+		}
+
+		for(std::list<RsRawItem*>::iterator it(items.begin());it!=items.end();++it)
+		{
+			ServiceEntry *entry = findEntry((*it)->PacketId());
+
+			if(entry)
+				entry->service->recv(*it);
+			else
+				delete *it;		// removed meanwhile
+		}
+	}
+}
@@ -58,12 +58,12 @@ class pqiService
 protected:
 
 	pqiService() // our type of packets.
-	    :mServiceServer(NULL) { return; }
+	    :mServiceServer(NULL), mServiceType(0) { return; }
 
 	virtual ~pqiService() { return; }
 
 public:
-	void 	setServiceServer(p3ServiceServerIface *server);
+	void 	setServiceServer(p3ServiceServerIface *server, uint32_t service_type = 0);
 	//
 	virtual bool	recv(RsRawItem *) = 0;
 	virtual bool	send(RsRawItem *item);
@@ -74,11 +74,30 @@ public:
 
 	virtual void getItemNames(std::map<uint8_t,std::string>& /*names*/) const {}	// This does nothing by default. Service should derive it in order to give info for the UI
 
+	// Services that queue their incoming items report here when they cannot keep up.
+	// The connections that feed them then read less until the queue is drained.
+	virtual bool incomingQueueFull() { return false; }
+
+	// Fills the mQueue* fields. Returns false if the service has no incoming queue.
+	virtual bool getIncomingQueueStats(RsServiceQueueStats& /*stats*/) { return false; }
+
+	// Out queue budgets (see pqi/pqibandwidth.h). Services that can produce more
+	// data than a friend takes (file data, forwarded tunnel data...) check that
+	// size more bytes fit in the out queue of peer_id before producing them.
+	// When they do not, outgoingWritable(peer_id) is called once the queue has
+	// drained, from the thread of that connection. Items that are sent anyway
+	// are queued as usual.
+	bool	canSendItems(const RsPeerId& peer_id, uint32_t size);
+	virtual void outgoingWritable(const RsPeerId& /*peer_id*/) {}
+
 private:
 	p3ServiceServerIface *mServiceServer; // const, no need for mutex.
+	uint32_t mServiceType;
 };
 
 #include <map>
+#include <atomic>
+#include <list>
 
 /* We are pushing the packets back through p3ServiceServer, 
  * so that we can filter services at this level later...
@@ -98,12 +117,27 @@ public:
 	virtual bool	sendItem(RsRawItem *) = 0;
 
 	virtual bool    getServiceItemNames(uint32_t service_type,std::map<uint8_t,std::string>& names) =0;
+
+	virtual bool	canSend(const RsPeerId& /*peer_id*/, uint32_t /*service_type*/, uint32_t /*size*/) { return true; }
 };
 
+/* Incoming items are handed to services by the thread of the connection they
+ * arrived on. Services are found without locking, in a table indexed by the 16
+ * bits service number of the packet id. Services that queue their items (see
+ * p3Service) do so without locking either, so a slow service only delays its
+ * own items.
+ *
+ * Services can be held while their config is still being loaded, so that the
+ * network starts before all configs are loaded. The items of a held service
+ * are kept until it is released, and it is not ticked. The service monitors
+ * are not notified about friends and services either while a service is held.
+ */
+
 class p3ServiceServer : public p3ServiceServerIface
 {
 public:
 	p3ServiceServer(pqiPublisher *pub, p3ServiceControl *ctrl);
+	virtual ~p3ServiceServer();
 
 	int	addService(pqiService *, bool defaultOn);
 	int	removeService(pqiService *);
@@ -112,11 +146,47 @@ public:
 	bool	sendItem(RsRawItem *);
 
 	bool getServiceItemNames(uint32_t service_type, std::map<uint8_t,std::string>& names) ;
+	bool getServiceQueueStats(std::map<uint32_t, RsServiceQueueStats>& stats) ;
+
+	/// true if the service of packet_id cannot keep up with its incoming items.
+	bool incomingCongested(uint32_t packet_id) ;
+
+	/// out queue budgets, see pqiService::canSendItems()
+	bool canSend(const RsPeerId& peer_id, uint32_t service_type, uint32_t size) ;
+	void outgoingWritable(const RsPeerId& peer_id, uint32_t service_type) ;
 
 	int	tick();
+
+	/// Keeps the incoming items of the service, and stops ticking it, until releaseServices() is called.
+	void	holdService(pqiService *) ;
+
+	/// Gives the held services the items kept for them, in the order they arrived, and lets them run again.
+	void	releaseServices() ;
 public:
 
 private:
+	struct ServiceEntry
+	{
+		ServiceEntry(pqiService *s,uint32_t type)
+		    : service(s), service_type(type), held(false), items_received(0), avg_dispatch_us(0), max_dispatch_us(0) {}
+
+		pqiService *service ;
+		uint32_t service_type ;		// full type, with the version byte
+
+		std::atomic<bool> held ;	// only set or cleared under srvMtx
+
+		std::atomic<uint64_t> items_received ;
+		std::atomic<uint64_t> avg_dispatch_us ;
+		std::atomic<uint64_t> max_dispatch_us ;
+	};
+
+	struct ServicePage
+	{
+		ServicePage() { for(int i=0;i<256;++i) entries[i].store(NULL) ; }
+		std::atomic<ServiceEntry*> entries[256] ;
+	};
+
+	ServiceEntry *findEntry(uint32_t packet_id) ;
 
 	pqiPublisher *mPublisher;	// constant no need for mutex.
 	p3ServiceControl *mServiceControl;
@@ -124,6 +194,16 @@ private:
 	RsMutex srvMtx;
 	std::map<uint32_t, pqiService *> services;
 
+	// Lookup table, written under srvMtx and read without lock. Pages and
+	// entries are only deleted with the server, since a connection thread may
+	// still be using the entry of a service that was just removed.
+
+	std::atomic<ServicePage*> mServiceTable[256];
+	std::list<ServiceEntry*> mAllEntries;
+
+	std::list<RsRawItem*> mHeldItems;		// items of the held services, in the order they arrived
+	std::list<ServiceEntry*> mHeldEntries;
+	std::atomic<bool> mServicesHeld;
 };
 
 
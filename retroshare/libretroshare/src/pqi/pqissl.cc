@@ -33,6 +33,7 @@
 #include <openssl/err.h>
 
 #include "pqi/pqissllistener.h"
+#include "pqi/pqisslhandshakepool.h"
 
 #include "pqi/p3linkmgr.h"
 #include "retroshare/rspeers.h"
@@ -202,6 +203,7 @@ int pqissl::reset_locked()
 	{
 		//outLog << "pqissl::reset() Shutting down SSL Connection";
 		//outLog << std::endl;
+		pqiSSLHandshakePool::instance().forget(ssl_connection);
 		SSL_shutdown(ssl_connection);
 		SSL_free (ssl_connection);
 
@@ -1028,12 +1030,18 @@ int 	pqissl::Initiate_SSL_Connection()
 
     	if(ssl_connection != NULL)
 	{
+		pqiSSLHandshakePool::instance().forget(ssl_connection);
 		SSL_shutdown(ssl_connection);
 		SSL_free(ssl_connection) ;
 	}
         
 	ssl_connection = ssl;
 
+	// offer the session of the last connection to this peer, if any, so that
+	// both sides can skip the key exchange and certificate checks.
+	if (sslmode == PQISSL_ACTIVE)
+		AuthSSL::instance().setResumableSession(ssl, PeerId());
+
 	net_internal_SSL_set_fd(ssl, sockfd);
 	if (err < 1)
 	{
@@ -1081,25 +1089,22 @@ int pqissl::SSL_Connection_Complete()
 
 	/* if we are passive - then accept! */
 	int err;
+	int serr = SSL_ERROR_NONE;
+	unsigned long err_err = 0;
 
-	if (sslmode == PQISSL_ACTIVE)
-	{
 #ifdef PQISSL_LOG_DEBUG 
+	if (sslmode == PQISSL_ACTIVE)
         rslog(RSL_DEBUG_BASIC, pqisslzone, "--------> Active Connect! Client side.");
-#endif
-        err = SSL_connect(ssl_connection);
-	}
 	else
-	{
-#ifdef PQISSL_LOG_DEBUG 
         rslog(RSL_DEBUG_BASIC, pqisslzone, "--------> Passive Accept! Server side.");
 #endif
-		err = SSL_accept(ssl_connection);
-	}
+
+	// The handshake steps run on the handshake pool, a pending step is
+	// reported as SSL_ERROR_WANT_READ.
+	err = pqiSSLHandshakePool::instance().handshake(ssl_connection, sslmode != PQISSL_ACTIVE, serr, err_err);
 
 	if (err != 1)
 	{
-		int serr = SSL_get_error(ssl_connection, err);
 		if ((serr == SSL_ERROR_WANT_READ)  || (serr == SSL_ERROR_WANT_WRITE))
 		{
 #ifdef PQISSL_LOG_DEBUG 
@@ -1128,7 +1133,7 @@ int pqissl::SSL_Connection_Complete()
 
 		std::string out;
 		rs_sprintf(out, "pqissl::SSL_Connection_Complete()\nIssues with SSL Connect(%d)!\n", err);
-		printSSLError(ssl_connection, err, serr, ERR_get_error(), out);
+		printSSLError(ssl_connection, err, serr, err_err, out);
 
 		rslog(RSL_WARNING, pqisslzone, out);
 
@@ -1168,6 +1173,17 @@ int pqissl::Authorise_SSL_Connection()
 	// reset switch.
 	waiting = WAITING_NOT;
 
+	/* Resumed sessions skip AuthSSL::VerifyX509Callback, the peer has to be
+	 * checked again in case the friendship changed in the meantime. */
+	if( SSL_session_reused(ssl_connection) &&
+	        !AuthSSL::instance().VerifyResumedSession(ssl_connection) )
+	{
+		RsInfo() << __PRETTY_FUNCTION__ << " resumed session of peer "
+		         << PeerId() << " refused." << std::endl;
+		reset_locked();
+		return failure;
+	}
+
 #ifdef RS_PQISSL_AUTH_DOUBLE_CHECK
 	X509* peercert = SSL_get_peer_certificate(ssl_connection);
 	if (!peercert)
@@ -1349,6 +1365,7 @@ int pqissl::accept_locked( SSL *ssl, int fd,
 	{
 		RsInfo() << __PRETTY_FUNCTION__
 		          << " closing Previous/Existing ssl_connection" << std::endl;
+		pqiSSLHandshakePool::instance().forget(ssl_connection);
 		SSL_shutdown(ssl_connection);
 		SSL_free (ssl_connection);
 	}
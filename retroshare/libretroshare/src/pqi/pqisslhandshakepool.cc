@@ -0,0 +1,209 @@
+/*******************************************************************************
+ * libretroshare/src/pqi: pqisslhandshakepool.cc                               *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#include <algorithm>
+
+#include <openssl/err.h>
+
+#include "pqi/pqisslhandshakepool.h"
+
+pqiSSLHandshakePool& pqiSSLHandshakePool::instance()
+{
+	static pqiSSLHandshakePool pool ;
+	return pool ;
+}
+
+pqiSSLHandshakePool::pqiSSLHandshakePool(uint32_t max_threads)
+    : mRunningTotal(0), mMaxThreads(max_threads), mStopping(false)
+{
+	// Handshake steps are pure CPU work (the sockets are non blocking), so
+	// there is no point in having more threads than cores, but two threads
+	// keep a slow PGP check from holding back all other handshakes.
+
+	if(mMaxThreads == 0)
+		mMaxThreads = std::min(4u,std::max(2u,std::thread::hardware_concurrency())) ;
+}
+
+pqiSSLHandshakePool::~pqiSSLHandshakePool()
+{
+	shutdown() ;
+}
+
+void pqiSSLHandshakePool::shutdown()
+{
+	std::vector<std::thread> workers ;
+	{
+		std::lock_guard<std::mutex> lock(mMtx) ;
+
+		// Queued steps are dropped. Running ones are left to the workers, and
+		// their result is not collected anymore.
+
+		for(std::list<SSL*>::const_iterator it(mQueue.begin());it!=mQueue.end();++it)
+			mSteps.erase(*it) ;
+
+		mQueue.clear() ;
+		mStopping = true ;
+		workers.swap(mWorkers) ;
+	}
+	mCond.notify_all() ;
+
+	for(std::thread& t : workers)
+		t.join() ;
+}
+
+int pqiSSLHandshakePool::handshake(SSL *ssl, bool accept, int& ssl_err, unsigned long& err_err)
+{
+	std::unique_lock<std::mutex> lock(mMtx) ;
+
+	std::map<SSL*,Step>::iterator it = mSteps.find(ssl) ;
+
+	if(mStopping)
+	{
+		// running steps are waited for by shutdown(), or forget()
+
+		if(it != mSteps.end() && it->second.state != STEP_RUNNING)
+			mSteps.erase(it) ;
+
+		ssl_err = SSL_ERROR_SSL ;
+		err_err = 0 ;
+		return -1 ;
+	}
+
+	if(it != mSteps.end() && it->second.state == STEP_DONE)
+	{
+		int ret = it->second.ret ;
+		ssl_err = it->second.ssl_err ;
+		err_err = it->second.err_err ;
+
+		if(ret == 1 || (ssl_err != SSL_ERROR_WANT_READ && ssl_err != SSL_ERROR_WANT_WRITE))
+		{
+			mSteps.erase(it) ;
+			return ret ;
+		}
+
+		// Still negotiating: queue the next step right away, so that it is
+		// done by the next time the caller polls.
+
+		it->second.state = STEP_QUEUED ;
+		mQueue.push_back(ssl) ;
+		lock.unlock() ;
+		mCond.notify_all() ;
+
+		return ret ;
+	}
+
+	ssl_err = SSL_ERROR_WANT_READ ;
+	err_err = 0 ;
+
+	if(it != mSteps.end())		// queued or running
+		return -1 ;
+
+	Step& step(mSteps[ssl]) ;
+	step.accept = accept ;
+	mQueue.push_back(ssl) ;
+
+	// Workers are only started when there is something to do, up to the limit.
+
+	if(mWorkers.size() < mMaxThreads && mWorkers.size() < mRunningTotal + mQueue.size())
+		mWorkers.push_back(std::thread(&pqiSSLHandshakePool::workerThread,this)) ;
+
+	lock.unlock() ;
+	mCond.notify_all() ;
+
+	return -1 ;
+}
+
+void pqiSSLHandshakePool::forget(SSL *ssl)
+{
+	std::unique_lock<std::mutex> lock(mMtx) ;
+
+	// The step is looked up again after each wait, as another forget() of
+	// the same ssl may have removed it meanwhile.
+
+	std::map<SSL*,Step>::iterator it ;
+
+	while((it = mSteps.find(ssl)) != mSteps.end() && it->second.state == STEP_RUNNING)
+		mCond.wait(lock) ;
+
+	if(it == mSteps.end())
+		return ;
+
+	if(it->second.state == STEP_QUEUED)
+		mQueue.remove(ssl) ;
+
+	mSteps.erase(it) ;
+}
+
+uint32_t pqiSSLHandshakePool::pendingHandshakes()
+{
+	std::lock_guard<std::mutex> lock(mMtx) ;
+
+	return mSteps.size() ;
+}
+
+void pqiSSLHandshakePool::workerThread()
+{
+	std::unique_lock<std::mutex> lock(mMtx) ;
+
+	for(;;)
+	{
+		if(mQueue.empty())
+		{
+			if(mStopping)
+				return ;
+
+			mCond.wait(lock) ;
+			continue ;
+		}
+
+		SSL *ssl = mQueue.front() ;
+		mQueue.pop_front() ;
+
+		// Running steps are never removed: forget() and handshake() wait for
+		// them or leave them alone, so the iterator stays valid while the lock
+		// is released.
+
+		std::map<SSL*,Step>::iterator it = mSteps.find(ssl) ;
+		it->second.state = STEP_RUNNING ;
+		bool accept = it->second.accept ;
+		++mRunningTotal ;
+
+		lock.unlock() ;
+
+		// The OpenSSL error queue is per thread, so it has to be read here.
+
+		ERR_clear_error() ;
+		int ret = accept ? SSL_accept(ssl) : SSL_connect(ssl) ;
+		int ssl_err = (ret == 1) ? SSL_ERROR_NONE : SSL_get_error(ssl,ret) ;
+		unsigned long err_err = ERR_get_error() ;
+		ERR_clear_error() ;
+
+		lock.lock() ;
+
+		it->second.ret = ret ;
+		it->second.ssl_err = ssl_err ;
+		it->second.err_err = err_err ;
+		it->second.state = STEP_DONE ;
+		--mRunningTotal ;
+
+		mCond.notify_all() ;
+	}
+}
@@ -0,0 +1,105 @@
+/*******************************************************************************
+ * libretroshare/src/pqi: pqisslhandshakepool.h                                *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#pragma once
+
+// pqiSSLHandshakePool runs the SSL_accept()/SSL_connect() calls of the
+// listener and of pqissl on a few worker threads.
+//
+// A handshake step costs a DH key exchange, an RSA signature and the PGP check
+// of the peer certificate in AuthSSL::VerifyX509Callback. Done in place, one
+// slow handshake delays all the other connections handled by the same thread,
+// which is what happens when all friends come back at once after an outage.
+//
+// The caller keeps polling handshake() from its own tick. Each call either
+// queues one step, reports that a step is still pending, or returns the result
+// of the finished step. forget() must be called before an SSL object that may
+// have been given to handshake() is freed.
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include <openssl/ssl.h>
+
+class pqiSSLHandshakePool
+{
+public:
+	static pqiSSLHandshakePool& instance() ;
+
+	/// max_threads = 0 chooses from the number of cores.
+	explicit pqiSSLHandshakePool(uint32_t max_threads = 0) ;
+
+	/// Same as shutdown().
+	~pqiSSLHandshakePool() ;
+
+	/// Drops the pending steps, waits for the running ones and stops the threads.
+	/// handshake() fails from then on.
+	void shutdown() ;
+
+	/**
+	 * Runs the next SSL_accept() (accept=true) or SSL_connect() step of ssl.
+	 * @param[out] ssl_err SSL_get_error() of the step, SSL_ERROR_WANT_READ while
+	 *  the step is pending
+	 * @param[out] err_err ERR_get_error() of the step, read on the worker thread
+	 * @return same as SSL_accept()/SSL_connect(): 1 when the handshake is done,
+	 *  <= 0 otherwise
+	 */
+	int handshake(SSL *ssl, bool accept, int& ssl_err, unsigned long& err_err) ;
+
+	/// Drops the step of ssl if it has not started yet, otherwise waits for it.
+	/// ssl can be freed once this returns.
+	void forget(SSL *ssl) ;
+
+	/// Number of steps waiting, running or not collected yet.
+	uint32_t pendingHandshakes() ;
+
+private:
+	enum { STEP_QUEUED = 0x01, STEP_RUNNING = 0x02, STEP_DONE = 0x03 } ;
+
+	struct Step
+	{
+		Step() : state(STEP_QUEUED), accept(false), ret(0), ssl_err(0), err_err(0) {}
+
+		uint32_t state ;
+		bool accept ;
+		int ret ;
+		int ssl_err ;
+		unsigned long err_err ;
+	};
+
+	void workerThread() ;
+
+	std::mutex mMtx ;
+	std::condition_variable mCond ;
+
+	std::map<SSL*,Step> mSteps ;
+	std::list<SSL*> mQueue ;
+	uint32_t mRunningTotal ;
+
+	std::vector<std::thread> mWorkers ;
+	uint32_t mMaxThreads ;
+	bool mStopping ;
+};
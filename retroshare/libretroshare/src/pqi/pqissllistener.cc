@@ -23,6 +23,7 @@
 
 #include "pqi/pqissl.h"
 #include "pqi/pqissllistener.h"
+#include "pqi/pqisslhandshakepool.h"
 #include "pqi/pqinetwork.h"
 #include "pqi/sslfns.h"
 #include "pqi/p3peermgr.h"
@@ -422,14 +423,14 @@ int	pqissllistenbase::acceptconnection()
 
 int	pqissllistenbase::continueSSL(IncomingSSLInfo& incoming_connexion_info, bool addin)
 {
-	// attempt the accept again.
-    int fd =  SSL_get_fd(incoming_connexion_info.ssl);
-    int err = SSL_accept(incoming_connexion_info.ssl);
+	// attempt the accept again. The accept itself runs on the handshake pool,
+	// so that expensive handshakes do not hold the listener.
+	int ssl_err = SSL_ERROR_NONE;
+	unsigned long err_err = 0;
+	int err = pqiSSLHandshakePool::instance().handshake(incoming_connexion_info.ssl, true, ssl_err, err_err);
 
     if (err <= 0)
 	{
-		int ssl_err = SSL_get_error(incoming_connexion_info.ssl, err);
-		int err_err = ERR_get_error();
 
 		{
 			std::string out;
@@ -463,7 +464,7 @@ int	pqissllistenbase::continueSSL(IncomingSSLInfo& incoming_connexion_info, bool
 				std::string out = "pqissllistenbase::continueSSL() Connection failed!\n";
 				pqioutput(PQL_DEBUG_BASIC, pqissllistenzone, out);
 
-				closeConnection(fd, incoming_connexion_info.ssl);
+				closeConnection(SSL_get_fd(incoming_connexion_info.ssl), incoming_connexion_info.ssl);
 
 				// basic-error while connecting, no security message needed
 				return -1;
@@ -485,12 +486,23 @@ int	pqissllistenbase::continueSSL(IncomingSSLInfo& incoming_connexion_info, bool
 			ev->mErrorCode = RsAuthSslError::MISSING_AUTHENTICATION_INFO;
 			rsEvents->postEvent(ev);
 		}
-		closeConnection(fd, incoming_connexion_info.ssl);
+		closeConnection(SSL_get_fd(incoming_connexion_info.ssl), incoming_connexion_info.ssl);
 
 		// failure -1, pending 0, sucess 1.
 		return -1;
     }
 
+    int fd =  SSL_get_fd(incoming_connexion_info.ssl);
+
+    // Resumed sessions skip VerifyX509Callback, so the peer has to be checked
+    // again against the current friend list.
+    if (SSL_session_reused(incoming_connexion_info.ssl) && !AuthSSL::instance().VerifyResumedSession(incoming_connexion_info.ssl))
+	{
+		pqioutput(PQL_WARNING, pqissllistenzone, "pqissllistenbase::continueSSL() resumed session refused!");
+		closeConnection(fd, incoming_connexion_info.ssl);
+		return -1;
+	}
+
     // Now grab the connection info from the SSL itself, because the callback info might be
     // tempered due to multiple connection attempts at once.
     //
@@ -537,6 +549,9 @@ int pqissllistenbase::closeConnection(int fd, SSL *ssl)
 	/* else we shut it down! */
   	pqioutput(PQL_WARNING, pqissllistenzone, "pqissllistenbase::closeConnection() Shutting it Down!");
 
+	// make sure no handshake step is still running on it.
+	pqiSSLHandshakePool::instance().forget(ssl);
+
 	// delete ssl connection.
 	SSL_shutdown(ssl);
 
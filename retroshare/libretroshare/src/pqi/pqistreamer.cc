@@ -33,6 +33,7 @@
 #include "pqi/p3notify.h"         // for p3Notify
 #include "retroshare/rsids.h"     // for operator<<
 #include "retroshare/rsnotify.h"  // for RS_SYS_WARNING
+#include "rsitems/itempriorities.h" // for QOS_PRIORITY_TOP
 #include "rsserver/p3face.h"      // for RsServer
 #include "serialiser/rsserial.h"  // for RsItem, RsSerialiser, getRsItemSize
 #include "util/rsdebug.h"         // for pqioutput, PQL_ALERT, PQL_DEBUG_ALL
@@ -48,7 +49,6 @@ static struct RsLog::logInfo pqistreamerzoneInfo = {RsLog::Default, "pqistreamer
 static const int   PQISTREAM_ABS_MAX    			= 100000000; /* 100 MB/sec (actually per loop) */
 static const int   PQISTREAM_AVG_PERIOD 			= 1; 		// update speed estimate every second
 static const float PQISTREAM_AVG_FRAC   			= 0.8; 		// for bandpass filter over speed estimate.
-static const float PQISTREAM_AVG_DT_FRAC                        = 0.99;         // for low pass filter over elapsed time
 
 static const int   PQISTREAM_OPTIMAL_PACKET_SIZE  		= 512;		// It is believed that this value should be lower than TCP slices and large enough as compare to encryption padding.
 										// most importantly, it should be constant, so as to allow correct QoS.
@@ -99,9 +99,7 @@ pqistreamer::pqistreamer(RsSerialiser *rss, const RsPeerId& id, BinInterface *bi
 	mBio(bio_in), mBio_flags(bio_flags_in), mRsSerialiser(rss), 
 	mPkt_wpending(NULL), mPkt_wpending_size(0),
 	mTotalRead(0), mTotalSent(0),
-	mCurrRead(0), mCurrSent(0),
-	mAvgReadCount(0), mAvgSentCount(0),
-	mAvgDtOut(0), mAvgDtIn(0)
+	mAvgReadCount(0), mAvgSentCount(0)
 {
 
 	// 100 B/s (minimal)
@@ -115,7 +113,7 @@ pqistreamer::pqistreamer(RsSerialiser *rss, const RsPeerId& id, BinInterface *bi
 	mAcceptsPacketSlicing = false ; // by default. Will be turned into true when everyone's ready.
 	mLastSentPacketSlicingProbe = 0 ;
 
-	mAvgLastUpdate = mCurrSentTS = mCurrReadTS = getCurrentTS();
+	mAvgLastUpdate = getCurrentTS();
 
 	mIncomingSize = 0 ;
 	mIncomingSize_bytes = 0;
@@ -1133,92 +1131,93 @@ float   pqistreamer::outTimeSlice_locked()
 
 int     pqistreamer::outAllowedBytes_locked()
 {
-	double t = getCurrentTS() ; // in sec, with high accuracy
-
 	// allow a lot if not bandwidthLimited()
 	if (!mBio->bandwidthLimited())
-	{
-		mCurrSent = 0;
-		mCurrSentTS = t;
 		return PQISTREAM_ABS_MAX;
-	}
 
-	// dt is the time elapsed since the last round of sending data
-	double dt = t - mCurrSentTS;
+	// The peer bucket follows the max rate computed by pqihandler, which already
+	// accounts for the per-peer caps. Bulk data has to leave some room in both the
+	// peer and the global buckets, so that interactive items always get through.
 
-	// ignore cases where dt > 1s
-	if (dt > 1)
-		dt = 1;
+	mOutBucket.setRate(getMaxRate_locked(false) * 1024.0);
 
-	// low pass filter on mAvgDtOut
-	mAvgDtOut = PQISTREAM_AVG_DT_FRAC * mAvgDtOut + (1 - PQISTREAM_AVG_DT_FRAC) * dt;
-	
-	double maxout = getMaxRate_locked(false) * 1024.0;
+	pqiBandwidthShaper::ServiceClass c = pqiBandwidthShaper::serviceClass(locked_out_queue_top_priority());
+	int64_t quota = pqiBandwidthShaper::allowedBytes(false, mOutBucket, c);
+
+#ifdef DEBUG_PQISTREAMER
+	RsDbg() << "PQISTREAMER pqistreamer::outAllowedBytes_locked() class " << c << " maxout " << (int)(mOutBucket.rate()) << " bytes/s, quota " << quota << " bytes";
+#endif
 
-	// this is used to take into account a possible excess of data sent during the previous round
-	mCurrSent -= int(dt * maxout);
+	return (int)std::min(quota, (int64_t)PQISTREAM_ABS_MAX);
+}
 
-	// we dont allow negative value, any quota not used during the previous round is therefore lost
-	if (mCurrSent < 0)
-		mCurrSent = 0;
+double  pqistreamer::outQueueRate_locked()
+{
+	// The out queue budgets follow what the peer actually takes, which can be
+	// much less than the max rate. A limited link that did not send anything
+	// yet gets the smallest budgets.
 
-	mCurrSentTS = t;
+	if (!mBio->bandwidthLimited())
+		return 0;
 
-	// now calculate the amount of data allowed to be sent during the next round
-	// we take into account the possible excess (but not deficit) of the previous round
-	// (this is handled differently when reading data, see below)
-	double quota = mAvgDtOut * maxout - mCurrSent;
+	return std::max(1.0, RateInterface::getRate(false) * 1024.0);
+}
+
+bool    pqistreamer::canSend(uint32_t service_type, uint32_t size)
+{
+	RsStackMutex stack(mStreamerMtx); /**** LOCKED MUTEX ****/
+
+	uint64_t service_bytes = locked_out_queue_service_bytes((service_type >> 8) & 0xffff);
+	uint64_t total_bytes = locked_compute_out_pkt_size();
+
+	if(pqiBandwidthShaper::outQueueAccepts(service_bytes, total_bytes, size, outQueueRate_locked()))
+		return true;
 
 #ifdef DEBUG_PQISTREAMER
-	RsDbg() << "PQISTREAMER pqistreamer::outAllowedBytes_locked() dt " << std::dec << (int)(1000 * dt) << "ms, mAvgDtOut " << (int)(1000 * mAvgDtOut) << "ms, maxout " << (int)(maxout) << " bytes/s, mCurrSent " << mCurrSent << " bytes, quota " << (int)(quota) << " bytes";
+	RsDbg() << "PQISTREAMER pqistreamer::canSend() service " << std::hex << service_type << std::dec << " has to wait: " << service_bytes << " bytes queued, " << total_bytes << " total";
 #endif
+	mWaitingServices.insert(service_type & 0xffffff00);
+	return false;
+}
+
+void    pqistreamer::getWritableServices(std::list<uint32_t>& service_types)
+{
+	RsStackMutex stack(mStreamerMtx); /**** LOCKED MUTEX ****/
+
+	if(mWaitingServices.empty())
+		return;
+
+	uint64_t total_bytes = locked_compute_out_pkt_size();
+	double rate = outQueueRate_locked();
 
-	return quota;
+	for(std::set<uint32_t>::iterator it(mWaitingServices.begin());it!=mWaitingServices.end();)
+		if(pqiBandwidthShaper::outQueueDrained(locked_out_queue_service_bytes((*it >> 8) & 0xffff), total_bytes, rate))
+		{
+			service_types.push_back(*it);
+			it = mWaitingServices.erase(it);
+		}
+		else
+			++it;
 }
 
 int     pqistreamer::inAllowedBytes()
 {
-	double t = getCurrentTS(); // in sec, with high accuracy
-
 	// allow a lot if not bandwidthLimited()
 	if (!mBio->bandwidthLimited())
-	{
- 		mCurrRead = 0;
-		mCurrReadTS = t;
 		return PQISTREAM_ABS_MAX;
-	}
 
-	// dt is the time elapsed since the last round of receiving data
-	double dt = t - mCurrReadTS;
+	// We cannot choose what the peer sends, so incoming data is never held back
+	// for interactive traffic.
 
-	// limit dt to 1s
-	if (dt > 1)
-        	dt = 1;
+	mInBucket.setRate(getMaxRate(true) * 1024.0);
 
-	// low pass filter on mAvgDtIn
-	mAvgDtIn = PQISTREAM_AVG_DT_FRAC * mAvgDtIn + (1 - PQISTREAM_AVG_DT_FRAC) * dt;
-
-	double maxin = getMaxRate(true) * 1024.0;
-
-	// this is used to take into account a possible excess/deficit of data received during the previous round
-	mCurrRead -= int(dt * maxin);
-
-	// we allow negative value up to the average amount of data received during one round
-	// in that case we will use this credit during the next around
-	if (mCurrRead < - mAvgDtIn * maxin)
-		mCurrRead = - mAvgDtIn * maxin;
-
-	mCurrReadTS = t;
-
-	// we now calculate the max amount of data allowed to be received during the next round
-	// we take into account the excess/deficit of the previous round
-	double quota = mAvgDtIn * maxin - mCurrRead;
+	int64_t quota = pqiBandwidthShaper::allowedBytes(true, mInBucket, pqiBandwidthShaper::CLASS_INTERACTIVE);
 
 #ifdef DEBUG_PQISTREAMER
-	RsDbg() << "PQISTREAMER pqistreamer::inAllowedBytes() dt " << std::dec << (int)(1000 * dt) << "ms, mAvgDtIn " << (int)(1000 * mAvgDtIn) << "ms, maxin " << (int)(maxin) << " bytes/s, mCurrRead " << mCurrRead << " bytes, quota " << (int)(quota) << " bytes";
+	RsDbg() << "PQISTREAMER pqistreamer::inAllowedBytes() maxin " << (int)(mInBucket.rate()) << " bytes/s, quota " << quota << " bytes";
 #endif
 
-	return quota;
+	return (int)std::min(quota, (int64_t)PQISTREAM_ABS_MAX);
 }
 
 void    pqistreamer::outSentBytes_locked(uint32_t outb)
@@ -1245,7 +1244,10 @@ void    pqistreamer::outSentBytes_locked(uint32_t outb)
 
 #endif
 	mTotalSent += outb;
-	mCurrSent += outb;
+
+	if (mBio->bandwidthLimited())
+		pqiBandwidthShaper::consume(false, mOutBucket, outb);
+
 	mAvgSentCount += outb;
 	PQInterface::traf_out += outb;
 	return;
@@ -1262,7 +1264,10 @@ void    pqistreamer::inReadBytes(uint32_t inb)
 #endif
 
 	mTotalRead += inb;
-	mCurrRead += inb;
+
+	if (mBio->bandwidthLimited())
+		pqiBandwidthShaper::consume(true, mInBucket, inb);
+
 	mAvgReadCount += inb;
 	PQInterface::traf_in += inb;
 	return;
@@ -1414,6 +1419,20 @@ int pqistreamer::locked_compute_out_pkt_size() const
 	return total ;
 }
 
+// this method is overloaded by pqiqosstreamer
+uint64_t pqistreamer::locked_out_queue_service_bytes(uint16_t /*service_id*/) const
+{
+	// Items are not sorted by service here, so the whole queue is counted.
+	return locked_compute_out_pkt_size() ;
+}
+
+// this method is overloaded by pqiqosstreamer
+int pqistreamer::locked_out_queue_top_priority() const
+{
+	// No prioritisation here, so there is nothing to hold bandwidth back for.
+	return QOS_PRIORITY_TOP ;
+}
+
 int pqistreamer::locked_gatherStatistics(std::list<RSTrafficClue>& out_lst,std::list<RSTrafficClue>& in_lst)
 {
     out_lst = mPreviousStatsChunk_Out ;
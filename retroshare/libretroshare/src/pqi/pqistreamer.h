@@ -27,8 +27,10 @@
 #include <iostream>               // for operator<<, basic_ostream, cerr, endl
 #include <list>                   // for list
 #include <map>                    // for map
+#include <set>                    // for set
 
 #include "pqi/pqi_base.h"         // for BinInterface (ptr only), PQInterface
+#include "pqi/pqibandwidth.h"     // for RsTokenBucket
 #include "retroshare/rsconfig.h"  // for RSTrafficClue
 #include "retroshare/rstypes.h"   // for RsPeerId
 #include "util/rsthreads.h"       // for RsMutex
@@ -70,6 +72,9 @@ class pqistreamer: public PQInterface
 		virtual int     getQueueSize(bool in); // extracting data.
 		virtual int     getQueueSize_bytes(bool in); // size of incoming queue in bytes
 		virtual int     gatherStatistics(std::list<RSTrafficClue>& outqueue_stats,std::list<RSTrafficClue>& inqueue_stats); // extracting data.
+
+		// out queue budgets (see pqibandwidth.h)
+		virtual bool    canSend(uint32_t service_type, uint32_t size);
         
             	// mutex protected versions of RateInterface calls.
             	virtual void setRate(bool b,float f) ;
@@ -87,6 +92,10 @@ class pqistreamer: public PQInterface
 		int tick_send(uint32_t timeout);
 		int tick_recv(uint32_t timeout);
 
+		// Services refused by canSend() that fit in the budgets again. They are
+		// forgotten, so each one is only returned once.
+		void getWritableServices(std::list<uint32_t>& service_types);
+
 		/* Implementation */
 
 		// These methods are redefined in pqiQoSstreamer
@@ -95,6 +104,8 @@ class pqistreamer: public PQInterface
 		virtual int locked_out_queue_size() const ;
 		virtual void locked_clear_out_queue() ;
 		virtual int locked_compute_out_pkt_size() const ;
+		virtual uint64_t locked_out_queue_service_bytes(uint16_t service_id) const ;
+		virtual int locked_out_queue_top_priority() const ;
 		virtual void *locked_pop_out_data(uint32_t max_slice_size,uint32_t& size,bool& starts,bool& ends,uint32_t& packet_id);
 		virtual int   locked_gatherStatistics(std::list<RSTrafficClue>& outqueue_stats,std::list<RSTrafficClue>& inqueue_stats); // extracting data.
 
@@ -118,6 +129,7 @@ class pqistreamer: public PQInterface
 
 		// Bandwidth/Streaming Management.
 		float	outTimeSlice_locked();
+		double	outQueueRate_locked();
 
 		int	outAllowedBytes_locked();
 		void	outSentBytes_locked(uint32_t );
@@ -155,20 +167,14 @@ class pqistreamer: public PQInterface
 		int mTotalRead;
 		int mTotalSent;
 
-		// these are representative (but not exact)
-		int mCurrRead;
-		int mCurrSent;
-        
-		double mCurrReadTS; // TS from which these are measured.
-		double mCurrSentTS;
+		// per-peer level of the bandwidth shaping hierarchy (see pqibandwidth.h)
+		RsTokenBucket mInBucket;
+		RsTokenBucket mOutBucket;
 
 		double mAvgLastUpdate; // TS from which these are measured.
 		uint32_t mAvgReadCount;
 		uint32_t mAvgSentCount;
 
-		double mAvgDtOut;	// average time diff between 2 rounds of sending data
-		double mAvgDtIn;	// average time diff between 2 rounds of receiving data
-
 		rstime_t mLastIncomingTs;
 	
         	// traffic statistics
@@ -185,6 +191,8 @@ class pqistreamer: public PQInterface
 		RsItem *addPartialPacket(const void *block, uint32_t len, uint32_t slice_packet_id,bool packet_starting,bool packet_ending,uint32_t& total_len);
         
 		std::map<uint32_t,PartialPacketRecord> mPartialPackets ;
+
+		std::set<uint32_t> mWaitingServices ;	// service types refused by canSend(), waiting for the queue to drain
 };
 
 #endif //MRK_PQI_STREAMER_HEADER
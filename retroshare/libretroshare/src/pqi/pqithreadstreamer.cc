@@ -21,16 +21,23 @@
  *******************************************************************************/
 #include "util/rstime.h"
 #include "pqi/pqithreadstreamer.h"
+#include "rsitems/rsitem.h"
 #include <unistd.h>
 
 #define DEFAULT_STREAMER_TIMEOUT	  10000 // 10 ms
 #define DEFAULT_STREAMER_SLEEP		  30000 // 30 ms
 #define DEFAULT_STREAMER_IDLE_SLEEP	1000000 // 1 sec
 
+// Number of consecutive ticks (~0.5 sec) during which reading is paused
+// because a service is congested. Reading resumes afterwards anyway, so that
+// a stuck service cannot make the connection time out.
+#define MAX_CONGESTED_SKIPS			     16
+
 // #define PQISTREAMER_DEBUG
 
 pqithreadstreamer::pqithreadstreamer(PQInterface *parent, RsSerialiser *rss, const RsPeerId& id, BinInterface *bio_in, int bio_flags_in)
-:pqistreamer(rss, id, bio_in, bio_flags_in), mParent(parent), mTimeout(0), mThreadMutex("pqithreadstreamer")
+:pqistreamer(rss, id, bio_in, bio_flags_in), mParent(parent), mTimeout(0), mThreadMutex("pqithreadstreamer"),
+  mCongestedPacketId(0), mCongestedSkips(0)
 {
 	mTimeout = DEFAULT_STREAMER_TIMEOUT;
 	mSleepPeriod = DEFAULT_STREAMER_SLEEP;
@@ -73,7 +80,27 @@ void	pqithreadstreamer::threadTick()
 		return ;
 	}
 
+	// If the last service items were given to could not keep up, leave the
+	// data in the socket for a while: TCP then slows the peer down, instead of
+	// the service queue growing without bound.
+	bool congested = false;
+
+	if(mCongestedPacketId != 0)
+	{
+		if(mCongestedSkips < MAX_CONGESTED_SKIPS && mParent->incomingCongested(mCongestedPacketId))
+		{
+			congested = true;
+			++mCongestedSkips;
+		}
+		else
+		{
+			mCongestedPacketId = 0;
+			mCongestedSkips = 0;
+		}
+	}
+
 	// fill incoming queue with items from SSL
+	if(!congested)
 	{
 		RsStackMutex stack(mThreadMutex);
 		tick_recv(recv_timeout);
@@ -83,7 +110,12 @@ void	pqithreadstreamer::threadTick()
 	RsItem *incoming = NULL;
 	while((incoming = GetItem()))
 	{
+		uint32_t packet_id = incoming->PacketId();
+
 		RecvItem(incoming);
+
+		if(mCongestedPacketId == 0 && mParent->incomingCongested(packet_id))
+			mCongestedPacketId = packet_id;
 	}
 
 	// parse the outgoing queue and send items to SSL
@@ -92,6 +124,14 @@ void	pqithreadstreamer::threadTick()
 		tick_send(0);
 	}
 
+	// tell the services that waited for the out queue to drain that they can
+	// send again. This is done without any lock, since they will likely send.
+	std::list<uint32_t> writable;
+	getWritableServices(writable);
+
+	for(std::list<uint32_t>::const_iterator it(writable.begin());it!=writable.end();++it)
+		mParent->outgoingWritable(*it);
+
 	// sleep 
 	if (sleep_period)
 	{
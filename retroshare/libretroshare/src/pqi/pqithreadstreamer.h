@@ -44,6 +44,10 @@ protected:
 private:
     /* thread variables */
     RsMutex mThreadMutex;
+
+    /* only used by the streamer thread */
+    uint32_t mCongestedPacketId;	// item type of a service that could not keep up, or 0
+    uint32_t mCongestedSkips;		// ticks spent without reading because of it
 };
 
 #endif //MRK_PQI_THREAD_STREAMER_HEADER
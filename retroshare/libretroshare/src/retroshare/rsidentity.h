@@ -389,6 +389,36 @@ struct RsIdentityDetails : RsSerializable
 	~RsIdentityDetails() override;
 };
 
+/// Counters of the identity key cache, since startup.
+struct RsIdentityKeyCacheStatistics : RsSerializable
+{
+	RsIdentityKeyCacheStatistics() :
+	    mHits(0), mMisses(0), mKeysLoaded(0), mKeysGivenUp(0), mTotalWaitUs(0),
+	    mMaxWaitUs(0) {}
+
+	uint64_t mHits;            /// key lookups found in cache
+	uint64_t mMisses;          /// key lookups that triggered a load
+	uint64_t mKeysLoaded;      /// missed keys that eventually arrived in cache
+	uint64_t mKeysGivenUp;     /// missed keys that never did
+	uint64_t mTotalWaitUs;     /// sum of the waiting times of the loaded keys
+	uint64_t mMaxWaitUs;
+
+	/// @see RsSerializable
+	virtual void serial_process(
+	        RsGenericSerializer::SerializeJob j,
+	        RsGenericSerializer::SerializeContext& ctx ) override
+	{
+		RS_SERIAL_PROCESS(mHits);
+		RS_SERIAL_PROCESS(mMisses);
+		RS_SERIAL_PROCESS(mKeysLoaded);
+		RS_SERIAL_PROCESS(mKeysGivenUp);
+		RS_SERIAL_PROCESS(mTotalWaitUs);
+		RS_SERIAL_PROCESS(mMaxWaitUs);
+	}
+
+	~RsIdentityKeyCacheStatistics() override;
+};
+
 
 
 /** The Main Interface Class for GXS people identities */
@@ -548,6 +578,14 @@ public:
 	 */
 	virtual void setDeleteBannedNodesThreshold(uint32_t days) = 0;
 
+	/**
+	 * @brief Get the counters of the key cache, that tell how often the keys
+	 *	needed to check signatures are found without waiting for them
+	 * @jsonapi{development}
+	 * @param[out] stats storage for the counters
+	 */
+	virtual void getKeyCacheStatistics(RsIdentityKeyCacheStatistics& stats) = 0;
+
 	/**
 	 * @brief request details of a not yet known identity to the network
 	 * @jsonapi{development}
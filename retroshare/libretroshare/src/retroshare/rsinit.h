@@ -133,6 +133,8 @@ struct RsConfigOptions
 
 	bool udpListenerOnly;			 /* only listen to udp */
 
+	bool gxsConcurrentDb;			 /* WAL journaling and concurrent readers for the GXS databases */
+
     std::string forcedInetAddress; 	 /* inet address to use.*/
     uint16_t    forcedPort; 	     /* port to listen to */
 
@@ -120,6 +120,45 @@ struct RsServicePermissions : RsSerializable
 	}
 };
 
+/* Incoming traffic of one service, as seen by the dispatcher */
+struct RsServiceQueueStats : RsSerializable
+{
+	RsServiceQueueStats() :
+	    mServiceType(0), mItemsReceived(0), mAverageDispatchUs(0), mMaxDispatchUs(0),
+	    mQueueDepth(0), mMaxQueueDepth(0), mQueueCapacity(0), mQueueOverflows(0),
+	    mAverageQueueLatencyUs(0), mMaxQueueLatencyUs(0) {}
+
+	uint32_t mServiceType;
+
+	// items handed to the service, and time spent in its recv() method
+	uint64_t mItemsReceived;
+	uint64_t mAverageDispatchUs;
+	uint64_t mMaxDispatchUs;
+
+	// incoming queue of the service, for services that have one.
+	// mQueueOverflows counts the items that arrived while the queue was full.
+	uint32_t mQueueDepth;
+	uint32_t mMaxQueueDepth;
+	uint32_t mQueueCapacity;
+	uint64_t mQueueOverflows;
+	uint64_t mAverageQueueLatencyUs;
+	uint64_t mMaxQueueLatencyUs;
+
+	// RsSerializable interface
+	void serial_process(RsGenericSerializer::SerializeJob j, RsGenericSerializer::SerializeContext &ctx) {
+		RS_SERIAL_PROCESS(mServiceType);
+		RS_SERIAL_PROCESS(mItemsReceived);
+		RS_SERIAL_PROCESS(mAverageDispatchUs);
+		RS_SERIAL_PROCESS(mMaxDispatchUs);
+		RS_SERIAL_PROCESS(mQueueDepth);
+		RS_SERIAL_PROCESS(mMaxQueueDepth);
+		RS_SERIAL_PROCESS(mQueueCapacity);
+		RS_SERIAL_PROCESS(mQueueOverflows);
+		RS_SERIAL_PROCESS(mAverageQueueLatencyUs);
+		RS_SERIAL_PROCESS(mMaxQueueLatencyUs);
+	}
+};
+
 class RsServiceControl
 {
 public:
@@ -152,6 +191,15 @@ public:
 	 */
 	virtual bool getServiceItemNames(uint32_t serviceId, std::map<uint8_t,std::string>& names) = 0;
 
+	/**
+	 * @brief getServiceQueueStats return statistics about the incoming items
+	 *  of each service: number, dispatch time, queue depth and latency.
+	 * @jsonapi{development}
+	 * @param[out] stats map of statistics, by service id
+	 * @return false if the services are not started yet
+	 */
+	virtual bool getServiceQueueStats(std::map<uint32_t, RsServiceQueueStats>& stats) = 0;
+
 	/**
 	 * @brief getServicesAllowed return a mpa with allowed service information.
 	 * @jsonapi{development}
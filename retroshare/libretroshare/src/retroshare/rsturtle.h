@@ -96,6 +96,17 @@ class TurtleTrafficStatisticsInfo
 		std::vector<float> forward_probabilities ;	// probability to forward a TR as a function of depth.
 };
 
+class TurtleSearchStatistics
+{
+	public:
+		uint64_t hits ;					// local searches answered from the results cache
+		uint64_t misses ;				// local searches that had to be done
+		float    hit_rate ;
+		float    searches_per_sec ;		// local searches served, from the cache or not
+		uint64_t cpu_saved_us ;			// time the searches answered from the cache took when they were done
+		uint64_t forwards_dropped ;		// searches not forwarded because the friend exceeded its budget
+};
+
 // Interface class for turtle hopping.
 //
 //   This class mainly interacts with the turtle router, that is responsible
@@ -161,6 +172,11 @@ public:
 		//
 		virtual void getTrafficStatistics(TurtleTrafficStatisticsInfo& info) const = 0;
 
+		// Get info about the cache of the search results sent to friends and the
+		// forwarded searches budget. See TurtleSearchStatistics members for details.
+		//
+		virtual void getSearchStatistics(TurtleSearchStatistics& stats) const = 0;
+
 		// Convenience function.
 		virtual bool isTurtlePeer(const RsPeerId& peer_id) const = 0 ;
 
@@ -477,6 +477,7 @@ template<class CRCTYPE> class t_CRCMap
 
 		inline void set(uint32_t i,const CRCTYPE& val) { _crcs[i] = val ; _ccmap.set(i) ; }
 		inline bool isSet(uint32_t i) const { return _ccmap[i] ; }
+		inline void reset(uint32_t i) { _ccmap.reset(i) ; }
 
 		inline const CRCTYPE& operator[](int i) const { return _crcs[i] ; }
 		inline uint32_t size() const { return _crcs.size() ; }
@@ -57,7 +57,7 @@ void RsFileTransferDataRequestItem::serial_process(RsGenericSerializer::Serializ
 
 void RsFileTransferDataItem::serial_process(RsGenericSerializer::SerializeJob j,RsGenericSerializer::SerializeContext& ctx)
 {
-    RsTypeSerializer::serial_process<RsTlvItem>(j,ctx,fd,"fd") ;
+    RsTypeSerializer::serial_process(j,ctx,fd,"fd") ;
 }
 
 void RsFileTransferChunkMapRequestItem::serial_process(RsGenericSerializer::SerializeJob j,RsGenericSerializer::SerializeContext& ctx)
@@ -177,7 +177,9 @@ class RsFileTransferSingleChunkCrcItem: public RsFileTransferItem
 class RsFileTransferSerialiser: public RsServiceSerializer
 {
 	public:
-		RsFileTransferSerialiser(): RsServiceSerializer(RS_SERVICE_TYPE_FILE_TRANSFER) {}
+		RsFileTransferSerialiser():
+		    RsServiceSerializer( RS_SERVICE_TYPE_FILE_TRANSFER,
+		                         RsSerializationFlags::SHARED_BUFFER_VIEWS ) {}
 
 		virtual ~RsFileTransferSerialiser() {}
 
@@ -120,11 +120,26 @@ class RsRawItem: public RsItem
 public:
 	RsRawItem(uint32_t t, uint32_t size) : RsItem(t), len(size)
 	{ data = rs_malloc(len); }
-	virtual ~RsRawItem() { free(data); }
+
+	/** Raw item pointing into data already held by a shared buffer, e.g. the
+	 * same serialised item sent to several peers. The data must not be
+	 * modified. */
+	RsRawItem(uint32_t t, const RsSharedBuffer& buffer, uint32_t size) :
+	    RsItem(t), data(buffer.get()), len(size), shared(buffer) {}
+	virtual ~RsRawItem() { if(!shared) free(data); }
 
 	uint32_t getRawLength() { return len; }
 	void * getRawData() { return data; }
 
+	/** Get a reference counted handle on the raw data, from now on the data is
+	 * owned by the handle so items deserialised from it can keep views into
+	 * it after this raw item is deleted */
+	const RsSharedBuffer& shareRawData()
+	{
+		if(!shared) shared = rs_shared_buffer_adopt(data);
+		return shared;
+	}
+
 //	virtual void clear() override {}
 	virtual std::ostream &print(std::ostream &out, uint16_t indent = 0);
 
@@ -139,4 +154,5 @@ public:
 private:
 	void *data;
 	uint32_t len;
+	RsSharedBuffer shared;
 };
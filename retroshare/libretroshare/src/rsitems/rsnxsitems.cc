@@ -108,8 +108,8 @@ void RsNxsGrp::serial_process(RsGenericSerializer::SerializeJob j,RsGenericSeria
     RsTypeSerializer::serial_process<uint32_t> (j,ctx,transactionNumber,"transactionNumber") ;
     RsTypeSerializer::serial_process<uint8_t>  (j,ctx,pos              ,"pos") ;
     RsTypeSerializer::serial_process           (j,ctx,grpId            ,"grpId") ;
-    RsTypeSerializer::serial_process<RsTlvItem>(j,ctx,grp              ,"grp") ;
-    RsTypeSerializer::serial_process<RsTlvItem>(j,ctx,meta             ,"meta") ;
+    RsTypeSerializer::serial_process           (j,ctx,grp              ,"grp") ;
+    RsTypeSerializer::serial_process           (j,ctx,meta             ,"meta") ;
 }
 
 void RsNxsSyncGrpStatsItem::serial_process(RsGenericSerializer::SerializeJob j,RsGenericSerializer::SerializeContext& ctx)
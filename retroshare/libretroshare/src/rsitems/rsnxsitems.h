@@ -519,8 +519,11 @@ class RsNxsSerialiser : public RsServiceSerializer
 {
 public:
 
+	/* Received messages and groups data is kept as views into the incoming
+	 * packet, nothing in GXS steals RsTlvBinaryData::bin_data */
 	explicit RsNxsSerialiser(uint16_t servtype):
-	    RsServiceSerializer(servtype), SERVICE_TYPE(servtype) {}
+	    RsServiceSerializer(servtype, RsSerializationFlags::SHARED_BUFFER_VIEWS),
+	    SERVICE_TYPE(servtype) {}
 	virtual ~RsNxsSerialiser() = default;
 
 
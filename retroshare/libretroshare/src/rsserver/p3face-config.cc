@@ -38,6 +38,7 @@
 
 #include "pqi/p3peermgr.h"
 #include "pqi/p3netmgr.h"
+#include "pqi/pqisslhandshakepool.h"
 
 
 // TO SHUTDOWN THREADS.
@@ -103,6 +104,10 @@ void RsServer::rsGlobalShutDown()
 
 	fullstop();
 
+	/* Connections are not ticked anymore, handshakes still running need
+	 * AuthSSL and AuthPGP */
+	pqiSSLHandshakePool::instance().shutdown();
+
 #ifdef RS_JSONAPI
 	rsJsonApi->fullstop();
 #endif
@@ -187,8 +187,8 @@ void RsServer::threadTick()
 #endif
         mConfigMgr->tick(RsConfigMgr::CheckPriority::SAVE_NOW); // This most of the time does nothing, since it only saved the urgent ones, which is not the default.
 
-        // slow services
-		if (rsPlugins)
+        // slow services. Plugin configs may still be loading until the core is ready.
+		if (rsPlugins && coreReady)
 		{
 #ifdef TICK_DEBUG
 			RsDbg() << "TICK_DEBUG ticking slow tick plugins";
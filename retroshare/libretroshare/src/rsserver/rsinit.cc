@@ -131,6 +131,7 @@ RsConfigOptions::RsConfigOptions()
         :
           autoLogin(false),
           udpListenerOnly(false),
+          gxsConcurrentDb(false),
           forcedInetAddress("127.0.0.1"), 	 /* inet address to use.*/
           forcedPort(0),
           outStderr(false),
@@ -192,6 +193,7 @@ struct RsInitConfig
 		std::string logfname;
 
 		bool udpListenerOnly;
+		bool gxsConcurrentDb;
 		std::string opModeStr;
 		std::string optBaseDir;
 
@@ -243,6 +245,7 @@ void RsInit::InitRsConfig()
 	rsInitConfig->passwd         = "";
 	rsInitConfig->debugLevel	= PQL_WARNING;
 	rsInitConfig->udpListenerOnly = false;
+	rsInitConfig->gxsConcurrentDb = false;
 	rsInitConfig->opModeStr = std::string("");
 
 #ifdef WINDOWS_SYS
@@ -312,6 +315,7 @@ int RsInit::InitRetroShare(const RsConfigOptions& conf)
     rsInitConfig->port               = conf.forcedPort ;
     rsInitConfig->debugLevel         = conf.debugLevel;
     rsInitConfig->udpListenerOnly    = conf.udpListenerOnly;
+    rsInitConfig->gxsConcurrentDb    = conf.gxsConcurrentDb;
     rsInitConfig->optBaseDir         = conf.optBaseDir;
     rsInitConfig->jsonApiPort        = conf.jsonApiPort;
     rsInitConfig->jsonApiBindAddress = conf.jsonApiBindAddress;
@@ -811,6 +815,7 @@ RsGRouter *rsGRouter = NULL ;
 #include "util/rsdebug.h"
 #include "util/rsdir.h"
 #include "util/rsrandom.h"
+#include "util/rsstartup.h"
 
 #ifdef RS_USE_LIBUPNP
 #	include "rs_upnp/upnphandler_libupnp.h"
@@ -920,6 +925,7 @@ RsControl *RsControl::instance()
 
 int RsServer::StartupRetroShare()
 {
+	int64_t stepStart = RsStartupTrace::now();
 	RsPeerId ownId = AuthSSL::getAuthSSL()->OwnId();
 
     std::cerr << "========================================================================" << std::endl;
@@ -1002,7 +1008,7 @@ int RsServer::StartupRetroShare()
 #endif
 
 	/* History Manager */
-	mHistoryMgr = new p3HistoryMgr();
+	mHistoryMgr = new p3HistoryMgr(RsAccounts::AccountDirectory() + "/history");
 	mPeerMgr = new p3PeerMgrIMPL( AuthSSL::getAuthSSL()->OwnId(),
                 AuthPGP::getPgpOwnId(),
                 AuthPGP::getPgpOwnName(),
@@ -1337,6 +1343,9 @@ int RsServer::StartupRetroShare()
 	//
 	mPluginsManager->loadPlugins(programatically_inserted_plugins) ;
 
+	RsStartupTrace::addStep("create managers and services", stepStart);
+	stepStart = RsStartupTrace::now();
+
     	/**** Reputation system ****/
 
     	p3GxsReputation *mReputations = new p3GxsReputation(mLinkMgr) ;
@@ -1347,6 +1356,52 @@ int RsServer::StartupRetroShare()
 		std::string currGxsDir = RsAccounts::AccountDirectory() + "/gxs";
         RsDirUtil::checkCreateDirectory(currGxsDir);
 
+	// Optionally use WAL journaling and reader connections, so that the GXS services can read their database while it is written.
+	RsDataServiceStorageOptions gxsStorage;
+
+	if(rsInitConfig->gxsConcurrentDb)
+		gxsStorage = RsDataServiceStorageOptions::concurrent();
+
+	// Opening the databases, and upgrading them when needed, is the longest
+	// part of the startup for large accounts. The databases do not depend on
+	// each other, so they are all opened in parallel, while each service
+	// below only waits for its own database.
+
+	RsStartupScheduler gxsDbScheduler;
+
+	auto openGxsDb = [&gxsDbScheduler,&currGxsDir,&gxsStorage](RsGeneralDataService*& ds, const std::string& dbName, uint16_t serviceType)
+	{
+		gxsDbScheduler.addTask("open " + dbName, [&ds,&currGxsDir,&gxsStorage,dbName,serviceType]()
+		{
+			ds = new RsDataService(currGxsDir + "/", dbName, serviceType, NULL, rsInitConfig->gxs_passwd, gxsStorage);
+		});
+	};
+
+	RsGeneralDataService *gxsid_ds = NULL, *gxscircles_ds = NULL, *posted_ds = NULL;
+	RsGeneralDataService *gxsforums_ds = NULL, *gxschannels_ds = NULL;
+
+	openGxsDb(gxsid_ds, "gxsid_db", RS_SERVICE_GXS_TYPE_GXSID);
+	openGxsDb(gxscircles_ds, "gxscircles_db", RS_SERVICE_GXS_TYPE_GXSCIRCLE);
+	openGxsDb(posted_ds, "posted_db", RS_SERVICE_GXS_TYPE_POSTED);
+	openGxsDb(gxsforums_ds, "gxsforums_db", RS_SERVICE_GXS_TYPE_FORUMS);
+	openGxsDb(gxschannels_ds, "gxschannels_db", RS_SERVICE_GXS_TYPE_CHANNELS);
+#ifdef RS_USE_WIKI
+	RsGeneralDataService *wiki_ds = NULL;
+	openGxsDb(wiki_ds, "wiki_db", RS_SERVICE_GXS_TYPE_WIKI);
+#endif
+#ifdef RS_USE_PHOTO
+	RsGeneralDataService *photo_ds = NULL;
+	openGxsDb(photo_ds, "photoV2_db", RS_SERVICE_GXS_TYPE_PHOTO);
+#endif
+#ifdef RS_USE_WIRE
+	RsGeneralDataService *wire_ds = NULL;
+	openGxsDb(wire_ds, "wire_db", RS_SERVICE_GXS_TYPE_WIRE);
+#endif
+#	ifdef RS_GXS_TRANS
+	RsGeneralDataService *gxstrans_ds = NULL;
+	openGxsDb(gxstrans_ds, "gxstrans_db", RS_SERVICE_TYPE_GXS_TRANS);
+#	endif
+
         RsNxsNetMgr* nxsMgr =  new RsNxsNetMgrImpl(serviceCtrl);
 
         /**** GXS Dist sync service ****/
@@ -1360,16 +1415,14 @@ int RsServer::StartupRetroShare()
 
         /**** Identity service ****/
 
-        RsGeneralDataService* gxsid_ds = new RsDataService(currGxsDir + "/", "gxsid_db",
-                        RS_SERVICE_GXS_TYPE_GXSID, NULL, rsInitConfig->gxs_passwd);
+        gxsDbScheduler.wait("open gxsid_db");
 
         // init gxs services
 	PgpAuxUtils *pgpAuxUtils = new PgpAuxUtilsImpl();
         p3IdService *mGxsIdService = new p3IdService(gxsid_ds, NULL, pgpAuxUtils);
 
         // circles created here, as needed by Ids.
-        RsGeneralDataService* gxscircles_ds = new RsDataService(currGxsDir + "/", "gxscircles_db",
-                        RS_SERVICE_GXS_TYPE_GXSCIRCLE, NULL, rsInitConfig->gxs_passwd);
+        gxsDbScheduler.wait("open gxscircles_db");
 
 	// create GxsCircles - early, as IDs need it.
         p3GxsCircles *mGxsCircles = new p3GxsCircles(gxscircles_ds, NULL, mGxsIdService, pgpAuxUtils);
@@ -1407,9 +1460,7 @@ int RsServer::StartupRetroShare()
     
         /**** Posted GXS service ****/
 
-        RsGeneralDataService* posted_ds = new RsDataService(currGxsDir + "/", "posted_db",
-                        RS_SERVICE_GXS_TYPE_POSTED, 
-			NULL, rsInitConfig->gxs_passwd);
+        gxsDbScheduler.wait("open posted_db");
 
         p3Posted *mPosted = new p3Posted(posted_ds, NULL, mGxsIdService);
 
@@ -1425,9 +1476,7 @@ int RsServer::StartupRetroShare()
         /**** Wiki GXS service ****/
 
 #ifdef RS_USE_WIKI
-        RsGeneralDataService* wiki_ds = new RsDataService(currGxsDir + "/", "wiki_db",
-                        RS_SERVICE_GXS_TYPE_WIKI,
-                        NULL, rsInitConfig->gxs_passwd);
+        gxsDbScheduler.wait("open wiki_db");
 
         p3Wiki *mWiki = new p3Wiki(wiki_ds, NULL, mGxsIdService);
         // create GXS wiki service
@@ -1442,9 +1491,7 @@ int RsServer::StartupRetroShare()
 
 	/************************* Forum GXS service ******************************/
 
-	RsGeneralDataService* gxsforums_ds = new RsDataService(
-	            currGxsDir + "/", "gxsforums_db", RS_SERVICE_GXS_TYPE_FORUMS,
-	            nullptr, rsInitConfig->gxs_passwd );
+	gxsDbScheduler.wait("open gxsforums_db");
 
     p3GxsForums* mGxsForums = new p3GxsForums( gxsforums_ds, nullptr, mGxsIdService );
 
@@ -1462,8 +1509,7 @@ int RsServer::StartupRetroShare()
 
         /**** Channel GXS service ****/
 
-        RsGeneralDataService* gxschannels_ds = new RsDataService(currGxsDir + "/", "gxschannels_db",
-                                                            RS_SERVICE_GXS_TYPE_CHANNELS, NULL, rsInitConfig->gxs_passwd);
+        gxsDbScheduler.wait("open gxschannels_db");
 
         p3GxsChannels *mGxsChannels = new p3GxsChannels(gxschannels_ds, NULL, mGxsIdService);
 
@@ -1484,8 +1530,7 @@ int RsServer::StartupRetroShare()
 
 #ifdef RS_USE_PHOTO
         /**** Photo service ****/
-        RsGeneralDataService* photo_ds = new RsDataService(currGxsDir + "/", "photoV2_db",
-                        RS_SERVICE_GXS_TYPE_PHOTO, NULL, rsInitConfig->gxs_passwd);
+        gxsDbScheduler.wait("open photoV2_db");
 
         // init gxs services
         p3PhotoService *mPhoto = new p3PhotoService(photo_ds, NULL, mGxsIdService);
@@ -1502,8 +1547,7 @@ int RsServer::StartupRetroShare()
 
 #ifdef RS_USE_WIRE
         /**** Wire GXS service ****/
-        RsGeneralDataService* wire_ds = new RsDataService(currGxsDir + "/", "wire_db",
-                        RS_SERVICE_GXS_TYPE_WIRE, NULL, rsInitConfig->gxs_passwd);
+        gxsDbScheduler.wait("open wire_db");
 
         p3Wire *mWire = new p3Wire(wire_ds, NULL, mGxsIdService);
 
@@ -1533,9 +1577,7 @@ int RsServer::StartupRetroShare()
 #endif
 
 #	ifdef RS_GXS_TRANS
-	RsGeneralDataService* gxstrans_ds = new RsDataService(
-	            currGxsDir + "/", "gxstrans_db", RS_SERVICE_TYPE_GXS_TRANS,
-	            NULL, rsInitConfig->gxs_passwd );
+	gxsDbScheduler.wait("open gxstrans_db");
 	mGxsTrans = new p3GxsTrans(gxstrans_ds, NULL, *mGxsIdService);
 
 	RsGxsNetService* gxstrans_ns = new RsGxsNetService(
@@ -1550,10 +1592,14 @@ int RsServer::StartupRetroShare()
 #	endif // RS_GXS_TRANS
 
 	// remove pword from memory
+	gxsDbScheduler.waitAll();
 	rsInitConfig->gxs_passwd = "";
 
 #endif // RS_ENABLE_GXS.
 
+	RsStartupTrace::addStep("create gxs services", stepStart);
+	stepStart = RsStartupTrace::now();
+
 	/* create Services */
 	p3ServiceInfo *serviceInfo = new p3ServiceInfo(serviceCtrl);
 	mDisc = new p3discovery2(mPeerMgr, mLinkMgr, mNetMgr, serviceCtrl,mGxsIdService);
@@ -1741,29 +1787,31 @@ int RsServer::StartupRetroShare()
 	//
     AuthPGP::registerToConfigMgr(std::string("gpg_prefs.cfg"),mConfigMgr);
 
+	// The configs the network needs come first, see below.
+
 	mConfigMgr->addConfiguration("gxsnettunnel.cfg", mGxsNetTunnel);
 	mConfigMgr->addConfiguration("peers.cfg"       , mPeerMgr);
 	mConfigMgr->addConfiguration("general.cfg"     , mGeneralConfig);
+	mConfigMgr->addConfiguration("servicecontrol.cfg", serviceCtrl);
+
+    if(mBanList != NULL)
+		mConfigMgr->addConfiguration("banlist.cfg"     , mBanList);
+
+#ifdef RS_USE_BITDHT
+    if(mBitDht != NULL)
+		mConfigMgr->addConfiguration("bitdht.cfg"      , mBitDht);
+#endif
+
 	mConfigMgr->addConfiguration("msgs.cfg"        , msgSrv);
 	mConfigMgr->addConfiguration("chat.cfg"        , chatSrv);
 	mConfigMgr->addConfiguration("p3History.cfg"   , mHistoryMgr);
 	mConfigMgr->addConfiguration("p3Status.cfg"    , mStatusSrv);
 	mConfigMgr->addConfiguration("turtle.cfg"      , tr);
-
-    if(mBanList != NULL)
-		mConfigMgr->addConfiguration("banlist.cfg"     , mBanList);
-
-	mConfigMgr->addConfiguration("servicecontrol.cfg", serviceCtrl);
 	mConfigMgr->addConfiguration("reputations.cfg" , mReputations);
 #ifdef ENABLE_GROUTER
 	mConfigMgr->addConfiguration("grouter.cfg"     , gr);
 #endif
 
-#ifdef RS_USE_BITDHT
-    if(mBitDht != NULL)
-		mConfigMgr->addConfiguration("bitdht.cfg"      , mBitDht);
-#endif
-
 #ifdef RS_ENABLE_GXS
 
 #	ifdef RS_GXS_TRANS
@@ -1771,16 +1819,19 @@ int RsServer::StartupRetroShare()
 	mConfigMgr->addConfiguration("gxs_trans.cfg"   , mGxsTrans);
 #	endif // RS_GXS_TRANS
 
+	// Circles check identities, and the other services check both when
+	// loading their groups, so these are loaded first whatever the order here.
+
     mConfigMgr->addConfiguration("p3identity.cfg"     , mGxsIdService);
     mConfigMgr->addConfiguration("identity.cfg"       , gxsid_ns);
     mConfigMgr->addConfiguration("gxsforums.cfg"      , gxsforums_ns);
-    mConfigMgr->addConfiguration("gxsforums_srv.cfg"  , mGxsForums);
+    mConfigMgr->addConfiguration("gxsforums_srv.cfg"  , mGxsForums, { "p3identity.cfg", "gxscircles_srv.cfg" });
     mConfigMgr->addConfiguration("gxschannels.cfg"    , gxschannels_ns);
-	mConfigMgr->addConfiguration("gxschannels_srv.cfg", mGxsChannels);
+	mConfigMgr->addConfiguration("gxschannels_srv.cfg", mGxsChannels, { "p3identity.cfg", "gxscircles_srv.cfg" });
     mConfigMgr->addConfiguration("gxscircles.cfg"     , gxscircles_ns);
-    mConfigMgr->addConfiguration("gxscircles_srv.cfg" , mGxsCircles);
+    mConfigMgr->addConfiguration("gxscircles_srv.cfg" , mGxsCircles, { "p3identity.cfg" });
     mConfigMgr->addConfiguration("posted.cfg"         , posted_ns);
-    mConfigMgr->addConfiguration("gxsposted_srv.cfg"  , mPosted);
+    mConfigMgr->addConfiguration("gxsposted_srv.cfg"  , mPosted, { "p3identity.cfg", "gxscircles_srv.cfg" });
 #ifdef RS_USE_WIKI
 	mConfigMgr->addConfiguration("wiki.cfg", wiki_ns);
 #endif
@@ -1805,7 +1856,37 @@ int RsServer::StartupRetroShare()
 	/**************************************************************************/
 	std::cerr << "(2) Load configuration files" << std::endl;
 
-	mConfigMgr->loadConfiguration();
+	RsStartupTrace::addStep("create services", stepStart);
+	stepStart = RsStartupTrace::now();
+
+	// The network only needs the friend list, the general config, the service
+	// permissions, the ban list and the DHT config. Except for hidden nodes,
+	// which are set up from the whole config below, it is started as soon as
+	// these are loaded, while the other configs are loaded. Until then, pqih
+	// holds the services whose config is not loaded yet: it keeps their items
+	// and does not tick them. File transfer is held until its threads start.
+
+	bool earlyNetwork = !isHiddenNode && !rsInitConfig->hiddenNodeSet;
+
+	if (earlyNetwork)
+	{
+		std::list<pqiConfig *> pendingConfigs;
+		mConfigMgr->loadConfiguration({ "peers.cfg", "general.cfg", "servicecontrol.cfg", "banlist.cfg", "bitdht.cfg" }, pendingConfigs);
+
+		for(pqiConfig *cfg : pendingConfigs)
+		{
+			pqiService *service = dynamic_cast<pqiService *>(cfg);
+
+			if (service)
+				pqih->holdService(service);
+		}
+		pqih->holdService(ftserver);
+	}
+	else
+		mConfigMgr->loadConfiguration();
+
+	RsStartupTrace::addStep("load configuration", stepStart);
+	stepStart = RsStartupTrace::now();
 
 	/**************************************************************************/
 	/* trigger generalConfig loading for classes that require it */
@@ -1906,11 +1987,50 @@ int RsServer::StartupRetroShare()
 	/**************************************************************************/
 	/* startup (stuff dependent on Ids/peers is after this point) */
 	/**************************************************************************/
-	autoProxy->startAll();
+	// The auto proxy services use their own configs.
+	if (!earlyNetwork)
+		autoProxy->startAll();
 
 	pqih->init_listener();
 	mNetMgr->addNetListener(pqih); /* add listener so we can reset all sockets later */
 
+	// Starts the DHT, the loopback device and this thread, which ticks the connections.
+	auto startNetwork = [&]()
+	{
+		//mDhtMgr->start();
+#ifdef RS_USE_BITDHT
+		if(mBitDht != NULL)
+			mBitDht->start();
+#endif
+
+		// create loopback device, and add to pqisslgrp.
+
+		SearchModule *mod = new SearchModule();
+		pqiloopback *ploop = new pqiloopback(ownId);
+
+		mod -> peerid = ownId;
+		mod -> pqi = ploop;
+
+		pqih->AddSearchModule(mod);
+
+		/* Startup this thread! */
+		start("rs main") ;
+	};
+
+	if (earlyNetwork)
+	{
+		startNetwork();
+
+		RsStartupTrace::addStep("network setup", stepStart);
+		stepStart = RsStartupTrace::now();
+
+		mConfigMgr->loadConfiguration();
+		autoProxy->startAll();
+
+		RsStartupTrace::addStep("load remaining configuration", stepStart);
+		stepStart = RsStartupTrace::now();
+	}
+
 	/**************************************************************************/
 	/* load caches and secondary data */
 	/**************************************************************************/
@@ -1937,6 +2057,12 @@ int RsServer::StartupRetroShare()
 	/* Start up Threads */
 	/**************************************************************************/
 
+	if (!earlyNetwork)
+	{
+		RsStartupTrace::addStep("network setup", stepStart);
+		stepStart = RsStartupTrace::now();
+	}
+
 	// auto proxy threads
 #ifdef RS_USE_I2P_SAM3
 	startServiceThread(mI2pSam3, "I2P-SAM3");
@@ -1993,24 +2119,6 @@ int RsServer::StartupRetroShare()
 	ftserver->StartupThreads();
 	ftserver->ResumeTransfers();
 
-	//mDhtMgr->start();
-#ifdef RS_USE_BITDHT
-    if(mBitDht != NULL)
-		mBitDht->start();
-#endif
-
-	/**************************************************************************/
-
-	// create loopback device, and add to pqisslgrp.
-
-	SearchModule *mod = new SearchModule();
-	pqiloopback *ploop = new pqiloopback(ownId);
-
-	mod -> peerid = ownId;
-	mod -> pqi = ploop;
-
-	pqih->AddSearchModule(mod);
-
 	/* Setup GUI Interfaces. */
 
 	// rsDisc & RsMsgs done already.
@@ -2044,14 +2152,20 @@ int RsServer::StartupRetroShare()
 		mGeneralConfig->saveConfiguration();
 	}
 
-	/* Startup this thread! */
-	start("rs main") ;
+	if (earlyNetwork)
+		pqih->releaseServices();
+	else
+		startNetwork();
 
     std::cerr << "========================================================================" << std::endl;
     std::cerr << "==                 RsInit:: Retroshare core started                   ==" << std::endl;
     std::cerr << "========================================================================" << std::endl;
 
 	coreReady = true;
+
+	RsStartupTrace::addStep("start threads", stepStart);
+	RsStartupTrace::dump(RsAccounts::AccountDirectory() + "/startup_trace.json");
+
 	return 1;
 }
 
@@ -240,6 +240,11 @@ RsItem *    RsSerialType::deserialise(void */*data*/, uint32_t */*size*/)
 	return NULL;
 }
 
+RsItem *    RsSerialType::deserialiseShared(const RsSharedBuffer& data, uint32_t *size)
+{
+	return deserialise(data.get(), size);
+}
+
 uint32_t    RsSerialType::PacketId() const
 {
 	return type;
@@ -368,6 +373,17 @@ bool        RsSerialiser::serialise  (RsItem *item, void *data, uint32_t *size)
 
 
 RsItem *    RsSerialiser::deserialise(void *data, uint32_t *size)
+{
+	return deserialise(data, size, RsSharedBuffer());
+}
+
+RsItem *    RsSerialiser::deserialise(const RsSharedBuffer& data, uint32_t *size)
+{
+	return deserialise(data.get(), size, data);
+}
+
+RsItem *    RsSerialiser::deserialise(
+        void *data, uint32_t *size, const RsSharedBuffer& buffer )
 {
 	/* find the type */
 	if (*size < 8)
@@ -430,7 +446,9 @@ RsItem *    RsSerialiser::deserialise(void *data, uint32_t *size)
 		}
 	}
 
-	RsItem *item = (it->second)->deserialise(data, &pkt_size);
+	RsItem *item = buffer ?
+	            (it->second)->deserialiseShared(buffer, &pkt_size) :
+	            (it->second)->deserialise(data, &pkt_size);
 	if (!item)
 	{
 #ifdef RSSERIAL_ERROR_DEBUG
@@ -29,6 +29,7 @@
 #include <cstdint>
 
 #include "util/rsdeprecate.h"
+#include "util/rsmemory.h"
 
 /*******************************************************************
  * This is the Top-Level serialiser/deserialise, 
@@ -78,9 +79,17 @@ public:
 	uint32_t    size(RsItem *);
 	bool        serialise  (RsItem *item, void *data, uint32_t *size);
 	RsItem *    deserialise(void *data, uint32_t *size);
-	
-	
+
+	/** Same as deserialise(void*, uint32_t*) but the serialisers which
+	 * support it may keep views into data instead of copying big binary
+	 * fields out of it, data lifetime is then tied to the returned item.
+	 * @see RsSerializationFlags::SHARED_BUFFER_VIEWS */
+	RsItem *    deserialise(const RsSharedBuffer& data, uint32_t *size);
+
 private:
+	RsItem *    deserialise(
+	        void *data, uint32_t *size, const RsSharedBuffer& buffer );
+
 	std::map<uint32_t, RsSerialType *> serialisers;
 };
 
@@ -32,6 +32,14 @@
 #include "util/rsdebug.h"
 
 RsItem *RsServiceSerializer::deserialise(void *data, uint32_t *size)
+{ return deserialise(data, size, RsSharedBuffer()); }
+
+RsItem *RsServiceSerializer::deserialiseShared(
+        const RsSharedBuffer& data, uint32_t *size )
+{ return deserialise(data.get(), size, data); }
+
+RsItem *RsServiceSerializer::deserialise(
+        void *data, uint32_t *size, const RsSharedBuffer& buffer )
 {
 	if(!data || !size || *size < 8)
 	{
@@ -77,6 +85,9 @@ RsItem *RsServiceSerializer::deserialise(void *data, uint32_t *size)
 	            mFlags );
 	ctx.mOffset = 8 ;
 
+	if(!!(mFlags & RsSerializationFlags::SHARED_BUFFER_VIEWS))
+		ctx.mBuffer = buffer;
+
 	item->serial_process(RsGenericSerializer::DESERIALIZE, ctx) ;
 
 	if(ctx.mSize < ctx.mOffset)
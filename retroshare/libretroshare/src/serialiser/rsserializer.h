@@ -174,6 +174,11 @@ public:
 	virtual	bool        serialise  (RsItem *item, void *data, uint32_t *size)=0;
 	virtual	RsItem *    deserialise(void *data, uint32_t *size)=0;
 
+	/** Deserialise from a reference counted buffer, serialisers which support
+	 * it may keep views into data instead of copying big binary fields.
+	 * Default implementation just call deserialise(data.get(), size) */
+	virtual RsItem *    deserialiseShared(const RsSharedBuffer& data, uint32_t *size);
+
 	uint32_t    PacketId() const;
 private:
 	uint32_t type;
@@ -221,7 +226,14 @@ enum class RsSerializationFlags
 	 * This encoding is also capable of representing big values at expences of a
 	 * one more byte used.
 	 */
-	INTEGER_VLQ        = 16
+	INTEGER_VLQ        = 16,
+
+	/** When set and the data being deserialised is owned by a RsSharedBuffer
+	 * (@see RsSerialType::deserialiseShared) big binary fields are not copied
+	 * out of the buffer, but become reference counted views into it.
+	 * Only set this on serialisers whose items consumers don't steal or
+	 * free() RsTlvBinaryData::bin_data */
+	SHARED_BUFFER_VIEWS = 32
 };
 RS_REGISTER_ENUM_FLAGS_TYPE(RsSerializationFlags);
 
@@ -253,6 +265,10 @@ struct RsGenericSerializer : RsSerialType
 		bool mOk;
 		RsSerializationFlags mFlags;
 		RsJson mJson;
+
+		/** Owner of mData, set only when deserialising with
+		 * RsSerializationFlags::SHARED_BUFFER_VIEWS from a shared buffer */
+		RsSharedBuffer mBuffer;
 	};
 
 	/**
@@ -295,6 +311,10 @@ struct RsServiceSerializer : RsGenericSerializer
 	                             uint8_t /* item_sub_id */ ) const = 0;
 
 	RsItem *deserialise(void *data, uint32_t *size);
+	RsItem *deserialiseShared(const RsSharedBuffer& data, uint32_t *size) override;
+
+protected:
+	RsItem *deserialise(void *data, uint32_t *size, const RsSharedBuffer& buffer);
 };
 
 
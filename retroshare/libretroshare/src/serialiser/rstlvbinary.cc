@@ -83,9 +83,18 @@ bool     RsTlvBinaryData::setBinData(const void *data, uint32_t size)
 	return true;
 }
 
+RsSharedBuffer RsTlvBinaryData::shareBinData()
+{
+	if(!bin_ref && bin_data)
+		bin_ref = rs_shared_buffer_adopt(bin_data);
+
+	return bin_ref;
+}
+
 void RsTlvBinaryData::TlvClear()
 {
-	free(bin_data);
+	if(!bin_ref)
+		free(bin_data);
 	TlvShallowClear();
 }
 
@@ -93,6 +102,7 @@ void RsTlvBinaryData::TlvShallowClear()
 {
 	bin_data = NULL;
 	bin_len = 0;
+	bin_ref.reset();
 }
 
 uint32_t RsTlvBinaryData::TlvSize() const
@@ -180,6 +190,45 @@ bool     RsTlvBinaryData::GetTlv(void *data, uint32_t size, uint32_t *offset)
 
 	return ok;
 }
+bool     RsTlvBinaryData::GetTlvShared(void *data, uint32_t size, uint32_t *offset, const RsSharedBuffer& buffer)
+{
+	if (!buffer || buffer.get() != data)
+		return GetTlv(data, size, offset);
+
+	if (size < *offset + TLV_HEADER_SIZE)
+		return false; /* not enough space to get the header */
+
+	uint16_t tlvtype_in = GetTlvType( &(((uint8_t *) data)[*offset])  );
+	uint32_t tlvsize = GetTlvSize( &(((uint8_t *) data)[*offset])  );
+	uint32_t tlvend = *offset + tlvsize;
+
+	if (size < tlvend)    /* check size */
+		return false; /* not enough space */
+
+	if (tlvsize < TLV_HEADER_SIZE)
+		return false; /* bad tlv size */
+
+	if (tlvtype != tlvtype_in) /* check type */
+		return false;
+
+	if (tlvsize - TLV_HEADER_SIZE < SHARED_VIEW_MIN_SIZE)
+		return GetTlv(data, size, offset);
+
+	TlvClear();
+
+	/* skip the header, and point into the buffer instead of copying */
+	(*offset) += TLV_HEADER_SIZE;
+
+	bin_len = tlvsize - TLV_HEADER_SIZE;
+	bin_ref = rs_shared_buffer_view(buffer, *offset);
+	bin_data = bin_ref.get();
+
+	/* skip also possible extra bytes, as GetTlv() does */
+	*offset = tlvend;
+
+	return true;
+}
+
 std::ostream &RsTlvBinaryDataRef::print(std::ostream &out, uint16_t indent) const
 {
         uint16_t int_Indent = indent + 2;
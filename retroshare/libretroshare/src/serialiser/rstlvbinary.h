@@ -50,14 +50,27 @@ public:
 	/// Deserialise.
 	/*! Deserialise Tlv buffer(*data) of 'size' bytes starting at *offset */
 	virtual bool     GetTlv(void *data, uint32_t size, uint32_t *offset); 
+
+	/// Deserialise as a view into buffer, if big enough to be worth it.
+	/*! Payloads smaller than SHARED_VIEW_MIN_SIZE are copied as usual */
+	virtual bool     GetTlvShared(void *data, uint32_t size, uint32_t *offset, const RsSharedBuffer& buffer);
 	virtual std::ostream &print(std::ostream &out, uint16_t indent) const; /*! Error/Debug util function */
 
 	// mallocs the necessary size, and copies data into the allocated buffer in bin_data
 	bool    setBinData(const void *data, uint32_t size);
 
+	/// Get a reference counted handle on bin_data without copying it.
+	/*! If bin_data was malloc'ed it becomes owned by the returned handle, the
+	 *  item keeps pointing to it as a view. */
+	RsSharedBuffer shareBinData();
+
+	/// Under this size keeping a view would pin a whole packet for nothing
+	static constexpr uint32_t SHARED_VIEW_MIN_SIZE = 256;
+
 	uint16_t tlvtype;	/// set/checked against TLV input 
 	uint32_t bin_len;	/// size of malloc'ed data (not serialised) 
 	void    *bin_data;	/// mandatory
+	RsSharedBuffer bin_ref;	/// if set bin_data is a view owned by it, not malloc'ed (not serialised)
 };
 
 // This class is mainly used for on-the-fly serialization
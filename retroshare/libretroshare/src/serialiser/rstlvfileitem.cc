@@ -633,6 +633,11 @@ bool RsTlvFileData::SetTlv(void *data, uint32_t size, uint32_t *offset) const
 }
 
 bool RsTlvFileData::GetTlv(void *data, uint32_t size, uint32_t *offset) 
+{
+	return GetTlvShared(data, size, offset, RsSharedBuffer());
+}
+
+bool RsTlvFileData::GetTlvShared(void *data, uint32_t size, uint32_t *offset, const RsSharedBuffer& buffer)
 {
 	if (size < *offset + TLV_HEADER_SIZE)
 	{
@@ -660,7 +665,7 @@ bool RsTlvFileData::GetTlv(void *data, uint32_t size, uint32_t *offset)
 	ok &= file.GetTlv(data, size, offset);
 	ok &= GetTlvUInt64(data,size,offset, 
 			TLV_TYPE_UINT64_OFFSET,&file_offset);
-	ok &= binData.GetTlv(data, size, offset);
+	ok &= binData.GetTlvShared(data, size, offset, buffer);
 
 
 	/***************************************************************************
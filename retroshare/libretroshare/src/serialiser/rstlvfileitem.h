@@ -79,6 +79,7 @@ virtual uint32_t TlvSize() const;
 virtual void	 TlvClear();
 virtual bool     SetTlv(void *data, uint32_t size, uint32_t *offset) const; 
 virtual bool     GetTlv(void *data, uint32_t size, uint32_t *offset); 
+virtual bool     GetTlvShared(void *data, uint32_t size, uint32_t *offset, const RsSharedBuffer& buffer);
 virtual std::ostream &print(std::ostream &out, uint16_t indent) const;
 
 	RsTlvFileItem   file;         /// Mandatory: file information	
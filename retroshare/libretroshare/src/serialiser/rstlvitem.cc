@@ -38,6 +38,11 @@ void  	RsTlvItem::TlvShallowClear()
 	TlvClear(); /* unless overloaded! */
 }
 
+bool	RsTlvItem::GetTlvShared(void *data, uint32_t size, uint32_t *offset, const RsSharedBuffer& /*buffer*/)
+{
+	return GetTlv(data, size, offset); /* unless overloaded! */
+}
+
 std::ostream &RsTlvItem::printBase(std::ostream &out, std::string clsName, uint16_t indent) const
 {
 	printIndent(out, indent);
@@ -27,6 +27,7 @@
  ******************************************************************/
 
 #include "util/rsdeprecate.h"
+#include "util/rsmemory.h"
 
 #include <iosfwd>
 #include <string>
@@ -47,6 +48,9 @@ virtual void	 TlvClear() = 0;
 virtual	void	 TlvShallowClear(); /*! Don't delete allocated data */
 virtual bool     SetTlv(void *data, uint32_t size, uint32_t *offset) const = 0; /* serialise   */
 virtual bool     GetTlv(void *data, uint32_t size, uint32_t *offset) = 0; /* deserialise */
+/*! Deserialise, data is owned by buffer so big binary fields may be kept as
+ * views into it instead of being copied. Defaults to GetTlv() */
+virtual bool     GetTlvShared(void *data, uint32_t size, uint32_t *offset, const RsSharedBuffer& buffer);
 virtual std::ostream &print(std::ostream &out, uint16_t indent) const = 0;
 std::ostream &printBase(std::ostream &out, std::string clsName, uint16_t indent) const;
 std::ostream &printEnd(std::ostream &out, std::string clsName, uint16_t indent) const;
@@ -875,7 +875,16 @@ struct RsTypeSerializer
 	        RsGenericSerializer::SerializeJob j,
 	        RsGenericSerializer::SerializeContext& ctx,
 	        T& member, const std::string& memberName )
-	{ serial_process(j, ctx, static_cast<RsTlvItem&>(member), memberName); }
+	{
+		if(j == RsGenericSerializer::DESERIALIZE && ctx.mBuffer)
+		{
+			ctx.mOk = ctx.mOk && member.GetTlvShared(
+			            ctx.mData, ctx.mSize, &ctx.mOffset, ctx.mBuffer );
+			return;
+		}
+
+		serial_process(j, ctx, static_cast<RsTlvItem&>(member), memberName);
+	}
 
 	/** std::error_condition
 	 * supports only TO_JSON ErrConditionWrapper::serial_process will explode
@@ -32,6 +32,8 @@
 #include <sys/time.h>
 
 #include <set>
+#include <algorithm>
+#include <string.h>
 
 /****
  * #define DEBUG_REPUTATION		1
@@ -60,7 +62,7 @@
  * 	- only send a neutral opinion when it is a true change over someone's opinion
  * 	- auto-clean reputations for default values
  *
- * std::map<RsGxsId, Reputation> mReputations.
+ * ReputationTable mReputations.
  * std::multimap<rstime_t, RsGxsId> mUpdated.
  *
  * std::map<RsPeerId, ReputationConfig> mConfig;
@@ -316,10 +318,10 @@ void p3GxsReputation::updateStaticIdentityFlags()
 	    std::cerr << "Updating reputation identity flags" << std::endl;
 #endif
 
-	    for( std::map<RsGxsId, Reputation>::iterator rit = mReputations.begin();rit!=mReputations.end();++rit)
+	    for(uint32_t i=0;i<mReputations.size();++i)
         {
-            if( (!(rit->second.mIdentityFlags & REPUTATION_IDENTITY_FLAG_UP_TO_DATE)) && (mPerNodeBannedIdsProxy.find(rit->first) == mPerNodeBannedIdsProxy.end()))
-			    to_update.push_back(rit->first) ;
+            if( (!(mReputations.at(i).mIdentityFlags & REPUTATION_IDENTITY_FLAG_UP_TO_DATE)) && (mPerNodeBannedIdsProxy.find(mReputations.id(i)) == mPerNodeBannedIdsProxy.end()))
+			    to_update.push_back(mReputations.id(i)) ;
         }
     }
 
@@ -336,27 +338,29 @@ void p3GxsReputation::updateStaticIdentityFlags()
 	    }
         {
             RsStackMutex stack(mReputationMtx); /****** LOCKED MUTEX *******/
-            std::map<RsGxsId,Reputation>::iterator it = mReputations.find(*rit) ;
+            uint32_t index = mReputations.find(*rit) ;
 
-            if(it == mReputations.end())
+            if(index == ReputationTable::NOT_FOUND)
             {
                 std::cerr << "  Weird situation: item " << *rit << " has been deleted from the list??" << std::endl;
                 continue ;
             }
-            it->second.mIdentityFlags = REPUTATION_IDENTITY_FLAG_UP_TO_DATE ;		// resets the NEEDS_UPDATE flag. All other flags set later on.
+            Reputation& rep(mReputations.at(index)) ;
+
+            rep.mIdentityFlags = REPUTATION_IDENTITY_FLAG_UP_TO_DATE ;		// resets the NEEDS_UPDATE flag. All other flags set later on.
 
             if(details.mFlags & RS_IDENTITY_FLAGS_PGP_LINKED)
             {
-                it->second.mIdentityFlags |= REPUTATION_IDENTITY_FLAG_PGP_LINKED ;
-                it->second.mOwnerNode = details.mPgpId ;
+                rep.mIdentityFlags |= REPUTATION_IDENTITY_FLAG_PGP_LINKED ;
+                rep.mOwnerNode = details.mPgpId ;
             }
-            if(details.mFlags & RS_IDENTITY_FLAGS_PGP_KNOWN ) it->second.mIdentityFlags |= REPUTATION_IDENTITY_FLAG_PGP_KNOWN ;
+            if(details.mFlags & RS_IDENTITY_FLAGS_PGP_KNOWN ) rep.mIdentityFlags |= REPUTATION_IDENTITY_FLAG_PGP_KNOWN ;
 
 #ifdef DEBUG_REPUTATION
-            std::cerr << "  updated flags for " << *rit << " to " << std::hex << it->second.mIdentityFlags << std::dec << std::endl;
+            std::cerr << "  updated flags for " << *rit << " to " << std::hex << rep.mIdentityFlags << std::dec << std::endl;
 #endif
 
-            it->second.updateReputation() ;
+            rep.updateReputation() ;
             mChanged = true ;
         }
     }
@@ -378,58 +382,56 @@ void p3GxsReputation::cleanup()
 	{
 		RsStackMutex stack(mReputationMtx); /****** LOCKED MUTEX *******/
 
-		for(std::map<RsGxsId,Reputation>::iterator it(mReputations.begin());it!=mReputations.end();)
+		for(uint32_t i=0;i<mReputations.size();)
         {
+            const Reputation& rep(mReputations.at(i)) ;
             bool should_delete = false ;
 
-			if( it->second.mOwnOpinion ==
+			if( rep.mOwnOpinion ==
 			        static_cast<int32_t>(RsOpinion::NEGATIVE) &&
 			        mMaxPreventReloadBannedIds != 0 &&
-			        it->second.mOwnOpinionTs + mMaxPreventReloadBannedIds < now )
+			        rep.mOwnOpinionTs + mMaxPreventReloadBannedIds < now )
             {
 #ifdef DEBUG_REPUTATION
-                std::cerr << "  ID " << it->first << ": own is negative for more than " << mMaxPreventReloadBannedIds/86400 << " days. Reseting it!" << std::endl;
+                std::cerr << "  ID " << mReputations.id(i) << ": own is negative for more than " << mMaxPreventReloadBannedIds/86400 << " days. Reseting it!" << std::endl;
 #endif
                 should_delete = true;
             }
 
             // Delete slots with basically no information
 
-			if( it->second.mOpinions.empty() &&
-			        it->second.mOwnOpinion ==
+			if( !mReputations.hasOpinions(i) &&
+			        rep.mOwnOpinion ==
 			            static_cast<int32_t>(RsOpinion::NEUTRAL) &&
-			        it->second.mOwnerNode.isNull() )
+			        rep.mOwnerNode.isNull() )
             {
 #ifdef DEBUG_REPUTATION
-                std::cerr << "  ID " << it->first << ": own is neutral and no opinions from friends => remove entry" << std::endl;
+                std::cerr << "  ID " << mReputations.id(i) << ": own is neutral and no opinions from friends => remove entry" << std::endl;
 #endif
                 should_delete = true ;
             }
 
             // Delete slots that havn't been used for a while. The else below is here for debug display purposes, and not harmful since both conditions lead the same effect.
 
-            else if(it->second.mLastUsedTS + REPUTATION_INFO_KEEP_DELAY_DEFAULT < now)
+            else if(rep.mLastUsedTS + REPUTATION_INFO_KEEP_DELAY_DEFAULT < now)
             {
 #ifdef DEBUG_REPUTATION
-                std::cerr << "  ID " << it->first << ": no request for reputation for more than " << REPUTATION_INFO_KEEP_DELAY_DEFAULT/86400 << " days => deleting." << std::endl;
+                std::cerr << "  ID " << mReputations.id(i) << ": no request for reputation for more than " << REPUTATION_INFO_KEEP_DELAY_DEFAULT/86400 << " days => deleting." << std::endl;
 #endif
                 should_delete = true ;
             }
 #ifdef DEBUG_REPUTATION
             else
-				std::cerr << "  ID " << it->first << ": flags=" << std::hex << it->second.mIdentityFlags << std::dec << ". Last used: " << (now - it->second.mLastUsedTS)/86400 << " days ago: kept." << std::endl;
+				std::cerr << "  ID " << mReputations.id(i) << ": flags=" << std::hex << rep.mIdentityFlags << std::dec << ". Last used: " << (now - rep.mLastUsedTS)/86400 << " days ago: kept." << std::endl;
 #endif
 
 			if(should_delete)
 			{
-                std::map<RsGxsId,Reputation>::iterator tmp(it) ;
-				++tmp ;
-				mReputations.erase(it) ;
-				it = tmp ;
+				mReputations.erase(i) ;	// the last entry now takes index i
                 mChanged = true ;
 			}
 			else
-				++it;
+				++i;
         }
 	}
 
@@ -466,10 +468,10 @@ void p3GxsReputation::cleanup()
 		{
 			RsStackMutex stack(mReputationMtx); /****** LOCKED MUTEX *******/
 
-			for(std::map<RsGxsId,Reputation>::iterator it(mReputations.begin());it!=mReputations.end();++it)
-				if( it->second.mOwnOpinion ==
+			for(uint32_t i=0;i<mReputations.size();++i)
+				if( mReputations.at(i).mOwnOpinion ==
 				        static_cast<int32_t>(RsOpinion::NEUTRAL) )
-					should_set_to_positive_candidates.push_back(it->first) ;
+					should_set_to_positive_candidates.push_back(mReputations.id(i)) ;
 		}
 
 		for(std::list<RsGxsId>::const_iterator it(should_set_to_positive_candidates.begin());it!=should_set_to_positive_candidates.end();++it)
@@ -565,9 +567,9 @@ bool p3GxsReputation::SendReputations(RsGxsReputationRequestItem *request)
 	for(;tit != mUpdated.end(); ++tit)
 	{
 		/* find */
-		std::map<RsGxsId, Reputation>::iterator rit = mReputations.find(tit->second);
+		uint32_t index = mReputations.find(tit->second);
         
-		if (rit == mReputations.end())
+		if (index == ReputationTable::NOT_FOUND)
 		{
 			std::cerr << "p3GxsReputation::SendReputations() ERROR Missing Reputation";
 			std::cerr << std::endl;
@@ -575,7 +577,9 @@ bool p3GxsReputation::SendReputations(RsGxsReputationRequestItem *request)
 			continue;
 		}
 
-		if (rit->second.mOwnOpinionTs == 0)
+		const Reputation& rep(mReputations.at(index));
+
+		if (rep.mOwnOpinionTs == 0)
 		{
 			std::cerr << "p3GxsReputation::SendReputations() ERROR OwnOpinionTS = 0";
 			std::cerr << std::endl;
@@ -583,9 +587,8 @@ bool p3GxsReputation::SendReputations(RsGxsReputationRequestItem *request)
 			continue;
 		}
 
-		RsGxsId gxsId = rit->first;
-		pkt->mOpinions[gxsId] = rit->second.mOwnOpinion;
-		pkt->mLatestUpdate = rit->second.mOwnOpinionTs;
+		pkt->mOpinions[tit->second] = rep.mOwnOpinion;
+		pkt->mLatestUpdate = rep.mOwnOpinionTs;
         
 		if (pkt->mLatestUpdate == (uint32_t) now)
 		{
@@ -638,12 +641,9 @@ void p3GxsReputation::locked_updateOpinion(
         const RsPeerId& from, const RsGxsId& about, RsOpinion op )
 {
     /* find matching Reputation */
-    std::map<RsGxsId, Reputation>::iterator rit = mReputations.find(about);
+    uint32_t index = mReputations.find(about);
 
 	RsOpinion new_opinion = op;
-	RsOpinion old_opinion = RsOpinion::NEUTRAL ;	// default if not set
-
-    bool updated = false ;
 
 #ifdef DEBUG_REPUTATION
     std::cerr << "p3GxsReputation::update opinion of " << about << " from " << from << " to " << op << std::endl;
@@ -656,17 +656,14 @@ void p3GxsReputation::locked_updateOpinion(
     //        New opinion is neutral:      nothing to do
     //        New opinion is != 1:         create entry and store
 
-    if (rit == mReputations.end())	
+    if (index == ReputationTable::NOT_FOUND)
     {
 #ifdef DEBUG_REPUTATION
 	    std::cerr << "  no preview record"<< std::endl;
 #endif
 
 		if(new_opinion != RsOpinion::NEUTRAL)
-	    {
-			mReputations[about] = Reputation();
-		    rit = mReputations.find(about);
-	    }
+		    index = mReputations.insert(about);
 	    else
 	    {
 #ifdef DEBUG_REPUTATION
@@ -676,38 +673,14 @@ void p3GxsReputation::locked_updateOpinion(
 	    }
     }
 
-    Reputation& reputation = rit->second;
+    // Neutral opinions are not stored. Vote counts are updated by the table.
 
-	std::map<RsPeerId,RsOpinion>::iterator it2 = reputation.mOpinions.find(from) ;
+    bool updated = mReputations.setOpinion(index, from, new_opinion) ;
 
-    if(it2 == reputation.mOpinions.end())
-    {
-		if(new_opinion != RsOpinion::NEUTRAL)
-	    {
-		    reputation.mOpinions[from] = new_opinion;	// filters potentially tweaked reputation score sent by friend
-		    updated = true ;
-	    }
-    }
-    else
+	if( !mReputations.hasOpinions(index) &&
+	        mReputations.at(index).mOwnOpinion == static_cast<int32_t>(RsOpinion::NEUTRAL) )
     {
-	    old_opinion = it2->second ;
-
-		if(new_opinion == RsOpinion::NEUTRAL)
-	    {
-		    reputation.mOpinions.erase(it2) ;		// don't store when the opinion is neutral
-		    updated = true ;
-	    }
-	    else if(new_opinion != old_opinion)
-	    {
-		    it2->second = new_opinion ;
-		    updated = true ;
-	    }
-    }
-
-	if( reputation.mOpinions.empty() &&
-	        reputation.mOwnOpinion == static_cast<int32_t>(RsOpinion::NEUTRAL) )
-    {
-	    mReputations.erase(rit) ;
+	    mReputations.erase(index) ;
 #ifdef DEBUG_REPUTATION
 	    std::cerr << "  own is neutral and no opinions from friends => remove entry" << std::endl;
 #endif
@@ -718,7 +691,7 @@ void p3GxsReputation::locked_updateOpinion(
 #ifdef DEBUG_REPUTATION
 	    std::cerr << "  reputation changed. re-calculating." << std::endl;
 #endif
-	    reputation.updateReputation() ;
+	    mReputations.at(index).updateReputation() ;
     }
     
     if(updated)
@@ -792,21 +765,23 @@ bool p3GxsReputation::getIdentityFlagsAndOwnerId(const RsGxsId& gxsid, uint32_t&
 
    RsStackMutex stack(mReputationMtx); /****** LOCKED MUTEX *******/
 
-   std::map<RsGxsId,Reputation>::iterator it = mReputations.find(gxsid) ;
+   uint32_t index = mReputations.find(gxsid) ;
 
-   if(it == mReputations.end())
+   if(index == ReputationTable::NOT_FOUND)
        return false ;
 
-   if(!(it->second.mIdentityFlags & REPUTATION_IDENTITY_FLAG_UP_TO_DATE))
+   const Reputation& rep(mReputations.at(index)) ;
+
+   if(!(rep.mIdentityFlags & REPUTATION_IDENTITY_FLAG_UP_TO_DATE))
        return false ;
 
-   if(it->second.mIdentityFlags & REPUTATION_IDENTITY_FLAG_PGP_LINKED)
+   if(rep.mIdentityFlags & REPUTATION_IDENTITY_FLAG_PGP_LINKED)
        identity_flags |= RS_IDENTITY_FLAGS_PGP_LINKED ;
 
-   if(it->second.mIdentityFlags & REPUTATION_IDENTITY_FLAG_PGP_KNOWN)
+   if(rep.mIdentityFlags & REPUTATION_IDENTITY_FLAG_PGP_KNOWN)
        identity_flags |= RS_IDENTITY_FLAGS_PGP_KNOWN ;
 
-   owner_id = it->second.mOwnerNode ;
+   owner_id = rep.mOwnerNode ;
 
    return true ;
 }
@@ -825,10 +800,10 @@ bool p3GxsReputation::getReputationInfo(
 #ifdef DEBUG_REPUTATION2
     std::cerr << "getReputationInfo() for " << gxsid << ", stamp = " << stamp << std::endl;
 #endif
-    std::map<RsGxsId,Reputation>::iterator it = mReputations.find(gxsid) ;
+    uint32_t index = mReputations.find(gxsid) ;
     RsPgpId owner_id ;
 
-    if(it == mReputations.end())
+    if(index == ReputationTable::NOT_FOUND)
     {
 		info.mOwnOpinion = RsOpinion::NEUTRAL ;
         info.mFriendAverageScore = RS_REPUTATION_THRESHOLD_DEFAULT ;
@@ -839,7 +814,7 @@ bool p3GxsReputation::getReputationInfo(
     }
     else
     {
-        Reputation& rep(it->second) ;
+        Reputation& rep(mReputations.at(index)) ;
 
 		info.mOwnOpinion =
 		        safe_convert_uint32t_to_opinion(
@@ -1017,11 +992,11 @@ bool p3GxsReputation::getOwnOpinion(
 
 	RS_STACK_MUTEX(mReputationMtx);
 
-	std::map<RsGxsId, Reputation>::iterator rit = mReputations.find(gxsid);
+	uint32_t index = mReputations.find(gxsid);
 
-	if(rit != mReputations.end())
+	if(index != ReputationTable::NOT_FOUND)
 		opinion = safe_convert_uint32t_to_opinion(
-		            static_cast<uint32_t>(rit->second.mOwnOpinion) );
+		            static_cast<uint32_t>(mReputations.at(index).mOwnOpinion) );
 	else
 		opinion = RsOpinion::NEUTRAL;
 
@@ -1042,20 +1017,11 @@ bool p3GxsReputation::setOwnOpinion(
 
 	RS_STACK_MUTEX(mReputationMtx);
 
-	std::map<RsGxsId, Reputation>::iterator rit;
-
-	/* find matching Reputation */
-	rit = mReputations.find(gxsid);
-    
-	if (rit == mReputations.end())
-	{
+	/* find matching Reputation, or create it */
 #warning csoler 2017-01-05: We should set the owner node id here.
-		mReputations[gxsid] = Reputation();
-		rit = mReputations.find(gxsid);
-	}
+	Reputation &reputation = mReputations.at(mReputations.insert(gxsid));
 
 	// we should remove previous entries from Updates...
-	Reputation &reputation = rit->second;
 	if (reputation.mOwnOpinionTs != 0)
 	{
 		if (reputation.mOwnOpinion == static_cast<int32_t>(opinion))
@@ -1131,27 +1097,33 @@ bool p3GxsReputation::saveList(bool& cleanup, std::list<RsItem*> &savelist)
 		savelist.push_back(item);
 	}
 
-	int count = 0;
- 	std::map<RsGxsId, Reputation>::iterator rit;
-	for(rit = mReputations.begin(); rit != mReputations.end(); ++rit, count++)
+	std::map<RsPeerId, RsOpinion> opinions;
+
+	for(uint32_t i=0; i<mReputations.size(); ++i)
 	{
+		const Reputation& rep(mReputations.at(i));
+
 		RsGxsReputationSetItem *item = new RsGxsReputationSetItem();
-		item->mGxsId = rit->first;
-		item->mOwnOpinion = rit->second.mOwnOpinion;
-		item->mOwnOpinionTS = rit->second.mOwnOpinionTs;
-		item->mIdentityFlags = rit->second.mIdentityFlags;
-        item->mOwnerNodeId = rit->second.mOwnerNode;
-        item->mLastUsedTS = rit->second.mLastUsedTS;
-
-		std::map<RsPeerId, RsOpinion>::iterator oit;
-		for(oit = rit->second.mOpinions.begin(); oit != rit->second.mOpinions.end(); ++oit)
+		item->mGxsId = mReputations.id(i);
+		item->mOwnOpinion = rep.mOwnOpinion;
+		item->mOwnOpinionTS = rep.mOwnOpinionTs;
+		item->mIdentityFlags = rep.mIdentityFlags;
+        item->mOwnerNodeId = rep.mOwnerNode;
+        item->mLastUsedTS = rep.mLastUsedTS;
+
+		if(mReputations.hasOpinions(i))
 		{
-			// should be already limited.
-			item->mOpinions[oit->first] = (uint32_t)oit->second;
+			mReputations.getOpinions(i, opinions);
+
+			std::map<RsPeerId, RsOpinion>::iterator oit;
+			for(oit = opinions.begin(); oit != opinions.end(); ++oit)
+			{
+				// should be already limited.
+				item->mOpinions[oit->first] = (uint32_t)oit->second;
+			}
 		}
 
 		savelist.push_back(item);
-		count++;
 	}
 
     for(std::map<RsPgpId,BannedNodeInfo>::const_iterator it(mBannedPgpIds.begin());it!=mBannedPgpIds.end();++it)
@@ -1296,21 +1268,18 @@ bool p3GxsReputation::loadReputationSet_deprecated3(RsGxsReputationSetItem_depre
     {
         RsStackMutex stack(mReputationMtx); /****** LOCKED MUTEX *******/
 
-        std::map<RsGxsId, Reputation>::iterator rit;
-
         if(item->mGxsId.isNull())	// just a protection against potential errors having put 00000 into ids.
             return false ;
 
         /* find matching Reputation */
         RsGxsId gxsId(item->mGxsId);
-        rit = mReputations.find(gxsId);
-        if (rit != mReputations.end())
+        if (mReputations.find(gxsId) != ReputationTable::NOT_FOUND)
         {
             std::cerr << "ERROR";
             std::cerr << std::endl;
         }
 
-        Reputation &reputation = mReputations[gxsId];
+        uint32_t index = mReputations.insert(gxsId);
 
         // install opinions.
         std::map<RsPeerId, uint32_t>::const_iterator oit;
@@ -1319,9 +1288,11 @@ bool p3GxsReputation::loadReputationSet_deprecated3(RsGxsReputationSetItem_depre
             // expensive ... but necessary.
             RsPeerId peerId(oit->first);
             if (peerSet.end() != peerSet.find(peerId))
-                reputation.mOpinions[peerId] = safe_convert_uint32t_to_opinion(oit->second);
+                mReputations.setOpinion(index, peerId, safe_convert_uint32t_to_opinion(oit->second));
         }
 
+        Reputation &reputation = mReputations.at(index);
+
         reputation.mOwnOpinion = item->mOwnOpinion;
         reputation.mOwnOpinionTs = item->mOwnOpinionTS;
         reputation.mOwnerNode = item->mOwnerNodeId;
@@ -1348,21 +1319,18 @@ bool p3GxsReputation::loadReputationSet(RsGxsReputationSetItem *item, const std:
     {
         RsStackMutex stack(mReputationMtx); /****** LOCKED MUTEX *******/
 
-        std::map<RsGxsId, Reputation>::iterator rit;
-
         if(item->mGxsId.isNull())	// just a protection against potential errors having put 00000 into ids.
             return false ;
 
         /* find matching Reputation */
         RsGxsId gxsId(item->mGxsId);
-        rit = mReputations.find(gxsId);
-        if (rit != mReputations.end())
+        if (mReputations.find(gxsId) != ReputationTable::NOT_FOUND)
         {
             std::cerr << "ERROR";
             std::cerr << std::endl;
         }
 
-        Reputation &reputation = mReputations[gxsId];
+        uint32_t index = mReputations.insert(gxsId);
 
         // install opinions.
         std::map<RsPeerId, uint32_t>::const_iterator oit;
@@ -1371,9 +1339,11 @@ bool p3GxsReputation::loadReputationSet(RsGxsReputationSetItem *item, const std:
             // expensive ... but necessary.
             RsPeerId peerId(oit->first);
             if (peerSet.end() != peerSet.find(peerId))
-                reputation.mOpinions[peerId] = safe_convert_uint32t_to_opinion(oit->second);
+                mReputations.setOpinion(index, peerId, safe_convert_uint32t_to_opinion(oit->second));
         }
 
+        Reputation &reputation = mReputations.at(index);
+
         reputation.mOwnOpinion = item->mOwnOpinion;
         reputation.mOwnOpinionTs = item->mOwnOpinionTS;
         reputation.mOwnerNode = item->mOwnerNodeId;
@@ -1501,27 +1471,13 @@ void Reputation::updateReputation()
 {
     // the calculation of reputation makes the whole thing   
 
-    int friend_total = 0;
-
-    mFriendsNegative = 0 ;
-    mFriendsPositive = 0 ;
-
-    // accounts for all friends. Neutral opinions count for 1-1=0
+    // accounts for all friends. Neutral opinions count for 1-1=0, so only the
+    // vote counts matter. They are kept up to date by ReputationTable.
     // because the average is performed over only accessible peers (not the total number) we need to shift to 1
 
-	for( std::map<RsPeerId,RsOpinion>::const_iterator it(mOpinions.begin());
-	     it != mOpinions.end(); ++it )
-    {
-		if( it->second == RsOpinion::NEGATIVE)
-            ++mFriendsNegative ;
+    int friend_total = static_cast<int>(mFriendsPositive) - static_cast<int>(mFriendsNegative) ;
 
-		if( it->second == RsOpinion::POSITIVE)
-            ++mFriendsPositive ;
-
-		friend_total += static_cast<int>(it->second) - 1;
-    }
-
-    if(mOpinions.empty())	// includes the case of no friends!
+    if(mFriendsPositive + mFriendsNegative == 0)	// includes the case of no friends!
 	    mFriendAverage = 1.0f ;
     else
     {
@@ -1578,13 +1534,228 @@ void Reputation::updateReputation()
 	else mReputationScore = static_cast<float>(mOwnOpinion);
 }
 
+/********************************************************************
+ * ReputationTable
+ ****/
+
+// Opinions are stored on 2 bits: 0 for neutral (i.e. no opinion), and the
+// opinion value + 1 otherwise.
+
+static const uint32_t OPINIONS_PER_WORD = 32 ;
+
+const uint32_t ReputationTable::NOT_FOUND ;
+
+ReputationTable::ReputationTable()
+    : mWordsPerEntry(0)
+{
+	clear() ;
+}
+
+void ReputationTable::clear()
+{
+	mIds.clear() ;
+	mEntries.clear() ;
+	mSlots.assign(16,NOT_FOUND) ;
+
+	mFriendIndices.clear() ;
+	mFriends.clear() ;
+
+	mOpinionBits.clear() ;
+	mWordsPerEntry = 0 ;
+}
+
+uint32_t ReputationTable::homeSlot(const RsGxsId& id, uint32_t mask)
+{
+	// GXS ids are hashes of public keys, so that any part of them is a good hash.
+
+	uint32_t h ;
+	memcpy(&h,id.toByteArray(),sizeof(h)) ;
+
+	return h & mask ;
+}
+
+uint32_t ReputationTable::findSlot(const RsGxsId& id) const
+{
+	uint32_t mask = mSlots.size() - 1 ;
+
+	for(uint32_t s = homeSlot(id,mask);;s = (s+1) & mask)
+		if(mSlots[s] == NOT_FOUND || mIds[mSlots[s]] == id)
+			return s ;
+}
+
+uint32_t ReputationTable::find(const RsGxsId& id) const
+{
+	return mSlots[findSlot(id)] ;
+}
+
+uint32_t ReputationTable::insert(const RsGxsId& id)
+{
+	uint32_t s = findSlot(id) ;
+
+	if(mSlots[s] != NOT_FOUND)
+		return mSlots[s] ;
+
+	uint32_t index = mIds.size() ;
+
+	mIds.push_back(id) ;
+	mEntries.push_back(Reputation()) ;
+	mOpinionBits.resize(mOpinionBits.size() + mWordsPerEntry,0) ;
+
+	mSlots[s] = index ;
+
+	// Keep the load factor under 70%, so that probe sequences stay short.
+
+	if(10*mIds.size() > 7*mSlots.size())
+		resizeSlots(2*mSlots.size()) ;
+
+	return index ;
+}
+
+void ReputationTable::resizeSlots(uint32_t n)
+{
+	mSlots.assign(n,NOT_FOUND) ;
+
+	for(uint32_t i=0;i<mIds.size();++i)
+		mSlots[findSlot(mIds[i])] = i ;
+}
+
+void ReputationTable::erase(uint32_t index)
+{
+	uint32_t mask = mSlots.size() - 1 ;
+	uint32_t hole = findSlot(mIds[index]) ;
+
+	// Backward shift deletion: move up the entries that would not be found
+	// anymore once the slot is empty. This avoids tombstones.
+
+	for(uint32_t s = (hole+1) & mask; mSlots[s] != NOT_FOUND; s = (s+1) & mask)
+	{
+		uint32_t home = homeSlot(mIds[mSlots[s]],mask) ;
+
+		if(((s - home) & mask) >= ((s - hole) & mask))
+		{
+			mSlots[hole] = mSlots[s] ;
+			hole = s ;
+		}
+	}
+	mSlots[hole] = NOT_FOUND ;
+
+	// Move the last entry in place of the removed one, so that storage stays dense.
+
+	uint32_t last = mIds.size() - 1 ;
+
+	if(index != last)
+	{
+		mSlots[findSlot(mIds[last])] = index ;
+
+		mIds[index] = mIds[last] ;
+		mEntries[index] = mEntries[last] ;
+
+		std::copy(mOpinionBits.begin() + last*mWordsPerEntry,mOpinionBits.begin() + (last+1)*mWordsPerEntry,mOpinionBits.begin() + index*mWordsPerEntry) ;
+	}
+
+	mIds.pop_back() ;
+	mEntries.pop_back() ;
+	mOpinionBits.resize(last*mWordsPerEntry) ;
+}
+
+uint32_t ReputationTable::friendIndex(const RsPeerId& peer_id)
+{
+	std::map<RsPeerId,uint32_t>::const_iterator it = mFriendIndices.find(peer_id) ;
+
+	if(it != mFriendIndices.end())
+		return it->second ;
+
+	uint32_t n = mFriends.size() ;
+
+	mFriendIndices[peer_id] = n ;
+	mFriends.push_back(peer_id) ;
+
+	if(n >= mWordsPerEntry * OPINIONS_PER_WORD)
+		setWordsPerEntry(mWordsPerEntry + 1) ;
+
+	return n ;
+}
+
+void ReputationTable::setWordsPerEntry(uint32_t n)
+{
+	std::vector<uint64_t> bits(mIds.size() * n, 0) ;
+
+	for(uint32_t i=0;i<mIds.size();++i)
+		std::copy(mOpinionBits.begin() + i*mWordsPerEntry,mOpinionBits.begin() + (i+1)*mWordsPerEntry,bits.begin() + i*n) ;
+
+	mOpinionBits.swap(bits) ;
+	mWordsPerEntry = n ;
+}
+
+RsOpinion ReputationTable::opinion(uint32_t index, const RsPeerId& from) const
+{
+	std::map<RsPeerId,uint32_t>::const_iterator it = mFriendIndices.find(from) ;
+
+	if(it == mFriendIndices.end())
+		return RsOpinion::NEUTRAL ;
+
+	uint64_t w = mOpinionBits[index*mWordsPerEntry + it->second / OPINIONS_PER_WORD] ;
+	uint32_t code = (w >> (2*(it->second % OPINIONS_PER_WORD))) & 0x3 ;
+
+	return code?static_cast<RsOpinion>(code-1):RsOpinion::NEUTRAL ;
+}
+
+bool ReputationTable::setOpinion(uint32_t index, const RsPeerId& from, RsOpinion op)
+{
+	RsOpinion old_op = opinion(index,from) ;
+
+	if(old_op == op)
+		return false ;
+
+	uint32_t f = friendIndex(from) ;
+	uint32_t shift = 2*(f % OPINIONS_PER_WORD) ;
+	uint64_t& w(mOpinionBits[index*mWordsPerEntry + f / OPINIONS_PER_WORD]) ;
+	uint64_t code = (op == RsOpinion::NEUTRAL)?0:(static_cast<uint64_t>(op)+1) ;
+
+	w = (w & ~(uint64_t(0x3) << shift)) | (code << shift) ;
+
+	Reputation& rep(mEntries[index]) ;
+
+	if(old_op == RsOpinion::POSITIVE) --rep.mFriendsPositive ;
+	if(old_op == RsOpinion::NEGATIVE) --rep.mFriendsNegative ;
+	if(op     == RsOpinion::POSITIVE) ++rep.mFriendsPositive ;
+	if(op     == RsOpinion::NEGATIVE) ++rep.mFriendsNegative ;
+
+	return true ;
+}
+
+void ReputationTable::getOpinions(uint32_t index, std::map<RsPeerId,RsOpinion>& opinions) const
+{
+	opinions.clear() ;
+
+	for(uint32_t i=0;i<mWordsPerEntry;++i)
+		for(uint64_t w = mOpinionBits[index*mWordsPerEntry + i];w != 0;)
+		{
+			uint32_t k = __builtin_ctzll(w) / 2 ;
+			uint32_t code = (w >> (2*k)) & 0x3 ;
+
+			opinions[mFriends[i*OPINIONS_PER_WORD + k]] = static_cast<RsOpinion>(code-1) ;
+			w &= ~(uint64_t(0x3) << (2*k)) ;
+		}
+}
+
+size_t ReputationTable::memoryUsage() const
+{
+	return mIds.capacity() * sizeof(RsGxsId)
+	        + mEntries.capacity() * sizeof(Reputation)
+	        + mSlots.capacity() * sizeof(uint32_t)
+	        + mOpinionBits.capacity() * sizeof(uint64_t)
+	        + mFriends.capacity() * sizeof(RsPeerId)
+	        + mFriendIndices.size() * (sizeof(RsPeerId) + 48) ;
+}
+
 void p3GxsReputation::debug_print()
 {
     std::cerr << "Reputations database: " << std::endl;
     std::cerr << "  GXS ID data: " << std::endl;
     std::cerr << std::dec ;
 
-	std::map<RsGxsId,Reputation> rep_copy;
+	ReputationTable rep_copy;
 
 	{
 		RS_STACK_MUTEX(mReputationMtx);
@@ -1594,25 +1765,29 @@ void p3GxsReputation::debug_print()
 	rstime_t now = time(nullptr);
 
 
-	for( std::map<RsGxsId,Reputation>::const_iterator it(rep_copy.begin());
-	     it != rep_copy.end(); ++it )
+	for(uint32_t i=0; i<rep_copy.size(); ++i)
     {
+		const Reputation& rep(rep_copy.at(i));
+
 		RsReputationInfo info;
-		getReputationInfo(it->first, RsPgpId(), info, false);
+		getReputationInfo(rep_copy.id(i), RsPgpId(), info, false);
 		uint32_t lev = static_cast<uint32_t>(info.mOverallReputationLevel);
 
-        std::cerr << "    " << it->first << ": own: " << it->second.mOwnOpinion
-                  << ", PGP id=" << it->second.mOwnerNode
-                  << ", flags=" << std::setfill('0') << std::setw(4) << std::hex << it->second.mIdentityFlags << std::dec
-                  << ", Friend pos/neg: " << it->second.mFriendsPositive << "/" << it->second.mFriendsNegative
+        std::cerr << "    " << rep_copy.id(i) << ": own: " << rep.mOwnOpinion
+                  << ", PGP id=" << rep.mOwnerNode
+                  << ", flags=" << std::setfill('0') << std::setw(4) << std::hex << rep.mIdentityFlags << std::dec
+                  << ", Friend pos/neg: " << rep.mFriendsPositive << "/" << rep.mFriendsNegative
                   << ", reputation lev: [" << lev
-                  << "], last own update: " << std::setfill(' ') << std::setw(10) << now - it->second.mOwnOpinionTs << " secs ago"
-                  << ", last needed: " << std::setfill(' ') << std::setw(10) << now - it->second.mLastUsedTS << " secs ago, "
+                  << "], last own update: " << std::setfill(' ') << std::setw(10) << now - rep.mOwnOpinionTs << " secs ago"
+                  << ", last needed: " << std::setfill(' ') << std::setw(10) << now - rep.mLastUsedTS << " secs ago, "
 		          << std::endl;
 
 #ifdef DEBUG_REPUTATION2
-        for(std::map<RsPeerId,RsReputations::Opinion>::const_iterator it2(it->second.mOpinions.begin());it2!=it->second.mOpinions.end();++it2)
-            std::cerr << "    " << it2->first << ": " << it2->second << std::endl;
+        std::map<RsPeerId,RsOpinion> opinions;
+        rep_copy.getOpinions(i,opinions);
+
+        for(std::map<RsPeerId,RsOpinion>::const_iterator it2(opinions.begin());it2!=opinions.end();++it2)
+            std::cerr << "    " << it2->first << ": " << static_cast<uint32_t>(it2->second) << std::endl;
 #endif
     }
 
@@ -26,6 +26,7 @@
 #include <list>
 #include <map>
 #include <set>
+#include <vector>
 
 static const uint32_t  REPUTATION_IDENTITY_FLAG_UP_TO_DATE    = 0x0100;	// This flag means that the static info has been initialised from p3IdService. Normally such a call should happen once.
 static const uint32_t  REPUTATION_IDENTITY_FLAG_PGP_LINKED    = 0x0001;
@@ -76,13 +77,12 @@ public:
 
 	void updateReputation();
 
-	std::map<RsPeerId, RsOpinion> mOpinions;
 	int32_t mOwnOpinion;
 	rstime_t  mOwnOpinionTs;
 
 	float mFriendAverage ;
-    uint32_t mFriendsPositive ;		// number of positive vites from friends
-    uint32_t mFriendsNegative ;		// number of negative vites from friends
+    uint32_t mFriendsPositive ;		// number of positive vites from friends. Kept up to date by ReputationTable.
+    uint32_t mFriendsNegative ;		// number of negative vites from friends. Kept up to date by ReputationTable.
 
 	float mReputationScore;
 
@@ -93,6 +93,70 @@ public:
     rstime_t mLastUsedTS ;			// last time the reputation was asked. Used to keep track of activity and clean up some reputation data.
 };
 
+// Storage for the reputations of all known GXS ids. There are easily 100k of
+// them, with opinions from each friend, so the layout is kept compact:
+//  - entries are stored in a dense array, found through an open addressing
+//    hash table on the GXS id,
+//  - friends are given a small index, and the opinions of friends are stored
+//    in a separate bit array, 2 bits per friend and per entry,
+//  - the vote counts of each entry are updated when an opinion changes, so
+//    that the reputation score never needs to go through the opinions.
+//
+// Entries are designated by their index, which stays valid until the next
+// call to insert() or erase().
+
+class ReputationTable
+{
+public:
+	static const uint32_t NOT_FOUND = 0xffffffff ;
+
+	ReputationTable() ;
+
+	uint32_t size() const { return mIds.size() ; }
+	void clear() ;
+
+	uint32_t find(const RsGxsId& id) const ;
+
+	/// Returns the index of the entry for id, creating it if needed.
+	uint32_t insert(const RsGxsId& id) ;
+
+	/// Removes an entry. The last entry takes its index.
+	void erase(uint32_t index) ;
+
+	const RsGxsId& id(uint32_t index) const { return mIds[index] ; }
+	Reputation& at(uint32_t index) { return mEntries[index] ; }
+	const Reputation& at(uint32_t index) const { return mEntries[index] ; }
+
+	/// Sets the opinion of a friend, and updates the vote counts. Neutral
+	/// opinions take no room. Returns true if the opinion changed.
+	bool setOpinion(uint32_t index, const RsPeerId& from, RsOpinion op) ;
+
+	RsOpinion opinion(uint32_t index, const RsPeerId& from) const ;
+	void getOpinions(uint32_t index, std::map<RsPeerId,RsOpinion>& opinions) const ;
+	bool hasOpinions(uint32_t index) const { return mEntries[index].mFriendsPositive + mEntries[index].mFriendsNegative > 0 ; }
+
+	/// Approximate number of bytes allocated by the table.
+	size_t memoryUsage() const ;
+
+private:
+	uint32_t findSlot(const RsGxsId& id) const ;
+	uint32_t friendIndex(const RsPeerId& peer_id) ;
+	void resizeSlots(uint32_t n) ;
+	void setWordsPerEntry(uint32_t n) ;
+
+	static uint32_t homeSlot(const RsGxsId& id, uint32_t mask) ;
+
+	std::vector<RsGxsId> mIds ;
+	std::vector<Reputation> mEntries ;
+	std::vector<uint32_t> mSlots ;		// entry index, or NOT_FOUND for empty slots. Size is a power of 2.
+
+	std::map<RsPeerId,uint32_t> mFriendIndices ;
+	std::vector<RsPeerId> mFriends ;
+
+	std::vector<uint64_t> mOpinionBits ;	// mWordsPerEntry words per entry, 32 friends per word
+	uint32_t mWordsPerEntry ;
+};
+
 
 //!The p3GxsReputation service.
 class p3GxsReputation: public p3Service, public p3Config, public RsGixsReputation, public RsReputations /* , public pqiMonitor */
@@ -184,7 +248,7 @@ private:
 
     // Data for Reputation.
     std::map<RsPeerId, ReputationConfig> mConfig;
-    std::map<RsGxsId, Reputation> mReputations;
+    ReputationTable mReputations;
     std::multimap<rstime_t, RsGxsId> mUpdated;
 
     // PGP Ids auto-banned. This is updated regularly.
@@ -71,6 +71,8 @@ static const uint32_t MAX_DELAY_BEFORE_CLEANING=    1800 ; // clean old keys eve
 
 static const uint32_t MAX_SERIALISED_IDENTITY_AGE  = 600 ; // after 10 mins, a serialised identity record must be renewed.
 
+static const rstime_t KEY_PREFETCH_TIMEOUT         =  30 ; // keys that are not there after 30 secs are given up. Validation retries by itself after that.
+
 RsIdentity* rsIdentity = nullptr;
 
 /******
@@ -161,6 +163,7 @@ p3IdService::p3IdService( RsGeneralDataService *gds
                        RS_SERVICE_GXS_TYPE_GXSID, idAuthenPolicy() )
     , RsIdentity(static_cast<RsGxsIface&>(*this))
     , GxsTokenQueue(this), RsTickEvent(), p3Config()
+    , mLastKeyWaitCheck(0)
     , mKeyCache(GXSID_MAX_CACHE_SIZE, "GxsIdKeyCache")
     , mBgSchedule_Active(false), mBgSchedule_Mode(0)
     , mIdMtx("p3IdService"), mNes(nes), mPgpUtils(pgpUtils)
@@ -598,6 +601,15 @@ void	p3IdService::service_tick()
         mLastPGPHashProcessTime=now;
     }
 
+    bool check_key_waiters ;
+    {
+        RS_STACK_MUTEX(mIdMtx);
+        check_key_waiters = (mLastKeyWaitCheck != now) ;
+    }
+
+    if(check_key_waiters)
+        checkKeyWaiters();
+
     return;
 }
 
@@ -679,6 +691,15 @@ void p3IdService::notifyChanges(std::vector<RsGxsNotify *> &changes)
                         ev->mIdentityEventCode = RsGxsIdentityEventCode::NEW_IDENTITY;
                         rsEvents->postEvent(ev);
 
+                        // If someone is waiting for this key, load it now rather than at the next cache miss.
+                        bool waited ;
+                        {
+                            RS_STACK_MUTEX(mIdMtx);
+                            waited = mKeyWaits.isWaited(RsGxsId(gid));
+                        }
+                        if(waited)
+                            cache_request_load(RsGxsId(gid));
+
 						// also time_stamp the key that this group represents
 						timeStampKey(RsGxsId(gid),RsIdentityUsage(RsServiceType(serviceType()),RsIdentityUsage::IDENTITY_NEW_FROM_GXS_SYNC)) ;
                         should_subscribe = true;
@@ -1282,7 +1303,14 @@ bool p3IdService::getRecognTagRequest(const RsGxsId &id, const std::string &comm
 bool p3IdService::haveKey(const RsGxsId &id)
 {
     RsStackMutex stack(mIdMtx); /********** STACK LOCKED MTX ******/
-    return mKeyCache.is_cached(id);
+
+    if(mKeyCache.is_cached(id))
+    {
+        ++mKeyWaits.stats().mHits;
+        return true;
+    }
+    ++mKeyWaits.stats().mMisses;
+    return false;
 }
 
 bool p3IdService::havePrivateKey(const RsGxsId &id)
@@ -1377,6 +1405,149 @@ bool p3IdService::requestKey(const RsGxsId &id, const std::list<RsPeerId>& peers
     return cache_request_load(id, peers);
 }
 
+uint32_t p3IdService::prefetchKeys( const std::set<RsGxsId>& ids,
+                                    const std::list<RsPeerId>& peers,
+                                    const RsIdentityUsage& use_info,
+                                    const std::function<void(const std::set<RsGxsId>&)>& callback )
+{
+	std::list<RsGxsId> to_check;
+	GxsKeyWaitList::Waiter waiter;
+
+	{
+		RS_STACK_MUTEX(mIdMtx);
+
+		for(const RsGxsId& id: ids)
+			if(id.isNull())
+				continue;
+			else if(mKeyCache.is_cached(id))
+				++mKeyWaits.stats().mHits;
+			else
+				to_check.push_back(id);
+	}
+
+	// Same as in requestKey(): banned identities are not requested. The
+	// reputation system is asked off-mutex since it may call us back.
+
+	for(const RsGxsId& id: to_check)
+		if(rsReputations->isIdentityBanned(id))
+			waiter.mMissing.insert(id);
+		else
+			waiter.mPending.insert(id);
+
+	if(waiter.mPending.empty())
+	{
+		if(callback)
+			callback(waiter.mMissing);
+		return 0;
+	}
+
+	uint32_t n = waiter.mPending.size();
+
+	{
+		RS_STACK_MUTEX(mIdMtx);
+		rstime_t now = time(nullptr);
+
+		// All keys go in the same load request. The ones that are not in the
+		// database are then asked to the peers by cache_load_for_token().
+
+		for(const RsGxsId& id: waiter.mPending)
+		{
+			++mKeyWaits.stats().mMisses;
+			mKeyWaits.keyMissed(id, GxsKeyWaitList::Clock::now());
+			mergeIds(mCacheLoad_ToCache, id, peers);
+			mKeysTS[id].usage_map[use_info] = now;
+		}
+
+		waiter.mCallback = callback;
+		waiter.mDeadline = now + KEY_PREFETCH_TIMEOUT;
+		mKeyWaits.addWaiter(waiter);
+	}
+
+	cache_schedule_load();
+	return n;
+}
+
+void GxsKeyWaitList::keyMissed(const RsGxsId& id, Clock::time_point now)
+{
+	mWaitStart.insert(std::make_pair(id, now));
+}
+
+void GxsKeyWaitList::keyArrived(const RsGxsId& id, bool loaded, Clock::time_point now)
+{
+	auto it = mWaitStart.find(id);
+
+	if(it != mWaitStart.end())
+	{
+		if(loaded)
+		{
+			uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(now - it->second).count();
+
+			++mStats.mKeysLoaded;
+			mStats.mTotalWaitUs += us;
+			mStats.mMaxWaitUs = std::max(mStats.mMaxWaitUs, us);
+		}
+		else
+			++mStats.mKeysGivenUp;
+
+		mWaitStart.erase(it);
+	}
+
+	for(auto& w: mWaiters)
+		if(w.mPending.erase(id) && !loaded)
+			w.mMissing.insert(id);
+}
+
+void GxsKeyWaitList::collectDone(rstime_t now, Clock::time_point steady_now, rstime_t timeout, std::list<Waiter>& done)
+{
+	for(auto it(mWaiters.begin());it!=mWaiters.end();)
+		if(it->mPending.empty() || it->mDeadline < now)
+		{
+			it->mMissing.insert(it->mPending.begin(), it->mPending.end());
+			it->mPending.clear();
+			done.splice(done.end(), mWaiters, it++);
+		}
+		else
+			++it;
+
+	// Keys missed by getKey() and friends have no waiter. Forget about them
+	// after the same delay, so that the list does not grow forever.
+
+	auto limit = steady_now - std::chrono::seconds(timeout);
+
+	for(auto it(mWaitStart.begin());it!=mWaitStart.end();)
+		if(it->second < limit)
+		{
+			++mStats.mKeysGivenUp;
+			it = mWaitStart.erase(it);
+		}
+		else
+			++it;
+}
+
+void p3IdService::checkKeyWaiters()
+{
+	std::list<GxsKeyWaitList::Waiter> done;
+
+	{
+		RS_STACK_MUTEX(mIdMtx);
+
+		rstime_t now = time(nullptr);
+		mLastKeyWaitCheck = now;
+
+		mKeyWaits.collectDone(now, GxsKeyWaitList::Clock::now(), KEY_PREFETCH_TIMEOUT, done);
+	}
+
+	for(auto& w: done)
+		if(w.mCallback)
+			w.mCallback(w.mMissing);
+}
+
+void p3IdService::getKeyCacheStatistics(RsIdentityKeyCacheStatistics& stats)
+{
+	RS_STACK_MUTEX(mIdMtx);
+	stats = mKeyWaits.stats();
+}
+
 bool p3IdService::isPendingNetworkRequest(const RsGxsId& gxsId)
 {
     RsStackMutex stack(mIdMtx); /********** STACK LOCKED MTX ******/
@@ -1396,9 +1567,11 @@ bool p3IdService::getKey(const RsGxsId &id, RsTlvPublicRSAKey &key)
 
         if (mKeyCache.fetch(id, data))
         {
+            ++mKeyWaits.stats().mHits;
             key = data.pub_key;
             return true;
         }
+        ++mKeyWaits.stats().mMisses;
     }
 
     cache_request_load(id);
@@ -1423,9 +1596,11 @@ bool p3IdService::getPrivateKey(const RsGxsId &id, RsTlvPrivateRSAKey &key)
 
         if (mKeyCache.fetch(id, data))
         {
+            ++mKeyWaits.stats().mHits;
             key = data.priv_key;
             return true;
         }
+        ++mKeyWaits.stats().mMisses;
     }
 
     key.keyId.clear() ;
@@ -2886,6 +3061,8 @@ bool p3IdService::cache_store(const RsGxsIdGroupItem *item)
     mKeyCache.store(id, keycache);
     mKeyCache.resize();
 
+    mKeyWaits.keyArrived(id, true, GxsKeyWaitList::Clock::now());
+
     return true;
 }
 
@@ -2903,24 +3080,30 @@ bool p3IdService::cache_request_load(const RsGxsId &id, const std::list<RsPeerId
 		RS_STACK_MUTEX(mIdMtx);
 		// merge, even if peers is empty
 		mergeIds(mCacheLoad_ToCache, id, peers);
+		mKeyWaits.keyMissed(id, GxsKeyWaitList::Clock::now());
 	}
 
+	cache_schedule_load();
+	return true;
+}
+
+void p3IdService::cache_schedule_load()
+{
 	if(RsTickEvent::event_count(GXSID_EVENT_CACHELOAD) > 0)
 	{
 		Dbg3() << __PRETTY_FUNCTION__ << " cache reload already scheduled "
 		       << "skipping" << std::endl;
-		return true;
+		return;
 	}
 
 	int32_t age = 0;
 	if( RsTickEvent::prev_event_ago(GXSID_EVENT_CACHELOAD, age) && age < MIN_CYCLE_GAP )
 	{
 		RsTickEvent::schedule_in(GXSID_EVENT_CACHELOAD, MIN_CYCLE_GAP - age);
-		return true;
+		return;
 	}
 
 	RsTickEvent::schedule_now(GXSID_EVENT_CACHELOAD);
-	return true;
 }
 
 
@@ -3019,10 +3202,13 @@ bool p3IdService::cache_load_for_token(uint32_t token)
             for(std::map<RsGxsId,std::list<RsPeerId> >::const_iterator itt(mPendingCache.begin());itt!=mPendingCache.end();++itt)
                 if(!itt->second.empty())
                     mergeIds(mIdsNotPresent,itt->first,itt->second) ;
-#ifdef DEBUG_IDS
 				else
+				{
+#ifdef DEBUG_IDS
                     std::cerr << "(WW) empty list of peers to request ID " << itt->first << ": cannot request" << std::endl;
 #endif
+					mKeyWaits.keyArrived(itt->first, false, GxsKeyWaitList::Clock::now());
+				}
 
 
 			mPendingCache.clear();
@@ -3031,6 +3217,8 @@ bool p3IdService::cache_load_for_token(uint32_t token)
                 schedule_now(GXSID_EVENT_REQUEST_IDS);
 		}
 
+		// call back the ones that were waiting for these keys
+		checkKeyWaiters();
 	}
 	else
 	{
@@ -5020,5 +5208,6 @@ RsIdentity::~RsIdentity() = default;
 RsReputationInfo::~RsReputationInfo() = default;
 RsGixs::~RsGixs() = default;
 RsIdentityDetails::~RsIdentityDetails() = default;
+RsIdentityKeyCacheStatistics::~RsIdentityKeyCacheStatistics() = default;
 GxsReputation::~GxsReputation() = default;
 RsGxsIdGroup::~RsGxsIdGroup() = default;
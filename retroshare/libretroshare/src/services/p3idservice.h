@@ -25,6 +25,10 @@
 
 #include <map>
 #include <string>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <set>
 
 #include "retroshare/rsidentity.h"	// External Interfaces.
 #include "gxs/rsgenexchange.h"		// GXS service.
@@ -191,6 +195,47 @@ struct SerialisedIdentityStruct
     rstime_t mLastUsageTS;
 };
 
+/// Keys that are waited for, either by prefetchKeys() callers or after a cache miss.
+/// Not thread safe: p3IdService uses it under mIdMtx, and calls the callbacks of
+/// the finished waiters after releasing it.
+class GxsKeyWaitList
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+	typedef std::function<void(const std::set<RsGxsId>&)> Callback;
+
+	struct Waiter
+	{
+		std::set<RsGxsId> mPending;
+		std::set<RsGxsId> mMissing;
+		Callback mCallback;
+		rstime_t mDeadline;
+	};
+
+	GxsKeyWaitList() {}
+
+	/// A load was asked for the key. Only the first miss counts, so that retries do not reset the waiting time.
+	void keyMissed(const RsGxsId& id, Clock::time_point now);
+
+	/// The key reached the cache (loaded=true), or cannot be found.
+	void keyArrived(const RsGxsId& id, bool loaded, Clock::time_point now);
+
+	bool isWaited(const RsGxsId& id) const { return mWaitStart.find(id) != mWaitStart.end(); }
+
+	void addWaiter(const Waiter& waiter) { mWaiters.push_back(waiter); }
+
+	/// Moves to done the waiters that have all their keys, or that are past their deadline. The keys still
+	/// pending then count as missing. Missed keys that nobody waits for are forgotten after timeout secs.
+	void collectDone(rstime_t now, Clock::time_point steady_now, rstime_t timeout, std::list<Waiter>& done);
+
+	RsIdentityKeyCacheStatistics& stats() { return mStats; }
+
+private:
+	std::list<Waiter> mWaiters;
+	std::map<RsGxsId, Clock::time_point> mWaitStart;
+	RsIdentityKeyCacheStatistics mStats;
+};
+
 // We cache all identities, and provide alternative (instantaneous)
 // functions to extract info, rather than the horrible Token system.
 class p3IdService: public RsGxsIdExchange, public RsIdentity,  public GxsTokenQueue, public RsTickEvent, public p3Config
@@ -373,6 +418,13 @@ public:
                              const RsIdentityUsage &use_info )override;
     virtual bool requestPrivateKey(const RsGxsId &id)override;
 
+	virtual uint32_t prefetchKeys( const std::set<RsGxsId>& ids,
+	                               const std::list<RsPeerId>& peers,
+	                               const RsIdentityUsage& use_info,
+	                               const std::function<void(const std::set<RsGxsId>&)>& callback ) override;
+
+	virtual void getKeyCacheStatistics(RsIdentityKeyCacheStatistics& stats) override;
+
 	RS_DEPRECATED_FOR(exportIdentityLink)
     virtual bool serialiseIdentityToMemory(const RsGxsId& id, std::string& radix_string) override;
 	RS_DEPRECATED_FOR(importIdentityLink)
@@ -432,6 +484,7 @@ private:
 	int  cache_tick();
 
     bool cache_request_load(const RsGxsId &id, const std::list<RsPeerId>& peers = std::list<RsPeerId>());
+	void cache_schedule_load();
 	bool cache_start_load();
 	bool cache_load_for_token(uint32_t token);
 
@@ -441,11 +494,17 @@ private:
 	bool isPendingNetworkRequest(const RsGxsId& gxsId);
     void requestIdsFromNet();
 
+	// calls back the prefetchKeys() callers whose keys are there, or that waited long enough.
+	void checkKeyWaiters();
+
 	// Mutex protected.
 
 	//std::list<RsGxsId> mCacheLoad_ToCache;
 	std::map<RsGxsId, std::list<RsPeerId> > mCacheLoad_ToCache, mPendingCache;
 
+	GxsKeyWaitList mKeyWaits;
+	rstime_t mLastKeyWaitCheck;
+
 	// Switching to RsMemCache for Key Caching.
 	RsMemCache<RsGxsId, RsGxsIdCache> mKeyCache;
 
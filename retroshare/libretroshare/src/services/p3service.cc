@@ -36,28 +36,33 @@
 
 
 
+p3Service::~p3Service()
+{
+	RsItem *item = NULL;
+
+	while(mIncoming.pop(item))
+		delete item;
+}
+
 RsItem *p3Service::recvItem()
 {
-	RsStackMutex stack(srvMtx);  /*****   LOCK MUTEX *****/
+	RsItem *item = NULL;
 
-	if (recv_queue.empty())
-	{
-		return NULL; /* nothing there! */
-	}
+	if (mIncoming.pop(item))
+		return item;
 
-	/* get something off front */
-	RsItem *item = recv_queue.front();
-	recv_queue.pop_front();
+	/* nothing there, unless an item is being queued right now. In that
+	 * case, make sure the service comes back for it. */
+	if (!mIncoming.empty())
+		incomingItemsQueued();
 
-	return item;
+	return NULL;
 }
 
 
 bool    p3Service::receivedItems()
 {
-	RsStackMutex stack(srvMtx);  /*****   LOCK MUTEX *****/
-
-	return (!recv_queue.empty());
+	return !mIncoming.empty();
 }
 
 
@@ -65,13 +70,36 @@ bool p3Service::recvItem(RsItem *item)
 {
 	if (item)
 	{
-		RsStackMutex stack(srvMtx);  /*****   LOCK MUTEX *****/
+		bool was_empty = false;
+
+		if (!mIncoming.push(item, was_empty))
+		{
+#ifdef SERV_DEBUG
+			std::cerr << "p3Service::recvItem() incoming queue full: " << mIncoming.size() << " items." << std::endl;
+#endif
+		}
 
-		recv_queue.push_back(item);
+		if (was_empty)
+			incomingItemsQueued();
 	}
 	return true;
 }
 
+bool p3Service::getIncomingQueueStats(RsServiceQueueStats& stats)
+{
+	RsMpscQueue<RsItem *>::Stats qs;
+	mIncoming.getStats(qs);
+
+	stats.mQueueDepth            = qs.depth;
+	stats.mMaxQueueDepth         = qs.max_depth;
+	stats.mQueueCapacity         = qs.capacity;
+	stats.mQueueOverflows        = qs.overflowed;
+	stats.mAverageQueueLatencyUs = qs.avg_wait_us;
+	stats.mMaxQueueLatencyUs     = qs.max_wait_us;
+
+	return true;
+}
+
 
 
 
@@ -94,9 +122,10 @@ bool p3FastService::recv(RsRawItem *raw)
 		std::cerr << std::endl;
 	#endif
 	
-		/* convert to RsServiceItem */
+		/* convert to RsServiceItem, big binary fields may be kept as views
+		 * into the raw data by serialisers supporting it */
 		uint32_t size = raw->getRawLength();
-		item = rsSerialiser->deserialise(raw->getRawData(), &size);
+		item = rsSerialiser->deserialise(raw->shareRawData(), &size);
 		if ((!item) || (size != raw->getRawLength()))
 		{
 			/* error in conversion */
@@ -220,4 +249,50 @@ int p3FastService::sendItem(RsItem *si)
 	}
 }
 
+int p3FastService::sendItemToPeers(RsItem *si, const std::set<RsPeerId>& peers)
+{
+	if (peers.empty())
+		return 0;
+
+	RsSharedBuffer buffer;
+	uint32_t size = 0;
+
+	{
+		RsStackMutex stack(srvMtx);  /*****   LOCK MUTEX *****/
+
+		size = rsSerialiser->size(si);
+		if (!size)
+		{
+			std::cerr << "p3Service::sendItemToPeers() ERROR size == 0";
+			std::cerr << std::endl;
+			return 0;
+		}
+
+		buffer = rs_shared_buffer_adopt(rs_malloc(size));
+		uint32_t ssize = size;
+
+		if (!buffer || !rsSerialiser->serialise(si, buffer.get(), &ssize) || (ssize != size))
+		{
+			std::cerr << "p3service: item could not be properly serialised. Will be wasted.  Item is: "<< std::endl;
+			si->print(std::cerr,0) ;
+			return 0;
+		}
+	}
+
+	/* every raw item holds a reference on the same data, which is freed
+	 * once the last of them has been written out.
+	 */
+	int count = 0;
+	for(std::set<RsPeerId>::const_iterator it = peers.begin(); it != peers.end(); ++it)
+	{
+		RsRawItem *raw = new RsRawItem(si->PacketId(), buffer, size);
+		raw->PeerId(*it);
+		raw->setPriorityLevel(si->priority_level()) ;
+
+		if (pqiService::send(raw))
+			++count;
+	}
+	return count;
+}
+
 
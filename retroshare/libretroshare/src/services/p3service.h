@@ -25,6 +25,7 @@
 #include "pqi/pqi.h"
 #include "pqi/pqiservice.h"
 #include "util/rsthreads.h"
+#include "util/rsmpscqueue.h"
 
 /* This provides easy to use extensions to the pqiservice class provided in src/pqi.
  * 
@@ -46,6 +47,10 @@
 
 std::string generateRandomServiceId();
 
+// Number of incoming items a p3Service queues before asking the connections
+// to slow down. Items are never dropped: the queue grows beyond that if needed.
+static const uint32_t P3SERVICE_INCOMING_QUEUE_SIZE = 1024 ;
+
 //TODO : encryption and upload / download rate implementation
 
 
@@ -71,6 +76,9 @@ virtual ~p3FastService() { delete rsSerialiser; return; }
 
 /*************** INTERFACE ******************************/
 int             sendItem(RsItem *);
+	/* serialises si once and queues the same data for each peer.
+	 * Unlike sendItem(), si is not deleted. returns the number of peers */
+int             sendItemToPeers(RsItem *si, const std::set<RsPeerId>& peers);
 virtual int	tick() { return 0; }
 /*************** INTERFACE ******************************/
 
@@ -96,13 +104,15 @@ class p3Service: public p3FastService
 	protected:
 
 	p3Service() 
-	:p3FastService()
+	:p3FastService(), mIncoming(P3SERVICE_INCOMING_QUEUE_SIZE)
 	{
 		return; 
 	}
 
 	public:
 
+virtual ~p3Service() ;
+
 /*************** INTERFACE ******************************/
         /* called from Thread/tick/GUI */
 //int             sendItem(RsItem *);
@@ -116,10 +126,20 @@ bool		receivedItems();
 	// overloaded p3FastService interface.
 virtual bool	recvItem(RsItem *item);
 
+	// overloaded pqiService interface.
+virtual bool	incomingQueueFull() { return mIncoming.full(); }
+virtual bool	getIncomingQueueStats(RsServiceQueueStats& stats) ;
+
+	protected:
+	/* Called by the connection thread that queued an item when the queue was
+	 * empty, and by recvItem() when an item is being queued. Services running
+	 * their own thread override it to wake it up, instead of polling. */
+virtual void	incomingItemsQueued() {}
+
 	private:
 
-	/* below locked by srvMtx Mutex */
-	std::list<RsItem *> recv_queue;
+	/* lock free, filled by the connection threads */
+	RsMpscQueue<RsItem *> mIncoming;
 };
 
 
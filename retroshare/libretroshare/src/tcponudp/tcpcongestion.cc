@@ -0,0 +1,236 @@
+/*******************************************************************************
+ * libretroshare/src/tcponudp: tcpcongestion.cc                                *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#include "tcpcongestion.h"
+
+#include <math.h>
+
+static const double CUBIC_C    = 0.4;
+static const double CUBIC_BETA = 0.7;
+
+static const double BW_GAIN        = 1.25; /* window floor = BW_GAIN * bandwidth * minRtt */
+static const double MIN_RTT_WINDOW = 10.0; /* secs before the min RTT is forgotten */
+
+TcpCongestion::TcpCongestion(uint32 s, uint32 max)
+{
+	reset(s, max);
+}
+
+void TcpCongestion::reset(uint32 s, uint32 max)
+{
+	mss = s;
+	maxWin = max;
+
+	cwnd = mss;
+	ssthresh = maxWin;
+
+	wMax = 0;
+	epochStart = 0;
+	K = 0;
+	originPoint = 0;
+	renoCwnd = 0;
+
+	minRtt = 0;
+	minRttTs = 0;
+	roundStart = 0;
+	roundBytes = 0;
+	for(int i = 0; i < TCP_BW_ROUNDS; i++)
+	{
+		bwSamples[i] = 0;
+	}
+	bwIdx = 0;
+}
+
+void TcpCongestion::setMss(uint32 s)
+{
+	mss = s;
+}
+
+void TcpCongestion::setMaxWindow(uint32 max)
+{
+	if (ssthresh == maxWin)
+	{
+		ssthresh = max;
+	}
+	maxWin = max;
+
+	if (cwnd > maxWin)
+	{
+		cwnd = maxWin;
+	}
+}
+
+void TcpCongestion::delivered(uint32 bytes, double cts, double rtt)
+{
+	if ((minRtt == 0) || (rtt < minRtt) || (cts - minRttTs > MIN_RTT_WINDOW))
+	{
+		minRtt = rtt;
+		minRttTs = cts;
+	}
+
+	if (roundStart == 0)
+	{
+		roundStart = cts;
+		roundBytes = 0;
+	}
+	roundBytes += bytes;
+
+	/* one delivery rate sample per round trip */
+	if (cts - roundStart >= minRtt)
+	{
+		bwSamples[bwIdx] = roundBytes / (cts - roundStart);
+		bwIdx = (bwIdx + 1) % TCP_BW_ROUNDS;
+
+		roundStart = cts;
+		roundBytes = 0;
+	}
+}
+
+void TcpCongestion::onAck(uint32 acked, double cts, double rtt)
+{
+	if (cwnd < ssthresh)
+	{
+		/* slow start */
+		cwnd += acked;
+	}
+	else
+	{
+		if (epochStart == 0)
+		{
+			epochStart = cts;
+			renoCwnd = cwnd;
+
+			if (cwnd < wMax)
+			{
+				K = cbrt((wMax - cwnd) / mss / CUBIC_C);
+				originPoint = wMax;
+			}
+			else
+			{
+				K = 0;
+				originPoint = cwnd;
+			}
+		}
+
+		/* where the cubic curve will be in one RTT */
+		double t = cts + rtt - epochStart - K;
+		double target = originPoint + CUBIC_C * t * t * t * mss;
+
+		if (target > 1.5 * cwnd)
+		{
+			target = 1.5 * cwnd;
+		}
+
+		if (target > cwnd)
+		{
+			cwnd += (target - cwnd) * acked / cwnd;
+		}
+		else
+		{
+			/* plateau around wMax: probe very slowly */
+			cwnd += 0.01 * mss * acked / cwnd;
+		}
+
+		/* never grow slower than standard tcp would */
+		renoCwnd += 3.0 * (1.0 - CUBIC_BETA) / (1.0 + CUBIC_BETA) * mss * acked / renoCwnd;
+		if (renoCwnd > cwnd)
+		{
+			cwnd = renoCwnd;
+		}
+	}
+
+	if (cwnd > maxWin)
+	{
+		cwnd = maxWin;
+	}
+}
+
+void TcpCongestion::onLoss()
+{
+	/* reduce from what was really in use */
+	double w = window();
+
+	epochStart = 0;
+
+	/* fast convergence: if we lost before getting back to the previous
+	 * maximum, another flow is taking its share -> release some more.
+	 */
+	if (w < wMax)
+	{
+		wMax = w * (1.0 + CUBIC_BETA) / 2.0;
+	}
+	else
+	{
+		wMax = w;
+	}
+
+	cwnd = w * CUBIC_BETA;
+	if (cwnd < 2 * mss)
+	{
+		cwnd = 2 * mss;
+	}
+	ssthresh = cwnd;
+}
+
+void TcpCongestion::onTimeout()
+{
+	onLoss();
+	cwnd = mss;
+
+	/* the path model can't be trusted anymore */
+	for(int i = 0; i < TCP_BW_ROUNDS; i++)
+	{
+		bwSamples[i] = 0;
+	}
+	roundStart = 0;
+}
+
+double TcpCongestion::bandwidth() const
+{
+	double bw = 0;
+	for(int i = 0; i < TCP_BW_ROUNDS; i++)
+	{
+		if (bwSamples[i] > bw)
+		{
+			bw = bwSamples[i];
+		}
+	}
+	return bw;
+}
+
+uint32 TcpCongestion::window() const
+{
+	double w = BW_GAIN * bandwidth() * minRtt;
+	if (w < cwnd)
+	{
+		w = cwnd;
+	}
+	if (w > maxWin)
+	{
+		w = maxWin;
+	}
+	return (uint32) w;
+}
+
+uint32 TcpCongestion::threshold() const
+{
+	return (uint32) ssthresh;
+}
@@ -0,0 +1,94 @@
+/*******************************************************************************
+ * libretroshare/src/tcponudp: tcpcongestion.h                                 *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#ifndef TOU_TCP_CONGESTION_H
+#define TOU_TCP_CONGESTION_H
+
+/* Congestion control for the TcpStream sender.
+ *
+ * The window follows CUBIC (RFC 8312): after a loss it grows back as
+ * a cubic function of the time elapsed, rather than by one segment per
+ * round trip, so the time needed to refill a long fat link doesn't
+ * depend on its RTT.
+ *
+ * On top of that, as in BBR, a model of the path is kept: the bottleneck
+ * bandwidth (max delivery rate over the last rounds) and the minimum RTT.
+ * The window never drops below a little more than their product. Random
+ * loss - which is what lossy wireless links or overloaded relays mostly
+ * produce - then no longer divides the throughput, while real congestion
+ * still shows up as a lower delivery rate and brings the window down.
+ *
+ * It is purely a sender side change, and needs no negotiation with the
+ * peer. All sizes are in bytes, times in seconds.
+ */
+
+#include "tcppacket.h"
+
+#define TCP_BW_ROUNDS 10
+
+class TcpCongestion
+{
+	public:
+	TcpCongestion(uint32 mss, uint32 maxWin);
+
+void	reset(uint32 mss, uint32 maxWin);
+void	setMss(uint32 mss);
+void	setMaxWindow(uint32 maxWin);
+
+	/* bytes that reached the peer (acked or SACKed) -> path model */
+void	delivered(uint32 bytes, double cts, double rtt);
+
+	/* new data acked, outside of loss recovery -> window growth */
+void	onAck(uint32 acked, double cts, double rtt);
+	/* loss detected, once per recovery episode */
+void	onLoss();
+	/* retransmission timeout -> restart from one segment */
+void	onTimeout();
+
+uint32	window() const;
+uint32	threshold() const;
+double	bandwidth() const;
+
+	private:
+
+	/* CUBIC */
+	double cwnd;
+	double ssthresh;
+
+	double wMax;        /* window before the last reduction */
+	double epochStart;  /* start of the congestion avoidance epoch, 0 if none */
+	double K;           /* time to get back to wMax */
+	double originPoint;
+	double renoCwnd;    /* window standard tcp would have now (tcp friendly region) */
+
+	/* path model */
+	double minRtt;
+	double minRttTs;
+	double roundStart;
+	double roundBytes;
+	double bwSamples[TCP_BW_ROUNDS]; /* delivery rate, one per round */
+	uint32 bwIdx;
+
+	uint32 mss;
+	uint32 maxWin;
+};
+
+#endif
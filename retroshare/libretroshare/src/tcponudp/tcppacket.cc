@@ -56,6 +56,9 @@
  * FIN -> bit 7 => 0x0080
  *
  * and second byte 0-3 -> hlen, 4-7 unused.
+ *
+ * hlen is the header size in 32 bit words, options included.
+ * Older peers never set it, so 0 means a plain 20 bytes header.
  */
 
 #define TCP_URG_BIT  0x0004
@@ -65,10 +68,18 @@
 #define TCP_SYN_BIT  0x0040
 #define TCP_FIN_BIT  0x0080
 
+#define TCP_HLEN_MASK   0xF000
+#define TCP_HLEN_SHIFT  12
+
+#define TCP_OPT_END     0
+#define TCP_OPT_NOP     1
+#define TCP_OPT_SACK    5
+
 
 TcpPacket::TcpPacket(uint8 *ptr, int size)
 	:data(0), datasize(0), seqno(0), ackno(0), hlen_flags(0), 
-	 winsize(0), ts(0), retrans(0)
+	 winsize(0), extensions(0), nSackBlocks(0), ts(0), retrans(0),
+	 sacked(false), resent(false)
 	{
 		if (size > 0)
 		{
@@ -83,7 +94,8 @@ TcpPacket::TcpPacket(uint8 *ptr, int size)
 
 TcpPacket::TcpPacket() /* likely control packet */
 	:data(0), datasize(0), seqno(0), ackno(0), hlen_flags(0), 
-	 winsize(0), ts(0), retrans(0)
+	 winsize(0), extensions(0), nSackBlocks(0), ts(0), retrans(0),
+	 sacked(false), resent(false)
 	{
 		return;
 	}
@@ -96,14 +108,35 @@ TcpPacket::~TcpPacket()
 	}
 
 
+int	TcpPacket::optionsSize()
+{
+	if (nSackBlocks == 0)
+	{
+		return 0;
+	}
+
+	/* NOP, NOP, kind, len, blocks -> keeps the blocks 32bit aligned */
+	return 4 + 8 * nSackBlocks;
+}
+
+
 int	TcpPacket::writePacket(void *buf, int &size)
 {
-	if (size < TCP_PSEUDO_HDR_SIZE + datasize)
+	int optsize = optionsSize();
+	int hdrsize = TCP_PSEUDO_HDR_SIZE + optsize;
+
+	if (size < hdrsize + datasize)
 	{
 		size = 0;
 		return -1;
 	}
 
+	hlen_flags &= ~TCP_HLEN_MASK;
+	if (optsize)
+	{
+		hlen_flags |= (hdrsize / 4) << TCP_HLEN_SHIFT;
+	}
+
 	/* byte:  0 => uint16 srcport = 0 */
 	*((uint16 *) &(((uint8 *) buf)[0])) = htons(0); 
 
@@ -125,15 +158,30 @@ int	TcpPacket::writePacket(void *buf, int &size)
 	/* byte: 16 => uint16 chksum */
 	*((uint16 *) &(((uint8 *) buf)[16])) = htons(0); 
 
-	/* byte: 18 => uint16 urgptr */
-	*((uint16 *) &(((uint8 *) buf)[18])) = htons(0); 
+	/* byte: 18 => uint16 urgptr (extensions) */
+	*((uint16 *) &(((uint8 *) buf)[18])) = htons(extensions); 
 
 	/* total 20 bytes */
 
+	/* then the options */
+	if (optsize)
+	{
+		uint8 *opt = &(((uint8 *) buf)[20]);
+		opt[0] = TCP_OPT_NOP;
+		opt[1] = TCP_OPT_NOP;
+		opt[2] = TCP_OPT_SACK;
+		opt[3] = 2 + 8 * nSackBlocks;
+
+		for(int i = 0; i < 2 * nSackBlocks; i++)
+		{
+			*((uint32 *) &(opt[4 + 4 * i])) = htonl(sackBlocks[i]);
+		}
+	}
+
 	/* now the data */
-	memcpy((void *) &(((uint8 *) buf)[20]), data, datasize);
+	memcpy((void *) &(((uint8 *) buf)[hdrsize]), data, datasize);
 
-	return size = TCP_PSEUDO_HDR_SIZE + datasize;
+	return size = hdrsize + datasize;
 }
 
 
@@ -170,18 +218,64 @@ int	TcpPacket::readPacket(void *buf, int size)
 	*((uint16 *) &(((uint8 *) buf)[16])) = htons(0); 
 	***********/
 
-	/* byte: 18 => uint16 urgptr *************************
-	*((uint16 *) &(((uint8 *) buf)[18])) = htons(0); 
-	***********/
+	/* byte: 18 => uint16 urgptr (extensions) */
+	extensions = ntohs(  *((uint16 *) &(((uint8 *) buf)[18])) );
 
 	/* total 20 bytes */
 
+	int hdrsize = 4 * ((hlen_flags & TCP_HLEN_MASK) >> TCP_HLEN_SHIFT);
+	if (hdrsize < TCP_PSEUDO_HDR_SIZE)
+	{
+		hdrsize = TCP_PSEUDO_HDR_SIZE;
+	}
+
+	if (size < hdrsize)
+	{
+		std::cerr << "TcpPacket::readPacket() Failed Options Too Big!";
+		std::cerr << std::endl;
+		return -1;
+	}
+
+	/* options, unknown ones are skipped */
+	nSackBlocks = 0;
+	uint8 *opt = &(((uint8 *) buf)[TCP_PSEUDO_HDR_SIZE]);
+	int optsize = hdrsize - TCP_PSEUDO_HDR_SIZE;
+	for(int i = 0; i < optsize;)
+	{
+		if (opt[i] == TCP_OPT_END)
+		{
+			break;
+		}
+		if (opt[i] == TCP_OPT_NOP)
+		{
+			i++;
+			continue;
+		}
+		if ((i + 1 >= optsize) || (opt[i + 1] < 2) || (i + opt[i + 1] > optsize))
+		{
+			std::cerr << "TcpPacket::readPacket() Failed Bad Option!";
+			std::cerr << std::endl;
+			return -1;
+		}
+		if (opt[i] == TCP_OPT_SACK)
+		{
+			int n = (opt[i + 1] - 2) / 8;
+			for(int j = 0; (j < n) && (nSackBlocks < TCP_MAX_SACK_BLOCKS); j++)
+			{
+				sackBlocks[2 * nSackBlocks] = ntohl( *((uint32 *) &(opt[i + 2 + 8 * j])) );
+				sackBlocks[2 * nSackBlocks + 1] = ntohl( *((uint32 *) &(opt[i + 6 + 8 * j])) );
+				nSackBlocks++;
+			}
+		}
+		i += opt[i + 1];
+	}
+
 	if (data)
 	{
 		free(data);
 		data = NULL ;
 	}
-	datasize = size - TCP_PSEUDO_HDR_SIZE;
+	datasize = size - hdrsize;
 
 	// this happens for control packets (e.g. syn/ack/fin)
 	if(datasize == 0)
@@ -201,7 +295,7 @@ int	TcpPacket::readPacket(void *buf, int size)
 	}
 
 	/* now the data */
-	memcpy(data, (void *) &(((uint8 *) buf)[20]), datasize);
+	memcpy(data, (void *) &(((uint8 *) buf)[hdrsize]), datasize);
 
 	return size;
 }
@@ -31,6 +31,24 @@ typedef unsigned char  uint8;
 
 #define TCP_PSEUDO_HDR_SIZE 20
 
+/* Options (only SACK blocks) are appended to the header, as in tcp,
+ * but only once both ends have advertised support for them.
+ */
+#define TCP_MAX_OPTIONS_SIZE	40
+#define TCP_MAX_SACK_BLOCKS	4
+
+/* Extensions are advertised in the urgent pointer of SYN packets,
+ * which older peers always set to 0 and never read.
+ *
+ * || 0 1 2 3 | 4 5 6 7 | 8 9 10 11 | 12 13 14 15 ||
+ *  <- magic -> <-flags-> <- unused -> <- wscale ->
+ */
+#define TCP_EXT_MAGIC		0xA000
+#define TCP_EXT_MAGIC_MASK	0xF000
+#define TCP_EXT_SACK		0x0100
+#define TCP_EXT_PMTU		0x0200
+#define TCP_EXT_WSCALE_MASK	0x000F
+
 class TcpPacket
 {
 	public:
@@ -46,15 +64,19 @@ class TcpPacket
 	uint16 hlen_flags;
 	uint16 winsize;
 	/* don't need these -> in udp + not supported
-	uint16 chksum, urgptr; 
-	 **************************/
-	/* no options.
+	uint16 chksum;
 	 **************************/
-	
+	uint16 extensions; /* urgptr: TCP_EXT_* flags, SYN packets only */
+
+	/* options: SACK blocks [left, right) */
+	uint32 sackBlocks[2 * TCP_MAX_SACK_BLOCKS];
+	uint8  nSackBlocks;
 
 	/* other variables */
 	double  ts; /* transmit time */ 
 	uint16  retrans; /* retransmit counter */
+	bool    sacked; /* reported as received by the peer (SACK) */
+	bool    resent; /* retransmitted during the current loss recovery */
 
 	TcpPacket(uint8 *ptr, int size);
 	TcpPacket(); /* likely control packet */
@@ -62,6 +84,7 @@ class TcpPacket
 
 int	writePacket(void *buf, int &size);
 int	readPacket(void *buf, int size);
+int	optionsSize();
 
 void    *getData();
 void    *releaseData();
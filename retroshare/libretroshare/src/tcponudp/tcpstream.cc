@@ -64,6 +64,10 @@ int	setupBinaryCheck(std::string fname);
 #endif
 
 static const uint32 kMaxQueueSize = 300;    // Was 100, which means max packet size of 100k (smaller than max packet size).
+static const uint32 kDupThresh = 3;         // SACKed segments above a hole before it is considered lost.
+static const uint32 kProbeSizes[] = { 1200, TCP_MAX_PROBED_SEG };
+static const uint32 kNumProbeSizes = sizeof(kProbeSizes) / sizeof(kProbeSizes[0]);
+static const uint32 kMaxProbeFailures = 3;  // lost probes of a size before giving up on it.
 static const uint32 kMaxPktRetransmit = 10;
 static const uint32 kMaxSynPktRetransmit = 100; // 100 => 200secs = over 3 minutes startup
 static const int    TCP_STD_TTL = 64;
@@ -78,6 +82,7 @@ static double getCurrentTS();
 
 TcpStream::TcpStream(UdpSubReceiver *lyr)
 	: tcpMtx("TcpStream"), inSize(0), outSizeRead(0), outSizeNet(0), 
+	inQueueOffset(0), maxInPkts(kMaxQueueSize),
 	state(TCP_CLOSED), 
         inStreamActive(false),
         outStreamActive(false),
@@ -100,9 +105,9 @@ TcpStream::TcpStream(UdpSubReceiver *lyr)
 	/* retranmission variables - init to large */
 	rtt_est(TCP_RETRANS_TIMEOUT), 
 	rtt_dev(0),
-	congestThreshold(TCP_MAX_WIN),
-	congestWinSize(MAX_SEG),
-	congestUpdate(0),
+	rtt_valid(false),
+	congestion(MAX_SEG, TCP_MAX_WIN),
+	useExtensions(true),
 	ttl(0),
         mTTL_period(0), 
         mTTL_start(0),
@@ -111,10 +116,20 @@ TcpStream::TcpStream(UdpSubReceiver *lyr)
 	udp(lyr)
 {
 	sockaddr_clear(&peeraddr);
+	resetExtensions();
 
 	return;
 }
 
+void	TcpStream::setUseExtensions(bool on)
+{
+	tcpMtx.lock();   /********** LOCK MUTEX *********/
+
+	useExtensions = on;
+
+	tcpMtx.unlock(); /******** UNLOCK MUTEX *********/
+}
+
 /* Stream Control! */
 int	TcpStream::connect(const struct sockaddr_in &raddr, uint32_t conn_period)
 {
@@ -148,11 +163,12 @@ int	TcpStream::connect(const struct sockaddr_in &raddr, uint32_t conn_period)
 	initOurSeqno = outSeqno;
 
 	outAcked = outSeqno; /* min - 1 expected */
+
+	/* extensions are decided when the peer's SYN arrives */
+	resetExtensions();
 	inWinSize = maxWinSize;
 
-	congestThreshold = TCP_MAX_WIN;
-	congestWinSize   = MAX_SEG;
-	congestUpdate    = outAcked + congestWinSize;
+	congestion.reset(MAX_SEG, maxWinSize);
 
 	/* Init Connection */
 	/* send syn packet */
@@ -351,6 +367,10 @@ int	TcpStream::status_locked(std::ostream &out)
 	out << "peer -> us: Expected SeqNo: " << inAckno;
 	out << " winsize: " << inWinSize;
 	out << std::endl;
+	out << "extensions: sack: " << sackOn << " pmtu: " << pmtuOn;
+	out << " wscale: " << (int) inWinScale << "/" << (int) outWinScale;
+	out << " segment: " << segSize << " cwnd: " << congestion.window();
+	out << std::endl;
 	out << std::endl;
 
 	return tmpstate;
@@ -416,6 +436,12 @@ int     TcpStream::int_read_pending()
 	return outSizeRead + outQueue.size() * MAX_SEG + outSizeNet;
 }
 
+/* INTERNAL */
+int     TcpStream::int_write_pending()
+{
+	return inQueue.size() * MAX_SEG - inQueueOffset + inSize;
+}
+
 
 	/* stream Interface */
 int	TcpStream::write(char *dta, int size) /* write -> pkt -> net */
@@ -1053,6 +1079,7 @@ int	TcpStream::cleanup()
 
 	// clear arrays.
 	inSize = 0;
+	inQueueOffset = 0;
 	while(inQueue.size() > 0)
 	{
 		dataBuffer *db = inQueue.front();
@@ -1084,9 +1111,87 @@ int	TcpStream::cleanup()
 		inPkt.pop_front();
 		delete pkt;
 	}
+
+	resetExtensions();
 	return 1;
 }
 
+
+void	TcpStream::resetExtensions()
+{
+	peerExtensions = 0;
+	sackOn = false;
+	pmtuOn = false;
+	inWinScale = 0;
+	outWinScale = 0;
+	maxWinSize = TCP_MAX_WIN;
+	maxInPkts = kMaxQueueSize;
+
+	sackedBytes = 0;
+	sackedTs = 0;
+	inRecovery = false;
+	recoveryPoint = 0;
+
+	segSize = MAX_SEG;
+	probeIdx = 0;
+	probeFailures = 0;
+	probeInFlight = false;
+	probeSeqno = 0;
+}
+
+
+/* called with the peer's SYN: extensions are only used when both sides 
+ * advertise them. Older peers leave the field to 0 -> nothing changes.
+ */
+void	TcpStream::negotiateExtensions(TcpPacket *pkt)
+{
+	resetExtensions();
+
+	if ((!useExtensions) || 
+		((pkt->extensions & TCP_EXT_MAGIC_MASK) != TCP_EXT_MAGIC))
+	{
+		return;
+	}
+
+	peerExtensions = pkt->extensions;
+	sackOn = (peerExtensions & TCP_EXT_SACK);
+	pmtuOn = (peerExtensions & TCP_EXT_PMTU);
+
+	inWinScale = TCP_WIN_SCALE;
+	outWinScale = (peerExtensions & TCP_EXT_WSCALE_MASK);
+	maxWinSize = TCP_MAX_SCALED_WIN;
+	maxInPkts = 2 * TCP_MAX_SCALED_WIN / MAX_SEG;
+
+	congestion.setMaxWindow(maxWinSize);
+
+	std::string out;
+	rs_sprintf(out, "TcpStream::negotiateExtensions() sack: %d pmtu: %d wscale: %d/%d", 
+		sackOn, pmtuOn, inWinScale, outWinScale);
+	rslog(RSL_WARNING, rstcpstreamzone, out);
+}
+
+
+/* the window in SYN packets is never scaled */
+uint16	TcpStream::advertisedWinSize(TcpPacket *pkt)
+{
+	uint32 win = inWinSize;
+	if (!pkt->hasSyn())
+	{
+		win >>= inWinScale;
+	}
+	return (win > 0xffff) ? 0xffff : win;
+}
+
+
+uint32	TcpStream::peerWinSize(TcpPacket *pkt)
+{
+	if (pkt->hasSyn())
+	{
+		return pkt->winsize;
+	}
+	return ((uint32) pkt->winsize) << outWinScale;
+}
+
 int 	TcpStream::handleIncoming(TcpPacket *pkt)
 {
 #ifdef DEBUG_TCP_STREAM
@@ -1233,8 +1338,9 @@ int TcpStream::incoming_Closed(TcpPacket *pkt)
 		/* save seqno */
 		initPeerSeqno = pkt -> seqno;
 		inAckno = initPeerSeqno + 1;
-		outWinSize = pkt -> winsize;
 
+		negotiateExtensions(pkt);
+		outWinSize = peerWinSize(pkt);
 
 		inWinSize = maxWinSize;
 
@@ -1252,9 +1358,7 @@ int TcpStream::incoming_Closed(TcpPacket *pkt)
 			outAcked = outSeqno; /* min - 1 expected */
 
 			/* setup Congestion Charging */
-			congestThreshold = TCP_MAX_WIN;
-			congestWinSize   = MAX_SEG;
-			congestUpdate    = outAcked + congestWinSize;
+			congestion.reset(MAX_SEG, maxWinSize);
 
 			rsp -> setSyn();
 		}
@@ -1323,7 +1427,9 @@ int TcpStream::incoming_SynSent(TcpPacket *pkt)
 		initPeerSeqno = pkt -> seqno;
 		inAckno = initPeerSeqno + 1;
 
-		outWinSize = pkt -> winsize;
+		negotiateExtensions(pkt);
+		outWinSize = peerWinSize(pkt);
+		UpdateInWinSize();
 
 		outAcked = pkt -> getAck();
 	
@@ -1419,7 +1525,7 @@ int TcpStream::incoming_SynRcvd(TcpPacket *pkt)
 		}
 
 		inAckno = pkt -> seqno; /* + pkt -> datasize; */
-		outWinSize = pkt -> winsize;
+		outWinSize = peerWinSize(pkt);
 
 		outAcked = pkt -> getAck();
 		
@@ -1498,7 +1604,12 @@ int TcpStream::incoming_Established(TcpPacket *pkt)
 			outAcked = pkt->ackno;
 		}
 
-		outWinSize = pkt->winsize;
+		outWinSize = peerWinSize(pkt);
+
+		if (sackOn && pkt->nSackBlocks)
+		{
+			updateSacked(pkt);
+		}
 
 #ifdef DEBUG_TCP_STREAM
 		std::cerr << "\tUpdating OutWinSize to: " << outWinSize;
@@ -1536,71 +1647,125 @@ int TcpStream::incoming_Established(TcpPacket *pkt)
 
 
 	/* add to queue */
-	inPkt.push_back(pkt);
+	bool hasData = (pkt->datasize > 0);
+	insertInPkt(pkt);
+
+	/* use as many packets as possible */
+	int ret = check_InPkts();
 
-	if (inPkt.size() > kMaxQueueSize)
+	/* with SACK, data after a hole is acked straight away: 
+	 * this is what tells the peer about the hole. 
+	 */
+	if (sackOn && hasData && (!inPkt.empty()))
 	{
-		TcpPacket *pkt = inPkt.front();
-		inPkt.pop_front();
-		delete pkt;
+		sendAck();
+	}
+	return ret;
+}
+
+
+/* inPkt is kept sorted by seqno. Packets mostly arrive in order,
+ * so the place is searched from the end.
+ */
+int TcpStream::insertInPkt(TcpPacket *pkt)
+{
+	std::list<TcpPacket *>::iterator it = inPkt.end();
+	while(it != inPkt.begin())
+	{
+		std::list<TcpPacket *>::iterator prev = it;
+		--prev;
+
+		if ((pkt->datasize > 0) && ((*prev)->seqno == pkt->seqno) &&
+			((*prev)->datasize >= pkt->datasize))
+		{
+			/* duplicate (retransmission) */
+			delete pkt;
+			return 0;
+		}
+
+		if (!isOldSequence(pkt->seqno, (*prev)->seqno))
+		{
+			break;
+		}
+		it = prev;
+	}
+	inPkt.insert(it, pkt);
+
+	if (inPkt.size() > maxInPkts)
+	{
+		/* drop the furthest one, it'll be retransmitted */
+		TcpPacket *last = inPkt.back();
+		inPkt.pop_back();
+		delete last;
 
 #ifdef DEBUG_TCP_STREAM
-		std::cerr << "TcpStream::incoming_Established() inPkt reached max size...Discarding Oldest Pkt";
+		std::cerr << "TcpStream::insertInPkt() inPkt reached max size...Discarding Last Pkt";
 		std::cerr << std::endl;
 #endif
-
 	}
-
-	/* use as many packets as possible */
-	return check_InPkts();
+	return 1;
 }
 
 int TcpStream::check_InPkts()
 {
 	bool found = true;
 	TcpPacket *pkt;
-	std::list<TcpPacket *>::iterator it;
 	while(found)
 	{
 		found = false;
-		for(it = inPkt.begin(); (!found) && (it != inPkt.end());)
+		while((!found) && (!inPkt.empty()))
 		{
+			pkt = inPkt.front();
+
 #ifdef DEBUG_TCP_STREAM
 			std::cerr << "Checking expInAck: " << std::hex << inAckno;
-			std::cerr << " vs: " << std::hex << (*it)->seqno << std::dec << std::endl;
+			std::cerr << " vs: " << std::hex << pkt->seqno << std::dec << std::endl;
 #endif
 
-			pkt = *it;
-			if ((*it)->seqno == inAckno)
+			if (pkt->seqno == inAckno)
 			{
 				//std::cerr << "\tFOUND MATCH!";
 				//std::cerr << std::endl;
 
 				found = true;
-				it = inPkt.erase(it);
-
+				inPkt.pop_front();
 			}
 
 			/* see if we can discard it */
 			/* if smaller seqno, and not wrapping around */
-			else if (isOldSequence((*it)->seqno, inAckno))
+			else if (isOldSequence(pkt->seqno, inAckno))
 			{
+				inPkt.pop_front();
+
+				/* retransmitted probes are split differently from 
+				 * the original: keep the part we don't have yet. 
+				 */
+				uint32 skip = inAckno - pkt->seqno;
+				if ((int) skip < pkt->datasize)
+				{
+					memmove(pkt->data, &(pkt->data[skip]), pkt->datasize - skip);
+					pkt->datasize -= skip;
+					pkt->seqno = inAckno;
+					found = true;
+				}
+				else
+				{
 #ifdef DEBUG_TCP_STREAM
-				std::cerr << "Discarding Old Packet expAck: " << std::hex << inAckno;
-				std::cerr << " seqno: " << std::hex << (*it)->seqno;
-				std::cerr << " pkt->size: " << std::hex << (*it)->datasize;
-				std::cerr << " pkt->seqno+size: " << std::hex << (*it)->seqno + (*it)->datasize;
-				std::cerr << std::dec << std::endl;
+					std::cerr << "Discarding Old Packet expAck: " << std::hex << inAckno;
+					std::cerr << " seqno: " << std::hex << pkt->seqno;
+					std::cerr << " pkt->size: " << std::hex << pkt->datasize;
+					std::cerr << " pkt->seqno+size: " << std::hex << pkt->seqno + pkt->datasize;
+					std::cerr << std::dec << std::endl;
 #endif
 
-				/* discard */
-				it = inPkt.erase(it);
-				delete pkt;
-				
+					/* discard */
+					delete pkt;
+				}
 			}
 			else
 			{
-				++it;
+				/* sorted -> everything else is after a hole */
+				break;
 			}
 		}
 		if (found)
@@ -1655,7 +1820,7 @@ int TcpStream::check_InPkts()
 #endif
 
 					outAcked = pkt->ackno;
-					outWinSize = pkt->winsize;
+					outWinSize = peerWinSize(pkt);
 
 #ifdef DEBUG_TCP_STREAM
 					std::cerr << "\tUpdating OutAcked to: " << outAcked;
@@ -1702,11 +1867,13 @@ int TcpStream::check_InPkts()
 
 				/* any big chunks that will take up a full dataBuffer */
 				int remData = pkt->datasize - remSpace;
+				int offset = remSpace;
 				while(remData >= MAX_SEG)
 				{
 					db = new dataBuffer();
-					memcpy((void *) db->data,  (void *) &(pkt->data[remSpace]), MAX_SEG);
+					memcpy((void *) db->data,  (void *) &(pkt->data[offset]), MAX_SEG);
 
+					offset += MAX_SEG;
 					remData -= MAX_SEG;
 					outQueue.push_back(db);
 				}
@@ -1856,6 +2023,100 @@ int TcpStream::sendAck()
 	return toSend(new TcpPacket(), false);
 }
 
+/* SACK blocks describe the data received after the first hole. 
+ * inPkt is sorted, so they are built in one pass, and the lowest 
+ * ones are sent, as they are the ones the peer has to fill first.
+ */
+void TcpStream::fillSackBlocks(TcpPacket *pkt)
+{
+	uint8 n = 0;
+
+	if (sackOn)
+	{
+		std::list<TcpPacket *>::iterator it;
+		for(it = inPkt.begin(); it != inPkt.end(); ++it)
+		{
+			TcpPacket *p = *it;
+			if ((p->datasize == 0) || (!isOldSequence(inAckno, p->seqno)))
+			{
+				continue;
+			}
+
+			uint32 left = p->seqno;
+			uint32 right = p->seqno + p->datasize;
+
+			if ((n > 0) && (!isOldSequence(pkt->sackBlocks[2 * n - 1], left)))
+			{
+				/* contiguous -> extend the current block */
+				if (isOldSequence(pkt->sackBlocks[2 * n - 1], right))
+				{
+					pkt->sackBlocks[2 * n - 1] = right;
+				}
+			}
+			else
+			{
+				if (n == TCP_MAX_SACK_BLOCKS)
+				{
+					break;
+				}
+				pkt->sackBlocks[2 * n] = left;
+				pkt->sackBlocks[2 * n + 1] = right;
+				n++;
+			}
+		}
+	}
+	pkt->nSackBlocks = n;
+}
+
+/* Takes the next size bytes of the write queue. */
+TcpPacket *TcpStream::nextSegment(uint32 size)
+{
+	uint8 seg[TCP_MAX_PROBED_SEG];
+	uint32 len = 0;
+
+	if (size > TCP_MAX_PROBED_SEG)
+	{
+		size = TCP_MAX_PROBED_SEG;
+	}
+
+	while((len < size) && (!inQueue.empty()))
+	{
+		dataBuffer *db = inQueue.front();
+		uint32 n = MAX_SEG - inQueueOffset;
+		if (n > size - len)
+		{
+			n = size - len;
+		}
+
+		memcpy((void *) &(seg[len]), (void *) &(db->data[inQueueOffset]), n);
+		len += n;
+		inQueueOffset += n;
+
+		if (inQueueOffset == MAX_SEG)
+		{
+			inQueue.pop_front();
+			delete db;
+			inQueueOffset = 0;
+		}
+	}
+
+	if ((len < size) && (inSize > 0))
+	{
+		uint32 n = inSize;
+		if (n > size - len)
+		{
+			n = size - len;
+		}
+
+		memcpy((void *) &(seg[len]), (void *) inData, n);
+		len += n;
+		inSize -= n;
+		memmove((void *) inData, (void *) &(inData[n]), inSize);
+	}
+
+	return new TcpPacket(seg, len);
+}
+
 void TcpStream::setRemoteAddress(const struct sockaddr_in &raddr)
 {
 	peeraddr = raddr;
@@ -1865,8 +2126,8 @@ void TcpStream::setRemoteAddress(const struct sockaddr_in &raddr)
 
 int TcpStream::toSend(TcpPacket *pkt, bool retrans)
 {
-	int  outPktSize = MAX_SEG + TCP_PSEUDO_HDR_SIZE;
-	char tmpOutPkt[outPktSize];
+	int  outPktSize = TCP_MAX_PKT_SIZE;
+	char tmpOutPkt[TCP_MAX_PKT_SIZE];
 
 	if (!peerKnown)
 	{
@@ -1882,7 +2143,6 @@ int TcpStream::toSend(TcpPacket *pkt, bool retrans)
 	/* get accurate timestamp */
 	double cts =  getCurrentTS();
 
-	pkt -> winsize = inWinSize;
 	pkt -> seqno = outSeqno;
 
 	/* increment seq no */
@@ -1904,6 +2164,11 @@ int TcpStream::toSend(TcpPacket *pkt, bool retrans)
 #endif
 		}
 		outSeqno++;
+
+		if (useExtensions)
+		{
+			pkt -> extensions = TCP_EXT_MAGIC | TCP_EXT_SACK | TCP_EXT_PMTU | TCP_WIN_SCALE;
+		}
 	}
 	else
 	{
@@ -1911,11 +2176,12 @@ int TcpStream::toSend(TcpPacket *pkt, bool retrans)
 		pkt -> setAck(inAckno);
 	}
 
-	pkt -> winsize = inWinSize;
+	pkt -> winsize = advertisedWinSize(pkt);
+	fillSackBlocks(pkt);
 
 	/* store old info */
 	lastSentAck = pkt -> ackno;
-	lastSentWinSize = pkt -> winsize;
+	lastSentWinSize = inWinSize;
 	keepAliveTimer = cts;
 	
 	pkt -> writePacket(tmpOutPkt, outPktSize);
@@ -2037,8 +2303,8 @@ void TcpStream::incRetransmitTimeout()
 
 int TcpStream::retrans()
 {
-	int  outPktSize = MAX_SEG + TCP_PSEUDO_HDR_SIZE;
-	char tmpOutPkt[outPktSize];
+	int  outPktSize = TCP_MAX_PKT_SIZE;
+	char tmpOutPkt[TCP_MAX_PKT_SIZE];
 
 	if (!peerKnown)
 	{
@@ -2075,21 +2341,38 @@ int TcpStream::retrans()
 		return 0;
 	}
 	
-	/* retransmission -> adjust the congestWinSize and congestThreshold 
-	*/
+	if (probeInFlight && (pkt->seqno == probeSeqno))
+	{
+		/* a lost probe only says that the path may not take such 
+		 * big packets: resend it as normal segments, and leave 
+		 * the congestion window alone.
+		 */
+		pkt = *(splitProbe(outPkt.begin()));
+	}
+	else if (!(pkt->hasSyn()))
+	{
+		/* retransmission -> adjust the congestion window, 
+		 * and SACK recovery restarts from the first hole.
+		 */
+		congestion.onTimeout();
+
+		inRecovery = true;
+		recoveryPoint = outSeqno;
+
+		std::list<TcpPacket *>::iterator it;
+		for(it = outPkt.begin(); it != outPkt.end(); ++it)
+		{
+			(*it)->resent = false;
+		}
 
-	congestThreshold = congestWinSize / 2;
-	congestWinSize = MAX_SEG;
-	congestUpdate  = outAcked + congestWinSize; // point when we can up the winSize.
-	
 #ifdef DEBUG_TCP_STREAM
-	std::cerr << "TcpStream::retrans() Adjusting Congestion Parameters: ";
-	std::cerr << std::endl;
-	std::cerr << "\tcongestWinSize: " << congestWinSize;
-	std::cerr << "  congestThreshold: " << congestThreshold;
-	std::cerr << "  congestUpdate: " << congestUpdate;
-	std::cerr << std::endl;
+		std::cerr << "TcpStream::retrans() Adjusting Congestion Parameters: ";
+		std::cerr << std::endl;
+		std::cerr << "\tcongestWinSize: " << congestion.window();
+		std::cerr << "  congestThreshold: " << congestion.threshold();
+		std::cerr << std::endl;
 #endif
+	}
 	
 	/* update ackno and winsize */
 	if (!(pkt->hasSyn()))
@@ -2098,8 +2381,9 @@ int TcpStream::retrans()
 		lastSentAck = pkt -> ackno;
 	}
 	
-	pkt->winsize = inWinSize;
-	lastSentWinSize = pkt -> winsize;
+	pkt->winsize = advertisedWinSize(pkt);
+	lastSentWinSize = inWinSize;
+	fillSackBlocks(pkt);
 	
 	keepAliveTimer = cts;
 	
@@ -2191,6 +2475,7 @@ int TcpStream::retrans()
 	/* restart timers */
 	pkt->ts = cts;
 	pkt->retrans++;	
+	pkt->resent = true;
 	
 	/* 
 	 * finally - double the retransTimeout ... (Karn's Algorithm)
@@ -2220,6 +2505,7 @@ void TcpStream::acknowledge()
 	double cts = getCurrentTS();
 	bool updateRTT = true;
 	bool clearedPkts = false;
+	uint32 ackedBytes = 0;
 
 	for(it = outPkt.begin(); (it != outPkt.end()) && 
 			(isOldSequence((*it)->seqno, outAcked)); 
@@ -2228,37 +2514,31 @@ void TcpStream::acknowledge()
 		TcpPacket *pkt = (*it);
 		clearedPkts = true;
 
-		/* adjust the congestWinSize and congestThreshold 
-		 * congestUpdate <= outAcked
-		 *
-		 ***/
+		/* the congestion window is adjusted once the loop is done */
+		ackedBytes += pkt->datasize;
 
-		if (!isOldSequence(outAcked, congestUpdate))
+		if (pkt->sacked)
 		{
-			if (congestWinSize < congestThreshold)
-			{
-				/* double it baby! */
-				congestWinSize *= 2;
-			}
-			else
-			{
-				/* linear increase */
-				congestWinSize += MAX_SEG;
-			}
+			sackedBytes -= pkt->datasize;
+		}
+		else if (pkt->datasize)
+		{
+			congestion.delivered(pkt->datasize, cts,
+				(pkt->retrans) ? rtt_est : cts - pkt->ts);
+		}
 
-			if (congestWinSize > maxWinSize)
-			{
-				congestWinSize = maxWinSize;
-			}
+		/* a probe got through -> the path takes bigger segments */
+		if (probeInFlight && (pkt->seqno == probeSeqno))
+		{
+			probeInFlight = false;
+			probeFailures = 0;
+			probeIdx++;
 
-			congestUpdate  = outAcked + congestWinSize; // point when we can up the winSize.
+			segSize = pkt->datasize;
+			congestion.setMss(segSize);
 
 #ifdef DEBUG_TCP_STREAM
-			std::cerr << "TcpStream::acknowledge() Adjusting Congestion Parameters: ";
-			std::cerr << std::endl;
-			std::cerr << "\tcongestWinSize: " << congestWinSize;
-			std::cerr << "  congestThreshold: " << congestThreshold;
-			std::cerr << "  congestUpdate: " << congestUpdate;
+			std::cerr << "TcpStream::acknowledge() Probe Succeeded, segment size: " << segSize;
 			std::cerr << std::endl;
 #endif
 		}
@@ -2287,7 +2567,8 @@ void TcpStream::acknowledge()
 		 * 	(2) double timeout, when packets fail. (done in retrans).
 		 */
 
-		if (pkt->retrans)
+		/* SACKed packets were received long before their ack */
+		if ((pkt->retrans) || (pkt->sacked))
 		{
 			updateRTT = false;
 		}
@@ -2295,8 +2576,18 @@ void TcpStream::acknowledge()
 		if (updateRTT) /* can use for RTT calc */
 		{
 			double ack_time = cts - pkt->ts;
-			rtt_est = RTT_ALPHA * rtt_est + (1.0 - RTT_ALPHA) * ack_time;
-			rtt_dev = RTT_ALPHA * rtt_dev + (1.0 - RTT_ALPHA) * fabs(rtt_est - ack_time);
+			if (!rtt_valid)
+			{
+				/* first measurement replaces the initial guess (RFC 6298) */
+				rtt_est = ack_time;
+				rtt_dev = ack_time / 2.0;
+				rtt_valid = true;
+			}
+			else
+			{
+				rtt_est = RTT_ALPHA * rtt_est + (1.0 - RTT_ALPHA) * ack_time;
+				rtt_dev = RTT_ALPHA * rtt_dev + (1.0 - RTT_ALPHA) * fabs(rtt_est - ack_time);
+			}
 			retransTimeout = rtt_est + 4.0 * rtt_dev;
 #ifdef DEBUG_TCP_STREAM
 			std::cerr << "TcpStream::acknowledge() Updating RTT: ";
@@ -2328,6 +2619,30 @@ void TcpStream::acknowledge()
 		delete pkt;
 	}
 
+	if (ackedBytes)
+	{
+		if (inRecovery && (!isOldSequence(outAcked, recoveryPoint)))
+		{
+			inRecovery = false;
+		}
+
+		/* no growth during loss recovery, except for the slow start 
+		 * that follows a timeout.
+		 */
+		if ((!inRecovery) || (congestion.window() < congestion.threshold()))
+		{
+			congestion.onAck(ackedBytes, cts, rtt_est);
+		}
+
+#ifdef DEBUG_TCP_STREAM
+		std::cerr << "TcpStream::acknowledge() Adjusting Congestion Parameters: ";
+		std::cerr << std::endl;
+		std::cerr << "\tcongestWinSize: " << congestion.window();
+		std::cerr << "  congestThreshold: " << congestion.threshold();
+		std::cerr << std::endl;
+#endif
+	}
+
 	/* This is triggered if we have recieved acks for retransmitted packets....
 	 * In this case we want to reset the timeout, and remove the doubling.
 	 *
@@ -2366,6 +2681,226 @@ void TcpStream::acknowledge()
 }
 
 
+/* Marks the packets covered by the peer's SACK blocks. */
+void TcpStream::updateSacked(TcpPacket *pkt)
+{
+	std::list<TcpPacket *>::iterator it;
+	double cts = getCurrentTS();
+	for(it = outPkt.begin(); it != outPkt.end(); ++it)
+	{
+		TcpPacket *p = *it;
+		if ((p->sacked) || (p->datasize == 0))
+		{
+			continue;
+		}
+
+		for(int i = 0; i < pkt->nSackBlocks; i++)
+		{
+			if ((!isOldSequence(p->seqno, pkt->sackBlocks[2 * i])) &&
+				(!isOldSequence(pkt->sackBlocks[2 * i + 1], p->seqno + p->datasize)))
+			{
+				p->sacked = true;
+				sackedBytes += p->datasize;
+				congestion.delivered(p->datasize, cts,
+					(p->retrans) ? rtt_est : cts - p->ts);
+				if (p->ts > sackedTs)
+				{
+					sackedTs = p->ts;
+				}
+				break;
+			}
+		}
+	}
+}
+
+
+/* SACK based loss recovery (RFC 6675, simplified):
+ * a hole is lost once kDupThresh segments above it have been SACKed.
+ * Lost packets are resent straight away - as far as the congestion 
+ * window allows - instead of waiting for the retransmit timer, which 
+ * only ever resends the first one.
+ *
+ * A retransmission can be lost too: it is resent again once a packet
+ * sent after it has been SACKed and more than a RTT has passed (as in
+ * RACK), rather than falling back to a timeout and slow start.
+ */
+int TcpStream::fastRetrans()
+{
+	if ((!sackOn) || (sackedBytes == 0) || (state < TCP_ESTABLISHED))
+	{
+		return 0;
+	}
+
+	double cts = getCurrentTS();
+	std::list<std::list<TcpPacket *>::iterator> lost;
+	uint32 above = 0;
+	uint32 lostBytes = 0;
+	bool onlyProbe = true;
+
+	std::list<TcpPacket *>::iterator it = outPkt.end();
+	while(it != outPkt.begin())
+	{
+		--it;
+		TcpPacket *pkt = *it;
+		if (pkt->sacked)
+		{
+			above += pkt->datasize;
+		}
+		else if (((!pkt->resent) && (above >= kDupThresh * segSize)) ||
+			((pkt->resent) && (pkt->ts < sackedTs) && (cts - pkt->ts > 1.25 * rtt_est)))
+		{
+			lost.push_front(it);
+			lostBytes += pkt->datasize;
+
+			if (!(probeInFlight && (pkt->seqno == probeSeqno)))
+			{
+				onlyProbe = false;
+			}
+		}
+	}
+
+	if (lost.empty())
+	{
+		return 0;
+	}
+
+	/* once per window of data (the probe doesn't count) */
+	if ((!inRecovery) && (!onlyProbe))
+	{
+		inRecovery = true;
+		recoveryPoint = outSeqno;
+		congestion.onLoss();
+
+#ifdef DEBUG_TCP_STREAM
+		std::cerr << "TcpStream::fastRetrans() Entering Recovery, cwnd: " << congestion.window();
+		std::cerr << std::endl;
+#endif
+	}
+
+	uint32 pipe = outSeqno - outAcked;
+	if (pipe > sackedBytes + lostBytes)
+	{
+		pipe -= sackedBytes + lostBytes;
+	}
+	else
+	{
+		pipe = 0;
+	}
+
+	int count = 0;
+	std::list<std::list<TcpPacket *>::iterator>::iterator lit;
+	for(lit = lost.begin(); lit != lost.end(); ++lit)
+	{
+		it = *lit;
+
+		/* the first one always goes */
+		if ((count > 0) && (pipe + (*it)->datasize > congestion.window()))
+		{
+			break;
+		}
+
+		if (probeInFlight && ((*it)->seqno == probeSeqno))
+		{
+			std::list<TcpPacket *>::iterator next = it;
+			++next;
+			for(it = splitProbe(it); it != next; ++it)
+			{
+				resend(*it, cts);
+				pipe += (*it)->datasize;
+				count++;
+			}
+		}
+		else
+		{
+			resend(*it, cts);
+			pipe += (*it)->datasize;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+
+int TcpStream::resend(TcpPacket *pkt, double cts)
+{
+	int  outPktSize = TCP_MAX_PKT_SIZE;
+	char tmpOutPkt[TCP_MAX_PKT_SIZE];
+
+	pkt->setAck(inAckno);
+	pkt->winsize = advertisedWinSize(pkt);
+	fillSackBlocks(pkt);
+
+	lastSentAck = pkt->ackno;
+	lastSentWinSize = inWinSize;
+	keepAliveTimer = cts;
+
+	pkt->writePacket(tmpOutPkt, outPktSize);
+
+#ifdef DEBUG_TCP_STREAM_RETRANS
+	std::cerr << "TcpStream::resend()";
+	std::cerr << " Seqno: " << pkt->seqno << " size: " << pkt->datasize;
+	std::cerr << std::endl;
+#endif
+
+	udp -> sendPkt(tmpOutPkt, outPktSize, peeraddr, ttl);
+
+	pkt->ts = cts;
+	pkt->retrans++;
+	pkt->resent = true;
+
+	return 1;
+}
+
+
+/* Replaces a lost probe by normal sized segments, and gives up on
+ * that size after kMaxProbeFailures. Returns the first new segment.
+ */
+std::list<TcpPacket *>::iterator TcpStream::splitProbe(std::list<TcpPacket *>::iterator it)
+{
+	TcpPacket *probe = *it;
+	std::list<TcpPacket *>::iterator first = it;
+
+	for(int offset = 0; offset < probe->datasize; offset += segSize)
+	{
+		int size = probe->datasize - offset;
+		if (size > (int) segSize)
+		{
+			size = segSize;
+		}
+
+		TcpPacket *pkt = new TcpPacket(&(probe->data[offset]), size);
+		pkt->seqno = probe->seqno + offset;
+		pkt->ackno = probe->ackno;
+		pkt->hlen_flags = probe->hlen_flags;
+		pkt->ts = probe->ts;
+		pkt->retrans = probe->retrans;
+
+		std::list<TcpPacket *>::iterator nit = outPkt.insert(it, pkt);
+		if (offset == 0)
+		{
+			first = nit;
+		}
+	}
+
+	outPkt.erase(it);
+	delete probe;
+
+	probeInFlight = false;
+	if (++probeFailures >= kMaxProbeFailures)
+	{
+		probeIdx = kNumProbeSizes;
+	}
+
+#ifdef DEBUG_TCP_STREAM
+	std::cerr << "TcpStream::splitProbe() Probe Lost, failures: " << probeFailures;
+	std::cerr << std::endl;
+#endif
+
+	return first;
+}
+
+
 int TcpStream::send()
 {
 	/* handle network interface always */
@@ -2373,6 +2908,8 @@ int TcpStream::send()
 	acknowledge();
 	/* send any old packets */
 	retrans();
+	/* and the ones the peer told us are missing */
+	fastRetrans();
 
 
 	if (state < TCP_ESTABLISHED)
@@ -2384,6 +2921,7 @@ int TcpStream::send()
 
 
 	/* determine exactly how much we can send */
+	uint32 congestWinSize = congestion.window();
 	uint32 maxsend = congestWinSize;
 	uint32 inTransit;
 
@@ -2401,6 +2939,16 @@ int TcpStream::send()
 		inTransit = outSeqno - outAcked;
 	}
 
+	/* SACKed packets have left the network */
+	if (inTransit > sackedBytes)
+	{
+		inTransit -= sackedBytes;
+	}
+	else
+	{
+		inTransit = 0;
+	}
+
 	if (maxsend > inTransit)
 	{
 		maxsend -= inTransit;
@@ -2410,8 +2958,9 @@ int TcpStream::send()
 		maxsend = 0;
 	}
 
+	uint32 availSend = int_write_pending();
+
 #ifdef DEBUG_TCP_STREAM
-	int availSend = inQueue.size() * MAX_SEG + inSize;
 		std::cerr << "TcpStream::send() CC: ";
 		std::cerr << "oWS: " << outWinSize;
 		std::cerr << " cWS: " << congestWinSize;
@@ -2420,39 +2969,56 @@ int TcpStream::send()
 		std::cerr << " aSnd: " << availSend;
 		std::cerr << " | oSeq: " << outSeqno;
 		std::cerr << "  oAck: " << outAcked;
-		std::cerr << "  cUpd: " << congestUpdate;
+		std::cerr << "  cThr: " << congestion.threshold();
 		std::cerr << std::endl;
 #endif
 
 	int sent = 0;
-	while((inQueue.size() > 0) && (maxsend >= MAX_SEG))
+
+	/* path MTU probing: one bigger segment at a time */
+	if (pmtuOn && (!probeInFlight) && (!inRecovery) && (probeIdx < kNumProbeSizes))
 	{
-		dataBuffer *db = inQueue.front();
-		inQueue.pop_front();
+		uint32 probeSize = kProbeSizes[probeIdx];
+		if ((availSend >= probeSize) && (maxsend >= probeSize))
+		{
+			probeSeqno = outSeqno;
+			probeInFlight = true;
 
-		TcpPacket *pkt = new TcpPacket(db->data, MAX_SEG);
+			TcpPacket *pkt = nextSegment(probeSize);
+#ifdef DEBUG_TCP_STREAM
+			std::cerr << "TcpStream::send() Probe ===> size: " << probeSize;
+			std::cerr << std::endl;
+#endif
+			sent++;
+			maxsend -= probeSize;
+			availSend -= probeSize;
+			toSend(pkt);
+		}
+	}
+
+	while((availSend >= segSize) && (maxsend >= segSize))
+	{
+		TcpPacket *pkt = nextSegment(segSize);
 #ifdef DEBUG_TCP_STREAM
 		std::cerr << "TcpStream::send() Segment ===> Seqno: ";
-		std::cerr << pkt->seqno << " size: " << pkt->datasize;
+		std::cerr << outSeqno << " size: " << pkt->datasize;
 		std::cerr << std::endl;
 #endif
 		sent++;
-		maxsend -= MAX_SEG;
+		maxsend -= segSize;
+		availSend -= segSize;
 		toSend(pkt);
-		delete db;
 	}
 
 	/* if inqueue empty, and enough window space, send partial stuff */
-	if ((!sent) && (inQueue.empty()) && (maxsend >= inSize) && (inSize))
+	if ((!sent) && (availSend < segSize) && (maxsend >= availSend) && (availSend))
 	{
-		TcpPacket *pkt = new TcpPacket(inData, inSize);
+		TcpPacket *pkt = nextSegment(availSend);
 #ifdef DEBUG_TCP_STREAM
 		std::cerr << "TcpStream::send() Remaining ===>";
 		std::cerr << std::endl;
 #endif
-		inSize = 0;
 		sent++;
-		maxsend -= inSize;
 		toSend(pkt);
 	}
 
@@ -2728,9 +3294,10 @@ int TcpStream::dumpstate_locked(std::ostream &out)
 	out << " rtt_dev: " << rtt_dev;
 	out << std::endl;
 
-	out << "(congestion) congestThreshold: " << congestThreshold;
-	out << " congestWinSize: " << congestWinSize;
-	out << " congestUpdate: " << congestUpdate;
+	out << "(congestion) congestThreshold: " << congestion.threshold();
+	out << " congestWinSize: " << congestion.window();
+	out << " inRecovery: " << inRecovery;
+	out << " sackedBytes: " << sackedBytes;
 	out << std::endl;
 
 	out << "(TTL) mTTL_period: " << mTTL_period;
@@ -30,6 +30,7 @@
  */
 
 #include "tcppacket.h"
+#include "tcpcongestion.h"
 #include "udppeer.h"
 
 // WINDOWS doesn't like UDP packets bigger than 1492 (truncates them). 
@@ -39,8 +40,16 @@
 // We are going to start at 1000 (to avoid any fragmentation, and work up).
 #define MAX_SEG 		1000       
 
+// With peers that support it, bigger segments are probed for (path MTU 
+// probing), up to a size that still fits a relayed packet with a full
+// SACK option: 1360 + 20 + 36 (options) = 1416 <= 1400 + 20.
+#define TCP_MAX_PROBED_SEG	1360
+#define TCP_MAX_PKT_SIZE	(TCP_MAX_PROBED_SEG + TCP_PSEUDO_HDR_SIZE + TCP_MAX_OPTIONS_SIZE)
+
 #define TCP_MAX_SEQ 		UINT_MAX
 #define TCP_MAX_WIN		65500
+#define TCP_WIN_SCALE		6	/* when negotiated, window = winsize << 6 */
+#define TCP_MAX_SCALED_WIN	(4 * 1024 * 1024)
 #define TCP_ALIVE_TIMEOUT	15      /* 15 sec ... < 20 sec UDP state limit on some firewalls */
 #define TCP_RETRANS_TIMEOUT	1	/* 1 sec (Initial value) */
 #define TCP_RETRANS_MAX_TIMEOUT	15	/* 15 secs */
@@ -101,6 +110,12 @@ int	close(); /* standard unix behaviour */
 
 int	tick(); /* check iface etc */
 
+	/* Window scaling, SACK and path MTU probing are advertised in our
+	 * SYN, and used only if the peer advertises them too. Disabling them
+	 * makes the stream look exactly like an older version on the wire.
+	 */
+void	setUseExtensions(bool on);
+
 	/* Callback Funcion from UDP Layers */
 virtual void recvPkt(void *data, int size); /* overloaded */
 
@@ -146,8 +161,17 @@ int 	incoming_Closing(TcpPacket *pkt);
 int 	incoming_CloseWait(TcpPacket *pkt);
 int 	incoming_LastAck(TcpPacket *pkt);
 int 	check_InPkts();
+int 	insertInPkt(TcpPacket *pkt);
+void 	fillSackBlocks(TcpPacket *pkt);
 int 	UpdateInWinSize();
 int	int_read_pending();
+int	int_write_pending();
+
+/* extensions */
+void 	resetExtensions();
+void 	negotiateExtensions(TcpPacket *pkt);
+uint16 	advertisedWinSize(TcpPacket *pkt);
+uint32 	peerWinSize(TcpPacket *pkt);
 
 /* outgoing data */
 int	send();
@@ -155,6 +179,13 @@ int 	toSend(TcpPacket *pkt, bool retrans = true);
 void 	acknowledge();
 int	retrans();
 int	sendAck();
+TcpPacket *nextSegment(uint32 size);
+
+/* loss recovery */
+void 	updateSacked(TcpPacket *pkt);
+int 	fastRetrans();
+int 	resend(TcpPacket *pkt, double cts);
+std::list<TcpPacket *>::iterator splitProbe(std::list<TcpPacket *>::iterator it);
 void 	setRemoteAddress(const struct sockaddr_in &raddr);
 
 int	getTTL() { return ttl; }
@@ -189,9 +220,11 @@ uint32 	int_rbytes();
 
 	/* get packed into here as size increases */
 	std::deque<dataBuffer *>   inQueue, outQueue;
+	uint32 inQueueOffset; /* already sent from inQueue.front() */
 
 	/* packets waiting for acks */
-	std::list<TcpPacket *> inPkt, outPkt;
+	std::list<TcpPacket *> inPkt, outPkt; /* both sorted by seqno */
+	uint32 maxInPkts;
 
 
 	uint8  state; /* stream state */
@@ -232,11 +265,31 @@ uint32 	int_rbytes();
 	/* RoundTripTime estimations */
 	double rtt_est;
 	double rtt_dev;
+	bool   rtt_valid; /* false until the first measurement */
 
 	/* congestion limits */
-	uint32 congestThreshold;
-	uint32 congestWinSize;
-	uint32 congestUpdate;
+	TcpCongestion congestion;
+
+	/* extensions */
+	bool   useExtensions;
+	uint16 peerExtensions;
+	bool   sackOn;
+	bool   pmtuOn;
+	uint8  inWinScale;  /* applied to the windows we advertise */
+	uint8  outWinScale; /* applied to the windows the peer advertises */
+
+	/* SACK - loss recovery */
+	uint32 sackedBytes;
+	double sackedTs; /* send time of the last packet SACKed */
+	bool   inRecovery;
+	uint32 recoveryPoint;
+
+	/* path MTU probing */
+	uint32 segSize;
+	uint32 probeIdx;
+	uint32 probeFailures;
+	bool   probeInFlight;
+	uint32 probeSeqno;
 
 	/* existing TTL for this stream (tweaked at startup) */
 	int ttl;
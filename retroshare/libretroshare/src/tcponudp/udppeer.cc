@@ -45,7 +45,7 @@ int UdpPeerReceiver::recvPkt(void *data, int size, struct sockaddr_in &from)
         RsStackMutex stack(peerMtx);   /********** LOCK MUTEX *********/
 
 	/* look for a peer */
-        std::map<struct sockaddr_in, UdpPeer *>::iterator it;
+        UdpPeerMap::iterator it;
 	it = streams.find(from);
 
 	if (it == streams.end())
@@ -78,7 +78,7 @@ int     UdpPeerReceiver::status(std::ostream &out)
 
 	out << "UdpPeerReceiver::status()" << std::endl;
 	out << "UdpPeerReceiver::peers:" << std::endl;
-        std::map<struct sockaddr_in, UdpPeer *>::iterator it;
+        UdpPeerMap::iterator it;
 	for(it = streams.begin(); it != streams.end(); ++it)
 	{
 		out << "\t" << it->first << std::endl;
@@ -95,7 +95,7 @@ int UdpPeerReceiver::addUdpPeer(UdpPeer *peer, const struct sockaddr_in &raddr)
 
 
 	/* check for duplicate */
-        std::map<struct sockaddr_in, UdpPeer *>::iterator it;
+        UdpPeerMap::iterator it;
 	it = streams.find(raddr);
 	bool ok = (it == streams.end());
 	if (!ok)
@@ -118,7 +118,7 @@ int UdpPeerReceiver::removeUdpPeer(UdpPeer *peer)
         RsStackMutex stack(peerMtx);   /********** LOCK MUTEX *********/
 
 	/* check for duplicate */
-        std::map<struct sockaddr_in, UdpPeer *>::iterator it;
+        UdpPeerMap::iterator it;
 	for(it = streams.begin(); it != streams.end(); ++it)
 	{
 		if (it->second == peer)
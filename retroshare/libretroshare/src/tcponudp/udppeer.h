@@ -31,9 +31,30 @@
 #include <iosfwd>
 #include <list>
 #include <deque>
+#include <unordered_map>
 
 #include "tcponudp/rsudpstack.h"
 
+/* Hashing of IPv4 end-points, so that the receivers can find the stream
+ * of each incoming packet without walking a tree.
+ */
+struct UdpAddrHash
+{
+	size_t operator()(const struct sockaddr_in &addr) const
+	{
+		uint64_t key = ((uint64_t) addr.sin_addr.s_addr << 16) | addr.sin_port;
+		return std::hash<uint64_t>()(key * 0x9E3779B97F4A7C15ULL);
+	}
+};
+
+struct UdpAddrEqual
+{
+	bool operator()(const struct sockaddr_in &a, const struct sockaddr_in &b) const
+	{
+		return (a.sin_addr.s_addr == b.sin_addr.s_addr) && (a.sin_port == b.sin_port);
+	}
+};
+
 class UdpPeer
 {
 	public:
@@ -41,6 +62,8 @@ virtual ~UdpPeer() { return; }
 virtual void recvPkt(void *data, int size) = 0;
 };
 
+typedef std::unordered_map<struct sockaddr_in, UdpPeer *, UdpAddrHash, UdpAddrEqual> UdpPeerMap;
+
 
 class UdpPeerReceiver: public UdpSubReceiver
 {
@@ -62,7 +85,7 @@ int     status(std::ostream &out);
 
 	RsMutex peerMtx; /* for all class data (below) */
 
-	std::map<struct sockaddr_in, UdpPeer *> streams;
+	UdpPeerMap streams;
 
 };
 
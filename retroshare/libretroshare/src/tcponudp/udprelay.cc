@@ -88,7 +88,7 @@ int     UdpRelayReceiver::addUdpPeer(UdpPeer *peer, UdpRelayAddrSet *endPoints,
 		RsStackMutex stack(relayMtx);   /********** LOCK MUTEX *********/
 		
 		/* check for duplicate */
-		std::map<struct sockaddr_in, UdpRelayEnd>::iterator it;
+		UdpRelayEndMap::iterator it;
 		it = mStreams.find(realPeerAddr);
 		bool ok = (it == mStreams.end());
 		if (!ok)
@@ -135,7 +135,7 @@ int     UdpRelayReceiver::removeUdpPeer(UdpPeer *peer)
 	{
 		RsStackMutex stack(udppeerMtx);   /********** LOCK MUTEX *********/
 		
-		std::map<struct sockaddr_in, UdpPeer *>::iterator it;
+		UdpPeerMap::iterator it;
 		for(it = mPeers.begin(); it != mPeers.end(); ++it)
 		{
 			if (it->second == peer)
@@ -164,7 +164,7 @@ int     UdpRelayReceiver::removeUdpPeer(UdpPeer *peer)
 	{
 		RsStackMutex stack(relayMtx);   /********** LOCK MUTEX *********/
 		
-		std::map<struct sockaddr_in, UdpRelayEnd>::iterator it;
+		UdpRelayEndMap::iterator it;
 		it = mStreams.find(realPeerAddr);
 		if (it != mStreams.end())
 		{
@@ -185,7 +185,7 @@ int UdpRelayReceiver::getRelayEnds(std::list<UdpRelayEnd> &relayEnds)
 {
         RsStackMutex stack(relayMtx);   /********** LOCK MUTEX *********/
 
-	std::map<struct sockaddr_in, UdpRelayEnd>::iterator rit;
+	UdpRelayEndMap::iterator rit;
 	
 	for(rit = mStreams.begin(); rit != mStreams.end(); ++rit)
 	{
@@ -200,7 +200,7 @@ int UdpRelayReceiver::getRelayProxies(std::list<UdpRelayProxy> &relayProxies)
 {
         RsStackMutex stack(relayMtx);   /********** LOCK MUTEX *********/
 
-	std::map<UdpRelayAddrSet, UdpRelayProxy>::iterator rit;
+	UdpRelayProxyMap::iterator rit;
 	
 	for(rit = mRelays.begin(); rit != mRelays.end(); ++rit)
 	{
@@ -231,7 +231,7 @@ int UdpRelayReceiver::checkRelays()
 #endif
 
 	std::list<UdpRelayAddrSet> eraseList;
-	std::map<UdpRelayAddrSet, UdpRelayProxy>::iterator rit;
+	UdpRelayProxyMap::iterator rit;
 	rstime_t now = time(NULL);
 
 #define BANDWIDTH_FILTER_K	(0.8)
@@ -350,7 +350,7 @@ int UdpRelayReceiver::addUdpRelay(UdpRelayAddrSet *addrSet, int &relayClass, uin
 	RsStackMutex stack(relayMtx);   /********** LOCK MUTEX *********/
 
 	/* check for duplicate */
-	std::map<UdpRelayAddrSet, UdpRelayProxy>::iterator rit = mRelays.find(*addrSet);
+	UdpRelayProxyMap::iterator rit = mRelays.find(*addrSet);
 	int ok = (rit == mRelays.end());
 	if (!ok)
 	{
@@ -396,7 +396,7 @@ int UdpRelayReceiver::removeUdpRelay_relayLocked(UdpRelayAddrSet *addrSet)
 #endif
 
 	/* find in Relay list */
-        std::map<UdpRelayAddrSet, UdpRelayProxy>::iterator rit = mRelays.find(*addrSet);
+        UdpRelayProxyMap::iterator rit = mRelays.find(*addrSet);
 	if (rit == mRelays.end())
 	{
 		/* ERROR */
@@ -607,7 +607,7 @@ int UdpRelayReceiver::RelayStatus(std::ostream &out)
 	out << "UdpRelayReceiver::RelayStatus()";
 	out << std::endl;
 
-	std::map<UdpRelayAddrSet, UdpRelayProxy>::iterator rit;
+	UdpRelayProxyMap::iterator rit;
 	for(rit = mRelays.begin(); rit != mRelays.end(); ++rit)
 	{
 		out << "Relay for: " << rit->first;
@@ -645,7 +645,7 @@ int     UdpRelayReceiver::status(std::ostream &out)
 
 		out << "UdpRelayReceiver::Connections:" << std::endl;
 
-		std::map<struct sockaddr_in, UdpRelayEnd>::iterator pit;
+		UdpRelayEndMap::iterator pit;
 		for(pit = mStreams.begin(); pit != mStreams.end(); ++pit)
 		{
 			out << "\t" << pit->first << " : " << pit->second;
@@ -666,7 +666,7 @@ int UdpRelayReceiver::UdpPeersStatus(std::ostream &out)
 	out << "UdpRelayReceiver::UdpPeersStatus()";
 	out << std::endl;
 
-        std::map<struct sockaddr_in, UdpPeer *>::iterator pit;
+        UdpPeerMap::iterator pit;
 	for(pit = mPeers.begin(); pit != mPeers.end(); ++pit)
 	{
 		out << "UdpPeer for: " << pit->first;
@@ -754,7 +754,7 @@ int UdpRelayReceiver::recvPkt(void *data, int size, struct sockaddr_in &from)
 	        RsStackMutex stack(relayMtx);   /********** LOCK MUTEX *********/
 	
 		/* lookup relay first (double entries) */
-		std::map<UdpRelayAddrSet, UdpRelayProxy>::iterator rit = mRelays.find(addrSet);
+		UdpRelayProxyMap::iterator rit = mRelays.find(addrSet);
 		if (rit != mRelays.end())
 		{
 			/* we are the relay */
@@ -781,7 +781,7 @@ int UdpRelayReceiver::recvPkt(void *data, int size, struct sockaddr_in &from)
 	{
 	        RsStackMutex stack(udppeerMtx);   /********** LOCK MUTEX *********/
 
-		std::map<struct sockaddr_in, UdpPeer *>::iterator pit = mPeers.find(addrSet.mSrcAddr);
+		UdpPeerMap::iterator pit = mPeers.find(addrSet.mSrcAddr);
 		if (pit != mPeers.end())
 		{
 			/* we are the end-point */
@@ -829,7 +829,7 @@ int UdpRelayReceiver::sendPkt(const void *data, int size, const struct sockaddr_
 	RsStackMutex stack(relayMtx);   /********** LOCK MUTEX *********/
 	
 	/* work out who the proxy is */
-	std::map<struct sockaddr_in, UdpRelayEnd>::iterator it;
+	UdpRelayEndMap::iterator it;
 	it = mStreams.find(to);
 	if (it == mStreams.end())
 	{
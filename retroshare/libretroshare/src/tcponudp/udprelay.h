@@ -41,6 +41,24 @@ class UdpRelayAddrSet
 };
 
 int operator<(const UdpRelayAddrSet &a, const UdpRelayAddrSet &b);
+
+struct UdpRelayAddrSetHash
+{
+	size_t operator()(const UdpRelayAddrSet &set) const
+	{
+		UdpAddrHash h;
+		return h(set.mSrcAddr) ^ (h(set.mDestAddr) * 31);
+	}
+};
+
+struct UdpRelayAddrSetEqual
+{
+	bool operator()(const UdpRelayAddrSet &a, const UdpRelayAddrSet &b) const
+	{
+		UdpAddrEqual eq;
+		return eq(a.mSrcAddr, b.mSrcAddr) && eq(a.mDestAddr, b.mDestAddr);
+	}
+};
 	
 class UdpRelayProxy
 {
@@ -73,6 +91,9 @@ class UdpRelayEnd
 	struct sockaddr_in mRemoteAddr; 
 };
 
+typedef std::unordered_map<struct sockaddr_in, UdpRelayEnd, UdpAddrHash, UdpAddrEqual> UdpRelayEndMap;
+typedef std::unordered_map<UdpRelayAddrSet, UdpRelayProxy, UdpRelayAddrSetHash, UdpRelayAddrSetEqual> UdpRelayProxyMap;
+
 std::ostream &operator<<(std::ostream &out, const UdpRelayAddrSet &uras);
 std::ostream &operator<<(std::ostream &out, const UdpRelayProxy &urp);
 std::ostream &operator<<(std::ostream &out, const UdpRelayEnd &ure);
@@ -185,14 +206,14 @@ void 	getDataTransferred(uint32_t &read, uint32_t &write, uint32_t &relay);
 
 	RsMutex udppeerMtx; /* for all class data (below) */
 	
-	std::map<struct sockaddr_in, UdpPeer *> mPeers; /* indexed by <dest> */
+	UdpPeerMap mPeers; /* indexed by <dest> */
 	uint32_t mReadBytes;
 
 	RsMutex relayMtx; /* for all class data (below) */
 
 	std::vector<int> mClassLimit, mClassCount, mClassBandwidth;
-	std::map<struct sockaddr_in, UdpRelayEnd> mStreams; /* indexed by <dest> */
-	std::map<UdpRelayAddrSet, UdpRelayProxy> mRelays; /* indexed by <src,dest> */
+	UdpRelayEndMap mStreams; /* indexed by <dest> */
+	UdpRelayProxyMap mRelays; /* indexed by <src,dest> */
 
 	void *mTmpSendPkt;
 	uint32_t mTmpSendSize;
@@ -0,0 +1,433 @@
+/*******************************************************************************
+ * libretroshare/src/tests/file_sharing: filelist_container_bench.cc           *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+/**********************************************************
+ * Saving and loading a large hash cache.
+ *
+ * A synthetic hash cache of 300000 entries (by default) is serialised
+ * exactly as HashStorage does it, and saved:
+ *  - into a single buffer encrypted at once by AuthSSL::encrypt(), as
+ *    was done before FileListContainer,
+ *  - streamed into a FileListContainer,
+ * each in a child process, so that the peak memory of the save can be
+ * measured. The container is then saved again after a few time stamps
+ * changed, after entries were appended, after an entry was inserted
+ * at the beginning, and once more after that, counting the chunks written
+ * and kept.
+ * Finally both files are loaded back through FileListContainerReader.
+ *
+ * There is no node here, so AuthSSL is replaced by a minimal class that
+ * seals the data for an RSA key generated at start, with the same
+ * EVP_Seal calls as AuthSSLimpl::encrypt().
+ *
+ * Build, from libretroshare/src:
+ *  g++ -std=c++17 -O2 -I. tests/file_sharing/filelist_container_bench.cc \
+ *      file_sharing/filelist_container.cc file_sharing/filelist_io.cc \
+ *      util/rsdir.cc util/rsrandom.cc util/rsprint.cc util/rsnet.cc \
+ *      util/rsthreads.cc util/folderiterator.cc util/rsstring.cc \
+ *      util/rstime.cc util/rsdebug.cc util/rsstacktrace.cc \
+ *      serialiser/rsbaseserial.cc -lssl -lcrypto -lpthread \
+ *      -Wl,--unresolved-symbols=ignore-all
+ */
+
+#include "file_sharing/filelist_container.h"
+#include "file_sharing/filelist_io.h"
+#include "file_sharing/file_sharing_defaults.h"
+#include "pqi/authssl.h"
+
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/rand.h>
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+static double getTS()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// VmHWM / VmRSS of the current process, in kB.
+
+static long procStatus(const char *field)
+{
+	std::ifstream f("/proc/self/status");
+	std::string line;
+	size_t l = strlen(field);
+
+	while(std::getline(f, line))
+		if(line.compare(0, l, field) == 0)
+			return atol(line.c_str() + l + 1);
+
+	return -1;
+}
+
+static void resetPeakRSS()
+{
+	std::ofstream f("/proc/self/clear_refs");
+	f << "5";
+}
+
+static long fileSize(const std::string& fname)
+{
+	struct stat st;
+	return stat(fname.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+/*************************** AuthSSL replacement *****************************/
+
+class BenchAuthSSL: public AuthSSL
+{
+public:
+	BenchAuthSSL()
+	{
+		mKey = EVP_RSA_gen(2048);
+		mOwnId = RsPeerId::random();
+	}
+
+	bool encrypt(void*& out, int& outlen, const void* in, int inlen, const RsPeerId&) override
+	{
+		// ek size | ek | iv | data, as AuthSSLimpl::encrypt()
+
+		EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+		int ek_size = EVP_PKEY_size(mKey);
+		unsigned char *ek = (unsigned char*)malloc(ek_size);
+		unsigned char iv[EVP_MAX_IV_LENGTH];
+		int eklen = 0;
+
+		if(!EVP_SealInit(ctx, EVP_aes_128_cbc(), &ek, &eklen, iv, &mKey, 1))
+			return false;
+
+		out = malloc(4 + eklen + EVP_MAX_IV_LENGTH + inlen + 32);
+		unsigned char *o = (unsigned char*)out;
+		uint32_t net_ekl = htonl(eklen);
+		memcpy(o, &net_ekl, 4);
+		memcpy(o+4, ek, eklen);
+		memcpy(o+4+eklen, iv, EVP_MAX_IV_LENGTH);
+		int off = 4 + eklen + EVP_MAX_IV_LENGTH, n = 0;
+
+		EVP_SealUpdate(ctx, o+off, &n, (const unsigned char*)in, inlen);
+		off += n;
+		EVP_SealFinal(ctx, o+off, &n);
+		outlen = off + n;
+
+		free(ek);
+		EVP_CIPHER_CTX_free(ctx);
+		return true;
+	}
+
+	bool decrypt(void*& out, int& outlen, const void* in, int inlen) override
+	{
+		const unsigned char *i = (const unsigned char*)in;
+		uint32_t net_ekl;
+
+		if(inlen < 4)
+			return false;
+
+		memcpy(&net_ekl, i, 4);
+		int eklen = ntohl(net_ekl);
+
+		if(eklen > EVP_PKEY_size(mKey) || 4 + eklen + EVP_MAX_IV_LENGTH > inlen)
+			return false;
+
+		EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+		int off = 4 + eklen + EVP_MAX_IV_LENGTH, n = 0;
+
+		if(!EVP_OpenInit(ctx, EVP_aes_128_cbc(), i+4, eklen, i+4+eklen, mKey))
+		{
+			EVP_CIPHER_CTX_free(ctx);
+			return false;
+		}
+		out = malloc(inlen - off + 32);
+		unsigned char *o = (unsigned char*)out;
+
+		bool ok = EVP_OpenUpdate(ctx, o, &n, i+off, inlen-off);
+		outlen = n;
+		ok = ok && EVP_OpenFinal(ctx, o+outlen, &n);
+		outlen += n;
+
+		EVP_CIPHER_CTX_free(ctx);
+
+		if(!ok)
+		{
+			free(out);
+			out = NULL;
+		}
+		return ok;
+	}
+
+	const RsPeerId& OwnId() override { return mOwnId; }
+
+	bool validateOwnCertificate(X509*, EVP_PKEY*) override { return true; }
+	bool active() override { return true; }
+	bool InitAuth(const char*, const char*, const char*, std::string, RsInit::LoadCertificateStatus&) override { return true; }
+	bool CloseAuth() override { return true; }
+	std::string getOwnLocation() override { return std::string(); }
+	std::string SaveOwnCertificateToString() override { return std::string(); }
+	bool SignData(std::string, std::string&) override { return false; }
+	bool SignData(const void*, const uint32_t, std::string&) override { return false; }
+	bool SignDataBin(std::string, unsigned char*, unsigned int*) override { return false; }
+	bool SignDataBin(const void*, uint32_t, unsigned char*, unsigned int*) override { return false; }
+	bool VerifyOwnSignBin(const void*, uint32_t, unsigned char*, unsigned int) override { return false; }
+	bool VerifySignBin(const void*, const uint32_t, unsigned char*, unsigned int, const RsPeerId&) override { return false; }
+	X509* SignX509ReqWithGPG(X509_REQ*, long) override { return NULL; }
+	bool AuthX509WithGPG(X509*, bool, uint32_t&) override { return false; }
+	int VerifyX509Callback(int, X509_STORE_CTX*) override { return 0; }
+	bool VerifyResumedSession(SSL*) override { return false; }
+	bool setResumableSession(SSL*, const RsPeerId&) override { return false; }
+	void forgetPeer(const RsPeerId&) override {}
+	SSL_CTX* getCTX() override { return NULL; }
+	bool parseX509DetailsFromFile(const std::string&, RsPeerId&, RsPgpId&, std::string&) override { return false; }
+
+private:
+	EVP_PKEY *mKey;
+	RsPeerId mOwnId;
+};
+
+AuthSSL& AuthSSL::instance() { static BenchAuthSSL a; return a; }
+AuthSSL* AuthSSL::getAuthSSL() { return &instance(); }
+AuthSSL::~AuthSSL() = default;
+
+/****************************** Hash cache **********************************/
+
+struct Entry
+{
+	std::string filename;
+	uint64_t size;
+	uint32_t time_stamp;
+	uint32_t modf_stamp;
+	RsFileHash hash;
+};
+
+static std::vector<Entry> makeEntries(uint32_t n)
+{
+	std::vector<Entry> entries(n);
+
+	for(uint32_t i=0; i<n; ++i)
+	{
+		char name[128];
+		snprintf(name, sizeof(name), "/home/user/Shared/collection_%03u/album_%04u/track_%06u.ogg", i/5000, i/12, i);
+
+		entries[i].filename = name;
+		entries[i].size = 1000000 + (uint64_t)i * 4099;
+		entries[i].time_stamp = 1600000000 + i;
+		entries[i].modf_stamp = 1500000000 + i;
+		entries[i].hash = RsFileHash::random();
+	}
+	return entries;
+}
+
+// Same serialisation as HashStorage::writeHashStorageInfo(), into a buffer
+// that is reused from one entry to the next.
+
+static bool serialiseEntry(const Entry& e, unsigned char *& data, uint32_t& total_size, uint32_t& offset)
+{
+	unsigned char section_data[FL_BASE_TMP_SECTION_SIZE];
+	unsigned char *s = section_data;
+	uint32_t section_size = FL_BASE_TMP_SECTION_SIZE;
+	uint32_t section_offset = 0;
+
+	if(!FileListIO::writeField(s, section_size, section_offset, FILE_LIST_IO_TAG_FILE_NAME     , e.filename  )) return false;
+	if(!FileListIO::writeField(s, section_size, section_offset, FILE_LIST_IO_TAG_FILE_SIZE     , e.size      )) return false;
+	if(!FileListIO::writeField(s, section_size, section_offset, FILE_LIST_IO_TAG_UPDATE_TS     , e.time_stamp)) return false;
+	if(!FileListIO::writeField(s, section_size, section_offset, FILE_LIST_IO_TAG_MODIF_TS      , e.modf_stamp)) return false;
+	if(!FileListIO::writeField(s, section_size, section_offset, FILE_LIST_IO_TAG_FILE_SHA1_HASH, e.hash      )) return false;
+
+	return FileListIO::writeField(data, total_size, offset, FILE_LIST_IO_TAG_HASH_STORAGE_ENTRY, section_data, section_offset);
+}
+
+static bool saveWholeBuffer(const std::vector<Entry>& entries, const std::string& fname)
+{
+	unsigned char *data = NULL;
+	uint32_t total_size = 0, offset = 0;
+
+	for(uint32_t i=0; i<entries.size(); ++i)
+		if(!serialiseEntry(entries[i], data, total_size, offset))
+			return false;
+
+	bool ok = FileListIO::saveEncryptedDataToFile(fname, data, offset);
+	free(data);
+	return ok;
+}
+
+static bool saveContainer(const std::vector<Entry>& entries, const std::string& fname, uint32_t& written, uint32_t& kept)
+{
+	FileListContainerWriter writer;
+
+	if(!writer.open(fname))
+		return false;
+
+	unsigned char *data = NULL;
+	uint32_t total_size = 0;
+
+	for(uint32_t i=0; i<entries.size(); ++i)
+	{
+		uint32_t offset = 0;
+
+		if(!serialiseEntry(entries[i], data, total_size, offset) || !writer.write(data, offset))
+		{
+			free(data);
+			return false;
+		}
+	}
+	free(data);
+
+	bool ok = writer.close();
+	written = writer.writtenChunks();
+	kept = writer.keptChunks();
+	return ok;
+}
+
+// Same as HashStorage::locked_load(): returns the number of entries read.
+
+static long loadEntries(const std::string& fname)
+{
+	FileListContainerReader reader;
+
+	if(!reader.open(fname))
+		return -1;
+
+	unsigned char *section_data = (unsigned char*)malloc(FL_BASE_TMP_SECTION_SIZE);
+	long n = 0;
+
+	for(;;)
+	{
+		uint32_t section_size = FL_BASE_TMP_SECTION_SIZE;
+		uint32_t section_offset = 0;
+		Entry e;
+
+		if(!FileListIO::readField(reader, FILE_LIST_IO_TAG_HASH_STORAGE_ENTRY, section_data, section_size))
+			break;
+
+		if(!FileListIO::readField(section_data, section_size, section_offset, FILE_LIST_IO_TAG_FILE_NAME     , e.filename  )) break;
+		if(!FileListIO::readField(section_data, section_size, section_offset, FILE_LIST_IO_TAG_FILE_SIZE     , e.size      )) break;
+		if(!FileListIO::readField(section_data, section_size, section_offset, FILE_LIST_IO_TAG_UPDATE_TS     , e.time_stamp)) break;
+		if(!FileListIO::readField(section_data, section_size, section_offset, FILE_LIST_IO_TAG_MODIF_TS      , e.modf_stamp)) break;
+		if(!FileListIO::readField(section_data, section_size, section_offset, FILE_LIST_IO_TAG_FILE_SHA1_HASH, e.hash      )) break;
+		++n;
+	}
+	free(section_data);
+
+	if(!reader.eof() || reader.failed())
+		return -1;
+
+	return n;
+}
+
+// Runs f in a child process and prints its time and the memory it added on top
+// of what the entries already use.
+
+template<class F>
+static void measure(const char *title, F f)
+{
+	std::cout.flush();
+	pid_t pid = fork();
+
+	if(pid == 0)
+	{
+		long base = procStatus("VmRSS:");
+		resetPeakRSS();
+
+		double t0 = getTS();
+		bool ok = f();
+		double t1 = getTS();
+
+		long peak = procStatus("VmHWM:");
+
+		std::cout << "  " << std::left << std::setw(40) << title << std::right
+		          << std::fixed << std::setprecision(1) << std::setw(8) << (t1-t0)*1000.0 << " ms"
+		          << std::setw(10) << (peak - base) << " kB peak" << (ok ? "" : "  FAILED") << std::endl;
+		_exit(ok ? 0 : 1);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t n_entries = (argc > 1) ? atoi(argv[1]) : 300000;
+	std::string dir = (argc > 2) ? argv[2] : "/tmp";
+
+	std::string legacy_file = dir + "/fl_bench_legacy.bin";
+	std::string container_file = dir + "/fl_bench_container.bin";
+
+	remove(legacy_file.c_str());
+	remove(container_file.c_str());
+
+	AuthSSL::instance();	// generates the key before forking
+	std::vector<Entry> entries = makeEntries(n_entries);
+
+	std::cout << n_entries << " hash cache entries" << std::endl;
+	std::cout << "Save:" << std::endl;
+
+	measure("whole buffer + AuthSSL::encrypt()", [&]() { return saveWholeBuffer(entries, legacy_file); });
+	measure("container, new file", [&]() { uint32_t w, k; return saveContainer(entries, container_file, w, k); });
+
+	std::cout << "  file sizes: " << fileSize(legacy_file) << " / " << fileSize(container_file) << " bytes" << std::endl;
+
+	std::cout << "Save again into the container:" << std::endl;
+
+	struct Resave { const char *title; void (*change)(std::vector<Entry>&); };
+	Resave resaves[] = {
+	    { "unchanged",                [](std::vector<Entry>&) {} },
+	    { "10 time stamps changed",   [](std::vector<Entry>& e) { for(uint32_t i=0; i<10; ++i) e[(i*7919u) % e.size()].time_stamp++; } },
+	    { "1000 entries appended",    [](std::vector<Entry>& e) { std::vector<Entry> more = makeEntries(1000); for(uint32_t i=0; i<more.size(); ++i) { more[i].filename += ".new"; e.push_back(more[i]); } } },
+	    { "1 entry inserted at start", [](std::vector<Entry>& e) { Entry x = e[0]; x.filename = "/a"; e.insert(e.begin(), x); } },
+	    { "10 time stamps changed",   [](std::vector<Entry>& e) { for(uint32_t i=0; i<10; ++i) e[(i*7919u) % e.size()].time_stamp++; } },
+	};
+
+	for(uint32_t r=0; r<sizeof(resaves)/sizeof(resaves[0]); ++r)
+	{
+		resaves[r].change(entries);
+
+		uint32_t written = 0, kept = 0;
+		double t0 = getTS();
+		bool ok = saveContainer(entries, container_file, written, kept);
+		double t1 = getTS();
+
+		std::cout << "  " << std::left << std::setw(40) << resaves[r].title << std::right
+		          << std::fixed << std::setprecision(1) << std::setw(8) << (t1-t0)*1000.0 << " ms"
+		          << std::setw(8) << written << " chunks written, " << kept << " kept, file " << fileSize(container_file) << " bytes"
+		          << (ok ? "" : "  FAILED") << std::endl;
+	}
+
+	std::cout << "Load:" << std::endl;
+
+	measure("legacy file through the reader", [&]() { long n = loadEntries(legacy_file); std::cout << "  (" << n << " entries)" << std::endl; return n == (long)n_entries; });
+	measure("container", [&]() { long n = loadEntries(container_file); std::cout << "  (" << n << " entries)" << std::endl; return n == (long)entries.size(); });
+
+	remove(legacy_file.c_str());
+	remove(container_file.c_str());
+
+	return 0;
+}
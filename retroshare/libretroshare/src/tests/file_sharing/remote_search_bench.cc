@@ -0,0 +1,351 @@
+/*******************************************************************************
+ * libretroshare/src/tests/file_sharing: remote_search_bench.cc                *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+/**********************************************************
+ * Source discovery and remote search over many friend lists.
+ *
+ * Synthetic file lists are built for 200 friends (by default), through
+ * the same deserialisation as the lists received from friends. File
+ * hashes are drawn from a common pool, so that popular files are found
+ * at several friends.
+ *
+ * The bench then times a source discovery pass over a set of downloads,
+ * half of which exist at some friends:
+ *  - probing every friend list for every download, as was done before
+ *    p3FileDatabase kept a cross-friend hash index,
+ *  - looking each download up in such an index, checking each entry
+ *    against the friend list, as p3FileDatabase::search() now does.
+ * and the latency of a keyword search over all friend lists, when the
+ * lists are searched one after the other and on several threads.
+ *
+ * p3FileDatabase itself needs a running node, so the lookups are done
+ * here directly on the RemoteDirectoryStorage objects.
+ */
+
+#include "file_sharing/directory_storage.h"
+#include "file_sharing/filelist_io.h"
+#include "serialiser/rstlvbinary.h"
+#include "util/rsdir.h"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <map>
+#include <set>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static const uint32_t NB_DIRS = 50;
+static const char *WORDS[] = { "live", "concert", "remix", "holiday", "lecture", "season", "chapter", "demo",
+                               "archive", "draft", "mountain", "river", "jazz", "opera", "tutorial", "linux" };
+static const uint32_t NB_WORDS = sizeof(WORDS) / sizeof(WORDS[0]);
+static const char *RARE_WORD = "kilimanjaro";
+
+static double getTS()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+struct SyntheticFile
+{
+	std::string name;
+	uint64_t size;
+	RsFileHash hash;
+};
+
+static void serialiseDir(const std::string& name, const std::vector<RsFileHash>& subdirs,
+                         const std::vector<SyntheticFile>& files, RsTlvBinaryData& bindata)
+{
+	unsigned char *data = NULL, *file_data = NULL;
+	uint32_t size = 0, offset = 0, file_size = 0;
+	uint32_t ts = 1600000000;
+
+	FileListIO::writeField(data, size, offset, FILE_LIST_IO_TAG_DIR_NAME, name);
+	FileListIO::writeField(data, size, offset, FILE_LIST_IO_TAG_RECURS_MODIF_TS, ts);
+	FileListIO::writeField(data, size, offset, FILE_LIST_IO_TAG_MODIF_TS, ts);
+	FileListIO::writeField(data, size, offset, FILE_LIST_IO_TAG_RAW_NUMBER, (uint32_t) subdirs.size());
+	FileListIO::writeField(data, size, offset, FILE_LIST_IO_TAG_RAW_NUMBER, (uint32_t) files.size());
+
+	for(uint32_t i=0; i<subdirs.size(); ++i)
+		FileListIO::writeField(data, size, offset, FILE_LIST_IO_TAG_ENTRY_INDEX, subdirs[i]);
+
+	for(uint32_t i=0; i<files.size(); ++i)
+	{
+		uint32_t file_offset = 0;
+
+		FileListIO::writeField(file_data, file_size, file_offset, FILE_LIST_IO_TAG_FILE_NAME, files[i].name);
+		FileListIO::writeField(file_data, file_size, file_offset, FILE_LIST_IO_TAG_FILE_SIZE, files[i].size);
+		FileListIO::writeField(file_data, file_size, file_offset, FILE_LIST_IO_TAG_FILE_SHA1_HASH, files[i].hash);
+		FileListIO::writeField(file_data, file_size, file_offset, FILE_LIST_IO_TAG_MODIF_TS, ts);
+
+		FileListIO::writeField(data, size, offset, FILE_LIST_IO_TAG_REMOTE_FILE_ENTRY, file_data, file_offset);
+	}
+	free(file_data);
+
+	bindata.TlvClear();
+	bindata.bin_data = data;
+	bindata.bin_len = offset;
+}
+
+static RemoteDirectoryStorage *createFriendList(const std::string& dir, uint32_t nb_files,
+                                                const std::vector<RsFileHash>& pool, unsigned short seed[3])
+{
+	RsPeerId pid = RsPeerId::random();
+	RemoteDirectoryStorage *rds = new RemoteDirectoryStorage(pid, dir + "/dirlist_" + pid.toStdString() + ".bin");
+
+	std::vector<RsFileHash> subdirs;
+	for(uint32_t d=0; d<NB_DIRS; ++d)
+		subdirs.push_back(RsFileHash::random());
+
+	RsTlvBinaryData bindata;
+	serialiseDir("", subdirs, std::vector<SyntheticFile>(), bindata);
+	rds->deserialiseUpdateDirEntry(rds->root(), bindata);
+
+	for(uint32_t d=0; d<NB_DIRS; ++d)
+	{
+		std::vector<SyntheticFile> files(nb_files / NB_DIRS);
+
+		for(uint32_t i=0; i<files.size(); ++i)
+		{
+			std::string name = std::string(WORDS[nrand48(seed) % NB_WORDS]) + " " + WORDS[nrand48(seed) % NB_WORDS];
+			if(nrand48(seed) % 1000 == 0)
+				name += std::string(" ") + RARE_WORD;
+
+			files[i].name = name + " " + std::to_string(nrand48(seed) % 100000) + ".mkv";
+			files[i].size = 1000000 + nrand48(seed);
+			files[i].hash = pool[nrand48(seed) % pool.size()];
+		}
+
+		DirectoryStorage::EntryIndex e;
+		if(!rds->getIndexFromDirHash(subdirs[d], e))
+		{
+			std::cerr << "Cannot find synthetic directory " << subdirs[d] << std::endl;
+			exit(1);
+		}
+
+		serialiseDir("dir " + std::to_string(d), std::vector<RsFileHash>(), files, bindata);
+		rds->deserialiseUpdateDirEntry(e, bindata);
+	}
+	return rds;
+}
+
+/* Same structure as p3FileDatabase::mRemoteHashIndex */
+struct IndexEntry
+{
+	uint32_t friend_index;
+	DirectoryStorage::EntryIndex index;
+};
+
+static void searchTerms(const std::vector<RemoteDirectoryStorage*>& lists, const std::list<std::string>& terms,
+                        uint32_t nb_threads, std::vector<std::list<DirectoryStorage::EntryIndex> >& results)
+{
+	std::atomic<uint32_t> next(0);
+
+	auto worker = [&]()
+	{
+		for(uint32_t i; (i = next++) < lists.size(); )
+			lists[i]->searchTerms(terms, results[i]);
+	};
+
+	std::vector<std::thread> threads;
+	for(uint32_t i=1; i<nb_threads; ++i)
+		threads.push_back(std::thread(worker));
+
+	worker();
+
+	for(auto& t:threads)
+		t.join();
+}
+
+static void usage(char *name)
+{
+	std::cerr << "Usage: " << name << " [-f <friends>] [-n <files>] [-l <downloads>] [-r <threads>] [-d <dir>]" << std::endl;
+	std::cerr << "\t-f : number of friend lists (default 200)" << std::endl;
+	std::cerr << "\t-n : number of files per friend (default 5000)" << std::endl;
+	std::cerr << "\t-l : number of downloads looked up in each pass (default 2000)" << std::endl;
+	std::cerr << "\t-r : number of threads for the parallel keyword search (default 4)" << std::endl;
+	std::cerr << "\t-d : directory where friend lists would be saved (default .)" << std::endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t nb_friends = 200;
+	uint32_t nb_files = 5000;
+	uint32_t nb_downloads = 2000;
+	uint32_t nb_threads = 4;
+	std::string dir = ".";
+	int c;
+
+	while(-1 != (c = getopt(argc, argv, "f:n:l:r:d:")))
+	{
+		switch (c)
+		{
+			case 'f':
+				nb_friends = atoi(optarg);
+				break;
+			case 'n':
+				nb_files = atoi(optarg);
+				break;
+			case 'l':
+				nb_downloads = atoi(optarg);
+				break;
+			case 'r':
+				nb_threads = atoi(optarg);
+				break;
+			case 'd':
+				dir = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	unsigned short seed[3] = { 1, 2, 3 };
+
+	/* each file of the pool is shared by 4 friends on average */
+	std::vector<RsFileHash> pool(std::max(1u, nb_friends * nb_files / 4));
+	for(auto& h:pool)
+		h = RsFileHash::random();
+
+	double t = getTS();
+	std::vector<RemoteDirectoryStorage*> lists;
+	for(uint32_t f=0; f<nb_friends; ++f)
+		lists.push_back(createFriendList(dir, nb_files, pool, seed));
+	std::cout << nb_friends << " friend lists of " << nb_files << " files built in " << getTS() - t << " secs" << std::endl;
+
+	std::vector<RsFileHash> downloads;
+	for(uint32_t i=0; i<nb_downloads; ++i)
+		downloads.push_back((i % 2) ? pool[nrand48(seed) % pool.size()] : RsFileHash::random());
+
+	/* source discovery, probing every friend list */
+
+	std::vector<std::set<uint32_t> > probe_sources(nb_downloads);
+	t = getTS();
+	for(uint32_t i=0; i<nb_downloads; ++i)
+		for(uint32_t f=0; f<nb_friends; ++f)
+		{
+			DirectoryStorage::EntryIndex e;
+			if(lists[f]->searchHash(downloads[i], e))
+				probe_sources[i].insert(f);
+		}
+	double probe_time = getTS() - t;
+
+	/* source discovery with the cross-friend index */
+
+	t = getTS();
+	std::map<RsFileHash, std::vector<IndexEntry> > index;
+	for(uint32_t f=0; f<nb_friends; ++f)
+	{
+		std::vector<std::pair<RsFileHash, DirectoryStorage::EntryIndex> > hashes;
+		lists[f]->getFileHashes(DirectoryStorage::NO_INDEX, hashes);
+
+		for(auto& h:hashes)
+		{
+			std::vector<IndexEntry>& entries(index[h.first]);
+
+			if(entries.empty() || entries.back().friend_index != f)
+				entries.push_back(IndexEntry{ f, h.second });
+			else
+				entries.back().index = h.second;
+		}
+	}
+	double index_build_time = getTS() - t;
+
+	std::vector<std::set<uint32_t> > index_sources(nb_downloads);
+	t = getTS();
+	for(uint32_t i=0; i<nb_downloads; ++i)
+	{
+		auto it = index.find(downloads[i]);
+		if(it == index.end())
+			continue;
+
+		for(auto& e:it->second)
+			if(lists[e.friend_index]->checkFileHash(e.index, downloads[i]))
+				index_sources[i].insert(e.friend_index);
+	}
+	double index_time = getTS() - t;
+
+	uint64_t nb_sources = 0;
+	for(auto& s:probe_sources)
+		nb_sources += s.size();
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Source discovery over " << nb_downloads << " downloads (" << nb_sources << " sources found):" << std::endl;
+	std::cout << "  probing every friend list : " << probe_time * 1000 << " ms" << std::endl;
+	std::cout << "  cross-friend hash index   : " << index_time * 1000 << " ms (index of " << index.size()
+	          << " hashes built in " << index_build_time * 1000 << " ms)" << std::endl;
+
+	bool ok = (probe_sources == index_sources);
+	if(!ok)
+		std::cerr << "Sources found with the index differ from the ones found by probing!" << std::endl;
+
+	/* keyword search over all friend lists */
+
+	const std::list<std::string> queries[] = { { RARE_WORD }, { "opera" }, { "jazz", "linux" } };
+
+	std::cout << "Keyword search over " << nb_friends << " friend lists:" << std::endl;
+	for(auto& q:queries)
+	{
+		double times[2];
+		uint64_t counts[2];
+
+		for(int p=0; p<2; ++p)
+		{
+			double best = 1e9;
+			for(int run=0; run<5; ++run)
+			{
+				std::vector<std::list<DirectoryStorage::EntryIndex> > results(nb_friends);
+
+				t = getTS();
+				searchTerms(lists, q, (p == 0) ? 1 : nb_threads, results);
+				best = std::min(best, getTS() - t);
+
+				counts[p] = 0;
+				for(auto& r:results)
+					counts[p] += r.size();
+			}
+			times[p] = best;
+		}
+
+		std::string qs;
+		for(auto& w:q)
+			qs += (qs.empty() ? "" : " ") + w;
+
+		std::cout << "  \"" << qs << "\": " << counts[0] << " results, sequential " << times[0] * 1000 << " ms, "
+		          << nb_threads << " threads " << times[1] * 1000 << " ms" << std::endl;
+
+		ok = ok && (counts[0] == counts[1]);
+	}
+
+	for(auto l:lists)
+		delete l;
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,241 @@
+/*******************************************************************************
+ * libretroshare/src/tests/ft: chunkcheck_bench.cc                             *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+/**********************************************************
+ * Chunk checking and final hashing of a large download.
+ *
+ * A file is downloaded from a single source at a fixed rate (100MB/s by
+ * default, about a saturated gigabit link). Each 1MB chunk is checked
+ * against its sum as soon as it is complete, then the whole file is
+ * hashed, as ftTransferModule does before declaring the download complete.
+ *
+ * Two ways are compared:
+ *  - inline: chunks are checked on the thread that writes the data, and
+ *    the final hash reads the whole file again (as before ftChecksumPool),
+ *  - pool:   chunks are checked by ftChecksumPool, and the final hash only
+ *    reads what follows the chunks already checked at the start of the file.
+ *
+ * Reports the time spent downloading, and the finalisation time: from the
+ * last data written until the file hash is known.
+ */
+
+#include "ft/ftfilecreator.h"
+#include "ft/ftchecksumpool.h"
+#include "util/rsdir.h"
+#include "util/rsdiscspace.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <openssl/sha.h>
+
+static const uint32_t CS = ChunkMap::CHUNKMAP_FIXED_CHUNK_SIZE;
+
+static double getTS()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* content of a chunk, cheap to generate again */
+static uint32_t fillChunk(uint32_t chunk, uint64_t fileSize, unsigned char *buf)
+{
+	uint64_t *w = (uint64_t *) buf;
+	for(uint32_t i = 0; i < CS / 8; i++)
+		w[i] = (chunk + 1) * 0x9E3779B97F4A7C15ull ^ (i * 0xBF58476D1CE4E5B9ull);
+
+	uint64_t left = fileSize - (uint64_t) chunk * CS;
+	return (left < CS) ? left : CS;
+}
+
+struct RunResult
+{
+	double download;
+	double finalise;
+	bool ok;
+};
+
+static RunResult runDownload(const std::string& path, uint64_t fileSize, double rate, FileChunksInfo::ChunkStrategy s,
+		bool usePool, const std::vector<Sha1CheckSum>& sums, const RsFileHash& fileHash)
+{
+	RunResult res;
+	res.ok = true;
+
+	remove(path.c_str());
+
+	ftFileCreator fc(path, fileSize, fileHash, true);
+	fc.setChunkStrategy(s);
+
+	ftChecksumPool pool;
+	RsPeerId source = RsPeerId::random();
+	std::vector<unsigned char> buf(CS);
+	std::vector<uint32_t> toCheck;
+	uint64_t offset;
+	uint32_t size;
+	bool mapNeeded;
+
+	double start = getTS();
+	uint64_t received = 0;
+
+	while(fc.getMissingChunk(source, CS, offset, size, mapNeeded))
+	{
+		/* the source does not send faster than the link rate */
+		double late = received / rate - (getTS() - start);
+		if (late > 0)
+			usleep(late * 1000000);
+		received += size;
+
+		/* slices of 1MB are whole chunks */
+		fillChunk(offset / CS, fileSize, buf.data());
+		fc.addFileData(offset, size, buf.data());
+
+		fc.getChunksToCheck(toCheck);
+
+		for(uint32_t i = 0; i < toCheck.size(); i++)
+		{
+			uint32_t c = toCheck[i];
+			if (usePool)
+				pool.addJob(fileHash, [&fc, &sums, c]() { fc.verifyChunk(c, sums[c]); });
+			else
+				fc.verifyChunk(c, sums[c]);
+		}
+	}
+
+	double end = getTS();
+	res.download = end - start;
+
+	while(!fc.finished())
+	{
+		if (pool.pendingJobs() == 0 && !fc.finished())
+		{
+			std::cerr << "chunkcheck_bench: some chunks failed their check" << std::endl;
+			res.ok = false;
+			break;
+		}
+		usleep(1000);
+	}
+
+	RsFileHash h;
+	uint64_t tmpsize;
+
+	if (usePool)
+		res.ok = res.ok && fc.hashReceivedData(h);
+	else
+		res.ok = res.ok && RsDirUtil::getFileHash(path, h, tmpsize);
+
+	res.finalise = getTS() - end;
+	res.ok = res.ok && (h == fileHash);
+
+	fc.closeFile();
+	remove(path.c_str());
+	return res;
+}
+
+static void usage(char *name)
+{
+	std::cerr << "Usage: " << name << " [-f <GB>] [-r <MB/s>] [-d <dir>]" << std::endl;
+	std::cerr << "\t-f : file size in GB (default 20)" << std::endl;
+	std::cerr << "\t-r : download rate in MB/s (default 100)" << std::endl;
+	std::cerr << "\t-d : directory of the downloaded file (default /tmp)" << std::endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	double gb = 20;
+	double rate = 100;
+	std::string dir = "/tmp";
+	int c;
+
+	while(-1 != (c = getopt(argc, argv, "f:r:d:")))
+	{
+		switch (c)
+		{
+			case 'f':
+				gb = atof(optarg);
+				break;
+			case 'r':
+				rate = atof(optarg);
+				break;
+			case 'd':
+				dir = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+	uint64_t fileSize = gb * 1024 * 1024 * 1024;
+	if (fileSize < CS || rate <= 0)
+		usage(argv[0]);
+
+	RsDiscSpace::setPartialsPath(dir);
+	std::string path = dir + "/chunkcheck_bench.tmp";
+
+	/* sums the source would give */
+	uint32_t nChunks = ChunkMap::getNumberOfChunks(fileSize);
+	std::vector<Sha1CheckSum> sums(nChunks);
+	std::vector<unsigned char> buf(CS);
+	SHA_CTX ctx;
+	SHA1_Init(&ctx);
+
+	for(uint32_t i = 0; i < nChunks; i++)
+	{
+		uint32_t len = fillChunk(i, fileSize, buf.data());
+		sums[i] = RsDirUtil::sha1sum(buf.data(), len);
+		SHA1_Update(&ctx, buf.data(), len);
+	}
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	SHA1_Final(digest, &ctx);
+	RsFileHash fileHash(digest);
+
+	const FileChunksInfo::ChunkStrategy strategies[] = {
+		FileChunksInfo::CHUNK_STRATEGY_STREAMING,
+		FileChunksInfo::CHUNK_STRATEGY_PROGRESSIVE,
+		FileChunksInfo::CHUNK_STRATEGY_RANDOM };
+	const char *names[] = { "streaming", "progressive", "random" };
+	bool ok = true;
+
+	std::cout << "file: " << gb << " GB, " << nChunks << " chunks, " << rate << " MB/s" << std::endl;
+	std::cout << "strategy     checks  download(s)  finalise(s)  hash" << std::endl;
+	for(int i = 0; i < 3; i++)
+	{
+		for(int p = 0; p < 2; p++)
+		{
+			RunResult r = runDownload(path, fileSize, rate * 1024 * 1024, strategies[i], p == 1, sums, fileHash);
+
+			std::cout << std::left << std::setw(13) << names[i] << std::setw(7) << (p ? "pool" : "inline");
+			std::cout << std::right << std::fixed << std::setprecision(1);
+			std::cout << std::setw(12) << r.download << std::setw(13) << r.finalise;
+			std::cout << "  " << (r.ok ? "OK" : "WRONG") << std::endl;
+			std::cout.unsetf(std::ios::fixed);
+
+			ok = ok && r.ok;
+		}
+	}
+	return ok ? 0 : 1;
+}
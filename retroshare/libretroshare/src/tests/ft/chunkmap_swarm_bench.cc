@@ -0,0 +1,311 @@
+/*******************************************************************************
+ * libretroshare/src/tests/ft: chunkmap_swarm_bench.cc                         *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+/**********************************************************
+ * Swarm download simulation for ChunkMap.
+ *
+ * A file is downloaded from several sources of different speeds. One
+ * source has the complete file but leaves after a while. The others
+ * only have a random part of it and stay. Requests are issued once per
+ * simulated second, the way ftTransferModule and ftFileCreator do it,
+ * and every source sends its requested slices in order at its own rate.
+ *
+ * For each chunk strategy, reports how many runs completed, the average
+ * and worst completion time, the average fraction of the file obtained,
+ * and the bytes received twice because of endgame duplication.
+ *
+ * ChunkMap takes its time from time(). The simulation provides its own
+ * time() below, so that it runs much faster than real time.
+ */
+
+#include "ft/ftchunkmap.h"
+
+#include <iostream>
+#include <iomanip>
+#include <deque>
+#include <map>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static time_t simTime = 1000000;
+
+extern "C" time_t time(time_t *t) noexcept
+{
+	if (t)
+		*t = simTime;
+	return simTime;
+}
+
+static const uint32_t MAX_SLICES_PER_SOURCE = 20;	/* as MAX_FTCHUNKS_PER_PEER */
+static const rstime_t SLICE_MAX_AGE = 120;		/* as CHUNK_MAX_AGE */
+static const rstime_t MAX_SIM_TIME = 4 * 3600;
+
+struct Source
+{
+	RsPeerId id;
+	uint32_t rate;
+	rstime_t leaveTime;
+	bool online;
+	CompressedChunkMap cmap;
+	std::deque<std::pair<uint64_t, uint32_t> > requests;
+	uint32_t sentInFirst;
+	uint32_t nbRequested;
+};
+
+struct RunResult
+{
+	bool complete;
+	double time;
+	double obtained;
+	double duplicated;
+};
+
+static RunResult runSwarm(FileChunksInfo::ChunkStrategy strategy, uint64_t fileSize,
+		uint32_t nSources, double partial, rstime_t seedTime, uint32_t seed)
+{
+	srand48(seed);
+	srand(seed);
+
+	uint32_t nChunks = ChunkMap::getNumberOfChunks(fileSize);
+	ChunkMap cmap(fileSize, false);
+	cmap.setStrategy(strategy);
+
+	std::vector<Source> sources(nSources);
+	for(uint32_t i = 0; i < nSources; i++)
+	{
+		Source& s = sources[i];
+		s.id = RsPeerId::random();
+		s.rate = 50000 * pow(20, drand48());	/* 50 kB/s to 1 MB/s */
+		s.leaveTime = simTime + MAX_SIM_TIME;
+		s.online = true;
+		s.sentInFirst = 0;
+		s.nbRequested = 0;
+		s.cmap = CompressedChunkMap(nChunks, 0);
+
+		if (i == 0)
+		{
+			/* the seed */
+			s.rate = 200000;
+			s.leaveTime = simTime + seedTime;
+			s.cmap = CompressedChunkMap(nChunks, ~uint32_t(0));
+		}
+		else
+		{
+			for(uint32_t c = 0; c < nChunks; c++)
+				if (drand48() < partial)
+					s.cmap.set(c);
+		}
+		cmap.setPeerAvailabilityMap(s.id, s.cmap);
+	}
+
+	std::map<uint64_t, rstime_t> pending;	/* slice offset => last request time */
+	uint64_t received = 0, duplicated = 0;
+	rstime_t start = simTime;
+	RunResult res;
+
+	while(!cmap.isComplete() && simTime - start < MAX_SIM_TIME)
+	{
+		++simTime;
+
+		for(uint32_t i = 0; i < nSources; i++)
+		{
+			Source& s = sources[i];
+
+			if (!s.online)
+				continue;
+
+			if (simTime > s.leaveTime)
+			{
+				cmap.removeFileSource(s.id);
+				s.requests.clear();
+				s.online = false;
+				continue;
+			}
+
+			/* requests, as ftTransferModule::locked_tickPeerTransfer() */
+			uint32_t next_req = s.rate;
+			while(next_req > 0 && s.requests.size() < MAX_SLICES_PER_SOURCE)
+			{
+				uint64_t offset = 0;
+				uint32_t size = 0;
+				bool needed = false;
+				bool found = false;
+
+				/* as ftFileCreator::getMissingChunk() */
+				for(std::map<uint64_t, rstime_t>::iterator it = pending.begin(); it != pending.end(); ++it)
+					if (it->second + SLICE_MAX_AGE < simTime && s.cmap[it->first / ChunkMap::CHUNKMAP_FIXED_CHUNK_SIZE])
+					{
+						it->second = simTime;
+						offset = it->first;
+						size = std::min((uint64_t) next_req, fileSize - offset);
+						found = true;
+						break;
+					}
+
+				ftChunk chunk;
+				if (!found && cmap.getDataChunk(s.id, next_req, chunk, needed))
+				{
+					offset = chunk.offset;
+					size = chunk.size;
+					pending[offset] = simTime;
+					found = true;
+				}
+				if (!found && cmap.reAskPendingChunk(s.id, next_req, offset, size))
+					found = true;
+
+				if (!found || size == 0)
+					break;
+
+				s.requests.push_back(std::make_pair(offset, size));
+				s.nbRequested++;
+				next_req -= std::min(size, next_req);
+			}
+
+			/* the source sends its slices in order */
+			uint32_t budget = s.rate;
+			while(budget > 0 && !s.requests.empty())
+			{
+				std::pair<uint64_t, uint32_t>& r = s.requests.front();
+				uint32_t n = std::min(budget, r.second - s.sentInFirst);
+
+				budget -= n;
+				s.sentInFirst += n;
+
+				if (s.sentInFirst < r.second)
+					break;
+
+				std::map<uint64_t, rstime_t>::iterator it = pending.find(r.first);
+				if (it != pending.end())
+				{
+					pending.erase(it);
+					cmap.dataReceived(r.first);
+					received += r.second;
+				}
+				else
+					duplicated += r.second;
+
+				s.requests.pop_front();
+				s.sentInFirst = 0;
+			}
+		}
+
+		std::vector<uint32_t> to_check;
+		cmap.getChunksToCheck(to_check);
+		for(uint32_t i = 0; i < to_check.size(); i++)
+			cmap.setChunkCheckingResult(to_check[i], true);
+	}
+
+	res.complete = cmap.isComplete();
+	res.time = simTime - start;
+	res.obtained = received / (double) fileSize;
+	res.duplicated = duplicated / (double) fileSize;
+	return res;
+}
+
+static void usage(char *name)
+{
+	std::cerr << "Usage: " << name << " [-f <MB>] [-s <sources>] [-p <fraction>] [-t <secs>] [-r <runs>]" << std::endl;
+	std::cerr << "\t-f : file size (default 100 MB)" << std::endl;
+	std::cerr << "\t-s : number of sources, the seed included (default 8)" << std::endl;
+	std::cerr << "\t-p : fraction of the file each partial source has (default 0.4)" << std::endl;
+	std::cerr << "\t-t : time after which the seed leaves (default 120 secs)" << std::endl;
+	std::cerr << "\t-r : number of runs per strategy (default 20)" << std::endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t fileSize = 100 * 1024 * 1024;
+	uint32_t nSources = 8;
+	double partial = 0.4;
+	rstime_t seedTime = 120;
+	uint32_t nRuns = 20;
+	int c;
+
+	while(-1 != (c = getopt(argc, argv, "f:s:p:t:r:")))
+	{
+		switch (c)
+		{
+			case 'f':
+				fileSize = atof(optarg) * 1024 * 1024;
+				break;
+			case 's':
+				nSources = atoi(optarg);
+				break;
+			case 'p':
+				partial = atof(optarg);
+				break;
+			case 't':
+				seedTime = atoi(optarg);
+				break;
+			case 'r':
+				nRuns = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+	if (nSources < 1 || nRuns < 1 || fileSize == 0)
+		usage(argv[0]);
+
+	const FileChunksInfo::ChunkStrategy strategies[] = {
+		FileChunksInfo::CHUNK_STRATEGY_STREAMING,
+		FileChunksInfo::CHUNK_STRATEGY_PROGRESSIVE,
+		FileChunksInfo::CHUNK_STRATEGY_RANDOM };
+	const char *names[] = { "streaming", "progressive", "random" };
+
+	std::cout << "strategy     complete  avg time(s)  max time(s)  obtained  duplicated" << std::endl;
+	for(int i = 0; i < 3; i++)
+	{
+		uint32_t complete = 0;
+		double sumTime = 0, maxTime = 0, obtained = 0, duplicated = 0;
+
+		for(uint32_t r = 0; r < nRuns; r++)
+		{
+			RunResult res = runSwarm(strategies[i], fileSize, nSources, partial, seedTime, r + 1);
+
+			obtained += res.obtained;
+			duplicated += res.duplicated;
+			if (res.complete)
+			{
+				complete++;
+				sumTime += res.time;
+				maxTime = std::max(maxTime, res.time);
+			}
+		}
+
+		std::cout << std::left << std::setw(13) << names[i] << std::right;
+		std::cout << std::setw(4) << complete << "/" << std::left << std::setw(4) << nRuns << std::right;
+		std::cout << std::fixed << std::setprecision(1);
+		if (complete > 0)
+			std::cout << std::setw(13) << sumTime / complete << std::setw(13) << maxTime;
+		else
+			std::cout << std::setw(13) << "-" << std::setw(13) << "-";
+		std::cout << std::setw(9) << 100 * obtained / nRuns << "%";
+		std::cout << std::setw(11) << 100 * duplicated / nRuns << "%" << std::endl;
+		std::cout.unsetf(std::ios::fixed);
+	}
+	return 0;
+}
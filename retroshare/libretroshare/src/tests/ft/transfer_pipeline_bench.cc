@@ -0,0 +1,273 @@
+/*******************************************************************************
+ * libretroshare/src/tests/ft: transfer_pipeline_bench.cc                      *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+
+/**********************************************************
+ * Single source download over an emulated LAN link.
+ *
+ * ftTransferModule sends its data requests to an emulated source, that
+ * answers each of them with 8kB packets (as ftServer does) through a link
+ * with a fixed rate and round trip time. Data packets are given back to the
+ * transfer module as they arrive, and the module is ticked every second,
+ * like ftController does.
+ *
+ * Reports the goodput over the whole run and over its second half, the
+ * time taken to reach 90% of the achievable rate, and the number of data
+ * requests sent.
+ */
+
+#include "ft/ftdatamultiplex.h"
+#include "ft/ftfilecreator.h"
+#include "ft/fttransfermodule.h"
+#include "util/rsdiscspace.h"
+
+#include <iostream>
+#include <iomanip>
+#include <deque>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static const uint32_t PACKET_SIZE = 8 * 1024;
+static const double   STANDARD_RATE = 10 * 1024 * 1024;	/* what ftController gives each source */
+
+static double getTS()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+class EmulatedSource: public ftDataSend
+{
+	public:
+	EmulatedSource(double rate, double rtt)
+	:mRate(rate), mDelay(rtt / 2), mLinkFree(0), mRequests(0) { return; }
+
+	/* requests reach the source after half a rtt, then the data is sent
+	 * packet after packet at the link rate.
+	 */
+virtual bool sendDataRequest(const RsPeerId& /*peerId*/, const RsFileHash& /*hash*/, uint64_t /*size*/, uint64_t offset, uint32_t chunksize)
+	{
+		double t = getTS() + mDelay;
+		mRequests++;
+
+		if (mLinkFree < t)
+			mLinkFree = t;
+
+		for(uint32_t done = 0; done < chunksize; done += PACKET_SIZE)
+		{
+			Pkt p;
+			p.offset = offset + done;
+			p.size = std::min(PACKET_SIZE, chunksize - done);
+
+			mLinkFree += p.size / mRate;
+			p.ts = mLinkFree + mDelay;
+			mQueue.push_back(p);
+		}
+		return true;
+	}
+
+virtual bool sendData(const RsPeerId&, const RsFileHash&, uint64_t, uint64_t, uint32_t, void *) { return true; }
+virtual bool sendChunkMapRequest(const RsPeerId&, const RsFileHash&, bool) { return true; }
+virtual bool sendChunkMap(const RsPeerId&, const RsFileHash&, const CompressedChunkMap&, bool) { return true; }
+virtual bool sendSingleChunkCRCRequest(const RsPeerId&, const RsFileHash&, uint32_t) { return true; }
+virtual bool sendSingleChunkCRC(const RsPeerId&, const RsFileHash&, uint32_t, const Sha1CheckSum&) { return true; }
+
+	/* the transfer module may send new requests from recvFileData() */
+uint64_t deliver(double now, ftTransferModule *tm, const RsPeerId& peerId, const RsSharedBuffer& data)
+	{
+		uint64_t received = 0;
+
+		while((!mQueue.empty()) && (mQueue.front().ts <= now))
+		{
+			Pkt p = mQueue.front();
+			mQueue.pop_front();
+
+			tm->recvFileData(peerId, p.offset, p.size, data);
+			received += p.size;
+		}
+		return received;
+	}
+
+	private:
+	struct Pkt
+	{
+		double ts;
+		uint64_t offset;
+		uint32_t size;
+	};
+
+	double mRate, mDelay;
+	double mLinkFree;
+	std::deque<Pkt> mQueue;
+
+	public:
+	uint32_t mRequests;
+};
+
+struct RunResult
+{
+	double goodput;		/* bytes / sec, whole run */
+	double steady;		/* bytes / sec, second half */
+	double rampUp;		/* secs until 90% of the achievable rate, -1 if never */
+	uint32_t requests;
+};
+
+static RunResult runDownload(const std::string& path, double rate, double rtt, double cap, double period)
+{
+	RunResult res;
+	remove(path.c_str());
+
+	/* larger than what can be downloaded during the run */
+	uint64_t fileSize = (uint64_t) (rate * period * 2);
+
+	ftFileCreator *fc = new ftFileCreator(path, fileSize, RsFileHash::random(), true);
+	EmulatedSource source(rate, rtt);
+	ftDataMultiplex mplex(RsPeerId::random(), &source, NULL);
+	ftTransferModule *tm = new ftTransferModule(fc, &mplex, NULL);
+
+	RsPeerId peerId = RsPeerId::random();
+	tm->addFileSource(peerId);
+	tm->setPeerState(peerId, PQIPEER_IDLE, cap);
+
+	static uint8_t buf[PACKET_SIZE];
+	RsSharedBuffer data(buf, [](uint8_t *) {});
+
+	double target = 0.9 * std::min(rate, cap);
+	uint64_t received = 0, receivedHalf = 0;
+	uint64_t windowStart = 0;
+	double windowTS = 0;
+
+	res.rampUp = -1;
+
+	double start = getTS();
+	double nextTick = start;
+	double now = start;
+
+	while(now - start < period)
+	{
+		if (now >= nextTick)
+		{
+			tm->tick();
+			nextTick += 1.0;
+		}
+
+		received += source.deliver(now, tm, peerId, data);
+
+		/* rate over 1 sec windows, for the ramp up */
+		if (now - windowTS >= 1.0)
+		{
+			if ((res.rampUp < 0) && (windowTS > 0) && ((received - windowStart) / (now - windowTS) >= target))
+				res.rampUp = windowTS - start;
+			windowStart = received;
+			windowTS = now;
+		}
+		if (now - start < period / 2)
+			receivedHalf = received;
+
+		usleep(100);
+		now = getTS();
+	}
+
+	res.goodput = received / (now - start);
+	res.steady = (received - receivedHalf) / (period / 2);
+	res.requests = source.mRequests;
+
+	delete tm;
+	delete fc;
+	remove(path.c_str());
+	return res;
+}
+
+static void usage(char *name)
+{
+	std::cerr << "Usage: " << name << " [-r <ms>] [-t <secs>] [-d <dir>]" << std::endl;
+	std::cerr << "\t-r : round trip time, including the time taken by the source to answer (default 2 ms)" << std::endl;
+	std::cerr << "\t-t : duration of each download (default 10 secs)" << std::endl;
+	std::cerr << "\t-d : directory of the downloaded file (default /tmp)" << std::endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	double rtt = 0.002;
+	double period = 10;
+	std::string dir = "/tmp";
+	int c;
+
+	while(-1 != (c = getopt(argc, argv, "r:t:d:")))
+	{
+		switch (c)
+		{
+			case 'r':
+				rtt = atof(optarg) / 1000;
+				break;
+			case 't':
+				period = atof(optarg);
+				break;
+			case 'd':
+				dir = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+	if ((rtt <= 0) || (period <= 0))
+		usage(argv[0]);
+
+	RsDiscSpace::setPartialsPath(dir);
+	std::string path = dir + "/transfer_pipeline_bench.tmp";
+
+	/* 100 Mbit/s and 1 Gbit/s links, with the rate ftController gives a
+	 * source, and with no limit.
+	 */
+	const double rates[] = { 12.5e6, 125e6 };
+	const double caps[] = { STANDARD_RATE, 4e9 };	/* setPeerState() takes 32 bits */
+
+	std::cout << "link(MB/s)  cap(MB/s)  goodput(MB/s)  2nd half(MB/s)  90% after(s)  requests" << std::endl;
+	for(int i = 0; i < 2; i++)
+	{
+		for(int j = 0; j < 2; j++)
+		{
+			RunResult r = runDownload(path, rates[i], rtt, caps[j], period);
+
+			std::cout << std::fixed << std::setprecision(1);
+			std::cout << std::setw(10) << rates[i] / 1e6;
+			if (caps[j] < 1e9)
+				std::cout << std::setw(11) << caps[j] / 1e6;
+			else
+				std::cout << std::setw(11) << "none";
+			std::cout << std::setw(15) << r.goodput / 1e6;
+			std::cout << std::setw(16) << r.steady / 1e6;
+			if (r.rampUp < 0)
+				std::cout << std::setw(14) << "never";
+			else
+				std::cout << std::setw(14) << r.rampUp;
+			std::cout << std::setw(10) << r.requests << std::endl;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,269 @@
+/*******************************************************************************
+ * libretroshare/src/tests/gxs/data_service: concurrent_reads_bench.cc         *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+
+/**********************************************************
+ * Mixed read / write load on a large GXS store.
+ *
+ * A store of 1M forum messages (by default) is spread over 100 groups.
+ * One thread keeps storing new messages by batches of 100 and marking
+ * random messages as read, as synchronisation and the GUI do, while
+ * several threads keep reading batches of 10 random messages. The number
+ * of messages read and written per second is reported, as well as the
+ * mean and the longest time taken by a read.
+ *
+ * By default the store uses a single connection. With -w it uses WAL
+ * journaling and a pool of reader connections. The journal mode is kept
+ * in the database file, so run the default mode first, or on a copy.
+ */
+
+#include "gxs/rsdataservice.h"
+#include "retroshare/rsgxsflags.h"
+#include "rsitems/rsserviceids.h"
+#include "util/rsdir.h"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static const uint32_t NB_GROUPS   = 100;
+static const uint32_t WRITE_BATCH = 100;
+static const uint32_t READ_BATCH  = 10;
+static const std::string BODY(300, 'x');
+
+static double getTS()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static RsGxsGroupId groupId(uint32_t g)
+{
+	RsGxsGroupId id;
+	id.asByteArray()[0] = 1 + g;
+	return id;
+}
+
+static RsNxsMsg *createMsg(const RsGxsGroupId& grpId, rstime_t ts)
+{
+	RsNxsMsg *msg = new RsNxsMsg(RS_SERVICE_GXS_TYPE_FORUMS);
+	RsGxsMsgMetaData *meta = new RsGxsMsgMetaData();
+
+	meta->mGroupId = grpId;
+	meta->mMsgId = RsGxsMessageId::random();
+	meta->mPublishTs = ts;
+	meta->mMsgName = "forum post";
+
+	msg->grpId = grpId;
+	msg->msgId = meta->mMsgId;
+	msg->msg.setBinData(BODY.data(), BODY.size());
+	msg->metaData = meta;
+
+	return msg;
+}
+
+static void createStore(RsDataService& ds, uint32_t nb_msgs)
+{
+	for(uint32_t g=0; g<NB_GROUPS; ++g)
+	{
+		uint32_t n = nb_msgs / NB_GROUPS;
+
+		for(uint32_t i=0; i<n; )
+		{
+			std::list<RsNxsMsg*> msgs;
+
+			for(uint32_t k=0; k<10000 && i<n; ++k,++i)
+				msgs.push_back(createMsg(groupId(g), 1500000000 + i));
+
+			ds.storeMessage(msgs);
+		}
+	}
+	std::cerr << NB_GROUPS << " groups of " << nb_msgs / NB_GROUPS << " messages created" << std::endl;
+}
+
+static void usage(char *name)
+{
+	std::cerr << "Usage: " << name << " [-c] [-w] [-n <msgs>] [-r <threads>] [-t <secs>] [-d <dir>]" << std::endl;
+	std::cerr << "\t-c : create the store" << std::endl;
+	std::cerr << "\t-w : WAL journaling and concurrent readers" << std::endl;
+	std::cerr << "\t-n : number of messages in the created store (default 1000000)" << std::endl;
+	std::cerr << "\t-r : number of reading threads (default 4)" << std::endl;
+	std::cerr << "\t-t : duration of the run (default 30 secs)" << std::endl;
+	std::cerr << "\t-d : directory of the store (default .)" << std::endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	bool create = false, wal = false;
+	uint32_t nb_msgs = 1000000;
+	uint32_t nb_readers = 4;
+	double period = 30;
+	std::string dir = ".";
+	int c;
+
+	while(-1 != (c = getopt(argc, argv, "cwn:r:t:d:")))
+	{
+		switch (c)
+		{
+			case 'c':
+				create = true;
+				break;
+			case 'w':
+				wal = true;
+				break;
+			case 'n':
+				nb_msgs = atoi(optarg);
+				break;
+			case 'r':
+				nb_readers = atoi(optarg);
+				break;
+			case 't':
+				period = atof(optarg);
+				break;
+			case 'd':
+				dir = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	RsDataServiceStorageOptions storage;
+	if(wal)
+		storage = RsDataServiceStorageOptions::concurrent();
+
+	RsDataService ds(dir, "concurrent_reads_bench_store", RS_SERVICE_GXS_TYPE_FORUMS, NULL, "", storage);
+
+	if(create)
+	{
+		createStore(ds, nb_msgs);
+		return 0;
+	}
+
+	std::vector<std::vector<RsGxsMessageId> > ids(NB_GROUPS);
+	for(uint32_t g=0; g<NB_GROUPS; ++g)
+	{
+		RsGxsMessageId::std_set s;
+		ds.retrieveMsgIds(groupId(g), s);
+		ids[g].assign(s.begin(), s.end());
+
+		if(ids[g].empty())
+		{
+			std::cerr << "Group " << g << " is empty. Create the store with -c first." << std::endl;
+			return 1;
+		}
+	}
+
+	std::atomic<bool> stop(false);
+	std::atomic<uint64_t> read(0), reads(0), written(0), updated(0);
+	std::vector<double> max_read(nb_readers, 0), total_read(nb_readers, 0);
+	std::vector<std::thread> readers;
+
+	for(uint32_t r=0; r<nb_readers; ++r)
+		readers.push_back(std::thread([&,r]()
+		{
+			unsigned short seed[3] = { (unsigned short) (r + 1), 0, 0 };
+
+			while(!stop)
+			{
+				uint32_t g = nrand48(seed) % NB_GROUPS;
+				GxsMsgReq req;
+				GxsMsgResult result;
+
+				for(uint32_t i=0; i<READ_BATCH; ++i)
+					req[groupId(g)].insert(ids[g][nrand48(seed) % ids[g].size()]);
+
+				double t = getTS();
+				ds.retrieveNxsMsgs(req, result, false);
+				t = getTS() - t;
+
+				max_read[r] = std::max(max_read[r], t);
+				total_read[r] += t;
+				++reads;
+
+				for(auto& msg:result[groupId(g)])
+				{
+					++read;
+					delete msg;
+				}
+			}
+		}));
+
+	std::thread writer([&]()
+	{
+		unsigned short seed[3] = { 0, 1, 0 };
+		rstime_t ts = 1600000000;
+
+		while(!stop)
+		{
+			uint32_t g = nrand48(seed) % NB_GROUPS;
+			std::list<RsNxsMsg*> msgs;
+
+			for(uint32_t i=0; i<WRITE_BATCH; ++i)
+				msgs.push_back(createMsg(groupId(g), ts++));
+
+			ds.storeMessage(msgs);
+			written += WRITE_BATCH;
+
+			for(uint32_t i=0; i<10; ++i)
+			{
+				MsgLocMetaData meta;
+				meta.msgId = std::make_pair(groupId(g), ids[g][nrand48(seed) % ids[g].size()]);
+				meta.val.put(RsGeneralDataService::MSG_META_STATUS, (int32_t) GXS_SERV::GXS_MSG_STATUS_GUI_UNREAD);
+				ds.updateMessageMetaData(meta);
+				++updated;
+			}
+		}
+	});
+
+	double start = getTS();
+	usleep(period * 1000000);
+	stop = true;
+
+	writer.join();
+	for(auto& t:readers)
+		t.join();
+
+	double duration = getTS() - start;
+	double longest = *std::max_element(max_read.begin(), max_read.end());
+	double total = 0;
+	for(auto t:total_read)
+		total += t;
+
+	std::cout << (wal ? "WAL, " + std::to_string(storage.mConcurrentReaders) + " reader connections" : std::string("single connection"))
+	          << ", " << nb_readers << " reading threads" << std::endl;
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "  messages read:    " << read / duration << " /s" << std::endl;
+	std::cout << "  messages written: " << written / duration << " /s, " << updated / duration << " meta updates /s" << std::endl;
+	std::cout << "  read time:        " << total / std::max<uint64_t>(reads, 1) * 1000 << " ms mean, " << longest * 1000 << " ms max" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*******************************************************************************
+ * libretroshare/src/tests/gxs/data_service: large_items_bench.cc              *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+
+/**********************************************************
+ * Storage of large GXS messages, such as channel posts with
+ * attached pictures.
+ *
+ * Messages of the given size are stored by batches, as they would
+ * arrive from synchronisation, then the store is opened again and
+ * the meta data of all the messages is loaded, and finally every
+ * message is read back one at a time, as when they are displayed.
+ * The time taken by each phase is reported, as well as the peak
+ * resident memory reached during the phase above what was used when
+ * it started.
+ *
+ * The data service refuses items larger than GXS_MAX_ITEM_SIZE, so
+ * the default size is the largest one that fits.
+ */
+
+#include "gxs/rsdataservice.h"
+#include "rsitems/rsserviceids.h"
+#include "util/rsdir.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <malloc.h>
+
+static const std::string DB_NAME = "large_items_bench_store";
+
+static double getTS()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Peak resident memory is reset to the current one, so that each
+// phase can be measured on its own. Sizes are in kB.
+
+static uint64_t statusValue(const std::string& key)
+{
+	std::ifstream in("/proc/self/status");
+	std::string line;
+
+	while(std::getline(in, line))
+		if(line.compare(0, key.size(), key) == 0)
+			return strtoull(line.c_str() + key.size(), NULL, 10);
+
+	return 0;
+}
+
+static uint64_t startPhase()
+{
+	std::ofstream("/proc/self/clear_refs") << "5";
+	return statusValue("VmRSS:");
+}
+
+static void endPhase(const char *name, double start, uint64_t rss, uint32_t nb_msgs, uint64_t bytes)
+{
+	double duration = getTS() - start;
+
+	std::cout << std::setw(6) << name << ": " << nb_msgs << " msgs, "
+	          << std::fixed << std::setprecision(2) << duration << " s, "
+	          << std::setprecision(1) << bytes / duration / 1048576 << " MB/s, peak memory +"
+	          << (statusValue("VmHWM:") - rss) / 1024 << " MB" << std::endl;
+	std::cout.unsetf(std::ios::fixed);
+}
+
+static RsNxsMsg *createMsg(const RsGxsGroupId& grpId, uint32_t size, uint32_t i)
+{
+	RsNxsMsg *msg = new RsNxsMsg(RS_SERVICE_GXS_TYPE_CHANNELS);
+	RsGxsMsgMetaData *meta = new RsGxsMsgMetaData();
+
+	meta->mGroupId = grpId;
+	meta->mMsgId = RsGxsMessageId::random();
+	meta->mPublishTs = 1500000000 + i;
+	meta->mMsgName = "channel post";
+
+	msg->grpId = grpId;
+	msg->msgId = meta->mMsgId;
+	msg->msg.bin_data = rs_malloc(size);
+	msg->msg.bin_len = size;
+	memset(msg->msg.bin_data, i, size);
+	msg->metaData = meta;
+
+	return msg;
+}
+
+static void usage(char *name)
+{
+	std::cerr << "Usage: " << name << " [-n <msgs>] [-s <bytes>] [-b <batch>] [-d <dir>]" << std::endl;
+	std::cerr << "\t-n : number of messages (default 1000)" << std::endl;
+	std::cerr << "\t-s : size of the messages (default 1500000)" << std::endl;
+	std::cerr << "\t-b : number of messages stored at once (default 10)" << std::endl;
+	std::cerr << "\t-d : directory of the store (default .)" << std::endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t nb_msgs = 1000;
+	uint32_t size = 1500000;
+	uint32_t batch = 10;
+	std::string dir = ".";
+	int c;
+
+	while(-1 != (c = getopt(argc, argv, "n:s:b:d:")))
+	{
+		switch (c)
+		{
+			case 'n':
+				nb_msgs = atoi(optarg);
+				break;
+			case 's':
+				size = atoi(optarg);
+				break;
+			case 'b':
+				batch = atoi(optarg);
+				break;
+			case 'd':
+				dir = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	// Large blocks are always mapped and unmapped, otherwise freed blocks
+	// stay in the heap and the peak memory of a phase hides what it uses.
+	mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+
+	remove((dir + "/" + DB_NAME).c_str());
+
+	RsGxsGroupId grpId = RsGxsGroupId::random();
+	std::vector<RsGxsMessageId> ids;
+	uint64_t bytes = 0;
+
+	{
+		RsDataService ds(dir, DB_NAME, RS_SERVICE_GXS_TYPE_CHANNELS);
+
+		uint64_t rss = startPhase();
+		double start = getTS();
+
+		for(uint32_t i=0; i<nb_msgs; )
+		{
+			std::list<RsNxsMsg*> msgs;
+
+			for(uint32_t k=0; k<batch && i<nb_msgs; ++k,++i)
+			{
+				msgs.push_back(createMsg(grpId, size, i));
+				ids.push_back(msgs.back()->msgId);
+			}
+
+			ds.storeMessage(msgs);
+		}
+		endPhase("store", start, rss, nb_msgs, uint64_t(nb_msgs) * size);
+	}
+
+	RsDataService ds(dir, DB_NAME, RS_SERVICE_GXS_TYPE_CHANNELS);
+
+	{
+		uint64_t rss = startPhase();
+		double start = getTS();
+
+		GxsMsgReq req;
+		GxsMsgMetaResult metas;
+		req[grpId];
+		ds.retrieveGxsMsgMetaData(req, metas);
+
+		endPhase("meta", start, rss, metas[grpId].size(), 0);
+
+		if(metas[grpId].size() != nb_msgs)
+			std::cerr << "Only " << metas[grpId].size() << " messages stored, the size may be too large" << std::endl;
+	}
+
+	{
+		uint64_t rss = startPhase();
+		double start = getTS();
+		uint32_t nb_read = 0;
+
+		for(uint32_t i=0; i<ids.size(); ++i)
+		{
+			GxsMsgReq req;
+			GxsMsgResult result;
+			req[grpId].insert(ids[i]);
+			ds.retrieveNxsMsgs(req, result, true);
+
+			for(RsNxsMsg *msg:result[grpId])
+			{
+				if(msg->msg.bin_len == size && ((uint8_t*)msg->msg.bin_data)[size-1] == uint8_t(i))
+				{
+					++nb_read;
+					bytes += size;
+				}
+				delete msg;
+			}
+		}
+		endPhase("read", start, rss, nb_read, bytes);
+
+		if(nb_read != ids.size())
+			std::cerr << "Only " << nb_read << " messages read back correctly" << std::endl;
+	}
+
+	remove((dir + "/" + DB_NAME).c_str());
+
+	return 0;
+}
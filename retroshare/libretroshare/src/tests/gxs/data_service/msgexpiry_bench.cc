@@ -0,0 +1,304 @@
+/*******************************************************************************
+ * libretroshare/src/tests/gxs/data_service: msgexpiry_bench.cc                *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+
+/**********************************************************
+ * Expiry of the messages of a large GXS store.
+ *
+ * A store of 1M forum messages (by default) is spread over four groups
+ * of 70%, 20%, 8% and 2% of the messages, published regularly over two
+ * years, one out of five being a reply to a recent message of the same
+ * group. With a storage period of one year, about half of the messages
+ * are expired.
+ *
+ * Two ways of cleaning up the store are compared:
+ *  - full (-o): the message metas of each group are loaded at once and
+ *    filtered in memory, as RsGxsCleanUp did before, and the selected
+ *    messages are removed with a single removeMsgs() call per group,
+ *  - batched:   the same passes as RsGxsCleanUp, each selecting at most
+ *    500 expired messages from the (grpId,timeStamp) index, the most
+ *    overdue group first, until the end of the round.
+ *
+ * While cleaning up, another thread keeps querying the data service, and
+ * reports the longest time it had to wait, which is the longest time the
+ * database mutex was held by the clean up. The peak RSS of the process
+ * is reported at the end.
+ *
+ * The store is created by a separate run (-c), so that the memory used to
+ * create it does not count in the peak RSS of the clean up.
+ */
+
+#include "gxs/rsdataservice.h"
+#include "retroshare/rsgxsflags.h"
+#include "rsitems/rsserviceids.h"
+#include "util/rsdir.h"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+static const rstime_t START_TS     = 1500000000;
+static const rstime_t SPAN         = 2*365*86400;
+static const rstime_t CUTOFF_TS    = START_TS + 365*86400;
+static const uint32_t CHUNK_SIZE   = 500;
+static const double   GROUP_SIZES[] = { 0.70, 0.20, 0.08, 0.02 };
+
+static double getTS()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// The store has no group entries, only messages, so groups have fixed ids.
+static RsGxsGroupId groupId(uint32_t g)
+{
+	RsGxsGroupId id;
+	id.asByteArray()[0] = 1 + g;
+	return id;
+}
+
+static void createStore(RsDataService& ds, uint32_t nb_msgs)
+{
+	srand48(1);
+
+	for(uint32_t g=0; g<4; ++g)
+	{
+		RsGxsGroupId grpId = groupId(g);
+		uint32_t n = nb_msgs * GROUP_SIZES[g];
+		std::vector<RsGxsMessageId> ids;
+
+		for(uint32_t i=0; i<n; )
+		{
+			std::list<RsNxsMsg*> msgs;
+
+			for(uint32_t k=0; k<10000 && i<n; ++k,++i)
+			{
+				RsNxsMsg *msg = new RsNxsMsg(RS_SERVICE_GXS_TYPE_FORUMS);
+				RsGxsMsgMetaData *meta = new RsGxsMsgMetaData();
+
+				meta->mGroupId = grpId;
+				meta->mMsgId = RsGxsMessageId::random();
+				meta->mPublishTs = START_TS + (rstime_t)(SPAN * (double)i / n);
+
+				if(i > 0 && drand48() < 0.2)
+					meta->mParentId = ids[i - 1 - lrand48() % std::min(i,1000u)];
+
+				if(drand48() < 0.001)
+					meta->mMsgStatus = GXS_SERV::GXS_MSG_STATUS_KEEP_FOREVER;
+
+				msg->grpId = grpId;
+				msg->msgId = meta->mMsgId;
+				msg->msg.setBinData("forum post body", 15);
+				msg->metaData = meta;
+
+				ids.push_back(meta->mMsgId);
+				msgs.push_back(msg);
+			}
+			ds.storeMessage(msgs);
+		}
+		std::cerr << "group " << g << ": " << n << " messages" << std::endl;
+	}
+}
+
+static uint32_t cleanFull(RsDataService& ds, const std::vector<RsGxsGroupId>& grps)
+{
+	uint32_t deleted = 0;
+
+	for(auto& grpId:grps)
+	{
+		GxsMsgReq req;
+		GxsMsgMetaResult result;
+
+		req[grpId];
+		ds.retrieveGxsMsgMetaData(req, result);
+
+		auto& metaV = result[grpId];
+		std::set<RsGxsMessageId> messages_with_kids;
+
+		for(auto& meta:metaV)
+			if(!meta->mParentId.isNull())
+				messages_with_kids.insert(meta->mParentId);
+
+		GxsMsgReq to_delete;
+
+		for(auto& meta:metaV)
+			if(meta->mPublishTs < CUTOFF_TS && !(meta->mMsgStatus & GXS_SERV::GXS_MSG_STATUS_KEEP_FOREVER)
+			        && messages_with_kids.find(meta->mMsgId) == messages_with_kids.end())
+				to_delete[grpId].insert(meta->mMsgId);
+
+		deleted += to_delete[grpId].size();
+		ds.removeMsgs(to_delete);
+	}
+	return deleted;
+}
+
+static uint32_t cleanBatched(RsDataService& ds, const std::vector<RsGxsGroupId>& grps, uint32_t& passes)
+{
+	uint32_t deleted = 0;
+	bool done = false;
+	std::map<RsGxsGroupId,rstime_t> next_ts_to_check;
+
+	while(!done)
+	{
+		std::vector<std::pair<rstime_t,RsGxsGroupId> > groups;
+
+		for(auto& grpId:grps)
+		{
+			std::vector<std::pair<RsGxsMessageId,rstime_t> > oldest;
+			ds.retrieveExpiredMsgIds(grpId, next_ts_to_check[grpId], CUTOFF_TS, false, 1, oldest);
+
+			if(!oldest.empty())
+				groups.push_back(std::make_pair(CUTOFF_TS - oldest.front().second, grpId));
+		}
+		std::sort(groups.begin(), groups.end(), [](const std::pair<rstime_t,RsGxsGroupId>& g1,const std::pair<rstime_t,RsGxsGroupId>& g2) { return g1.first > g2.first; });
+
+		GxsMsgReq to_delete;
+		uint32_t remaining = CHUNK_SIZE;
+		done = true;
+
+		for(auto& g:groups)
+		{
+			if(remaining == 0)
+			{
+				done = false;
+				break;
+			}
+			std::vector<std::pair<RsGxsMessageId,rstime_t> > msgs;
+			ds.retrieveExpiredMsgIds(g.second, next_ts_to_check[g.second], CUTOFF_TS, false, remaining, msgs);
+
+			for(auto& m:msgs)
+				to_delete[g.second].insert(m.first);
+
+			if(!msgs.empty())
+				next_ts_to_check[g.second] = msgs.back().second;
+
+			if(msgs.size() >= remaining)
+				done = false;
+
+			remaining -= std::min((uint32_t)msgs.size(), remaining);
+		}
+
+		ds.removeMsgs(to_delete);
+		deleted += CHUNK_SIZE - remaining;
+		++passes;
+	}
+	return deleted;
+}
+
+static void usage(char *name)
+{
+	std::cerr << "Usage: " << name << " [-c] [-o] [-n <msgs>] [-d <dir>]" << std::endl;
+	std::cerr << "\t-c : create the store" << std::endl;
+	std::cerr << "\t-o : clean up by loading all the metas of each group, as before" << std::endl;
+	std::cerr << "\t-n : number of messages in the created store (default 1000000)" << std::endl;
+	std::cerr << "\t-d : directory of the store (default .)" << std::endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	bool create = false, full = false;
+	uint32_t nb_msgs = 1000000;
+	std::string dir = ".";
+	int c;
+
+	while(-1 != (c = getopt(argc, argv, "con:d:")))
+	{
+		switch (c)
+		{
+			case 'c':
+				create = true;
+				break;
+			case 'o':
+				full = true;
+				break;
+			case 'n':
+				nb_msgs = atoi(optarg);
+				break;
+			case 'd':
+				dir = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	RsDataService ds(dir, "msgexpiry_bench_store", RS_SERVICE_GXS_TYPE_FORUMS);
+
+	if(create)
+	{
+		createStore(ds, nb_msgs);
+		return 0;
+	}
+
+	std::vector<RsGxsGroupId> grps;
+	for(uint32_t g=0; g<4; ++g)
+		grps.push_back(groupId(g));
+
+	// Probe thread: the time it waits for a (trivial) query is the time the database mutex was held.
+
+	std::atomic<bool> stop(false);
+	double max_wait = 0;
+
+	std::thread probe([&]()
+	{
+		while(!stop)
+		{
+			std::vector<RsGxsGroupId> ids;
+			double t = getTS();
+			ds.retrieveGroupIds(ids);
+			max_wait = std::max(max_wait, getTS() - t);
+			usleep(1000);
+		}
+	});
+
+	uint32_t passes = 0;
+	double start = getTS();
+	uint32_t deleted = full ? cleanFull(ds, grps) : cleanBatched(ds, grps, passes);
+	double duration = getTS() - start;
+
+	stop = true;
+	probe.join();
+
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+
+	std::cout << (full ? "full" : "batched") << " clean up: " << deleted << " messages deleted";
+	if(!full)
+		std::cout << " in " << passes << " passes";
+	std::cout << std::endl;
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "  time:          " << duration << " s" << std::endl;
+	std::cout << "  max lock wait: " << max_wait * 1000 << " ms" << std::endl;
+	std::cout << "  peak RSS:      " << ru.ru_maxrss / 1024.0 << " MB" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,211 @@
+/*******************************************************************************
+ * libretroshare/src/tests/pqi: history_bench.cc                               *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+/**********************************************************
+ * Chat history loading benchmark.
+ *
+ * Stores <chats> x <msgs> history messages, then measures the time needed
+ * to get the last 50 messages of one chat:
+ *  - as before, when all messages were serialised in the config file and
+ *    had to be deserialised and sorted per chat before the first query,
+ *  - with p3HistoryStore, from a cold start (chat directories listed, then
+ *    the segments of one chat listed and indexed) and once it is indexed.
+ *
+ * The config file encryption is not included in the first measurement, so
+ * it is favourable to the old layout.
+ */
+
+#include "pqi/p3historystore.h"
+#include "util/rsdir.h"
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static double getTS()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static RsPeerId chatId(uint32_t n)
+{
+	uint8_t bytes[RsPeerId::SIZE_IN_BYTES];
+	memset(bytes, 0, RsPeerId::SIZE_IN_BYTES);
+	memcpy(bytes, &n, sizeof(n));
+	return RsPeerId(bytes);
+}
+
+static void fillItem(RsHistoryMsgItem& item, uint32_t chat, uint32_t i, uint32_t t)
+{
+	item.chatPeerId = chatId(chat);
+	item.incoming = (i % 2);
+	item.msgPeerId = chatId(chat);
+	item.peerName = "some peer name";
+	item.sendTime = t;
+	item.recvTime = t;
+	item.message = "<span>this is a typical short chat message, number " + std::to_string(i) + "</span>";
+}
+
+static void cleanup(const std::string& dir, uint32_t nchats)
+{
+	for(uint32_t n = 0; n < nchats; n++)
+	{
+		std::string chat_dir = dir + "/" + chatId(n).toStdString();
+		RsDirUtil::cleanupDirectory(chat_dir, std::set<std::string>());
+		rmdir(chat_dir.c_str());
+	}
+	rmdir(dir.c_str());
+}
+
+static void usage(char *name)
+{
+	std::cerr << "Usage: " << name << " [-c <chats>] [-m <msgs per chat>] [-d <dir>]" << std::endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t nchats = 1000;
+	uint32_t nmsgs = 1000;
+	std::string dir = "history_bench";
+	int c;
+
+	while(-1 != (c = getopt(argc, argv, "c:m:d:")))
+	{
+		switch (c)
+		{
+			case 'c':
+				nchats = atoi(optarg);
+				break;
+			case 'm':
+				nmsgs = atoi(optarg);
+				break;
+			case 'd':
+				dir = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	uint8_t key[p3HistoryStore::ENCRYPTION_KEY_SIZE];
+	memset(key, 42, sizeof(key));
+
+	// ten days of history, interleaved between chats as it happens in practice
+
+	const uint32_t start_time = 1600000000;
+	const uint32_t step = 10 * p3HistoryStore::SEGMENT_DURATION / nmsgs;
+	const uint32_t target = nchats / 2;
+
+	RsHistorySerialiser ser;
+	std::vector<uint8_t> config;
+
+	cleanup(dir, nchats);
+	{
+		p3HistoryStore store(dir);
+		store.setEncryptionKey(key);
+
+		double ts = getTS();
+		for(uint32_t i = 0; i < nmsgs; i++)
+			for(uint32_t n = 0; n < nchats; n++)
+			{
+				RsHistoryMsgItem item;
+				fillItem(item, n, i, start_time + i * step);
+
+				uint32_t size = ser.size(&item);
+				config.resize(config.size() + size);
+				ser.serialise(&item, config.data() + config.size() - size, &size);
+
+				store.addMessage(&item);
+			}
+		std::cout << "stored " << nchats * nmsgs << " messages in " << getTS() - ts << " secs, config size would be " << config.size() / 1024 << " kB" << std::endl;
+	}
+
+	/* old layout: deserialise everything, then query */
+	{
+		double ts = getTS();
+
+		std::map<RsPeerId, std::map<uint32_t, RsHistoryMsgItem*> > messages;
+		uint32_t next_id = 1;
+		uint32_t offset = 0;
+
+		while(offset < config.size())
+		{
+			uint32_t size = config.size() - offset;
+			RsHistoryMsgItem *item = dynamic_cast<RsHistoryMsgItem*>(ser.deserialise(config.data() + offset, &size));
+			if (!item)
+				break;
+			offset += size;
+			item->msgId = next_id++;
+			messages[item->chatPeerId][item->msgId] = item;
+		}
+
+		std::map<uint32_t, RsHistoryMsgItem*>& msgs = messages[chatId(target)];
+		std::list<std::string> last;
+		for(std::map<uint32_t, RsHistoryMsgItem*>::reverse_iterator it = msgs.rbegin(); it != msgs.rend() && last.size() < 50; ++it)
+			last.push_front(it->second->message);
+
+		std::cout << "config file layout: last " << last.size() << " messages in " << (getTS() - ts) * 1000 << " ms" << std::endl;
+
+		for(std::map<RsPeerId, std::map<uint32_t, RsHistoryMsgItem*> >::iterator it = messages.begin(); it != messages.end(); ++it)
+			for(std::map<uint32_t, RsHistoryMsgItem*>::iterator lit = it->second.begin(); lit != it->second.end(); ++lit)
+				delete lit->second;
+	}
+
+	/* store: cold start, then warm. The first start right after the
+	 * messages were written also pays for the file system metadata of the
+	 * history directory, so it is run twice, on different chats. */
+	for(uint32_t run = 0; run < 2; run++)
+	{
+		double ts = getTS();
+
+		p3HistoryStore store(dir);
+		store.setEncryptionKey(key);
+
+		std::list<RsHistoryMsgItem*> items;
+		store.getLastMessages(chatId(target + run), 50, items);
+
+		double cold = getTS() - ts;
+		for(std::list<RsHistoryMsgItem*>::iterator it = items.begin(); it != items.end(); ++it)
+			delete *it;
+		items.clear();
+
+		ts = getTS();
+		store.getLastMessages(chatId(target + run), 50, items);
+		double warm = getTS() - ts;
+
+		std::cout << "history store, start " << run + 1 << ": last " << items.size() << " messages in " << cold * 1000 << " ms (cold), " << warm * 1000 << " ms (indexed)" << std::endl;
+
+		for(std::list<RsHistoryMsgItem*>::iterator it = items.begin(); it != items.end(); ++it)
+			delete *it;
+	}
+
+	cleanup(dir, nchats);
+	return 0;
+}
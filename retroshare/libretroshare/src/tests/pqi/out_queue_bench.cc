@@ -0,0 +1,232 @@
+/*******************************************************************************
+ * libretroshare/src/tests/pqi: out_queue_bench.cc                             *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+/**********************************************************
+ * Out queue of a slow friend while a large upload is running.
+ *
+ * The out queue of a friend (pqiQoS, as in pqiQoSstreamer) is emptied at the
+ * rate of the friend (50kB/s by default), in 512 bytes slices every 30ms, as
+ * pqistreamer does. Meanwhile:
+ *  - the friend downloads a file from us: it asks for a 256kB chunk every
+ *    second, more than the link can take (ftDataMultiplex),
+ *  - file data in a clear tunnel from another, fast, friend is forwarded to it
+ *    at 200kB/s in 8kB items (p3turtle),
+ *  - we send it a chat message every 500ms.
+ *
+ * Without budgets, every request is served and all tunnel data is forwarded.
+ * With budgets (pqiBandwidthShaper::outQueueAccepts()), requests wait until
+ * the queue has drained and forwarded file data is dropped.
+ *
+ * Time is simulated, so the run is deterministic and takes no time. Reports
+ * the peak size of the out queue, what each service got through and the time
+ * chat items spent in the queue, which is what the round trip time of a chat
+ * message to that friend is made of on our side.
+ */
+
+#include "pqi/pqiqos.h"
+#include "pqi/pqibandwidth.h"
+#include "rsitems/itempriorities.h"
+#include "rsitems/rsserviceids.h"
+#include "serialiser/rsbaseserial.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <list>
+#include <map>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint32_t TICK_MS        = 30 ;
+static const uint32_t SLICE_SIZE     = 512 ;
+static const uint32_t FT_CHUNK       = 256*1024 ;
+static const uint32_t FT_ITEM        = 8*1024 ;
+static const uint32_t TURTLE_ITEM    = 8*1024 ;
+static const uint32_t CHAT_ITEM      = 300 ;
+
+static uint32_t serviceType(RsServiceType service) { return (0x02 << 24) | (uint32_t(service) << 8) ; }
+
+static void *makeItem(RsServiceType service,uint32_t size,uint32_t seq)
+{
+	void *data = malloc(size) ;
+	memset(data,0,size) ;
+
+	uint32_t offset = 0 ;
+	setRawUInt32(data,size,&offset,serviceType(service) | 0x01) ;
+	setRawUInt32(data,size,&offset,size) ;
+	setRawUInt32(data,size,&offset,seq) ;	// used to find chat items when they come out
+
+	return data ;
+}
+
+struct Result
+{
+	Result() : peak_queue(0), ft_sent(0), turtle_sent(0), turtle_dropped(0), chat_avg_ms(0), chat_max_ms(0) {}
+
+	uint64_t peak_queue ;
+	uint64_t ft_sent ;
+	uint64_t turtle_sent ;
+	uint64_t turtle_dropped ;
+	double chat_avg_ms ;
+	uint64_t chat_max_ms ;
+};
+
+static Result run(bool budgets,double rate,uint32_t duration_s,uint32_t turtle_rate)
+{
+	pqiQoS qos(10,2.0f) ;
+	Result res ;
+
+	const uint16_t FT = uint16_t(RsServiceType::FILE_TRANSFER) ;
+	const uint16_t TURTLE = uint16_t(RsServiceType::TURTLE) ;
+
+	uint64_t queued = 0 ;
+	double link_credit = 0 ;
+	double turtle_credit = 0 ;
+
+	std::list<uint32_t> ft_requests ;				// chunk requests not served yet
+	std::map<uint32_t,uint64_t> chat_sent_ms ;		// seq -> time queued
+	uint32_t chat_seq = 0 ;
+	uint64_t chat_total_ms = 0 ;
+	uint32_t chat_count = 0 ;
+
+	for(uint64_t now_ms = 0 ; now_ms < duration_s*1000ull ; now_ms += TICK_MS)
+	{
+		// producers
+
+		if(now_ms % 1000 == 0)
+			ft_requests.push_back(FT_CHUNK) ;
+
+		while(!ft_requests.empty())
+		{
+			if(budgets && !pqiBandwidthShaper::outQueueAccepts(qos.service_queue_bytes(FT),queued,ft_requests.front(),rate))
+				break ;
+
+			for(uint32_t s=0;s<ft_requests.front();s+=FT_ITEM)
+			{
+				qos.in_rsItem(makeItem(RsServiceType::FILE_TRANSFER,FT_ITEM,0),FT_ITEM,QOS_PRIORITY_RS_FILE_DATA) ;
+				queued += FT_ITEM ;
+			}
+			ft_requests.pop_front() ;
+		}
+
+		turtle_credit += turtle_rate * TICK_MS / 1000.0 ;
+
+		while(turtle_credit >= TURTLE_ITEM)
+		{
+			turtle_credit -= TURTLE_ITEM ;
+
+			if(budgets && !pqiBandwidthShaper::outQueueAccepts(qos.service_queue_bytes(TURTLE),queued,TURTLE_ITEM,rate))
+			{
+				++res.turtle_dropped ;
+				continue ;
+			}
+			qos.in_rsItem(makeItem(RsServiceType::TURTLE,TURTLE_ITEM,0),TURTLE_ITEM,QOS_PRIORITY_RS_TURTLE_FILE_DATA) ;
+			queued += TURTLE_ITEM ;
+		}
+
+		if(now_ms % 500 == 0)
+		{
+			qos.in_rsItem(makeItem(RsServiceType::CHAT,CHAT_ITEM,++chat_seq),CHAT_ITEM,QOS_PRIORITY_RS_CHAT_ITEM) ;
+			queued += CHAT_ITEM ;
+			chat_sent_ms[chat_seq] = now_ms ;
+		}
+
+		res.peak_queue = std::max(res.peak_queue,queued) ;
+
+		// the link
+
+		link_credit += rate * TICK_MS / 1000.0 ;
+
+		while(link_credit > 0)
+		{
+			uint64_t ft_before = qos.service_queue_bytes(FT) ;
+			uint64_t turtle_before = qos.service_queue_bytes(TURTLE) ;
+
+			uint32_t size,packet_id ;
+			bool starts,ends ;
+			void *data = qos.out_rsItem(SLICE_SIZE,size,starts,ends,packet_id) ;
+
+			if(!data)
+			{
+				link_credit = 0 ;	// an idle link does not save bandwidth for later
+				break ;
+			}
+			link_credit -= size ;
+			queued -= size ;
+
+			res.ft_sent += ft_before - qos.service_queue_bytes(FT) ;
+			res.turtle_sent += turtle_before - qos.service_queue_bytes(TURTLE) ;
+
+			// chat items are small enough to go as a whole
+
+			if(starts && ends)
+			{
+				uint32_t offset = 0, type = 0, item_size = 0, seq = 0 ;
+				getRawUInt32(data,size,&offset,&type) ;
+				getRawUInt32(data,size,&offset,&item_size) ;
+				getRawUInt32(data,size,&offset,&seq) ;
+
+				if(((type >> 8) & 0xffff) == uint32_t(RsServiceType::CHAT))
+				{
+					uint64_t wait = now_ms + TICK_MS - chat_sent_ms[seq] ;
+					chat_total_ms += wait ;
+					res.chat_max_ms = std::max(res.chat_max_ms,wait) ;
+					++chat_count ;
+				}
+			}
+			free(data) ;
+		}
+	}
+	res.chat_avg_ms = chat_count ? chat_total_ms / double(chat_count) : 0 ;
+
+	qos.clear() ;
+	return res ;
+}
+
+int main(int argc,char *argv[])
+{
+	double rate = 50*1024 ;
+	uint32_t duration = 120 ;
+	uint32_t turtle_rate = 200*1024 ;
+
+	for(int i=1;i+1<argc;i+=2)
+		if(!strcmp(argv[i],"-rate"))
+			rate = atof(argv[i+1])*1024 ;
+		else if(!strcmp(argv[i],"-t"))
+			duration = atoi(argv[i+1]) ;
+		else if(!strcmp(argv[i],"-turtle"))
+			turtle_rate = atoi(argv[i+1])*1024 ;
+
+	std::cerr << "friend at " << rate/1024 << " kB/s, " << duration << " s, file requests 256 kB/s, tunnel data " << turtle_rate/1024 << " kB/s" << std::endl;
+
+	for(int b=0;b<2;++b)
+	{
+		Result r = run(b==1,rate,duration,turtle_rate) ;
+
+		std::cerr << std::setw(10) << (b?"budgets":"unbounded") << ": peak queue " << std::fixed << std::setprecision(1) << r.peak_queue/1024.0/1024.0 << " MB"
+		          << ", file data " << r.ft_sent/1024/duration << " kB/s"
+		          << ", tunnel data " << r.turtle_sent/1024/duration << " kB/s (" << r.turtle_dropped << " items dropped)"
+		          << ", chat wait avg " << std::setprecision(0) << r.chat_avg_ms << " ms, max " << r.chat_max_ms << " ms" << std::endl;
+	}
+	return 0 ;
+}
@@ -0,0 +1,256 @@
+/*******************************************************************************
+ * libretroshare/src/tests/pqi: service_dispatch_bench.cc                      *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+/**********************************************************
+ * Dispatch of incoming items from the peer threads to the services.
+ *
+ * P producer threads (the pqithreadstreamer of each peer, 8 by default) send
+ * items to S services (16 by default), each drained by its own thread. Two
+ * setups are timed:
+ *  - locked:   the service is looked up in a std::map under one mutex, and
+ *              the item goes into a std::list under the service mutex, as
+ *              p3ServiceServer::recvItem() and p3Service did before,
+ *  - lockfree: flat service table and RsMpscQueue, as now.
+ *
+ * Reports the time to deliver all items and the average time an item spent
+ * between being sent and being received by its service.
+ */
+
+#include "util/rsmpscqueue.h"
+#include "util/rsthreads.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <list>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::chrono::steady_clock Clock ;
+
+struct BenchItem
+{
+	uint32_t service ;
+	Clock::time_point sent ;
+};
+
+class LockedService
+{
+public:
+	LockedService() : mMtx("LockedService") {}
+
+	void recv(BenchItem *item)
+	{
+		RsStackMutex stack(mMtx) ;
+		mQueue.push_back(item) ;
+	}
+	BenchItem *pop()
+	{
+		RsStackMutex stack(mMtx) ;
+		if(mQueue.empty())
+			return NULL ;
+		BenchItem *item = mQueue.front() ;
+		mQueue.pop_front() ;
+		return item ;
+	}
+
+private:
+	RsMutex mMtx ;
+	std::list<BenchItem*> mQueue ;
+};
+
+class LockFreeService
+{
+public:
+	LockFreeService() : mQueue(1024) {}
+
+	void recv(BenchItem *item)
+	{
+		bool was_empty ;
+		mQueue.push(item,was_empty) ;
+	}
+	BenchItem *pop()
+	{
+		BenchItem *item = NULL ;
+		return mQueue.pop(item) ? item : NULL ;
+	}
+
+private:
+	RsMpscQueue<BenchItem*> mQueue ;
+};
+
+template<class Service> class Server
+{
+public:
+	virtual ~Server() {}
+	virtual Service *find(uint32_t service) = 0 ;
+};
+
+template<class Service> class LockedServer: public Server<Service>
+{
+public:
+	LockedServer(std::vector<Service*>& services) : mMtx("LockedServer")
+	{
+		for(uint32_t i=0;i<services.size();++i)
+			mServices[0x02000000 + (i << 8)] = services[i] ;
+	}
+	Service *find(uint32_t service) override
+	{
+		RsStackMutex stack(mMtx) ;
+		typename std::map<uint32_t,Service*>::iterator it = mServices.find(service) ;
+		return it == mServices.end() ? NULL : it->second ;
+	}
+private:
+	RsMutex mMtx ;
+	std::map<uint32_t,Service*> mServices ;
+};
+
+template<class Service> class FlatServer: public Server<Service>
+{
+public:
+	FlatServer(std::vector<Service*>& services)
+	{
+		memset(mTable,0,sizeof(mTable)) ;
+		for(uint32_t i=0;i<services.size();++i)
+			mTable[i] = services[i] ;
+	}
+	Service *find(uint32_t service) override
+	{
+		return mTable[(service >> 8) & 0xff] ;
+	}
+private:
+	Service *mTable[256] ;
+};
+
+template<class Service> static void run(const char *name,Server<Service>& server,std::vector<Service*>& services,uint32_t producers,uint32_t items_per_producer)
+{
+	uint32_t nservices = services.size() ;
+	uint64_t total = (uint64_t)producers * items_per_producer ;
+
+	std::vector<BenchItem> items(total) ;
+	std::atomic<uint64_t> received(0) ;
+	std::atomic<uint64_t> latency_us(0) ;
+	std::atomic<bool> done(false) ;
+
+	Clock::time_point start = Clock::now() ;
+
+	std::vector<std::thread> consumers ;
+	for(uint32_t s=0;s<nservices;++s)
+		consumers.push_back(std::thread([&,s]()
+		{
+			uint64_t lat = 0 ;
+			uint64_t n = 0 ;
+			while(!done)
+			{
+				BenchItem *item ;
+				bool got = false ;
+				while((item = services[s]->pop()) != NULL)
+				{
+					lat += std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - item->sent).count() ;
+					++n ;
+					got = true ;
+				}
+				if(n > 0 && got)
+				{
+					received += n ;
+					latency_us += lat ;
+					n = 0 ;
+					lat = 0 ;
+				}
+				if(!got)
+					std::this_thread::yield() ;
+			}
+		})) ;
+
+	std::vector<std::thread> threads ;
+	for(uint32_t p=0;p<producers;++p)
+		threads.push_back(std::thread([&,p]()
+		{
+			for(uint32_t i=0;i<items_per_producer;++i)
+			{
+				BenchItem& item(items[(uint64_t)p*items_per_producer + i]) ;
+				item.service = 0x02000000 + (((p + i) % nservices) << 8) ;
+				item.sent = Clock::now() ;
+
+				Service *service = server.find(item.service) ;
+				service->recv(&item) ;
+			}
+		})) ;
+
+	for(uint32_t p=0;p<producers;++p)
+		threads[p].join() ;
+
+	while(received < total)
+		std::this_thread::yield() ;
+
+	double elapsed_ms = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count() / 1000.0 ;
+
+	done = true ;
+	for(uint32_t s=0;s<nservices;++s)
+		consumers[s].join() ;
+
+	std::cerr << std::setw(9) << name << ": " << std::fixed << std::setprecision(1) << elapsed_ms << " ms, "
+	          << std::setprecision(0) << total / elapsed_ms * 1000.0 << " items/s, "
+	          << "avg latency " << latency_us / total << " us" << std::endl;
+}
+
+int main(int argc,char *argv[])
+{
+	uint32_t producers = 8 ;
+	uint32_t nservices = 16 ;
+	uint32_t items = 200000 ;
+
+	for(int i=1;i+1<argc;i+=2)
+		if(!strcmp(argv[i],"-p"))
+			producers = atoi(argv[i+1]) ;
+		else if(!strcmp(argv[i],"-s"))
+			nservices = atoi(argv[i+1]) ;
+		else if(!strcmp(argv[i],"-n"))
+			items = atoi(argv[i+1]) ;
+
+	std::cerr << producers << " peers, " << nservices << " services, " << items << " items per peer, "
+	          << std::thread::hardware_concurrency() << " cores" << std::endl;
+
+	{
+		std::vector<LockedService*> services ;
+		for(uint32_t i=0;i<nservices;++i)
+			services.push_back(new LockedService) ;
+		LockedServer<LockedService> server(services) ;
+		run("locked",server,services,producers,items) ;
+		for(uint32_t i=0;i<nservices;++i)
+			delete services[i] ;
+	}
+	{
+		std::vector<LockFreeService*> services ;
+		for(uint32_t i=0;i<nservices;++i)
+			services.push_back(new LockFreeService) ;
+		FlatServer<LockFreeService> server(services) ;
+		run("lockfree",server,services,producers,items) ;
+		for(uint32_t i=0;i<nservices;++i)
+			delete services[i] ;
+	}
+	return 0 ;
+}
@@ -0,0 +1,364 @@
+/*******************************************************************************
+ * libretroshare/src/tests/pqi: ssl_reconnect_bench.cc                         *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+/**********************************************************
+ * Reconnection of many friends after a network outage.
+ *
+ * N friends (300 by default) connect to one node through non blocking local
+ * socket pairs. The node side works like pqissllistener: a tick calls the
+ * accept of every pending connection, then sleeps 1ms. The friends run their
+ * SSL_connect() the same way on a second thread. The SSL context is set up as
+ * in AuthSSLimpl::InitAuth(). The verify callback checks the signature of the
+ * peer certificate, plus an optional busy wait (-pgp <us>) standing for the
+ * PGP check done by AuthSSL::VerifyX509Callback.
+ *
+ * All friends connect once, all connections are dropped (the outage), then
+ * all friends reconnect at once. The reconnection is timed in three ways:
+ *  - inline: SSL_accept() called from the tick, full handshakes (as before),
+ *  - pool:   accepts run on pqiSSLHandshakePool, full handshakes,
+ *  - resume: pool, and the friends offer the session of the first connection.
+ *
+ * Reports the time until all reconnections are accepted, and the median and
+ * max time a single reconnection took.
+ */
+
+#include "pqi/pqisslhandshakepool.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+
+static double getTS()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static uint32_t pgpCostUs = 0;
+static std::atomic<uint32_t> verifyCount(0);
+
+static int bench_verify_callback(int /*preverify_ok*/, X509_STORE_CTX *ctx)
+{
+	X509 *cert = X509_STORE_CTX_get_current_cert(ctx);
+	if(!cert || X509_verify(cert, X509_get0_pubkey(cert)) != 1)
+		return 0;
+
+	if(pgpCostUs > 0)
+	{
+		double end = getTS() + pgpCostUs / 1000000.0;
+		while(getTS() < end) ;
+	}
+
+	++verifyCount;
+	return 1;
+}
+
+/* sessions kept by the friends, indexed by connection number */
+static std::vector<SSL_SESSION*> sessions;
+
+static int bench_new_session_callback(SSL *ssl, SSL_SESSION *session)
+{
+	if(SSL_is_server(ssl))
+		return 0;
+
+	size_t n = (size_t) SSL_get_app_data(ssl);
+	if(sessions[n])
+		SSL_SESSION_free(sessions[n]);
+	sessions[n] = session;
+	return 1;
+}
+
+static void makeCert(EVP_PKEY*& pkey, X509*& x509, const char *cn)
+{
+	pkey = EVP_RSA_gen(2048);
+	x509 = X509_new();
+
+	X509_set_version(x509, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+	X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+	X509_set_pubkey(x509, pkey);
+
+	X509_NAME *name = X509_get_subject_name(x509);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*) cn, -1, -1, 0);
+	X509_set_issuer_name(x509, name);
+	X509_sign(x509, pkey, EVP_sha256());
+}
+
+static SSL_CTX *makeCtx(EVP_PKEY *pkey, X509 *x509, bool resume)
+{
+	/* same setup as AuthSSLimpl::InitAuth() */
+	SSL_CTX *ctx = SSL_CTX_new(SSLv23_method());
+	SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv3);
+	SSL_CTX_set_options(ctx, SSL_OP_SINGLE_DH_USE);
+	SSL_CTX_set_cipher_list(ctx, "kEDH+HIGH:!DSS:!aNULL:!3DES:!EXP");
+	SSL_CTX_use_certificate(ctx, x509);
+	SSL_CTX_use_PrivateKey(ctx, pkey);
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, bench_verify_callback);
+
+	if(resume)
+	{
+		static const unsigned char sessionIdContext[] = "RetroShare";
+		SSL_CTX_set_session_id_context(ctx, sessionIdContext, sizeof(sessionIdContext) - 1);
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_BOTH | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(ctx, bench_new_session_callback);
+	}
+	return ctx;
+}
+
+struct Conn
+{
+	SSL *s, *c;
+	int sfd, cfd;
+	bool sdone, cdone;
+	bool sfailed, cfailed;
+	uint32_t ticket_reads;
+	double done_ts;
+};
+
+enum { MODE_INLINE = 0, MODE_POOL = 1, MODE_RESUME = 2 };
+
+static int step(SSL *ssl, bool accept, bool pool, int& ssl_err)
+{
+	if(pool)
+	{
+		unsigned long err_err;
+		return pqiSSLHandshakePool::instance().handshake(ssl, accept, ssl_err, err_err);
+	}
+
+	int ret = accept ? SSL_accept(ssl) : SSL_connect(ssl);
+	ssl_err = (ret == 1) ? SSL_ERROR_NONE : SSL_get_error(ssl, ret);
+	ERR_clear_error();
+	return ret;
+}
+
+static bool pending(int ret, int ssl_err)
+{
+	return ret != 1 && (ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE);
+}
+
+/* one connection of every friend, returns the time until all are accepted */
+static double connectAll(SSL_CTX *sctx, SSL_CTX *cctx, uint32_t n, int mode, std::vector<double>& latencies, uint32_t& failures, uint32_t& reused)
+{
+	std::vector<Conn> conns(n);
+
+	for(uint32_t i = 0; i < n; ++i)
+	{
+		int fds[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		{
+			perror("socketpair");
+			exit(1);
+		}
+		fcntl(fds[0], F_SETFL, O_NONBLOCK);
+		fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+		Conn& c(conns[i]);
+		c.sfd = fds[0];
+		c.cfd = fds[1];
+		c.s = SSL_new(sctx);
+		c.c = SSL_new(cctx);
+		SSL_set_fd(c.s, c.sfd);
+		SSL_set_fd(c.c, c.cfd);
+		SSL_set_app_data(c.c, (char*) (size_t) i);
+		c.sdone = c.cdone = c.sfailed = c.cfailed = false;
+		c.ticket_reads = 0;
+		c.done_ts = 0;
+
+		if(mode == MODE_RESUME && sessions[i])
+		{
+			SSL_set_session(c.c, sessions[i]);
+			SSL_SESSION_free(sessions[i]);
+			sessions[i] = NULL;
+		}
+	}
+
+	bool pool = (mode != MODE_INLINE);
+	std::atomic<bool> stop(false);
+	double t0 = getTS();
+
+	/* the friends */
+	std::thread clients([&]()
+	{
+		while(!stop)
+		{
+			for(Conn& c : conns)
+			{
+				if(c.cfailed)
+					continue;
+
+				if(!c.cdone)
+				{
+					int ssl_err;
+					int ret = step(c.c, false, false, ssl_err);
+
+					if(ret == 1)
+						c.cdone = true;
+					else if(!pending(ret, ssl_err))
+						c.cfailed = true;
+				}
+				else if(c.ticket_reads < 20)
+				{
+					/* TLS 1.3 tickets come after the handshake */
+					char buf[16];
+					SSL_read(c.c, buf, sizeof(buf));
+					ERR_clear_error();
+					++c.ticket_reads;
+				}
+			}
+			usleep(1000);
+		}
+	});
+
+	/* the node: a listener tick */
+	uint32_t remaining = n;
+	while(remaining > 0 && getTS() < t0 + 120)
+	{
+		for(Conn& c : conns)
+		{
+			if(c.sdone || c.sfailed)
+				continue;
+
+			int ssl_err;
+			int ret = step(c.s, true, pool, ssl_err);
+
+			if(ret == 1)
+			{
+				c.sdone = true;
+				c.done_ts = getTS();
+				--remaining;
+			}
+			else if(!pending(ret, ssl_err))
+			{
+				c.sfailed = true;
+				--remaining;
+			}
+		}
+		usleep(1000);
+	}
+	double total = getTS() - t0;
+
+	/* let the friends collect their tickets */
+	usleep(100000);
+	stop = true;
+	clients.join();
+
+	failures = 0;
+	reused = 0;
+	latencies.clear();
+
+	for(Conn& c : conns)
+	{
+		if(!c.sdone)
+			++failures;
+		else
+		{
+			latencies.push_back(c.done_ts - t0);
+			if(SSL_session_reused(c.s))
+				++reused;
+		}
+
+		/* the outage: connections are dropped as pqissl::reset_locked() does */
+		pqiSSLHandshakePool::instance().forget(c.s);
+		SSL_shutdown(c.s);
+		SSL_shutdown(c.c);
+		SSL_free(c.s);
+		SSL_free(c.c);
+		close(c.sfd);
+		close(c.cfd);
+	}
+	std::sort(latencies.begin(), latencies.end());
+
+	return total;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t n = 300;
+
+	for(int i = 1; i < argc; ++i)
+		if(!strcmp(argv[i], "-n") && i + 1 < argc)
+			n = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-pgp") && i + 1 < argc)
+			pgpCostUs = atoi(argv[++i]);
+		else
+		{
+			std::cerr << "usage: " << argv[0] << " [-n friends] [-pgp us]" << std::endl;
+			return 1;
+		}
+
+	EVP_PKEY *spkey, *cpkey;
+	X509 *scert, *ccert;
+	makeCert(spkey, scert, "node");
+	makeCert(cpkey, ccert, "friend");
+
+	std::cerr << n << " friends, simulated PGP check: " << pgpCostUs << "us, "
+	          << std::thread::hardware_concurrency() << " cores" << std::endl;
+
+	const char *names[] = { "inline", "pool", "resume" };
+
+	for(int mode = MODE_INLINE; mode <= MODE_RESUME; ++mode)
+	{
+		SSL_CTX *sctx = makeCtx(spkey, scert, mode == MODE_RESUME);
+		SSL_CTX *cctx = makeCtx(cpkey, ccert, mode == MODE_RESUME);
+		sessions.assign(n, NULL);
+
+		std::vector<double> lat;
+		uint32_t failures, reused;
+
+		connectAll(sctx, cctx, n, mode, lat, failures, reused);	// first connection
+
+		verifyCount = 0;
+		double total = connectAll(sctx, cctx, n, mode, lat, failures, reused);	// after the outage
+
+		std::cerr << std::setw(7) << names[mode]
+		          << ": all reconnected in " << std::fixed << std::setprecision(0) << total * 1000 << " ms"
+		          << ", median " << (lat.empty() ? 0 : lat[lat.size() / 2] * 1000) << " ms"
+		          << ", max " << (lat.empty() ? 0 : lat.back() * 1000) << " ms"
+		          << ", resumed " << reused << ", cert checks " << verifyCount
+		          << ", failures " << failures << std::endl;
+
+		for(SSL_SESSION *s : sessions)
+			if(s)
+				SSL_SESSION_free(s);
+
+		SSL_CTX_free(sctx);
+		SSL_CTX_free(cctx);
+	}
+	return 0;
+}
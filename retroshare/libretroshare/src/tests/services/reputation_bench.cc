@@ -0,0 +1,172 @@
+/*******************************************************************************
+ * libretroshare/src/tests/services: reputation_bench.cc                       *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+/**********************************************************
+ * Reputation storage benchmark.
+ *
+ * Loads <ids> reputation entries with opinions from a fraction of <friends>
+ * friends through p3GxsReputation::loadList(), as at startup, then reports:
+ *  - the heap memory used by the reputations once loaded,
+ *  - the average time of getReputationInfo() on random known ids.
+ */
+
+#include "services/p3gxsreputation.h"
+#include "rsitems/rsgxsreputationitems.h"
+
+#include <iostream>
+#include <vector>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static double getTS()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static size_t heapUsed()
+{
+	struct mallinfo2 mi = mallinfo2();
+	return mi.uordblks + mi.hblkhd;
+}
+
+template<class ID> static ID randomId()
+{
+	uint8_t bytes[ID::SIZE_IN_BYTES];
+	for(uint32_t i = 0; i < ID::SIZE_IN_BYTES; i++)
+		bytes[i] = lrand48();
+	return ID(bytes);
+}
+
+static void usage(char *name)
+{
+	std::cerr << "Usage: " << name << " [-i <ids>] [-f <friends>] [-o <opinion fraction>]" << std::endl;
+	std::cerr << "\t-i : number of GXS ids (default 100000)" << std::endl;
+	std::cerr << "\t-f : number of friends (default 100)" << std::endl;
+	std::cerr << "\t-o : probability that a friend has an opinion about an id (default 0.3)" << std::endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t nIds = 100000;
+	uint32_t nFriends = 100;
+	double fraction = 0.3;
+	int c;
+
+	while(-1 != (c = getopt(argc, argv, "i:f:o:")))
+	{
+		switch (c)
+		{
+			case 'i':
+				nIds = atoi(optarg);
+				break;
+			case 'f':
+				nFriends = atoi(optarg);
+				break;
+			case 'o':
+				fraction = atof(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	srand48(1);
+
+	std::vector<RsPeerId> friends;
+	for(uint32_t i = 0; i < nFriends; i++)
+		friends.push_back(randomId<RsPeerId>());
+
+	std::vector<RsGxsId> ids;
+	for(uint32_t i = 0; i < nIds; i++)
+		ids.push_back(randomId<RsGxsId>());
+
+	p3GxsReputation *rep = new p3GxsReputation(NULL);
+	size_t heapBefore = heapUsed();
+
+	std::list<RsItem *> load;
+	uint64_t nOpinions = 0;
+
+	for(uint32_t i = 0; i < nFriends; i++)
+	{
+		RsGxsReputationConfigItem *item = new RsGxsReputationConfigItem();
+		item->mPeerId = friends[i];
+		item->mLatestUpdate = time(NULL);
+		load.push_back(item);
+	}
+
+	for(uint32_t i = 0; i < nIds; i++)
+	{
+		RsGxsReputationSetItem *item = new RsGxsReputationSetItem();
+		item->mGxsId = ids[i];
+		item->mOwnOpinion = static_cast<uint32_t>(RsOpinion::NEUTRAL);
+		item->mOwnOpinionTS = 0;
+		item->mLastUsedTS = time(NULL);
+
+		for(uint32_t j = 0; j < nFriends; j++)
+			if (drand48() < fraction)
+			{
+				item->mOpinions[friends[j]] = (drand48() < 0.7) ? static_cast<uint32_t>(RsOpinion::POSITIVE) : static_cast<uint32_t>(RsOpinion::NEGATIVE);
+				nOpinions++;
+			}
+
+		load.push_back(item);
+	}
+
+	// Friends only get their opinions loaded when they are in the same list.
+	// Items are deleted by loadList().
+
+	rep->loadList(load);
+
+	size_t heapAfter = heapUsed();
+
+	std::cout << nIds << " ids, " << nFriends << " friends, " << nOpinions << " opinions" << std::endl;
+	std::cout << "memory used:         " << (heapAfter - heapBefore) / (1024 * 1024.0) << " MB" << std::endl;
+
+	const uint32_t nQueries = 1000000;
+	std::vector<uint32_t> order(nQueries);
+	for(uint32_t i = 0; i < nQueries; i++)
+		order[i] = lrand48() % nIds;
+
+	uint32_t negative = 0;
+	double start = getTS();
+
+	for(uint32_t i = 0; i < nQueries; i++)
+	{
+		RsReputationInfo info;
+		rep->getReputationInfo(ids[order[i]], RsPgpId(), info);
+
+		if (info.mOverallReputationLevel == RsReputationLevel::REMOTELY_NEGATIVE)
+			negative++;
+	}
+
+	double elapsed = getTS() - start;
+	std::cout << "getReputationInfo(): " << elapsed / nQueries * 1e9 << " ns per call (" << negative << " remotely negative)" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,305 @@
+/*******************************************************************************
+ * libretroshare/src/tests/tcponudp: lossy_tou.cc                              *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+/**********************************************************
+ * Lossy link emulator for the TCP-on-UDP stream.
+ *
+ * Two TcpStreams are connected back to back inside the process,
+ * through a pair of emulated links that add propagation delay,
+ * serialisation delay at a fixed bottleneck rate, a drop-tail queue
+ * and random loss. Bulk data is pushed one way, checked at the other
+ * end, and the goodput is reported for each loss / RTT combination.
+ *
+ * No socket is opened, so the test runs anywhere, but it runs in real
+ * time as TcpStream takes its timestamps from the system clock.
+ */
+
+#include "tcponudp/tcpstream.h"
+
+#include <iostream>
+#include <iomanip>
+#include <deque>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static double getTS()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+class EmulatedLink: public UdpPublisher
+{
+	public:
+	EmulatedLink(double loss, double delay, double rate, uint32_t queue)
+	:mLoss(loss), mDelay(delay), mRate(rate), mQueueSize(queue),
+	 mLinkFree(0), mDest(NULL), mSent(0), mDropped(0) { return; }
+
+virtual int sendPkt(const void *data, int size, const struct sockaddr_in &/*to*/, int /*ttl*/)
+	{
+		double now = getTS();
+		mSent++;
+
+		if ((drand48() < mLoss) || (mQueue.size() >= mQueueSize))
+		{
+			mDropped++;
+			return size;
+		}
+
+		/* packets leave the bottleneck one after the other */
+		if (mLinkFree < now)
+			mLinkFree = now;
+		mLinkFree += size / mRate;
+
+		Pkt p;
+		p.ts = mLinkFree + mDelay;
+		p.data.assign((const uint8_t *) data, (const uint8_t *) data + size);
+		mQueue.push_back(p);
+
+		return size;
+	}
+
+void	setDestination(UdpPeer *dest) { mDest = dest; }
+
+void	deliver(double now)
+	{
+		while((!mQueue.empty()) && (mQueue.front().ts <= now))
+		{
+			Pkt p = mQueue.front();
+			mQueue.pop_front();
+			mDest->recvPkt(p.data.data(), p.data.size());
+		}
+	}
+
+	private:
+	struct Pkt
+	{
+		double ts;
+		std::vector<uint8_t> data;
+	};
+
+	double mLoss, mDelay, mRate;
+	uint32_t mQueueSize;
+	double mLinkFree;
+	std::deque<Pkt> mQueue;
+	UdpPeer *mDest;
+
+	public:
+	uint32_t mSent, mDropped;
+};
+
+class EmulatedReceiver: public UdpSubReceiver
+{
+	public:
+	EmulatedReceiver(UdpPublisher *pub) :UdpSubReceiver(pub) { return; }
+
+virtual int recvPkt(void *, int, struct sockaddr_in &) { return 0; }
+virtual int status(std::ostream &) { return 0; }
+};
+
+struct RunResult
+{
+	bool   connected;
+	bool   dataOk;
+	double goodput; /* bytes / sec */
+	uint32_t sent, dropped;
+};
+
+static RunResult runTransfer(double loss, double rtt, double rate, double period,
+		bool extA, bool extB)
+{
+	RunResult res;
+	res.connected = false;
+	res.dataOk = true;
+	res.goodput = 0;
+
+	/* drop-tail queue of one bandwidth delay product */
+	uint32_t queue = rate * rtt / 1000 + 8;
+
+	EmulatedLink linkAB(loss, rtt / 2, rate, queue);
+	EmulatedLink linkBA(loss, rtt / 2, rate, queue);
+
+	EmulatedReceiver recvA(&linkAB);
+	EmulatedReceiver recvB(&linkBA);
+
+	TcpStream tcpA(&recvA);
+	TcpStream tcpB(&recvB);
+
+	tcpA.setUseExtensions(extA);
+	tcpB.setUseExtensions(extB);
+
+	linkAB.setDestination(&tcpB);
+	linkBA.setDestination(&tcpA);
+
+	struct sockaddr_in addrA, addrB;
+	memset(&addrA, 0, sizeof(addrA));
+	memset(&addrB, 0, sizeof(addrB));
+	addrA.sin_family = AF_INET;
+	addrB.sin_family = AF_INET;
+	addrA.sin_port = htons(4001);
+	addrB.sin_port = htons(4002);
+
+	tcpB.listenfor(addrA);
+	tcpA.connect(addrB, 10);
+
+	double start = getTS();
+	while(!(tcpA.isConnected() && tcpB.isConnected()))
+	{
+		double now = getTS();
+		if (now - start > 30)
+			return res;
+
+		linkAB.deliver(now);
+		linkBA.deliver(now);
+		tcpA.tick();
+		tcpB.tick();
+		usleep(500);
+	}
+	res.connected = true;
+
+	/* counter pattern, so that reordering or corruption is noticed */
+	char buf[16384];
+	uint8_t wnext = 0, rnext = 0;
+	uint64_t received = 0;
+
+	start = getTS();
+	double now = start;
+	while(now - start < period)
+	{
+		int allowed = tcpA.write_allowed();
+		if (allowed > (int) sizeof(buf))
+			allowed = sizeof(buf);
+		if (allowed > 0)
+		{
+			for(int i = 0; i < allowed; i++)
+				buf[i] = wnext++;
+			if (tcpA.write(buf, allowed) != allowed)
+			{
+				std::cerr << "lossy_tou: short write" << std::endl;
+				res.dataOk = false;
+				break;
+			}
+		}
+
+		linkAB.deliver(now);
+		linkBA.deliver(now);
+		tcpA.tick();
+		tcpB.tick();
+
+		int n;
+		while(0 < (n = tcpB.read(buf, sizeof(buf))))
+		{
+			for(int i = 0; i < n; i++)
+			{
+				if ((uint8_t) buf[i] != rnext++)
+					res.dataOk = false;
+			}
+			received += n;
+		}
+
+		usleep(500);
+		now = getTS();
+	}
+
+	res.goodput = received / (now - start);
+	res.sent = linkAB.mSent;
+	res.dropped = linkAB.mDropped;
+
+	tcpA.close();
+	tcpB.close();
+	return res;
+}
+
+static void usage(char *name)
+{
+	std::cerr << "Usage: " << name << " [-l] [-m] [-r <kB/s>] [-t <secs>]" << std::endl;
+	std::cerr << "\t-l : disable the negotiated extensions on both sides" << std::endl;
+	std::cerr << "\t-m : mixed run, only the sender supports the extensions" << std::endl;
+	std::cerr << "\t-r : bottleneck rate (default 1250 kB/s, i.e. 10 Mbit/s)" << std::endl;
+	std::cerr << "\t-t : duration of each transfer (default 20 secs)" << std::endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	bool extA = true, extB = true;
+	double rate = 1250 * 1000;
+	double period = 20;
+	int c;
+
+	while(-1 != (c = getopt(argc, argv, "lmr:t:")))
+	{
+		switch (c)
+		{
+			case 'l':
+				extA = extB = false;
+				break;
+			case 'm':
+				extB = false;
+				break;
+			case 'r':
+				rate = atof(optarg) * 1000;
+				break;
+			case 't':
+				period = atof(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	srand48(getTS());
+
+	const double losses[] = { 0.01, 0.05 };
+	const double rtts[] = { 0.05, 0.2 };
+	bool ok = true;
+
+	std::cout << "loss  rtt(ms)  goodput(kB/s)  sent  dropped  data" << std::endl;
+	for(int i = 0; i < 2; i++)
+	{
+		for(int j = 0; j < 2; j++)
+		{
+			RunResult r = runTransfer(losses[i], rtts[j], rate, period, extA, extB);
+
+			std::cout << std::setw(4) << (int) (losses[i] * 100) << "%";
+			std::cout << std::setw(8) << (int) (rtts[j] * 1000);
+			if (!r.connected)
+			{
+				std::cout << "  connection failed" << std::endl;
+				ok = false;
+				continue;
+			}
+			std::cout << std::setw(15) << std::fixed << std::setprecision(1) << r.goodput / 1000;
+			std::cout << std::setw(7) << r.sent << std::setw(9) << r.dropped;
+			std::cout << "  " << (r.dataOk ? "OK" : "CORRUPTED") << std::endl;
+			std::cout.unsetf(std::ios::fixed);
+
+			ok = ok && r.dataOk;
+		}
+	}
+	return ok ? 0 : 1;
+}
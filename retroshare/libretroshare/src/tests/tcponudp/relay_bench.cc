@@ -0,0 +1,212 @@
+/*******************************************************************************
+ * libretroshare/src/tests/tcponudp: relay_bench.cc                            *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+/**********************************************************
+ * Relay forwarding benchmark.
+ *
+ * A UdpRelayReceiver relays packets between two loopback sockets.
+ * The relay socket is filled with relay packets, then drained packet
+ * by packet with recvfrom()/sendto(), as a UdpLayer does. Idle relays
+ * are installed next to the benchmarked one, so that the forwarding
+ * rate includes the relay lookups.
+ */
+
+#include "tcponudp/udprelay.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#define BENCH_PKT_SIZE	1036	/* full TcpStream segment */
+#define BENCH_BUF_SIZE	2048
+
+static double getTS()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int openSocket(struct sockaddr_in &addr, int rcvbuf)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	if ((fd < 0) || (0 != bind(fd, (struct sockaddr *) &addr, sizeof(addr))))
+	{
+		std::cerr << "relay_bench: cannot bind socket" << std::endl;
+		exit(1);
+	}
+
+	socklen_t len = sizeof(addr);
+	getsockname(fd, (struct sockaddr *) &addr, &len);
+
+#ifdef SO_RCVBUFFORCE
+	if (0 != setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)))
+#endif
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+}
+
+/* what a UdpLayer does: one syscall per packet each way */
+class SinglePktIO: public UdpPublisher
+{
+	public:
+	SinglePktIO(int fd) :mFd(fd) { return; }
+
+virtual int sendPkt(const void *data, int size, const struct sockaddr_in &to, int /*ttl*/)
+	{
+		return sendto(mFd, data, size, 0, (const struct sockaddr *) &to, sizeof(to));
+	}
+
+int	recvAll(UdpReceiver *recv)
+	{
+		char buf[BENCH_BUF_SIZE];
+		struct sockaddr_in from;
+		socklen_t len = sizeof(from);
+		int n = 0;
+		int size;
+
+		while(0 < (size = recvfrom(mFd, buf, sizeof(buf), 0, (struct sockaddr *) &from, &len)))
+		{
+			recv->recvPkt(buf, size, from);
+			len = sizeof(from);
+			n++;
+		}
+		return n;
+	}
+
+	private:
+	int mFd;
+};
+
+static void drain(int fd)
+{
+	char buf[BENCH_BUF_SIZE];
+	while(0 < recv(fd, buf, sizeof(buf), 0)) ;
+}
+
+static double runBench(int rounds, int burst, int nrelays)
+{
+	struct sockaddr_in srcAddr, relayAddr, sinkAddr;
+	int srcFd = openSocket(srcAddr, 1 << 20);
+	int relayFd = openSocket(relayAddr, 16 << 20);
+	int sinkFd = openSocket(sinkAddr, 16 << 20);
+
+	SinglePktIO single(relayFd);
+	UdpRelayReceiver relay(&single);
+
+	relay.setRelayTotal(2 * nrelays);
+	relay.setRelayClassMax(UDP_RELAY_CLASS_GENERAL, nrelays, 1000000);
+
+	/* the benchmarked flow, plus idle relays filling the tables */
+	struct sockaddr_in fake = srcAddr;
+	for(int i = 0; i < nrelays - 1; i++)
+	{
+		fake.sin_port = htons(10000 + i);
+		UdpRelayAddrSet idle(&fake, &sinkAddr);
+		int relayClass = UDP_RELAY_CLASS_GENERAL;
+		uint32_t bandwidth = 0;
+		relay.addUdpRelay(&idle, relayClass, bandwidth);
+	}
+
+	UdpRelayAddrSet addrSet(&srcAddr, &sinkAddr);
+	int relayClass = UDP_RELAY_CLASS_GENERAL;
+	uint32_t bandwidth = 0;
+	if (!relay.addUdpRelay(&addrSet, relayClass, bandwidth))
+	{
+		std::cerr << "relay_bench: cannot install relay" << std::endl;
+		exit(1);
+	}
+
+	char data[BENCH_PKT_SIZE];
+	char pkt[BENCH_PKT_SIZE + 16];
+	memset(data, 0xAB, sizeof(data));
+	UdpRelayEnd ure(&addrSet, &relayAddr);
+	int pktsize = createRelayUdpPacket(data, sizeof(data), pkt, sizeof(pkt), &ure);
+
+	uint64_t forwarded = 0;
+	double elapsed = 0;
+
+	for(int r = 0; r < rounds; r++)
+	{
+		for(int i = 0; i < burst; i++)
+		{
+			sendto(srcFd, pkt, pktsize, 0, (struct sockaddr *) &relayAddr, sizeof(relayAddr));
+		}
+
+		double start = getTS();
+		forwarded += single.recvAll(&relay);
+		elapsed += getTS() - start;
+
+		drain(sinkFd);
+	}
+
+	close(srcFd);
+	close(relayFd);
+	close(sinkFd);
+
+	return forwarded / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = 200;
+	int burst = 1000;
+	int nrelays = 100;
+	int c;
+
+	while(-1 != (c = getopt(argc, argv, "r:b:n:")))
+	{
+		switch (c)
+		{
+			case 'r':
+				rounds = atoi(optarg);
+				break;
+			case 'b':
+				burst = atoi(optarg);
+				break;
+			case 'n':
+				nrelays = atoi(optarg);
+				break;
+			default:
+				std::cerr << "Usage: " << argv[0] << " [-r <rounds>] [-b <burst>] [-n <relays>]" << std::endl;
+				exit(1);
+		}
+	}
+
+	double rate = runBench(rounds, burst, nrelays);
+	std::cout << "relayed: " << (int) rate << " pkts/sec, " << nrelays << " relays" << std::endl;
+
+	return 0;
+}
@@ -91,6 +91,9 @@ static const uint32_t MAX_TUNNEL_REQS_PER_SECOND               =   1 ; /// maxim
 static const uint32_t MAX_ALLOWED_SR_IN_CACHE                  = 120 ; /// maximum number of search requests allowed in cache. That makes 2 per sec.
 static const uint32_t TURTLE_SEARCH_RESULT_MAX_HITS_FILES      =5000 ; /// maximum number of search results forwarded back to the source.
 static const uint32_t TURTLE_SEARCH_RESULT_MAX_HITS_DEFAULT    = 100 ; /// default maximum number of search results forwarded back source.
+static const rstime_t SEARCH_RESULTS_CACHE_LIFE_TIME           =  20 ; /// local results are reused for identical searches during 20 secs.
+static const uint32_t MAX_SEARCH_RESULTS_IN_CACHE              = 500 ; /// maximum number of distinct searches in the results cache.
+static const uint32_t SEARCH_FORWARD_BUDGET_PER_FRIEND         =4096 ; /// bytes of search requests per sec we forward on behalf of each friend.
 
 static const float depth_peer_probability[7] = { 1.0f,0.99f,0.9f,0.7f,0.6f,0.5,0.4f } ;
 
@@ -103,7 +106,11 @@ static const int DISTANCE_SQUEEZING_POWER              =   8 ;
 #define HEX_PRINT(a) std::hex << a << std::dec
 
 p3turtle::p3turtle(p3ServiceControl *sc,p3LinkMgr *lm)
-	:p3Service(), p3Config(), mServiceControl(sc), mLinkMgr(lm), mTurtleMtx("p3turtle")
+	:p3Service(), p3Config(), mServiceControl(sc), mLinkMgr(lm), mTurtleMtx("p3turtle"),
+	  _search_requests_origins(SEARCH_REQUESTS_LIFE_TIME),
+	  _search_results_cache(SEARCH_RESULTS_CACHE_LIFE_TIME,MAX_SEARCH_RESULTS_IN_CACHE), _search_forwards_dropped(0),
+	  _tunnel_requests_origins(TUNNEL_REQUESTS_LIFE_TIME),
+	  _unknown_updn_bytes(0), _data_up_bytes(0), _data_dn_bytes(0)
 {
 	RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
 
@@ -245,6 +252,10 @@ int p3turtle::tick()
 			RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
 			_last_tunnel_management_time = now ;
 
+			_traffic_info_buffer.unknown_updn_Bps += _unknown_updn_bytes.exchange(0) ;
+			_traffic_info_buffer.data_up_Bps += _data_up_bytes.exchange(0) ;
+			_traffic_info_buffer.data_dn_Bps += _data_dn_bytes.exchange(0) ;
+
 			// Update traffic statistics. The constants are important: they allow a smooth variation of the
 			// traffic speed, which is used to moderate tunnel requests statistics.
 			//
@@ -337,7 +348,7 @@ void p3turtle::getSourceVirtualPeersList(const TurtleFileHash& hash,std::list<pq
 	if(it != _incoming_file_hashes.end())
 		for(uint32_t i=0;i<it->second.tunnels.size();++i)
 		{
-			std::map<TurtleTunnelId,TurtleTunnel>::const_iterator it2 = _local_tunnels.find( it->second.tunnels[i] ) ;
+			std::unordered_map<TurtleTunnelId,TurtleTunnel>::const_iterator it2 = _local_tunnels.find( it->second.tunnels[i] ) ;
 
 			if(it2 != _local_tunnels.end())
 			{
@@ -428,12 +439,26 @@ void p3turtle::manageTunnels()
 
 void p3turtle::estimateTunnelSpeeds()
 {
+	// The traffic is counted by the data path in the routing table. Collect it
+	// before taking the mutex, and use it to also update the tunnel time stamps.
+
+	std::vector<TurtleRoutingTable::Activity> activity ;
+	_tunnel_routes.collectActivity(activity) ;
+
 	RsStackMutex stack(mTurtleMtx) ;
 
-	for(std::map<TurtleTunnelId,TurtleTunnel>::iterator it(_local_tunnels.begin());it!=_local_tunnels.end();++it)
+	for(uint32_t i=0;i<activity.size();++i)
 	{
+		std::unordered_map<TurtleTunnelId,TurtleTunnel>::iterator it(_local_tunnels.find(activity[i].tunnel_id)) ;
+
+		if(it == _local_tunnels.end())
+			continue ;
+
 		TurtleTunnel& tunnel(it->second) ;
 
+		tunnel.time_stamp = std::max(tunnel.time_stamp, uint32_t(activity[i].time_stamp)) ;
+		tunnel.transfered_bytes = activity[i].transfered_bytes ;
+
 		float speed_estimate = tunnel.transfered_bytes / float(TUNNEL_SPEED_ESTIMATE_LAPSE) ;
 		tunnel.speed_Bps = 0.75*tunnel.speed_Bps + 0.25*speed_estimate ;
 		tunnel.transfered_bytes = 0 ;
@@ -494,42 +519,27 @@ void p3turtle::autoWash()
 
 	rstime_t now = time(NULL) ;
 
-	// Search requests
+	// Search and tunnel requests. Whole time buckets are dropped at once.
 	//
 	{
 		RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
 
-		for(std::map<TurtleSearchRequestId,TurtleSearchRequestInfo>::iterator it(_search_requests_origins.begin());it!=_search_requests_origins.end();)
-			if(now > (rstime_t)(it->second.time_stamp + SEARCH_REQUESTS_LIFE_TIME))
-			{
-#ifdef P3TURTLE_DEBUG
-				std::cerr << "  removed search request " << HEX_PRINT(it->first) << ", timeout." << std::endl ;
-#endif
-				std::map<TurtleSearchRequestId,TurtleSearchRequestInfo>::iterator tmp(it) ;
-				++tmp ;
-				_search_requests_origins.erase(it) ;
-				it = tmp ;
-			}
-			else
-				++it;
+		_search_requests_origins.expire(now) ;
+		_tunnel_requests_origins.expire(now) ;
 	}
 
-	// Tunnel requests
-	//
+	_search_results_cache.expire(now) ;
+
+	// Search budgets of friends that are gone.
 	{
+		std::set<RsPeerId> onlineIds ;
+		mServiceControl->getPeersConnected(_service_type, onlineIds);
+
 		RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
 
-		for(std::map<TurtleTunnelRequestId,TurtleTunnelRequestInfo>::iterator it(_tunnel_requests_origins.begin());it!=_tunnel_requests_origins.end();)
-			if(now > (rstime_t)(it->second.time_stamp + TUNNEL_REQUESTS_LIFE_TIME))
-			{
-#ifdef P3TURTLE_DEBUG
-				std::cerr << "  removed tunnel request " << HEX_PRINT(it->first) << ", timeout." << std::endl ;
-#endif
-				std::map<TurtleTunnelRequestId,TurtleTunnelRequestInfo>::iterator tmp(it) ;
-				++tmp ;
-				_tunnel_requests_origins.erase(it) ;
-				it = tmp ;
-			}
+		for(std::map<RsPeerId,RsTokenBucket>::iterator it(_search_forward_budgets.begin());it!=_search_forward_budgets.end();)
+			if(onlineIds.find(it->first) == onlineIds.end())
+				it = _search_forward_budgets.erase(it) ;
 			else
 				++it ;
 	}
@@ -540,7 +550,7 @@ void p3turtle::autoWash()
 
 		std::vector<TurtleTunnelId> tunnels_to_close ;
 
-		for(std::map<TurtleTunnelId,TurtleTunnel>::iterator it(_local_tunnels.begin());it!=_local_tunnels.end();++it)
+		for(std::unordered_map<TurtleTunnelId,TurtleTunnel>::iterator it(_local_tunnels.begin());it!=_local_tunnels.end();++it)
 			if(now > (rstime_t)(it->second.time_stamp + MAXIMUM_TUNNEL_IDLE_TIME))
 			{
 #ifdef P3TURTLE_DEBUG
@@ -587,7 +597,7 @@ void p3turtle::locked_closeTunnel(TurtleTunnelId tid,std::vector<std::pair<RsTur
 	// tunnel closing commands. In our case, this is not necessary, because if a tunnel is closed somewhere, its
 	// source is not going to be used and the tunnel will eventually disappear.
 	//
-	std::map<TurtleTunnelId,TurtleTunnel>::iterator it(_local_tunnels.find(tid)) ;
+	std::unordered_map<TurtleTunnelId,TurtleTunnel>::iterator it(_local_tunnels.find(tid)) ;
 
 	if(it == _local_tunnels.end())
 	{
@@ -667,6 +677,7 @@ void p3turtle::locked_closeTunnel(TurtleTunnelId tid,std::vector<std::pair<RsTur
 		}
 	}
 
+	_tunnel_routes.removeRoute(tid) ;
 	_local_tunnels.erase(it) ;
 }
 
@@ -906,8 +917,7 @@ void p3turtle::handleSearchRequest(RsTurtleSearchRequestItem *item)
 			return;
 		}
 
-		if( _search_requests_origins.find(item->request_id) !=
-		        _search_requests_origins.end() )
+		if( _search_requests_origins.find(item->request_id) != NULL )
 		{
 			/* If the item contains an already handled search request, give up.
 			 * This happens when the same search request gets relayed by
@@ -947,9 +957,11 @@ void p3turtle::handleSearchRequest(RsTurtleSearchRequestItem *item)
 	// This is a new request. Let's add it to the request map, and forward it to
 	// open peers.
 
-	TurtleSearchRequestInfo& req( _search_requests_origins[item->request_id] ) ;
+	rstime_t now = time(NULL) ;
+
+	TurtleSearchRequestInfo& req( _search_requests_origins.insert(item->request_id,now) ) ;
 	req.origin = item->PeerId() ;
-	req.time_stamp = time(NULL) ;
+	req.time_stamp = now ;
 	req.depth = item->depth ;
 	req.result_count = search_result_count;
 	req.keywords = item->GetKeywords() ;
@@ -979,6 +991,7 @@ void p3turtle::handleSearchRequest(RsTurtleSearchRequestItem *item)
 #ifdef P3TURTLE_DEBUG
 		std::cerr << "  Looking for online peers" << std::endl ;
 #endif
+		std::vector<RsPeerId> forward_ids ;
 
 		for(std::set<RsPeerId>::const_iterator it(onlineIds.begin());it!=onlineIds.end();++it)
 		{
@@ -991,26 +1004,57 @@ void p3turtle::handleSearchRequest(RsTurtleSearchRequestItem *item)
 				continue ;
 
 			if(*it != item->PeerId())
+				forward_ids.push_back(*it) ;
+		}
+
+		// Each friend gets a budget of forwarded search traffic. Boolean expressions
+		// count double, since every node they go through has to match them against
+		// all its files.
+
+		if(item->PeerId() != _own_id && !forward_ids.empty())
+		{
+			RsTokenBucket& budget(_search_forward_budgets[item->PeerId()]) ;
+
+			if(budget.rate() == 0)
+				budget.setRate(SEARCH_FORWARD_BUDGET_PER_FRIEND) ;
+
+			if(budget.available() < 0)
 			{
 #ifdef P3TURTLE_DEBUG
-				std::cerr << "  Forwarding request to peer = " << *it << std::endl ;
+				std::cerr << "  Friend " << item->PeerId() << " exceeded its search budget. Not forwarding." << std::endl ;
 #endif
-				// Copy current item and modify it.
-				RsTurtleSearchRequestItem *fwd_item = item->clone() ;
+				++_search_forwards_dropped ;
+				return ;
+			}
 
-				// increase search depth, except in some rare cases, to prevent correlation between
-				// TR sniffing and friend names. The strategy is to not increase depth if the depth
-				// is 1:
-				// 	If B receives a TR of depth 1 from A, B cannot deduice that A is downloading the
-				// 	file, since A might have shifted the depth.
-				//
-				if(!random_dshift)
-					++(fwd_item->depth) ;
+			uint32_t cost = item_size * forward_ids.size() ;
 
-				fwd_item->PeerId(*it) ;
+			if(dynamic_cast<RsTurtleRegExpSearchRequestItem*>(item) != NULL)
+				cost *= 2 ;
 
-				sendItem(fwd_item) ;
-			}
+			budget.consume(cost) ;
+		}
+
+		for(std::vector<RsPeerId>::const_iterator it(forward_ids.begin());it!=forward_ids.end();++it)
+		{
+#ifdef P3TURTLE_DEBUG
+			std::cerr << "  Forwarding request to peer = " << *it << std::endl ;
+#endif
+			// Copy current item and modify it.
+			RsTurtleSearchRequestItem *fwd_item = item->clone() ;
+
+			// increase search depth, except in some rare cases, to prevent correlation between
+			// TR sniffing and friend names. The strategy is to not increase depth if the depth
+			// is 1:
+			// 	If B receives a TR of depth 1 from A, B cannot deduice that A is downloading the
+			// 	file, since A might have shifted the depth.
+			//
+			if(!random_dshift)
+				++(fwd_item->depth) ;
+
+			fwd_item->PeerId(*it) ;
+
+			sendItem(fwd_item) ;
 		}
 	}
 #ifdef P3TURTLE_DEBUG
@@ -1083,8 +1127,27 @@ void p3turtle::performLocalSearch_files(
 {
 	Dbg3() << __PRETTY_FUNCTION__ << " " << *item << std::endl;
 
-    std::list<TurtleFileInfo> initialResults ;
-    item->search(initialResults) ;
+	std::vector<TurtleFileInfoV2> initialResults ;
+
+	// The same searches come back from many origins within seconds, so the
+	// results are reused for a while. Only the results that can be sent back
+	// are kept.
+
+	std::string key = item->PeerId().toStdString() + item->searchKey() ;
+	rstime_t now = time(NULL) ;
+
+	if(!_search_results_cache.find(key,now,initialResults))
+	{
+		int64_t start = RsTokenBucket::monotonicTimeUs() ;
+
+		std::list<TurtleFileInfo> found ;
+		item->search(found) ;
+
+		for(auto it(found.begin());it!=found.end() && initialResults.size() < TURTLE_SEARCH_RESULT_MAX_HITS_FILES;++it)
+			initialResults.push_back(TurtleFileInfoV2(*it)) ;
+
+		_search_results_cache.store(key,now,initialResults,RsTokenBucket::monotonicTimeUs() - start) ;
+	}
 
 #ifdef P3TURTLE_DEBUG
 	std::cerr << initialResults.size() << " matches found." << std::endl ;
@@ -1105,13 +1168,20 @@ void p3turtle::performLocalSearch_files(
 
 		result.push_back(res_item) ;
 		}
-		res_item->result.push_back(*it);
+
+		// the search result items still carry the old format
+
+		TurtleFileInfo info ;
+		info.size = it->fSize ;
+		info.hash = it->fHash ;
+		info.name = it->fName ;
+		res_item->result.push_back(info);
 
 		// Let's chop search results items into several chunks of finite size to avoid exceeding streamer's capacity.
 		//
 		++req_result_count ;	// increase hit number for this particular search request.
 
-		item_size += 8 /* size */ + it->hash.serial_size() + it->name.size() ;
+		item_size += 8 /* size */ + it->fHash.serial_size() + it->fName.size() ;
 
 		if(item_size > RSTURTLE_MAX_SEARCH_RESPONSE_SIZE)
 		{
@@ -1160,13 +1230,13 @@ void p3turtle::handleSearchResult(RsTurtleSearchResultItem *item)
 		RS_STACK_MUTEX(mTurtleMtx);
 		// Find who actually sent the corresponding request.
 		//
-		std::map<TurtleRequestId,TurtleSearchRequestInfo>::iterator it = _search_requests_origins.find(item->request_id) ;
+		TurtleSearchRequestInfo *req = _search_requests_origins.find(item->request_id) ;
 
 #ifdef P3TURTLE_DEBUG
 		std::cerr << "Received search result:" << std::endl ;
 		item->print(std::cerr,0) ;
 #endif
-		if(it == _search_requests_origins.end())
+		if(req == NULL)
 		{
 			// This is an error: how could we receive a search result corresponding to a search item we
 			// have forwarded but that it not in the list ??
@@ -1178,7 +1248,7 @@ void p3turtle::handleSearchResult(RsTurtleSearchResultItem *item)
 		// Is this result too old?
 		// Search Requests younger than SEARCH_REQUESTS_LIFE_TIME are kept in the cache, so that they are not duplicated if they bounce in the network
 		// Nevertheless results received for Search Requests older than SEARCH_REQUESTS_RESULT_TIME are considered obsolete and discarded
-		if (time(NULL) > it->second.time_stamp + SEARCH_REQUESTS_RESULT_TIME)
+		if (time(NULL) > req->time_stamp + SEARCH_REQUESTS_RESULT_TIME)
 		{
 #ifdef P3TURTLE_DEBUG
 			RsDbg() << "TURTLE p3turtle::handleSearchResult Search Request is known, but result arrives too late, dropping";
@@ -1188,49 +1258,49 @@ void p3turtle::handleSearchResult(RsTurtleSearchResultItem *item)
 
 		// Is this result's target actually ours ?
 
-		if(it->second.origin == _own_id)
+		if(req->origin == _own_id)
 		{
-			it->second.result_count += item->count() ;
+			req->result_count += item->count() ;
 
-            auto it2 = _registered_services.find(it->second.service_id) ;
+            auto it2 = _registered_services.find(req->service_id) ;
 
             if(it2 != _registered_services.end())
 				results_to_notify_off_mutex.push_back(std::make_pair(item,it2->second)) ;
             else
-                std::cerr << "(EE) cannot find client service for ID " << std::hex << it->second.service_id << std::dec << ": search result item will be dropped." << std::endl;
+                std::cerr << "(EE) cannot find client service for ID " << std::hex << req->service_id << std::dec << ": search result item will be dropped." << std::endl;
 		}
 		else
 		{									// Nope, so forward it back.
 #ifdef P3TURTLE_DEBUG
-			std::cerr << "  Forwarding result back to " << it->second.origin << std::endl;
+			std::cerr << "  Forwarding result back to " << req->origin << std::endl;
 #endif
 			// We update the total count forwarded back, and chop it to TURTLE_SEARCH_RESULT_MAX_HITS.
 
 			uint32_t n = item->count(); // not so good!
 
-			if(it->second.result_count >= it->second.max_allowed_hits)
+			if(req->result_count >= req->max_allowed_hits)
 			{
 				std::cerr << "(WW) exceeded turtle search result to forward. Req=" << std::hex << item->request_id << std::dec
-				          << " already forwarded: " << it->second.result_count << ", max_allowed: " << it->second.max_allowed_hits << ": dropping item with " << n << " elements." << std::endl;
+				          << " already forwarded: " << req->result_count << ", max_allowed: " << req->max_allowed_hits << ": dropping item with " << n << " elements." << std::endl;
 				return ;
 			}
 
-			if(it->second.result_count + n > it->second.max_allowed_hits)
+			if(req->result_count + n > req->max_allowed_hits)
 			{
-				for(uint32_t i=it->second.result_count + n; i>it->second.max_allowed_hits;--i)
+				for(uint32_t i=req->result_count + n; i>req->max_allowed_hits;--i)
 					item->pop() ;
 
-				it->second.result_count = it->second.max_allowed_hits ;
+				req->result_count = req->max_allowed_hits ;
 			}
 			else
-				it->second.result_count += n ;
+				req->result_count += n ;
 
 			RsTurtleSearchResultItem *fwd_item = item->duplicate();
 
 			// Normally here, we should setup the forward adress, so that the owner's
 			// of the files found can be further reached by a tunnel.
 
-			fwd_item->PeerId(it->second.origin) ;
+			fwd_item->PeerId(req->origin) ;
 
 			sendItem(fwd_item) ;
 		}
@@ -1286,13 +1356,13 @@ void p3turtle::routeGenericTunnelItem(RsTurtleGenericTunnelItem *item)
 #endif
 
 	{
-		RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
-
-		// look for the tunnel id.
+		// Look for the tunnel id. This only uses the routing table, and not the turtle
+		// mutex, so that forwarding is never blocked by the tunnel management passes.
 		//
-		std::map<TurtleTunnelId,TurtleTunnel>::iterator it(_local_tunnels.find(item->tunnelId())) ;
+		TurtlePeerId local_src,local_dst ;
+		uint32_t item_size = RsTurtleSerialiser().size(item) ;
 
-		if(it == _local_tunnels.end())
+		if(!_tunnel_routes.route(item->tunnelId(),item_size,item->shouldStampTunnel(),local_src,local_dst))
 		{
 #ifdef P3TURTLE_DEBUG
 			std::cerr << "p3turtle: got file map with unknown tunnel id " << HEX_PRINT(item->tunnelId()) << std::endl ;
@@ -1301,23 +1371,17 @@ void p3turtle::routeGenericTunnelItem(RsTurtleGenericTunnelItem *item)
 			return ;
 		}
 
-		TurtleTunnel& tunnel(it->second) ;
-
 		// Only file data transfer updates tunnels time_stamp field, to avoid maintaining tunnel that are incomplete.
-		if(item->shouldStampTunnel())
-			tunnel.time_stamp = time(NULL) ;
-
-		tunnel.transfered_bytes += RsTurtleSerialiser().size(item);
 
-		if(item->PeerId() == tunnel.local_dst)
+		if(item->PeerId() == local_dst)
 			item->setTravelingDirection(RsTurtleGenericTunnelItem::DIRECTION_CLIENT) ;
-		else if(item->PeerId() == tunnel.local_src)
+		else if(item->PeerId() == local_src)
 			item->setTravelingDirection(RsTurtleGenericTunnelItem::DIRECTION_SERVER) ;
 		else
 		{
 			std::cerr << "(EE) p3turtle::routeGenericTunnelItem(): item mismatches tunnel src/dst ids." << std::endl;
-			std::cerr << "(EE)          tunnel.local_src = " << tunnel.local_src << std::endl;
-			std::cerr << "(EE)          tunnel.local_dst = " << tunnel.local_dst << std::endl;
+			std::cerr << "(EE)          tunnel.local_src = " << local_src << std::endl;
+			std::cerr << "(EE)          tunnel.local_dst = " << local_dst << std::endl;
 			std::cerr << "(EE)            item->PeerId() = " << item->PeerId()    << std::endl;
 			std::cerr << "(EE) This item is probably lost while tunnel route got redefined. Deleting this item." << std::endl ;
 			delete item ;
@@ -1326,14 +1390,19 @@ void p3turtle::routeGenericTunnelItem(RsTurtleGenericTunnelItem *item)
 
 		// Let's figure out whether this packet is for us or not.
 
-		if(item->PeerId() == tunnel.local_dst && tunnel.local_src != _own_id) //direction == RsTurtleGenericTunnelItem::DIRECTION_CLIENT &&
+		if(item->PeerId() == local_dst && local_src != _own_id) //direction == RsTurtleGenericTunnelItem::DIRECTION_CLIENT &&
 		{
 #ifdef P3TURTLE_DEBUG
-			std::cerr << "  Forwarding generic item to peer " << tunnel.local_src << std::endl ;
+			std::cerr << "  Forwarding generic item to peer " << local_src << std::endl ;
 #endif
-			item->PeerId(tunnel.local_src) ;
+			if(forwardQueueFull(local_src,item,item_size))
+			{
+				delete item ;
+				return ;
+			}
+			item->PeerId(local_src) ;
 
-			_traffic_info_buffer.unknown_updn_Bps += RsTurtleSerialiser().size(item) ;
+			_unknown_updn_bytes += item_size ;
 
 			// This has been disabled for compilation reasons. Not sure we actually need it.
 			//
@@ -1344,22 +1413,27 @@ void p3turtle::routeGenericTunnelItem(RsTurtleGenericTunnelItem *item)
 			return ;
 		}
 
-		if(item->PeerId() == tunnel.local_src && tunnel.local_dst != _own_id) //direction == RsTurtleGenericTunnelItem::DIRECTION_SERVER &&
+		if(item->PeerId() == local_src && local_dst != _own_id) //direction == RsTurtleGenericTunnelItem::DIRECTION_SERVER &&
 		{
 #ifdef P3TURTLE_DEBUG
-			std::cerr << "  Forwarding generic item to peer " << tunnel.local_dst << std::endl ;
+			std::cerr << "  Forwarding generic item to peer " << local_dst << std::endl ;
 #endif
-			item->PeerId(tunnel.local_dst) ;
+			if(forwardQueueFull(local_dst,item,item_size))
+			{
+				delete item ;
+				return ;
+			}
+			item->PeerId(local_dst) ;
 
-			_traffic_info_buffer.unknown_updn_Bps += RsTurtleSerialiser().size(item);
+			_unknown_updn_bytes += item_size ;
 
 			sendItem(item) ;
 			return ;
         }
 
-        // item is for us. Use the locked region to record the data.
+        // item is for us.
 
-        _traffic_info_buffer.data_dn_Bps += RsTurtleSerialiser().size(item);
+        _data_dn_bytes += item_size ;
     }
 
 	// The packet was not forwarded, so it is for us. Let's treat it.
@@ -1391,7 +1465,7 @@ bool p3turtle::getTunnelServiceInfo(TurtleTunnelId tunnel_id,RsPeerId& vpid,RsFi
 {
 	RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
 
-	std::map<TurtleTunnelId,TurtleTunnel>::iterator it2(_local_tunnels.find(tunnel_id)) ;
+	std::unordered_map<TurtleTunnelId,TurtleTunnel>::iterator it2(_local_tunnels.find(tunnel_id)) ;
 
 	if(it2 == _local_tunnels.end())
 	{
@@ -1457,50 +1531,48 @@ bool p3turtle::getTunnelServiceInfo(TurtleTunnelId tunnel_id,RsPeerId& vpid,RsFi
 //
 void p3turtle::sendTurtleData(const RsPeerId& virtual_peer_id,RsTurtleGenericTunnelItem *item)
 {
-	RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
+	TurtleTunnelId tunnel_id ;
 
-	// get the proper tunnel for this file hash and peer id.
-	std::map<TurtleVirtualPeerId,TurtleTunnelId>::const_iterator it(_virtual_peers.find(virtual_peer_id)) ;
-
-	if(it == _virtual_peers.end())
 	{
+		RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
+
+		// get the proper tunnel for this file hash and peer id.
+		std::map<TurtleVirtualPeerId,TurtleTunnelId>::const_iterator it(_virtual_peers.find(virtual_peer_id)) ;
+
+		if(it == _virtual_peers.end())
+		{
 #ifdef P3TURTLE_DEBUG
-		std::cerr << "p3turtle::senddataRequest: cannot find virtual peer " << virtual_peer_id << " in VP list." << std::endl ;
+			std::cerr << "p3turtle::senddataRequest: cannot find virtual peer " << virtual_peer_id << " in VP list." << std::endl ;
 #endif
-		delete item ;
-		return ;
+			delete item ;
+			return ;
+		}
+		tunnel_id = it->second ;
 	}
-	TurtleTunnelId tunnel_id = it->second ;
-	std::map<TurtleTunnelId,TurtleTunnel>::iterator it2( _local_tunnels.find(tunnel_id) ) ;
 
-	if(it2 == _local_tunnels.end())
+	item->tunnel_id = tunnel_id ;	// we should randomly select a tunnel, or something more clever.
+
+	uint32_t ss = RsTurtleSerialiser().size(item);
+	TurtlePeerId local_src,local_dst ;
+
+	if(!_tunnel_routes.route(tunnel_id,ss,item->shouldStampTunnel(),local_src,local_dst))
 	{
 		std::cerr << "p3turtle::client asked to send a packet through tunnel that has previously been deleted. Not a big issue unless it happens in masses." << std::endl;
 		delete item ;
 		return ;
 	}
-	TurtleTunnel& tunnel(it2->second) ;
-
-	item->tunnel_id = tunnel_id ;	// we should randomly select a tunnel, or something more clever.
-
-	uint32_t ss = RsTurtleSerialiser().size(item);
-
-	if(item->shouldStampTunnel())
-		tunnel.time_stamp = time(NULL) ;
 
-	tunnel.transfered_bytes += ss ;
-
-	if(tunnel.local_src == _own_id)
+	if(local_src == _own_id)
 	{
 		item->setTravelingDirection(RsTurtleGenericTunnelItem::DIRECTION_SERVER) ;
-		item->PeerId(tunnel.local_dst) ;
-		_traffic_info_buffer.data_dn_Bps += ss ;
+		item->PeerId(local_dst) ;
+		_data_dn_bytes += ss ;
 	}
-	else if(tunnel.local_dst == _own_id)
+	else if(local_dst == _own_id)
 	{
 		item->setTravelingDirection(RsTurtleGenericTunnelItem::DIRECTION_CLIENT) ;
-		item->PeerId(tunnel.local_src) ;
-		_traffic_info_buffer.data_up_Bps += ss ;
+		item->PeerId(local_src) ;
+		_data_up_bytes += ss ;
 	}
 	else
 	{
@@ -1510,11 +1582,61 @@ void p3turtle::sendTurtleData(const RsPeerId& virtual_peer_id,RsTurtleGenericTun
 	}
 
 #ifdef P3TURTLE_DEBUG
-	std::cerr << "p3turtle: sending service packet to virtual peer id " << virtual_peer_id << ", hash=0x" << tunnel.hash << ", tunnel = " << HEX_PRINT(item->tunnel_id) << ", next peer=" << tunnel.local_dst << std::endl ;
+	std::cerr << "p3turtle: sending service packet to virtual peer id " << virtual_peer_id << ", tunnel = " << HEX_PRINT(item->tunnel_id) << ", next peer=" << item->PeerId() << std::endl ;
 #endif
 	sendItem(item) ;
 }
 
+bool p3turtle::forwardQueueFull(const TurtlePeerId& next_hop, const RsTurtleGenericTunnelItem *item, uint32_t item_size)
+{
+	// File data that the next friend cannot take is dropped, rather than queued
+	// without bound for a slow friend. Everything else is always forwarded.
+
+	if(!mayDropForwardedItem(item))
+		return false ;
+
+	if(canSendItems(next_hop,item_size))
+		return false ;
+
+#ifdef P3TURTLE_DEBUG
+	std::cerr << "p3turtle: out queue of " << next_hop << " is full. Dropping forwarded item of size " << item_size << std::endl;
+#endif
+	return true ;
+}
+
+bool p3turtle::mayDropForwardedItem(const RsTurtleGenericTunnelItem *item)
+{
+	// The downloading end requests missing file chunks again after a timeout.
+	// Generic data (GXS net tunnels, distant chat...) is not resent by anyone.
+	// File data of encrypted tunnels travels as generic data, so it cannot be
+	// told apart here and is always forwarded as well.
+
+	return item->PacketSubType() == RS_TURTLE_SUBTYPE_FILE_DATA ;
+}
+
+bool p3turtle::canSendTurtleData(const RsPeerId& virtual_peer_id, uint32_t size)
+{
+	TurtlePeerId next_hop ;
+
+	{
+		RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
+
+		std::map<TurtleVirtualPeerId,TurtleTunnelId>::const_iterator it(_virtual_peers.find(virtual_peer_id)) ;
+
+		if(it == _virtual_peers.end())
+			return true ;	// sendTurtleData() will drop the data anyway
+
+		std::unordered_map<TurtleTunnelId,TurtleTunnel>::const_iterator tit(_local_tunnels.find(it->second)) ;
+
+		if(tit == _local_tunnels.end())
+			return true ;
+
+		next_hop = (tit->second.local_src == _own_id)?tit->second.local_dst:tit->second.local_src ;
+	}
+
+	return canSendItems(next_hop,size) ;
+}
+
 bool p3turtle::isTurtlePeer(const RsPeerId& peer_id) const
 {
 	RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
@@ -1526,7 +1648,7 @@ RsPeerId p3turtle::getTurtlePeerId(TurtleTunnelId tid) const
 {
 	RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
 
-	std::map<TurtleTunnelId,TurtleTunnel>::const_iterator it( _local_tunnels.find(tid) ) ;
+	std::unordered_map<TurtleTunnelId,TurtleTunnel>::const_iterator it( _local_tunnels.find(tid) ) ;
 
 #ifdef P3TURTLE_DEBUG
 	assert(it!=_local_tunnels.end()) ;
@@ -1620,9 +1742,7 @@ void p3turtle::handleTunnelRequest(RsTurtleOpenTunnelItem *item)
 	{
 		RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
 
-		std::map<TurtleTunnelRequestId,TurtleTunnelRequestInfo>::iterator it = _tunnel_requests_origins.find(item->request_id) ;
-
-		if(it != _tunnel_requests_origins.end())
+		if(_tunnel_requests_origins.find(item->request_id) != NULL)
 		{
 #ifdef P3TURTLE_DEBUG
 			std::cerr << "  This is a bouncing request. Ignoring and deleting item." << std::endl ;
@@ -1633,9 +1753,11 @@ void p3turtle::handleTunnelRequest(RsTurtleOpenTunnelItem *item)
 		// it to open peers, while the mutex is locked, so no-one can trigger the
 		// lock before the data is consistent.
 
-		TurtleTunnelRequestInfo& req( _tunnel_requests_origins[item->request_id] ) ;
+		rstime_t now = time(NULL) ;
+
+		TurtleTunnelRequestInfo& req( _tunnel_requests_origins.insert(item->request_id,now) ) ;
 		req.origin = item->PeerId() ;
-		req.time_stamp = time(NULL) ;
+		req.time_stamp = now ;
 		req.depth = item->depth ;
 
 #ifdef TUNNEL_STATISTICS
@@ -1693,6 +1815,7 @@ void p3turtle::handleTunnelRequest(RsTurtleOpenTunnelItem *item)
 				tt.speed_Bps = 0.0f ;
 
 				_local_tunnels[t_id] = tt ;
+				_tunnel_routes.addRoute(t_id,tt.local_src,tt.local_dst,tt.time_stamp) ;
 
 				// We add a virtual peer for that tunnel+hash combination.
 				//
@@ -1852,13 +1975,13 @@ void p3turtle::handleTunnelResult(RsTurtleTunnelOkItem *item)
 
 		// Find who actually sent the corresponding turtle tunnel request.
 		//
-		std::map<TurtleTunnelRequestId,TurtleTunnelRequestInfo>::iterator it = _tunnel_requests_origins.find(item->request_id) ;
+		TurtleTunnelRequestInfo *req = _tunnel_requests_origins.find(item->request_id) ;
 #ifdef P3TURTLE_DEBUG
 		std::cerr << "Received tunnel result:" << std::endl ;
 		item->print(std::cerr,0) ;
 #endif
 
-		if(it == _tunnel_requests_origins.end())
+		if(req == NULL)
 		{
 			// This is an error: how could we receive a tunnel result corresponding to a tunnel item we
 			// have forwarded but that it not in the list ?? Actually that happens, when tunnel requests
@@ -1869,13 +1992,13 @@ void p3turtle::handleTunnelResult(RsTurtleTunnelOkItem *item)
 #endif
 			return ;
 		}
-		if(it->second.responses.find(item->tunnel_id) != it->second.responses.end())
+		if(req->responses.find(item->tunnel_id) != req->responses.end())
 		{
 			std::cerr << "p3turtle: ERROR: received a tunnel response twice. That should not happen." << std::endl;
 			return ;
 		}
 		else
-			it->second.responses.insert(item->tunnel_id) ;
+			req->responses.insert(item->tunnel_id) ;
 
 		// store tunnel info.
 		bool found = (_local_tunnels.find(item->tunnel_id) != _local_tunnels.end()) ;
@@ -1889,13 +2012,15 @@ void p3turtle::handleTunnelResult(RsTurtleTunnelOkItem *item)
 		}
 		else
 		{
-			tunnel.local_src = it->second.origin ;
+			tunnel.local_src = req->origin ;
 			tunnel.local_dst = item->PeerId() ;
 			tunnel.hash.clear() ;
 			tunnel.time_stamp = time(NULL) ;
 			tunnel.transfered_bytes = 0 ;
 			tunnel.speed_Bps = 0.0f ;
 
+			_tunnel_routes.addRoute(item->tunnel_id,tunnel.local_src,tunnel.local_dst,tunnel.time_stamp) ;
+
 #ifdef P3TURTLE_DEBUG
 			std::cerr << "  storing tunnel info. src=" << tunnel.local_src << ", dst=" << tunnel.local_dst << ", id=" << item->tunnel_id << std::endl ;
 #endif
@@ -1904,7 +2029,7 @@ void p3turtle::handleTunnelResult(RsTurtleTunnelOkItem *item)
 		// Is this result too old?
 		// Tunnel Requests younger than TUNNEL_REQUESTS_LIFE_TIME are kept in the cache, so that they are not duplicated if they bounce in the network
 		// Nevertheless results received for Tunnel Requests older than TUNNEL_REQUESTS_RESULT_TIME are considered obsolete and discarded
-		if (time(NULL) > it->second.time_stamp + TUNNEL_REQUESTS_RESULT_TIME)
+		if (time(NULL) > req->time_stamp + TUNNEL_REQUESTS_RESULT_TIME)
 		{
 #ifdef P3TURTLE_DEBUG
 			RsDbg() << "TURTLE p3turtle::handleTunnelResult Tunnel Request is known, but result arrives too late, dropping";
@@ -1914,10 +2039,10 @@ void p3turtle::handleTunnelResult(RsTurtleTunnelOkItem *item)
 
 		// Is this result's target actually ours ?
 
-		if(it->second.origin == _own_id)
+		if(req->origin == _own_id)
 		{
 #ifdef P3TURTLE_DEBUG
-			std::cerr << "  Tunnel starting point. Storing id=" << HEX_PRINT(item->tunnel_id) << " for hash (unknown) and tunnel request id " << it->second.origin << std::endl;
+			std::cerr << "  Tunnel starting point. Storing id=" << HEX_PRINT(item->tunnel_id) << " for hash (unknown) and tunnel request id " << req->origin << std::endl;
 #endif
 			// Tunnel is ending here. Add it to the list of tunnels for the given hash.
 
@@ -1967,10 +2092,10 @@ void p3turtle::handleTunnelResult(RsTurtleTunnelOkItem *item)
 		else
 		{											// Nope, forward it back.
 #ifdef P3TURTLE_DEBUG
-			std::cerr << "  Forwarding result back to " << it->second.origin << std::endl;
+			std::cerr << "  Forwarding result back to " << req->origin << std::endl;
 #endif
 			RsTurtleTunnelOkItem *fwd_item = new RsTurtleTunnelOkItem(*item) ;	// copy the item
-			fwd_item->PeerId(it->second.origin) ;
+			fwd_item->PeerId(req->origin) ;
 
 			sendItem(fwd_item) ;
 		}
@@ -2288,6 +2413,14 @@ static std::string printNumber(uint64_t num,bool hex=false)
 	}
 }
 
+void p3turtle::getSearchStatistics(TurtleSearchStatistics& stats) const
+{
+	_search_results_cache.getStatistics(stats) ;
+
+	RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
+	stats.forwards_dropped = _search_forwards_dropped ;
+}
+
 void p3turtle::getTrafficStatistics(TurtleTrafficStatisticsInfo& info) const
 {
 	RsStackMutex stack(mTurtleMtx); /********** STACK LOCKED MTX ******/
@@ -2325,7 +2458,7 @@ std::string p3turtle::getPeerNameForVirtualPeerId(const RsPeerId& virtual_peer_i
 	std::map<TurtleVirtualPeerId,TurtleTunnelId>::const_iterator it(_virtual_peers.find(virtual_peer_id)) ;
 	if(it != _virtual_peers.end())
 	{
-		std::map<TurtleTunnelId,TurtleTunnel>::iterator it2( _local_tunnels.find(it->second) ) ;
+		std::unordered_map<TurtleTunnelId,TurtleTunnel>::iterator it2( _local_tunnels.find(it->second) ) ;
 		if(it2 != _local_tunnels.end())
 		{
 			if(it2->second.local_src == _own_id)
@@ -2385,7 +2518,7 @@ void p3turtle::getInfo(	std::vector<std::vector<std::string> >& hashes_info,
 
 	tunnels_info.clear();
 
-	for(std::map<TurtleTunnelId,TurtleTunnel>::const_iterator it(_local_tunnels.begin());it!=_local_tunnels.end();++it)
+	for(std::unordered_map<TurtleTunnelId,TurtleTunnel>::const_iterator it(_local_tunnels.begin());it!=_local_tunnels.end();++it)
 	{
 		tunnels_info.push_back(std::vector<std::string>()) ;
 		std::vector<std::string>& tunnel(tunnels_info.back()) ;
@@ -2410,33 +2543,33 @@ void p3turtle::getInfo(	std::vector<std::vector<std::string> >& hashes_info,
 
 	search_reqs_info.clear();
 
-	for(std::map<TurtleSearchRequestId,TurtleSearchRequestInfo>::const_iterator it(_search_requests_origins.begin());it!=_search_requests_origins.end();++it)
+	_search_requests_origins.forEach([&](const TurtleSearchRequestId& id,const TurtleSearchRequestInfo& req)
 	{
 		TurtleSearchRequestDisplayInfo info ;
 
-		info.request_id 		= it->first ;
-		info.source_peer_id 	= it->second.origin ;
-		info.age 				= now - it->second.time_stamp ;
-		info.depth 				= it->second.depth ;
-		info.keywords           = it->second.keywords ;
-		info.hits               = it->second.result_count ;
+		info.request_id 		= id ;
+		info.source_peer_id 	= req.origin ;
+		info.age 				= now - req.time_stamp ;
+		info.depth 				= req.depth ;
+		info.keywords           = req.keywords ;
+		info.hits               = req.result_count ;
 
 		search_reqs_info.push_back(info) ;
-	}
+	});
 
 	tunnel_reqs_info.clear();
 
-	for(std::map<TurtleSearchRequestId,TurtleTunnelRequestInfo>::const_iterator it(_tunnel_requests_origins.begin());it!=_tunnel_requests_origins.end();++it)
+	_tunnel_requests_origins.forEach([&](const TurtleTunnelRequestId& id,const TurtleTunnelRequestInfo& req)
 	{
 		TurtleTunnelRequestDisplayInfo info ;
 
-		info.request_id 		= it->first ;
-		info.source_peer_id 	= it->second.origin ;
-		info.age 				= now - it->second.time_stamp ;
-		info.depth 				= it->second.depth ;
+		info.request_id 		= id ;
+		info.source_peer_id 	= req.origin ;
+		info.age 				= now - req.time_stamp ;
+		info.depth 				= req.depth ;
 
 		tunnel_reqs_info.push_back(info) ;
-	}
+	});
 }
 
 #ifdef P3TURTLE_DEBUG
@@ -2461,7 +2594,7 @@ void p3turtle::dumpState()
         std::cerr << "    TID=0x" << it->first << std::endl ;
 
 	std::cerr << "  Local tunnels:" << std::endl ;
-	for(std::map<TurtleTunnelId,TurtleTunnel>::const_iterator it(_local_tunnels.begin());it!=_local_tunnels.end();++it)
+	for(std::unordered_map<TurtleTunnelId,TurtleTunnel>::const_iterator it(_local_tunnels.begin());it!=_local_tunnels.end();++it)
 		std::cerr << "    " << HEX_PRINT(it->first) << ": from="
 					<< it->second.local_src << ", to=" << it->second.local_dst
 					<< ", hash=0x" << it->second.hash << ", ts=" << it->second.time_stamp << " (" << now-it->second.time_stamp << " secs ago)"
@@ -2470,17 +2603,21 @@ void p3turtle::dumpState()
 	std::cerr << "  buffered request origins: " << std::endl ;
 	std::cerr << "    Search requests: " << _search_requests_origins.size() << std::endl ;
 
-	for(std::map<TurtleSearchRequestId,TurtleSearchRequestInfo>::const_iterator it(_search_requests_origins.begin());it!=_search_requests_origins.end();++it)
-		std::cerr 	<< "      " << HEX_PRINT(it->first) << ": from=" << it->second.origin
-						<< ", ts=" << it->second.time_stamp << " (" << now-it->second.time_stamp
+	_search_requests_origins.forEach([&](const TurtleSearchRequestId& id,const TurtleSearchRequestInfo& req)
+	{
+		std::cerr 	<< "      " << HEX_PRINT(id) << ": from=" << req.origin
+						<< ", ts=" << req.time_stamp << " (" << now-req.time_stamp
 						<< " secs ago)"
-		                << it->second.result_count << " hits" << std::endl ;
+		                << req.result_count << " hits" << std::endl ;
+	});
 
 	std::cerr << "    Tunnel requests: " << _tunnel_requests_origins.size() << std::endl ;
-	for(std::map<TurtleTunnelRequestId,TurtleTunnelRequestInfo>::const_iterator it(_tunnel_requests_origins.begin());it!=_tunnel_requests_origins.end();++it)
-		std::cerr 	<< "      " << HEX_PRINT(it->first) << ": from=" << it->second.origin
-						<< ", ts=" << it->second.time_stamp << " (" << now-it->second.time_stamp
+	_tunnel_requests_origins.forEach([&](const TurtleTunnelRequestId& id,const TurtleTunnelRequestInfo& req)
+	{
+		std::cerr 	<< "      " << HEX_PRINT(id) << ": from=" << req.origin
+						<< ", ts=" << req.time_stamp << " (" << now-req.time_stamp
 						<< " secs ago)" << std::endl ;
+	});
 
 	std::cerr << "  Virtual peers:" << std::endl ;
 	for(std::map<TurtleVirtualPeerId,TurtleTunnelId>::const_iterator it(_virtual_peers.begin());it!=_virtual_peers.end();++it)
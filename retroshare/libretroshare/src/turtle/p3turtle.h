@@ -134,18 +134,24 @@
 #include <string>
 #include <list>
 #include <set>
+#include <atomic>
+#include <unordered_map>
 
 #include "pqi/pqinetwork.h"
 #include "pqi/pqi.h"
 #include "pqi/pqimonitor.h"
 #include "ft/ftcontroller.h"
 #include "pqi/p3cfgmgr.h"
+#include "pqi/pqibandwidth.h"
 #include "services/p3service.h"
 #include "ft/ftsearch.h"
 #include "retroshare/rsturtle.h"
 #include "rsturtleitem.h"
 #include "turtleclientservice.h"
 #include "turtlestatistics.h"
+#include "turtleroutingtable.h"
+#include "turtlerequestcache.h"
+#include "turtlesearchcache.h"
 
 //#define TUNNEL_STATISTICS
 
@@ -295,6 +301,9 @@ class p3turtle: public p3Service, public RsTurtle, public p3Config
 		
 		virtual void getTrafficStatistics(TurtleTrafficStatisticsInfo& info) const ;
 
+		/// hit rate of the local search results cache, and searches not forwarded because of the friends budgets.
+		virtual void getSearchStatistics(TurtleSearchStatistics& stats) const override ;
+
 		/************* from p3service *******************/
 
 		/// This function does many things:
@@ -334,6 +343,14 @@ class p3turtle: public p3Service, public RsTurtle, public p3Config
 		/// Send a data request into the correct tunnel for the given file hash
 		void sendTurtleData(const RsPeerId& virtual_peer_id, RsTurtleGenericTunnelItem *item) ;
 
+		/// true if size more bytes of data for the virtual peer fit in the out queue budget of the friend
+		/// its tunnel goes through (see pqiService::canSendItems()).
+		bool canSendTurtleData(const RsPeerId& virtual_peer_id, uint32_t size) ;
+
+		/// true if a forwarded item may be dropped when the next friend's out queue is full, because the
+		/// tunnel ends ask for it again. Only file data in clear is: other items have no retransmission.
+		static bool mayDropForwardedItem(const RsTurtleGenericTunnelItem *item) ;
+
 		/// Encrypts/decrypts an item, using a autenticated construction + chacha20, based on the given 32 bytes master key.
 		/// Input values are not touched (memory is not released). Memory ownership of outputs is left to the client.
 		///
@@ -379,6 +396,8 @@ class p3turtle: public p3Service, public RsTurtle, public p3Config
 
 		/// Generic routing function for all tunnel packets that derive from RsTurtleGenericTunnelItem
 		void routeGenericTunnelItem(RsTurtleGenericTunnelItem *item) ;
+		/// true if a forwarded item should be dropped because next_hop cannot take more data (see mayDropForwardedItem()).
+		bool forwardQueueFull(const TurtlePeerId& next_hop, const RsTurtleGenericTunnelItem *item, uint32_t item_size) ;
 
 		/// specific routing functions for handling particular packets.
 		void handleRecvGenericTunnelItem(RsTurtleGenericTunnelItem *item);
@@ -411,10 +430,17 @@ class p3turtle: public p3Service, public RsTurtle, public p3Config
 		mutable RsMutex mTurtleMtx;
 
 		/// keeps trace of who emmitted a given search request
-		std::map<TurtleSearchRequestId,TurtleSearchRequestInfo> 	_search_requests_origins ;
+		TurtleRequestCache<TurtleSearchRequestId,TurtleSearchRequestInfo> 	_search_requests_origins ;
+
+		/// local results of the recent searches, by friend and search expression. Has its own lock.
+		TurtleSearchCache _search_results_cache ;
+
+		/// budget of each friend for the searches we forward on its behalf, in bytes of forwarded requests.
+		std::map<RsPeerId,RsTokenBucket> _search_forward_budgets ;
+		uint64_t _search_forwards_dropped ;
 
 		/// keeps trace of who emmitted a tunnel request
-		std::map<TurtleTunnelRequestId,TurtleTunnelRequestInfo> 	_tunnel_requests_origins ;
+		TurtleRequestCache<TurtleTunnelRequestId,TurtleTunnelRequestInfo> 	_tunnel_requests_origins ;
 
 		/// stores adequate tunnels for each file hash locally managed
 		std::map<TurtleFileHash,TurtleHashInfo>			   	_incoming_file_hashes ;
@@ -423,7 +449,10 @@ class p3turtle: public p3Service, public RsTurtle, public p3Config
         std::map<TurtleTunnelId,RsTurtleClientService *>	_outgoing_tunnel_client_services ;
 
 		/// local tunnels, stored by ids (Either transiting or ending).
-		std::map<TurtleTunnelId,TurtleTunnel > 				_local_tunnels ;				
+		std::unordered_map<TurtleTunnelId,TurtleTunnel > 		_local_tunnels ;				
+
+		/// next hops of the local tunnels, for the data path. Has its own locks: not protected by mTurtleMtx.
+		TurtleRoutingTable 							_tunnel_routes ;
 
 		/// Peers corresponding to each tunnel.
 		std::map<TurtleVirtualPeerId,TurtleTunnelId>			_virtual_peers ;				
@@ -454,6 +483,11 @@ class p3turtle: public p3Service, public RsTurtle, public p3Config
 		TurtleTrafficStatisticsInfoOp _traffic_info ;			// used for recording speed
 		TurtleTrafficStatisticsInfoOp _traffic_info_buffer ;	// used as a buffer to collect bytes
 
+		// Bytes counted by the data path, off-mutex. Moved into _traffic_info_buffer at each tunnel management call.
+		std::atomic<uint64_t> _unknown_updn_bytes ;
+		std::atomic<uint64_t> _data_up_bytes ;
+		std::atomic<uint64_t> _data_dn_bytes ;
+
 		float _max_tr_up_rate ;
 		bool  _turtle_routing_enabled ;
 		bool  _turtle_routing_session_enabled ;
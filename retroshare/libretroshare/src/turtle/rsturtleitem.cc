@@ -23,6 +23,7 @@
 #include <stdexcept>
 #endif
 #include <iostream>
+#include <ctype.h>
 #include "turtletypes.h"
 #include "rsturtleitem.h"
 #include "turtleclientservice.h"
@@ -89,6 +90,34 @@ void RsTurtleRegExpSearchRequestItem::serial_process(RsGenericSerializer::Serial
     RsTypeSerializer::serial_process<uint16_t>(j,ctx,depth,"depth") ;
     RsTypeSerializer::serial_process(j,ctx,expr,"expr") ;
 }
+
+// Keyword searches match file names as substrings, ignoring case. Boolean
+// expressions are kept as they are, since some of their operators are case sensitive.
+
+std::string RsTurtleStringSearchRequestItem::searchKey() const
+{
+	std::string key("s:") ;
+
+	for(uint32_t i=0;i<match_string.size();++i)
+		key += tolower(match_string[i]) ;
+
+	return key ;
+}
+std::string RsTurtleRegExpSearchRequestItem::searchKey() const
+{
+	std::string key("r:") ;
+
+	key.append(expr._tokens.begin(),expr._tokens.end()) ;
+	key += ':' ;
+
+	for(uint32_t i=0;i<expr._ints.size();++i)
+		key += std::to_string(expr._ints[i]) + ',' ;
+
+	for(uint32_t i=0;i<expr._strings.size();++i)
+		key += ':' + std::to_string(expr._strings[i].size()) + ':' + expr._strings[i] ;
+
+	return key ;
+}
 void RsTurtleGenericSearchRequestItem::serial_process(RsGenericSerializer::SerializeJob j,RsGenericSerializer::SerializeContext& ctx)
 {
     RsTypeSerializer::serial_process<uint32_t>(j,ctx,request_id,"request_id") ;
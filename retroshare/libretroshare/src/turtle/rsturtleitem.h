@@ -118,6 +118,9 @@ class RsTurtleFileSearchRequestItem: public RsTurtleSearchRequestItem
 
         virtual uint16_t serviceId() const { return RS_SERVICE_TYPE_FILE_TRANSFER ; }
 		virtual void search(std::list<TurtleFileInfo> &) const =0;
+
+		/// Normalised form of the search. Two requests with the same key give the same local results.
+		virtual std::string searchKey() const =0;
 };
 
 class RsTurtleStringSearchRequestItem: public RsTurtleFileSearchRequestItem
@@ -127,6 +130,7 @@ class RsTurtleStringSearchRequestItem: public RsTurtleFileSearchRequestItem
         virtual ~RsTurtleStringSearchRequestItem() {}
 
 		virtual void search(std::list<TurtleFileInfo> &) const ;
+		virtual std::string searchKey() const ;
 
 		std::string match_string ;	// string to match
 		std::string GetKeywords() { return match_string; }
@@ -156,6 +160,7 @@ class RsTurtleRegExpSearchRequestItem: public RsTurtleFileSearchRequestItem
 		}
 
 		virtual void search(std::list<TurtleFileInfo> &) const ;
+		virtual std::string searchKey() const ;
 
 		virtual RsTurtleSearchRequestItem *clone() const { return new RsTurtleRegExpSearchRequestItem(*this) ; }
 		void clear() { expr = RsRegularExpression::LinearizedExpression(); }
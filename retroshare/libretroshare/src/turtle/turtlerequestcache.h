@@ -0,0 +1,107 @@
+/*******************************************************************************
+ * libretroshare/src/turtle: turtlerequestcache.h                              *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+
+#include "util/rstime.h"
+
+// Cache of the search and tunnel requests that went through this node, keyed
+// by request id.
+//
+// Requests are stored in buckets by arrival time. Each bucket is a hash map
+// covering life_time/NB_BUCKETS seconds, and expiring requests is done by
+// dropping whole buckets, so that cleaning costs nothing, however many requests
+// there are. A request may therefore live up to one bucket length longer than
+// life_time. Lookups check the buckets from the most recent one.
+//
+// This class is not thread safe. In p3turtle it is protected by mTurtleMtx.
+
+template<class ID,class INFO> class TurtleRequestCache
+{
+public:
+	TurtleRequestCache(rstime_t life_time)
+	    : mLifeTime(life_time), mBucketLength(std::max(rstime_t(1),life_time / NB_BUCKETS)), mSize(0) {}
+
+	/// Returns the stored info for this request, or NULL.
+	INFO *find(const ID& id)
+	{
+		for(typename std::deque<Bucket>::reverse_iterator it(mBuckets.rbegin());it!=mBuckets.rend();++it)
+		{
+			typename std::unordered_map<ID,INFO>::iterator it2 = it->entries.find(id) ;
+
+			if(it2 != it->entries.end())
+				return &it2->second ;
+		}
+		return NULL ;
+	}
+
+	/// Stores a new request received at time now. The request should not be
+	/// already there.
+	INFO& insert(const ID& id,rstime_t now)
+	{
+		if(mBuckets.empty() || now >= mBuckets.back().start + mBucketLength)
+		{
+			mBuckets.push_back(Bucket()) ;
+			mBuckets.back().start = now ;
+		}
+
+		++mSize ;
+		return mBuckets.back().entries[id] ;
+	}
+
+	/// Drops the buckets in which all requests are older than the life time.
+	void expire(rstime_t now)
+	{
+		while(!mBuckets.empty() && now > mBuckets.front().start + mBucketLength + mLifeTime)
+		{
+			mSize -= mBuckets.front().entries.size() ;
+			mBuckets.pop_front() ;
+		}
+	}
+
+	size_t size() const { return mSize ; }
+
+	/// Calls f(id,info) for all requests. Used for display only.
+	template<class F> void forEach(F f) const
+	{
+		for(typename std::deque<Bucket>::const_iterator it(mBuckets.begin());it!=mBuckets.end();++it)
+			for(typename std::unordered_map<ID,INFO>::const_iterator it2(it->entries.begin());it2!=it->entries.end();++it2)
+				f(it2->first,it2->second) ;
+	}
+
+private:
+	static const rstime_t NB_BUCKETS = 20 ;
+
+	struct Bucket
+	{
+		rstime_t start ;
+		std::unordered_map<ID,INFO> entries ;
+	};
+
+	rstime_t mLifeTime ;
+	rstime_t mBucketLength ;
+	size_t mSize ;
+	std::deque<Bucket> mBuckets ;	// oldest first
+};
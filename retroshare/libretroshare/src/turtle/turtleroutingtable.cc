@@ -0,0 +1,101 @@
+/*******************************************************************************
+ * libretroshare/src/turtle: turtleroutingtable.cc                             *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#include "turtle/turtleroutingtable.h"
+
+const uint32_t TurtleRoutingTable::NB_SHARDS ;
+
+void TurtleRoutingTable::addRoute(TurtleTunnelId tid,const TurtlePeerId& local_src,const TurtlePeerId& local_dst,rstime_t now)
+{
+	Shard& s(shard(tid)) ;
+	RsStackMutex stack(s.mtx) ;
+
+	Route& r(s.routes[tid]) ;
+	r.local_src = local_src ;
+	r.local_dst = local_dst ;
+	r.time_stamp = now ;
+	r.transfered_bytes = 0 ;
+}
+
+void TurtleRoutingTable::removeRoute(TurtleTunnelId tid)
+{
+	Shard& s(shard(tid)) ;
+	RsStackMutex stack(s.mtx) ;
+
+	s.routes.erase(tid) ;
+}
+
+bool TurtleRoutingTable::route(TurtleTunnelId tid,uint32_t size,bool stamp,TurtlePeerId& local_src,TurtlePeerId& local_dst)
+{
+	Shard& s(shard(tid)) ;
+	RsStackMutex stack(s.mtx) ;
+
+	std::unordered_map<TurtleTunnelId,Route>::iterator it = s.routes.find(tid) ;
+
+	if(it == s.routes.end())
+		return false ;
+
+	if(stamp)
+		it->second.time_stamp = time(NULL) ;
+
+	it->second.transfered_bytes += size ;
+
+	local_src = it->second.local_src ;
+	local_dst = it->second.local_dst ;
+
+	return true ;
+}
+
+void TurtleRoutingTable::collectActivity(std::vector<Activity>& activity)
+{
+	activity.clear() ;
+
+	// One shard at a time, so that the data path is never held for more than
+	// a fraction of the table.
+
+	for(uint32_t i=0;i<NB_SHARDS;++i)
+	{
+		RsStackMutex stack(mShards[i].mtx) ;
+
+		for(std::unordered_map<TurtleTunnelId,Route>::iterator it(mShards[i].routes.begin());it!=mShards[i].routes.end();++it)
+		{
+			Activity a ;
+			a.tunnel_id = it->first ;
+			a.time_stamp = it->second.time_stamp ;
+			a.transfered_bytes = it->second.transfered_bytes ;
+
+			activity.push_back(a) ;
+			it->second.transfered_bytes = 0 ;
+		}
+	}
+}
+
+size_t TurtleRoutingTable::size() const
+{
+	size_t n = 0 ;
+
+	for(uint32_t i=0;i<NB_SHARDS;++i)
+	{
+		RsStackMutex stack(mShards[i].mtx) ;
+		n += mShards[i].routes.size() ;
+	}
+	return n ;
+}
@@ -0,0 +1,88 @@
+/*******************************************************************************
+ * libretroshare/src/turtle: turtleroutingtable.h                              *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+
+#include "util/rsthreads.h"
+#include "util/rstime.h"
+#include "turtle/turtletypes.h"
+
+// Tunnel id => next hops, for the data path.
+//
+// This is a copy of the routing part of p3turtle::_local_tunnels, kept in a
+// hash table split into independently locked shards, so that forwarding a
+// packet never waits for the turtle mutex. That mutex is held for long while
+// the periodic passes (tunnel management, cleaning, speed estimates) walk all
+// tunnels, which on relay nodes can be tens of thousands of them.
+//
+// The data path also accounts here for the traffic of each tunnel. This is
+// collected back into the tunnel list by collectActivity().
+
+class TurtleRoutingTable
+{
+public:
+	struct Activity
+	{
+		TurtleTunnelId tunnel_id ;
+		rstime_t       time_stamp ;		// last time the tunnel was stamped by data
+		uint32_t       transfered_bytes ;	// bytes since the previous call to collectActivity()
+	};
+
+	void addRoute(TurtleTunnelId tid,const TurtlePeerId& local_src,const TurtlePeerId& local_dst,rstime_t now) ;
+	void removeRoute(TurtleTunnelId tid) ;
+
+	/// Looks up the next hops of the tunnel and accounts for size bytes of
+	/// traffic, stamping the tunnel if required. Returns false if the tunnel
+	/// is unknown.
+	bool route(TurtleTunnelId tid,uint32_t size,bool stamp,TurtlePeerId& local_src,TurtlePeerId& local_dst) ;
+
+	/// Gets the traffic of all tunnels, and resets the byte counters.
+	void collectActivity(std::vector<Activity>& activity) ;
+
+	size_t size() const ;
+
+private:
+	struct Route
+	{
+		TurtlePeerId local_src ;
+		TurtlePeerId local_dst ;
+		rstime_t time_stamp ;
+		uint32_t transfered_bytes ;
+	};
+
+	struct Shard
+	{
+		Shard() : mtx("TurtleRoutingTable") {}
+
+		mutable RsMutex mtx ;
+		std::unordered_map<TurtleTunnelId,Route> routes ;
+	};
+
+	static const uint32_t NB_SHARDS = 16 ;
+
+	// Tunnel ids are random, so their low bits spread evenly over the shards.
+	Shard& shard(TurtleTunnelId tid) { return mShards[tid % NB_SHARDS] ; }
+
+	Shard mShards[NB_SHARDS] ;
+};
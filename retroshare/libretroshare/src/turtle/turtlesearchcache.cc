@@ -0,0 +1,98 @@
+/*******************************************************************************
+ * libretroshare/src/turtle: turtlesearchcache.cc                              *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#include "turtle/turtlesearchcache.h"
+
+TurtleSearchCache::TurtleSearchCache(rstime_t life_time,uint32_t max_entries)
+    : mMtx("TurtleSearchCache"), mLifeTime(life_time), mMaxEntries(max_entries),
+      mHits(0), mMisses(0), mCpuSavedUs(0), mServedAtLastExpire(0), mLastExpireTime(0), mSearchesPerSec(0)
+{
+}
+
+bool TurtleSearchCache::find(const std::string& key,rstime_t now,std::vector<TurtleFileInfoV2>& results)
+{
+	RsStackMutex stack(mMtx) ;
+
+	std::unordered_map<std::string,Entry>::iterator it = mEntries.find(key) ;
+
+	if(it == mEntries.end() || it->second.time_stamp + mLifeTime < now)
+	{
+		++mMisses ;
+		return false ;
+	}
+
+	++mHits ;
+	mCpuSavedUs += it->second.cost_us ;
+	results = it->second.results ;
+
+	return true ;
+}
+
+void TurtleSearchCache::store(const std::string& key,rstime_t now,const std::vector<TurtleFileInfoV2>& results,int64_t cost_us)
+{
+	RsStackMutex stack(mMtx) ;
+
+	// When full, new searches are simply not cached until the next cleaning.
+
+	if(mEntries.size() >= mMaxEntries && mEntries.find(key) == mEntries.end())
+		return ;
+
+	Entry& e(mEntries[key]) ;
+	e.results = results ;
+	e.time_stamp = now ;
+	e.cost_us = cost_us ;
+}
+
+void TurtleSearchCache::expire(rstime_t now)
+{
+	RsStackMutex stack(mMtx) ;
+
+	for(std::unordered_map<std::string,Entry>::iterator it(mEntries.begin());it!=mEntries.end();)
+		if(it->second.time_stamp + mLifeTime < now)
+			it = mEntries.erase(it) ;
+		else
+			++it ;
+
+	uint64_t served = mHits + mMisses ;
+
+	if(mLastExpireTime > 0 && now > mLastExpireTime)
+		mSearchesPerSec = (served - mServedAtLastExpire) / float(now - mLastExpireTime) ;
+
+	mServedAtLastExpire = served ;
+	mLastExpireTime = now ;
+}
+
+void TurtleSearchCache::getStatistics(TurtleSearchStatistics& stats) const
+{
+	RsStackMutex stack(mMtx) ;
+
+	stats.hits = mHits ;
+	stats.misses = mMisses ;
+	stats.hit_rate = (mHits + mMisses > 0)?(mHits / float(mHits + mMisses)):0.0f ;
+	stats.searches_per_sec = mSearchesPerSec ;
+	stats.cpu_saved_us = mCpuSavedUs ;
+}
+
+size_t TurtleSearchCache::size() const
+{
+	RsStackMutex stack(mMtx) ;
+	return mEntries.size() ;
+}
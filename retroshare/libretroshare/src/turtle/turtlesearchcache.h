@@ -0,0 +1,83 @@
+/*******************************************************************************
+ * libretroshare/src/turtle: turtlesearchcache.h                               *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "retroshare/rsfiles.h"
+#include "retroshare/rsturtle.h"
+#include "util/rsthreads.h"
+#include "util/rstime.h"
+
+// Short lived cache of the local results of the file searches received from friends.
+//
+// Popular searches reach us many times within a few seconds, with different
+// request ids, and each of them used to trigger a full search of the shared
+// files. Results are stored by friend and normalised search expression. The
+// friend is part of the key because the files it may see depend on its share
+// permissions.
+//
+// The cache has its own mutex, because local searches are done off the turtle mutex.
+
+class TurtleSearchCache
+{
+public:
+	TurtleSearchCache(rstime_t life_time,uint32_t max_entries) ;
+
+	/// Copies the cached results for key. Returns false if there are none, or if they are too old.
+	bool find(const std::string& key,rstime_t now,std::vector<TurtleFileInfoV2>& results) ;
+
+	/// Stores the results of a search that took cost_us microseconds to perform.
+	void store(const std::string& key,rstime_t now,const std::vector<TurtleFileInfoV2>& results,int64_t cost_us) ;
+
+	/// Removes old entries and updates the search rate.
+	void expire(rstime_t now) ;
+
+	/// Fills everything but forwards_dropped, which is counted by the turtle router.
+	void getStatistics(TurtleSearchStatistics& stats) const ;
+
+	size_t size() const ;
+
+private:
+	struct Entry
+	{
+		std::vector<TurtleFileInfoV2> results ;
+		rstime_t time_stamp ;
+		int64_t  cost_us ;
+	};
+
+	mutable RsMutex mMtx ;
+	std::unordered_map<std::string,Entry> mEntries ;
+
+	rstime_t mLifeTime ;
+	uint32_t mMaxEntries ;
+
+	uint64_t mHits ;
+	uint64_t mMisses ;
+	uint64_t mCpuSavedUs ;
+
+	uint64_t mServedAtLastExpire ;
+	rstime_t mLastExpireTime ;
+	float    mSearchesPerSec ;
+};
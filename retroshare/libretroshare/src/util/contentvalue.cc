@@ -33,6 +33,7 @@ const uint8_t ContentValue::STRING_TYPE = 3;
 const uint8_t ContentValue::DOUBLE_TYPE = 4;
 const uint8_t ContentValue::INT32_TYPE = 5;
 const uint8_t ContentValue::INT64_TYPE = 6;
+const uint8_t ContentValue::ZEROBLOB_TYPE = 7;
 
 
 /**************** content value implementation ******************/
@@ -108,6 +109,12 @@ ContentValue::ContentValue(const ContentValue &from){
                     put(currKey, value);
                 break;
             }
+        case ZEROBLOB_TYPE:
+            {
+                if (from.getAsZeroBlob(currKey, data_len))
+                    putZeroBlob(currKey, data_len);
+                break;
+            }
         default:
             std::cerr << "ContentValue::ContentValue(ContentValue &from):"
                     << "Error! Unrecognised data type!" << std::endl;
@@ -185,6 +192,15 @@ void ContentValue::put(const std::string &key, uint32_t len, const char* value){
     // cppcheck-suppress memleak
 }
 
+void ContentValue::putZeroBlob(const std::string &key, uint32_t len){
+
+    if(mKvSet.find(key) != mKvSet.end())
+        removeKeyValue(key);
+
+    mKvSet.insert(KeyTypePair(key, ZEROBLOB_TYPE));
+    mKvZeroBlob.insert(std::pair<std::string, uint32_t>(key, len));
+}
+
 bool ContentValue::getAsBool(const std::string &key, bool& value) const{
 
     std::map<std::string, bool>::const_iterator it;
@@ -238,6 +254,16 @@ bool ContentValue::getAsData(const std::string& key, uint32_t &len, char*& value
     return true;
 }
 
+bool ContentValue::getAsZeroBlob(const std::string &key, uint32_t& len) const{
+
+    std::map<std::string, uint32_t>::const_iterator it;
+    if((it = mKvZeroBlob.find(key)) == mKvZeroBlob.end())
+        return false;
+
+    len = it->second;
+    return true;
+}
+
 bool ContentValue::getAsDouble(const std::string &key, double& value) const{
 
     std::map<std::string, double>::const_iterator it;
@@ -275,6 +301,9 @@ bool ContentValue::removeKeyValue(const std::string &key){
     if(mit->second == INT32_TYPE)
         mKvInt32.erase(key);
 
+    if(mit->second == ZEROBLOB_TYPE)
+        mKvZeroBlob.erase(key);
+
 
     mKvSet.erase(key);
     return true;
@@ -292,6 +321,7 @@ void ContentValue::clear(){
     mKvString.clear();
     mKvInt32.clear();
     mKvInt64.clear();
+    mKvZeroBlob.clear();
     clearData();
 }
 
@@ -40,6 +40,7 @@ public:
     static const uint8_t STRING_TYPE;
     static const uint8_t DATA_TYPE;
     static const uint8_t BOOL_TYPE;
+    static const uint8_t ZEROBLOB_TYPE;
 
     ContentValue();
 
@@ -103,6 +104,14 @@ public:
      */
     void put(const std::string& key, uint32_t len, const char* value);
 
+    /*!
+     * Adds a blob of len zero bytes to the set, without allocating it. \n
+     * The actual content is meant to be written afterwards through \n
+     * RetroDb::openBlob(), straight from the buffer that holds it
+     * @param key  the name of the value to put
+     * @param len  size of the blob
+     */
+    void putZeroBlob(const std::string& key, uint32_t len);
 
     /*!
      * get value as 32-bit signed integer
@@ -143,6 +152,12 @@ public:
      */
     bool getAsData(const std::string&, uint32_t& len, char*& value) const;
 
+    /*!
+     * get size of a blob added with putZeroBlob()
+     * @param key the value to get
+     */
+    bool getAsZeroBlob(const std::string& key, uint32_t& len) const;
+
     /*!
      * @param keySet the is set with key to type pairs contained in the ContentValue instance
      */
@@ -179,6 +194,7 @@ private:
     std::map<std::string, std::string> mKvString;
     std::map<std::string, std::pair<uint32_t, char*> > mKvData;
     std::map<std::string, bool> mKvBool;
+    std::map<std::string, uint32_t> mKvZeroBlob;
 
     std::map<std::string, uint8_t> mKvSet;
 
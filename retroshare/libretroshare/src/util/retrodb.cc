@@ -473,6 +473,12 @@ void RetroDb::buildInsertQueryValue(const std::map<std::string, uint8_t> keyType
                 cv.getAsData(key, len, value);
                 rb = new RsBlobBind(value, len, ++index);
             }
+        else if( ContentValue::ZEROBLOB_TYPE == type)
+            {
+                uint32_t len = 0;
+                cv.getAsZeroBlob(key, len);
+                rb = new RsZeroBlobBind(len, ++index);
+            }
         else if ( ContentValue::STRING_TYPE == type)
             {
                 std::string value;
@@ -545,6 +551,12 @@ void RetroDb::buildUpdateQueryValue(const std::map<std::string, uint8_t> keyType
                 cv.getAsData(key, len, value);
                 rb = new RsBlobBind(value, len, ++index);
             }
+        else if( ContentValue::ZEROBLOB_TYPE == type)
+            {
+                uint32_t len = 0;
+                cv.getAsZeroBlob(key, len);
+                rb = new RsZeroBlobBind(len, ++index);
+            }
         else if ( ContentValue::STRING_TYPE == type)
             {
                 std::string value;
@@ -671,6 +683,128 @@ bool RetroDb::tableExists(const std::string &tableName)
     return result;
 }
 
+bool RetroDb::execPragma(const std::string& pragma, std::string *value)
+{
+    if (!isOpen()) {
+        return false;
+    }
+
+    std::string query = "PRAGMA " + pragma + ";";
+    sqlite3_stmt* stmt = NULL;
+
+    int rc = sqlite3_prepare_v2(mDb, query.c_str(), query.length(), &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        std::cerr << "RetroDb::execPragma(): Error preparing " << query << ": "
+                  << sqlite3_errmsg(mDb) << std::endl;
+        return false;
+    }
+
+    // pragmas that set a value usually return it as well
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const unsigned char* text = sqlite3_column_text(stmt, 0);
+
+        if (value && text) {
+            *value = reinterpret_cast<const char*>(text);
+        }
+    }
+
+    sqlite3_finalize(stmt);
+
+    if (rc != SQLITE_DONE) {
+        std::cerr << "RetroDb::execPragma(): Error executing " << query << " (code: " << rc << ")"
+                  << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool RetroDb::setPageCache(uint32_t cacheSizeKb, uint64_t mmapSize)
+{
+    bool ok = true;
+
+    // a negative cache size is a number of kB rather than a number of pages
+    if (cacheSizeKb > 0) {
+        ok &= execPragma("cache_size = -" + std::to_string(cacheSizeKb));
+    }
+
+    ok &= execPragma("mmap_size = " + std::to_string(mmapSize));
+
+    return ok;
+}
+
+bool RetroDb::enableWal(uint32_t cacheSizeKb, uint64_t mmapSize)
+{
+    std::string mode;
+
+    if (!execPragma("journal_mode = WAL", &mode) || mode != "wal") {
+        RsErr() << __PRETTY_FUNCTION__ << " Cannot use WAL journaling for "
+                << mPath << ", journal mode is \"" << mode << "\"" << std::endl;
+        return false;
+    }
+
+    // Readers and the checkpointer may hold the WAL index for a short while.
+    sqlite3_busy_timeout(mDb, TIME_LIMIT * 1000);
+
+    // In WAL mode, NORMAL only syncs at checkpoints: a power loss may lose
+    // the last transactions, but never corrupts the database. The log is
+    // truncated back to a reasonable size once it has been checkpointed.
+    bool ok = execPragma("synchronous = NORMAL");
+    ok &= execPragma("wal_autocheckpoint = 0");
+    ok &= execPragma("journal_size_limit = " + std::to_string(64 * 1024 * 1024));
+    ok &= setPageCache(cacheSizeKb, mmapSize);
+
+    return ok;
+}
+
+bool RetroDb::setQueryOnly(uint32_t cacheSizeKb, uint64_t mmapSize)
+{
+    if (!isOpen()) {
+        return false;
+    }
+
+    sqlite3_busy_timeout(mDb, TIME_LIMIT * 1000);
+
+    bool ok = execPragma("query_only = 1");
+    ok &= setPageCache(cacheSizeKb, mmapSize);
+
+    return ok;
+}
+
+bool RetroDb::checkpoint(int *logPages, int *checkpointedPages)
+{
+    if (!isOpen()) {
+        return false;
+    }
+
+    // A passive checkpoint stops at the first page still needed by a reader,
+    // and returns SQLITE_BUSY if the writer is in the middle of a commit. The
+    // rest of the log is copied at the next call.
+    int rc = sqlite3_wal_checkpoint_v2(mDb, NULL, SQLITE_CHECKPOINT_PASSIVE, logPages, checkpointedPages);
+
+    if (rc != SQLITE_OK && rc != SQLITE_BUSY) {
+        std::cerr << "RetroDb::checkpoint(): Error (code: " << rc << ") "
+                  << sqlite3_errmsg(mDb) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int64_t RetroDb::lastInsertRowId() const
+{
+    return isOpen() ? sqlite3_last_insert_rowid(mDb) : 0;
+}
+
+RetroBlob* RetroDb::openBlob(const std::string& tableName, const std::string& column, int64_t rowid, bool writable)
+{
+    if (!isOpen()) {
+        return NULL;
+    }
+
+    return RetroBlob::open(mDb, tableName, column, rowid, writable);
+}
+
 /********************** RetroCursor ************************/
 
 RetroCursor::RetroCursor(sqlite3_stmt *stmt)
@@ -881,3 +1015,56 @@ const void* RetroCursor::getData(int columnIndex, uint32_t &datSize){
     return val;
 }
 
+RetroBlob* RetroCursor::openBlob(const std::string& tableName, const std::string& column, int64_t rowid){
+
+    if(!isOpen())
+        return NULL;
+
+    return RetroBlob::open(sqlite3_db_handle(mStmt), tableName, column, rowid, false);
+}
+
+/********************** RetroBlob ************************/
+
+RetroBlob::RetroBlob(sqlite3_blob *blob)
+    : mBlob(blob) {}
+
+RetroBlob::~RetroBlob(){
+
+    sqlite3_blob_close(mBlob);
+}
+
+RetroBlob* RetroBlob::open(sqlite3 *db, const std::string& tableName, const std::string& column, int64_t rowid, bool writable){
+
+    sqlite3_blob* blob = NULL;
+    int rc = sqlite3_blob_open(db, "main", tableName.c_str(), column.c_str(), rowid, writable ? 1 : 0, &blob);
+
+    if(rc != SQLITE_OK){
+        std::cerr << "RetroBlob::open(): Error opening " << tableName << "." << column << " of row " << rowid
+                  << " (code: " << rc << ") " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_blob_close(blob);
+        return NULL;
+    }
+
+    return new RetroBlob(blob);
+}
+
+uint32_t RetroBlob::size() const{
+
+    return sqlite3_blob_bytes(mBlob);
+}
+
+bool RetroBlob::read(void *data, uint32_t len, uint32_t offset){
+
+    return (SQLITE_OK == sqlite3_blob_read(mBlob, data, len, offset));
+}
+
+bool RetroBlob::write(const void *data, uint32_t len, uint32_t offset){
+
+    return (SQLITE_OK == sqlite3_blob_write(mBlob, data, len, offset));
+}
+
+bool RetroBlob::moveTo(int64_t rowid){
+
+    return (SQLITE_OK == sqlite3_blob_reopen(mBlob, rowid));
+}
+
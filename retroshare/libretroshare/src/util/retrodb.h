@@ -37,6 +37,7 @@
 #include "util/contentvalue.h"
 
 class RetroCursor;
+class RetroBlob;
 
 /*!
  * RetroDb provide a means for Retroshare's core and \n
@@ -172,6 +173,56 @@ public:
      */
     bool tableExists(const std::string& tableName);
 
+    /*!
+     * Switches the database to write-ahead logging, so that other connections
+     * reading it see the last committed state without waiting for this one
+     * to finish writing. The log is not checkpointed on commit anymore, this
+     * has to be done by calling checkpoint(), ideally from another connection.
+     * The journal mode is stored in the database file, and is used by all the
+     * connections opened afterwards.
+     * @param cacheSizeKb page cache of this connection in kB, 0 keeps the default
+     * @param mmapSize number of bytes of the file read through memory mapping,
+     *        0 to disable. SQLCipher ignores it, as pages need to be decrypted.
+     * @return false if the database could not be switched to WAL
+     */
+    bool enableWal(uint32_t cacheSizeKb, uint64_t mmapSize);
+
+    /*!
+     * Sets up a connection to a database in WAL mode that is only used to run
+     * queries. Any attempt to modify the database through it fails.
+     * @see enableWal() for the parameters
+     * @return false if the connection could not be set up
+     */
+    bool setQueryOnly(uint32_t cacheSizeKb, uint64_t mmapSize);
+
+    /*!
+     * Copies the pages of the write-ahead log back into the database, as far
+     * as possible without waiting for the readers nor the writer.
+     * @param logPages if not null, receives the number of pages in the log
+     * @param checkpointedPages if not null, receives the number of pages copied
+     * @return false on error
+     */
+    bool checkpoint(int *logPages = nullptr, int *checkpointedPages = nullptr);
+
+    /*!
+     * @return rowid of the last row inserted through this connection
+     */
+    int64_t lastInsertRowId() const;
+
+    /*!
+     * Opens a blob for incremental I/O, so that large values can be written \n
+     * or read without being copied as a whole in a query or its result. \n
+     * The size of a blob cannot be changed this way, to write a new value the \n
+     * row must first be given a blob of the right size, see ContentValue::putZeroBlob()
+     * @param tableName table of the blob
+     * @param column column of the blob
+     * @param rowid rowid of the row holding the blob
+     * @param writable false to only read the blob
+     * @return blob handle, this allocated resource should be free'd after use \n
+     *         or null if the value cannot be opened, for instance because it is not a blob
+     */
+    RetroBlob* openBlob(const std::string& tableName, const std::string& column, int64_t rowid, bool writable);
+
 public:
 
     static const int OPEN_READONLY;
@@ -182,6 +233,15 @@ private:
 
     bool execSQL_bind(const std::string &query, std::list<RetroBind*>& blobs);
 
+    /*!
+     * Runs a PRAGMA statement, which unlike execSQL() may return a row
+     * @param pragma statement without 'PRAGMA' itself
+     * @param value if not null, receives the first column of the last row
+     */
+    bool execPragma(const std::string& pragma, std::string *value = nullptr);
+
+    bool setPageCache(uint32_t cacheSizeKb, uint64_t mmapSize);
+
     /*!
      * Build the "VALUE" part of an insertiong sql query
      * @param parameter contains place holder query
@@ -313,6 +373,13 @@ public:
      */
     const void* getData(int columnIndex, uint32_t& datSize);
 
+    /*!
+     * Opens a blob for reading through the connection the cursor queries, \n
+     * so that it is read from the same snapshot of the database as the rows
+     * @see RetroDb::openBlob()
+     */
+    RetroBlob* openBlob(const std::string& tableName, const std::string& column, int64_t rowid);
+
     template <class T>
     inline void getStringT(int columnIndex, T &str){
     	std::string temp;
@@ -322,3 +389,48 @@ public:
 private:
     sqlite3_stmt* mStmt;
 };
+
+/*!
+ * Incremental I/O on a blob stored in a retrodb table
+ */
+class RetroBlob {
+
+public:
+
+    /*!
+     * @warning blob takes ownership of the handle passed to it
+     */
+    RetroBlob(sqlite3_blob* blob);
+
+    ~RetroBlob();
+
+    /*!
+     * @return size of the blob in bytes
+     */
+    uint32_t size() const;
+
+    /*!
+     * copies len bytes of the blob starting at offset into data
+     * @return false if the range is out of the blob or on error
+     */
+    bool read(void* data, uint32_t len, uint32_t offset);
+
+    /*!
+     * copies len bytes from data into the blob starting at offset
+     * @return false if the range is out of the blob or on error
+     */
+    bool write(const void* data, uint32_t len, uint32_t offset);
+
+    /*!
+     * Points the blob to the same column of another row of the table, \n
+     * which is much cheaper than opening a new blob
+     * @return false if the value in the row cannot be opened, the blob \n
+     *         cannot be used anymore then
+     */
+    bool moveTo(int64_t rowid);
+
+    static RetroBlob* open(sqlite3* db, const std::string& tableName, const std::string& column, int64_t rowid, bool writable);
+
+private:
+    sqlite3_blob* mBlob;
+};
@@ -40,6 +40,9 @@ RsBoolBind::RsBoolBind(bool value, int index)
 RsBlobBind::RsBlobBind(char* data, uint32_t dataLen, int index)
  : RetroBind(BLOB, index), mData(data), mDataLen(dataLen) {}
 
+RsZeroBlobBind::RsZeroBlobBind(uint32_t dataLen, int index)
+ : RetroBind(ZEROBLOB, index), mDataLen(dataLen) {}
+
 bool RsDoubleBind::bind(sqlite3_stmt* const stm) const
 {
 	return (SQLITE_OK == sqlite3_bind_double(stm, getIndex(), mValue));
@@ -69,3 +72,8 @@ bool RsBlobBind::bind(sqlite3_stmt* const stm) const
 {
 	return (SQLITE_OK == sqlite3_bind_blob(stm, getIndex(), mData, mDataLen, SQLITE_TRANSIENT));
 }
+
+bool RsZeroBlobBind::bind(sqlite3_stmt* const stm) const
+{
+	return (SQLITE_OK == sqlite3_bind_zeroblob(stm, getIndex(), mDataLen));
+}
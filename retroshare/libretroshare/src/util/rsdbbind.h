@@ -36,7 +36,7 @@ class RetroBind
 {
 public:
 
-	enum BindType { BLOB=1, STRING, INT32, INT64, DOUBLE, BOOL } ;
+	enum BindType { BLOB=1, STRING, INT32, INT64, DOUBLE, BOOL, ZEROBLOB } ;
 	RetroBind(const BindType& type, int index) : mIndex(index), mType(type) {}
 
 	virtual bool bind(sqlite3_stmt* const stm) const = 0;
@@ -98,4 +98,12 @@ public:
 	uint32_t mDataLen;
 };
 
+class RsZeroBlobBind : public RetroBind
+{
+public:
+	RsZeroBlobBind(uint32_t dataLen, int index);
+	bool bind(sqlite3_stmt* const stm) const;
+	uint32_t mDataLen;
+};
+
 #endif /* RSDBBIND_H_ */
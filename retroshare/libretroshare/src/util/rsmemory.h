@@ -23,6 +23,7 @@
  *******************************************************************************/
 #pragma once
 
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
@@ -113,6 +114,30 @@ template<typename T> using rs_view_ptr = T*;
 template<typename T> using rs_owner_ptr = T*;
 
 
+/** Reference counted handle on a chunk of memory allocated with malloc.
+ * Thanks to std::shared_ptr aliasing constructor an RsSharedBuffer may also
+ * point inside a bigger block, in that case it keeps the whole block alive,
+ * this is used to deserialise big binary fields as views into the received
+ * packet instead of copying them out.
+ * @see rs_shared_buffer_adopt, RsSerializationFlags::SHARED_BUFFER_VIEWS */
+typedef std::shared_ptr<uint8_t> RsSharedBuffer;
+
+/** Take ownership of a chunk of memory allocated with malloc/rs_malloc, it
+ * will be freed when the last RsSharedBuffer referencing it goes away.
+ * @param[in] mem memory to adopt, must not be freed by the caller afterwards
+ * @return shared handle on mem, empty if mem is nullptr */
+inline RsSharedBuffer rs_shared_buffer_adopt(rs_owner_ptr<void> mem)
+{
+	if(!mem) return RsSharedBuffer();
+	return RsSharedBuffer(static_cast<uint8_t*>(mem), free);
+}
+
+/** Get a view on a region of a shared buffer, the returned handle points to
+ * buffer.get() + offset and keeps the whole buffer alive */
+inline RsSharedBuffer rs_shared_buffer_view(
+        const RsSharedBuffer& buffer, size_t offset )
+{ return RsSharedBuffer(buffer, buffer.get() + offset); }
+
 /// 1Gb should be enough for everything!
 static constexpr size_t RS_SAFE_MEMALLOC_THRESHOLD = 1024*1024*1024;
 
@@ -0,0 +1,248 @@
+/*******************************************************************************
+ * libretroshare/src/util: rsmpscqueue.h                                       *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+/* Queue of items passed from several producer threads to the thread(s)
+ * consuming them, as used for the incoming items of services.
+ *
+ * Items go into a fixed size ring of cells (D. Vyukov's bounded queue):
+ * pushing and popping take no lock and allocate nothing. When the ring is
+ * full, items go into an overflow list protected by a mutex, so that nothing
+ * is ever dropped: full() tells the producers to slow down. While the
+ * overflow list is not empty, all items go there, so that the items of a
+ * given producer are always popped in the order they were pushed.
+ *
+ * Each item is stamped when pushed, so that the time it waited in the queue
+ * is known when it is popped.
+ *
+ * size() counts the items being pushed as well. A consumer that cannot pop
+ * anything while size() > 0 only has to try again: an item is being written.
+ * When size() is 0, the consumer can sleep until a push reports was_empty.
+ */
+
+template<class T> class RsMpscQueue
+{
+public:
+	struct Stats
+	{
+		Stats() : depth(0), max_depth(0), capacity(0), pushed(0), overflowed(0), avg_wait_us(0), max_wait_us(0) {}
+
+		uint32_t depth ;
+		uint32_t max_depth ;
+		uint32_t capacity ;
+		uint64_t pushed ;
+		uint64_t overflowed ;		// items that went to the overflow list
+		uint64_t avg_wait_us ;		// moving average of the time spent in the queue
+		uint64_t max_wait_us ;
+	};
+
+	/// capacity is rounded up to a power of 2
+	explicit RsMpscQueue(uint32_t capacity)
+	    : mSize(0), mMaxSize(0), mPushed(0), mOverflowed(0), mAvgWaitUs(0), mMaxWaitUs(0), mOverflowSize(0)
+	{
+		mCapacity = 2 ;
+		while(mCapacity < capacity)
+			mCapacity <<= 1 ;
+
+		mCells.reset(new Cell[mCapacity]) ;
+
+		for(uint32_t i=0;i<mCapacity;++i)
+			mCells[i].seq.store(i,std::memory_order_relaxed) ;
+
+		mEnqueuePos.store(0,std::memory_order_relaxed) ;
+		mDequeuePos.store(0,std::memory_order_relaxed) ;
+	}
+
+	/**
+	 * Queues item. Never fails.
+	 * @param[out] was_empty true if the queue was empty, i.e. the consumer may
+	 *  need to be woken up once push() returns
+	 * @return false if the queue is now over capacity
+	 */
+	bool push(const T& item,bool& was_empty)
+	{
+		Clock::time_point now = Clock::now() ;
+
+		uint32_t size = mSize.fetch_add(1) + 1 ;
+		was_empty = (size == 1) ;
+
+		if(mOverflowSize.load(std::memory_order_acquire) > 0 || !pushRing(item,now))
+		{
+			std::lock_guard<std::mutex> lock(mOverflowMtx) ;
+
+			mOverflow.push_back(std::make_pair(item,now)) ;
+			mOverflowSize.store(mOverflow.size(),std::memory_order_release) ;
+			mOverflowed.fetch_add(1,std::memory_order_relaxed) ;
+		}
+		mPushed.fetch_add(1,std::memory_order_relaxed) ;
+
+		uint32_t max_size = mMaxSize.load(std::memory_order_relaxed) ;
+		while(size > max_size && !mMaxSize.compare_exchange_weak(max_size,size,std::memory_order_relaxed)) ;
+
+		return size <= mCapacity ;
+	}
+
+	/// Takes the oldest item. Returns false if the queue is empty.
+	bool pop(T& item)
+	{
+		Clock::time_point ts ;
+
+		if(!popRing(item,ts))
+		{
+			// The ring must be empty before the overflow list is used, otherwise
+			// the items of a producer could come out of order. If a cell of the
+			// ring is still being written, the caller will try again.
+
+			if(mOverflowSize.load(std::memory_order_acquire) == 0
+			        || mEnqueuePos.load(std::memory_order_acquire) != mDequeuePos.load(std::memory_order_acquire))
+				return false ;
+
+			std::lock_guard<std::mutex> lock(mOverflowMtx) ;
+
+			if(mOverflow.empty())
+				return false ;
+
+			item = mOverflow.front().first ;
+			ts = mOverflow.front().second ;
+			mOverflow.pop_front() ;
+			mOverflowSize.store(mOverflow.size(),std::memory_order_release) ;
+		}
+		mSize.fetch_sub(1) ;
+
+		// Statistics are updated without lock. With several consumers, an
+		// update may occasionally be lost, which does not matter here.
+
+		uint64_t wait_us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - ts).count() ;
+		uint64_t avg = mAvgWaitUs.load(std::memory_order_relaxed) ;
+		mAvgWaitUs.store(avg - avg/16 + wait_us/16,std::memory_order_relaxed) ;
+
+		if(wait_us > mMaxWaitUs.load(std::memory_order_relaxed))
+			mMaxWaitUs.store(wait_us,std::memory_order_relaxed) ;
+
+		return true ;
+	}
+
+	uint32_t size() const { return mSize.load(std::memory_order_relaxed) ; }
+	bool empty() const { return size() == 0 ; }
+	bool full() const { return size() >= mCapacity ; }
+	uint32_t capacity() const { return mCapacity ; }
+
+	void getStats(Stats& stats) const
+	{
+		stats.depth       = size() ;
+		stats.max_depth   = mMaxSize.load(std::memory_order_relaxed) ;
+		stats.capacity    = mCapacity ;
+		stats.pushed      = mPushed.load(std::memory_order_relaxed) ;
+		stats.overflowed  = mOverflowed.load(std::memory_order_relaxed) ;
+		stats.avg_wait_us = mAvgWaitUs.load(std::memory_order_relaxed) ;
+		stats.max_wait_us = mMaxWaitUs.load(std::memory_order_relaxed) ;
+	}
+
+private:
+	typedef std::chrono::steady_clock Clock ;
+
+	struct Cell
+	{
+		std::atomic<size_t> seq ;
+		T data ;
+		Clock::time_point ts ;
+	};
+
+	bool pushRing(const T& item,const Clock::time_point& now)
+	{
+		size_t pos = mEnqueuePos.load(std::memory_order_relaxed) ;
+
+		for(;;)
+		{
+			Cell& cell(mCells[pos & (mCapacity-1)]) ;
+			size_t seq = cell.seq.load(std::memory_order_acquire) ;
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos ;
+
+			if(diff == 0)
+			{
+				if(mEnqueuePos.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed))
+				{
+					cell.data = item ;
+					cell.ts = now ;
+					cell.seq.store(pos+1,std::memory_order_release) ;
+					return true ;
+				}
+			}
+			else if(diff < 0)
+				return false ;	// full
+			else
+				pos = mEnqueuePos.load(std::memory_order_relaxed) ;
+		}
+	}
+
+	bool popRing(T& item,Clock::time_point& ts)
+	{
+		size_t pos = mDequeuePos.load(std::memory_order_relaxed) ;
+
+		for(;;)
+		{
+			Cell& cell(mCells[pos & (mCapacity-1)]) ;
+			size_t seq = cell.seq.load(std::memory_order_acquire) ;
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos+1) ;
+
+			if(diff == 0)
+			{
+				if(mDequeuePos.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed))
+				{
+					item = cell.data ;
+					ts = cell.ts ;
+					cell.seq.store(pos+mCapacity,std::memory_order_release) ;
+					return true ;
+				}
+			}
+			else if(diff < 0)
+				return false ;	// empty
+			else
+				pos = mDequeuePos.load(std::memory_order_relaxed) ;
+		}
+	}
+
+	std::unique_ptr<Cell[]> mCells ;
+	uint32_t mCapacity ;
+
+	std::atomic<size_t> mEnqueuePos ;
+	std::atomic<size_t> mDequeuePos ;
+
+	std::atomic<uint32_t> mSize ;
+	std::atomic<uint32_t> mMaxSize ;
+	std::atomic<uint64_t> mPushed ;
+	std::atomic<uint64_t> mOverflowed ;
+	std::atomic<uint64_t> mAvgWaitUs ;
+	std::atomic<uint64_t> mMaxWaitUs ;
+
+	std::mutex mOverflowMtx ;
+	std::deque<std::pair<T,Clock::time_point> > mOverflow ;
+	std::atomic<size_t> mOverflowSize ;
+};
@@ -0,0 +1,362 @@
+/*******************************************************************************
+ * libretroshare/src/util: rsstartup.cc                                        *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <stdio.h>
+
+#include "util/rsstartup.h"
+#include "util/rsdir.h"
+
+//#define DEBUG_STARTUP 1
+
+/*************************************************************************/
+/*                              RsStartupTrace                           */
+/*************************************************************************/
+
+namespace
+{
+struct TraceStep
+{
+	std::string name ;
+	int64_t start ;
+	int64_t end ;
+	uint32_t thread ;
+};
+
+struct TraceData
+{
+	std::mutex mtx ;
+	std::vector<TraceStep> steps ;
+	std::map<std::thread::id,uint32_t> threads ;	// small numbers are easier to read than thread ids
+};
+
+TraceData& traceData()
+{
+	static TraceData data ;
+	return data ;
+}
+
+std::string jsonEscape(const std::string& s)
+{
+	std::string res ;
+
+	for(char c : s)
+		if(c == '"' || c == '\\')
+			res += std::string("\\") + c ;
+		else if((unsigned char)c < 0x20)
+			res += ' ' ;
+		else
+			res += c ;
+
+	return res ;
+}
+}
+
+int64_t RsStartupTrace::now()
+{
+	static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now() ;
+
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count() ;
+}
+
+void RsStartupTrace::addStep(const std::string& name, int64_t start_us)
+{
+	TraceStep step ;
+	step.name = name ;
+	step.start = start_us ;
+	step.end = now() ;
+
+	TraceData& data(traceData()) ;
+	std::lock_guard<std::mutex> lock(data.mtx) ;
+
+	std::map<std::thread::id,uint32_t>::const_iterator it = data.threads.find(std::this_thread::get_id()) ;
+
+	if(it == data.threads.end())
+		it = data.threads.insert(std::make_pair(std::this_thread::get_id(),(uint32_t)data.threads.size())).first ;
+
+	step.thread = it->second ;
+	data.steps.push_back(step) ;
+
+#ifdef DEBUG_STARTUP
+	std::cerr << "RsStartupTrace: " << name << " took " << (step.end - step.start)/1000 << " ms" << std::endl;
+#endif
+}
+
+void RsStartupTrace::dump(const std::string& trace_file)
+{
+	std::vector<TraceStep> steps ;
+	{
+		TraceData& data(traceData()) ;
+		std::lock_guard<std::mutex> lock(data.mtx) ;
+
+		steps.swap(data.steps) ;
+	}
+
+	std::stable_sort(steps.begin(),steps.end(),[](const TraceStep& a,const TraceStep& b) { return a.start < b.start ; }) ;
+
+	std::cerr << "(II) Startup timeline (start, duration in ms, thread, step):" << std::endl;
+
+	for(const TraceStep& s : steps)
+		std::cerr << std::fixed << std::setprecision(1)
+		          << std::setw(10) << s.start/1000.0 << std::setw(10) << (s.end - s.start)/1000.0
+		          << std::setw(4) << s.thread << "  " << s.name << std::endl;
+
+	std::cerr.unsetf(std::ios::fixed) ;
+
+	if(trace_file.empty())
+		return ;
+
+	FILE *f = RsDirUtil::rs_fopen(trace_file.c_str(),"w") ;
+
+	if(!f)
+	{
+		std::cerr << "(WW) RsStartupTrace: cannot write startup trace to " << trace_file << std::endl;
+		return ;
+	}
+
+	fprintf(f,"{\"traceEvents\":[") ;
+
+	for(uint32_t i=0;i<steps.size();++i)
+		fprintf(f,"%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld}",
+		        i?",":"", jsonEscape(steps[i].name).c_str(), steps[i].thread,
+		        (long long)steps[i].start, (long long)(steps[i].end - steps[i].start)) ;
+
+	fprintf(f,"\n]}\n") ;
+	fclose(f) ;
+}
+
+/*************************************************************************/
+/*                            RsStartupScheduler                         */
+/*************************************************************************/
+
+RsStartupScheduler::RsStartupScheduler(uint32_t max_threads)
+    : mRunning(0), mMaxThreads(max_threads), mStopping(false)
+{
+	// Startup tasks mostly wait for the disc, so that running a few of them
+	// in parallel pays off even on a single core.
+
+	if(mMaxThreads == 0)
+		mMaxThreads = std::min(8u,std::max(2u,std::thread::hardware_concurrency())) ;
+}
+
+RsStartupScheduler::~RsStartupScheduler()
+{
+	waitAll() ;
+
+	{
+		std::lock_guard<std::mutex> lock(mMtx) ;
+		mStopping = true ;
+	}
+	mCond.notify_all() ;
+
+	for(std::thread& t : mWorkers)
+		t.join() ;
+}
+
+void RsStartupScheduler::addTask(const std::string& name, const std::function<void()>& fn, const std::list<std::string>& deps)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMtx) ;
+		locked_addTask(name,fn,deps,false) ;
+	}
+	mCond.notify_all() ;
+}
+
+void RsStartupScheduler::addWaiterTask(const std::string& name, const std::function<void()>& fn, const std::list<std::string>& deps)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMtx) ;
+		locked_addTask(name,fn,deps,true) ;
+	}
+	mCond.notify_all() ;
+}
+
+void RsStartupScheduler::locked_addTask(const std::string& name, const std::function<void()>& fn, const std::list<std::string>& deps, bool on_waiter)
+{
+	if(mTasks.find(name) != mTasks.end())
+	{
+		std::cerr << "(EE) RsStartupScheduler: task \"" << name << "\" already added. Ignoring it." << std::endl;
+		return ;
+	}
+
+	Task& t(mTasks[name]) ;
+	t.fn = fn ;
+	t.deps = deps ;
+	t.done = false ;
+	t.onWaiter = on_waiter ;
+
+	mPending.push_back(name) ;
+
+	// Workers are only started when there is something to do, up to the limit.
+
+	if(!on_waiter && mWorkers.size() < mMaxThreads && mWorkers.size() < mRunning + mPending.size())
+		mWorkers.push_back(std::thread(&RsStartupScheduler::workerThread,this)) ;
+}
+
+bool RsStartupScheduler::locked_isReady(const Task& t) const
+{
+	for(const std::string& d : t.deps)
+	{
+		std::map<std::string,Task>::const_iterator it = mTasks.find(d) ;
+
+		if(it == mTasks.end() || !it->second.done)
+			return false ;
+	}
+	return true ;
+}
+
+void RsStartupScheduler::locked_checkStalled()
+{
+	// Nothing runs and nothing can start: the remaining tasks wait for tasks
+	// that were never added, or for each other. Waiting would last forever.
+
+	if(mRunning > 0 || mPending.empty())
+		return ;
+
+	for(const std::string& name : mPending)
+		if(locked_isReady(mTasks[name]))
+			return ;
+
+	for(const std::string& name : mPending)
+	{
+		std::cerr << "(EE) RsStartupScheduler: task \"" << name << "\" depends on a task that was never added or on itself. Skipping it." << std::endl;
+		mTasks[name].done = true ;
+		mTasks[name].fn = nullptr ;
+	}
+	mPending.clear() ;
+	mCond.notify_all() ;
+}
+
+bool RsStartupScheduler::locked_runWaiterTask(std::unique_lock<std::mutex>& lock)
+{
+	std::list<std::string>::iterator it = mPending.begin() ;
+
+	while(it != mPending.end() && !(mTasks[*it].onWaiter && locked_isReady(mTasks[*it])))
+		++it ;
+
+	if(it == mPending.end())
+		return false ;
+
+	// Only one thread is expected to wait. If several do, the task still only
+	// runs once, and the tasks of the waiters one at a time.
+
+	std::string name = *it ;
+	std::function<void()> fn ;
+	fn.swap(mTasks[name].fn) ;
+
+	mPending.erase(it) ;
+	++mRunning ;
+
+	lock.unlock() ;
+	{
+		std::lock_guard<std::mutex> waiter_lock(mWaiterMtx) ;
+		RsStartupTrace::Step step(name) ;
+		fn() ;
+	}
+	lock.lock() ;
+
+	mTasks[name].done = true ;
+	--mRunning ;
+
+	mCond.notify_all() ;
+	return true ;
+}
+
+bool RsStartupScheduler::wait(const std::string& name)
+{
+	std::unique_lock<std::mutex> lock(mMtx) ;
+
+	if(mTasks.find(name) == mTasks.end())
+		return false ;
+
+	while(!mTasks[name].done)
+	{
+		if(locked_runWaiterTask(lock))
+			continue ;
+
+		locked_checkStalled() ;
+
+		if(!mTasks[name].done)
+			mCond.wait(lock) ;
+	}
+
+	return true ;
+}
+
+void RsStartupScheduler::waitAll()
+{
+	std::unique_lock<std::mutex> lock(mMtx) ;
+
+	while(mRunning > 0 || !mPending.empty())
+	{
+		if(locked_runWaiterTask(lock))
+			continue ;
+
+		locked_checkStalled() ;
+
+		if(mRunning > 0 || !mPending.empty())
+			mCond.wait(lock) ;
+	}
+}
+
+void RsStartupScheduler::workerThread()
+{
+	std::unique_lock<std::mutex> lock(mMtx) ;
+
+	for(;;)
+	{
+		std::list<std::string>::iterator it = mPending.begin() ;
+
+		while(it != mPending.end() && (mTasks[*it].onWaiter || !locked_isReady(mTasks[*it])))
+			++it ;
+
+		if(it == mPending.end())
+		{
+			if(mStopping)
+				return ;
+
+			mCond.wait(lock) ;
+			continue ;
+		}
+
+		std::string name = *it ;
+		std::function<void()> fn ;
+		fn.swap(mTasks[name].fn) ;
+
+		mPending.erase(it) ;
+		++mRunning ;
+
+		lock.unlock() ;
+		{
+			RsStartupTrace::Step step(name) ;
+			fn() ;
+		}
+		lock.lock() ;
+
+		mTasks[name].done = true ;
+		--mRunning ;
+
+		mCond.notify_all() ;
+	}
+}
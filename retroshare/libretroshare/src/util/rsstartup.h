@@ -0,0 +1,130 @@
+/*******************************************************************************
+ * libretroshare/src/util: rsstartup.h                                         *
+ *                                                                             *
+ * libretroshare: retroshare core library                                      *
+ *                                                                             *
+ * Copyright (C) 2021 Retroshare Team <contact@retroshare.cc>                  *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Lesser General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+#pragma once
+
+// Tools used to shorten and follow the startup of a node.
+//
+//  - RsStartupTrace records when each startup step begins and ends, and on
+//    which thread. The timeline is printed in the log once the node is up, and
+//    saved in the Chrome trace event format, so that it can be opened in
+//    chrome://tracing or Perfetto and compared from one version to the next.
+//
+//  - RsStartupScheduler runs independent startup tasks (decrypting config
+//    files, opening databases...) on a few worker threads. A task only starts
+//    once the tasks it depends on are done, and the caller can wait for any
+//    given task when it needs its result. Tasks that must not run beside the
+//    caller's own code (giving the loaded configs to the services...) can be
+//    run by the waiting thread instead, still in dependency order.
+
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <map>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+class RsStartupTrace
+{
+public:
+	/// Microseconds since the first call. Used as start time of steps.
+	static int64_t now() ;
+
+	/// Records a step that started at start_us and ends now.
+	static void addStep(const std::string& name, int64_t start_us) ;
+
+	/// Prints the timeline and saves it in trace_file, unless it is empty.
+	/// Recorded steps are then cleared.
+	static void dump(const std::string& trace_file) ;
+
+	/// Records a step that lasts as long as the object.
+	class Step
+	{
+	public:
+		explicit Step(const std::string& name) : mName(name), mStart(now()) {}
+		~Step() { addStep(mName, mStart) ; }
+
+	private:
+		std::string mName ;
+		int64_t mStart ;
+	};
+};
+
+class RsStartupScheduler
+{
+public:
+	/// max_threads = 0 chooses from the number of cores.
+	explicit RsStartupScheduler(uint32_t max_threads = 0) ;
+
+	/// Waits for all tasks, and stops the worker threads.
+	~RsStartupScheduler() ;
+
+	/// Runs fn on a worker thread once all the tasks named in deps are done.
+	/// Names must be unique. Dependencies may be added after the task that
+	/// needs them, but must be added eventually. Each task is recorded in the
+	/// startup trace under its name.
+	void addTask(const std::string& name, const std::function<void()>& fn,
+	             const std::list<std::string>& deps = std::list<std::string>()) ;
+
+	/// Same as addTask(), but fn is run by the thread that calls wait() or
+	/// waitAll(), never by a worker. Such tasks run one at a time, in the
+	/// order they become ready.
+	void addWaiterTask(const std::string& name, const std::function<void()>& fn,
+	                   const std::list<std::string>& deps = std::list<std::string>()) ;
+
+	/// Blocks until the task is done. Returns false if it is unknown.
+	bool wait(const std::string& name) ;
+
+	/// Blocks until all tasks are done.
+	void waitAll() ;
+
+private:
+	struct Task
+	{
+		std::function<void()> fn ;
+		std::list<std::string> deps ;
+		bool done ;
+		bool onWaiter ;
+	};
+
+	void workerThread() ;
+
+	bool locked_isReady(const Task& t) const ;
+	void locked_checkStalled() ;
+	bool locked_runWaiterTask(std::unique_lock<std::mutex>& lock) ;
+	void locked_addTask(const std::string& name, const std::function<void()>& fn,
+	                    const std::list<std::string>& deps, bool on_waiter) ;
+
+	std::mutex mMtx ;
+	std::mutex mWaiterMtx ;	// runs the waiter tasks one at a time
+	std::condition_variable mCond ;
+
+	std::map<std::string,Task> mTasks ;
+	std::list<std::string> mPending ;	// tasks not started yet, in the order they were added
+	uint32_t mRunning ;
+
+	std::vector<std::thread> mWorkers ;
+	uint32_t mMaxThreads ;
+	bool mStopping ;
+};
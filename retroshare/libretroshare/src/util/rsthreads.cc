@@ -269,6 +269,11 @@ void RsQueueThread::threadTick()
 void RsMutex::unlock()
 {
 	_thread_id = 0;
+
+	if(mHoldStats)
+		mHoldStats->record(std::chrono::duration_cast<std::chrono::microseconds>(
+		                       std::chrono::steady_clock::now() - mLockedSince ).count());
+
 	pthread_mutex_unlock(&realMutex);
 }
 
@@ -292,6 +297,47 @@ void RsMutex::lock()
 	}
  
 	_thread_id = pthread_self();
+
+	if(mHoldStats) mLockedSince = std::chrono::steady_clock::now();
+}
+
+RsMutexHoldStats::RsMutexHoldStats() : mMaxUs(0), mTotalUs(0)
+{
+	for(int i=0;i<NB_BUCKETS;++i)
+		mCounts[i] = 0;
+}
+
+void RsMutexHoldStats::record(uint64_t us)
+{
+	int b = 0;
+	while(b+1 < NB_BUCKETS && (us >> (b+1)) > 0)
+		++b;
+
+	++mCounts[b];
+	mTotalUs += us;
+
+	uint64_t m = mMaxUs.load();
+	while(us > m && !mMaxUs.compare_exchange_weak(m,us)) ;
+}
+
+void RsMutexHoldStats::getHistogram(std::vector<uint64_t>& counts, uint64_t& max_us, uint64_t& total_us) const
+{
+	counts.resize(NB_BUCKETS);
+
+	for(int i=0;i<NB_BUCKETS;++i)
+		counts[i] = mCounts[i].load();
+
+	max_us = mMaxUs.load();
+	total_us = mTotalUs.load();
+}
+
+void RsMutexHoldStats::print(std::ostream& out) const
+{
+	for(int i=0;i<NB_BUCKETS;++i)
+		if(mCounts[i].load() > 0)
+			out << (i==0?0:(1ull << i)) << "us:" << mCounts[i].load() << " ";
+
+	out << "max=" << mMaxUs.load() << "us total=" << mTotalUs.load() << "us";
 }
 
 #ifdef RS_MUTEX_DEBUG
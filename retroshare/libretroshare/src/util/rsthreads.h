@@ -30,6 +30,8 @@
 #include <unistd.h>
 #include <atomic>
 #include <thread>
+#include <chrono>
+#include <vector>
 #include <functional>
 
 #include "util/rsmemory.h"
@@ -39,6 +41,33 @@
 #	include "util/rstime.h"
 #endif
 
+/**
+ * @brief Histogram of the time a mutex is held, in microseconds.
+ * Bucket i counts the holds that lasted between 2^i and 2^(i+1) us, bucket 0
+ * also counts shorter holds and the last bucket all the longer ones.
+ * Enable it on a mutex with RsMutex::trackHoldTime().
+ */
+class RsMutexHoldStats
+{
+public:
+	RsMutexHoldStats();
+
+	static const int NB_BUCKETS = 24;
+
+	void record(uint64_t us);
+
+	/// Counts are never reset. Callers compute differences if they need rates.
+	void getHistogram(std::vector<uint64_t>& counts, uint64_t& max_us, uint64_t& total_us) const;
+
+	/// Prints the non empty buckets as "<lower bound>us:count".
+	void print(std::ostream& out) const;
+
+private:
+	std::atomic<uint64_t> mCounts[NB_BUCKETS];
+	std::atomic<uint64_t> mMaxUs;
+	std::atomic<uint64_t> mTotalUs;
+};
+
 /**
  * @brief Provide mutexes that keep track of the owner. Based on pthread mutex.
  */
@@ -46,7 +75,7 @@ class RsMutex
 {
 public:
 
-	RsMutex(const std::string& name) : _thread_id(0)
+	RsMutex(const std::string& name) : _thread_id(0), mHoldStats(nullptr)
 #ifdef RS_MUTEX_DEBUG
 	  , _name(name)
 #endif
@@ -64,7 +93,16 @@ public:
 
 	void lock();
 	void unlock();
-	bool trylock() { return (0 == pthread_mutex_trylock(&realMutex)); }
+	bool trylock()
+	{
+		if(0 != pthread_mutex_trylock(&realMutex)) return false;
+		if(mHoldStats) mLockedSince = std::chrono::steady_clock::now();
+		return true;
+	}
+
+	/// Records how long each lock is held into stats, which must outlive the
+	/// mutex. Must be called before the mutex is used by other threads.
+	void trackHoldTime(RsMutexHoldStats *stats) { mHoldStats = stats; }
 
 #ifdef RS_MUTEX_DEBUG
 	const std::string& name() const { return _name ; }
@@ -74,6 +112,9 @@ private:
 	pthread_mutex_t realMutex;
 	pthread_t _thread_id;
 
+	RsMutexHoldStats *mHoldStats;
+	std::chrono::steady_clock::time_point mLockedSince;	// only written by the owner
+
 #ifdef RS_MUTEX_DEBUG
 	std::string _name;
 #endif
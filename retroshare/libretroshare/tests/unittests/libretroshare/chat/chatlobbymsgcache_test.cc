@@ -0,0 +1,70 @@
+/*******************************************************************************
+ * unittests/libretroshare/chat/chatlobbymsgcache_test.cc                      *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+// from libretroshare
+
+#include "chat/distributedchat.h"
+
+TEST(libretroshare_chat, ChatLobbyMsgCache)
+{
+	ChatLobbyMsgCache cache ;
+
+	EXPECT_FALSE(cache.contains(1)) ;
+
+	// first time an id is seen, it is new. Afterwards it is known.
+
+	EXPECT_FALSE(cache.touch(1,100)) ;
+	EXPECT_FALSE(cache.touch(2,105)) ;
+	EXPECT_FALSE(cache.touch(3,110)) ;
+	EXPECT_TRUE(cache.touch(1,100)) ;
+	EXPECT_TRUE(cache.contains(1)) ;
+	EXPECT_EQ(3u,cache.size()) ;
+
+	// seeing id 1 again later keeps it alive, and makes it the most recent one
+
+	EXPECT_TRUE(cache.touch(1,120)) ;
+
+	std::list<ChatLobbyMsgId> ids ;
+	cache.getRecentIds(105,ids) ;
+
+	ASSERT_EQ(3u,ids.size()) ;
+	EXPECT_EQ(1u,ids.front()) ;
+	EXPECT_EQ(2u,ids.back()) ;
+
+	ids.clear() ;
+	cache.getRecentIds(111,ids) ;
+	ASSERT_EQ(1u,ids.size()) ;
+	EXPECT_EQ(1u,ids.front()) ;
+
+	// expiry removes what was not seen since the limit
+
+	cache.removeOlderThan(111) ;
+
+	EXPECT_TRUE(cache.contains(1)) ;
+	EXPECT_FALSE(cache.contains(2)) ;
+	EXPECT_FALSE(cache.contains(3)) ;
+	EXPECT_EQ(1u,cache.size()) ;
+
+	cache.removeOlderThan(121) ;
+	EXPECT_EQ(0u,cache.size()) ;
+	EXPECT_FALSE(cache.touch(1,130)) ;
+}
@@ -0,0 +1,369 @@
+/*******************************************************************************
+ * unittests/libretroshare/file_sharing/filelistcontainer_test.cc              *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+
+// from libretroshare
+
+#include "file_sharing/filelist_container.h"
+#include "file_sharing/file_sharing_defaults.h"
+#include "util/rsdir.h"
+#include "util/rsrandom.h"
+
+// There is no SSL key in the tests: the own key encryption is replaced by a xor, which is
+// enough to check that the container keys go through it.
+
+static bool xorWithOwnKey(void *& out,int& out_size,const void *in,int in_size)
+{
+	out = malloc(in_size) ;
+	out_size = in_size ;
+
+	for(int i=0;i<in_size;++i)
+		((unsigned char*)out)[i] = ((const unsigned char*)in)[i] ^ 0x5a ;
+
+	return true ;
+}
+
+class TestWriter: public FileListContainerWriter
+{
+protected:
+	virtual bool encryptWithOwnKey(void *& out,int& out_size,const void *in,int in_size) { return xorWithOwnKey(out,out_size,in,in_size) ; }
+	virtual bool decryptWithOwnKey(void *& out,int& out_size,const void *in,int in_size) { return xorWithOwnKey(out,out_size,in,in_size) ; }
+};
+
+class TestReader: public FileListContainerReader
+{
+protected:
+	virtual bool encryptWithOwnKey(void *& out,int& out_size,const void *in,int in_size) { return xorWithOwnKey(out,out_size,in,in_size) ; }
+	virtual bool decryptWithOwnKey(void *& out,int& out_size,const void *in,int in_size) { return xorWithOwnKey(out,out_size,in,in_size) ; }
+};
+
+static std::vector<unsigned char> randomData(uint32_t size)
+{
+	std::vector<unsigned char> data(size) ;
+	RSRandom::random_bytes(data.data(),size) ;
+	return data ;
+}
+
+static bool save(const std::string& fname,const std::vector<unsigned char>& data,uint32_t& written,uint32_t& kept)
+{
+	TestWriter writer ;
+
+	if(!writer.open(fname))
+		return false ;
+
+	// in pieces that do not match the chunks, as the file lists write their fields
+
+	for(uint32_t offset=0;offset<data.size();offset+=1000)
+		if(!writer.write(&data[offset],std::min((uint32_t)data.size()-offset,1000u)))
+			return false ;
+
+	bool res = writer.close() ;
+
+	written = writer.writtenChunks() ;
+	kept = writer.keptChunks() ;
+
+	return res ;
+}
+
+static bool load(const std::string& fname,std::vector<unsigned char>& data)
+{
+	TestReader reader ;
+	data.clear() ;
+
+	if(!reader.open(fname))
+		return false ;
+
+	while(!reader.eof())
+	{
+		if(!reader.ensure(1))
+			return false ;
+
+		uint32_t n = std::min(reader.available(),777u) ;
+
+		data.insert(data.end(),reader.data(),reader.data()+n) ;
+		reader.consume(n) ;
+	}
+	return !reader.failed() ;
+}
+
+static bool readFile(const std::string& fname,std::vector<unsigned char>& content)
+{
+	FILE *F = RsDirUtil::rs_fopen(fname.c_str(),"rb") ;
+
+	if(!F)
+		return false ;
+
+	content.clear() ;
+	unsigned char buf[4096] ;
+	size_t n ;
+
+	while((n = fread(buf,1,sizeof(buf),F)) > 0)
+		content.insert(content.end(),buf,buf+n) ;
+
+	fclose(F) ;
+	return true ;
+}
+
+static bool writeFile(const std::string& fname,const std::vector<unsigned char>& content)
+{
+	FILE *F = RsDirUtil::rs_fopen(fname.c_str(),"wb") ;
+
+	if(!F)
+		return false ;
+
+	bool res = fwrite(content.data(),1,content.size(),F) == content.size() ;
+	fclose(F) ;
+	return res ;
+}
+
+class FileListContainerTest: public ::testing::Test
+{
+protected:
+	FileListContainerTest()
+	{
+		char tmpl[] = "/tmp/rs_flc_XXXXXX" ;
+		mDir = mkdtemp(tmpl) ;
+		mFileName = mDir + "/dirlist.bin" ;
+	}
+
+	~FileListContainerTest()
+	{
+		remove(mFileName.c_str()) ;
+		remove((mFileName+".tmp").c_str()) ;
+		rmdir(mDir.c_str()) ;
+	}
+
+	std::string mDir ;
+	std::string mFileName ;
+};
+
+TEST_F(FileListContainerTest, roundTrip)
+{
+	std::vector<unsigned char> data(randomData(3*FL_CONTAINER_CHUNK_SIZE + 12345)), loaded ;
+	uint32_t written, kept ;
+
+	ASSERT_TRUE(save(mFileName,data,written,kept)) ;
+
+	EXPECT_EQ(4u,written) ;
+	EXPECT_EQ(0u,kept) ;
+	EXPECT_FALSE(RsDirUtil::fileExists(mFileName+".tmp")) ;
+
+	ASSERT_TRUE(load(mFileName,loaded)) ;
+	EXPECT_TRUE(data == loaded) ;
+
+	// the data is not in the file in clear
+
+	std::vector<unsigned char> content ;
+	ASSERT_TRUE(readFile(mFileName,content)) ;
+	EXPECT_TRUE(std::search(content.begin(),content.end(),data.begin(),data.begin()+64) == content.end()) ;
+
+	// empty content
+
+	ASSERT_TRUE(save(mFileName,std::vector<unsigned char>(),written,kept)) ;
+	ASSERT_TRUE(load(mFileName,loaded)) ;
+	EXPECT_TRUE(loaded.empty()) ;
+}
+
+TEST_F(FileListContainerTest, legacyFile)
+{
+	// Files saved before the container are the whole data encrypted at once with the own key.
+
+	std::vector<unsigned char> data(randomData(100000)), loaded ;
+
+	void *encrypted = NULL ;
+	int encrypted_size = 0 ;
+	ASSERT_TRUE(xorWithOwnKey(encrypted,encrypted_size,data.data(),data.size())) ;
+
+	ASSERT_TRUE(writeFile(mFileName,std::vector<unsigned char>((unsigned char*)encrypted,(unsigned char*)encrypted+encrypted_size))) ;
+	free(encrypted) ;
+
+	ASSERT_TRUE(load(mFileName,loaded)) ;
+	EXPECT_TRUE(data == loaded) ;
+
+	// and the next save replaces it with a container
+
+	uint32_t written, kept ;
+	data[10] ^= 1 ;
+
+	ASSERT_TRUE(save(mFileName,data,written,kept)) ;
+	EXPECT_EQ(0u,kept) ;
+
+	ASSERT_TRUE(load(mFileName,loaded)) ;
+	EXPECT_TRUE(data == loaded) ;
+
+	// missing file
+
+	EXPECT_FALSE(load(mDir+"/nonexistent.bin",loaded)) ;
+}
+
+TEST_F(FileListContainerTest, unchangedChunks)
+{
+	std::vector<unsigned char> data(randomData(8*FL_CONTAINER_CHUNK_SIZE)), loaded ;
+	uint32_t written, kept ;
+
+	ASSERT_TRUE(save(mFileName,data,written,kept)) ;
+	EXPECT_EQ(8u,written) ;
+
+	// saving the same data again writes no chunk
+
+	ASSERT_TRUE(save(mFileName,data,written,kept)) ;
+	EXPECT_EQ(0u,written) ;
+	EXPECT_EQ(8u,kept) ;
+
+	// only the chunk that changed is written
+
+	data[3*FL_CONTAINER_CHUNK_SIZE + 100] ^= 0xff ;
+
+	ASSERT_TRUE(save(mFileName,data,written,kept)) ;
+	EXPECT_EQ(1u,written) ;
+	EXPECT_EQ(7u,kept) ;
+
+	ASSERT_TRUE(load(mFileName,loaded)) ;
+	EXPECT_TRUE(data == loaded) ;
+
+	// data added at the end only writes the last chunks
+
+	std::vector<unsigned char> more(randomData(FL_CONTAINER_CHUNK_SIZE + 10)) ;
+	data.insert(data.end(),more.begin(),more.end()) ;
+
+	ASSERT_TRUE(save(mFileName,data,written,kept)) ;
+	EXPECT_EQ(2u,written) ;
+	EXPECT_EQ(8u,kept) ;
+
+	ASSERT_TRUE(load(mFileName,loaded)) ;
+	EXPECT_TRUE(data == loaded) ;
+
+	// The file does not grow forever with the unused slots of previous generations.
+
+	std::vector<unsigned char> content ;
+	ASSERT_TRUE(readFile(mFileName,content)) ;
+	uint64_t size = content.size() ;
+
+	for(int i=0;i<10;++i)
+	{
+		data[RSRandom::random_u32() % data.size()] ^= 0xff ;
+		ASSERT_TRUE(save(mFileName,data,written,kept)) ;
+	}
+	ASSERT_TRUE(readFile(mFileName,content)) ;
+	EXPECT_LE(content.size(),2*size) ;
+
+	ASSERT_TRUE(load(mFileName,loaded)) ;
+	EXPECT_TRUE(data == loaded) ;
+}
+
+TEST_F(FileListContainerTest, interruptedSave)
+{
+	std::vector<unsigned char> data1(randomData(5*FL_CONTAINER_CHUNK_SIZE)), loaded ;
+	uint32_t written, kept ;
+
+	// A new file is written to a temporary file, renamed when complete. A save that does not
+	// complete leaves nothing.
+
+	{
+		TestWriter writer ;
+		ASSERT_TRUE(writer.open(mFileName)) ;
+		ASSERT_TRUE(writer.write(data1.data(),data1.size())) ;
+		EXPECT_TRUE(RsDirUtil::fileExists(mFileName+".tmp")) ;
+	}
+	EXPECT_FALSE(RsDirUtil::fileExists(mFileName)) ;
+	EXPECT_FALSE(RsDirUtil::fileExists(mFileName+".tmp")) ;
+
+	// a temporary file left by a crash does not get in the way
+
+	ASSERT_TRUE(writeFile(mFileName+".tmp",randomData(1000))) ;
+	ASSERT_TRUE(save(mFileName,data1,written,kept)) ;
+	EXPECT_FALSE(RsDirUtil::fileExists(mFileName+".tmp")) ;
+
+	ASSERT_TRUE(load(mFileName,loaded)) ;
+	EXPECT_TRUE(data1 == loaded) ;
+
+	// An update in place that stops before close() leaves the previous content, although
+	// the new chunks are on disc already.
+
+	std::vector<unsigned char> data2(data1) ;
+	data2[100] ^= 0xff ;
+	data2[4*FL_CONTAINER_CHUNK_SIZE] ^= 0xff ;
+
+	{
+		TestWriter writer ;
+		ASSERT_TRUE(writer.open(mFileName)) ;
+		ASSERT_TRUE(writer.write(data2.data(),data2.size())) ;
+		EXPECT_EQ(2u,writer.writtenChunks()) ;
+	}
+	ASSERT_TRUE(load(mFileName,loaded)) ;
+	EXPECT_TRUE(data1 == loaded) ;
+
+	// A crash while the new header is written: the header of the previous generation, in the
+	// other header slot, is used.
+
+	ASSERT_TRUE(save(mFileName,data2,written,kept)) ;
+
+	std::vector<unsigned char> content ;
+	ASSERT_TRUE(readFile(mFileName,content)) ;
+
+	uint32_t new_header = 0 ;	// generation 2 uses header slot 0
+
+	for(uint32_t i=100;i<FileListContainer::HEADER_SLOT_SIZE;++i)
+		content[new_header*FileListContainer::HEADER_SLOT_SIZE + i] = 0 ;
+
+	ASSERT_TRUE(writeFile(mFileName,content)) ;
+
+	ASSERT_TRUE(load(mFileName,loaded)) ;
+	EXPECT_TRUE(data1 == loaded) ;
+}
+
+TEST_F(FileListContainerTest, tamperedChunk)
+{
+	std::vector<unsigned char> data(randomData(3*FL_CONTAINER_CHUNK_SIZE)), loaded ;
+	uint32_t written, kept ;
+
+	ASSERT_TRUE(save(mFileName,data,written,kept)) ;
+
+	std::vector<unsigned char> content ;
+	ASSERT_TRUE(readFile(mFileName,content)) ;
+
+	// One bit changed in the second chunk, which the GCM tag of the chunk catches. The slots
+	// come after the two header slots, and the chunks of a new file are in slots 0, 1, 2.
+
+	content[2*FileListContainer::HEADER_SLOT_SIZE + FL_CONTAINER_CHUNK_SIZE + 1000] ^= 0x01 ;
+	ASSERT_TRUE(writeFile(mFileName,content)) ;
+
+	TestReader reader ;
+	ASSERT_TRUE(reader.open(mFileName)) ;
+
+	uint32_t read = 0 ;
+
+	while(reader.ensure(1))
+	{
+		read += reader.available() ;
+		reader.consume(reader.available()) ;
+	}
+
+	EXPECT_TRUE(reader.failed()) ;
+	EXPECT_EQ(FL_CONTAINER_CHUNK_SIZE,read) ;
+	EXPECT_FALSE(load(mFileName,loaded)) ;
+}
@@ -0,0 +1,241 @@
+/*******************************************************************************
+ * unittests/libretroshare/file_sharing/remotefilehashindex_test.cc            *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <map>
+
+// from libretroshare
+
+#include "file_sharing/directory_storage.h"
+#include "file_sharing/filelist_io.h"
+
+struct TestFile
+{
+	std::string name ;
+	RsFileHash hash ;
+};
+
+// Directory content, as a friend sends it.
+
+static void serialiseDir(const std::string& name,const std::vector<RsFileHash>& subdirs,const std::vector<TestFile>& files,RsTlvBinaryData& bindata)
+{
+	unsigned char *data = NULL, *file_data = NULL ;
+	uint32_t size = 0, offset = 0, file_size = 0 ;
+	uint32_t ts = 1600000000 ;
+
+	FileListIO::writeField(data,size,offset,FILE_LIST_IO_TAG_DIR_NAME,name) ;
+	FileListIO::writeField(data,size,offset,FILE_LIST_IO_TAG_RECURS_MODIF_TS,ts) ;
+	FileListIO::writeField(data,size,offset,FILE_LIST_IO_TAG_MODIF_TS,ts) ;
+	FileListIO::writeField(data,size,offset,FILE_LIST_IO_TAG_RAW_NUMBER,(uint32_t)subdirs.size()) ;
+	FileListIO::writeField(data,size,offset,FILE_LIST_IO_TAG_RAW_NUMBER,(uint32_t)files.size()) ;
+
+	for(uint32_t i=0;i<subdirs.size();++i)
+		FileListIO::writeField(data,size,offset,FILE_LIST_IO_TAG_ENTRY_INDEX,subdirs[i]) ;
+
+	for(uint32_t i=0;i<files.size();++i)
+	{
+		uint32_t file_offset = 0 ;
+
+		FileListIO::writeField(file_data,file_size,file_offset,FILE_LIST_IO_TAG_FILE_NAME,files[i].name) ;
+		FileListIO::writeField(file_data,file_size,file_offset,FILE_LIST_IO_TAG_FILE_SIZE,(uint64_t)1000) ;
+		FileListIO::writeField(file_data,file_size,file_offset,FILE_LIST_IO_TAG_FILE_SHA1_HASH,files[i].hash) ;
+		FileListIO::writeField(file_data,file_size,file_offset,FILE_LIST_IO_TAG_MODIF_TS,ts) ;
+
+		FileListIO::writeField(data,size,offset,FILE_LIST_IO_TAG_REMOTE_FILE_ENTRY,file_data,file_offset) ;
+	}
+	free(file_data) ;
+
+	bindata.TlvClear() ;
+	bindata.bin_data = data ;
+	bindata.bin_len = offset ;
+}
+
+static bool updateDir(RemoteDirectoryStorage& rds,DirectoryStorage::EntryIndex indx,const std::string& name,const std::vector<RsFileHash>& subdirs,const std::vector<TestFile>& files)
+{
+	RsTlvBinaryData bindata ;
+	serialiseDir(name,subdirs,files,bindata) ;
+
+	return rds.deserialiseUpdateDirEntry(indx,bindata) ;
+}
+
+class RemoteFileHashIndexTest: public ::testing::Test
+{
+protected:
+	RemoteFileHashIndexTest()
+	    : mPeerA(RsPeerId::random()), mPeerB(RsPeerId::random()),
+	      mListA(new RemoteDirectoryStorage(mPeerA,"/nonexistent/dirlist_a.bin")),
+	      mListB(new RemoteDirectoryStorage(mPeerB,"/nonexistent/dirlist_b.bin")),
+	      mSubdir(RsFileHash::random()),
+	      mFinder([this](const RsPeerId& pid) -> const RemoteDirectoryStorage * { auto it = mLists.find(pid) ; return it==mLists.end()?NULL:it->second ; })
+	{
+		for(int i=0;i<4;++i)
+			mFiles.push_back(TestFile{ "file" + std::to_string(i),RsFileHash::random() }) ;
+
+		mLists[mPeerA] = mListA ;
+		mLists[mPeerB] = mListB ;
+	}
+
+	~RemoteFileHashIndexTest()
+	{
+		delete mListA ;
+		delete mListB ;
+	}
+
+	std::list<RsPeerId> sources(const RsFileHash& hash)
+	{
+		std::list<RsPeerId> peers ;
+		mIndex.findSources(hash,mFinder,peers) ;
+		peers.sort() ;
+		return peers ;
+	}
+
+	RsPeerId mPeerA, mPeerB ;
+	RemoteDirectoryStorage *mListA, *mListB ;
+	RsFileHash mSubdir ;
+	std::vector<TestFile> mFiles ;
+
+	std::map<RsPeerId,const RemoteDirectoryStorage*> mLists ;	// lists p3FileDatabase knows of
+	RemoteFileHashIndex::ListFinder mFinder ;
+	RemoteFileHashIndex mIndex ;
+};
+
+TEST_F(RemoteFileHashIndexTest, sources)
+{
+	// A has files 0 and 1 at the top and 2 in a subdir. B has file 1 and 3.
+
+	ASSERT_TRUE(updateDir(*mListA,mListA->root(),"",{ mSubdir },{ mFiles[0],mFiles[1] })) ;
+
+	DirectoryStorage::EntryIndex subdir_index ;
+	ASSERT_TRUE(mListA->getIndexFromDirHash(mSubdir,subdir_index)) ;
+	ASSERT_TRUE(updateDir(*mListA,subdir_index,"dir",{},{ mFiles[2] })) ;
+
+	ASSERT_TRUE(updateDir(*mListB,mListB->root(),"",{},{ mFiles[1],mFiles[3] })) ;
+
+	mIndex.indexFiles(mListA,DirectoryStorage::NO_INDEX) ;
+	mIndex.indexFiles(mListB,DirectoryStorage::NO_INDEX) ;
+
+	EXPECT_EQ(4u,mIndex.size()) ;
+
+	EXPECT_EQ(std::list<RsPeerId>({ mPeerA }),sources(mFiles[0].hash)) ;
+	EXPECT_EQ(std::list<RsPeerId>({ mPeerA }),sources(mFiles[2].hash)) ;
+	EXPECT_EQ(std::list<RsPeerId>({ mPeerB }),sources(mFiles[3].hash)) ;
+
+	std::list<RsPeerId> both({ mPeerA,mPeerB }) ;
+	both.sort() ;
+	EXPECT_EQ(both,sources(mFiles[1].hash)) ;
+
+	EXPECT_TRUE(sources(RsFileHash::random()).empty()) ;
+
+	// indexing the same directory again does not add entries
+
+	mIndex.indexFiles(mListA,mListA->root()) ;
+	EXPECT_EQ(0u,mIndex.check(mFinder)) ;
+	EXPECT_EQ(both,sources(mFiles[1].hash)) ;
+}
+
+TEST_F(RemoteFileHashIndexTest, staleEntries)
+{
+	ASSERT_TRUE(updateDir(*mListA,mListA->root(),"",{},{ mFiles[0],mFiles[1],mFiles[2] })) ;
+	mIndex.indexFiles(mListA,DirectoryStorage::NO_INDEX) ;
+
+	EXPECT_EQ(3u,mIndex.size()) ;
+
+	// A updates its list: file 1 is gone, and file 3 is new. Only the updated directory is indexed
+	// again, and the entry of file 1 stays until it is looked up or checked.
+
+	ASSERT_TRUE(updateDir(*mListA,mListA->root(),"",{},{ mFiles[0],mFiles[2],mFiles[3] })) ;
+	mIndex.indexFiles(mListA,mListA->root()) ;
+
+	EXPECT_EQ(4u,mIndex.size()) ;
+
+	EXPECT_TRUE(sources(mFiles[1].hash).empty()) ;
+	EXPECT_EQ(3u,mIndex.size()) ;
+
+	EXPECT_EQ(std::list<RsPeerId>({ mPeerA }),sources(mFiles[3].hash)) ;
+
+	// same, with check()
+
+	ASSERT_TRUE(updateDir(*mListA,mListA->root(),"",{},{ mFiles[0],mFiles[3] })) ;
+
+	EXPECT_EQ(1u,mIndex.check(mFinder)) ;
+	EXPECT_EQ(2u,mIndex.size()) ;
+	EXPECT_TRUE(sources(mFiles[2].hash).empty()) ;
+	EXPECT_EQ(std::list<RsPeerId>({ mPeerA }),sources(mFiles[0].hash)) ;
+}
+
+TEST_F(RemoteFileHashIndexTest, movedFiles)
+{
+	ASSERT_TRUE(updateDir(*mListA,mListA->root(),"",{ mSubdir },{ mFiles[0],mFiles[1] })) ;
+
+	DirectoryStorage::EntryIndex subdir_index ;
+	ASSERT_TRUE(mListA->getIndexFromDirHash(mSubdir,subdir_index)) ;
+	ASSERT_TRUE(updateDir(*mListA,subdir_index,"dir",{},{ mFiles[2] })) ;
+
+	mIndex.indexFiles(mListA,DirectoryStorage::NO_INDEX) ;
+
+	// File 0 moves into the subdir. Its index in A's list changes. File 2 takes its place at the top,
+	// possibly at the index file 0 had.
+
+	ASSERT_TRUE(updateDir(*mListA,mListA->root(),"",{ mSubdir },{ mFiles[1] })) ;
+	ASSERT_TRUE(updateDir(*mListA,subdir_index,"dir",{},{ mFiles[0] })) ;
+	ASSERT_TRUE(updateDir(*mListA,mListA->root(),"",{ mSubdir },{ mFiles[1],mFiles[2] })) ;
+
+	// Nothing is indexed again: entries are moved to where the files are now.
+
+	EXPECT_EQ(0u,mIndex.check(mFinder)) ;
+	EXPECT_EQ(3u,mIndex.size()) ;
+
+	EXPECT_EQ(std::list<RsPeerId>({ mPeerA }),sources(mFiles[0].hash)) ;
+	EXPECT_EQ(std::list<RsPeerId>({ mPeerA }),sources(mFiles[2].hash)) ;
+
+	// and are found directly from then on
+
+	DirectoryStorage::EntryIndex file_index ;
+	ASSERT_EQ(1,mListA->searchHash(mFiles[0].hash,file_index)) ;
+	EXPECT_TRUE(mListA->checkFileHash(file_index,mFiles[0].hash)) ;
+	EXPECT_EQ(0u,mIndex.check(mFinder)) ;
+}
+
+TEST_F(RemoteFileHashIndexTest, removedFriend)
+{
+	ASSERT_TRUE(updateDir(*mListA,mListA->root(),"",{},{ mFiles[0],mFiles[1] })) ;
+	ASSERT_TRUE(updateDir(*mListB,mListB->root(),"",{},{ mFiles[1],mFiles[2] })) ;
+
+	mIndex.indexFiles(mListA,DirectoryStorage::NO_INDEX) ;
+	mIndex.indexFiles(mListB,DirectoryStorage::NO_INDEX) ;
+
+	// A is not a friend anymore: p3FileDatabase forgets its list.
+
+	mLists.erase(mPeerA) ;
+
+	EXPECT_EQ(std::list<RsPeerId>({ mPeerB }),sources(mFiles[1].hash)) ;
+
+	EXPECT_EQ(1u,mIndex.check(mFinder)) ;
+	EXPECT_EQ(2u,mIndex.size()) ;
+	EXPECT_TRUE(sources(mFiles[0].hash).empty()) ;
+
+	// and so is B
+
+	mLists.erase(mPeerB) ;
+
+	EXPECT_EQ(2u,mIndex.check(mFinder)) ;
+	EXPECT_EQ(0u,mIndex.size()) ;
+}
@@ -0,0 +1,159 @@
+/*******************************************************************************
+ * unittests/libretroshare/ft/ftchecksumpool_test.cc                           *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <unistd.h>
+
+// from libretroshare
+
+#include "ft/ftchecksumpool.h"
+#include "ft/ftfilecreator.h"
+#include "util/rsdir.h"
+#include "util/rsdiscspace.h"
+
+static const uint32_t CS = ChunkMap::CHUNKMAP_FIXED_CHUNK_SIZE ;
+
+TEST(libretroshare_ft, ChecksumPoolCancel)
+{
+	ftChecksumPool pool(1) ;
+
+	RsFileHash ha = RsFileHash::random() ;
+	RsFileHash hb = RsFileHash::random() ;
+
+	std::atomic<bool> started(false), release(false), done(false) ;
+	std::atomic<int> count_a(0), count_b(0) ;
+
+	pool.addJob(ha,[&]() {
+		started = true ;
+		while(!release)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1)) ;
+		done = true ;
+	}) ;
+
+	for(int i=0;i<10;++i)
+	{
+		pool.addJob(ha,[&]() { ++count_a ; }) ;
+		pool.addJob(hb,[&]() { ++count_b ; }) ;
+	}
+
+	while(!started)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1)) ;
+
+	// Cancelling drops the jobs of the file that did not start, and waits for the running one.
+
+	std::thread releaser([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100)) ;
+		release = true ;
+	}) ;
+
+	pool.cancelJobs(ha) ;
+	EXPECT_TRUE(done) ;
+	releaser.join() ;
+
+	while(pool.pendingJobs() > 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1)) ;
+
+	EXPECT_EQ(count_a, 0) ;
+	EXPECT_EQ(count_b, 10) ;
+}
+
+static void downloadAll(ftFileCreator& fc, const RsPeerId& peer, const std::vector<unsigned char>& data)
+{
+	uint64_t offset ;
+	uint32_t size ;
+	bool map_needed ;
+
+	for(int i=0;i<100 && fc.getMissingChunk(peer,CS,offset,size,map_needed);++i)
+		fc.addFileData(offset,size,(void*)&data[offset]) ;
+}
+
+TEST(libretroshare_ft, FileCreatorChunkChecking)
+{
+	RsDiscSpace::setPartialsPath("/tmp") ;
+
+	std::string path = "/tmp/ftchecksumpool_test_" + std::to_string(getpid()) ;
+	uint64_t size = 3*(uint64_t)CS + CS/2 ;
+
+	std::vector<unsigned char> data(size) ;
+	uint32_t x = 1 ;
+	for(uint64_t i=0;i<size;++i)
+		data[i] = (unsigned char)((x = x*1103515245 + 12345) >> 16) ;
+
+	std::vector<Sha1CheckSum> sums ;
+	for(uint64_t o=0;o<size;o+=CS)
+		sums.push_back(RsDirUtil::sha1sum(&data[o],std::min((uint64_t)CS,size-o))) ;
+
+	RsFileHash file_hash = RsDirUtil::sha1sum(data.data(),size) ;
+	RsPeerId peer = RsPeerId::random() ;
+
+	{
+		ftFileCreator fc(path,size,file_hash,true) ;
+
+		downloadAll(fc,peer,data) ;
+
+		std::vector<uint32_t> to_check ;
+		fc.getChunksToCheck(to_check) ;
+		ASSERT_EQ(to_check.size(), 4u) ;
+		EXPECT_FALSE(fc.finished()) ;
+
+		// A wrong sum sends the chunk back to download.
+
+		EXPECT_FALSE(fc.verifyChunk(1,sums[0])) ;
+		downloadAll(fc,peer,data) ;
+
+		// Chunks are checked in any order. Once all are checked the file is complete.
+
+		EXPECT_TRUE(fc.verifyChunk(2,sums[2])) ;
+		EXPECT_TRUE(fc.verifyChunk(0,sums[0])) ;
+		EXPECT_TRUE(fc.verifyChunk(1,sums[1])) ;
+		EXPECT_FALSE(fc.finished()) ;
+		EXPECT_TRUE(fc.verifyChunk(3,sums[3])) ;
+		EXPECT_TRUE(fc.finished()) ;
+
+		// Checking a chunk twice is harmless.
+
+		EXPECT_TRUE(fc.verifyChunk(3,sums[3])) ;
+
+		RsFileHash h ;
+		ASSERT_TRUE(fc.hashReceivedData(h)) ;
+		EXPECT_EQ(h, file_hash) ;
+
+		// After a forced check, the file is hashed again from the chunks checked anew.
+
+		fc.forceCheck() ;
+		EXPECT_FALSE(fc.finished()) ;
+
+		for(uint32_t i=4;i>0;--i)
+			EXPECT_TRUE(fc.verifyChunk(i-1,sums[i-1])) ;
+
+		ASSERT_TRUE(fc.finished()) ;
+		ASSERT_TRUE(fc.hashReceivedData(h)) ;
+		EXPECT_EQ(h, file_hash) ;
+
+		fc.closeFile() ;
+	}
+	remove(path.c_str()) ;
+}
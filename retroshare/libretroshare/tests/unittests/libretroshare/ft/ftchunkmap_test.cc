@@ -0,0 +1,159 @@
+/*******************************************************************************
+ * unittests/libretroshare/ft/ftchunkmap_test.cc                               *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+// from libretroshare
+
+#include "ft/ftchunkmap.h"
+
+static const uint32_t CS = ChunkMap::CHUNKMAP_FIXED_CHUNK_SIZE ;
+
+TEST(libretroshare_ft, ChunkMapRarestFirst)
+{
+	// 4 chunks. A has all of them, B has 0,1,2 and C has 0,1.
+
+	ChunkMap cmap(4*CS,false) ;
+	cmap.setStrategy(FileChunksInfo::CHUNK_STRATEGY_RANDOM) ;
+
+	RsPeerId a = RsPeerId::random() ;
+	RsPeerId b = RsPeerId::random() ;
+	RsPeerId c = RsPeerId::random() ;
+
+	CompressedChunkMap ma(4,0),mb(4,0),mc(4,0) ;
+
+	for(uint32_t i=0;i<4;++i) ma.set(i) ;
+	for(uint32_t i=0;i<3;++i) mb.set(i) ;
+	for(uint32_t i=0;i<2;++i) mc.set(i) ;
+
+	cmap.setPeerAvailabilityMap(a,ma) ;
+	cmap.setPeerAvailabilityMap(b,mb) ;
+	cmap.setPeerAvailabilityMap(c,mc) ;
+
+	// A gets the chunks only it has first, then the ones only A and B have.
+
+	ftChunk chunk ;
+	bool map_needed ;
+
+	ASSERT_TRUE(cmap.getDataChunk(a,CS,chunk,map_needed)) ;
+	EXPECT_EQ(chunk.offset, 3*(uint64_t)CS) ;
+	EXPECT_EQ(chunk.size, CS) ;
+
+	ASSERT_TRUE(cmap.getDataChunk(a,CS,chunk,map_needed)) ;
+	EXPECT_EQ(chunk.offset, 2*(uint64_t)CS) ;
+
+	// Once B is gone, chunk 0 and 1 are equally rare.
+
+	cmap.removeFileSource(b) ;
+
+	ASSERT_TRUE(cmap.getDataChunk(c,CS,chunk,map_needed)) ;
+	EXPECT_LT(chunk.offset, 2*(uint64_t)CS) ;
+}
+
+TEST(libretroshare_ft, ChunkMapEndgame)
+{
+	// 2 chunks, and two sources with the whole file: a slow one and a fast one.
+
+	ChunkMap cmap(2*CS,true) ;
+	cmap.setStrategy(FileChunksInfo::CHUNK_STRATEGY_STREAMING) ;
+
+	RsPeerId slow = RsPeerId::random() ;
+	RsPeerId fast = RsPeerId::random() ;
+
+	ftChunk chunk ;
+	bool map_needed ;
+
+	ASSERT_TRUE(cmap.getDataChunk(slow,10000,chunk,map_needed)) ;
+	EXPECT_EQ(chunk.offset, 0u) ;
+	EXPECT_EQ(chunk.size, 10000u) ;
+
+	// The fast source first takes the rest of the chunk of the slow one, then the next chunk.
+
+	ASSERT_TRUE(cmap.getDataChunk(fast,CS,chunk,map_needed)) ;
+	EXPECT_EQ(chunk.offset, 10000u) ;
+	EXPECT_EQ(chunk.size, CS - 10000) ;
+
+	ASSERT_TRUE(cmap.getDataChunk(fast,CS,chunk,map_needed)) ;
+	EXPECT_EQ(chunk.offset, (uint64_t)CS) ;
+
+	EXPECT_FALSE(cmap.getDataChunk(fast,CS,chunk,map_needed)) ;
+
+	// The slice of the slow source is asked again to the fast one, without
+	// waiting, because the fast one should send it sooner. It is not asked to
+	// the same source twice.
+
+	uint64_t offset ;
+	uint32_t size ;
+
+	ASSERT_TRUE(cmap.reAskPendingChunk(fast,CS,offset,size)) ;
+	EXPECT_EQ(offset, 0u) ;
+	EXPECT_EQ(size, 10000u) ;
+
+	EXPECT_FALSE(cmap.reAskPendingChunk(fast,CS,offset,size)) ;
+	EXPECT_FALSE(cmap.reAskPendingChunk(slow,10000,offset,size)) ;
+
+	cmap.dataReceived(0) ;
+	cmap.dataReceived(10000) ;
+	cmap.dataReceived(CS) ;
+
+	std::vector<uint32_t> to_check ;
+	cmap.getChunksToCheck(to_check) ;
+	EXPECT_EQ(to_check.size(), 2u) ;
+}
+
+TEST(libretroshare_ft, ChunkMapFastSourceSecondChunk)
+{
+	// 4 chunks, and two sources with the whole file: a slow one and a fast one.
+
+	ChunkMap cmap(4*CS,true) ;
+	cmap.setStrategy(FileChunksInfo::CHUNK_STRATEGY_STREAMING) ;
+
+	RsPeerId slow = RsPeerId::random() ;
+	RsPeerId fast = RsPeerId::random() ;
+
+	ftChunk chunk ;
+	bool map_needed ;
+
+	ASSERT_TRUE(cmap.getDataChunk(fast,100000,chunk,map_needed)) ;
+	EXPECT_EQ(chunk.offset, 0u) ;
+
+	ASSERT_TRUE(cmap.getDataChunk(slow,10000,chunk,map_needed)) ;
+	EXPECT_EQ(chunk.offset, (uint64_t)CS) ;
+
+	// The fast source takes a second chunk, but first finishes the one it has.
+
+	ASSERT_TRUE(cmap.getDataChunk(fast,100000,chunk,map_needed)) ;
+	EXPECT_EQ(chunk.offset, 100000u) ;
+	EXPECT_EQ(cmap.getChunkState(2), FileChunksInfo::CHUNK_ACTIVE) ;
+	EXPECT_EQ(cmap.getChunkState(3), FileChunksInfo::CHUNK_OUTSTANDING) ;
+
+	ASSERT_TRUE(cmap.getDataChunk(fast,CS,chunk,map_needed)) ;
+	EXPECT_EQ(chunk.offset, 200000u) ;
+	EXPECT_EQ(chunk.size, CS - 200000) ;
+
+	ASSERT_TRUE(cmap.getDataChunk(fast,CS,chunk,map_needed)) ;
+	EXPECT_EQ(chunk.offset, 2*(uint64_t)CS) ;
+	EXPECT_EQ(cmap.getChunkState(3), FileChunksInfo::CHUNK_ACTIVE) ;
+
+	// The slow one keeps its only chunk.
+
+	ASSERT_TRUE(cmap.getDataChunk(slow,10000,chunk,map_needed)) ;
+	EXPECT_EQ(chunk.offset, (uint64_t)CS + 10000) ;
+}
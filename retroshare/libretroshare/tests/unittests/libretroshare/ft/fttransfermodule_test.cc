@@ -0,0 +1,135 @@
+/*******************************************************************************
+ * unittests/libretroshare/ft/fttransfermodule_test.cc                         *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <deque>
+#include <cstdio>
+
+// from libretroshare
+
+#include "ft/ftdatamultiplex.h"
+#include "ft/ftfilecreator.h"
+#include "ft/fttransfermodule.h"
+#include "util/rsdiscspace.h"
+
+static const uint32_t PACKET_SIZE = 8*1024 ;
+
+// Records the data requests, and answers them only when told to.
+
+class RequestRecorder: public ftDataSend
+{
+public:
+	RequestRecorder() : requested(0) {}
+
+	virtual bool sendDataRequest(const RsPeerId&, const RsFileHash&, uint64_t, uint64_t offset, uint32_t chunksize)
+	{
+		requests.push_back(std::make_pair(offset,chunksize)) ;
+		requested += chunksize ;
+		return true ;
+	}
+	virtual bool sendData(const RsPeerId&, const RsFileHash&, uint64_t, uint64_t, uint32_t, void *) { return true ; }
+	virtual bool sendChunkMapRequest(const RsPeerId&, const RsFileHash&, bool) { return true ; }
+	virtual bool sendChunkMap(const RsPeerId&, const RsFileHash&, const CompressedChunkMap&, bool) { return true ; }
+	virtual bool sendSingleChunkCRCRequest(const RsPeerId&, const RsFileHash&, uint32_t) { return true ; }
+	virtual bool sendSingleChunkCRC(const RsPeerId&, const RsFileHash&, uint32_t, const Sha1CheckSum&) { return true ; }
+
+	// Sends back the data of all requests, in packets like ftServer does. The
+	// transfer module may ask for more while this is going on.
+
+	void answerAll(ftTransferModule& tm, const RsPeerId& peer)
+	{
+		static uint8_t buf[PACKET_SIZE] ;
+		RsSharedBuffer data(buf,[](uint8_t *) {}) ;
+
+		while(!requests.empty())
+		{
+			std::pair<uint64_t,uint32_t> req = requests.front() ;
+			requests.pop_front() ;
+
+			for(uint32_t done=0;done<req.second;done+=PACKET_SIZE)
+				tm.recvFileData(peer,req.first+done,std::min(PACKET_SIZE,req.second-done),data) ;
+		}
+	}
+
+	std::deque<std::pair<uint64_t,uint32_t> > requests ;
+	uint64_t requested ;
+};
+
+TEST(libretroshare_ft, TransferModuleRequestsFollowData)
+{
+	RsDiscSpace::setPartialsPath("/tmp") ;
+	std::string path = "/tmp/fttransfermodule_test.tmp" ;
+	uint64_t size = 8*ChunkMap::CHUNKMAP_FIXED_CHUNK_SIZE + 1000 ;
+
+	RequestRecorder rec ;
+	ftDataMultiplex mplex(RsPeerId::random(),&rec,NULL) ;
+	ftFileCreator *fc = new ftFileCreator(path,size,RsFileHash::random(),true) ;
+	ftTransferModule *tm = new ftTransferModule(fc,&mplex,NULL) ;
+
+	RsPeerId peer = RsPeerId::random() ;
+	tm->addFileSource(peer) ;
+	tm->setPeerState(peer,PQIPEER_IDLE,0xffffffff) ;
+
+	// The first tick starts the transfer. Everything else is asked as data comes back.
+
+	tm->tick() ;
+	ASSERT_FALSE(rec.requests.empty()) ;
+
+	rec.answerAll(*tm,peer) ;
+
+	EXPECT_EQ(fc->getRecvd(),size) ;
+	EXPECT_EQ(rec.requested,size) ;
+
+	delete tm ;
+	delete fc ;
+	remove(path.c_str()) ;
+}
+
+TEST(libretroshare_ft, TransferModuleRateLimit)
+{
+	RsDiscSpace::setPartialsPath("/tmp") ;
+	std::string path = "/tmp/fttransfermodule_test.tmp" ;
+	uint64_t size = 64*ChunkMap::CHUNKMAP_FIXED_CHUNK_SIZE ;
+	uint32_t rate = 100*1024 ;
+
+	RequestRecorder rec ;
+	ftDataMultiplex mplex(RsPeerId::random(),&rec,NULL) ;
+	ftFileCreator *fc = new ftFileCreator(path,size,RsFileHash::random(),true) ;
+	ftTransferModule *tm = new ftTransferModule(fc,&mplex,NULL) ;
+
+	RsPeerId peer = RsPeerId::random() ;
+	tm->addFileSource(peer) ;
+	tm->setPeerState(peer,PQIPEER_IDLE,rate) ;
+
+	// A source that answers instantly still only gets asked for a couple of
+	// seconds worth of data at the rate given by the controller.
+
+	tm->tick() ;
+	rec.answerAll(*tm,peer) ;
+
+	EXPECT_GT(rec.requested,(uint64_t)rate) ;
+	EXPECT_LT(rec.requested,(uint64_t)(3*rate) + 128*1024) ;
+	EXPECT_LT(fc->getRecvd(),size) ;
+
+	delete tm ;
+	delete fc ;
+	remove(path.c_str()) ;
+}
@@ -0,0 +1,293 @@
+/*******************************************************************************
+ * unittests/libretroshare/gxs/data_service/rsdataservice_blob_test.cc         *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include "gxs/rsdataservice.h"
+#include "rsitems/rsserviceids.h"
+#include "util/rsdir.h"
+
+#define BLOB_DATA_BASE_NAME "blob_Store"
+
+static void fillData(RsTlvBinaryData& data, uint32_t len, uint8_t seed)
+{
+	std::vector<uint8_t> buf(len);
+	for(uint32_t i=0;i<len;++i)
+		buf[i] = uint8_t(seed + i * 7);
+
+	data.setBinData(buf.data(), len);
+}
+
+static bool sameData(const RsTlvBinaryData& a, const RsTlvBinaryData& b)
+{
+	return a.tlvtype == b.tlvtype && a.bin_len == b.bin_len
+	        && (a.bin_len == 0 || !memcmp(a.bin_data, b.bin_data, a.bin_len));
+}
+
+static RsNxsMsg *createMsg(const RsGxsGroupId& grpId, uint32_t len, uint8_t seed)
+{
+	RsNxsMsg *msg = new RsNxsMsg(RS_SERVICE_GXS_TYPE_CHANNELS);
+	RsGxsMsgMetaData *meta = new RsGxsMsgMetaData();
+
+	meta->mGroupId = grpId;
+	meta->mMsgId = RsGxsMessageId::random();
+	meta->mPublishTs = 1000;
+
+	msg->grpId = grpId;
+	msg->msgId = meta->mMsgId;
+	fillData(msg->msg, len, seed);
+	msg->metaData = meta;
+
+	return msg;
+}
+
+static RsNxsGrp *createGrp(const RsGxsGroupId& grpId, uint32_t len, uint8_t seed)
+{
+	RsNxsGrp *grp = new RsNxsGrp(RS_SERVICE_GXS_TYPE_CHANNELS);
+	RsGxsGrpMetaData *meta = new RsGxsGrpMetaData();
+
+	meta->mGroupId = grpId;
+	meta->mGroupName = "blob";
+
+	grp->grpId = grpId;
+	fillData(grp->grp, len, seed);
+	grp->metaData = meta;
+
+	return grp;
+}
+
+static void removeStore(const std::string& dir)
+{
+	std::string path = dir + "/" + BLOB_DATA_BASE_NAME;
+
+	remove(path.c_str());
+	remove((path + "-wal").c_str());
+	remove((path + "-shm").c_str());
+}
+
+static void checkMessages(RsDataService& ds, const RsGxsGroupId& grpId, const std::map<RsGxsMessageId, RsNxsMsg*>& ref, bool withMeta)
+{
+	GxsMsgReq req;
+	GxsMsgResult result;
+	req[grpId];
+	ds.retrieveNxsMsgs(req, result, withMeta);
+
+	ASSERT_EQ(ref.size(), result[grpId].size());
+
+	for(RsNxsMsg *msg:result[grpId])
+	{
+		auto it = ref.find(msg->msgId);
+		ASSERT_TRUE(it != ref.end());
+		EXPECT_TRUE(sameData(it->second->msg, msg->msg));
+		EXPECT_EQ(withMeta, msg->metaData != NULL);
+
+		if(withMeta)
+			EXPECT_EQ(it->second->msg.TlvSize(), msg->metaData->mMsgSize);
+
+		delete msg;
+	}
+}
+
+TEST(libretroshare_gxs, RsDataServiceBlobData)
+{
+	std::string dir = "./blob_test_dir";
+	RsDirUtil::checkCreateDirectory(dir);
+
+	const uint32_t sizes[] = { 0, 1, 1000, 100000, 1024 * 1024 };
+
+	for(int concurrent=0;concurrent<2;++concurrent)
+	{
+		removeStore(dir);
+
+		RsDataService ds(dir, BLOB_DATA_BASE_NAME, RS_SERVICE_GXS_TYPE_CHANNELS, NULL, "",
+		                 concurrent ? RsDataServiceStorageOptions::concurrent() : RsDataServiceStorageOptions());
+
+		RsGxsGroupId grpId = RsGxsGroupId::random();
+		std::map<RsGxsMessageId, RsNxsMsg*> ref;
+		std::list<RsNxsMsg*> msgs;
+
+		// the store takes ownership of the messages, keep copies to compare with
+
+		for(uint32_t i=0;i<sizeof(sizes)/sizeof(sizes[0]);++i)
+		{
+			RsNxsMsg *msg = createMsg(grpId, sizes[i], i);
+			RsNxsMsg *copy = new RsNxsMsg(RS_SERVICE_GXS_TYPE_CHANNELS);
+
+			copy->msgId = msg->msgId;
+			copy->msg = msg->msg;
+			ref[msg->msgId] = copy;
+			msgs.push_back(msg);
+		}
+
+		ds.storeMessage(msgs);
+
+		checkMessages(ds, grpId, ref, false);
+		checkMessages(ds, grpId, ref, true);
+
+		// groups are updated in place with data of another size
+
+		RsGxsGroupId grpId2 = RsGxsGroupId::random();
+		ds.storeGroup(std::list<RsNxsGrp*>(1, createGrp(grpId2, 200000, 3)));
+
+		RsNxsGrp *updated = createGrp(grpId2, 300, 5);
+		RsTlvBinaryData updatedData(updated->grp);
+		ds.updateGroup(std::list<RsNxsGrp*>(1, updated));
+
+		std::map<RsGxsGroupId, RsNxsGrp*> grps;
+		grps[grpId2] = NULL;
+		ds.retrieveNxsGrps(grps, true);
+
+		ASSERT_TRUE(grps[grpId2] != NULL);
+		EXPECT_TRUE(sameData(updatedData, grps[grpId2]->grp));
+		ASSERT_TRUE(grps[grpId2]->metaData != NULL);
+		EXPECT_EQ(updatedData.TlvSize(), grps[grpId2]->metaData->mGrpSize);
+		delete grps[grpId2];
+
+		for(auto& it:ref)
+			delete it.second;
+	}
+
+	removeStore(dir);
+	rmdir(dir.c_str());
+}
+
+// Creates the tables as they were in release 2, where the data of the items sits in the middle of the rows
+
+static void createRelease2Store(const std::string& path, const RsNxsMsg& msg, const RsNxsGrp& grp)
+{
+	sqlite3 *db = NULL;
+	ASSERT_EQ(SQLITE_OK, sqlite3_open(path.c_str(), &db));
+
+	const char *schema =
+	        "CREATE TABLE DATABASE_RELEASE(id INT PRIMARY KEY,release INT);"
+	        "INSERT INTO DATABASE_RELEASE VALUES(1,2);"
+	        "CREATE TABLE MESSAGES(msgId TEXT PRIMARY KEY,grpId TEXT,flags INT,origMsgId TEXT,timeStamp INT,"
+	        "identity TEXT,signSet BLOB,nxsData BLOB,nxsDataLen INT,msgStatus INT,childTs INT,meta BLOB,"
+	        "threadId TEXT,parentId TEXT,msgName TEXT,serv_str TEXT,hash TEXT,recv_time_stamp INT);"
+	        "CREATE TABLE GROUPS(grpId TEXT PRIMARY KEY,timeStamp INT,nxsData BLOB,nxsDataLen INT,keySet BLOB,"
+	        "meta BLOB,grpName TEXT,lastPost INT,popularity INT,msgCount INT,subscribeFlag INT,grpStatus INT,"
+	        "identity TEXT,origGrpId TEXT,serv_str TEXT,flags INT,authenFlags INT,signFlags INT,circleId TEXT,"
+	        "circleType INT,internalCircle TEXT,originator TEXT,hash TEXT,recv_time_stamp INT,parentGrpId TEXT,"
+	        "rep_cutoff INT,signSet BLOB);"
+	        "CREATE TRIGGER LAST_POST_UPDATE INSERT ON MESSAGES BEGIN UPDATE GROUPS SET lastPost=new.recv_time_stamp"
+	        " WHERE grpId=new.grpId;END;"
+	        "CREATE INDEX INDEX_MESSAGES_GRPID_TS ON MESSAGES(grpId,timeStamp);"
+	        "CREATE INDEX INDEX_MESSAGES_PARENTID ON MESSAGES(parentId);";
+	ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, schema, NULL, NULL, NULL));
+
+	std::vector<char> data;
+	uint32_t offset = 0;
+	sqlite3_stmt *stmt = NULL;
+
+	data.resize(msg.msg.TlvSize());
+	msg.msg.SetTlv(data.data(), data.size(), &offset);
+	sqlite3_prepare_v2(db, "INSERT INTO MESSAGES(msgId,grpId,nxsData,nxsDataLen,msgStatus) VALUES(?,?,?,?,0);", -1, &stmt, NULL);
+	sqlite3_bind_text(stmt, 1, msg.msgId.toStdString().c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(stmt, 2, msg.grpId.toStdString().c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_blob(stmt, 3, data.data(), data.size(), SQLITE_TRANSIENT);
+	sqlite3_bind_int(stmt, 4, data.size());
+	EXPECT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+	sqlite3_finalize(stmt);
+
+	offset = 0;
+	data.resize(grp.grp.TlvSize());
+	grp.grp.SetTlv(data.data(), data.size(), &offset);
+	sqlite3_prepare_v2(db, "INSERT INTO GROUPS(grpId,nxsData,nxsDataLen,grpName) VALUES(?,?,?,'old');", -1, &stmt, NULL);
+	sqlite3_bind_text(stmt, 1, grp.grpId.toStdString().c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_blob(stmt, 2, data.data(), data.size(), SQLITE_TRANSIENT);
+	sqlite3_bind_int(stmt, 3, data.size());
+	EXPECT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+	sqlite3_finalize(stmt);
+
+	sqlite3_close(db);
+}
+
+static std::string lastColumn(const std::string& path, const std::string& table)
+{
+	sqlite3 *db = NULL;
+	sqlite3_stmt *stmt = NULL;
+	std::string name;
+
+	sqlite3_open(path.c_str(), &db);
+	sqlite3_prepare_v2(db, ("PRAGMA table_info(" + table + ");").c_str(), -1, &stmt, NULL);
+
+	while(sqlite3_step(stmt) == SQLITE_ROW)
+		name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+
+	return name;
+}
+
+TEST(libretroshare_gxs, RsDataServiceBlobUpgrade)
+{
+	std::string dir = "./blob_test_dir";
+	std::string path = dir + "/" + BLOB_DATA_BASE_NAME;
+	RsDirUtil::checkCreateDirectory(dir);
+	removeStore(dir);
+
+	RsGxsGroupId grpId = RsGxsGroupId::random();
+	RsNxsMsg *msg = createMsg(grpId, 50000, 1);
+	RsNxsGrp *grp = createGrp(grpId, 3000, 2);
+
+	createRelease2Store(path, *msg, *grp);
+	EXPECT_EQ("recv_time_stamp", lastColumn(path, "MESSAGES"));
+
+	{
+		RsDataService ds(dir, BLOB_DATA_BASE_NAME, RS_SERVICE_GXS_TYPE_CHANNELS);
+
+		std::map<RsGxsMessageId, RsNxsMsg*> ref;
+		ref[msg->msgId] = msg;
+		checkMessages(ds, grpId, ref, true);
+
+		std::map<RsGxsGroupId, RsNxsGrp*> grps;
+		ds.retrieveNxsGrps(grps, true);
+
+		ASSERT_EQ(1u, grps.size());
+		ASSERT_TRUE(grps[grpId] != NULL);
+		EXPECT_TRUE(sameData(grp->grp, grps[grpId]->grp));
+		EXPECT_EQ("old", grps[grpId]->metaData->mGroupName);
+		delete grps[grpId];
+
+		// the trigger is still there
+
+		RsNxsMsg *msg2 = createMsg(grpId, 10, 3);
+		msg2->metaData->recvTS = 1234;
+		ds.storeMessage(std::list<RsNxsMsg*>(1, msg2));
+
+		std::map<RsGxsGroupId, std::shared_ptr<RsGxsGrpMetaData> > metas;
+		metas[grpId];
+		ds.retrieveGxsGrpMetaData(metas);
+		ASSERT_TRUE(metas[grpId] != NULL);
+		EXPECT_EQ(1234, metas[grpId]->mLastPost);
+	}
+
+	EXPECT_EQ("nxsData", lastColumn(path, "MESSAGES"));
+	EXPECT_EQ("nxsData", lastColumn(path, "GROUPS"));
+
+	delete msg;
+	delete grp;
+
+	removeStore(dir);
+	rmdir(dir.c_str());
+}
@@ -0,0 +1,187 @@
+/*******************************************************************************
+ * unittests/libretroshare/gxs/data_service/rsdataservice_expiry_test.cc       *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "gxs/rsdataservice.h"
+#include "retroshare/rsgxsflags.h"
+#include "rsitems/rsserviceids.h"
+#include "util/rsdir.h"
+
+#define EXPIRY_DATA_BASE_NAME "msg_expiry_Store"
+
+static RsNxsMsg *createMsg(const RsGxsGroupId& grpId, const RsGxsMessageId& msgId, rstime_t publish_ts,
+                           const RsGxsMessageId& parentId = RsGxsMessageId(), const RsGxsMessageId& origMsgId = RsGxsMessageId(), uint32_t status = 0)
+{
+	RsNxsMsg *msg = new RsNxsMsg(RS_SERVICE_GXS_TYPE_FORUMS);
+	RsGxsMsgMetaData *meta = new RsGxsMsgMetaData();
+
+	meta->mGroupId = grpId;
+	meta->mMsgId = msgId;
+	meta->mPublishTs = publish_ts;
+	meta->mParentId = parentId;
+	meta->mOrigMsgId = origMsgId;
+	meta->mMsgStatus = status;
+
+	msg->grpId = grpId;
+	msg->msgId = msgId;
+	msg->msg.setBinData("data", 4);
+	msg->metaData = meta;
+
+	return msg;
+}
+
+static std::vector<RsGxsMessageId> expiredIds(RsGeneralDataService& ds, const RsGxsGroupId& grpId, rstime_t newer_than, rstime_t older_than, bool include_kept, uint32_t max_count)
+{
+	std::vector<std::pair<RsGxsMessageId,rstime_t> > msgs;
+	ds.retrieveExpiredMsgIds(grpId, newer_than, older_than, include_kept, max_count, msgs);
+
+	std::vector<RsGxsMessageId> ids;
+	for(auto& m:msgs)
+		ids.push_back(m.first);
+
+	return ids;
+}
+
+TEST(libretroshare_gxs, RsDataServiceExpiry)
+{
+	std::string dir = "./expiry_test_dir";
+	RsDirUtil::checkCreateDirectory(dir);
+	remove((dir + "/" + EXPIRY_DATA_BASE_NAME).c_str());
+
+	{
+		RsDataService ds(dir, EXPIRY_DATA_BASE_NAME, RS_SERVICE_GXS_TYPE_FORUMS);
+
+		RsGxsGroupId grp1 = RsGxsGroupId::random();
+		RsGxsGroupId grp2 = RsGxsGroupId::random();
+
+		// grp1: m[i] is published at time 1000+i. m[1] has a reply (m[5]), m[2] is kept forever,
+		// m[3] was edited into m[7].
+
+		std::vector<RsGxsMessageId> m;
+		for(int i=0;i<10;++i)
+			m.push_back(RsGxsMessageId::random());
+
+		std::list<RsNxsMsg*> msgs;
+		for(int i=0;i<10;++i)
+		{
+			RsGxsMessageId parent = (i == 5)?m[1]:RsGxsMessageId();
+			RsGxsMessageId orig = (i == 7)?m[3]:((i == 8)?m[8]:RsGxsMessageId());
+			uint32_t status = (i == 2)?GXS_SERV::GXS_MSG_STATUS_KEEP_FOREVER:0;
+
+			msgs.push_back(createMsg(grp1, m[i], 1000+i, parent, orig, status));
+		}
+		msgs.push_back(createMsg(grp2, RsGxsMessageId::random(), 500));
+
+		ds.storeMessage(msgs);
+
+		// oldest first, kept messages and messages with replies are skipped, only the group asked is looked at
+
+		std::vector<RsGxsMessageId> expected = { m[0], m[3], m[4], m[5] };
+		EXPECT_EQ(expected, expiredIds(ds, grp1, 0, 1006, false, 100));
+
+		expected = { m[0], m[3] };
+		EXPECT_EQ(expected, expiredIds(ds, grp1, 0, 1006, false, 2));
+
+		expected = { m[3], m[4], m[5] };
+		EXPECT_EQ(expected, expiredIds(ds, grp1, 1003, 1006, false, 100));
+
+		expected = { m[0], m[1], m[2], m[3] };
+		EXPECT_EQ(expected, expiredIds(ds, grp1, 0, 1004, true, 100));
+
+		EXPECT_TRUE(expiredIds(ds, grp1, 0, 1000, true, 100).empty());
+
+		std::vector<std::pair<RsGxsMessageId,rstime_t> > oldest;
+		ds.retrieveExpiredMsgIds(grp1, 0, 2000, false, 1, oldest);
+		ASSERT_EQ(1u, oldest.size());
+		EXPECT_EQ(1000, oldest[0].second);
+
+		// Only m[3] was replaced by a newer version. m[8] points to itself.
+
+		std::vector<RsGxsMessageId> old_versions;
+		ds.retrieveOldMsgVersionIds(grp1, 100, old_versions);
+		expected = { m[3] };
+		EXPECT_EQ(expected, old_versions);
+
+		// Removing the reply makes its parent expirable. Removing the old version removes it from the
+		// old versions, even if the new version still references it.
+
+		GxsMsgReq to_delete;
+		to_delete[grp1].insert(m[5]);
+		to_delete[grp1].insert(m[3]);
+		ds.removeMsgs(to_delete);
+
+		expected = { m[0], m[1], m[4] };
+		EXPECT_EQ(expected, expiredIds(ds, grp1, 0, 1006, false, 100));
+
+		old_versions.clear();
+		ds.retrieveOldMsgVersionIds(grp1, 100, old_versions);
+		EXPECT_TRUE(old_versions.empty());
+
+		// removed messages are also gone from the meta cache
+
+		GxsMsgReq req;
+		GxsMsgMetaResult result;
+		req[grp1];
+		ds.retrieveGxsMsgMetaData(req, result);
+		EXPECT_EQ(8u, result[grp1].size());
+	}
+
+	remove((dir + "/" + EXPIRY_DATA_BASE_NAME).c_str());
+	rmdir(dir.c_str());
+}
+
+TEST(libretroshare_gxs, RsDataServiceBatchedRemoval)
+{
+	std::string dir = "./expiry_test_dir";
+	RsDirUtil::checkCreateDirectory(dir);
+	remove((dir + "/" + EXPIRY_DATA_BASE_NAME).c_str());
+
+	{
+		RsDataService ds(dir, EXPIRY_DATA_BASE_NAME, RS_SERVICE_GXS_TYPE_FORUMS);
+
+		RsGxsGroupId grpId = RsGxsGroupId::random();
+		std::list<RsNxsMsg*> msgs;
+		GxsMsgReq to_delete;
+
+		// more than one removal batch, and a few messages left
+
+		for(int i=0;i<1000;++i)
+		{
+			RsGxsMessageId msgId = RsGxsMessageId::random();
+			msgs.push_back(createMsg(grpId, msgId, 1000+i));
+
+			if(i < 990)
+				to_delete[grpId].insert(msgId);
+		}
+		ds.storeMessage(msgs);
+		ds.removeMsgs(to_delete);
+
+		RsGxsMessageId::std_set left;
+		ds.retrieveMsgIds(grpId, left);
+		EXPECT_EQ(10u, left.size());
+
+		for(auto& msgId:left)
+			EXPECT_TRUE(to_delete[grpId].find(msgId) == to_delete[grpId].end());
+	}
+
+	remove((dir + "/" + EXPIRY_DATA_BASE_NAME).c_str());
+	rmdir(dir.c_str());
+}
@@ -0,0 +1,192 @@
+/*******************************************************************************
+ * unittests/libretroshare/gxs/data_service/rsdataservice_wal_test.cc          *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include "gxs/rsdataservice.h"
+#include "rsitems/rsserviceids.h"
+#include "util/rsdir.h"
+
+#define WAL_DATA_BASE_NAME "wal_Store"
+
+static RsNxsMsg *createMsg(const RsGxsGroupId& grpId, uint32_t status = 0)
+{
+	RsNxsMsg *msg = new RsNxsMsg(RS_SERVICE_GXS_TYPE_FORUMS);
+	RsGxsMsgMetaData *meta = new RsGxsMsgMetaData();
+
+	meta->mGroupId = grpId;
+	meta->mMsgId = RsGxsMessageId::random();
+	meta->mPublishTs = 1000;
+	meta->mMsgStatus = status;
+
+	msg->grpId = grpId;
+	msg->msgId = meta->mMsgId;
+	msg->msg.setBinData("data", 4);
+	msg->metaData = meta;
+
+	return msg;
+}
+
+static void removeStore(const std::string& dir)
+{
+	std::string path = dir + "/" + WAL_DATA_BASE_NAME;
+
+	remove(path.c_str());
+	remove((path + "-wal").c_str());
+	remove((path + "-shm").c_str());
+}
+
+TEST(libretroshare_gxs, RsDataServiceWal)
+{
+	std::string dir = "./wal_test_dir";
+	RsDirUtil::checkCreateDirectory(dir);
+	removeStore(dir);
+
+	RsGxsGroupId grpId = RsGxsGroupId::random();
+	RsGxsMessageId msgId;
+
+	{
+		RsDataService ds(dir, WAL_DATA_BASE_NAME, RS_SERVICE_GXS_TYPE_FORUMS, NULL, "", RsDataServiceStorageOptions::concurrent());
+		EXPECT_TRUE(ds.hasConcurrentReaders());
+
+		std::list<RsNxsMsg*> msgs;
+		for(int i=0;i<10;++i)
+			msgs.push_back(createMsg(grpId));
+		msgId = msgs.front()->msgId;
+		ds.storeMessage(msgs);
+
+		EXPECT_TRUE(RsDirUtil::fileExists(dir + "/" + WAL_DATA_BASE_NAME + "-wal"));
+
+		// the readers see what was just written
+
+		RsGxsMessageId::std_set ids;
+		ds.retrieveMsgIds(grpId, ids);
+		EXPECT_EQ(10u, ids.size());
+
+		GxsMsgReq req;
+		GxsMsgResult result;
+		req[grpId].insert(msgId);
+		ds.retrieveNxsMsgs(req, result, true);
+		ASSERT_EQ(1u, result[grpId].size());
+		EXPECT_EQ(msgId, result[grpId][0]->msgId);
+		ASSERT_TRUE(result[grpId][0]->metaData != NULL);
+		EXPECT_EQ(msgId, result[grpId][0]->metaData->mMsgId);
+		delete result[grpId][0];
+
+		// a meta changed on the main connection is seen through the cache and the readers
+
+		MsgLocMetaData meta;
+		meta.msgId = std::make_pair(grpId, msgId);
+		meta.val.put(RsGeneralDataService::MSG_META_STATUS, (int32_t) 42);
+		ds.updateMessageMetaData(meta);
+
+		GxsMsgReq metaReq;
+		GxsMsgMetaResult metaResult;
+		metaReq[grpId];
+		ds.retrieveGxsMsgMetaData(metaReq, metaResult);
+		ASSERT_EQ(10u, metaResult[grpId].size());
+
+		for(auto& m:metaResult[grpId])
+			EXPECT_EQ(m->mMsgId == msgId ? 42u : 0u, m->mMsgStatus);
+	}
+
+	// the log is checkpointed and removed when the store is closed, and the store opens as usual
+
+	EXPECT_FALSE(RsDirUtil::fileExists(dir + "/" + WAL_DATA_BASE_NAME + "-wal"));
+
+	{
+		RsDataService ds(dir, WAL_DATA_BASE_NAME, RS_SERVICE_GXS_TYPE_FORUMS);
+		EXPECT_FALSE(ds.hasConcurrentReaders());
+
+		RsGxsMessageId::std_set ids;
+		ds.retrieveMsgIds(grpId, ids);
+		EXPECT_EQ(10u, ids.size());
+	}
+
+	removeStore(dir);
+	rmdir(dir.c_str());
+}
+
+TEST(libretroshare_gxs, RsDataServiceConcurrentReads)
+{
+	std::string dir = "./wal_test_dir";
+	RsDirUtil::checkCreateDirectory(dir);
+	removeStore(dir);
+
+	{
+		RsDataServiceStorageOptions storage = RsDataServiceStorageOptions::concurrent();
+		storage.mCheckpointInterval = 10;
+
+		RsDataService ds(dir, WAL_DATA_BASE_NAME, RS_SERVICE_GXS_TYPE_FORUMS, NULL, "", storage);
+		RsGxsGroupId grpId = RsGxsGroupId::random();
+
+		// Readers only ever see whole batches, and never less than the previous time.
+
+		std::atomic<bool> stop(false);
+		std::atomic<int> errors(0);
+		std::vector<std::thread> readers;
+
+		for(int r=0;r<3;++r)
+			readers.push_back(std::thread([&]()
+			{
+				size_t last = 0;
+
+				while(!stop)
+				{
+					GxsMsgReq req;
+					GxsMsgMetaResult result;
+					req[grpId];
+					ds.retrieveGxsMsgMetaData(req, result);
+
+					size_t n = result[grpId].size();
+
+					if(n % 50 != 0 || n < last)
+						++errors;
+					last = n;
+				}
+			}));
+
+		for(int b=0;b<20;++b)
+		{
+			std::list<RsNxsMsg*> msgs;
+			for(int i=0;i<50;++i)
+				msgs.push_back(createMsg(grpId));
+			ds.storeMessage(msgs);
+		}
+
+		stop = true;
+		for(auto& t:readers)
+			t.join();
+
+		EXPECT_EQ(0, errors);
+
+		GxsMsgReq req;
+		GxsMsgMetaResult result;
+		req[grpId];
+		ds.retrieveGxsMsgMetaData(req, result);
+		EXPECT_EQ(1000u, result[grpId].size());
+	}
+
+	removeStore(dir);
+	rmdir(dir.c_str());
+}
@@ -57,7 +57,7 @@ namespace rs_nxs_test
 		virtual bool recipients(const RsGxsCircleId &circleId, std::list<RsPgpId> &friendlist);
 		virtual bool recipients(const RsGxsCircleId &circleId, const RsGxsGroupId& destination_group, std::list<RsGxsId>& idlist) ;
 		virtual bool isRecipient(const RsGxsCircleId &circleId, const RsGxsGroupId& destination_group, const RsGxsId& id) ;
-		virtual bool getLocalCircleServerUpdateTS(const RsGxsCircleId& /*gid*/,time_t& /*grp_server_update_TS*/,time_t& /*msg_server_update_TS*/) { return true ; }
+		virtual bool getLocalCircleServerUpdateTS(const RsGxsCircleId& /*gid*/,rstime_t& /*grp_server_update_TS*/,rstime_t& /*msg_server_update_TS*/) { return true ; }
 	};
 
 	/*!
@@ -86,7 +86,7 @@ namespace rs_nxs_test
 		virtual bool recipients(const RsGxsCircleId &circleId, std::list<RsPgpId> &friendlist);
 		virtual bool recipients(const RsGxsCircleId &/*circleId*/, const RsGxsGroupId& /*destination_group*/, std::list<RsGxsId>& /*idlist*/) { return true ;}
 		virtual bool isRecipient(const RsGxsCircleId &circleId, const RsGxsGroupId& /*destination_group*/, const RsGxsId& /*id*/) { return allowed(circleId) ; }
-		virtual bool getLocalCircleServerUpdateTS(const RsGxsCircleId& /*gid*/,time_t& /*grp_server_update_TS*/,time_t& /*msg_server_update_TS*/) { return true ; }
+		virtual bool getLocalCircleServerUpdateTS(const RsGxsCircleId& /*gid*/,rstime_t& /*grp_server_update_TS*/,rstime_t& /*msg_server_update_TS*/) { return true ; }
 	private:
 
 		bool allowed(const RsGxsCircleId& circleId);
@@ -123,7 +123,7 @@ namespace rs_nxs_test
 		bool loadReputation(const RsGxsId &id, const std::list<RsPeerId>& peers);
 		bool getReputation(const RsGxsId &id, GixsReputation &rep);
 
-		virtual RsReputations::ReputationLevel overallReputationLevel(const RsGxsId&,uint32_t */*identity_flags*/=NULL) { return RsReputations::REPUTATION_NEUTRAL ; }
+		virtual RsReputationLevel overallReputationLevel(const RsGxsId&,uint32_t */*identity_flags*/=NULL) { return RsReputationLevel::NEUTRAL ; }
 
 	private:
 
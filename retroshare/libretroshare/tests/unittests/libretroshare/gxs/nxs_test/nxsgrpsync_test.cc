@@ -95,7 +95,7 @@ NxsGrpSync::NxsGrpSync(RsGcxs* circle, RsGixsReputation* reputation):
 
 		RsGxsGroupId grpId = grp->grpId;
 
-		RsNxsGrpDataTemporaryList gsp;
+		std::list<RsNxsGrp*> gsp;
 		gsp.push_back(grp);
 		mit->second->storeGroup(gsp);
 
@@ -0,0 +1,178 @@
+/*******************************************************************************
+ * unittests/libretroshare/gxs/nxs_test/nxsmsgchain_test.cc                    *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include "nxsmsgchain_test.h"
+#include "retroshare/rstypes.h"
+#include "gxs/rsdataservice.h"
+#include "nxsdummyservices.h"
+#include "../common/data_support.h"
+
+using namespace rs_nxs_test;
+
+rs_nxs_test::NxsMsgChain::~NxsMsgChain()
+{
+	for(std::map<RsPeerId,RsNxsNetMgr*>::const_iterator it(mNxsNetMgrs.begin());it!=mNxsNetMgrs.end();++it)
+		delete it->second ;
+
+	for(DataMap::const_iterator it(mDataServices.begin());it!=mDataServices.end();++it)
+		delete it->second ;
+
+	delete mRep ;
+	delete mCircles;
+	delete mPgpUtils;
+}
+
+rs_nxs_test::NxsMsgChain::NxsMsgChain(int numPeers)
+ : mPgpUtils(NULL), mServType(0)
+{
+	for(int i =0; i < numPeers; i++)
+		mPeerIds.push_back(RsPeerId::random());
+
+	// each peer only knows its neighbours in the chain
+
+	std::list<RsPeerId>::iterator it = mPeerIds.begin();
+	for(; it != mPeerIds.end(); it++)
+	{
+		RsGeneralDataService* ds = createDataStore(*it, mServType);
+		mDataServices.insert(std::make_pair(*it, ds));
+
+		std::list<RsPeerId> neighbours;
+
+		if(it != mPeerIds.begin())
+			neighbours.push_back(*std::prev(it));
+
+		if(std::next(it) != mPeerIds.end())
+			neighbours.push_back(*std::next(it));
+
+		RsNxsNetMgr* mgr = new rs_nxs_test::RsNxsNetDummyMgr(*it, neighbours);
+		mNxsNetMgrs.insert(std::make_pair(*it, mgr));
+	}
+
+	RsNxsSimpleDummyReputation::RepMap reMap;
+	mRep = new RsNxsSimpleDummyReputation(reMap, true);
+	mCircles = new RsNxsSimpleDummyCircles();
+	mPgpUtils = new RsDummyPgpUtils();
+
+	// one public group, that all peers are subscribed to
+
+	RsNxsGrp grp(mServType);
+	init_item(grp);
+
+	RsGxsGrpMetaData* meta = new RsGxsGrpMetaData();
+	init_item(meta);
+	meta->mGroupId = grp.grpId;
+	meta->mPublishTs = time(NULL);
+	meta->mGroupFlags = 0;
+	meta->mSignFlags = 0;
+	meta->mAuthenFlags = 0;
+	meta->mReputationCutOff = 0;
+	meta->mSubscribeFlags = GXS_SERV::GROUP_SUBSCRIBE_SUBSCRIBED;
+	meta->mCircleType = GXS_CIRCLE_TYPE_PUBLIC;
+	meta->mCircleId.clear();
+	grp.metaData = meta;
+
+	mGrpId = grp.grpId;
+
+	for(DataMap::iterator mit = mDataServices.begin(); mit != mDataServices.end(); mit++)
+	{
+		std::list<RsNxsGrp*> gsp;
+		gsp.push_back(grp.clone());
+		mit->second->storeGroup(gsp);
+	}
+}
+
+RsNxsMsg* rs_nxs_test::NxsMsgChain::createMessage()
+{
+	RsNxsMsg* msg = new RsNxsMsg(mServType);
+	init_item(*msg);
+	msg->grpId = mGrpId;
+
+	RsGxsMsgMetaData* msgMeta = new RsGxsMsgMetaData();
+	init_item(msgMeta);
+	msgMeta->mGroupId = mGrpId;
+	msgMeta->mMsgId = msg->msgId;
+	msgMeta->mThreadId.clear();
+	msgMeta->mParentId.clear();
+	msgMeta->mOrigMsgId = msg->msgId;
+	msgMeta->mAuthorId.clear();
+	msgMeta->mPublishTs = time(NULL);
+	msgMeta->recvTS = time(NULL);
+	msg->metaData = msgMeta;
+
+	// the meta data also travels serialised, as RsGenExchange does it
+
+	uint32_t size = msgMeta->serial_size();
+	std::vector<char> metaData(size);
+	msgMeta->serialise(metaData.data(), &size);
+	msg->meta.setBinData(metaData.data(), size);
+
+	for(std::list<RsPeerId>::const_iterator it = mPeerIds.begin(); it != mPeerIds.end(); it++)
+		mExpectedResult[*it][mGrpId].push_back(msg->msgId);
+
+	return msg;
+}
+
+bool rs_nxs_test::NxsMsgChain::hasMessage(const RsPeerId& peerId, const RsGxsMessageId& msgId)
+{
+	RsGxsMessageId::std_set msgIds;
+	getDataService(peerId)->retrieveMsgIds(mGrpId, msgIds);
+
+	return msgIds.find(msgId) != msgIds.end();
+}
+
+void rs_nxs_test::NxsMsgChain::getPeers(std::list<RsPeerId>& peerIds) {
+	peerIds = mPeerIds;
+}
+
+RsGeneralDataService* rs_nxs_test::NxsMsgChain::getDataService(
+		const RsPeerId& peerId) {
+	return mDataServices[peerId];
+}
+
+RsNxsNetMgr* rs_nxs_test::NxsMsgChain::getDummyNetManager(
+		const RsPeerId& peerId) {
+	return mNxsNetMgrs[peerId];
+}
+
+RsGcxs* rs_nxs_test::NxsMsgChain::getDummyCircles(const RsPeerId& /*peerId*/) {
+	return mCircles;
+}
+
+RsGixsReputation* rs_nxs_test::NxsMsgChain::getDummyReputations(
+		const RsPeerId& /*peerId*/) {
+	return mRep;
+}
+
+uint16_t rs_nxs_test::NxsMsgChain::getServiceType() {
+	return mServType;
+}
+
+RsServiceInfo rs_nxs_test::NxsMsgChain::getServiceInfo() {
+	return mServInfo;
+}
+
+PgpAuxUtils* rs_nxs_test::NxsMsgChain::getDummyPgpUtils()
+{
+	return mPgpUtils;
+}
+
+const NxsMsgTestScenario::ExpectedMap& rs_nxs_test::NxsMsgChain::getExpectedMap() {
+	return mExpectedResult;
+}
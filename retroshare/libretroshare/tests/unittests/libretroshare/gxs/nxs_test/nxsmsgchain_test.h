@@ -0,0 +1,87 @@
+/*******************************************************************************
+ * unittests/libretroshare/gxs/nxs_test/nxsmsgchain_test.h                     *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#ifndef NXSMSGCHAIN_TEST_H_
+#define NXSMSGCHAIN_TEST_H_
+
+#include "nxsmsgtestscenario.h"
+
+namespace rs_nxs_test {
+
+	/*!
+	 * Peers are connected in a line, each peer only being friend
+	 * with the previous and the next one. All peers are subscribed to
+	 * the same group, so that a message posted at one end has to be
+	 * relayed by every peer in between to reach the other end.
+	 */
+	class NxsMsgChain : public NxsMsgTestScenario
+	{
+	public:
+
+		NxsMsgChain(int numPeers);
+		virtual ~NxsMsgChain();
+		void getPeers(std::list<RsPeerId>& peerIds);
+		RsGeneralDataService* getDataService(const RsPeerId& peerId);
+		RsNxsNetMgr* getDummyNetManager(const RsPeerId& peerId);
+		RsGcxs* getDummyCircles(const RsPeerId& peerId);
+		RsGixsReputation* getDummyReputations(const RsPeerId& peerId);
+		uint16_t getServiceType();
+		RsServiceInfo getServiceInfo();
+		PgpAuxUtils* getDummyPgpUtils();
+
+		const RsPeerId& firstPeer() const { return mPeerIds.front(); }
+		const RsPeerId& lastPeer() const { return mPeerIds.back(); }
+
+		/*!
+		 * Creates a new message in the group, that all peers are
+		 * then expected to have.
+		 */
+		RsNxsMsg* createMessage();
+
+		/*!
+		 * @return true if the message has reached the peer's data store
+		 */
+		bool hasMessage(const RsPeerId& peerId, const RsGxsMessageId& msgId);
+
+	protected:
+
+		const ExpectedMap& getExpectedMap();
+
+	private:
+
+		std::list<RsPeerId> mPeerIds;
+		typedef std::map<RsPeerId, RsGeneralDataService*> DataMap;
+
+		DataMap mDataServices;
+		std::map<RsPeerId, RsNxsNetMgr*> mNxsNetMgrs;
+		RsGixsReputation* mRep;
+		RsGcxs* mCircles;
+		RsServiceInfo mServInfo;
+		PgpAuxUtils* mPgpUtils;
+
+		RsGxsGroupId mGrpId;
+		NxsMsgTestScenario::ExpectedMap mExpectedResult;
+
+		uint16_t mServType;
+	};
+
+}
+
+#endif /* NXSMSGCHAIN_TEST_H_ */
@@ -104,7 +104,7 @@ rs_nxs_test::NxsMsgSync::NxsMsgSync()
 			// first store grp
 			RsGeneralDataService* ds = mit->second;
 			RsNxsGrp* grp_clone = grp->clone();
-			RsNxsGrpDataTemporaryList gsp;
+			std::list<RsNxsGrp*> gsp;
 			gsp.push_back(grp_clone);
 			ds->storeGroup(gsp);
 
@@ -124,7 +124,7 @@ rs_nxs_test::NxsMsgSync::NxsMsgSync()
 				msgMeta->mGroupId = grp->grpId;
 				msgMeta->mMsgId = msg->msgId;
 
-				RsNxsMsgDataTemporaryList msm;
+				std::list<RsNxsMsg*> msm;
 				msm.push_back(msg);
 				RsGxsMessageId msgId = msg->msgId;
 				ds->storeMessage(msm);
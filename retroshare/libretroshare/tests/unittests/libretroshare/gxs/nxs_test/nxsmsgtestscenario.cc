@@ -53,9 +53,11 @@ bool NxsMsgTestScenario::checkTestPassed() {
 		{
 			const RsGxsGroupId& grpId = cit->first;
 			RsGxsMessageId::std_vector expMsgIds = cit->second;
-			RsGxsMessageId::std_vector msgIds;
+			RsGxsMessageId::std_set msgIdSet;
 
-			ds->retrieveMsgIds(grpId, msgIds);
+			ds->retrieveMsgIds(grpId, msgIdSet);
+
+			RsGxsMessageId::std_vector msgIds(msgIdSet.begin(), msgIdSet.end());
 
 			RsGxsMessageId::std_vector result(expMsgIds.size()+msgIds.size());
 
@@ -32,12 +32,12 @@ public:
 	}
 	virtual ~NotifyWithPeerId(){}
 
-    void notifyNewMessages(std::vector<RsNxsMsg*>& messages)
+    void receiveNewMessages(const std::vector<RsNxsMsg*>& messages)
     {
     	mTestHub.notifyNewMessages(mPeerId, messages);
     }
 
-    void notifyNewGroups(std::vector<RsNxsGrp*>& groups)
+    void receiveNewGroups(const std::vector<RsNxsGrp*>& groups)
     {
     	mTestHub.notifyNewGroups(mPeerId, groups);
     }
@@ -47,6 +47,11 @@ public:
 
     }
 
+    void notifyChangedGroupSyncParams(const RsGxsGroupId& )
+    {
+
+    }
+
     void notifyChangedGroupStats(const RsGxsGroupId&)
     {
 
@@ -107,8 +112,7 @@ rs_nxs_test::NxsTestHub::NxsTestHub(NxsTestScenario *testScenario)
 									mTestScenario->getDummyReputations(*cit),
 									mTestScenario->getDummyCircles(*cit),
 									NULL,
-									mTestScenario->getDummyPgpUtils(),
-									true
+									mTestScenario->getDummyPgpUtils()
 									);
 
 		NxsTestHubConnection *connection = new NxsTestHubConnection(*cit, this);
@@ -155,53 +159,61 @@ void rs_nxs_test::NxsTestHub::StartTest()
 void rs_nxs_test::NxsTestHub::EndTest()
 {
 	// then stop this thread
-    join();
+    fullstop();
 
 	// stop services
 	PeerNxsMap::iterator mit = mPeerNxsMap.begin();
 	for(; mit != mPeerNxsMap.end(); mit++)
 	{
-		mit->second->join();
+		mit->second->fullstop();
 	}
 }
 
 void rs_nxs_test::NxsTestHub::notifyNewMessages(const RsPeerId& pid,
-		std::vector<RsNxsMsg*>& messages)
+		const std::vector<RsNxsMsg*>& messages)
 {
-    RS_STACK_MUTEX(mMtx); /***** MTX LOCKED *****/
+	std::set<RsGxsGroupId> grpIds;
 
-	RsNxsMsgDataTemporaryList toStore;
-	std::vector<RsNxsMsg*>::iterator it = messages.begin();
-	for(; it != messages.end(); it++)
 	{
-		RsNxsMsg* msg = *it;
-		RsGxsMsgMetaData* meta = new RsGxsMsgMetaData();
-        // local meta is not touched by the deserialisation routine
-        // have to initialise it
-
-		msg->metaData = meta ;
-
-        meta->mMsgStatus = 0;
-        meta->mMsgSize = 0;
-        meta->mChildTs = 0;
-        meta->recvTS = 0;
-        meta->validated = false;
-		meta->deserialise(msg->meta.bin_data, &(msg->meta.bin_len));
-
-		toStore.push_back(msg);
+		RS_STACK_MUTEX(mMtx); /***** MTX LOCKED *****/
+
+		std::list<RsNxsMsg*> toStore;
+		std::vector<RsNxsMsg*>::const_iterator it = messages.begin();
+		for(; it != messages.end(); it++)
+		{
+			RsNxsMsg* msg = *it;
+			RsGxsMsgMetaData* meta = new RsGxsMsgMetaData();
+			// local meta is not touched by the deserialisation routine
+			// have to initialise it
+
+			msg->metaData = meta ;
+
+			meta->mMsgStatus = 0;
+			meta->mMsgSize = 0;
+			meta->mChildTs = 0;
+			meta->recvTS = 0;
+			meta->validated = false;
+			meta->deserialise(msg->meta.bin_data, &(msg->meta.bin_len));
+
+			grpIds.insert(msg->grpId);
+			toStore.push_back(msg);
+		}
+
+		RsGeneralDataService* ds = mTestScenario->getDataService(pid);
+		ds->storeMessage(toStore);
 	}
 
-	RsGeneralDataService* ds = mTestScenario->getDataService(pid);
-	ds->storeMessage(toStore);
+	// same as RsGenExchange once received messages are stored
+	mPeerNxsMap[pid]->notifyMessagesStored(grpIds);
 }
 
 
-void rs_nxs_test::NxsTestHub::notifyNewGroups(const RsPeerId& pid, std::vector<RsNxsGrp*>& groups)
+void rs_nxs_test::NxsTestHub::notifyNewGroups(const RsPeerId& pid, const std::vector<RsNxsGrp*>& groups)
 {
     RS_STACK_MUTEX(mMtx); /***** MTX LOCKED *****/
 
-	RsNxsGrpDataTemporaryList toStore;
-	std::vector<RsNxsGrp*>::iterator it = groups.begin();
+	std::list<RsNxsGrp*> toStore;
+	std::vector<RsNxsGrp*>::const_iterator it = groups.begin();
 	for(; it != groups.end(); it++)
 	{
 		RsNxsGrp* grp = *it;
@@ -215,6 +227,23 @@ void rs_nxs_test::NxsTestHub::notifyNewGroups(const RsPeerId& pid, std::vector<R
 	ds->storeGroup(toStore);
 }
 
+void rs_nxs_test::NxsTestHub::publishMessage(const RsPeerId& pid, RsNxsMsg* msg)
+{
+	RsGxsGroupId grpId = msg->grpId;
+
+	{
+		RS_STACK_MUTEX(mMtx); /***** MTX LOCKED *****/
+
+		std::list<RsNxsMsg*> toStore;
+		toStore.push_back(msg);
+		mTestScenario->getDataService(pid)->storeMessage(toStore);
+	}
+
+	RsGxsNetService *ns = mPeerNxsMap[pid];
+	ns->stampMsgServerUpdateTS(grpId);
+	ns->requestPull();
+}
+
 void rs_nxs_test::NxsTestHub::Wait(int seconds) {
 
 	double dsecs = seconds;
@@ -239,7 +268,7 @@ void rs_nxs_test::NxsTestHub::CleanUpTest()
 	mTestScenario->cleanTestScenario();
 }
 
-void rs_nxs_test::NxsTestHub::data_tick()
+void rs_nxs_test::NxsTestHub::threadTick()
 {
 	// for each nxs instance pull out all items from each and then move to destination peer
 
@@ -270,7 +299,7 @@ void rs_nxs_test::NxsTestHub::data_tick()
 
 	}
 
-    double timeDelta = .2;
+    double timeDelta = .05;
     usleep(timeDelta * 1000000);
 }
 
@@ -96,12 +96,19 @@ namespace rs_nxs_test
 	    /*!
 	     * @param messages messages are deleted after function returns
 	     */
-	    void notifyNewMessages(const RsPeerId&, std::vector<RsNxsMsg*>& messages);
+	    void notifyNewMessages(const RsPeerId&, const std::vector<RsNxsMsg*>& messages);
 
 	    /*!
 	     * @param messages messages are deleted after function returns
 	     */
-	    void notifyNewGroups(const RsPeerId&, std::vector<RsNxsGrp*>& groups);
+	    void notifyNewGroups(const RsPeerId&, const std::vector<RsNxsGrp*>& groups);
+
+	    /*!
+	     * Stores a message posted by the peer and announces it to its
+	     * friends the way RsGenExchange does for local posts
+	     * @param msg message is deleted after function returns
+	     */
+	    void publishMessage(const RsPeerId& pid, RsNxsMsg* msg);
 
 	    static void Wait(int seconds);
 
@@ -116,7 +123,7 @@ namespace rs_nxs_test
          *  This simulates the p3Service ticker and calls both gxs net services tick methods
          *  Also enables transport of messages between both services
          */
-        virtual void data_tick();
+        virtual void threadTick();
 
 	private:
 
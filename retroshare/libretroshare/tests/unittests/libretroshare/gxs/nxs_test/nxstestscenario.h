@@ -13,7 +13,7 @@
 #include "gxs/rsgxsnetutils.h"
 #include "gxs/rsdataservice.h"
 #include "gxs/rsnxsobserver.h"
-#include "util/rssharedptr.h"
+#include "rssharedptr.h"
 
 namespace rs_nxs_test
 {
@@ -19,9 +19,12 @@
  ******************************************************************************/
 
 #include <gtest/gtest.h>
+#include <chrono>
+#include <unistd.h>
 
 #include "nxsgrpsync_test.h"
 #include "nxsmsgsync_test.h"
+#include "nxsmsgchain_test.h"
 #include "nxstesthub.h"
 #include "nxsgrpsyncdelayed.h"
 
@@ -84,3 +87,41 @@ TEST(libretroshare_gxs, gxs_msg_sync_delayed)
 
 }
 
+TEST(libretroshare_gxs, gxs_msg_chain_propagation)
+{
+	// 6 peers in a line, so a post has to travel 5 hops to reach the last one
+	rs_nxs_test::NxsMsgChain *chain_test = new rs_nxs_test::NxsMsgChain(6);
+	rs_nxs_test::NxsTestHub tHub(chain_test);
+	tHub.StartTest();
+
+	// let the peers do their initial sync
+	rs_nxs_test::NxsTestHub::Wait(2);
+
+	RsNxsMsg *msg = chain_test->createMessage();
+	RsGxsMessageId msgId = msg->msgId;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double elapsed = 0;
+	bool received = false;
+
+	tHub.publishMessage(chain_test->firstPeer(), msg);
+
+	// the periodic sync alone would take minutes
+	while(!received && elapsed < 30)
+	{
+		usleep(10 * 1000);
+		received = chain_test->hasMessage(chain_test->lastPeer(), msgId);
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	std::cerr << "Post propagated over 5 hops in " << elapsed << " secs" << std::endl;
+
+	tHub.EndTest();
+
+	ASSERT_TRUE(received);
+	ASSERT_TRUE(tHub.testsPassed());
+
+	tHub.CleanUpTest();
+	delete chain_test ;
+}
+
@@ -0,0 +1,129 @@
+/*******************************************************************************
+ * unittests/libretroshare/pqi/authenticatedcertcache_test.cc                  *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+// from libretroshare
+
+#include "pqi/authssl.h"
+
+TEST(libretroshare_pqi, AuthenticatedCertCache_find)
+{
+	AuthenticatedCertCache cache(8) ;
+
+	Sha256CheckSum digest = Sha256CheckSum::random() ;
+	RsPgpFingerprint fpr = RsPgpFingerprint::random() ;
+	RsPeerId ssl_id = RsPeerId::random() ;
+
+	EXPECT_FALSE(cache.find(digest,fpr)) ;
+
+	cache.add(digest,fpr,ssl_id) ;
+
+	EXPECT_TRUE(cache.find(digest,fpr)) ;
+	EXPECT_FALSE(cache.find(Sha256CheckSum::random(),fpr)) ;
+
+	// same certificate, but the issuer key has changed
+
+	EXPECT_FALSE(cache.find(digest,RsPgpFingerprint::random())) ;
+
+	// adding it again does not make a new entry
+
+	cache.add(digest,fpr,ssl_id) ;
+	EXPECT_EQ(1u,cache.size()) ;
+
+	cache.clear() ;
+	EXPECT_FALSE(cache.find(digest,fpr)) ;
+}
+
+TEST(libretroshare_pqi, AuthenticatedCertCache_eviction)
+{
+	const uint32_t MAX_SIZE = 4 ;
+	AuthenticatedCertCache cache(MAX_SIZE) ;
+
+	RsPgpFingerprint fpr = RsPgpFingerprint::random() ;
+	std::vector<Sha256CheckSum> digests ;
+
+	for(uint32_t i=0;i<MAX_SIZE+2;++i)
+		digests.push_back(Sha256CheckSum::random()) ;
+
+	for(uint32_t i=0;i<MAX_SIZE;++i)
+		cache.add(digests[i],fpr,RsPeerId::random()) ;
+
+	EXPECT_EQ(MAX_SIZE,cache.size()) ;
+
+	// Certificate 0 is used again, so 1 is now the least recently used one, and is dropped
+	// when a new one comes. All this happens within the same second.
+
+	EXPECT_TRUE(cache.find(digests[0],fpr)) ;
+
+	cache.add(digests[MAX_SIZE],fpr,RsPeerId::random()) ;
+
+	EXPECT_EQ(MAX_SIZE,cache.size()) ;
+	EXPECT_TRUE(cache.find(digests[0],fpr)) ;
+	EXPECT_FALSE(cache.find(digests[1],fpr)) ;
+	EXPECT_TRUE(cache.find(digests[MAX_SIZE],fpr)) ;
+
+	// next is 2
+
+	cache.add(digests[MAX_SIZE+1],fpr,RsPeerId::random()) ;
+
+	EXPECT_EQ(MAX_SIZE,cache.size()) ;
+	EXPECT_FALSE(cache.find(digests[2],fpr)) ;
+	EXPECT_TRUE(cache.find(digests[3],fpr)) ;
+	EXPECT_TRUE(cache.find(digests[MAX_SIZE+1],fpr)) ;
+
+	// a failed lookup does not count as a use: 0 is dropped next
+
+	EXPECT_FALSE(cache.find(digests[0],RsPgpFingerprint::random())) ;
+	cache.add(digests[1],fpr,RsPeerId::random()) ;
+	EXPECT_FALSE(cache.find(digests[0],fpr)) ;
+	EXPECT_TRUE(cache.find(digests[1],fpr)) ;
+}
+
+TEST(libretroshare_pqi, AuthenticatedCertCache_removePeer)
+{
+	AuthenticatedCertCache cache(8) ;
+
+	RsPgpFingerprint fpr = RsPgpFingerprint::random() ;
+	RsPeerId removed_id = RsPeerId::random() ;
+	RsPeerId friend_id = RsPeerId::random() ;
+
+	// The removed location has two certificates, as when it made a new one.
+
+	Sha256CheckSum old_cert = Sha256CheckSum::random() ;
+	Sha256CheckSum new_cert = Sha256CheckSum::random() ;
+	Sha256CheckSum friend_cert = Sha256CheckSum::random() ;
+
+	cache.add(old_cert,fpr,removed_id) ;
+	cache.add(new_cert,fpr,removed_id) ;
+	cache.add(friend_cert,fpr,friend_id) ;
+
+	EXPECT_EQ(2u,cache.removePeer(removed_id)) ;
+	EXPECT_EQ(0u,cache.removePeer(removed_id)) ;
+
+	// its signature is checked again at the next connection, the other friends are not affected
+
+	EXPECT_FALSE(cache.find(old_cert,fpr)) ;
+	EXPECT_FALSE(cache.find(new_cert,fpr)) ;
+	EXPECT_TRUE(cache.find(friend_cert,fpr)) ;
+	EXPECT_EQ(1u,cache.size()) ;
+}
@@ -0,0 +1,349 @@
+/*******************************************************************************
+ * unittests/libretroshare/pqi/p3historystore_test.cc                          *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+// from libretroshare
+
+#include "pqi/p3historystore.h"
+#include "util/rsdir.h"
+#include "util/folderiterator.h"
+
+static const std::string TEST_DIR = "p3historystore_test" ;
+
+static const uint8_t TEST_KEY[p3HistoryStore::ENCRYPTION_KEY_SIZE] = {
+    1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32 } ;
+
+static RsPeerId chatId(uint8_t n)
+{
+	uint8_t bytes[RsPeerId::SIZE_IN_BYTES] ;
+	memset(bytes,n,RsPeerId::SIZE_IN_BYTES) ;
+	return RsPeerId(bytes) ;
+}
+
+static bool addMsg(p3HistoryStore& store,const RsPeerId& chat,uint32_t recv_time,const std::string& text)
+{
+	RsHistoryMsgItem item ;
+	item.chatPeerId = chat ;
+	item.incoming = true ;
+	item.peerName = "peer" ;
+	item.sendTime = recv_time ;
+	item.recvTime = recv_time ;
+	item.message = text ;
+
+	return store.addMessage(&item) ;
+}
+
+static std::vector<std::string> lastMsgs(p3HistoryStore& store,const RsPeerId& chat,uint32_t count)
+{
+	std::list<RsHistoryMsgItem*> items ;
+	std::vector<std::string> res ;
+
+	store.getLastMessages(chat,count,items) ;
+
+	for(std::list<RsHistoryMsgItem*>::iterator it(items.begin());it!=items.end();++it)
+	{
+		res.push_back((*it)->message) ;
+		delete *it ;
+	}
+	return res ;
+}
+
+static std::string segmentPath(const RsPeerId& chat,uint32_t day)
+{
+	p3HistoryStore store(TEST_DIR) ;
+	store.setEncryptionKey(TEST_KEY) ;
+
+	return store.segmentPath(chat,day) ;
+}
+
+static void cleanTestDir()
+{
+	for(librs::util::FolderIterator it(TEST_DIR,false);it.isValid();it.next())
+		if(it.file_type() == librs::util::FolderIterator::TYPE_DIR)
+		{
+			RsDirUtil::cleanupDirectory(TEST_DIR + "/" + it.file_name(),std::set<std::string>()) ;
+			rmdir((TEST_DIR + "/" + it.file_name()).c_str()) ;
+		}
+
+	rmdir(TEST_DIR.c_str()) ;
+}
+
+// names and contents of all the files of the store
+
+static void readTestDir(std::vector<std::string>& names,std::string& contents)
+{
+	for(librs::util::FolderIterator it(TEST_DIR,false);it.isValid();it.next())
+	{
+		names.push_back(it.file_name()) ;
+
+		for(librs::util::FolderIterator sit(TEST_DIR + "/" + it.file_name(),false);sit.isValid();sit.next())
+		{
+			names.push_back(sit.file_name()) ;
+
+			FILE *f = fopen((TEST_DIR + "/" + it.file_name() + "/" + sit.file_name()).c_str(),"rb") ;
+			ASSERT_TRUE(f != NULL) ;
+
+			char buf[4096] ;
+			size_t n ;
+			while(0 < (n = fread(buf,1,sizeof(buf),f)))
+				contents.append(buf,n) ;
+
+			fclose(f) ;
+		}
+	}
+}
+
+static bool containsUInt32(const std::string& data,uint32_t v)
+{
+	const char be[4] = { char(v >> 24), char(v >> 16), char(v >> 8), char(v) } ;
+	const char le[4] = { char(v), char(v >> 8), char(v >> 16), char(v >> 24) } ;
+
+	return data.find(std::string(be,4)) != std::string::npos || data.find(std::string(le,4)) != std::string::npos ;
+}
+
+TEST(libretroshare_pqi, p3HistoryStore)
+{
+	const uint32_t day = p3HistoryStore::SEGMENT_DURATION ;
+	const uint32_t t0 = 1000*day ;
+
+	cleanTestDir() ;
+
+	{
+		p3HistoryStore store(TEST_DIR) ;
+		store.setEncryptionKey(TEST_KEY) ;
+
+		// two chats, spread over three days
+
+		for(uint32_t i=0;i<30;++i)
+		{
+			EXPECT_TRUE(addMsg(store,chatId(1),t0 + i*day/10,"a" + std::to_string(i))) ;
+			EXPECT_TRUE(addMsg(store,chatId(2),t0 + i*day/10,"b" + std::to_string(i))) ;
+		}
+
+		std::vector<std::string> msgs = lastMsgs(store,chatId(1),5) ;
+		ASSERT_EQ(5u,msgs.size()) ;
+		EXPECT_EQ("a25",msgs.front()) ;
+		EXPECT_EQ("a29",msgs.back()) ;
+
+		EXPECT_EQ(30u,lastMsgs(store,chatId(2),0).size()) ;
+		EXPECT_TRUE(lastMsgs(store,chatId(3),0).empty()) ;
+	}
+
+	// what was written can be read back by another instance, with the same key only.
+
+	{
+		p3HistoryStore store(TEST_DIR) ;
+		std::list<RsHistoryMsgItem*> items ;
+		EXPECT_FALSE(store.getLastMessages(chatId(1),10,items)) ;
+	}
+	{
+		p3HistoryStore store(TEST_DIR) ;
+		uint8_t wrong_key[p3HistoryStore::ENCRYPTION_KEY_SIZE] ;
+		memset(wrong_key,0,sizeof(wrong_key)) ;
+		store.setEncryptionKey(wrong_key) ;
+
+		EXPECT_TRUE(lastMsgs(store,chatId(1),10).empty()) ;
+	}
+
+	p3HistoryStore store(TEST_DIR) ;
+	store.setEncryptionKey(TEST_KEY) ;
+
+	std::list<RsHistoryMsgItem*> items ;
+	ASSERT_TRUE(store.getLastMessages(chatId(1),3,items)) ;
+	ASSERT_EQ(3u,items.size()) ;
+	EXPECT_EQ("a27",items.front()->message) ;
+	EXPECT_EQ(chatId(1),items.front()->chatPeerId) ;
+
+	uint32_t id27 = items.front()->msgId ;
+	uint32_t id29 = items.back()->msgId ;
+	uint32_t id28 = (*++items.begin())->msgId ;
+
+	for(std::list<RsHistoryMsgItem*>::iterator it(items.begin());it!=items.end();++it)
+		delete *it ;
+
+	RsHistoryMsgItem *item = store.getMessage(id29) ;
+	ASSERT_TRUE(item != NULL) ;
+	EXPECT_EQ("a29",item->message) ;
+	delete item ;
+
+	// removing a message rewrites its segment, but keeps the other ids valid.
+
+	std::list<uint32_t> ids, removed ;
+	ids.push_back(id28) ;
+	store.removeMessages(ids,removed) ;
+
+	ASSERT_EQ(1u,removed.size()) ;
+	EXPECT_TRUE(store.getMessage(id28) == NULL) ;
+
+	item = store.getMessage(id29) ;
+	ASSERT_TRUE(item != NULL) ;
+	EXPECT_EQ("a29",item->message) ;
+	delete item ;
+
+	item = store.getMessage(id27) ;
+	ASSERT_TRUE(item != NULL) ;
+	EXPECT_EQ("a27",item->message) ;
+	delete item ;
+
+	std::vector<std::string> msgs = lastMsgs(store,chatId(1),2) ;
+	ASSERT_EQ(2u,msgs.size()) ;
+	EXPECT_EQ("a27",msgs[0]) ;
+	EXPECT_EQ("a29",msgs[1]) ;
+
+	// retention: first day is dropped entirely, the second one partially.
+
+	EXPECT_TRUE(store.removeOlderThan(t0 + day + day/2)) ;
+
+	msgs = lastMsgs(store,chatId(2),0) ;
+	ASSERT_EQ(15u,msgs.size()) ;
+	EXPECT_EQ("b15",msgs.front()) ;
+	EXPECT_FALSE(RsDirUtil::fileExists(segmentPath(chatId(2),1000))) ;
+	EXPECT_TRUE(RsDirUtil::fileExists(segmentPath(chatId(2),1001))) ;
+
+	// count limit
+
+	EXPECT_TRUE(store.keepLastMessages(chatId(2),4)) ;
+	msgs = lastMsgs(store,chatId(2),0) ;
+	ASSERT_EQ(4u,msgs.size()) ;
+	EXPECT_EQ("b26",msgs.front()) ;
+	EXPECT_FALSE(RsDirUtil::fileExists(segmentPath(chatId(2),1001))) ;
+
+	EXPECT_TRUE(store.clearChat(chatId(1))) ;
+	EXPECT_TRUE(lastMsgs(store,chatId(1),0).empty()) ;
+	EXPECT_FALSE(RsDirUtil::checkDirectory(store.chatDirectory(chatId(1)))) ;
+	EXPECT_TRUE(store.getMessage(id29) == NULL) ;
+
+	cleanTestDir() ;
+}
+
+TEST(libretroshare_pqi, p3HistoryStoreTruncatedSegment)
+{
+	const uint32_t t0 = 1000*p3HistoryStore::SEGMENT_DURATION ;
+	std::string path = segmentPath(chatId(1),1000) ;
+
+	cleanTestDir() ;
+
+	{
+		p3HistoryStore store(TEST_DIR) ;
+		store.setEncryptionKey(TEST_KEY) ;
+
+		for(uint32_t i=0;i<10;++i)
+			EXPECT_TRUE(addMsg(store,chatId(1),t0 + i,"a" + std::to_string(i))) ;
+	}
+
+	// simulate a crash while writing the last record
+
+	FILE *f = fopen(path.c_str(),"r+b") ;
+	ASSERT_TRUE(f != NULL) ;
+	fseek(f,0,SEEK_END) ;
+	long size = ftell(f) ;
+	fclose(f) ;
+	ASSERT_EQ(0,truncate(path.c_str(),size-5)) ;
+
+	p3HistoryStore store(TEST_DIR) ;
+	store.setEncryptionKey(TEST_KEY) ;
+
+	std::vector<std::string> msgs = lastMsgs(store,chatId(1),0) ;
+	ASSERT_EQ(9u,msgs.size()) ;
+	EXPECT_EQ("a8",msgs.back()) ;
+
+	// next records go after the last complete one
+
+	EXPECT_TRUE(addMsg(store,chatId(1),t0 + 20,"new")) ;
+
+	p3HistoryStore store2(TEST_DIR) ;
+	store2.setEncryptionKey(TEST_KEY) ;
+
+	msgs = lastMsgs(store2,chatId(1),2) ;
+	ASSERT_EQ(2u,msgs.size()) ;
+	EXPECT_EQ("a8",msgs[0]) ;
+	EXPECT_EQ("new",msgs[1]) ;
+
+	cleanTestDir() ;
+}
+
+TEST(libretroshare_pqi, p3HistoryStoreNoClearMetadata)
+{
+	const uint32_t day = p3HistoryStore::SEGMENT_DURATION ;
+	const uint32_t t0 = 18000*day + 12345 ;
+
+	cleanTestDir() ;
+
+	std::vector<uint32_t> times ;
+	{
+		p3HistoryStore store(TEST_DIR) ;
+		store.setEncryptionKey(TEST_KEY) ;
+
+		for(uint32_t i=0;i<20;++i)
+		{
+			times.push_back(t0 + i*day/4 + i*i*97) ;
+			EXPECT_TRUE(addMsg(store,chatId(1 + i%3),times.back(),"secret text " + std::to_string(i))) ;
+		}
+	}
+
+	std::vector<std::string> names ;
+	std::string contents ;
+	readTestDir(names,contents) ;
+
+	ASSERT_FALSE(contents.empty()) ;
+
+	for(uint8_t n=1;n<=3;++n)
+	{
+		std::string hex = chatId(n).toStdString() ;
+		std::string raw((const char*)chatId(n).toByteArray(),RsPeerId::SIZE_IN_BYTES) ;
+
+		for(uint32_t i=0;i<names.size();++i)
+			EXPECT_EQ(std::string::npos,names[i].find(hex)) << names[i] ;
+
+		EXPECT_EQ(std::string::npos,contents.find(hex)) ;
+		EXPECT_EQ(std::string::npos,contents.find(raw)) ;
+	}
+
+	for(uint32_t d=t0/day;d<=times.back()/day;++d)
+	{
+		for(uint32_t i=0;i<names.size();++i)
+			EXPECT_EQ(std::string::npos,names[i].find(std::to_string(d))) << names[i] ;
+
+		EXPECT_FALSE(containsUInt32(contents,d)) ;
+	}
+
+	for(uint32_t i=0;i<times.size();++i)
+		EXPECT_FALSE(containsUInt32(contents,times[i])) ;
+
+	EXPECT_EQ(std::string::npos,contents.find("secret text")) ;
+
+	// and everything can still be read back with the key.
+
+	p3HistoryStore store(TEST_DIR) ;
+	store.setEncryptionKey(TEST_KEY) ;
+
+	std::list<RsHistoryMsgItem*> items ;
+	ASSERT_TRUE(store.getLastMessages(chatId(1),0,items)) ;
+	ASSERT_EQ(7u,items.size()) ;
+	EXPECT_EQ("secret text 18",items.back()->message) ;
+	EXPECT_EQ(times[18],items.back()->recvTime) ;
+
+	for(std::list<RsHistoryMsgItem*>::iterator it(items.begin());it!=items.end();++it)
+		delete *it ;
+
+	cleanTestDir() ;
+}
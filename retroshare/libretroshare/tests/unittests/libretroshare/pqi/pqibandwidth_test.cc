@@ -0,0 +1,131 @@
+/*******************************************************************************
+ * unittests/libretroshare/pqi/pqibandwidth_test.cc                            *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+// from libretroshare
+
+#include "pqi/pqibandwidth.h"
+#include "rsitems/itempriorities.h"
+#include "util/rstime.h"
+
+TEST(libretroshare_pqi, RsTokenBucket)
+{
+	RsTokenBucket b ;
+
+	// no rate means no limit, and consuming has no effect
+
+	EXPECT_EQ(RsTokenBucket::UNLIMITED, b.available()) ;
+	b.consume(100000) ;
+	EXPECT_EQ(RsTokenBucket::UNLIMITED, b.available()) ;
+
+	// 1MB/s => 250kB of burst. The bucket starts empty and fills up with time.
+
+	b.setRate(1024*1024) ;
+	EXPECT_LE(b.available(), 1024) ;
+
+	rstime::rs_usleep(100*1000) ;
+
+	int64_t a = b.available() ;
+	EXPECT_GE(a, 80*1024) ;
+	EXPECT_LE(a, 256*1024) ;
+
+	rstime::rs_usleep(500*1000) ;
+
+	EXPECT_LE(b.available(), 256*1024) ;	// capped by the burst size
+
+	// the reserve is taken out of what is available
+
+	EXPECT_LT(b.available(0.25f), b.available()) ;
+
+	// lowering the rate also lowers the tokens to the new burst size
+
+	b.setRate(20000) ;
+	EXPECT_LE(b.available(), RsTokenBucket::MIN_BURST_SIZE) ;
+
+	// going in debt is allowed
+
+	b.consume(1024*1024) ;
+	EXPECT_LT(b.available(), 0) ;
+}
+
+TEST(libretroshare_pqi, pqiBandwidthShaper)
+{
+	EXPECT_EQ(pqiBandwidthShaper::CLASS_INTERACTIVE, pqiBandwidthShaper::serviceClass(QOS_PRIORITY_RS_CHAT_ITEM)) ;
+	EXPECT_EQ(pqiBandwidthShaper::CLASS_INTERACTIVE, pqiBandwidthShaper::serviceClass(QOS_PRIORITY_RS_FILE_REQUEST)) ;
+	EXPECT_EQ(pqiBandwidthShaper::CLASS_BULK, pqiBandwidthShaper::serviceClass(QOS_PRIORITY_RS_FILE_DATA)) ;
+	EXPECT_EQ(pqiBandwidthShaper::CLASS_BULK, pqiBandwidthShaper::serviceClass(QOS_PRIORITY_DEFAULT)) ;
+
+	// 100kB/s in total, 1MB/s for the peer: the global bucket is the limiting one.
+
+	pqiBandwidthShaper::setGlobalMaxRate(false, 100) ;
+
+	RsTokenBucket peer ;
+	peer.setRate(1024*1024) ;
+
+	rstime::rs_usleep(300*1000) ;
+
+	int64_t interactive = pqiBandwidthShaper::allowedBytes(false, peer, pqiBandwidthShaper::CLASS_INTERACTIVE) ;
+	int64_t bulk = pqiBandwidthShaper::allowedBytes(false, peer, pqiBandwidthShaper::CLASS_BULK) ;
+
+	EXPECT_LE(interactive, 26*1024) ;
+	EXPECT_LT(bulk, interactive) ;
+
+	// once bulk data has used everything it could, interactive items can still go
+
+	pqiBandwidthShaper::consume(false, peer, bulk) ;
+
+	EXPECT_LE(pqiBandwidthShaper::allowedBytes(false, peer, pqiBandwidthShaper::CLASS_BULK), 1024) ;
+	EXPECT_GT(pqiBandwidthShaper::allowedBytes(false, peer, pqiBandwidthShaper::CLASS_INTERACTIVE), 4096) ;
+
+	pqiBandwidthShaper::setGlobalMaxRate(false, 0) ;
+}
+
+TEST(libretroshare_pqi, pqiBandwidthShaper_outQueueBudgets)
+{
+	// 10kB/s: the budget of a service is the minimum one, the whole queue may hold 4 times that.
+
+	const double slow = 10*1024 ;
+	const uint64_t budget = pqiBandwidthShaper::MIN_SERVICE_QUEUE_BUDGET ;
+
+	EXPECT_TRUE (pqiBandwidthShaper::outQueueAccepts(0, 0, 8192, slow)) ;
+	EXPECT_TRUE (pqiBandwidthShaper::outQueueAccepts(budget - 8192, budget, 8192, slow)) ;
+	EXPECT_FALSE(pqiBandwidthShaper::outQueueAccepts(budget - 4096, budget, 8192, slow)) ;
+
+	// items larger than the budget go through once the queue is half empty
+
+	EXPECT_TRUE (pqiBandwidthShaper::outQueueAccepts(budget/2, budget, 10*budget, slow)) ;
+
+	// the whole queue is bounded as well, whatever the service
+
+	EXPECT_FALSE(pqiBandwidthShaper::outQueueAccepts(0, 4*budget, 8192, slow)) ;
+
+	// a service is told it can send again when both queues are back to half their budget
+
+	EXPECT_FALSE(pqiBandwidthShaper::outQueueDrained(budget, budget, slow)) ;
+	EXPECT_FALSE(pqiBandwidthShaper::outQueueDrained(0, 3*budget, slow)) ;
+	EXPECT_TRUE (pqiBandwidthShaper::outQueueDrained(budget/2, 2*budget, slow)) ;
+
+	// budgets follow the rate of the peer, and are the largest ones when the link is not limited
+
+	EXPECT_TRUE (pqiBandwidthShaper::outQueueAccepts(budget, budget, 8192, 1024*1024)) ;
+	EXPECT_TRUE (pqiBandwidthShaper::outQueueAccepts(3*1024*1024, 3*1024*1024, 8192, 0)) ;
+	EXPECT_FALSE(pqiBandwidthShaper::outQueueAccepts(pqiBandwidthShaper::MAX_SERVICE_QUEUE_BUDGET, pqiBandwidthShaper::MAX_SERVICE_QUEUE_BUDGET, 8192, 0)) ;
+}
@@ -0,0 +1,209 @@
+/*******************************************************************************
+ * unittests/libretroshare/pqi/pqiqos_test.cc                                  *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+// from libretroshare
+
+#include "pqi/pqiqos.h"
+#include "serialiser/rsbaseserial.h"
+
+// Makes a fake serialised item of the given service. The 4 bytes after the
+// header hold a counter, so that the output order can be checked.
+
+static void *makePacket(uint16_t service, uint32_t counter, uint32_t size = 16)
+{
+	void *data = rs_malloc(size) ;
+	uint32_t offset = 0 ;
+
+	memset(data,0,size) ;
+	setRawUInt32(data, size, &offset, (0x02 << 24) | (uint32_t(service) << 8)) ;
+	setRawUInt32(data, size, &offset, size) ;
+	setRawUInt32(data, size, &offset, counter) ;
+
+	return data ;
+}
+
+static void readPacket(void *data, uint16_t& service, uint32_t& counter)
+{
+	uint32_t type = 0, size = 0, offset = 0 ;
+
+	getRawUInt32(data, 16, &offset, &type) ;
+	getRawUInt32(data, 16, &offset, &size) ;
+	getRawUInt32(data, 16, &offset, &counter) ;
+
+	service = (type >> 8) & 0xffff ;
+}
+
+static void *popPacket(pqiQoS& qos)
+{
+	uint32_t size, packet_id ;
+	bool starts, ends ;
+
+	return qos.out_rsItem(1024, size, starts, ends, packet_id) ;
+}
+
+TEST(libretroshare_pqi, pqiQoS_Order)
+{
+	pqiQoS qos(10,2.0f) ;
+
+	EXPECT_EQ(-1, qos.top_priority()) ;
+
+	for(uint32_t i=0;i<1000;++i)
+		qos.in_rsItem(makePacket(0x10 + i%3, i), 16, i%10) ;
+
+	EXPECT_EQ(9, qos.top_priority()) ;
+	EXPECT_EQ(1000u, qos.qos_queue_size()) ;
+
+	// all items get out, in the order they got in for a given service and priority
+
+	std::map<uint32_t,uint32_t> last ;
+	uint32_t popped = 0 ;
+
+	while(void *data = popPacket(qos))
+	{
+		uint16_t service ;
+		uint32_t counter ;
+		readPacket(data, service, counter) ;
+
+		uint32_t key = (service << 8) + counter%10 ;
+
+		if(last.find(key) != last.end())
+			EXPECT_LT(last[key], counter) ;
+
+		last[key] = counter ;
+		free(data) ;
+		++popped ;
+	}
+
+	EXPECT_EQ(1000u, popped) ;
+	EXPECT_EQ(0u, qos.qos_queue_size()) ;
+	EXPECT_EQ(-1, qos.top_priority()) ;
+}
+
+TEST(libretroshare_pqi, pqiQoS_ServiceFairness)
+{
+	pqiQoS qos(10,2.0f) ;
+
+	// a burst from one service does not delay another service of the same level
+
+	for(uint32_t i=0;i<100;++i)
+		qos.in_rsItem(makePacket(0x200, i), 16, 3) ;
+
+	qos.in_rsItem(makePacket(0x12, 0), 16, 3) ;
+
+	bool found = false ;
+
+	for(int i=0;i<2;++i)
+	{
+		void *data = popPacket(qos) ;
+		uint16_t service ;
+		uint32_t counter ;
+		readPacket(data, service, counter) ;
+		found = found || (service == 0x12) ;
+		free(data) ;
+	}
+	EXPECT_TRUE(found) ;
+
+	std::map<uint16_t,pqiQoS::ServiceStatistics> stats ;
+	qos.getServiceStatistics(stats) ;
+
+	EXPECT_EQ(99u, stats[0x200].queued_items) ;
+	EXPECT_EQ(99u*16, stats[0x200].queued_bytes) ;
+	EXPECT_EQ(1u, stats[0x200].sent_items) ;
+	EXPECT_EQ(0u, stats[0x12].queued_items) ;
+	EXPECT_EQ(1u, stats[0x12].sent_items) ;
+	EXPECT_GE(stats[0x12].max_wait_us, stats[0x12].total_wait_us) ;
+}
+
+TEST(libretroshare_pqi, pqiQoS_Proportionality)
+{
+	pqiQoS qos(10,2.0f) ;
+
+	for(uint32_t i=0;i<10000;++i)
+	{
+		qos.in_rsItem(makePacket(0x18, i), 16, 8) ;
+		qos.in_rsItem(makePacket(0x16, i), 16, 6) ;
+	}
+
+	// level 8 gets alpha^2 = 4 times the bandwidth of level 6
+
+	std::map<uint16_t,uint32_t> hist ;
+
+	for(uint32_t i=0;i<5000;++i)
+	{
+		void *data = popPacket(qos) ;
+		uint16_t service ;
+		uint32_t counter ;
+		readPacket(data, service, counter) ;
+		free(data) ;
+
+		++hist[service] ;
+	}
+
+	EXPECT_EQ(5000u, hist[0x18] + hist[0x16]) ;
+	EXPECT_NEAR(4.0, hist[0x18] / (double)hist[0x16], 0.1) ;
+}
+
+TEST(libretroshare_pqi, pqiQoS_Slicing)
+{
+	pqiQoS qos(10,2.0f) ;
+
+	uint32_t total = 2000 ;
+	void *big = makePacket(0x20, 1, total) ;
+	unsigned char *copy = (unsigned char*)malloc(total) ;
+	memcpy(copy, big, total) ;
+
+	qos.in_rsItem(big, total, 5) ;
+
+	std::vector<unsigned char> received ;
+	uint32_t size, packet_id, first_id = 0 ;
+	bool starts, ends ;
+	int nb_slices = 0 ;
+
+	do
+	{
+		void *slice = qos.out_rsItem(512, size, starts, ends, packet_id) ;
+		ASSERT_TRUE(slice != NULL) ;
+
+		if(nb_slices == 0)
+		{
+			EXPECT_TRUE(starts) ;
+			first_id = packet_id ;
+		}
+		else
+		{
+			EXPECT_FALSE(starts) ;
+			EXPECT_EQ(first_id, packet_id) ;
+		}
+
+		received.insert(received.end(), (unsigned char*)slice, (unsigned char*)slice + size) ;
+		free(slice) ;
+		++nb_slices ;
+	}
+	while(!ends) ;
+
+	EXPECT_EQ(4, nb_slices) ;
+	ASSERT_EQ(total, received.size()) ;
+	EXPECT_EQ(0, memcmp(copy, received.data(), total)) ;
+	EXPECT_EQ(0u, qos.qos_queue_size()) ;
+
+	free(copy) ;
+}
@@ -0,0 +1,256 @@
+/*******************************************************************************
+ * unittests/libretroshare/pqi/pqiservice_test.cc                              *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <atomic>
+#include <vector>
+
+// from libretroshare
+
+#include "pqi/pqiservice.h"
+#include "rsitems/rsitem.h"
+#include "retroshare/rspeers.h"
+
+// from librssimulator
+
+#include "peer/FakeLinkMgr.h"
+#include "peer/FakeServiceControl.h"
+#include "peer/FakePublisher.h"
+
+class CountingService: public pqiService
+{
+public:
+	CountingService(uint16_t service) : mService(service), mReceived(0), mTicks(0), mCongested(false) {}
+
+	virtual bool recv(RsRawItem *item)
+	{
+		EXPECT_EQ(mService,(item->PacketId() >> 8) & 0xffff) ;
+		++mReceived ;
+		delete item ;
+		return true ;
+	}
+
+	virtual RsServiceInfo getServiceInfo() { return RsServiceInfo(mService,"test",1,0,1,0) ; }
+	virtual bool incomingQueueFull() { return mCongested ; }
+	virtual int tick() { ++mTicks ; return 0 ; }
+
+	uint16_t mService ;
+	std::atomic<uint32_t> mReceived ;
+	uint32_t mTicks ;
+	bool mCongested ;
+};
+
+static uint32_t packetId(uint16_t service,uint8_t subtype = 0x01,uint8_t version = RS_PKT_VERSION_SERVICE)
+{
+	return (uint32_t(version) << 24) | (uint32_t(service) << 8) | subtype ;
+}
+
+static RsRawItem *makeItem(uint32_t packet_id)
+{
+	RsRawItem *item = new RsRawItem(packet_id,8) ;
+	item->PeerId(RsPeerId::random()) ;
+	return item ;
+}
+
+class ServiceServerTest: public ::testing::Test
+{
+protected:
+	ServiceServerTest()
+	    : mLinkMgr(RsPeerId::random(),std::list<RsPeerId>(),true), mControl(&mLinkMgr), mServer(&mPublisher,&mControl) {}
+
+	FakeLinkMgr mLinkMgr ;
+	FakeServiceControl mControl ;
+	FakePublisher mPublisher ;
+	p3ServiceServer mServer ;
+};
+
+TEST_F(ServiceServerTest, lookup)
+{
+	// 0x0011 and 0x0012 share a page of the table, 0x0211 is in another one.
+
+	CountingService s1(0x0011), s2(0x0012), s3(0x0211) ;
+
+	EXPECT_EQ(1,mServer.addService(&s1,true)) ;
+	EXPECT_EQ(1,mServer.addService(&s2,true)) ;
+	EXPECT_EQ(1,mServer.addService(&s3,true)) ;
+	EXPECT_EQ(-1,mServer.addService(&s1,true)) ;
+
+	EXPECT_TRUE(mServer.recvItem(makeItem(packetId(0x0011)))) ;
+	EXPECT_TRUE(mServer.recvItem(makeItem(packetId(0x0011,0x07)))) ;
+	EXPECT_TRUE(mServer.recvItem(makeItem(packetId(0x0012)))) ;
+	EXPECT_TRUE(mServer.recvItem(makeItem(packetId(0x0211)))) ;
+
+	EXPECT_EQ(2u,s1.mReceived) ;
+	EXPECT_EQ(1u,s2.mReceived) ;
+	EXPECT_EQ(1u,s3.mReceived) ;
+
+	// Unknown services, in a known page or not, and known services with another version
+	// byte are dropped.
+
+	EXPECT_FALSE(mServer.recvItem(makeItem(packetId(0x0013)))) ;
+	EXPECT_FALSE(mServer.recvItem(makeItem(packetId(0x0311)))) ;
+	EXPECT_FALSE(mServer.recvItem(makeItem(packetId(0x0011,0x01,0x01)))) ;
+
+	EXPECT_EQ(2u,s1.mReceived) ;
+
+	// congestion of a service is found from the packet id, as a connection reads it
+
+	EXPECT_FALSE(mServer.incomingCongested(packetId(0x0011))) ;
+	s1.mCongested = true ;
+	EXPECT_TRUE(mServer.incomingCongested(packetId(0x0011,0x05))) ;
+	EXPECT_FALSE(mServer.incomingCongested(packetId(0x0012))) ;
+	EXPECT_FALSE(mServer.incomingCongested(packetId(0x0013))) ;
+
+	// removed services do not get anything anymore, the others are not affected
+
+	EXPECT_EQ(1,mServer.removeService(&s1)) ;
+	EXPECT_EQ(-1,mServer.removeService(&s1)) ;
+
+	EXPECT_FALSE(mServer.recvItem(makeItem(packetId(0x0011)))) ;
+	EXPECT_FALSE(mServer.incomingCongested(packetId(0x0011))) ;
+	EXPECT_TRUE(mServer.recvItem(makeItem(packetId(0x0012)))) ;
+
+	EXPECT_EQ(2u,s1.mReceived) ;
+	EXPECT_EQ(2u,s2.mReceived) ;
+
+	// and a service can be added again
+
+	EXPECT_EQ(1,mServer.addService(&s1,true)) ;
+	EXPECT_TRUE(mServer.recvItem(makeItem(packetId(0x0011)))) ;
+	EXPECT_EQ(3u,s1.mReceived) ;
+
+	mServer.removeService(&s1) ;
+	mServer.removeService(&s2) ;
+	mServer.removeService(&s3) ;
+}
+
+TEST_F(ServiceServerTest, stats)
+{
+	CountingService s1(0x0011), s2(0x0012) ;
+
+	mServer.addService(&s1,true) ;
+	mServer.addService(&s2,true) ;
+
+	for(int i=0;i<5;++i)
+		mServer.recvItem(makeItem(packetId(0x0011))) ;
+	mServer.recvItem(makeItem(packetId(0x0013))) ;
+
+	std::map<uint32_t,RsServiceQueueStats> stats ;
+	EXPECT_TRUE(mServer.getServiceQueueStats(stats)) ;
+
+	ASSERT_EQ(2u,stats.size()) ;
+	EXPECT_EQ(5u,stats[packetId(0x0011,0)].mItemsReceived) ;
+	EXPECT_EQ(0u,stats[packetId(0x0012,0)].mItemsReceived) ;
+	EXPECT_EQ(packetId(0x0011,0),stats[packetId(0x0011,0)].mServiceType) ;
+
+	// no incoming queue in these services
+
+	EXPECT_EQ(0u,stats[packetId(0x0011,0)].mQueueCapacity) ;
+
+	mServer.removeService(&s1) ;
+	mServer.removeService(&s2) ;
+}
+
+TEST_F(ServiceServerTest, concurrentDispatch)
+{
+	// Connection threads dispatch items without lock while services are added.
+
+	const uint32_t THREADS = 4 ;
+	const uint32_t ITEMS = 20000 ;
+
+	CountingService s1(0x0011), s2(0x0211) ;
+	mServer.addService(&s1,true) ;
+
+	std::atomic<uint32_t> delivered2(0) ;
+	std::vector<std::thread> threads ;
+
+	for(uint32_t t=0;t<THREADS;++t)
+		threads.push_back(std::thread([this,&delivered2,ITEMS]()
+		{
+			for(uint32_t i=0;i<ITEMS;++i)
+			{
+				mServer.recvItem(makeItem(packetId(0x0011))) ;
+
+				if(mServer.recvItem(makeItem(packetId(0x0211))))
+					++delivered2 ;
+			}
+		})) ;
+
+	mServer.addService(&s2,true) ;
+
+	for(uint32_t t=0;t<THREADS;++t)
+		threads[t].join() ;
+
+	EXPECT_EQ(THREADS*ITEMS,s1.mReceived) ;
+	EXPECT_EQ(delivered2,s2.mReceived) ;
+
+	mServer.removeService(&s1) ;
+	mServer.removeService(&s2) ;
+}
+
+TEST_F(ServiceServerTest, heldServices)
+{
+	CountingService s1(0x0011), s2(0x0012) ;
+
+	mServer.addService(&s1,true) ;
+	mServer.addService(&s2,true) ;
+
+	// Items of a held service are kept, and it is not ticked. The others are not affected.
+
+	mServer.holdService(&s1) ;
+
+	EXPECT_TRUE(mServer.recvItem(makeItem(packetId(0x0011)))) ;
+	EXPECT_TRUE(mServer.recvItem(makeItem(packetId(0x0011,0x02)))) ;
+	EXPECT_TRUE(mServer.recvItem(makeItem(packetId(0x0012)))) ;
+	EXPECT_FALSE(mServer.recvItem(makeItem(packetId(0x0013)))) ;
+
+	mServer.tick() ;
+
+	EXPECT_EQ(0u,s1.mReceived) ;
+	EXPECT_EQ(0u,s1.mTicks) ;
+	EXPECT_EQ(1u,s2.mReceived) ;
+	EXPECT_EQ(1u,s2.mTicks) ;
+
+	// Once released, it gets the kept items, then the new ones directly.
+
+	mServer.releaseServices() ;
+
+	EXPECT_EQ(2u,s1.mReceived) ;
+
+	EXPECT_TRUE(mServer.recvItem(makeItem(packetId(0x0011)))) ;
+	mServer.tick() ;
+
+	EXPECT_EQ(3u,s1.mReceived) ;
+	EXPECT_EQ(1u,s1.mTicks) ;
+	EXPECT_EQ(2u,s2.mTicks) ;
+
+	// Items kept for a service that is removed meanwhile are dropped.
+
+	mServer.holdService(&s2) ;
+	mServer.recvItem(makeItem(packetId(0x0012))) ;
+	mServer.removeService(&s2) ;
+	mServer.releaseServices() ;
+
+	EXPECT_EQ(1u,s2.mReceived) ;
+
+	mServer.removeService(&s1) ;
+}
@@ -0,0 +1,311 @@
+/*******************************************************************************
+ * unittests/libretroshare/pqi/pqisslhandshakepool_test.cc                     *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+
+// from libretroshare
+
+#include "pqi/pqisslhandshakepool.h"
+
+static const int SLOW_STEP_MS = 300 ;
+
+// Steps of the SSL objects using this callback take SLOW_STEP_MS longer.
+
+static std::atomic<int> slowStepsStarted(0) ;
+static std::atomic<int> slowStepsFinished(0) ;
+
+static void slowInfoCallback(const SSL *,int where,int)
+{
+	if(!(where & SSL_CB_LOOP))
+		return ;
+
+	++slowStepsStarted ;
+	std::this_thread::sleep_for(std::chrono::milliseconds(SLOW_STEP_MS)) ;
+	++slowStepsFinished ;
+}
+
+class SSLHandshakePoolTest: public ::testing::Test
+{
+protected:
+	SSLHandshakePoolTest()
+	{
+		slowStepsStarted = 0 ;
+		slowStepsFinished = 0 ;
+
+		// self signed certificate for the accepting side
+
+		mKey = EVP_RSA_gen(2048) ;
+		mCert = X509_new() ;
+		X509_set_version(mCert,2) ;
+		ASN1_INTEGER_set(X509_get_serialNumber(mCert),1) ;
+		X509_gmtime_adj(X509_getm_notBefore(mCert),0) ;
+		X509_gmtime_adj(X509_getm_notAfter(mCert),3600) ;
+		X509_set_pubkey(mCert,mKey) ;
+		X509_NAME_add_entry_by_txt(X509_get_subject_name(mCert),"CN",MBSTRING_ASC,(const unsigned char*)"test",-1,-1,0) ;
+		X509_set_issuer_name(mCert,X509_get_subject_name(mCert)) ;
+		X509_sign(mCert,mKey,EVP_sha256()) ;
+
+		mServerCtx = SSL_CTX_new(TLS_server_method()) ;
+		SSL_CTX_use_certificate(mServerCtx,mCert) ;
+		SSL_CTX_use_PrivateKey(mServerCtx,mKey) ;
+
+		mClientCtx = SSL_CTX_new(TLS_client_method()) ;
+		SSL_CTX_set_verify(mClientCtx,SSL_VERIFY_NONE,NULL) ;
+	}
+
+	~SSLHandshakePoolTest()
+	{
+		SSL_CTX_free(mServerCtx) ;
+		SSL_CTX_free(mClientCtx) ;
+		X509_free(mCert) ;
+		EVP_PKEY_free(mKey) ;
+	}
+
+	// A connected pair of non blocking SSL objects
+
+	void makePair(SSL*& server,SSL*& client)
+	{
+		int fds[2] ;
+		ASSERT_EQ(0,socketpair(AF_UNIX,SOCK_STREAM,0,fds)) ;
+
+		for(int i=0;i<2;++i)
+			fcntl(fds[i],F_SETFL,fcntl(fds[i],F_GETFL) | O_NONBLOCK) ;
+
+		server = SSL_new(mServerCtx) ;
+		client = SSL_new(mClientCtx) ;
+		SSL_set_fd(server,fds[0]) ;
+		SSL_set_fd(client,fds[1]) ;
+	}
+
+	void freeSSL(SSL *ssl)
+	{
+		int fd = SSL_get_fd(ssl) ;
+		SSL_free(ssl) ;
+		close(fd) ;
+	}
+
+	EVP_PKEY *mKey ;
+	X509 *mCert ;
+	SSL_CTX *mServerCtx ;
+	SSL_CTX *mClientCtx ;
+};
+
+static bool waitFor(const std::atomic<int>& counter,int value)
+{
+	for(int i=0;i<500 && counter < value;++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10)) ;
+
+	return counter >= value ;
+}
+
+TEST_F(SSLHandshakePoolTest, handshake)
+{
+	pqiSSLHandshakePool pool(2) ;
+	SSL *server, *client ;
+	makePair(server,client) ;
+
+	int server_ret = 0, client_ret = 0 ;
+
+	for(int i=0;i<1000 && (server_ret != 1 || client_ret != 1);++i)
+	{
+		int ssl_err ;
+		unsigned long err_err ;
+
+		if(server_ret != 1)
+		{
+			server_ret = pool.handshake(server,true,ssl_err,err_err) ;
+			ASSERT_TRUE(server_ret == 1 || ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE) ;
+		}
+		if(client_ret != 1)
+		{
+			client_ret = pool.handshake(client,false,ssl_err,err_err) ;
+			ASSERT_TRUE(client_ret == 1 || ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE) ;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1)) ;
+	}
+
+	EXPECT_EQ(1,server_ret) ;
+	EXPECT_EQ(1,client_ret) ;
+
+	// finished handshakes are not kept
+
+	EXPECT_EQ(0u,pool.pendingHandshakes()) ;
+
+	freeSSL(server) ;
+	freeSSL(client) ;
+}
+
+TEST_F(SSLHandshakePoolTest, forgetRunningStep)
+{
+	pqiSSLHandshakePool pool(1) ;
+	SSL *server, *client ;
+	makePair(server,client) ;
+
+	SSL_set_info_callback(server,slowInfoCallback) ;
+
+	int ssl_err ;
+	unsigned long err_err ;
+
+	EXPECT_EQ(-1,pool.handshake(server,true,ssl_err,err_err)) ;
+	EXPECT_EQ(SSL_ERROR_WANT_READ,ssl_err) ;
+	ASSERT_TRUE(waitFor(slowStepsStarted,1)) ;
+
+	// The step is running: forget() must wait until the worker is done with the SSL object.
+
+	EXPECT_EQ(1u,pool.pendingHandshakes()) ;
+	EXPECT_EQ(0,slowStepsFinished) ;
+
+	pool.forget(server) ;
+
+	EXPECT_EQ(slowStepsStarted,slowStepsFinished) ;
+	EXPECT_EQ(0u,pool.pendingHandshakes()) ;
+
+	freeSSL(server) ;
+	freeSSL(client) ;
+}
+
+TEST_F(SSLHandshakePoolTest, concurrentForget)
+{
+	// Two forget() of the same running step: the second one must not use the step
+	// the first one removed.
+
+	pqiSSLHandshakePool pool(1) ;
+	SSL *server, *client ;
+	makePair(server,client) ;
+
+	SSL_set_info_callback(server,slowInfoCallback) ;
+
+	int ssl_err ;
+	unsigned long err_err ;
+
+	pool.handshake(server,true,ssl_err,err_err) ;
+	ASSERT_TRUE(waitFor(slowStepsStarted,1)) ;
+
+	std::thread t1([&pool,server]() { pool.forget(server) ; }) ;
+	std::thread t2([&pool,server]() { pool.forget(server) ; }) ;
+	t1.join() ;
+	t2.join() ;
+
+	EXPECT_EQ(slowStepsStarted,slowStepsFinished) ;
+	EXPECT_EQ(0u,pool.pendingHandshakes()) ;
+
+	// forgetting an unknown SSL object does nothing
+
+	pool.forget(server) ;
+	pool.forget(client) ;
+
+	freeSSL(server) ;
+	freeSSL(client) ;
+}
+
+TEST_F(SSLHandshakePoolTest, forgetQueuedStep)
+{
+	// With one worker busy on a slow step, the step of the second SSL object stays queued.
+
+	pqiSSLHandshakePool pool(1) ;
+	SSL *slow, *slow_client, *server, *client ;
+	makePair(slow,slow_client) ;
+	makePair(server,client) ;
+
+	SSL_set_info_callback(slow,slowInfoCallback) ;
+
+	int ssl_err ;
+	unsigned long err_err ;
+
+	pool.handshake(slow,true,ssl_err,err_err) ;
+	ASSERT_TRUE(waitFor(slowStepsStarted,1)) ;
+
+	pool.handshake(server,true,ssl_err,err_err) ;
+	EXPECT_EQ(2u,pool.pendingHandshakes()) ;
+
+	// dropped without waiting
+
+	auto start = std::chrono::steady_clock::now() ;
+	pool.forget(server) ;
+	EXPECT_LT(std::chrono::steady_clock::now() - start,std::chrono::milliseconds(SLOW_STEP_MS/2)) ;
+	EXPECT_EQ(1u,pool.pendingHandshakes()) ;
+
+	pool.forget(slow) ;
+	EXPECT_EQ(0u,pool.pendingHandshakes()) ;
+
+	freeSSL(slow) ;
+	freeSSL(slow_client) ;
+	freeSSL(server) ;
+	freeSSL(client) ;
+}
+
+TEST_F(SSLHandshakePoolTest, shutdown)
+{
+	pqiSSLHandshakePool pool(1) ;
+	SSL *slow, *slow_client, *server, *client ;
+	makePair(slow,slow_client) ;
+	makePair(server,client) ;
+
+	SSL_set_info_callback(slow,slowInfoCallback) ;
+
+	int ssl_err ;
+	unsigned long err_err ;
+
+	pool.handshake(slow,true,ssl_err,err_err) ;
+	ASSERT_TRUE(waitFor(slowStepsStarted,1)) ;
+	pool.handshake(server,true,ssl_err,err_err) ;
+
+	// the running step is waited for, the queued one is dropped
+
+	pool.shutdown() ;
+
+	EXPECT_EQ(slowStepsStarted,slowStepsFinished) ;
+	EXPECT_EQ(1u,pool.pendingHandshakes()) ;
+
+	// no handshake is done anymore, and the result of the step that was running is not given
+
+	EXPECT_EQ(-1,pool.handshake(slow,true,ssl_err,err_err)) ;
+	EXPECT_EQ(SSL_ERROR_SSL,ssl_err) ;
+	EXPECT_EQ(-1,pool.handshake(server,true,ssl_err,err_err)) ;
+	EXPECT_EQ(SSL_ERROR_SSL,ssl_err) ;
+	EXPECT_EQ(-1,pool.handshake(client,false,ssl_err,err_err)) ;
+	EXPECT_EQ(SSL_ERROR_SSL,ssl_err) ;
+
+	EXPECT_EQ(0u,pool.pendingHandshakes()) ;
+
+	pool.forget(slow) ;
+	pool.forget(server) ;
+
+	// shutting down again, and destroying the pool, is harmless
+
+	pool.shutdown() ;
+
+	freeSSL(slow) ;
+	freeSSL(slow_client) ;
+	freeSSL(server) ;
+	freeSSL(client) ;
+}
@@ -23,6 +23,7 @@
 #include <string.h>
 #include <iostream>
 #include "serialiser/rstlvbinary.h"
+#include "serialiser/rstlvbase.h"
 
 #include "rstlvutil.h"
 
@@ -53,3 +54,45 @@ TEST(libretroshare_serialiser, test_RsTlvBinData2)
 
 
 
+
+TEST(libretroshare_serialiser, test_RsTlvBinDataSharedView)
+{
+	RsTlvBinaryData  d1(1023);
+	RsTlvBinaryData  d2(1023);
+
+	char data[BIN_LEN] = {0};
+	for(int i = 0; i < BIN_LEN; i++) data[i] = i%13;
+
+	for(uint32_t j = 1; j < BIN_LEN; j *= 2)
+	{
+		d1.setBinData(data, j);
+
+		uint32_t size = d1.TlvSize();
+		RsSharedBuffer buffer = rs_shared_buffer_adopt(rs_malloc(size));
+		uint32_t offset = 0;
+		EXPECT_TRUE(d1.SetTlv(buffer.get(), size, &offset));
+
+		offset = 0;
+		EXPECT_TRUE(d2.GetTlvShared(buffer.get(), size, &offset, buffer));
+		EXPECT_EQ(offset, size);
+		EXPECT_EQ(d1.bin_len, d2.bin_len);
+		EXPECT_TRUE(0 == memcmp(d1.bin_data, d2.bin_data, d1.bin_len));
+
+		/* big payloads point into the buffer and keep it alive, small ones
+		 * are copied */
+		bool isView = j >= RsTlvBinaryData::SHARED_VIEW_MIN_SIZE;
+		EXPECT_EQ(isView, static_cast<bool>(d2.bin_ref));
+		EXPECT_EQ(isView, d2.bin_data == buffer.get() + TLV_HEADER_SIZE);
+
+		buffer.reset();
+		EXPECT_TRUE(0 == memcmp(d1.bin_data, d2.bin_data, d1.bin_len));
+	}
+
+	/* sharing malloc'ed data doesn't copy it */
+	d1.setBinData(data, BIN_LEN);
+	void* oldPtr = d1.bin_data;
+	RsSharedBuffer shared = d1.shareBinData();
+	EXPECT_EQ(oldPtr, static_cast<void*>(shared.get()));
+	d1.TlvClear();
+	EXPECT_TRUE(0 == memcmp(shared.get(), data, BIN_LEN));
+}
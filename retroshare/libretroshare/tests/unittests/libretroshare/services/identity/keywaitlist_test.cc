@@ -0,0 +1,153 @@
+/*******************************************************************************
+ * unittests/libretroshare/services/identity/keywaitlist_test.cc               *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+// from libretroshare
+
+#include "services/p3idservice.h"
+
+static RsGxsId makeId(uint8_t n)
+{
+	uint8_t bytes[RsGxsId::SIZE_IN_BYTES] ;
+	memset(bytes,0,RsGxsId::SIZE_IN_BYTES) ;
+	bytes[0] = n ;
+	return RsGxsId::fromBufferUnsafe(bytes) ;
+}
+
+// Waiter as prefetchKeys() registers it, with a callback that records what it was called with.
+
+static GxsKeyWaitList::Waiter makeWaiter(const std::set<RsGxsId>& ids,rstime_t deadline,int& calls,std::set<RsGxsId>& missing)
+{
+	GxsKeyWaitList::Waiter w ;
+	w.mPending = ids ;
+	w.mDeadline = deadline ;
+	w.mCallback = [&calls,&missing](const std::set<RsGxsId>& m) { ++calls ; missing = m ; } ;
+	return w ;
+}
+
+static void callBack(std::list<GxsKeyWaitList::Waiter>& done)
+{
+	for(auto& w: done)
+		w.mCallback(w.mMissing) ;
+	done.clear() ;
+}
+
+TEST(libretroshare_services, GxsKeyWaitList_callback)
+{
+	GxsKeyWaitList list ;
+	GxsKeyWaitList::Clock::time_point t0 = GxsKeyWaitList::Clock::now() ;
+	RsGxsId a(makeId(1)), b(makeId(2)), c(makeId(3)) ;
+
+	int calls = 0 ;
+	std::set<RsGxsId> missing ;
+
+	for(const RsGxsId& id: {a,b,c})
+		list.keyMissed(id,t0) ;
+	list.addWaiter(makeWaiter({a,b,c},1030,calls,missing)) ;
+
+	EXPECT_TRUE(list.isWaited(a)) ;
+
+	// nothing is called back while keys are still pending
+
+	std::list<GxsKeyWaitList::Waiter> done ;
+	list.collectDone(1000,t0,30,done) ;
+	EXPECT_TRUE(done.empty()) ;
+
+	// a arrives, b cannot be found. The waiter is done once c arrives, and gets b as missing.
+
+	list.keyArrived(a,true,t0 + std::chrono::milliseconds(10)) ;
+	list.keyArrived(b,false,t0 + std::chrono::milliseconds(20)) ;
+
+	list.collectDone(1001,t0,30,done) ;
+	EXPECT_TRUE(done.empty()) ;
+
+	list.keyArrived(c,true,t0 + std::chrono::milliseconds(40)) ;
+	EXPECT_FALSE(list.isWaited(c)) ;
+
+	list.collectDone(1001,t0,30,done) ;
+	ASSERT_EQ(1u,done.size()) ;
+	callBack(done) ;
+
+	EXPECT_EQ(1,calls) ;
+	EXPECT_EQ(std::set<RsGxsId>({b}),missing) ;
+
+	// the callback fires only once
+
+	list.collectDone(1002,t0,30,done) ;
+	EXPECT_TRUE(done.empty()) ;
+
+	const RsIdentityKeyCacheStatistics& stats(list.stats()) ;
+	EXPECT_EQ(2u,stats.mKeysLoaded) ;
+	EXPECT_EQ(1u,stats.mKeysGivenUp) ;
+	EXPECT_EQ(50000u,stats.mTotalWaitUs) ;
+	EXPECT_EQ(40000u,stats.mMaxWaitUs) ;
+}
+
+TEST(libretroshare_services, GxsKeyWaitList_timeout)
+{
+	GxsKeyWaitList list ;
+	GxsKeyWaitList::Clock::time_point t0 = GxsKeyWaitList::Clock::now() ;
+	RsGxsId a(makeId(1)), b(makeId(2)), c(makeId(3)) ;
+
+	int calls1 = 0, calls2 = 0 ;
+	std::set<RsGxsId> missing1, missing2 ;
+
+	list.keyMissed(a,t0) ;
+	list.keyMissed(b,t0) ;
+	list.addWaiter(makeWaiter({a,b},1030,calls1,missing1)) ;
+	list.addWaiter(makeWaiter({b},1060,calls2,missing2)) ;
+
+	// c is missed by a getKey() call, 20 secs later. Missing it again does not reset its waiting time.
+
+	list.keyMissed(c,t0 + std::chrono::seconds(20)) ;
+	list.keyMissed(c,t0 + std::chrono::seconds(40)) ;
+
+	list.keyArrived(a,true,t0 + std::chrono::seconds(1)) ;
+
+	// first waiter is past its deadline: called back with what did not come
+
+	std::list<GxsKeyWaitList::Waiter> done ;
+	list.collectDone(1031,t0 + std::chrono::seconds(31),30,done) ;
+	ASSERT_EQ(1u,done.size()) ;
+	callBack(done) ;
+
+	EXPECT_EQ(1,calls1) ;
+	EXPECT_EQ(std::set<RsGxsId>({b}),missing1) ;
+	EXPECT_EQ(0,calls2) ;
+
+	// b, which has no one waiting after the timeout, is forgotten. c is not, yet.
+
+	EXPECT_FALSE(list.isWaited(b)) ;
+	EXPECT_TRUE(list.isWaited(c)) ;
+	EXPECT_EQ(1u,list.stats().mKeysGivenUp) ;
+
+	// the second waiter still gets called back at its own deadline
+
+	list.collectDone(1061,t0 + std::chrono::seconds(61),30,done) ;
+	ASSERT_EQ(1u,done.size()) ;
+	callBack(done) ;
+
+	EXPECT_EQ(1,calls2) ;
+	EXPECT_EQ(std::set<RsGxsId>({b}),missing2) ;
+	EXPECT_FALSE(list.isWaited(c)) ;
+	EXPECT_EQ(2u,list.stats().mKeysGivenUp) ;
+	EXPECT_EQ(1u,list.stats().mKeysLoaded) ;
+}
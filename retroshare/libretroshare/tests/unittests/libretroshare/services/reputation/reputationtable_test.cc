@@ -0,0 +1,139 @@
+/*******************************************************************************
+ * unittests/libretroshare/services/reputation/reputationtable_test.cc         *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <math.h>
+
+// from libretroshare
+
+#include "services/p3gxsreputation.h"
+
+template<class ID> static ID randomId()
+{
+	uint8_t bytes[ID::SIZE_IN_BYTES];
+	for(uint32_t i=0;i<ID::SIZE_IN_BYTES;++i)
+		bytes[i] = lrand48() ;
+	return ID(bytes) ;
+}
+
+TEST(libretroshare_services, ReputationTable)
+{
+	// Random operations, checked against a plain map. More than 32 friends,
+	// so that the opinion bit array has to grow while entries are stored.
+
+	srand48(42) ;
+
+	std::vector<RsGxsId> ids ;
+	for(int i=0;i<2000;++i)
+		ids.push_back(randomId<RsGxsId>()) ;
+
+	std::vector<RsPeerId> friends ;
+	for(int i=0;i<70;++i)
+		friends.push_back(randomId<RsPeerId>()) ;
+
+	ReputationTable table ;
+	std::map<RsGxsId,std::map<RsPeerId,RsOpinion> > ref ;
+
+	for(int n=0;n<200000;++n)
+	{
+		const RsGxsId& id(ids[lrand48() % ids.size()]) ;
+		uint32_t index = table.find(id) ;
+
+		ASSERT_EQ(ref.find(id) == ref.end(), index == ReputationTable::NOT_FOUND) ;
+
+		if(lrand48() % 20 == 0)
+		{
+			if(index != ReputationTable::NOT_FOUND)
+			{
+				table.erase(index) ;
+				ref.erase(id) ;
+			}
+			continue ;
+		}
+
+		if(index == ReputationTable::NOT_FOUND)
+		{
+			index = table.insert(id) ;
+			ref[id] ;
+		}
+
+		// only the first friends get to vote for a while
+
+		const RsPeerId& from(friends[lrand48() % std::min<int>(friends.size(),10 + n/2000)]) ;
+		RsOpinion op = static_cast<RsOpinion>(lrand48() % 3) ;
+
+		bool changed = table.setOpinion(index,from,op) ;
+		RsOpinion old_op = ref[id].count(from)?ref[id][from]:RsOpinion::NEUTRAL ;
+
+		EXPECT_EQ(changed, old_op != op) ;
+
+		if(op == RsOpinion::NEUTRAL)
+			ref[id].erase(from) ;
+		else
+			ref[id][from] = op ;
+
+		EXPECT_EQ(op, table.opinion(index,from)) ;
+	}
+
+	ASSERT_EQ(ref.size(), table.size()) ;
+
+	for(std::map<RsGxsId,std::map<RsPeerId,RsOpinion> >::const_iterator it(ref.begin());it!=ref.end();++it)
+	{
+		uint32_t index = table.find(it->first) ;
+		ASSERT_NE(ReputationTable::NOT_FOUND, index) ;
+		EXPECT_EQ(it->first, table.id(index)) ;
+
+		std::map<RsPeerId,RsOpinion> opinions ;
+		table.getOpinions(index,opinions) ;
+		EXPECT_EQ(it->second, opinions) ;
+
+		uint32_t pos = 0, neg = 0 ;
+		for(std::map<RsPeerId,RsOpinion>::const_iterator it2(it->second.begin());it2!=it->second.end();++it2)
+			if(it2->second == RsOpinion::POSITIVE)
+				++pos ;
+			else
+				++neg ;
+
+		EXPECT_EQ(pos, table.at(index).mFriendsPositive) ;
+		EXPECT_EQ(neg, table.at(index).mFriendsNegative) ;
+		EXPECT_EQ(pos + neg > 0, table.hasOpinions(index)) ;
+	}
+}
+
+TEST(libretroshare_services, ReputationScore)
+{
+	ReputationTable table ;
+	uint32_t index = table.insert(randomId<RsGxsId>()) ;
+	Reputation& rep(table.at(index)) ;
+
+	rep.updateReputation() ;
+	EXPECT_FLOAT_EQ(1.0f, rep.mFriendAverage) ;
+
+	// anonymous ids: 2 positive votes more than negative => 2 - exp(-2/2)
+
+	for(int i=0;i<3;++i)
+		table.setOpinion(index,randomId<RsPeerId>(),RsOpinion::POSITIVE) ;
+	table.setOpinion(index,randomId<RsPeerId>(),RsOpinion::NEGATIVE) ;
+
+	table.at(index).updateReputation() ;
+	EXPECT_NEAR(2.0f - exp(-1.0f), table.at(index).mFriendAverage, 1e-5) ;
+	EXPECT_FLOAT_EQ(table.at(index).mFriendAverage, table.at(index).mReputationScore) ;
+}
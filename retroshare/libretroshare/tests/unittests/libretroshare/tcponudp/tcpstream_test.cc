@@ -0,0 +1,388 @@
+/*******************************************************************************
+ * unittests/libretroshare/tcponudp/tcpstream_test.cc                          *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+// from libretroshare
+
+#include "tcponudp/tcpstream.h"
+
+// Two TcpStreams are connected back to back through emulated links, which
+// record what goes on the wire and drop the packets a test chooses. The
+// streams take their time stamps from the system clock, so the tests run in
+// real time, over a link with a 100ms round trip time.
+
+static const double LINK_DELAY = 0.05 ;
+static const double CONNECT_TIMEOUT = 10 ;
+
+static double getTS()
+{
+	struct timeval tv ;
+	gettimeofday(&tv,NULL) ;
+	return tv.tv_sec + tv.tv_usec / 1000000.0 ;
+}
+
+struct WirePkt
+{
+	uint32 seqno ;
+	uint32 ackno ;
+	uint16 winsize ;
+	uint16 extensions ;
+	int datasize ;
+	uint8 nSackBlocks ;
+	bool syn ;
+	bool ack ;
+};
+
+class RecordingLink: public UdpPublisher
+{
+public:
+	RecordingLink() : mDest(NULL) {}
+
+	virtual int sendPkt(const void *data,int size,const struct sockaddr_in &/*to*/,int /*ttl*/)
+	{
+		TcpPacket pkt ;
+		if(pkt.readPacket(const_cast<void*>(data),size) < 0)
+			return size ;
+
+		WirePkt w ;
+		w.seqno = pkt.seqno ;
+		w.ackno = pkt.ackno ;
+		w.winsize = pkt.winsize ;
+		w.extensions = pkt.extensions ;
+		w.datasize = pkt.datasize ;
+		w.nSackBlocks = pkt.nSackBlocks ;
+		w.syn = pkt.hasSyn() ;
+		w.ack = pkt.hasAck() ;
+
+		mSent.push_back(w) ;
+
+		if(mOnSend)
+			mOnSend(w) ;
+
+		if(mDrop && mDrop(w))
+			return size ;
+
+		Pkt p ;
+		p.ts = getTS() + LINK_DELAY ;
+		p.data.assign((const uint8_t*)data,(const uint8_t*)data + size) ;
+		mQueue.push_back(p) ;
+
+		return size ;
+	}
+
+	void deliver(double now)
+	{
+		while(!mQueue.empty() && mQueue.front().ts <= now)
+		{
+			Pkt p = mQueue.front() ;
+			mQueue.pop_front() ;
+
+			if(mOnDeliver)
+			{
+				TcpPacket pkt ;
+				pkt.readPacket(p.data.data(),p.data.size()) ;
+				mOnDeliver(pkt) ;
+			}
+			mDest->recvPkt(p.data.data(),p.data.size()) ;
+		}
+	}
+
+	UdpPeer *mDest ;
+	std::vector<WirePkt> mSent ;
+	std::function<bool(const WirePkt&)> mDrop ;		// returns true for the packets to lose
+	std::function<void(const WirePkt&)> mOnSend ;
+	std::function<void(TcpPacket&)> mOnDeliver ;
+
+private:
+	struct Pkt
+	{
+		double ts ;
+		std::vector<uint8_t> data ;
+	};
+	std::deque<Pkt> mQueue ;
+};
+
+class RecordingReceiver: public UdpSubReceiver
+{
+public:
+	explicit RecordingReceiver(UdpPublisher *pub) : UdpSubReceiver(pub) {}
+
+	virtual int recvPkt(void *,int,struct sockaddr_in &) { return 0 ; }
+	virtual int status(std::ostream &) { return 0 ; }
+};
+
+class TcpStreamTest: public ::testing::Test
+{
+protected:
+	TcpStreamTest()
+	    : mRecvA(&mLinkAB), mRecvB(&mLinkBA), mStreamA(&mRecvA), mStreamB(&mRecvB),
+	      mAckedByB(0), mAckSeen(false), mMaxInFlight(0)
+	{
+		mLinkAB.mDest = &mStreamB ;
+		mLinkBA.mDest = &mStreamA ;
+
+		// bytes sent by A and not acknowledged yet, when A sends data
+
+		mLinkBA.mOnDeliver = [this](TcpPacket& pkt)
+		{
+			if(pkt.hasAck())
+			{
+				mAckedByB = pkt.ackno ;
+				mAckSeen = true ;
+			}
+		};
+		mLinkAB.mOnSend = [this](const WirePkt& w)
+		{
+			if(w.datasize > 0 && mAckSeen && w.seqno + w.datasize - mAckedByB > mMaxInFlight)
+				mMaxInFlight = w.seqno + w.datasize - mAckedByB ;
+		};
+	}
+
+	~TcpStreamTest()
+	{
+		mStreamA.close() ;
+		mStreamB.close() ;
+	}
+
+	void tick()
+	{
+		double now = getTS() ;
+		mLinkAB.deliver(now) ;
+		mLinkBA.deliver(now) ;
+		mStreamA.tick() ;
+		mStreamB.tick() ;
+	}
+
+	bool connect(bool extA,bool extB)
+	{
+		mStreamA.setUseExtensions(extA) ;
+		mStreamB.setUseExtensions(extB) ;
+
+		struct sockaddr_in addrA,addrB ;
+		memset(&addrA,0,sizeof(addrA)) ;
+		memset(&addrB,0,sizeof(addrB)) ;
+		addrA.sin_family = AF_INET ;
+		addrB.sin_family = AF_INET ;
+		addrA.sin_port = htons(4001) ;
+		addrB.sin_port = htons(4002) ;
+
+		mStreamB.listenfor(addrA) ;
+		mStreamA.connect(addrB,10) ;
+
+		double start = getTS() ;
+
+		while(!(mStreamA.isConnected() && mStreamB.isConnected()))
+		{
+			if(getTS() - start > CONNECT_TIMEOUT)
+				return false ;
+
+			tick() ;
+			usleep(500) ;
+		}
+		return true ;
+	}
+
+	// Sends a counter pattern from A to B for period seconds. Returns false if B
+	// does not get the data in order.
+
+	bool transfer(double period,uint64_t& received)
+	{
+		char buf[16384] ;
+		uint8_t wnext = 0, rnext = 0 ;
+		bool ok = true ;
+		received = 0 ;
+
+		double start = getTS() ;
+
+		while(getTS() - start < period)
+		{
+			int allowed = std::min(mStreamA.write_allowed(),(int)sizeof(buf)) ;
+
+			if(allowed > 0)
+			{
+				for(int i=0;i<allowed;++i)
+					buf[i] = wnext++ ;
+
+				if(mStreamA.write(buf,allowed) != allowed)
+					return false ;
+			}
+
+			tick() ;
+
+			int n ;
+			while(0 < (n = mStreamB.read(buf,sizeof(buf))))
+			{
+				for(int i=0;i<n;++i)
+					if((uint8_t)buf[i] != rnext++)
+						ok = false ;
+
+				received += n ;
+			}
+			usleep(500) ;
+		}
+		return ok ;
+	}
+
+	static const WirePkt *findSyn(const std::vector<WirePkt>& pkts)
+	{
+		for(uint32_t i=0;i<pkts.size();++i)
+			if(pkts[i].syn)
+				return &pkts[i] ;
+
+		return NULL ;
+	}
+
+	static uint32_t countSacks(const std::vector<WirePkt>& pkts)
+	{
+		uint32_t n = 0 ;
+		for(uint32_t i=0;i<pkts.size();++i)
+			if(pkts[i].nSackBlocks > 0)
+				++n ;
+		return n ;
+	}
+
+	static int maxDataSize(const std::vector<WirePkt>& pkts)
+	{
+		int n = 0 ;
+		for(uint32_t i=0;i<pkts.size();++i)
+			n = std::max(n,pkts[i].datasize) ;
+		return n ;
+	}
+
+	// Loses the n-th data packet A sends, once.
+
+	void dropDataPacket(uint32_t n)
+	{
+		std::shared_ptr<uint32_t> count(new uint32_t(0)) ;
+
+		mLinkAB.mDrop = [count,n](const WirePkt& w) { return w.datasize > 0 && ++*count == n ; } ;
+	}
+
+	RecordingLink mLinkAB, mLinkBA ;
+	RecordingReceiver mRecvA, mRecvB ;
+	TcpStream mStreamA, mStreamB ;
+
+	uint32 mAckedByB ;
+	bool mAckSeen ;
+	uint32 mMaxInFlight ;
+};
+
+TEST_F(TcpStreamTest, negotiated)
+{
+	dropDataPacket(50) ;
+
+	ASSERT_TRUE(connect(true,true)) ;
+
+	// both SYNs advertise SACK, path MTU probing and the window shift
+
+	const WirePkt *synA = findSyn(mLinkAB.mSent) ;
+	const WirePkt *synB = findSyn(mLinkBA.mSent) ;
+	ASSERT_TRUE(synA != NULL) ;
+	ASSERT_TRUE(synB != NULL) ;
+
+	uint16 expected = TCP_EXT_MAGIC | TCP_EXT_SACK | TCP_EXT_PMTU | TCP_WIN_SCALE ;
+	EXPECT_EQ(expected,synA->extensions) ;
+	EXPECT_EQ(expected,synB->extensions) ;
+
+	uint64_t received ;
+	EXPECT_TRUE(transfer(3,received)) ;
+	EXPECT_GT(received,0u) ;
+
+	// The lost packet is reported with SACK blocks.
+
+	EXPECT_GT(countSacks(mLinkBA.mSent),0u) ;
+
+	// Bigger segments are probed for, up to the limit.
+
+	EXPECT_EQ(TCP_MAX_PROBED_SEG,maxDataSize(mLinkAB.mSent)) ;
+
+	// With the scaled window, more than 64 KB can be in flight.
+
+	EXPECT_GT(mMaxInFlight,(uint32)TCP_MAX_WIN) ;
+}
+
+TEST_F(TcpStreamTest, oldPeer)
+{
+	// B behaves as a version without the extensions: none are used, in either direction.
+
+	dropDataPacket(50) ;
+
+	ASSERT_TRUE(connect(true,false)) ;
+
+	const WirePkt *synA = findSyn(mLinkAB.mSent) ;
+	const WirePkt *synB = findSyn(mLinkBA.mSent) ;
+	ASSERT_TRUE(synA != NULL) ;
+	ASSERT_TRUE(synB != NULL) ;
+
+	EXPECT_EQ(TCP_EXT_MAGIC,synA->extensions & TCP_EXT_MAGIC_MASK) ;
+	EXPECT_EQ(0,synB->extensions) ;
+
+	uint64_t received ;
+	EXPECT_TRUE(transfer(3,received)) ;
+	EXPECT_GT(received,0u) ;
+
+	EXPECT_EQ(0u,countSacks(mLinkBA.mSent)) ;
+	EXPECT_EQ(0u,countSacks(mLinkAB.mSent)) ;
+	EXPECT_EQ(MAX_SEG,maxDataSize(mLinkAB.mSent)) ;
+
+	EXPECT_GT(mMaxInFlight,0u) ;
+	EXPECT_LE(mMaxInFlight,(uint32)TCP_MAX_WIN) ;
+}
+
+TEST_F(TcpStreamTest, pathMtuLimit)
+{
+	// The path does not take segments of TCP_MAX_PROBED_SEG bytes. These probes are lost,
+	// their data is sent again in smaller segments, and A stops probing after a few tries.
+
+	const int PATH_LIMIT = 1300 ;
+
+	mLinkAB.mDrop = [PATH_LIMIT](const WirePkt& w) { return w.datasize > PATH_LIMIT ; } ;
+
+	ASSERT_TRUE(connect(true,true)) ;
+
+	uint64_t received ;
+	EXPECT_TRUE(transfer(4,received)) ;
+	EXPECT_GT(received,0u) ;
+
+	uint32_t probes = 0, segments = 0 ;
+
+	for(uint32_t i=0;i<mLinkAB.mSent.size();++i)
+		if(mLinkAB.mSent[i].datasize > PATH_LIMIT)
+			++probes ;
+		else if(mLinkAB.mSent[i].datasize > MAX_SEG)
+			++segments ;
+
+	EXPECT_GE(probes,1u) ;
+	EXPECT_LE(probes,3u) ;
+
+	// the intermediate size that gets through is used
+
+	EXPECT_GT(segments,probes) ;
+}
@@ -0,0 +1,53 @@
+/*******************************************************************************
+ * unittests/libretroshare/turtle/p3turtle_test.cc                             *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+// from libretroshare
+
+#include "turtle/p3turtle.h"
+#include "turtle/rsturtleitem.h"
+#include "ft/ftturtlefiletransferitem.h"
+
+TEST(libretroshare_turtle, TurtleForwardQueueFull)
+{
+	// Items with no retransmission are forwarded even when the next friend's
+	// out queue is full. Generic data is what GXS net tunnels send.
+
+	RsTurtleGenericDataItem generic_data ;
+	RsTurtleGenericFastDataItem fast_data ;
+	RsTurtleFileRequestItem file_request ;
+	RsTurtleFileMapItem file_map ;
+	RsTurtleChunkCrcItem chunk_crc ;
+
+	EXPECT_FALSE(p3turtle::mayDropForwardedItem(&generic_data)) ;
+	EXPECT_FALSE(p3turtle::mayDropForwardedItem(&fast_data)) ;
+	EXPECT_FALSE(p3turtle::mayDropForwardedItem(&file_request)) ;
+	EXPECT_FALSE(p3turtle::mayDropForwardedItem(&file_map)) ;
+	EXPECT_FALSE(p3turtle::mayDropForwardedItem(&chunk_crc)) ;
+
+	// File data has the same priority as generic data, but is requested again
+	// by the downloading end.
+
+	RsTurtleFileDataItem file_data ;
+
+	EXPECT_EQ(generic_data.priority_level(), file_data.priority_level()) ;
+	EXPECT_TRUE(p3turtle::mayDropForwardedItem(&file_data)) ;
+}
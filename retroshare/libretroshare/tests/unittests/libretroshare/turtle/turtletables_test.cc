@@ -0,0 +1,157 @@
+/*******************************************************************************
+ * unittests/libretroshare/turtle/turtletables_test.cc                         *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+// from libretroshare
+
+#include "turtle/turtleroutingtable.h"
+#include "turtle/turtlerequestcache.h"
+#include "turtle/turtlesearchcache.h"
+#include "turtle/rsturtleitem.h"
+
+TEST(libretroshare_turtle, TurtleRequestCache)
+{
+	// 60 secs of life time, i.e. 3 secs per bucket.
+	TurtleRequestCache<uint32_t,uint32_t> cache(60) ;
+	rstime_t now = 1000000 ;
+
+	for(uint32_t i=0;i<100;++i)
+		cache.insert(i,now + i) = 2*i ;
+
+	EXPECT_EQ(cache.size(), 100u) ;
+
+	for(uint32_t i=0;i<100;++i)
+	{
+		uint32_t *v = cache.find(i) ;
+		ASSERT_TRUE(v != NULL) ;
+		EXPECT_EQ(*v, 2*i) ;
+	}
+	EXPECT_TRUE(cache.find(100) == NULL) ;
+
+	// Nothing is dropped before the life time, and everything is dropped
+	// at most one bucket after it.
+
+	cache.expire(now + 59) ;
+	EXPECT_TRUE(cache.find(0) != NULL) ;
+
+	cache.expire(now + 99 + 60 + 3 + 1) ;
+	EXPECT_EQ(cache.size(), 0u) ;
+
+	for(uint32_t i=0;i<100;++i)
+		EXPECT_TRUE(cache.find(i) == NULL) ;
+}
+
+TEST(libretroshare_turtle, TurtleRoutingTable)
+{
+	TurtleRoutingTable table ;
+	TurtlePeerId a = TurtlePeerId::random() ;
+	TurtlePeerId b = TurtlePeerId::random() ;
+	TurtlePeerId src,dst ;
+
+	for(TurtleTunnelId t=0;t<1000;++t)
+		table.addRoute(t,a,b,0) ;
+
+	EXPECT_EQ(table.size(), 1000u) ;
+
+	EXPECT_TRUE(table.route(17,100,false,src,dst)) ;
+	EXPECT_EQ(src, a) ;
+	EXPECT_EQ(dst, b) ;
+	EXPECT_TRUE(table.route(17,50,true,src,dst)) ;
+	EXPECT_FALSE(table.route(1000,50,true,src,dst)) ;
+
+	table.removeRoute(17) ;
+	EXPECT_FALSE(table.route(17,50,true,src,dst)) ;
+	EXPECT_EQ(table.size(), 999u) ;
+
+	table.route(18,300,true,src,dst) ;
+
+	std::vector<TurtleRoutingTable::Activity> activity ;
+	table.collectActivity(activity) ;
+
+	EXPECT_EQ(activity.size(), 999u) ;
+
+	for(uint32_t i=0;i<activity.size();++i)
+		if(activity[i].tunnel_id == 18)
+		{
+			EXPECT_EQ(activity[i].transfered_bytes, 300u) ;
+			EXPECT_GT(activity[i].time_stamp, 0) ;
+		}
+		else
+			EXPECT_EQ(activity[i].transfered_bytes, 0u) ;
+
+	// counters are reset by the collection
+
+	table.collectActivity(activity) ;
+
+	for(uint32_t i=0;i<activity.size();++i)
+		EXPECT_EQ(activity[i].transfered_bytes, 0u) ;
+}
+
+TEST(libretroshare_turtle, TurtleSearchCache)
+{
+	TurtleSearchCache cache(20,2) ;
+	std::vector<TurtleFileInfoV2> results ;
+	rstime_t now = 1000000 ;
+
+	// Keyword searches only differ by case.
+
+	RsTurtleStringSearchRequestItem s1,s2 ;
+	s1.match_string = "Linux ISO" ;
+	s2.match_string = "linux iso" ;
+	s2.request_id = 1234 ;
+
+	EXPECT_EQ(s1.searchKey(), s2.searchKey()) ;
+
+	s2.match_string = "linux  iso" ;
+	EXPECT_NE(s1.searchKey(), s2.searchKey()) ;
+
+	EXPECT_FALSE(cache.find(s1.searchKey(),now,results)) ;
+
+	TurtleFileInfoV2 info ;
+	info.fName = "linux.iso" ;
+	info.fSize = 700 ;
+	results.push_back(info) ;
+
+	cache.store(s1.searchKey(),now,results,1000) ;
+	results.clear() ;
+
+	EXPECT_TRUE(cache.find(s1.searchKey(),now+20,results)) ;
+	ASSERT_EQ(results.size(), 1u) ;
+	EXPECT_EQ(results.front().fName, "linux.iso") ;
+
+	EXPECT_FALSE(cache.find(s1.searchKey(),now+21,results)) ;
+
+	// The cache does not grow beyond its size
+
+	cache.store("a",now,results,1) ;
+	cache.store("b",now,results,1) ;
+	EXPECT_EQ(cache.size(), 2u) ;
+
+	cache.expire(now+21) ;
+	EXPECT_EQ(cache.size(), 0u) ;
+
+	TurtleSearchStatistics stats ;
+	cache.getStatistics(stats) ;
+
+	EXPECT_EQ(stats.hits, 1u) ;
+	EXPECT_EQ(stats.misses, 2u) ;
+	EXPECT_EQ(stats.cpu_saved_us, 1000u) ;
+}
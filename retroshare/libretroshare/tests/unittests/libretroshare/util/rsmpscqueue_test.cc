@@ -0,0 +1,224 @@
+/*******************************************************************************
+ * unittests/libretroshare/util/rsmpscqueue_test.cc                            *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+// from libretroshare
+
+#include "util/rsmpscqueue.h"
+
+TEST(libretroshare_util, RsMpscQueue_capacity)
+{
+	// capacity is rounded up to a power of 2
+
+	RsMpscQueue<int> queue(5) ;
+	EXPECT_EQ(8u,queue.capacity()) ;
+	EXPECT_TRUE(queue.empty()) ;
+
+	bool was_empty ;
+
+	EXPECT_TRUE(queue.push(0,was_empty)) ;
+	EXPECT_TRUE(was_empty) ;
+
+	for(int i=1;i<8;++i)
+	{
+		EXPECT_TRUE(queue.push(i,was_empty)) ;
+		EXPECT_FALSE(was_empty) ;
+	}
+
+	// the last push that fits still succeeds. The queue is then full, and the next push
+	// is accepted all the same, but reports that the producer should slow down.
+
+	EXPECT_TRUE(queue.full()) ;
+	EXPECT_EQ(8u,queue.size()) ;
+
+	EXPECT_FALSE(queue.push(8,was_empty)) ;
+	EXPECT_EQ(9u,queue.size()) ;
+
+	int item ;
+	for(int i=0;i<9;++i)
+	{
+		ASSERT_TRUE(queue.pop(item)) ;
+		EXPECT_EQ(i,item) ;
+	}
+	EXPECT_FALSE(queue.pop(item)) ;
+	EXPECT_FALSE(queue.full()) ;
+	EXPECT_TRUE(queue.empty()) ;
+
+	EXPECT_TRUE(queue.push(9,was_empty)) ;
+	EXPECT_TRUE(was_empty) ;
+}
+
+TEST(libretroshare_util, RsMpscQueue_overflow)
+{
+	RsMpscQueue<int> queue(4) ;
+	bool was_empty ;
+	int item ;
+	int next_in = 0, next_out = 0 ;
+
+	// 10 items in a ring of 4: 6 go to the overflow list
+
+	for(;next_in<10;++next_in)
+		queue.push(next_in,was_empty) ;
+
+	// Popping frees cells in the ring, but as long as the overflow list is not empty,
+	// new items must go after it, and not into the ring.
+
+	for(;next_out<3;++next_out)
+	{
+		ASSERT_TRUE(queue.pop(item)) ;
+		EXPECT_EQ(next_out,item) ;
+	}
+
+	for(;next_in<13;++next_in)
+		queue.push(next_in,was_empty) ;
+
+	while(queue.pop(item))
+		EXPECT_EQ(next_out++,item) ;
+
+	EXPECT_EQ(13,next_out) ;
+	EXPECT_TRUE(queue.empty()) ;
+
+	// once drained, the ring is used again
+
+	RsMpscQueue<int>::Stats stats ;
+	queue.getStats(stats) ;
+	uint64_t overflowed = stats.overflowed ;
+
+	EXPECT_EQ(9u,overflowed) ;
+
+	for(int i=0;i<4;++i)
+		queue.push(i,was_empty) ;
+
+	queue.getStats(stats) ;
+	EXPECT_EQ(overflowed,stats.overflowed) ;
+}
+
+TEST(libretroshare_util, RsMpscQueue_stats)
+{
+	RsMpscQueue<int> queue(4) ;
+	bool was_empty ;
+	int item ;
+
+	RsMpscQueue<int>::Stats stats ;
+	queue.getStats(stats) ;
+
+	EXPECT_EQ(0u,stats.depth) ;
+	EXPECT_EQ(4u,stats.capacity) ;
+	EXPECT_EQ(0u,stats.pushed) ;
+
+	for(int i=0;i<6;++i)
+		queue.push(i,was_empty) ;
+
+	queue.pop(item) ;
+	queue.pop(item) ;
+
+	queue.getStats(stats) ;
+
+	EXPECT_EQ(4u,stats.depth) ;
+	EXPECT_EQ(6u,stats.max_depth) ;
+	EXPECT_EQ(6u,stats.pushed) ;
+	EXPECT_EQ(2u,stats.overflowed) ;
+
+	// items that stayed in the queue for a while show in the waiting times
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(20)) ;
+
+	while(queue.pop(item)) ;
+
+	queue.getStats(stats) ;
+
+	EXPECT_EQ(0u,stats.depth) ;
+	EXPECT_EQ(6u,stats.max_depth) ;
+	EXPECT_GE(stats.max_wait_us,20000u) ;
+	EXPECT_GT(stats.avg_wait_us,0u) ;
+	EXPECT_LE(stats.avg_wait_us,stats.max_wait_us) ;
+}
+
+TEST(libretroshare_util, RsMpscQueue_producers)
+{
+	// Several producers and one consumer, with a ring small enough for the overflow
+	// list to be used a lot. Every item must come out once, and the items of each
+	// producer in the order they were pushed.
+
+	const uint32_t PRODUCERS = 4 ;
+	const uint32_t ITEMS = 50000 ;
+
+	RsMpscQueue<uint32_t> queue(16) ;
+	std::vector<std::thread> producers ;
+
+	for(uint32_t p=0;p<PRODUCERS;++p)
+		producers.push_back(std::thread([&queue,p,ITEMS]()
+		{
+			bool was_empty ;
+
+			for(uint32_t i=0;i<ITEMS;++i)
+			{
+				queue.push((p << 24) | i,was_empty) ;
+
+				if(i % 1000 == 0)
+					std::this_thread::yield() ;
+			}
+		})) ;
+
+	std::vector<uint32_t> next(PRODUCERS,0) ;
+	uint32_t received = 0 ;
+	bool in_order = true ;
+
+	while(received < PRODUCERS*ITEMS)
+	{
+		uint32_t item ;
+
+		if(!queue.pop(item))
+		{
+			std::this_thread::yield() ;
+			continue ;
+		}
+
+		uint32_t p = item >> 24 ;
+		ASSERT_LT(p,PRODUCERS) ;
+
+		if((item & 0xffffff) != next[p])
+			in_order = false ;
+
+		next[p] = (item & 0xffffff) + 1 ;
+		++received ;
+	}
+
+	for(uint32_t p=0;p<PRODUCERS;++p)
+		producers[p].join() ;
+
+	EXPECT_TRUE(in_order) ;
+
+	for(uint32_t p=0;p<PRODUCERS;++p)
+		EXPECT_EQ(ITEMS,next[p]) ;
+
+	uint32_t item ;
+	EXPECT_FALSE(queue.pop(item)) ;
+
+	RsMpscQueue<uint32_t>::Stats stats ;
+	queue.getStats(stats) ;
+
+	EXPECT_EQ(0u,stats.depth) ;
+	EXPECT_EQ(uint64_t(PRODUCERS*ITEMS),stats.pushed) ;
+}
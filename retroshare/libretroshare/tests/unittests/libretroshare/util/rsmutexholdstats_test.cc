@@ -0,0 +1,75 @@
+/*******************************************************************************
+ * unittests/libretroshare/util/rsmutexholdstats_test.cc                       *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <numeric>
+
+// from libretroshare
+
+#include "util/rsthreads.h"
+
+TEST(libretroshare_util, RsMutexHoldStats_buckets)
+{
+	RsMutexHoldStats stats ;
+
+	stats.record(0) ;
+	stats.record(1) ;
+	stats.record(2) ;
+	stats.record(3) ;
+	stats.record(1000) ;		// 512 <= 1000 < 1024
+	stats.record(1ull << 40) ;	// beyond the last bucket
+
+	std::vector<uint64_t> counts ;
+	uint64_t max_us, total_us ;
+	stats.getHistogram(counts,max_us,total_us) ;
+
+	ASSERT_EQ(counts.size(), (size_t)RsMutexHoldStats::NB_BUCKETS) ;
+	EXPECT_EQ(counts[0], 2u) ;
+	EXPECT_EQ(counts[1], 2u) ;
+	EXPECT_EQ(counts[9], 1u) ;
+	EXPECT_EQ(counts[RsMutexHoldStats::NB_BUCKETS-1], 1u) ;
+	EXPECT_EQ(std::accumulate(counts.begin(),counts.end(),uint64_t(0)), 6u) ;
+	EXPECT_EQ(max_us, 1ull << 40) ;
+	EXPECT_EQ(total_us, 1006 + (1ull << 40)) ;
+}
+
+TEST(libretroshare_util, RsMutexHoldStats_tracking)
+{
+	RsMutexHoldStats stats ;
+	RsMutex mtx("test") ;
+	mtx.trackHoldTime(&stats) ;
+
+	{
+		RS_STACK_MUTEX(mtx) ;
+		std::this_thread::sleep_for(std::chrono::milliseconds(5)) ;
+	}
+	{
+		RS_STACK_MUTEX(mtx) ;
+	}
+
+	std::vector<uint64_t> counts ;
+	uint64_t max_us, total_us ;
+	stats.getHistogram(counts,max_us,total_us) ;
+
+	EXPECT_EQ(std::accumulate(counts.begin(),counts.end(),uint64_t(0)), 2u) ;
+	EXPECT_GE(max_us, 5000u) ;
+	EXPECT_GE(total_us, max_us) ;
+}
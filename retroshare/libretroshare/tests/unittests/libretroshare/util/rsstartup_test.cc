@@ -0,0 +1,149 @@
+/*******************************************************************************
+ * unittests/libretroshare/util/rsstartup_test.cc                              *
+ *                                                                             *
+ * Copyright (C) 2021, Retroshare team <retroshare.team@gmailcom>              *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Lesser General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Lesser General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <set>
+
+// from libretroshare
+
+#include "util/rsstartup.h"
+
+TEST(libretroshare_util, RsStartupScheduler)
+{
+	std::mutex mtx ;
+	std::vector<std::string> order ;
+
+	auto task = [&](const std::string& name)
+	{
+		return [&mtx,&order,name]()
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10)) ;
+
+			std::lock_guard<std::mutex> lock(mtx) ;
+			order.push_back(name) ;
+		};
+	};
+	auto position = [&](const std::string& name)
+	{
+		return std::find(order.begin(),order.end(),name) - order.begin() ;
+	};
+
+	RsStartupScheduler s(4) ;
+
+	// dependencies can be added after the tasks that need them
+
+	s.addTask("forums", task("forums"), { "circles" }) ;
+	s.addTask("circles", task("circles"), { "ids" }) ;
+	s.addTask("channels", task("channels"), { "ids" }) ;
+	s.addTask("ids", task("ids")) ;
+	s.addTask("files", task("files")) ;
+
+	EXPECT_TRUE(s.wait("circles")) ;
+	{
+		std::lock_guard<std::mutex> lock(mtx) ;
+		EXPECT_LT(position("ids"), position("circles")) ;
+		EXPECT_LT(position("circles"), (long)order.size()) ;
+	}
+	EXPECT_FALSE(s.wait("unknown")) ;
+
+	s.waitAll() ;
+
+	ASSERT_EQ(5u, order.size()) ;
+	EXPECT_LT(position("ids"), position("circles")) ;
+	EXPECT_LT(position("circles"), position("forums")) ;
+	EXPECT_LT(position("ids"), position("channels")) ;
+}
+
+TEST(libretroshare_util, RsStartupSchedulerMissingDependency)
+{
+	std::atomic<int> runs(0) ;
+
+	RsStartupScheduler s(2) ;
+
+	s.addTask("a", [&runs]() { ++runs ; }) ;
+	s.addTask("b", [&runs]() { ++runs ; }, { "never added" }) ;
+	s.addTask("c", [&runs]() { ++runs ; }, { "b" }) ;
+
+	// waiting must not block forever: tasks that can never run are skipped
+
+	EXPECT_TRUE(s.wait("c")) ;
+	s.waitAll() ;
+
+	EXPECT_EQ(1, runs.load()) ;
+}
+
+TEST(libretroshare_util, RsStartupSchedulerWaiterTasks)
+{
+	std::mutex mtx ;
+	std::vector<std::string> order ;
+	std::set<std::thread::id> loaders ;
+
+	auto read = [&](const std::string& name) { return [&,name]() { std::lock_guard<std::mutex> lock(mtx) ; order.push_back(name) ; } ; } ;
+	auto load = [&](const std::string& name) { return [&,name]() { std::lock_guard<std::mutex> lock(mtx) ; order.push_back(name) ; loaders.insert(std::this_thread::get_id()) ; } ; } ;
+	auto position = [&order](const std::string& name) { return std::find(order.begin(),order.end(),name) - order.begin() ; } ;
+
+	RsStartupScheduler s(4) ;
+
+	// as for the config files: read on the workers, loaded by the caller, forums after circles after ids
+
+	s.addWaiterTask("load forums", load("load forums"), { "read forums", "load circles" }) ;
+	s.addWaiterTask("load ids", load("load ids"), { "read ids" }) ;
+	s.addWaiterTask("load circles", load("load circles"), { "read circles", "load ids" }) ;
+	s.addTask("read forums", read("read forums")) ;
+	s.addTask("read circles", read("read circles")) ;
+	s.addTask("read ids", read("read ids")) ;
+
+	EXPECT_TRUE(s.wait("load circles")) ;
+	{
+		std::lock_guard<std::mutex> lock(mtx) ;
+		EXPECT_LT(position("load circles"), (long)order.size()) ;
+	}
+
+	s.waitAll() ;
+
+	ASSERT_EQ(6u, order.size()) ;
+	EXPECT_LT(position("read ids"), position("load ids")) ;
+	EXPECT_LT(position("load ids"), position("load circles")) ;
+	EXPECT_LT(position("read circles"), position("load circles")) ;
+	EXPECT_LT(position("load circles"), position("load forums")) ;
+	EXPECT_LT(position("read forums"), position("load forums")) ;
+
+	ASSERT_EQ(1u, loaders.size()) ;
+	EXPECT_EQ(std::this_thread::get_id(), *loaders.begin()) ;
+}
+
+TEST(libretroshare_util, RsStartupSchedulerParallel)
+{
+	// tasks that wait, as when reading from disc, overlap even on a single core
+
+	auto start = std::chrono::steady_clock::now() ;
+	{
+		RsStartupScheduler s(4) ;
+
+		for(int i=0;i<4;++i)
+			s.addTask("sleep " + std::to_string(i), []() { std::this_thread::sleep_for(std::chrono::milliseconds(100)) ; }) ;
+	}
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() ;
+
+	EXPECT_LT(elapsed, 300) ;
+}
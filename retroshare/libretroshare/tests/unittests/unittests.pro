@@ -294,6 +294,47 @@ SOURCES +=  unittests.cc \
 
 SOURCES += libretroshare/crypto/chacha20_test.cc
 
+################################### chat ###################################
+
+SOURCES += libretroshare/chat/chatlobbymsgcache_test.cc
+
+################################### pqi ####################################
+
+SOURCES += libretroshare/pqi/pqibandwidth_test.cc \
+	libretroshare/pqi/p3historystore_test.cc \
+	libretroshare/pqi/pqiqos_test.cc \
+	libretroshare/pqi/pqiservice_test.cc \
+	libretroshare/pqi/pqisslhandshakepool_test.cc \
+	libretroshare/pqi/authenticatedcertcache_test.cc
+
+#################################### ft ####################################
+
+SOURCES += libretroshare/ft/ftchunkmap_test.cc \
+           libretroshare/ft/ftchecksumpool_test.cc \
+           libretroshare/ft/fttransfermodule_test.cc
+
+############################### file_sharing ###############################
+
+SOURCES += libretroshare/file_sharing/remotefilehashindex_test.cc \
+	libretroshare/file_sharing/filelistcontainer_test.cc
+
+################################# tcponudp #################################
+
+bitdht {
+	SOURCES += libretroshare/tcponudp/tcpstream_test.cc
+}
+
+################################### turtle #################################
+
+SOURCES += libretroshare/turtle/turtletables_test.cc \
+	libretroshare/turtle/p3turtle_test.cc
+
+################################### util ###################################
+
+SOURCES += libretroshare/util/rsstartup_test.cc \
+	libretroshare/util/rsmutexholdstats_test.cc \
+	libretroshare/util/rsmpscqueue_test.cc
+
 ################################ Serialiser ################################
 HEADERS +=  libretroshare/serialiser/support.h \
 	libretroshare/serialiser/rstlvutil.h \
@@ -335,7 +376,8 @@ HEADERS +=  libretroshare/gxs/nxs_test/nxsdummyservices.h \
 	libretroshare/gxs/nxs_test/nxsmsgsync_test.h \
 	libretroshare/gxs/nxs_test/nxstesthub.h \
 	libretroshare/gxs/nxs_test/nxstestscenario.h \
-	libretroshare/gxs/nxs_test/nxsgrpsyncdelayed.h
+	libretroshare/gxs/nxs_test/nxsgrpsyncdelayed.h \
+	libretroshare/gxs/nxs_test/nxsmsgchain_test.h
 
 SOURCES +=  libretroshare/gxs/nxs_test/nxsdummyservices.cc \
 	libretroshare/gxs/nxs_test/nxsgrptestscenario.cc \
@@ -344,7 +386,8 @@ SOURCES +=  libretroshare/gxs/nxs_test/nxsdummyservices.cc \
 	libretroshare/gxs/nxs_test/rsgxsnetservice_test.cc \
 	libretroshare/gxs/nxs_test/nxsmsgsync_test.cc \
 	libretroshare/gxs/nxs_test/nxsgrpsync_test.cc \ 
-	libretroshare/gxs/nxs_test/nxsgrpsyncdelayed.cc
+	libretroshare/gxs/nxs_test/nxsgrpsyncdelayed.cc \
+	libretroshare/gxs/nxs_test/nxsmsgchain_test.cc
 	
 HEADERS += libretroshare/gxs/gen_exchange/genexchangetester.h \
 	libretroshare/gxs/gen_exchange/gxspublishmsgtest.h \
@@ -371,6 +414,9 @@ HEADERS += libretroshare/gxs/data_service/rsdataservice_test.h \
 
 SOURCES += libretroshare/gxs/data_service/rsdataservice_test.cc \
 	libretroshare/gxs/data_service/rsgxsdata_test.cc \
+	libretroshare/gxs/data_service/rsdataservice_expiry_test.cc \
+	libretroshare/gxs/data_service/rsdataservice_wal_test.cc \
+	libretroshare/gxs/data_service/rsdataservice_blob_test.cc \
 
 
 ################################ dbase #####################################
@@ -387,6 +433,8 @@ SOURCES += libretroshare/gxs/data_service/rsdataservice_test.cc \
 ############################### services ###################################
 
 SOURCES += libretroshare/services/status/status_test.cc \
+	libretroshare/services/reputation/reputationtable_test.cc \
+	libretroshare/services/identity/keywaitlist_test.cc \
 
 ############################### gxs ########################################
 